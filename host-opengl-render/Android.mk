@@ -10,6 +10,7 @@ LOCAL_SRC_FILES:=ColorBuffer.cpp \
                  GL2Dispatch.cpp \
                  GLDecoder.cpp \
                  GLDispatch.cpp \
+                 HeadlessDisplay.cpp \
                  glUtils.cpp \
                  lazy_instance.cpp \
                  main.cpp \
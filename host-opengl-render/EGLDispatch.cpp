@@ -7,7 +7,11 @@ EGLDispatch s_egl;
 
 bool init_egl_dispatch()
 {
-    osUtils::dynLibrary *lib = osUtils::dynLibrary::open("/vendor/lib64/egl/libEGL_mtk.so");
+    // ANDROID_EGL_LIB overrides the vendor library, e.g. with Mesa's
+    // to render in software on a host without a GPU
+    const char* libName = getenv("ANDROID_EGL_LIB");
+    if (!libName) libName = "/vendor/lib64/egl/libEGL_mtk.so";
+    osUtils::dynLibrary *lib = osUtils::dynLibrary::open(libName);
     if (!lib) return NULL;
 
     s_egl.eglGetError = (eglGetError_t) lib->findSymbol("eglGetError");
@@ -27,6 +27,31 @@
 FrameBuffer *FrameBuffer::s_theFrameBuffer = NULL;
 HandleType FrameBuffer::s_nextHandle = 0;
 
+//
+// Choose a config for the given attributes.  EGL platforms without a
+// window system, like Mesa's surfaceless platform, have no window
+// configs at all; when nothing matches, EGL_WINDOW_BIT is dropped from
+// the surface type and the framebuffer only renders into pbuffers.
+//
+static bool chooseConfig(EGLDisplay p_dpy, EGLint *p_attribs,
+                         EGLConfig *p_config)
+{
+    int n;
+    if (s_egl.eglChooseConfig(p_dpy, p_attribs, p_config, 1, &n) && n > 0) {
+        return true;
+    }
+
+    for (EGLint *attrib = p_attribs; attrib[0] != EGL_NONE; attrib += 2) {
+        if (attrib[0] == EGL_SURFACE_TYPE &&
+            (attrib[1] & EGL_WINDOW_BIT)) {
+            attrib[1] &= ~EGL_WINDOW_BIT;
+            return s_egl.eglChooseConfig(p_dpy, p_attribs, p_config, 1, &n) &&
+                   n > 0;
+        }
+    }
+    return false;
+}
+
 #ifdef WITH_GLES2
 static char* getGLES2ExtensionString(EGLDisplay p_dpy)
 {
@@ -39,9 +64,7 @@ static char* getGLES2ExtensionString(EGLDisplay p_dpy)
         EGL_NONE
     };
 
-    int n;
-    if (!s_egl.eglChooseConfig(p_dpy, configAttribs,
-                               &config, 1, &n)) {
+    if (!chooseConfig(p_dpy, configAttribs, &config)) {
         return NULL;
     }
 
@@ -182,9 +205,7 @@ bool FrameBuffer::initialize(int width, int height)
     };
 #endif
 
-    int n;
-    if (!s_egl.eglChooseConfig(fb->m_eglDisplay, configAttribs,
-                               &fb->m_eglConfig, 1, &n)) {
+    if (!chooseConfig(fb->m_eglDisplay, configAttribs, &fb->m_eglConfig)) {
         ERR("Failed on eglChooseConfig\n");
         free(gl2Extensions);
         delete fb;
@@ -376,6 +397,7 @@ FrameBuffer::FrameBuffer(int p_width, int p_height) :
     m_statsNumFrames(0),
     m_statsStartTime(0LL),
     m_onPost(NULL),
+    m_onPostReady(NULL),
     m_onPostContext(NULL),
     m_fbImage(NULL),
     m_glVendor(NULL),
@@ -390,16 +412,19 @@ FrameBuffer::~FrameBuffer()
     free(m_fbImage);
 }
 
-void FrameBuffer::setPostCallback(OnPostFn onPost, void* onPostContext)
+void FrameBuffer::setPostCallback(OnPostFn onPost, void* onPostContext,
+                                  OnPostReadyFn onPostReady)
 {
     emugl::Mutex::AutoLock mutex(m_lock);
     m_onPost = onPost;
+    m_onPostReady = onPostReady;
     m_onPostContext = onPostContext;
     if (m_onPost && !m_fbImage) {
         m_fbImage = (unsigned char*)malloc(4 * m_width * m_height);
         if (!m_fbImage) {
             ERR("out of memory, cancelling OnPost callback");
             m_onPost = NULL;
+            m_onPostReady = NULL;
             m_onPostContext = NULL;
             return;
         }
@@ -821,8 +846,9 @@ bool FrameBuffer::post(HandleType p_colorbuffer, bool needLock)
 
         m_lastPostedColorBuffer = p_colorbuffer;
         if (!m_subWin) {
-            // no subwindow created for the FB output
-            // cannot post the colorbuffer
+            // no subwindow created for the FB output, only
+            // the callback (if any) gets the colorbuffer
+            postCallback_locked((*c).second.cb);
             if (needLock) m_lock.unlock();
             return ret;
         }
@@ -870,11 +896,7 @@ bool FrameBuffer::post(HandleType p_colorbuffer, bool needLock)
         //
         // Send framebuffer (without FPS overlay) to callback
         //
-        if (m_onPost) {
-            (*c).second.cb->readback(m_fbImage);
-            m_onPost(m_onPostContext, m_width, m_height, -1,
-                    GL_RGBA, GL_UNSIGNED_BYTE, m_fbImage);
-        }
+        postCallback_locked((*c).second.cb);
 
     }
 
@@ -882,6 +904,27 @@ bool FrameBuffer::post(HandleType p_colorbuffer, bool needLock)
     return ret;
 }
 
+void FrameBuffer::postCallback_locked(ColorBufferPtr& p_cb)
+{
+    if (!m_onPost) {
+        return;
+    }
+
+    // the image buffer is sized for the framebuffer
+    if ((int)p_cb->getWidth() > m_width || (int)p_cb->getHeight() > m_height) {
+        return;
+    }
+
+    // let the callback skip the readback when it has no use for the frame
+    if (m_onPostReady && !m_onPostReady(m_onPostContext)) {
+        return;
+    }
+
+    p_cb->readback(m_fbImage);
+    m_onPost(m_onPostContext, p_cb->getWidth(), p_cb->getHeight(), -1,
+             p_cb->getFormat(), GL_UNSIGNED_BYTE, m_fbImage);
+}
+
 bool FrameBuffer::repost()
 {
     if (m_lastPostedColorBuffer) {
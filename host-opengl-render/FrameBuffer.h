@@ -26,6 +26,11 @@
 #include "egl.h"
 
 typedef uint32_t HandleType;
+
+// Called before the readback of a posted frame; returning false skips the
+// frame and its OnPostFn call.
+typedef bool (*OnPostReadyFn)(void* context);
+
 struct ColorBufferRef {
     ColorBufferPtr cb;
     uint32_t refcount;  // number of client-side references
@@ -59,7 +64,8 @@ public:
     int getWidth() const { return m_width; }
     int getHeight() const { return m_height; }
 
-    void setPostCallback(OnPostFn onPost, void* onPostContext);
+    void setPostCallback(OnPostFn onPost, void* onPostContext,
+                         OnPostReadyFn onPostReady = NULL);
 
     void getGLStrings(const char** vendor, const char** renderer, const char** version) const {
         *vendor = m_glVendor;
@@ -103,6 +109,7 @@ private:
     HandleType genHandle();
     void initGLState();
     bool bindSubwin_locked();
+    void postCallback_locked(ColorBufferPtr& p_cb);
 
 private:
     static FrameBuffer *s_theFrameBuffer;
@@ -139,6 +146,7 @@ private:
     bool m_fpsStats;
 
     OnPostFn m_onPost;
+    OnPostReadyFn m_onPostReady;
     void* m_onPostContext;
     unsigned char* m_fbImage;
 
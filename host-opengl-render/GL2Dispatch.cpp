@@ -34,7 +34,11 @@ static osUtils::dynLibrary *s_gles2_lib = NULL;
 
 bool init_gl2_dispatch()
 {
-    s_gles2_lib = osUtils::dynLibrary::open("/vendor/lib64/egl/libGLESv2_mtk.so");
+    // ANDROID_GLESv2_LIB overrides the vendor library, e.g. with Mesa's
+    // to render in software on a host without a GPU
+    const char* libName = getenv("ANDROID_GLESv2_LIB");
+    if (!libName) libName = "/vendor/lib64/egl/libGLESv2_mtk.so";
+    s_gles2_lib = osUtils::dynLibrary::open(libName);
     if (!s_gles2_lib) return false;
 
     s_gl2.glActiveTexture = (glActiveTexture_server_proc_t) s_gles2_lib->findSymbol("glActiveTexture");
@@ -30,7 +30,11 @@ static osUtils::dynLibrary *s_gles_lib = NULL;
 
 bool init_gl_dispatch()
 {
-    s_gles_lib = osUtils::dynLibrary::open("/vendor/lib64/egl/libGLESv1_CM_mtk.so");
+    // ANDROID_GLESv1_LIB overrides the vendor library, e.g. with Mesa's
+    // to render in software on a host without a GPU
+    const char* libName = getenv("ANDROID_GLESv1_LIB");
+    if (!libName) libName = "/vendor/lib64/egl/libGLESv1_CM_mtk.so";
+    s_gles_lib = osUtils::dynLibrary::open(libName);
     if (!s_gles_lib) return false;
 
     s_gl.glAlphaFunc = (glAlphaFunc_t) s_gles_lib->findSymbol("glAlphaFunc");
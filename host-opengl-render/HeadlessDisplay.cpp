@@ -0,0 +1,253 @@
+/*
+* Copyright (C) 2011 The Android Open Source Project
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+#include "HeadlessDisplay.h"
+#include "FrameBuffer.h"
+#include "ErrorLog.h"
+#include "TimeUtils.h"
+#include "gl.h"
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+// how often the thread checks whether a skipped frame can be reposted
+static const int s_retryMS = 5;
+
+HeadlessDisplay::HeadlessDisplay() :
+    m_path(NULL),
+    m_header(NULL),
+    m_mapSize(0),
+    m_back(0),
+    m_interval(0),
+    m_lastPublish(0LL),
+    m_pending(false),
+    m_exiting(false)
+{
+    memset(m_written, 0, sizeof(m_written));
+}
+
+HeadlessDisplay::~HeadlessDisplay()
+{
+    if (m_header) {
+        munmap(m_header, m_mapSize);
+    }
+    if (m_path) {
+        unlink(m_path);
+        free(m_path);
+    }
+}
+
+HeadlessDisplay *HeadlessDisplay::create(const char *p_path,
+                                         int p_width, int p_height,
+                                         int p_maxFps)
+{
+    if (p_width <= 0 || p_height <= 0 || p_maxFps < 0) {
+        return NULL;
+    }
+
+    HeadlessDisplay *hd = new HeadlessDisplay();
+    hd->m_interval = p_maxFps ? 1000 / p_maxFps : 0;
+
+    uint32_t stride = p_width * 4;
+    uint32_t offset = (sizeof(HeadlessFrameHeader) + 4095) & ~4095;
+    uint32_t bufferSize = (stride * p_height + 4095) & ~4095;
+    hd->m_mapSize = offset + (size_t)bufferSize * HEADLESS_FRAME_BUFFERS;
+
+    //
+    // build the file under a temporary name and rename it, so that
+    // a consumer never sees it half initialized
+    //
+    size_t tmpLen = strlen(p_path) + 5;
+    char *tmpPath = (char *)malloc(tmpLen);
+    snprintf(tmpPath, tmpLen, "%s.tmp", p_path);
+
+    int fd = open(tmpPath, O_RDWR | O_CREAT | O_TRUNC, 0600);
+    if (fd < 0) {
+        ERR("HeadlessDisplay: cannot create %s\n", tmpPath);
+        free(tmpPath);
+        delete hd;
+        return NULL;
+    }
+
+    void *map = MAP_FAILED;
+    if (ftruncate(fd, hd->m_mapSize) == 0) {
+        map = mmap(NULL, hd->m_mapSize, PROT_READ | PROT_WRITE, MAP_SHARED,
+                   fd, 0);
+    }
+    close(fd);
+    if (map == MAP_FAILED) {
+        ERR("HeadlessDisplay: cannot map %s\n", tmpPath);
+        unlink(tmpPath);
+        free(tmpPath);
+        delete hd;
+        return NULL;
+    }
+
+    HeadlessFrameHeader *header = (HeadlessFrameHeader *)map;
+    header->version = HEADLESS_FRAME_VERSION;
+    header->width = p_width;
+    header->height = p_height;
+    header->stride = stride;
+    header->offset = offset;
+    header->buffer_size = bufferSize;
+    header->middle = 1;
+    header->front = 2;
+    header->frames = 0;
+    header->dropped = 0;
+    __atomic_store_n(&header->magic, HEADLESS_FRAME_MAGIC, __ATOMIC_RELEASE);
+    hd->m_header = header;
+    hd->m_back = 0;
+
+    if (rename(tmpPath, p_path) < 0) {
+        ERR("HeadlessDisplay: cannot rename %s to %s\n", tmpPath, p_path);
+        unlink(tmpPath);
+        free(tmpPath);
+        delete hd;
+        return NULL;
+    }
+    free(tmpPath);
+    hd->m_path = strdup(p_path);
+
+    return hd;
+}
+
+int HeadlessDisplay::Main()
+{
+    while (!m_exiting) {
+        TimeSleepMS(s_retryMS);
+
+        bool repost;
+        m_lock.lock();
+        repost = m_pending && ready_locked(GetCurrentTimeMS());
+        m_lock.unlock();
+
+        //
+        // the last posted frame was skipped and the consumer can
+        // take a frame again: post it once more
+        //
+        if (repost) {
+            FrameBuffer *fb = FrameBuffer::getFB();
+            if (fb) {
+                fb->repost();
+            }
+        }
+    }
+    return 0;
+}
+
+void HeadlessDisplay::stop()
+{
+    int status;
+
+    m_exiting = true;
+    wait(&status);
+}
+
+bool HeadlessDisplay::ready_locked(long long p_now)
+{
+    // the consumer has not taken the previous frame yet
+    if (__atomic_load_n(&m_header->middle, __ATOMIC_ACQUIRE) &
+        HEADLESS_FRAME_FRESH) {
+        return false;
+    }
+    return !m_interval || p_now - m_lastPublish >= m_interval;
+}
+
+bool HeadlessDisplay::onPostReady(void *p_context)
+{
+    HeadlessDisplay *hd = (HeadlessDisplay *)p_context;
+    emugl::Mutex::AutoLock mutex(hd->m_lock);
+
+    if (!hd->ready_locked(GetCurrentTimeMS())) {
+        hd->m_pending = true;
+        hd->m_header->dropped++;
+        return false;
+    }
+    return true;
+}
+
+void HeadlessDisplay::onPost(void *p_context, int p_width, int p_height,
+                             int p_ydir, int p_format, int p_type,
+                             unsigned char *p_pixels)
+{
+    HeadlessDisplay *hd = (HeadlessDisplay *)p_context;
+    emugl::Mutex::AutoLock mutex(hd->m_lock);
+
+    if (p_type != GL_UNSIGNED_BYTE ||
+        (p_format != GL_RGBA && p_format != GL_RGB) ||
+        p_width > (int)hd->m_header->width ||
+        p_height > (int)hd->m_header->height) {
+        return;
+    }
+    hd->publish(p_width, p_height, p_ydir, p_format, p_pixels);
+}
+
+void HeadlessDisplay::publish(int p_width, int p_height, int p_ydir,
+                              int p_format, const unsigned char *p_pixels)
+{
+    HeadlessFrameHeader *header = m_header;
+    unsigned char *buffer = (unsigned char *)header + header->offset +
+                            (size_t)m_back * header->buffer_size;
+    int bpp = p_format == GL_RGBA ? 4 : 3;
+    // glReadPixels() rows are aligned to GL_PACK_ALIGNMENT, 4 by default
+    int srcStride = (p_width * bpp + 3) & ~3;
+
+    //
+    // convert to x8r8g8b8 and flip to top-to-bottom order in one pass
+    //
+    for (int y = 0; y < p_height; y++) {
+        int srcY = p_ydir < 0 ? p_height - 1 - y : y;
+        const unsigned char *src = p_pixels + (size_t)srcY * srcStride;
+        uint32_t *dst = (uint32_t *)(buffer + (size_t)y * header->stride);
+
+        for (int x = 0; x < p_width; x++, src += bpp) {
+            dst[x] = 0xff000000u | (src[0] << 16) | (src[1] << 8) | src[2];
+        }
+    }
+
+    //
+    // the frame is smaller than one written to this buffer before: clear
+    // what is left of the old one, the consumer shows the whole buffer
+    //
+    int oldWidth = m_written[m_back][0];
+    int oldHeight = m_written[m_back][1];
+    if (oldWidth > p_width) {
+        for (int y = 0; y < p_height && y < oldHeight; y++) {
+            memset(buffer + (size_t)y * header->stride + p_width * 4, 0,
+                   (oldWidth - p_width) * 4);
+        }
+    }
+    for (int y = p_height; y < oldHeight; y++) {
+        memset(buffer + (size_t)y * header->stride, 0, oldWidth * 4);
+    }
+    m_written[m_back][0] = p_width;
+    m_written[m_back][1] = p_height;
+
+    uint32_t old = __atomic_exchange_n(&header->middle,
+                                       m_back | HEADLESS_FRAME_FRESH,
+                                       __ATOMIC_ACQ_REL);
+    if (old & HEADLESS_FRAME_FRESH) {
+        // only when a frame is posted without asking onPostReady()
+        header->dropped++;
+    }
+    m_back = old & ~HEADLESS_FRAME_FRESH;
+    header->frames++;
+    m_lastPublish = GetCurrentTimeMS();
+    m_pending = false;
+}
@@ -0,0 +1,68 @@
+/*
+* Copyright (C) 2011 The Android Open Source Project
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+#ifndef _LIBRENDER_HEADLESS_DISPLAY_H
+#define _LIBRENDER_HEADLESS_DISPLAY_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "headless_frame.h"
+#include "mutex.h"
+#include "osThread.h"
+
+//
+// Publishes the frames posted to the FrameBuffer through a shared frame
+// file (see headless_frame.h) instead of a window.  It is registered as the
+// FrameBuffer post callback; its thread reposts the last frame when one
+// was skipped, so that the consumer always ends up with the latest frame.
+//
+class HeadlessDisplay : public osUtils::Thread
+{
+public:
+    // Creates the frame file at p_path for frames of up to
+    // p_width x p_height pixels.  At most p_maxFps frames are published
+    // per second, or all of them when p_maxFps is 0.
+    static HeadlessDisplay *create(const char *p_path,
+                                   int p_width, int p_height, int p_maxFps);
+    virtual ~HeadlessDisplay();
+
+    virtual int Main();
+    void stop();
+
+    static bool onPostReady(void *p_context);
+    static void onPost(void *p_context, int p_width, int p_height, int p_ydir,
+                       int p_format, int p_type, unsigned char *p_pixels);
+
+private:
+    HeadlessDisplay();
+    bool ready_locked(long long p_now);
+    void publish(int p_width, int p_height, int p_ydir, int p_format,
+                 const unsigned char *p_pixels);
+
+private:
+    char *m_path;
+    HeadlessFrameHeader *m_header;
+    size_t m_mapSize;
+    uint32_t m_back;
+    // size of the last frame written to each buffer
+    int m_written[HEADLESS_FRAME_BUFFERS][2];
+    int m_interval;
+    emugl::Mutex m_lock;
+    long long m_lastPublish;
+    bool m_pending;
+    volatile bool m_exiting;
+};
+
+#endif
@@ -0,0 +1,78 @@
+/*
+* Copyright (C) 2011 The Android Open Source Project
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+#ifndef _LIBRENDER_HEADLESS_FRAME_H
+#define _LIBRENDER_HEADLESS_FRAME_H
+
+/* This header must be usable from C code.
+ *
+ * Layout of the frame file shared between a headless renderer (see
+ * initHeadlessDisplay() in render_api.h) and the process showing its frames,
+ * e.g. QEMU's -gles-display.  The file starts with a HeadlessFrameHeader
+ * followed by HEADLESS_FRAME_BUFFERS frame buffers.  Pixels are 32 bit
+ * x8r8g8b8 in host byte order, rows are top-to-bottom.
+ *
+ * The buffers form a triple buffer.  The renderer owns one (the back
+ * buffer), the consumer owns another (the front buffer, which it keeps in
+ * the header's front field) and the last one, in the middle field, is
+ * being handed over.  After writing a frame to its back buffer the renderer
+ * swaps it into middle with HEADLESS_FRAME_FRESH set, and takes the old
+ * middle buffer as its next back buffer.  When the consumer sees
+ * HEADLESS_FRAME_FRESH in middle, it swaps its front buffer into middle
+ * and shows the buffer it got.  Both swaps are atomic exchanges, so
+ * neither side ever waits for the other.
+ *
+ * While HEADLESS_FRAME_FRESH is set the consumer has not taken the last
+ * frame yet, and the renderer skips new frames instead of reading them back.
+ *
+ * The renderer creates a new file each time it starts, so consumers should
+ * reopen the path when its inode changes.  magic is written last.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define HEADLESS_FRAME_MAGIC    0x48474c46  /* "HGLF" */
+#define HEADLESS_FRAME_VERSION  1
+#define HEADLESS_FRAME_BUFFERS  3
+#define HEADLESS_FRAME_FRESH    0x80000000u
+
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t width;
+    uint32_t height;
+    uint32_t stride;        /* bytes per row */
+    uint32_t offset;        /* of buffer 0 from the start of the file */
+    uint32_t buffer_size;   /* from one buffer to the next */
+    uint32_t middle;        /* buffer index, maybe | HEADLESS_FRAME_FRESH */
+    uint32_t front;         /* buffer index, written by the consumer only */
+    uint32_t frames;        /* frames published */
+    uint32_t dropped;       /* frames skipped */
+} HeadlessFrameHeader;
+
+/* QEMU keeps its own copy of this structure, and checks the same size and
+ * offsets.  Bump HEADLESS_FRAME_VERSION and update both when changing it. */
+#define HEADLESS_FRAME_CHECK(name, cond) \
+    typedef char name[(cond) ? 1 : -1]
+HEADLESS_FRAME_CHECK(headless_frame_size_check,
+                     sizeof(HeadlessFrameHeader) == 44);
+HEADLESS_FRAME_CHECK(headless_frame_middle_check,
+                     offsetof(HeadlessFrameHeader, middle) == 28);
+HEADLESS_FRAME_CHECK(headless_frame_front_check,
+                     offsetof(HeadlessFrameHeader, front) == 32);
+#undef HEADLESS_FRAME_CHECK
+
+#endif
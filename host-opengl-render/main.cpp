@@ -1,15 +1,44 @@
 #include "render_api.h"
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
 
 static char              rendererAddress[256];
 
+/*
+ * Usage: opengAPI [-headless PATH [-fps N]]
+ *
+ * With -headless, frames are published to the frame file at PATH
+ * instead of a subwindow, at most N (default 60) per second.
+ */
 int main(int argc, char** argv)
 {
+    const char* headlessPath = NULL;
+    int maxFps = 60;
+
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "-headless") && i + 1 < argc) {
+            headlessPath = argv[++i];
+        } else if (!strcmp(argv[i], "-fps") && i + 1 < argc) {
+            maxFps = atoi(argv[++i]);
+        } else {
+            fprintf(stderr, "usage: %s [-headless PATH [-fps N]]\n", argv[0]);
+            return 1;
+        }
+    }
+
     initLibrary();
 
     initOpenGLRenderer(1080,1920,rendererAddress,sizeof(rendererAddress));
-    createOpenGLSubwindow(NULL,0,0,1080,1920,0);
+    if (headlessPath) {
+        if (!initHeadlessDisplay(headlessPath, maxFps)) {
+            fprintf(stderr, "initHeadlessDisplay:%s failed\n", headlessPath);
+            return 1;
+        }
+    } else {
+        createOpenGLSubwindow(NULL,0,0,1080,1920,0);
+    }
 
     printf("initOpenGLRenderer:%s \n",rendererAddress);
 
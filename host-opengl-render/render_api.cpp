@@ -18,6 +18,7 @@
 #include "IOStream.h"
 #include "FrameBuffer.h"
 #include "RenderServer.h"
+#include "HeadlessDisplay.h"
 #include "osProcess.h"
 #include "TimeUtils.h"
 #include "TcpStream.h"
@@ -33,6 +34,7 @@
 
 static osUtils::childProcess *s_renderProc = NULL;
 static RenderServer *s_renderThread = NULL;
+static HeadlessDisplay *s_headlessDisplay = NULL;
 static char s_renderAddr[256];
 
 static IOStream *createRenderThread(int p_stream_buffer_size,
@@ -212,6 +214,25 @@ void setPostCallback(OnPostFn onPost, void* onPostContext)
 #endif
 }
 
+int initHeadlessDisplay(const char* path, int maxFps)
+{
+    FrameBuffer* fb = FrameBuffer::getFB();
+    if (!s_renderThread || !fb || s_headlessDisplay) {
+        return false;
+    }
+
+    s_headlessDisplay = HeadlessDisplay::create(path, fb->getWidth(),
+                                                fb->getHeight(), maxFps);
+    if (!s_headlessDisplay) {
+        return false;
+    }
+
+    fb->setPostCallback(HeadlessDisplay::onPost, s_headlessDisplay,
+                        HeadlessDisplay::onPostReady);
+    s_headlessDisplay->start();
+    return true;
+}
+
 void getHardwareStrings(const char** vendor, const char** renderer, const char** version)
 {
     FrameBuffer* fb = FrameBuffer::getFB();
@@ -252,6 +273,16 @@ int stopOpenGLRenderer(void)
         s_renderThread = NULL;
     }
 
+    if (s_headlessDisplay) {
+        FrameBuffer* fb = FrameBuffer::getFB();
+        if (fb) {
+            fb->setPostCallback(NULL, NULL);
+        }
+        s_headlessDisplay->stop();
+        delete s_headlessDisplay;
+        s_headlessDisplay = NULL;
+    }
+
     return ret;
 }
 
@@ -103,6 +103,23 @@ void getHardwareStrings(const char** vendor ,const char** renderer,const char**
 typedef void(*OnPostFn)(void* context ,int width, int height, int ydir,int format, int type ,unsigned char* pixels);
 void setPostCallback(OnPostFn onPost,void* onPostContext);
 
+/* initHeadlessDisplay -
+ *     Publish the framebuffer without a window system, for a host without
+ *     one or for a display server in another process. Each posted frame is
+ *     converted and written to the frame file created at 'path' (see
+ *     headless_frame.h), which e.g. QEMU's -gles-display maps and shows.
+ *     At most maxFps frames are published per second (0 for no limit).
+ *     A frame is skipped before its readback while the previous one has
+ *     not been taken; the last frame is posted again once it can be.
+ *     Uses the post callback, and must be called after initOpenGLRenderer()
+ *     and instead of createOpenGLSubwindow().
+ *
+ *     With a software EGL such as Mesa's, set EGL_PLATFORM=surfaceless and
+ *     point ANDROID_EGL_LIB, ANDROID_GLESv1_LIB and ANDROID_GLESv2_LIB at
+ *     its libraries.
+ */
+int initHeadlessDisplay(const char* path, int maxFps);
+
 /* createOpenGLSubwindow -
  *     Create a native subwindow which is a child of 'window'
  *     to be used for framebuffer display.
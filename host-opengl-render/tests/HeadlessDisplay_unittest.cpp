@@ -0,0 +1,208 @@
+/*
+* Copyright (C) 2011 The Android Open Source Project
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+//
+// Publishes frames from one thread while another one takes them the way
+// QEMU's -gles-display does, and checks that the consumer never sees a
+// frame that is torn or older than the one it showed before.  Every other
+// frame is smaller than the display, and what is outside of it must be
+// clear.
+//
+// Usage: HeadlessDisplay_unittest [FRAMES]
+//
+
+#include "HeadlessDisplay.h"
+#include "FrameBuffer.h"
+#include "gl.h"
+
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+// HeadlessDisplay::Main() reposts through the FrameBuffer, which is not
+// needed here
+FrameBuffer *FrameBuffer::s_theFrameBuffer = NULL;
+bool FrameBuffer::repost() { return false; }
+
+static const int s_width = 64;
+static const int s_height = 48;
+
+static int frameWidth(uint32_t p_frame)
+{
+    return p_frame & 1 ? s_width : s_width / 2 + 1;
+}
+
+static int frameHeight(uint32_t p_frame)
+{
+    return p_frame & 1 ? s_height : s_height / 3;
+}
+
+// frame p_frame as posted by the FrameBuffer: RGBA, bottom-to-top
+static void fillFrame(unsigned char *p_pixels, uint32_t p_frame)
+{
+    int width = frameWidth(p_frame);
+    int height = frameHeight(p_frame);
+
+    for (int i = 0; i < width * height; i++) {
+        p_pixels[i * 4] = p_frame >> 16;
+        p_pixels[i * 4 + 1] = p_frame >> 8;
+        p_pixels[i * 4 + 2] = p_frame;
+        p_pixels[i * 4 + 3] = 0xff;
+    }
+}
+
+class Consumer : public osUtils::Thread
+{
+public:
+    Consumer(HeadlessFrameHeader *p_header) :
+        m_last(0),
+        m_taken(0),
+        m_errors(0),
+        m_header(p_header),
+        m_done(false) {}
+
+    virtual int Main()
+    {
+        for (;;) {
+            bool done = __atomic_load_n(&m_done, __ATOMIC_ACQUIRE);
+
+            if (__atomic_load_n(&m_header->middle, __ATOMIC_ACQUIRE) &
+                HEADLESS_FRAME_FRESH) {
+                take();
+            } else if (done) {
+                return 0;
+            } else {
+                sched_yield();
+            }
+        }
+    }
+
+    void finish() { __atomic_store_n(&m_done, true, __ATOMIC_RELEASE); }
+
+    uint32_t m_last;
+    uint32_t m_taken;
+    int m_errors;
+
+private:
+    void take()
+    {
+        uint32_t old = __atomic_exchange_n(&m_header->middle,
+                                           m_header->front, __ATOMIC_ACQ_REL);
+        m_header->front = old & ~HEADLESS_FRAME_FRESH;
+
+        const unsigned char *buffer = (const unsigned char *)m_header +
+            m_header->offset + (size_t)m_header->front * m_header->buffer_size;
+        uint32_t frame = *(const uint32_t *)buffer & 0xffffff;
+        int width = frameWidth(frame);
+        int height = frameHeight(frame);
+
+        if (frame <= m_last) {
+            fprintf(stderr, "frame %u after frame %u\n", frame, m_last);
+            m_errors++;
+        }
+        for (int y = 0; y < s_height; y++) {
+            const uint32_t *row = (const uint32_t *)(buffer +
+                                                     y * m_header->stride);
+            for (int x = 0; x < s_width; x++) {
+                uint32_t expected = x < width && y < height ?
+                                    0xff000000u | frame : 0;
+                if (row[x] != expected) {
+                    fprintf(stderr, "frame %u: %08x at %d,%d, not %08x\n",
+                            frame, row[x], x, y, expected);
+                    m_errors++;
+                    return;
+                }
+            }
+        }
+        m_last = frame;
+        m_taken++;
+    }
+
+    HeadlessFrameHeader *m_header;
+    bool m_done;
+};
+
+int main(int argc, char **argv)
+{
+    uint32_t frames = argc > 1 ? strtoul(argv[1], NULL, 0) : 20000;
+    char path[] = "/tmp/headless-test.XXXXXX";
+    int fd = mkstemp(path);
+
+    if (fd < 0) {
+        perror("mkstemp");
+        return 1;
+    }
+    close(fd);
+
+    HeadlessDisplay *hd = HeadlessDisplay::create(path, s_width, s_height, 0);
+    if (!hd) {
+        unlink(path);
+        return 1;
+    }
+
+    // the display keeps it mapped, map it once more as the consumer does
+    FILE *file = fopen(path, "r+");
+    HeadlessFrameHeader header;
+    fread(&header, sizeof(header), 1, file);
+    size_t size = header.offset +
+                  (size_t)header.buffer_size * HEADLESS_FRAME_BUFFERS;
+    HeadlessFrameHeader *shared = (HeadlessFrameHeader *)
+        mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fileno(file), 0);
+    fclose(file);
+    if (shared == MAP_FAILED) {
+        perror("mmap");
+        delete hd;
+        return 1;
+    }
+
+    Consumer consumer(shared);
+    consumer.start();
+
+    unsigned char *pixels = (unsigned char *)malloc(s_width * s_height * 4);
+    for (uint32_t frame = 1; frame <= frames; frame++) {
+        // rows of 4 byte pixels need no padding
+        fillFrame(pixels, frame);
+        HeadlessDisplay::onPost(hd, frameWidth(frame), frameHeight(frame), 1,
+                                GL_RGBA, GL_UNSIGNED_BYTE, pixels);
+    }
+    consumer.finish();
+
+    int status;
+    consumer.wait(&status);
+
+    int errors = consumer.m_errors;
+    if (consumer.m_last != frames) {
+        fprintf(stderr, "last frame taken %u, not %u\n",
+                consumer.m_last, frames);
+        errors++;
+    }
+    if (shared->frames != frames ||
+        consumer.m_taken + shared->dropped != frames) {
+        fprintf(stderr, "%u frames published, %u taken, %u dropped\n",
+                shared->frames, consumer.m_taken, shared->dropped);
+        errors++;
+    }
+    printf("%u frames, %u taken, %u dropped: %s\n", frames,
+           consumer.m_taken, shared->dropped, errors ? "FAIL" : "PASS");
+
+    free(pixels);
+    munmap(shared, size);
+    delete hd;
+    return errors ? 1 : 0;
+}
@@ -33,13 +33,24 @@
 #include "hw/xen/xen.h"
 #include "qom/object.h"
 #include "hw/boards.h"
+#include "qapi/error.h"
 
 int tcg_tb_size;
+const char *tcg_tb_cache;
 static bool tcg_allowed = true;
 
 static int tcg_init(MachineState *ms)
 {
+    Error *err = NULL;
+
     tcg_exec_init(tcg_tb_size * 1024 * 1024);
+    if (tcg_tb_cache) {
+        tb_cache_init(tcg_tb_cache, &err);
+        if (err) {
+            error_report_err(err);
+            return -1;
+        }
+    }
     return 0;
 }
 
@@ -17,12 +17,16 @@
 #include "block/block.h"
 #include "qemu/queue.h"
 #include "qemu/sockets.h"
+#include "qemu/timer.h"
+#include "qapi/error.h"
+#include "trace.h"
 
 struct AioHandler
 {
     GPollFD pfd;
     IOHandler *io_read;
     IOHandler *io_write;
+    AioPollFn *io_poll;
     int deleted;
     void *opaque;
     QLIST_ENTRY(AioHandler) node;
@@ -41,6 +45,12 @@ static AioHandler *find_aio_handler(AioContext *ctx, int fd)
     return NULL;
 }
 
+/* Handlers that can only be watched with ppoll() keep us from busy polling */
+static bool aio_handler_blocks_polling(AioHandler *node)
+{
+    return node && !node->deleted && node->pfd.events && !node->io_poll;
+}
+
 void aio_set_fd_handler(AioContext *ctx,
                         int fd,
                         IOHandler *io_read,
@@ -50,6 +60,9 @@ void aio_set_fd_handler(AioContext *ctx,
     AioHandler *node;
 
     node = find_aio_handler(ctx, fd);
+    if (aio_handler_blocks_polling(node)) {
+        ctx->poll_disable_cnt--;
+    }
 
     /* Are we deleting the fd handler? */
     if (!io_read && !io_write) {
@@ -85,11 +98,28 @@ void aio_set_fd_handler(AioContext *ctx,
 
         node->pfd.events = (io_read ? G_IO_IN | G_IO_HUP | G_IO_ERR : 0);
         node->pfd.events |= (io_write ? G_IO_OUT | G_IO_ERR : 0);
+        if (aio_handler_blocks_polling(node)) {
+            ctx->poll_disable_cnt++;
+        }
     }
 
     aio_notify(ctx);
 }
 
+void aio_set_poll_handler(AioContext *ctx, int fd, AioPollFn *io_poll)
+{
+    AioHandler *node = find_aio_handler(ctx, fd);
+
+    assert(node);
+    if (aio_handler_blocks_polling(node)) {
+        ctx->poll_disable_cnt--;
+    }
+    node->io_poll = io_poll;
+    if (aio_handler_blocks_polling(node)) {
+        ctx->poll_disable_cnt++;
+    }
+}
+
 void aio_set_event_notifier(AioContext *ctx,
                             EventNotifier *notifier,
                             EventNotifierHandler *io_read)
@@ -98,6 +128,13 @@ void aio_set_event_notifier(AioContext *ctx,
                        (IOHandler *)io_read, NULL, notifier);
 }
 
+void aio_set_event_notifier_poll(AioContext *ctx,
+                                 EventNotifier *notifier,
+                                 AioPollFn *io_poll)
+{
+    aio_set_poll_handler(ctx, event_notifier_get_fd(notifier), io_poll);
+}
+
 bool aio_prepare(AioContext *ctx)
 {
     return false;
@@ -230,12 +267,115 @@ static void add_pollfd(AioHandler *node)
     npfd++;
 }
 
+/* Returns true if a handler made progress or someone called aio_notify().
+ * *progress is only set for the former.
+ */
+static bool run_poll_handlers_once(AioContext *ctx, bool *progress)
+{
+    AioHandler *node;
+    bool ready = false;
+
+    QLIST_FOREACH(node, &ctx->aio_handlers, node) {
+        if (!node->deleted && node->io_poll && node->io_poll(node->opaque)) {
+            ready = true;
+            if (node->opaque != &ctx->notifier) {
+                *progress = true;
+            }
+        }
+    }
+
+    return ready;
+}
+
+/* Busy poll the handlers for up to @max_ns nanoseconds.  Returns true if
+ * there is no need to block in ppoll() any more.
+ */
+static bool run_poll_handlers(AioContext *ctx, int64_t max_ns, bool *progress)
+{
+    int64_t start = qemu_clock_get_ns(QEMU_CLOCK_REALTIME);
+    int64_t now;
+    bool ready;
+
+    trace_run_poll_handlers_begin(ctx, max_ns);
+
+    do {
+        ready = run_poll_handlers_once(ctx, progress);
+        now = qemu_clock_get_ns(QEMU_CLOCK_REALTIME);
+    } while (!ready && now - start < max_ns);
+
+    ctx->poll_time_ns += now - start;
+    if (ready) {
+        ctx->poll_hits++;
+    } else {
+        ctx->poll_misses++;
+    }
+
+    trace_run_poll_handlers_end(ctx, ready);
+    return ready;
+}
+
+/* Adjust the polling window after a blocking aio_poll() that took
+ * @block_ns nanoseconds in total, polling included.  The window grows
+ * while events keep arriving within poll_max_ns, so that the next one
+ * would have been caught by polling, and shrinks when they do not.
+ */
+static void aio_adjust_poll_ns(AioContext *ctx, int64_t block_ns)
+{
+    int64_t old = ctx->poll_ns;
+
+    if (block_ns <= ctx->poll_ns) {
+        /* Caught by polling, leave the window alone */
+        return;
+    }
+
+    if (block_ns > ctx->poll_max_ns) {
+        /* Polling for longer would not have helped, poll less */
+        if (ctx->poll_shrink) {
+            ctx->poll_ns /= ctx->poll_shrink;
+        } else {
+            ctx->poll_ns = 0;
+        }
+        trace_poll_shrink(ctx, old, ctx->poll_ns);
+    } else if (ctx->poll_ns < ctx->poll_max_ns) {
+        /* A longer window would have caught the event, poll longer */
+        if (ctx->poll_ns) {
+            ctx->poll_ns *= ctx->poll_grow ? ctx->poll_grow : 2;
+        } else {
+            ctx->poll_ns = 4000; /* start at 4 microseconds */
+        }
+        if (ctx->poll_ns > ctx->poll_max_ns) {
+            ctx->poll_ns = ctx->poll_max_ns;
+        }
+        trace_poll_grow(ctx, old, ctx->poll_ns);
+    }
+}
+
+void aio_context_set_poll_params(AioContext *ctx, int64_t max_ns,
+                                 int64_t grow, int64_t shrink, Error **errp)
+{
+    if (max_ns < 0 || grow < 0 || shrink < 0) {
+        error_setg(errp, "polling parameters must not be negative");
+        return;
+    }
+
+    /* No thread synchronization here, it doesn't matter if an incorrect
+     * value is used once.
+     */
+    ctx->poll_max_ns = max_ns;
+    ctx->poll_ns = 0;
+    ctx->poll_grow = grow;
+    ctx->poll_shrink = shrink;
+
+    aio_notify(ctx);
+}
+
 bool aio_poll(AioContext *ctx, bool blocking)
 {
     AioHandler *node;
     int i, ret;
     bool progress;
     int64_t timeout;
+    int64_t start = 0;
 
     aio_context_acquire(ctx);
     progress = false;
@@ -253,6 +393,26 @@ bool aio_poll(AioContext *ctx, bool blocking)
 
     ctx->walking_handlers++;
 
+    timeout = blocking ? aio_compute_timeout(ctx) : 0;
+
+    /* Busy poll before blocking if all handlers can be polled.  This must
+     * come before filling pollfds because poll handlers run callbacks, and
+     * those can call aio_poll() recursively.
+     */
+    if (timeout && ctx->poll_max_ns) {
+        start = qemu_clock_get_ns(QEMU_CLOCK_REALTIME);
+        if (!ctx->poll_disable_cnt && ctx->poll_ns) {
+            int64_t max_ns = ctx->poll_ns;
+
+            if (timeout > 0 && timeout < max_ns) {
+                max_ns = timeout;
+            }
+            if (run_poll_handlers(ctx, max_ns, &progress)) {
+                timeout = 0;
+            }
+        }
+    }
+
     assert(npfd == 0);
 
     /* fill pollfds */
@@ -262,8 +422,6 @@ bool aio_poll(AioContext *ctx, bool blocking)
         }
     }
 
-    timeout = blocking ? aio_compute_timeout(ctx) : 0;
-
     /* wait until next event */
     if (timeout) {
         aio_context_release(ctx);
@@ -288,6 +446,12 @@ bool aio_poll(AioContext *ctx, bool blocking)
     npfd = 0;
     ctx->walking_handlers--;
 
+    if (start) {
+        int64_t block_ns = qemu_clock_get_ns(QEMU_CLOCK_REALTIME) - start;
+
+        aio_adjust_poll_ns(ctx, block_ns);
+    }
+
     /* Run dispatch even if there were no readable fds to run timers */
     if (aio_dispatch(ctx)) {
         progress = true;
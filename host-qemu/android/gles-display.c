@@ -0,0 +1,235 @@
+/*
+ * Graphic console for the frames of a headless GLES renderer
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ *
+ * The renderer runs in its own process, and publishes every frame in a
+ * file that both processes map.  The file holds three frame buffers that
+ * are passed around with atomic exchanges (see headless_frame.h in the
+ * renderer); each of them is shown through its own DisplaySurface, so
+ * frames are never copied on this side.  Taking a frame is a page flip.
+ */
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "qemu-common.h"
+#include "qemu/atomic.h"
+#include "qemu/error-report.h"
+#include "qemu/timer.h"
+#include "ui/console.h"
+#include "android/gles-display.h"
+
+/* Must match HeadlessFrameHeader in the renderer's headless_frame.h, which
+ * is not part of this tree.  The layout is fixed for a given
+ * HEADLESS_FRAME_VERSION; both sides check it at build time.  */
+#define GLES_FRAME_MAGIC    0x48474c46
+#define GLES_FRAME_VERSION  1
+#define GLES_FRAME_BUFFERS  3
+#define GLES_FRAME_FRESH    0x80000000u
+
+typedef struct GlesFrameHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t width;
+    uint32_t height;
+    uint32_t stride;
+    uint32_t offset;
+    uint32_t buffer_size;
+    uint32_t middle;
+    uint32_t front;
+    uint32_t frames;
+    uint32_t dropped;
+} GlesFrameHeader;
+
+QEMU_BUILD_BUG_ON(sizeof(GlesFrameHeader) != 44);
+QEMU_BUILD_BUG_ON(offsetof(GlesFrameHeader, width) != 8);
+QEMU_BUILD_BUG_ON(offsetof(GlesFrameHeader, stride) != 16);
+QEMU_BUILD_BUG_ON(offsetof(GlesFrameHeader, offset) != 20);
+QEMU_BUILD_BUG_ON(offsetof(GlesFrameHeader, buffer_size) != 24);
+QEMU_BUILD_BUG_ON(offsetof(GlesFrameHeader, middle) != 28);
+QEMU_BUILD_BUG_ON(offsetof(GlesFrameHeader, front) != 32);
+QEMU_BUILD_BUG_ON(offsetof(GlesFrameHeader, frames) != 36);
+QEMU_BUILD_BUG_ON(offsetof(GlesFrameHeader, dropped) != 40);
+
+/* How often to look for a new frame file, in milliseconds */
+#define GLES_DISPLAY_CHECK_MS 1000
+
+typedef struct GlesDisplay {
+    QemuConsole *con;
+    char *path;
+    GlesFrameHeader *header;
+    GlesFrameHeader layout;     /* copy of the header, as validated */
+    size_t size;
+    dev_t dev;
+    ino_t ino;
+    uint32_t shown;
+    int64_t checked;
+} GlesDisplay;
+
+static uint8_t *gles_display_buffer(GlesDisplay *s, uint32_t index)
+{
+    return (uint8_t *)s->header + s->layout.offset +
+           (size_t)index * s->layout.buffer_size;
+}
+
+static void gles_display_show(GlesDisplay *s, uint32_t index)
+{
+    GlesFrameHeader *header = &s->layout;
+    DisplaySurface *surface;
+
+    surface = qemu_create_displaysurface_from(header->width, header->height,
+                                              PIXMAN_x8r8g8b8,
+                                              header->stride,
+                                              gles_display_buffer(s, index));
+    s->shown = index;
+    dpy_gfx_replace_surface(s->con, surface);
+    dpy_gfx_update(s->con, 0, 0, header->width, header->height);
+}
+
+static void gles_display_unmap(GlesDisplay *s)
+{
+    GlesFrameHeader *header = &s->layout;
+    DisplaySurface *surface;
+    uint8_t *src;
+    int y;
+
+    if (!s->header) {
+        return;
+    }
+
+    /* Keep showing the last frame, from memory of our own */
+    surface = qemu_create_displaysurface(header->width, header->height);
+    src = gles_display_buffer(s, s->shown);
+    for (y = 0; y < header->height; y++) {
+        memcpy((uint8_t *)surface_data(surface) + y * surface_stride(surface),
+               src + y * header->stride, header->width * 4);
+    }
+    dpy_gfx_replace_surface(s->con, surface);
+
+    munmap(s->header, s->size);
+    s->header = NULL;
+}
+
+static bool gles_display_valid(GlesFrameHeader *header, size_t size)
+{
+    uint64_t end;
+
+    if (header->magic != GLES_FRAME_MAGIC ||
+        header->version != GLES_FRAME_VERSION ||
+        header->width == 0 || header->height == 0 ||
+        header->width > INT_MAX / 4 ||
+        header->stride < header->width * 4 ||
+        (uint64_t)header->stride * header->height > header->buffer_size ||
+        header->offset < sizeof(*header) || header->offset % 4) {
+        return false;
+    }
+    end = header->offset + (uint64_t)header->buffer_size * GLES_FRAME_BUFFERS;
+    return end <= size;
+}
+
+/* Map the frame file if the renderer created a new one since last time */
+static void gles_display_check(GlesDisplay *s)
+{
+    GlesFrameHeader *header, layout;
+    struct stat st;
+    uint32_t front;
+    int fd;
+
+    if (stat(s->path, &st) < 0) {
+        /* The renderer is gone; keep showing its last frame */
+        return;
+    }
+    if (s->header && st.st_dev == s->dev && st.st_ino == s->ino) {
+        return;
+    }
+
+    gles_display_unmap(s);
+    fd = open(s->path, O_RDWR);
+    if (fd < 0) {
+        return;
+    }
+    if (fstat(fd, &st) < 0 || st.st_size < (off_t)sizeof(*header)) {
+        close(fd);
+        return;
+    }
+    header = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED,
+                  fd, 0);
+    close(fd);
+    if (header == MAP_FAILED) {
+        return;
+    }
+    /* The magic is written last; the rest must not change afterwards */
+    layout.magic = atomic_mb_read(&header->magic);
+    memcpy((uint8_t *)&layout + sizeof(layout.magic),
+           (uint8_t *)header + sizeof(layout.magic),
+           sizeof(layout) - sizeof(layout.magic));
+    front = layout.front;
+    if (!gles_display_valid(&layout, st.st_size) ||
+        front >= GLES_FRAME_BUFFERS) {
+        munmap(header, st.st_size);
+        return;
+    }
+
+    s->header = header;
+    s->layout = layout;
+    s->size = st.st_size;
+    s->dev = st.st_dev;
+    s->ino = st.st_ino;
+
+    /* A buffer we took in an earlier run of QEMU, or the initial one */
+    gles_display_show(s, front);
+}
+
+static void gles_display_update(void *opaque)
+{
+    GlesDisplay *s = opaque;
+    GlesFrameHeader *header;
+    int64_t now = qemu_clock_get_ms(QEMU_CLOCK_REALTIME);
+    uint32_t front;
+
+    if (now - s->checked >= GLES_DISPLAY_CHECK_MS) {
+        s->checked = now;
+        gles_display_check(s);
+    }
+
+    header = s->header;
+    if (!header || !(atomic_read(&header->middle) & GLES_FRAME_FRESH)) {
+        return;
+    }
+
+    /* Give the buffer we show back to the renderer and take the new frame */
+    front = atomic_xchg(&header->middle, s->shown);
+    front &= ~GLES_FRAME_FRESH;
+    if (front >= GLES_FRAME_BUFFERS) {
+        /* The renderer wrote garbage; look for a new file next time */
+        gles_display_unmap(s);
+        return;
+    }
+    atomic_set(&header->front, front);
+    gles_display_show(s, front);
+}
+
+static void gles_display_invalidate(void *opaque)
+{
+    GlesDisplay *s = opaque;
+
+    if (s->header) {
+        gles_display_show(s, s->shown);
+    }
+}
+
+static const GraphicHwOps gles_display_ops = {
+    .invalidate = gles_display_invalidate,
+    .gfx_update = gles_display_update,
+};
+
+void android_gles_display_init(const char *path)
+{
+    GlesDisplay *s = g_new0(GlesDisplay, 1);
+
+    s->path = g_strdup(path);
+    s->con = graphic_console_init(NULL, 0, &gles_display_ops, s);
+}
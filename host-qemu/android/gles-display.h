@@ -0,0 +1,18 @@
+/*
+ * Graphic console for the frames of a headless GLES renderer
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#ifndef ANDROID_GLES_DISPLAY_H
+#define ANDROID_GLES_DISPLAY_H
+
+/*
+ * Add a graphic console that shows the frames the GLES renderer publishes
+ * in the frame file at @path (its -headless option).  The file does not
+ * need to exist yet; it is opened again whenever the renderer restarts.
+ */
+void android_gles_display_init(const char *path);
+
+#endif /* ANDROID_GLES_DISPLAY_H */
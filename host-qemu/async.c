@@ -316,6 +316,15 @@ static void event_notifier_dummy_cb(EventNotifier *e)
 {
 }
 
+/* Stop busy polling as soon as aio_notify() is called */
+static bool event_notifier_poll(void *opaque)
+{
+    EventNotifier *e = opaque;
+    AioContext *ctx = container_of(e, AioContext, notifier);
+
+    return atomic_read(&ctx->notified);
+}
+
 AioContext *aio_context_new(Error **errp)
 {
     int ret;
@@ -331,6 +340,7 @@ AioContext *aio_context_new(Error **errp)
     aio_set_event_notifier(ctx, &ctx->notifier,
                            (EventNotifierHandler *)
                            event_notifier_dummy_cb);
+    aio_set_event_notifier_poll(ctx, &ctx->notifier, event_notifier_poll);
     ctx->thread_pool = NULL;
     qemu_mutex_init(&ctx->bh_lock);
     rfifolock_init(&ctx->lock, aio_rfifolock_cb, ctx);
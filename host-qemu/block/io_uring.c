@@ -0,0 +1,735 @@
+/*
+ * Linux io_uring support.
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+#include "qemu-common.h"
+#include "block/aio.h"
+#include "qemu/queue.h"
+#include "qemu/error-report.h"
+#include "block/raw-aio.h"
+#include "qemu/event_notifier.h"
+#include "qemu/timer.h"
+#include "exec/ramlist.h"
+
+#include <liburing.h>
+#include <linux/falloc.h>
+
+/*
+ * Ring size (per-device).  The completion ring is twice as large, and at
+ * most MAX_ENTRIES requests are given to the kernel at a time, so that
+ * completions never overflow.
+ */
+#define MAX_ENTRIES 128
+
+/* Guest RAM is registered in buffers no larger than the kernel accepts */
+#define MAX_FIXED_BUFFER_SIZE (1ULL << 30)
+#define MAX_FIXED_BUFFERS 1024
+
+struct qemu_luringcb {
+    BlockAIOCB common;
+    int fd;
+    int type;
+    off_t offset;
+    size_t nbytes;
+    QEMUIOVector *qiov;
+
+    /* Bytes transferred by earlier parts of a short read or write, whose
+     * remainder is resubmitted with resubmit_qiov */
+    size_t done;
+    QEMUIOVector resubmit_qiov;
+
+    /* Error of a request that could not be submitted */
+    int ret;
+
+    /* The last submission used a fixed buffer; no_fixed once that failed */
+    bool fixed;
+    bool no_fixed;
+
+    QSIMPLEQ_ENTRY(qemu_luringcb) next;
+};
+
+typedef struct {
+    int plugged;
+    unsigned int in_flight;
+    QSIMPLEQ_HEAD(, qemu_luringcb) pending;
+    /* Completed by the completion BH, see ioq_fail() */
+    QSIMPLEQ_HEAD(, qemu_luringcb) failed;
+} LuringQueue;
+
+struct qemu_luring_state {
+    struct io_uring ring;
+    EventNotifier e;
+    AioContext *aio_context;
+
+    /* io queue for submit at batch */
+    LuringQueue io_q;
+
+    /* Requests that arrive while others are in flight are submitted
+     * together by submit_bh at the end of the event loop iteration */
+    bool batch;
+    QEMUBH *submit_bh;
+
+    /* Busy-wait this long for completions before going back to sleep */
+    int64_t poll_ns;
+
+    /* I/O completion processing */
+    QEMUBH *completion_bh;
+
+    /* Guest RAM blocks, registered with the ring as fixed buffers by
+     * register_bh.  fixed[] is sorted by address.  register_pending is
+     * set while register_bh waits for the requests in flight. */
+    bool fixed_buffers;
+    bool fixed_failed;
+    bool register_pending;
+    RAMBlockNotifier ram_notifier;
+    struct iovec *ram;
+    int nr_ram;
+    struct iovec *fixed;
+    int nr_fixed;
+    QEMUBH *register_bh;
+};
+
+static void ioq_submit(struct qemu_luring_state *s);
+
+/*
+ * Completes an AIO request (calls the callback and frees the ACB), or
+ * queues the rest of a short read or write again.
+ */
+static void luring_process_completion(struct qemu_luring_state *s,
+                                      struct qemu_luringcb *luringcb, int ret)
+{
+    bool is_rw = luringcb->type == QEMU_AIO_READ ||
+                 luringcb->type == QEMU_AIO_WRITE;
+
+    if (ret == -EINTR || ret == -EAGAIN) {
+        QSIMPLEQ_INSERT_TAIL(&s->io_q.pending, luringcb, next);
+        return;
+    }
+
+    /* The buffers were unregistered under the request, see
+     * luring_ram_block_removed() */
+    if (ret == -EFAULT && luringcb->fixed) {
+        luringcb->no_fixed = true;
+        QSIMPLEQ_INSERT_TAIL(&s->io_q.pending, luringcb, next);
+        return;
+    }
+
+    if (ret < 0) {
+        if (ret == -EOPNOTSUPP || ret == -ENOTTY) {
+            ret = -ENOTSUP;
+        }
+    } else if (is_rw) {
+        luringcb->done += ret;
+        if (luringcb->done == luringcb->nbytes) {
+            ret = 0;
+        } else if (ret > 0) {
+            if (!luringcb->resubmit_qiov.iov) {
+                qemu_iovec_init(&luringcb->resubmit_qiov,
+                                luringcb->qiov->niov);
+            }
+            qemu_iovec_reset(&luringcb->resubmit_qiov);
+            qemu_iovec_concat(&luringcb->resubmit_qiov, luringcb->qiov,
+                              luringcb->done,
+                              luringcb->nbytes - luringcb->done);
+            QSIMPLEQ_INSERT_TAIL(&s->io_q.pending, luringcb, next);
+            return;
+        } else if (luringcb->type == QEMU_AIO_READ) {
+            /* Reads return 0 at EOF, pad with zeros. */
+            qemu_iovec_memset(luringcb->qiov, luringcb->done, 0,
+                              luringcb->nbytes - luringcb->done);
+            ret = 0;
+        } else {
+            ret = -EINVAL;
+        }
+    } else {
+        ret = 0;
+    }
+
+    if (luringcb->resubmit_qiov.iov) {
+        qemu_iovec_destroy(&luringcb->resubmit_qiov);
+    }
+    luringcb->common.cb(luringcb->common.opaque, ret);
+    qemu_aio_unref(luringcb);
+}
+
+/* Processes the completions in the ring and invokes their callbacks.
+ *
+ * Every completion is given back to the kernel before its callback runs,
+ * so that an event loop nested in the callback (for example one that
+ * invokes aio_poll()) does not see it again.  The completion BH is
+ * scheduled while callbacks run so that a nested event loop also sees the
+ * completions that are still pending.
+ */
+static void luring_process_completions(struct qemu_luring_state *s)
+{
+    struct io_uring_cqe *cqe;
+
+    /* Reschedule so nested event loops see currently pending completions */
+    qemu_bh_schedule(s->completion_bh);
+
+    while (io_uring_peek_cqe(&s->ring, &cqe) == 0 && cqe) {
+        struct qemu_luringcb *luringcb = io_uring_cqe_get_data(cqe);
+        int ret = cqe->res;
+
+        /* Update the counters first, we can be nested */
+        io_uring_cqe_seen(&s->ring, cqe);
+        s->io_q.in_flight--;
+        luring_process_completion(s, luringcb, ret);
+    }
+
+    while (!QSIMPLEQ_EMPTY(&s->io_q.failed)) {
+        struct qemu_luringcb *luringcb = QSIMPLEQ_FIRST(&s->io_q.failed);
+
+        QSIMPLEQ_REMOVE_HEAD(&s->io_q.failed, next);
+        luring_process_completion(s, luringcb, luringcb->ret);
+    }
+
+    if (s->register_pending && !s->io_q.in_flight) {
+        s->register_pending = false;
+        qemu_bh_schedule(s->register_bh);
+    }
+
+    qemu_bh_cancel(s->completion_bh);
+}
+
+/*
+ * Spin for up to poll_ns waiting for a completion to show up in the ring,
+ * and let the completion BH run if one does.
+ */
+static void luring_poll(struct qemu_luring_state *s)
+{
+    int64_t deadline;
+
+    if (!s->poll_ns || !s->io_q.in_flight) {
+        return;
+    }
+
+    deadline = qemu_clock_get_ns(QEMU_CLOCK_REALTIME) + s->poll_ns;
+    do {
+        if (io_uring_cq_ready(&s->ring)) {
+            qemu_bh_schedule(s->completion_bh);
+            return;
+        }
+    } while (qemu_clock_get_ns(QEMU_CLOCK_REALTIME) < deadline);
+}
+
+static void luring_completion_bh(void *opaque)
+{
+    struct qemu_luring_state *s = opaque;
+
+    luring_process_completions(s);
+
+    if (!s->io_q.plugged) {
+        ioq_submit(s);
+    }
+    luring_poll(s);
+}
+
+static void luring_completion_cb(EventNotifier *e)
+{
+    struct qemu_luring_state *s = container_of(e, struct qemu_luring_state, e);
+
+    if (event_notifier_test_and_clear(&s->e)) {
+        qemu_bh_schedule(s->completion_bh);
+    }
+}
+
+/* Busy polling callback for the AioContext, see aio_set_poll_handler() */
+static bool luring_poll_cb(void *opaque)
+{
+    EventNotifier *e = opaque;
+    struct qemu_luring_state *s = container_of(e, struct qemu_luring_state, e);
+
+    if (!io_uring_cq_ready(&s->ring)) {
+        return false;
+    }
+
+    luring_process_completions(s);
+    if (!s->io_q.plugged) {
+        ioq_submit(s);
+    }
+    return true;
+}
+
+static const AIOCBInfo luring_aiocb_info = {
+    .aiocb_size         = sizeof(struct qemu_luringcb),
+};
+
+/* Index of the fixed buffer that contains all of @qiov, or -1 */
+static int luring_fixed_index(struct qemu_luring_state *s,
+                              struct qemu_luringcb *luringcb,
+                              QEMUIOVector *qiov)
+{
+    uintptr_t start, end;
+    int lo = 0, hi = s->nr_fixed;
+
+    if (qiov->niov != 1 || luringcb->no_fixed) {
+        return -1;
+    }
+
+    start = (uintptr_t)qiov->iov[0].iov_base;
+    end = start + qiov->iov[0].iov_len;
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        uintptr_t base = (uintptr_t)s->fixed[mid].iov_base;
+
+        if (start < base) {
+            hi = mid;
+        } else if (start >= base + s->fixed[mid].iov_len) {
+            lo = mid + 1;
+        } else {
+            return end <= base + s->fixed[mid].iov_len ? mid : -1;
+        }
+    }
+    return -1;
+}
+
+static void luring_prep_sqe(struct qemu_luring_state *s,
+                            struct qemu_luringcb *luringcb,
+                            struct io_uring_sqe *sqe)
+{
+    QEMUIOVector *qiov;
+    off_t offset = luringcb->offset + luringcb->done;
+    int index;
+
+    qiov = luringcb->done ? &luringcb->resubmit_qiov : luringcb->qiov;
+
+    luringcb->fixed = false;
+    switch (luringcb->type) {
+    case QEMU_AIO_WRITE:
+        index = luring_fixed_index(s, luringcb, qiov);
+        if (index >= 0) {
+            io_uring_prep_write_fixed(sqe, luringcb->fd, qiov->iov[0].iov_base,
+                                      qiov->iov[0].iov_len, offset, index);
+            luringcb->fixed = true;
+        } else {
+            io_uring_prep_writev(sqe, luringcb->fd, qiov->iov, qiov->niov,
+                                 offset);
+        }
+        break;
+    case QEMU_AIO_READ:
+        index = luring_fixed_index(s, luringcb, qiov);
+        if (index >= 0) {
+            io_uring_prep_read_fixed(sqe, luringcb->fd, qiov->iov[0].iov_base,
+                                     qiov->iov[0].iov_len, offset, index);
+            luringcb->fixed = true;
+        } else {
+            io_uring_prep_readv(sqe, luringcb->fd, qiov->iov, qiov->niov,
+                                offset);
+        }
+        break;
+    case QEMU_AIO_FLUSH:
+        io_uring_prep_fsync(sqe, luringcb->fd, IORING_FSYNC_DATASYNC);
+        break;
+    case QEMU_AIO_DISCARD:
+        io_uring_prep_fallocate(sqe, luringcb->fd,
+                                FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE,
+                                offset, luringcb->nbytes);
+        break;
+    default:
+        abort();
+    }
+    io_uring_sqe_set_data(sqe, luringcb);
+}
+
+static void ioq_init(LuringQueue *io_q)
+{
+    QSIMPLEQ_INIT(&io_q->pending);
+    QSIMPLEQ_INIT(&io_q->failed);
+    io_q->plugged = 0;
+    io_q->in_flight = 0;
+}
+
+/*
+ * io_uring_enter() failed with an error that retrying does not fix.  Take
+ * back the entries that the kernel did not consume from the submission
+ * ring, and fail them together with the requests still waiting for room
+ * in it.  The callbacks run from the completion BH, not from within
+ * luring_submit().
+ */
+static void ioq_fail(struct qemu_luring_state *s, int ret)
+{
+    struct io_uring_sq *sq = &s->ring.sq;
+    struct qemu_luringcb *luringcb;
+    unsigned int head;
+
+    /* Without SQPOLL the kernel only moves khead inside io_uring_enter() */
+    for (head = *sq->khead; head != sq->sqe_tail; head++) {
+        struct io_uring_sqe *sqe;
+
+        sqe = &sq->sqes[sq->array[head & *sq->kring_mask]];
+        luringcb = (struct qemu_luringcb *)(uintptr_t)sqe->user_data;
+        luringcb->ret = ret;
+        QSIMPLEQ_INSERT_TAIL(&s->io_q.failed, luringcb, next);
+        s->io_q.in_flight--;
+    }
+    sq->sqe_head = sq->sqe_tail = *sq->khead;
+    io_uring_smp_store_release(sq->ktail, sq->sqe_tail);
+
+    while (!QSIMPLEQ_EMPTY(&s->io_q.pending)) {
+        luringcb = QSIMPLEQ_FIRST(&s->io_q.pending);
+        QSIMPLEQ_REMOVE_HEAD(&s->io_q.pending, next);
+        luringcb->ret = ret;
+        QSIMPLEQ_INSERT_TAIL(&s->io_q.failed, luringcb, next);
+    }
+    qemu_bh_schedule(s->completion_bh);
+}
+
+/*
+ * Moves pending requests to the submission ring, as many as fit, and
+ * tells the kernel about everything in the ring.
+ */
+static void ioq_submit(struct qemu_luring_state *s)
+{
+    struct qemu_luringcb *luringcb;
+    struct io_uring_sqe *sqe;
+    int ret;
+
+    while (s->io_q.in_flight < MAX_ENTRIES &&
+           !QSIMPLEQ_EMPTY(&s->io_q.pending)) {
+        sqe = io_uring_get_sqe(&s->ring);
+        if (!sqe) {
+            break;
+        }
+        luringcb = QSIMPLEQ_FIRST(&s->io_q.pending);
+        QSIMPLEQ_REMOVE_HEAD(&s->io_q.pending, next);
+        luring_prep_sqe(s, luringcb, sqe);
+        s->io_q.in_flight++;
+    }
+
+    if (!io_uring_sq_ready(&s->ring)) {
+        return;
+    }
+
+    /* Entries that the kernel refuses now stay in the submission ring and
+     * go with the next io_uring_enter() */
+    ret = io_uring_submit(&s->ring);
+    if (ret < 0 && ret != -EAGAIN && ret != -EBUSY && ret != -EINTR) {
+        ioq_fail(s, ret);
+        return;
+    }
+    if (io_uring_sq_ready(&s->ring)) {
+        qemu_bh_schedule(s->submit_bh);
+    }
+}
+
+static void luring_submit_bh(void *opaque)
+{
+    struct qemu_luring_state *s = opaque;
+
+    if (!s->io_q.plugged) {
+        ioq_submit(s);
+    }
+    luring_poll(s);
+}
+
+void luring_io_plug(BlockDriverState *bs, void *aio_ctx)
+{
+    struct qemu_luring_state *s = aio_ctx;
+
+    s->io_q.plugged++;
+}
+
+void luring_io_unplug(BlockDriverState *bs, void *aio_ctx, bool unplug)
+{
+    struct qemu_luring_state *s = aio_ctx;
+
+    assert(s->io_q.plugged > 0 || !unplug);
+
+    if (unplug && --s->io_q.plugged > 0) {
+        return;
+    }
+
+    ioq_submit(s);
+}
+
+BlockAIOCB *luring_submit(BlockDriverState *bs, void *aio_ctx, int fd,
+        int64_t sector_num, QEMUIOVector *qiov, int nb_sectors,
+        BlockCompletionFunc *cb, void *opaque, int type)
+{
+    struct qemu_luring_state *s = aio_ctx;
+    struct qemu_luringcb *luringcb;
+
+    switch (type) {
+    case QEMU_AIO_WRITE:
+    case QEMU_AIO_READ:
+    case QEMU_AIO_FLUSH:
+    case QEMU_AIO_DISCARD:
+        break;
+    default:
+        fprintf(stderr, "%s: invalid AIO request type 0x%x.\n",
+                        __func__, type);
+        return NULL;
+    }
+
+    luringcb = qemu_aio_get(&luring_aiocb_info, bs, cb, opaque);
+    luringcb->fd = fd;
+    luringcb->type = type;
+    luringcb->offset = sector_num * BDRV_SECTOR_SIZE;
+    luringcb->nbytes = (size_t)nb_sectors * BDRV_SECTOR_SIZE;
+    luringcb->qiov = qiov;
+    luringcb->done = 0;
+    luringcb->fixed = false;
+    luringcb->no_fixed = false;
+    memset(&luringcb->resubmit_qiov, 0, sizeof(luringcb->resubmit_qiov));
+
+    QSIMPLEQ_INSERT_TAIL(&s->io_q.pending, luringcb, next);
+    if (!s->io_q.plugged) {
+        /* When nothing is in flight the device is idle and no completion
+         * is going to bring more requests along, so do not wait for them */
+        if (!s->batch || !s->io_q.in_flight) {
+            ioq_submit(s);
+        }
+        if (s->batch || s->poll_ns) {
+            qemu_bh_schedule(s->submit_bh);
+        }
+    }
+    return &luringcb->common;
+}
+
+static void luring_unregister_buffers(struct qemu_luring_state *s)
+{
+    if (s->nr_fixed) {
+        io_uring_unregister_buffers(&s->ring);
+        g_free(s->fixed);
+        s->fixed = NULL;
+        s->nr_fixed = 0;
+    }
+}
+
+static int iovec_compare(const void *a, const void *b)
+{
+    const struct iovec *x = a, *y = b;
+
+    if (x->iov_base == y->iov_base) {
+        return 0;
+    }
+    return (uintptr_t)x->iov_base < (uintptr_t)y->iov_base ? -1 : 1;
+}
+
+/*
+ * Registers guest RAM as fixed buffers, so that the kernel does not have
+ * to map and pin the pages of every request that reads or writes it.
+ * Requests that do not fall in one buffer use plain readv and writev.
+ *
+ * Requests in the rings name their buffer by index, and registering again
+ * renumbers the buffers, so wait until none is in flight.
+ */
+static void luring_register_bh(void *opaque)
+{
+    struct qemu_luring_state *s = opaque;
+    struct iovec *ram;
+    int i, ret;
+
+    if (s->io_q.in_flight) {
+        s->register_pending = true;
+        return;
+    }
+    luring_unregister_buffers(s);
+    if (!s->fixed_buffers || !s->nr_ram) {
+        return;
+    }
+
+    ram = g_memdup(s->ram, s->nr_ram * sizeof(*ram));
+    qsort(ram, s->nr_ram, sizeof(*ram), iovec_compare);
+
+    s->fixed = g_new(struct iovec, MAX_FIXED_BUFFERS);
+    for (i = 0; i < s->nr_ram; i++) {
+        uint8_t *base = ram[i].iov_base;
+        size_t left = ram[i].iov_len;
+
+        while (left && s->nr_fixed < MAX_FIXED_BUFFERS) {
+            size_t len = MIN(left, MAX_FIXED_BUFFER_SIZE);
+
+            s->fixed[s->nr_fixed].iov_base = base;
+            s->fixed[s->nr_fixed].iov_len = len;
+            s->nr_fixed++;
+            base += len;
+            left -= len;
+        }
+    }
+    g_free(ram);
+
+    ret = io_uring_register_buffers(&s->ring, s->fixed, s->nr_fixed);
+    if (ret < 0) {
+        if (!s->fixed_failed) {
+            error_report("io_uring: could not register guest RAM (%s), "
+                         "using unregistered buffers", strerror(-ret));
+            s->fixed_failed = true;
+        }
+        g_free(s->fixed);
+        s->fixed = NULL;
+        s->nr_fixed = 0;
+    }
+}
+
+static void luring_ram_block_added(RAMBlockNotifier *n, void *host,
+                                   size_t size)
+{
+    struct qemu_luring_state *s = container_of(n, struct qemu_luring_state,
+                                               ram_notifier);
+
+    if (s->aio_context) {
+        aio_context_acquire(s->aio_context);
+    }
+    s->ram = g_renew(struct iovec, s->ram, s->nr_ram + 1);
+    s->ram[s->nr_ram].iov_base = host;
+    s->ram[s->nr_ram].iov_len = size;
+    s->nr_ram++;
+    if (s->register_bh) {
+        qemu_bh_schedule(s->register_bh);
+    } else {
+        /* Registered again when a context is attached */
+        luring_unregister_buffers(s);
+    }
+    if (s->aio_context) {
+        aio_context_release(s->aio_context);
+    }
+}
+
+static void luring_ram_block_removed(RAMBlockNotifier *n, void *host,
+                                     size_t size)
+{
+    struct qemu_luring_state *s = container_of(n, struct qemu_luring_state,
+                                               ram_notifier);
+    int i;
+
+    if (s->aio_context) {
+        aio_context_acquire(s->aio_context);
+    }
+    for (i = 0; i < s->nr_ram; i++) {
+        if (s->ram[i].iov_base == host) {
+            s->ram[i] = s->ram[--s->nr_ram];
+            break;
+        }
+    }
+    /* Do not keep the pages of the block pinned until register_bh runs.
+     * Requests still in flight on the old buffers fail with EFAULT and
+     * are submitted again without them.  */
+    luring_unregister_buffers(s);
+    if (s->register_bh) {
+        qemu_bh_schedule(s->register_bh);
+    }
+    if (s->aio_context) {
+        aio_context_release(s->aio_context);
+    }
+}
+
+void luring_detach_aio_context(void *s_, AioContext *old_context)
+{
+    struct qemu_luring_state *s = s_;
+
+    aio_set_event_notifier(old_context, &s->e, NULL);
+    qemu_bh_delete(s->completion_bh);
+    qemu_bh_delete(s->submit_bh);
+    qemu_bh_delete(s->register_bh);
+    s->register_bh = NULL;
+    s->aio_context = NULL;
+}
+
+void luring_attach_aio_context(void *s_, AioContext *new_context)
+{
+    struct qemu_luring_state *s = s_;
+
+    s->aio_context = new_context;
+    s->completion_bh = aio_bh_new(new_context, luring_completion_bh, s);
+    s->submit_bh = aio_bh_new(new_context, luring_submit_bh, s);
+    s->register_bh = aio_bh_new(new_context, luring_register_bh, s);
+    aio_set_event_notifier(new_context, &s->e, luring_completion_cb);
+    aio_set_event_notifier_poll(new_context, &s->e, luring_poll_cb);
+    if (s->fixed_buffers && (!s->nr_fixed || s->register_pending)) {
+        s->register_pending = false;
+        qemu_bh_schedule(s->register_bh);
+    }
+}
+
+void luring_set_params(void *s_, bool batch, int64_t poll_ns,
+                       bool fixed_buffers)
+{
+    struct qemu_luring_state *s = s_;
+
+    s->batch = batch;
+    s->poll_ns = poll_ns;
+
+    if (fixed_buffers == s->fixed_buffers) {
+        return;
+    }
+    s->fixed_buffers = fixed_buffers;
+    if (fixed_buffers) {
+        s->fixed_failed = false;
+        ram_block_notifier_add(&s->ram_notifier);
+    } else {
+        ram_block_notifier_remove(&s->ram_notifier);
+        luring_unregister_buffers(s);
+        g_free(s->ram);
+        s->ram = NULL;
+        s->nr_ram = 0;
+    }
+}
+
+bool luring_has_fallocate(void *s_)
+{
+    struct qemu_luring_state *s = s_;
+    struct io_uring_probe *probe;
+    bool ret;
+
+    /* Kernels without IORING_REGISTER_PROBE have no IORING_OP_FALLOCATE */
+    probe = io_uring_get_probe_ring(&s->ring);
+    if (!probe) {
+        return false;
+    }
+    ret = io_uring_opcode_supported(probe, IORING_OP_FALLOCATE);
+    io_uring_free_probe(probe);
+    return ret;
+}
+
+void *luring_init(void)
+{
+    struct qemu_luring_state *s;
+    int ret;
+
+    s = g_malloc0(sizeof(*s));
+    if (event_notifier_init(&s->e, false) < 0) {
+        goto out_free_state;
+    }
+
+    /* liburing returns -errno, the caller looks at errno */
+    ret = io_uring_queue_init(MAX_ENTRIES, &s->ring, 0);
+    if (ret < 0) {
+        errno = -ret;
+        goto out_close_efd;
+    }
+
+    ret = io_uring_register_eventfd(&s->ring, event_notifier_get_fd(&s->e));
+    if (ret < 0) {
+        errno = -ret;
+        goto out_queue_exit;
+    }
+
+    ioq_init(&s->io_q);
+    s->batch = true;
+    s->ram_notifier.ram_block_added = luring_ram_block_added;
+    s->ram_notifier.ram_block_removed = luring_ram_block_removed;
+
+    return s;
+
+out_queue_exit:
+    io_uring_queue_exit(&s->ring);
+out_close_efd:
+    event_notifier_cleanup(&s->e);
+out_free_state:
+    g_free(s);
+    return NULL;
+}
+
+void luring_cleanup(void *s_)
+{
+    struct qemu_luring_state *s = s_;
+
+    luring_set_params(s, s->batch, s->poll_ns, false);
+    event_notifier_cleanup(&s->e);
+    io_uring_queue_exit(&s->ring);
+    g_free(s);
+}
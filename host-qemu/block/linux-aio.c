@@ -12,6 +12,7 @@
 #include "qemu/queue.h"
 #include "block/raw-aio.h"
 #include "qemu/event_notifier.h"
+#include "qemu/timer.h"
 
 #include <libaio.h>
 
@@ -27,6 +28,23 @@
 
 #define MAX_QUEUED_IO  128
 
+/*
+ * Layout of the completion ring that io_setup() maps into our address
+ * space; the io_context_t is its address.  The kernel adds events at the
+ * tail and we consume them from the head without entering the kernel.
+ */
+struct aio_ring {
+    unsigned id;
+    unsigned nr;
+    unsigned head;
+    unsigned tail;
+    unsigned magic;
+    unsigned compat_features;
+    unsigned incompat_features;
+    unsigned header_length;
+    struct io_event io_events[0];
+};
+
 struct qemu_laiocb {
     BlockAIOCB common;
     struct qemu_laio_state *ctx;
@@ -41,6 +59,7 @@ struct qemu_laiocb {
 typedef struct {
     int plugged;
     unsigned int n;
+    unsigned int in_flight;
     bool blocked;
     QSIMPLEQ_HEAD(, qemu_laiocb) pending;
 } LaioQueue;
@@ -52,9 +71,16 @@ struct qemu_laio_state {
     /* io queue for submit at batch */
     LaioQueue io_q;
 
+    /* Requests that arrive while others are in flight are submitted
+     * together by submit_bh at the end of the event loop iteration */
+    bool batch;
+    QEMUBH *submit_bh;
+
+    /* Busy-wait this long for completions before going back to sleep */
+    int64_t poll_ns;
+
     /* I/O completion processing */
     QEMUBH *completion_bh;
-    struct io_event events[MAX_EVENTS];
     int event_idx;
     int event_max;
 };
@@ -93,54 +119,112 @@ static void qemu_laio_process_completion(struct qemu_laio_state *s,
     qemu_aio_unref(laiocb);
 }
 
-/* The completion BH fetches completed I/O requests and invokes their
- * callbacks.
+/*
+ * Return the completion events that are in the ring, or the first part of
+ * them if they wrap around, without a system call.
+ */
+static unsigned int io_getevents_peek(io_context_t ctx,
+                                      struct io_event **events)
+{
+    struct aio_ring *ring = (struct aio_ring *)ctx;
+    unsigned int head = ring->head, tail = atomic_read(&ring->tail);
+    unsigned int nr;
+
+    nr = tail >= head ? tail - head : ring->nr - head;
+    *events = ring->io_events + head;
+    /* Do not read the events before the tail.  Pairs with the write
+     * barrier in the kernel's aio_complete(). */
+    smp_rmb();
+
+    return nr;
+}
+
+/* Give the first @nr events returned by io_getevents_peek() back */
+static void io_getevents_commit(io_context_t ctx, unsigned int nr)
+{
+    struct aio_ring *ring = (struct aio_ring *)ctx;
+
+    if (nr) {
+        smp_mb();
+        atomic_set(&ring->head, (ring->head + nr) % ring->nr);
+    }
+}
+
+/* Processes the completions in the ring and invokes their callbacks.
  *
  * The function is somewhat tricky because it supports nested event loops, for
  * example when a request callback invokes aio_poll().  In order to do this,
- * the completion events array and index are kept in qemu_laio_state.  The BH
- * reschedules itself as long as there are completions pending so it will
- * either be called again in a nested event loop or will be called after all
- * events have been completed.  When there are no events left to complete, the
- * BH returns without rescheduling.
+ * the index of the next event and the number of events peeked are kept in
+ * qemu_laio_state, and events are only given back to the kernel by whoever
+ * peeks next.  The completion BH is scheduled while callbacks run so that a
+ * nested event loop sees the pending completions; a nested call leaves
+ * event_max at zero, which ends the loop of the caller above it.
  */
-static void qemu_laio_completion_bh(void *opaque)
+static void qemu_laio_process_completions(struct qemu_laio_state *s)
 {
-    struct qemu_laio_state *s = opaque;
-
-    /* Fetch more completion events when empty */
-    if (s->event_idx == s->event_max) {
-        do {
-            struct timespec ts = { 0 };
-            s->event_max = io_getevents(s->ctx, MAX_EVENTS, MAX_EVENTS,
-                                        s->events, &ts);
-        } while (s->event_max == -EINTR);
-
-        s->event_idx = 0;
-        if (s->event_max <= 0) {
-            s->event_max = 0;
-            return; /* no more events */
-        }
-    }
+    struct io_event *events;
 
     /* Reschedule so nested event loops see currently pending completions */
     qemu_bh_schedule(s->completion_bh);
 
-    /* Process completion events */
-    while (s->event_idx < s->event_max) {
-        struct iocb *iocb = s->events[s->event_idx].obj;
-        struct qemu_laiocb *laiocb =
-                container_of(iocb, struct qemu_laiocb, iocb);
+    for (;;) {
+        io_getevents_commit(s->ctx, s->event_idx);
+        s->event_max = io_getevents_peek(s->ctx, &events);
+        if (!s->event_max) {
+            break;
+        }
+        for (s->event_idx = 0; s->event_idx < s->event_max; ) {
+            struct iocb *iocb = events[s->event_idx].obj;
+            struct qemu_laiocb *laiocb =
+                    container_of(iocb, struct qemu_laiocb, iocb);
+
+            laiocb->ret = io_event_ret(&events[s->event_idx]);
+
+            /* Update the counters first, we can be nested */
+            s->io_q.in_flight--;
+            s->event_idx++;
+            qemu_laio_process_completion(s, laiocb);
+        }
+    }
 
-        laiocb->ret = io_event_ret(&s->events[s->event_idx]);
-        s->event_idx++;
+    qemu_bh_cancel(s->completion_bh);
+    s->event_idx = 0;
+    s->event_max = 0;
+}
 
-        qemu_laio_process_completion(s, laiocb);
+/*
+ * Spin for up to poll_ns waiting for a completion to show up in the ring,
+ * and let the completion BH run if one does.  This saves the wake-up from
+ * ppoll() on devices that complete requests within a few microseconds.
+ */
+static void qemu_laio_poll(struct qemu_laio_state *s)
+{
+    struct io_event *events;
+    int64_t deadline;
+
+    if (!s->poll_ns || !s->io_q.in_flight) {
+        return;
     }
 
+    deadline = qemu_clock_get_ns(QEMU_CLOCK_REALTIME) + s->poll_ns;
+    do {
+        if (io_getevents_peek(s->ctx, &events)) {
+            qemu_bh_schedule(s->completion_bh);
+            return;
+        }
+    } while (qemu_clock_get_ns(QEMU_CLOCK_REALTIME) < deadline);
+}
+
+static void qemu_laio_completion_bh(void *opaque)
+{
+    struct qemu_laio_state *s = opaque;
+
+    qemu_laio_process_completions(s);
+
     if (!s->io_q.plugged && !QSIMPLEQ_EMPTY(&s->io_q.pending)) {
         ioq_submit(s);
     }
+    qemu_laio_poll(s);
 }
 
 static void qemu_laio_completion_cb(EventNotifier *e)
@@ -152,6 +236,24 @@ static void qemu_laio_completion_cb(EventNotifier *e)
     }
 }
 
+/* Busy polling callback for the AioContext, see aio_set_poll_handler() */
+static bool qemu_laio_poll_cb(void *opaque)
+{
+    EventNotifier *e = opaque;
+    struct qemu_laio_state *s = container_of(e, struct qemu_laio_state, e);
+    struct io_event *events;
+
+    if (!io_getevents_peek(s->ctx, &events)) {
+        return false;
+    }
+
+    qemu_laio_process_completions(s);
+    if (!s->io_q.plugged && !QSIMPLEQ_EMPTY(&s->io_q.pending)) {
+        ioq_submit(s);
+    }
+    return true;
+}
+
 static void laio_cancel(BlockAIOCB *blockacb)
 {
     struct qemu_laiocb *laiocb = (struct qemu_laiocb *)blockacb;
@@ -167,6 +269,7 @@ static void laio_cancel(BlockAIOCB *blockacb)
         /* iocb is not cancelled, cb will be called by the event loop later */
         return;
     }
+    laiocb->ctx->io_q.in_flight--;
 
     laiocb->common.cb(laiocb->common.opaque, laiocb->ret);
 }
@@ -181,6 +284,7 @@ static void ioq_init(LaioQueue *io_q)
     QSIMPLEQ_INIT(&io_q->pending);
     io_q->plugged = 0;
     io_q->n = 0;
+    io_q->in_flight = 0;
     io_q->blocked = false;
 }
 
@@ -192,10 +296,16 @@ static void ioq_submit(struct qemu_laio_state *s)
     QSIMPLEQ_HEAD(, qemu_laiocb) completed;
 
     do {
+        /* The ring has room for MAX_EVENTS requests, wait for completions
+         * rather than getting EAGAIN */
+        if (s->io_q.in_flight >= MAX_EVENTS) {
+            break;
+        }
         len = 0;
         QSIMPLEQ_FOREACH(aiocb, &s->io_q.pending, next) {
             iocbs[len++] = &aiocb->iocb;
-            if (len == MAX_QUEUED_IO) {
+            if (len == MAX_QUEUED_IO ||
+                s->io_q.in_flight + len == MAX_EVENTS) {
                 break;
             }
         }
@@ -209,12 +319,24 @@ static void ioq_submit(struct qemu_laio_state *s)
         }
 
         s->io_q.n -= ret;
+        s->io_q.in_flight += ret;
         aiocb = container_of(iocbs[ret - 1], struct qemu_laiocb, iocb);
         QSIMPLEQ_SPLIT_AFTER(&s->io_q.pending, aiocb, next, &completed);
     } while (ret == len && !QSIMPLEQ_EMPTY(&s->io_q.pending));
     s->io_q.blocked = (s->io_q.n > 0);
 }
 
+static void qemu_laio_submit_bh(void *opaque)
+{
+    struct qemu_laio_state *s = opaque;
+
+    if (!s->io_q.plugged && !s->io_q.blocked &&
+        !QSIMPLEQ_EMPTY(&s->io_q.pending)) {
+        ioq_submit(s);
+    }
+    qemu_laio_poll(s);
+}
+
 void laio_io_plug(BlockDriverState *bs, void *aio_ctx)
 {
     struct qemu_laio_state *s = aio_ctx;
@@ -272,9 +394,20 @@ BlockAIOCB *laio_submit(BlockDriverState *bs, void *aio_ctx, int fd,
 
     QSIMPLEQ_INSERT_TAIL(&s->io_q.pending, laiocb, next);
     s->io_q.n++;
-    if (!s->io_q.blocked &&
-        (!s->io_q.plugged || s->io_q.n >= MAX_QUEUED_IO)) {
+    if (s->io_q.blocked) {
+        return &laiocb->common;
+    }
+    if (s->io_q.n >= MAX_QUEUED_IO) {
         ioq_submit(s);
+    } else if (!s->io_q.plugged) {
+        /* When nothing is in flight the device is idle and no completion
+         * is going to bring more requests along, so do not wait for them */
+        if (!s->batch || !s->io_q.in_flight) {
+            ioq_submit(s);
+        }
+        if (s->batch || s->poll_ns) {
+            qemu_bh_schedule(s->submit_bh);
+        }
     }
     return &laiocb->common;
 
@@ -289,6 +422,7 @@ void laio_detach_aio_context(void *s_, AioContext *old_context)
 
     aio_set_event_notifier(old_context, &s->e, NULL);
     qemu_bh_delete(s->completion_bh);
+    qemu_bh_delete(s->submit_bh);
 }
 
 void laio_attach_aio_context(void *s_, AioContext *new_context)
@@ -296,7 +430,17 @@ void laio_attach_aio_context(void *s_, AioContext *new_context)
     struct qemu_laio_state *s = s_;
 
     s->completion_bh = aio_bh_new(new_context, qemu_laio_completion_bh, s);
+    s->submit_bh = aio_bh_new(new_context, qemu_laio_submit_bh, s);
     aio_set_event_notifier(new_context, &s->e, qemu_laio_completion_cb);
+    aio_set_event_notifier_poll(new_context, &s->e, qemu_laio_poll_cb);
+}
+
+void laio_set_params(void *s_, bool batch, int64_t poll_ns)
+{
+    struct qemu_laio_state *s = s_;
+
+    s->batch = batch;
+    s->poll_ns = poll_ns;
 }
 
 void *laio_init(void)
@@ -313,6 +457,7 @@ void *laio_init(void)
     }
 
     ioq_init(&s->io_q);
+    s->batch = true;
 
     return s;
 
@@ -24,14 +24,26 @@
 
 #include "block/block_int.h"
 #include "qemu-common.h"
+#include "qemu/host-utils.h"
+#include "qemu/queue.h"
 #include "qcow2.h"
 #include "trace.h"
 
+/*
+ * Cached tables are found through a hash table keyed by their offset.
+ * The tables that are not in use (ref == 0), including the empty ones,
+ * are kept on a list from least to most recently used, so a table to
+ * replace is always at its head.  lru_counter records when a table was
+ * last released, so that tables left unused for a while can be dropped
+ * and their memory given back.
+ */
 typedef struct Qcow2CachedTable {
     int64_t  offset;
     bool     dirty;
-    uint64_t lru_counter;
     int      ref;
+    uint64_t lru_counter;
+    QLIST_ENTRY(Qcow2CachedTable) hash_next;
+    QTAILQ_ENTRY(Qcow2CachedTable) lru_next;
 } Qcow2CachedTable;
 
 struct Qcow2Cache {
@@ -40,7 +52,11 @@ struct Qcow2Cache {
     int                     size;
     bool                    depends_on_flush;
     void                   *table_array;
+    QLIST_HEAD(, Qcow2CachedTable) *buckets;
+    int                     bucket_bits;
+    QTAILQ_HEAD(, Qcow2CachedTable) lru;
     uint64_t                lru_counter;
+    uint64_t                cache_clean_lru_counter;
 };
 
 static inline void *qcow2_cache_get_table_addr(BlockDriverState *bs,
@@ -60,6 +76,59 @@ static inline int qcow2_cache_get_table_idx(BlockDriverState *bs,
     return idx;
 }
 
+static inline int qcow2_cache_hash(BlockDriverState *bs, Qcow2Cache *c,
+                                   uint64_t offset)
+{
+    BDRVQcowState *s = bs->opaque;
+    uint64_t cluster = offset >> s->cluster_bits;
+
+    return (cluster * 0x9e3779b97f4a7c15ULL) >> (64 - c->bucket_bits);
+}
+
+static Qcow2CachedTable *qcow2_cache_lookup(BlockDriverState *bs,
+                                            Qcow2Cache *c, uint64_t offset)
+{
+    Qcow2CachedTable *t;
+
+    QLIST_FOREACH(t, &c->buckets[qcow2_cache_hash(bs, c, offset)],
+                  hash_next) {
+        if (t->offset == offset) {
+            return t;
+        }
+    }
+    return NULL;
+}
+
+static void qcow2_cache_table_release(BlockDriverState *bs, Qcow2Cache *c,
+                                      int i)
+{
+    BDRVQcowState *s = bs->opaque;
+    uintptr_t mask = getpagesize() - 1;
+    uintptr_t start, end;
+
+    /* Only whole host pages can be released */
+    start = ((uintptr_t) qcow2_cache_get_table_addr(bs, c, i) + mask) & ~mask;
+    end = ((uintptr_t) qcow2_cache_get_table_addr(bs, c, i) + s->cluster_size)
+          & ~mask;
+    if (end > start) {
+        qemu_madvise((void *) start, end - start, QEMU_MADV_DONTNEED);
+    }
+}
+
+static void qcow2_cache_reset(Qcow2Cache *c)
+{
+    int i;
+
+    for (i = 0; i < 1 << c->bucket_bits; i++) {
+        QLIST_INIT(&c->buckets[i]);
+    }
+    QTAILQ_INIT(&c->lru);
+    for (i = 0; i < c->size; i++) {
+        c->entries[i].offset = 0;
+        QTAILQ_INSERT_TAIL(&c->lru, &c->entries[i], lru_next);
+    }
+}
+
 Qcow2Cache *qcow2_cache_create(BlockDriverState *bs, int num_tables)
 {
     BDRVQcowState *s = bs->opaque;
@@ -67,17 +136,22 @@ Qcow2Cache *qcow2_cache_create(BlockDriverState *bs, int num_tables)
 
     c = g_new0(Qcow2Cache, 1);
     c->size = num_tables;
+    /* At least one bucket per table */
+    c->bucket_bits = MAX(64 - clz64(num_tables - 1), 1);
     c->entries = g_try_new0(Qcow2CachedTable, num_tables);
+    c->buckets = g_try_malloc(sizeof(*c->buckets) << c->bucket_bits);
     c->table_array = qemu_try_blockalign(bs->file,
                                          (size_t) num_tables * s->cluster_size);
 
-    if (!c->entries || !c->table_array) {
+    if (!c->entries || !c->buckets || !c->table_array) {
         qemu_vfree(c->table_array);
+        g_free(c->buckets);
         g_free(c->entries);
         g_free(c);
-        c = NULL;
+        return NULL;
     }
 
+    qcow2_cache_reset(c);
     return c;
 }
 
@@ -90,6 +164,7 @@ int qcow2_cache_destroy(BlockDriverState *bs, Qcow2Cache *c)
     }
 
     qemu_vfree(c->table_array);
+    g_free(c->buckets);
     g_free(c->entries);
     g_free(c);
 
@@ -222,6 +297,33 @@ void qcow2_cache_depends_on_flush(Qcow2Cache *c)
     c->depends_on_flush = true;
 }
 
+/*
+ * Drop the clean tables that have not been used since the previous call
+ * and release their memory.  Tables that are in use or dirty stay cached.
+ */
+void qcow2_cache_clean_unused(BlockDriverState *bs, Qcow2Cache *c)
+{
+    Qcow2CachedTable *t;
+
+    QTAILQ_FOREACH(t, &c->lru, lru_next) {
+        if (!t->offset) {
+            continue;
+        }
+        /* The rest of the list was released after the previous call */
+        if (t->lru_counter > c->cache_clean_lru_counter) {
+            break;
+        }
+        if (t->dirty) {
+            continue;
+        }
+        QLIST_REMOVE(t, hash_next);
+        t->offset = 0;
+        qcow2_cache_table_release(bs, c, t - c->entries);
+    }
+
+    c->cache_clean_lru_counter = c->lru_counter;
+}
+
 int qcow2_cache_empty(BlockDriverState *bs, Qcow2Cache *c)
 {
     int ret, i;
@@ -233,11 +335,9 @@ int qcow2_cache_empty(BlockDriverState *bs, Qcow2Cache *c)
 
     for (i = 0; i < c->size; i++) {
         assert(c->entries[i].ref == 0);
-        c->entries[i].offset = 0;
-        c->entries[i].lru_counter = 0;
     }
 
-    c->lru_counter = 0;
+    qcow2_cache_reset(c);
 
     return 0;
 }
@@ -246,39 +346,32 @@ static int qcow2_cache_do_get(BlockDriverState *bs, Qcow2Cache *c,
     uint64_t offset, void **table, bool read_from_disk)
 {
     BDRVQcowState *s = bs->opaque;
+    Qcow2CachedTable *t;
     int i;
     int ret;
-    int lookup_index;
-    uint64_t min_lru_counter = UINT64_MAX;
-    int min_lru_index = -1;
 
     trace_qcow2_cache_get(qemu_coroutine_self(), c == s->l2_table_cache,
                           offset, read_from_disk);
 
     /* Check if the table is already cached */
-    i = lookup_index = (offset / s->cluster_size * 4) % c->size;
-    do {
-        const Qcow2CachedTable *t = &c->entries[i];
-        if (t->offset == offset) {
-            goto found;
-        }
-        if (t->ref == 0 && t->lru_counter < min_lru_counter) {
-            min_lru_counter = t->lru_counter;
-            min_lru_index = i;
-        }
-        if (++i == c->size) {
-            i = 0;
+    t = qcow2_cache_lookup(bs, c, offset);
+    if (t) {
+        i = t - c->entries;
+        if (t->ref == 0) {
+            QTAILQ_REMOVE(&c->lru, t, lru_next);
         }
-    } while (i != lookup_index);
+        goto found;
+    }
 
-    if (min_lru_index == -1) {
+    t = QTAILQ_FIRST(&c->lru);
+    if (!t) {
         /* This can't happen in current synchronous code, but leave the check
          * here as a reminder for whoever starts using AIO with the cache */
         abort();
     }
 
     /* Cache miss: write a table back and replace it */
-    i = min_lru_index;
+    i = t - c->entries;
     trace_qcow2_cache_get_replace_entry(qemu_coroutine_self(),
                                         c == s->l2_table_cache, i);
 
@@ -289,7 +382,11 @@ static int qcow2_cache_do_get(BlockDriverState *bs, Qcow2Cache *c,
 
     trace_qcow2_cache_get_read(qemu_coroutine_self(),
                                c == s->l2_table_cache, i);
-    c->entries[i].offset = 0;
+    if (t->offset) {
+        QLIST_REMOVE(t, hash_next);
+        t->offset = 0;
+    }
+    QTAILQ_REMOVE(&c->lru, t, lru_next);
     if (read_from_disk) {
         if (c == s->l2_table_cache) {
             BLKDBG_EVENT(bs->file, BLKDBG_L2_LOAD);
@@ -298,15 +395,19 @@ static int qcow2_cache_do_get(BlockDriverState *bs, Qcow2Cache *c,
         ret = bdrv_pread(bs->file, offset, qcow2_cache_get_table_addr(bs, c, i),
                          s->cluster_size);
         if (ret < 0) {
+            /* Leave the empty entry to be reused first */
+            QTAILQ_INSERT_HEAD(&c->lru, t, lru_next);
             return ret;
         }
     }
 
-    c->entries[i].offset = offset;
+    t->offset = offset;
+    QLIST_INSERT_HEAD(&c->buckets[qcow2_cache_hash(bs, c, offset)], t,
+                      hash_next);
 
     /* And return the right table */
 found:
-    c->entries[i].ref++;
+    t->ref++;
     *table = qcow2_cache_get_table_addr(bs, c, i);
 
     trace_qcow2_cache_get_done(qemu_coroutine_self(),
@@ -336,6 +437,7 @@ void qcow2_cache_put(BlockDriverState *bs, Qcow2Cache *c, void **table)
 
     if (c->entries[i].ref == 0) {
         c->entries[i].lru_counter = ++c->lru_counter;
+        QTAILQ_INSERT_TAIL(&c->lru, &c->entries[i], lru_next);
     }
 
     assert(c->entries[i].ref >= 0);
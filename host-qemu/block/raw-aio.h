@@ -42,6 +42,23 @@ void laio_detach_aio_context(void *s, AioContext *old_context);
 void laio_attach_aio_context(void *s, AioContext *new_context);
 void laio_io_plug(BlockDriverState *bs, void *aio_ctx);
 void laio_io_unplug(BlockDriverState *bs, void *aio_ctx, bool unplug);
+void laio_set_params(void *s, bool batch, int64_t poll_ns);
+#endif
+
+/* io_uring.c - Linux io_uring implementation */
+#ifdef CONFIG_LINUX_IO_URING
+void *luring_init(void);
+void luring_cleanup(void *s);
+BlockAIOCB *luring_submit(BlockDriverState *bs, void *aio_ctx, int fd,
+        int64_t sector_num, QEMUIOVector *qiov, int nb_sectors,
+        BlockCompletionFunc *cb, void *opaque, int type);
+void luring_detach_aio_context(void *s, AioContext *old_context);
+void luring_attach_aio_context(void *s, AioContext *new_context);
+void luring_io_plug(BlockDriverState *bs, void *aio_ctx);
+void luring_io_unplug(BlockDriverState *bs, void *aio_ctx, bool unplug);
+void luring_set_params(void *s, bool batch, int64_t poll_ns,
+                       bool fixed_buffers);
+bool luring_has_fallocate(void *s);
 #endif
 
 #ifdef _WIN32
@@ -152,6 +152,16 @@ typedef struct BDRVRawState {
     int use_aio;
     void *aio_ctx;
 #endif
+#ifdef CONFIG_LINUX_IO_URING
+    bool use_linux_io_uring;
+    void *io_uring_ctx;
+    bool aio_fixed_buffers;
+    bool io_uring_discard;
+#endif
+#if defined(CONFIG_LINUX_AIO) || defined(CONFIG_LINUX_IO_URING)
+    bool aio_batch;
+    int64_t aio_poll_ns;
+#endif
 #ifdef CONFIG_XFS
     bool is_xfs:1;
 #endif
@@ -168,6 +178,9 @@ typedef struct BDRVRawReopenState {
 #ifdef CONFIG_LINUX_AIO
     int use_aio;
 #endif
+#ifdef CONFIG_LINUX_IO_URING
+    bool use_linux_io_uring;
+#endif
 } BDRVRawReopenState;
 
 static int fd_open(BlockDriverState *bs);
@@ -387,25 +400,37 @@ static void raw_parse_flags(int bdrv_flags, int *open_flags)
 
 static void raw_detach_aio_context(BlockDriverState *bs)
 {
-#ifdef CONFIG_LINUX_AIO
+#if defined(CONFIG_LINUX_AIO) || defined(CONFIG_LINUX_IO_URING)
     BDRVRawState *s = bs->opaque;
-
+#endif
+#ifdef CONFIG_LINUX_AIO
     if (s->use_aio) {
         laio_detach_aio_context(s->aio_ctx, bdrv_get_aio_context(bs));
     }
 #endif
+#ifdef CONFIG_LINUX_IO_URING
+    if (s->use_linux_io_uring) {
+        luring_detach_aio_context(s->io_uring_ctx, bdrv_get_aio_context(bs));
+    }
+#endif
 }
 
 static void raw_attach_aio_context(BlockDriverState *bs,
                                    AioContext *new_context)
 {
-#ifdef CONFIG_LINUX_AIO
+#if defined(CONFIG_LINUX_AIO) || defined(CONFIG_LINUX_IO_URING)
     BDRVRawState *s = bs->opaque;
-
+#endif
+#ifdef CONFIG_LINUX_AIO
     if (s->use_aio) {
         laio_attach_aio_context(s->aio_ctx, new_context);
     }
 #endif
+#ifdef CONFIG_LINUX_IO_URING
+    if (s->use_linux_io_uring) {
+        luring_attach_aio_context(s->io_uring_ctx, new_context);
+    }
+#endif
 }
 
 #ifdef CONFIG_LINUX_AIO
@@ -440,6 +465,26 @@ error:
 }
 #endif
 
+#ifdef CONFIG_LINUX_IO_URING
+static int raw_set_io_uring(void **io_uring_ctx, bool *use_linux_io_uring,
+                            int bdrv_flags)
+{
+    if (bdrv_flags & BDRV_O_IO_URING) {
+        /* if non-NULL, luring_init() has already been run */
+        if (*io_uring_ctx == NULL) {
+            *io_uring_ctx = luring_init();
+            if (!*io_uring_ctx) {
+                return -1;
+            }
+        }
+        *use_linux_io_uring = true;
+    } else {
+        *use_linux_io_uring = false;
+    }
+    return 0;
+}
+#endif
+
 static void raw_parse_filename(const char *filename, QDict *options,
                                Error **errp)
 {
@@ -460,6 +505,24 @@ static QemuOptsList raw_runtime_opts = {
             .type = QEMU_OPT_STRING,
             .help = "File name of the image",
         },
+        {
+            .name = "aio-batch",
+            .type = QEMU_OPT_BOOL,
+            .help = "Submit native AIO and io_uring requests that arrive in "
+                    "the same event loop iteration together (default: on)",
+        },
+        {
+            .name = "aio-poll-ns",
+            .type = QEMU_OPT_NUMBER,
+            .help = "Busy-wait this long for native AIO and io_uring "
+                    "completions before sleeping (default: 0)",
+        },
+        {
+            .name = "aio-fixed-buffers",
+            .type = QEMU_OPT_BOOL,
+            .help = "Register guest RAM with io_uring, which pins it in "
+                    "host memory (default: off)",
+        },
         { /* end of list */ }
     },
 };
@@ -490,6 +553,20 @@ static int raw_open_common(BlockDriverState *bs, QDict *options,
         goto fail;
     }
 
+#if defined(CONFIG_LINUX_AIO) || defined(CONFIG_LINUX_IO_URING)
+    s->aio_batch = qemu_opt_get_bool(opts, "aio-batch", true);
+    if (qemu_opt_get_number(opts, "aio-poll-ns", 0) >
+        NANOSECONDS_PER_SECOND) {
+        error_setg(errp, "aio-poll-ns may not exceed one second");
+        ret = -EINVAL;
+        goto fail;
+    }
+    s->aio_poll_ns = qemu_opt_get_number(opts, "aio-poll-ns", 0);
+#endif
+#ifdef CONFIG_LINUX_IO_URING
+    s->aio_fixed_buffers = qemu_opt_get_bool(opts, "aio-fixed-buffers", false);
+#endif
+
     s->open_flags = open_flags;
     raw_parse_flags(bdrv_flags, &s->open_flags);
 
@@ -511,6 +588,9 @@ static int raw_open_common(BlockDriverState *bs, QDict *options,
         error_setg_errno(errp, -ret, "Could not set AIO state");
         goto fail;
     }
+    if (s->aio_ctx) {
+        laio_set_params(s->aio_ctx, s->aio_batch, s->aio_poll_ns);
+    }
     if (!s->use_aio && (bdrv_flags & BDRV_O_NATIVE_AIO)) {
         error_printf("WARNING: aio=native was specified for '%s', but "
                      "it requires cache.direct=on, which was not "
@@ -521,6 +601,20 @@ static int raw_open_common(BlockDriverState *bs, QDict *options,
     }
 #endif
 
+#ifdef CONFIG_LINUX_IO_URING
+    if (raw_set_io_uring(&s->io_uring_ctx, &s->use_linux_io_uring,
+                         bdrv_flags)) {
+        qemu_close(fd);
+        ret = -errno;
+        error_setg_errno(errp, -ret, "Could not set up io_uring");
+        goto fail;
+    }
+    if (s->io_uring_ctx) {
+        luring_set_params(s->io_uring_ctx, s->aio_batch, s->aio_poll_ns,
+                          s->aio_fixed_buffers);
+    }
+#endif
+
     s->has_discard = true;
     s->has_write_zeroes = true;
     if ((bs->open_flags & BDRV_O_NOCACHE) != 0) {
@@ -572,10 +666,30 @@ static int raw_open_common(BlockDriverState *bs, QDict *options,
     }
 #endif
 
+#ifdef CONFIG_LINUX_IO_URING
+    /* Punch holes in regular files through the ring; XFS uses its own
+     * ioctl and block devices use BLKDISCARD in the thread pool */
+    if (s->use_linux_io_uring && S_ISREG(st.st_mode)) {
+        s->io_uring_discard = luring_has_fallocate(s->io_uring_ctx);
+#ifdef CONFIG_XFS
+        if (s->is_xfs) {
+            s->io_uring_discard = false;
+        }
+#endif
+    }
+#endif
+
     raw_attach_aio_context(bs, bdrv_get_aio_context(bs));
 
     ret = 0;
 fail:
+#ifdef CONFIG_LINUX_IO_URING
+    if (ret < 0 && s->io_uring_ctx) {
+        luring_cleanup(s->io_uring_ctx);
+        s->io_uring_ctx = NULL;
+        s->use_linux_io_uring = false;
+    }
+#endif
     if (filename && (bdrv_flags & BDRV_O_TEMPORARY)) {
         unlink(filename);
     }
@@ -624,6 +738,24 @@ static int raw_reopen_prepare(BDRVReopenState *state,
         error_setg(errp, "Could not set AIO state");
         return -1;
     }
+    if (s->aio_ctx) {
+        laio_set_params(s->aio_ctx, s->aio_batch, s->aio_poll_ns);
+    }
+#endif
+
+#ifdef CONFIG_LINUX_IO_URING
+    raw_s->use_linux_io_uring = s->use_linux_io_uring;
+
+    /* like aio_ctx above, io_uring_ctx is kept if io_uring is disabled */
+    if (raw_set_io_uring(&s->io_uring_ctx, &raw_s->use_linux_io_uring,
+                         state->flags)) {
+        error_setg(errp, "Could not set up io_uring");
+        return -1;
+    }
+    if (s->io_uring_ctx) {
+        luring_set_params(s->io_uring_ctx, s->aio_batch, s->aio_poll_ns,
+                          s->aio_fixed_buffers);
+    }
 #endif
 
     if (s->type == FTYPE_FD || s->type == FTYPE_CD) {
@@ -705,6 +837,9 @@ static void raw_reopen_commit(BDRVReopenState *state)
 #ifdef CONFIG_LINUX_AIO
     s->use_aio = raw_s->use_aio;
 #endif
+#ifdef CONFIG_LINUX_IO_URING
+    s->use_linux_io_uring = raw_s->use_linux_io_uring;
+#endif
 
     g_free(state->opaque);
     state->opaque = NULL;
@@ -1325,12 +1460,23 @@ static BlockAIOCB *raw_aio_submit(BlockDriverState *bs,
     if (s->needs_alignment) {
         if (!bdrv_qiov_is_aligned(bs, qiov)) {
             type |= QEMU_AIO_MISALIGNED;
+#ifdef CONFIG_LINUX_IO_URING
+        } else if (s->use_linux_io_uring) {
+            return luring_submit(bs, s->io_uring_ctx, s->fd, sector_num, qiov,
+                                 nb_sectors, cb, opaque, type);
+#endif
 #ifdef CONFIG_LINUX_AIO
         } else if (s->use_aio) {
             return laio_submit(bs, s->aio_ctx, s->fd, sector_num, qiov,
                                nb_sectors, cb, opaque, type);
 #endif
         }
+#ifdef CONFIG_LINUX_IO_URING
+    } else if (s->use_linux_io_uring) {
+        /* io_uring also does buffered I/O without blocking the caller */
+        return luring_submit(bs, s->io_uring_ctx, s->fd, sector_num, qiov,
+                             nb_sectors, cb, opaque, type);
+#endif
     }
 
     return paio_submit(bs, s->fd, sector_num, qiov, nb_sectors,
@@ -1339,32 +1485,53 @@ static BlockAIOCB *raw_aio_submit(BlockDriverState *bs,
 
 static void raw_aio_plug(BlockDriverState *bs)
 {
-#ifdef CONFIG_LINUX_AIO
+#if defined(CONFIG_LINUX_AIO) || defined(CONFIG_LINUX_IO_URING)
     BDRVRawState *s = bs->opaque;
+#endif
+#ifdef CONFIG_LINUX_AIO
     if (s->use_aio) {
         laio_io_plug(bs, s->aio_ctx);
     }
 #endif
+#ifdef CONFIG_LINUX_IO_URING
+    if (s->use_linux_io_uring) {
+        luring_io_plug(bs, s->io_uring_ctx);
+    }
+#endif
 }
 
 static void raw_aio_unplug(BlockDriverState *bs)
 {
-#ifdef CONFIG_LINUX_AIO
+#if defined(CONFIG_LINUX_AIO) || defined(CONFIG_LINUX_IO_URING)
     BDRVRawState *s = bs->opaque;
+#endif
+#ifdef CONFIG_LINUX_AIO
     if (s->use_aio) {
         laio_io_unplug(bs, s->aio_ctx, true);
     }
 #endif
+#ifdef CONFIG_LINUX_IO_URING
+    if (s->use_linux_io_uring) {
+        luring_io_unplug(bs, s->io_uring_ctx, true);
+    }
+#endif
 }
 
 static void raw_aio_flush_io_queue(BlockDriverState *bs)
 {
-#ifdef CONFIG_LINUX_AIO
+#if defined(CONFIG_LINUX_AIO) || defined(CONFIG_LINUX_IO_URING)
     BDRVRawState *s = bs->opaque;
+#endif
+#ifdef CONFIG_LINUX_AIO
     if (s->use_aio) {
         laio_io_unplug(bs, s->aio_ctx, false);
     }
 #endif
+#ifdef CONFIG_LINUX_IO_URING
+    if (s->use_linux_io_uring) {
+        luring_io_unplug(bs, s->io_uring_ctx, false);
+    }
+#endif
 }
 
 static BlockAIOCB *raw_aio_readv(BlockDriverState *bs,
@@ -1391,6 +1558,12 @@ static BlockAIOCB *raw_aio_flush(BlockDriverState *bs,
     if (fd_open(bs) < 0)
         return NULL;
 
+#ifdef CONFIG_LINUX_IO_URING
+    if (s->use_linux_io_uring) {
+        return luring_submit(bs, s->io_uring_ctx, s->fd, 0, NULL, 0,
+                             cb, opaque, QEMU_AIO_FLUSH);
+    }
+#endif
     return paio_submit(bs, s->fd, 0, NULL, 0, cb, opaque, QEMU_AIO_FLUSH);
 }
 
@@ -1404,6 +1577,12 @@ static void raw_close(BlockDriverState *bs)
     if (s->use_aio) {
         laio_cleanup(s->aio_ctx);
     }
+#endif
+#ifdef CONFIG_LINUX_IO_URING
+    if (s->io_uring_ctx) {
+        luring_cleanup(s->io_uring_ctx);
+        s->io_uring_ctx = NULL;
+    }
 #endif
     if (s->fd >= 0) {
         qemu_close(s->fd);
@@ -1872,12 +2051,45 @@ static int64_t coroutine_fn raw_co_get_block_status(BlockDriverState *bs,
     return ret | BDRV_BLOCK_OFFSET_VALID | start;
 }
 
+#ifdef CONFIG_LINUX_IO_URING
+typedef struct RawDiscardData {
+    BlockDriverState *bs;
+    BlockCompletionFunc *cb;
+    void *opaque;
+} RawDiscardData;
+
+/* Like handle_aiocb_discard(), stop discarding if the file cannot do it */
+static void raw_luring_discard_cb(void *opaque, int ret)
+{
+    RawDiscardData *data = opaque;
+    BDRVRawState *s = data->bs->opaque;
+
+    if (ret == -ENOTSUP) {
+        s->has_discard = false;
+    }
+    data->cb(data->opaque, ret);
+    g_free(data);
+}
+#endif
+
 static coroutine_fn BlockAIOCB *raw_aio_discard(BlockDriverState *bs,
     int64_t sector_num, int nb_sectors,
     BlockCompletionFunc *cb, void *opaque)
 {
     BDRVRawState *s = bs->opaque;
 
+#ifdef CONFIG_LINUX_IO_URING
+    if (s->use_linux_io_uring && s->io_uring_discard && s->has_discard) {
+        RawDiscardData *data = g_new(RawDiscardData, 1);
+
+        data->bs = bs;
+        data->cb = cb;
+        data->opaque = opaque;
+        return luring_submit(bs, s->io_uring_ctx, s->fd, sector_num, NULL,
+                             nb_sectors, raw_luring_discard_cb, data,
+                             QEMU_AIO_DISCARD);
+    }
+#endif
     return paio_submit(bs, s->fd, sector_num, NULL, nb_sectors,
                        cb, opaque, QEMU_AIO_DISCARD);
 }
@@ -910,6 +910,124 @@ static void flush_queued_work(CPUState *cpu)
     qemu_cond_broadcast(&qemu_work_cond);
 }
 
+/***********************************************************/
+/* vCPU throttling */
+
+/* Every CPU_THROTTLE_TIMESLICE_NS, each throttled vCPU is kept from
+ * running for its throttle percentage of the slice.  With KVM the vCPU
+ * thread sleeps; with TCG, where all vCPUs share one thread, the vCPU is
+ * skipped by tcg_exec_all() and the thread only sleeps when no vCPU is
+ * left to run.
+ */
+static QEMUTimer *throttle_timer;
+
+static bool cpu_throttled(CPUState *cpu, int64_t now)
+{
+    return cpu->throttle_until > now;
+}
+
+static void cpu_throttle_thread(void *opaque)
+{
+    CPUState *cpu = opaque;
+    int64_t now = qemu_clock_get_ns(QEMU_CLOCK_REALTIME);
+
+    if (cpu_throttled(cpu, now)) {
+        qemu_mutex_unlock_iothread();
+        g_usleep((cpu->throttle_until - now) / SCALE_US);
+        qemu_mutex_lock_iothread();
+    }
+    atomic_set(&cpu->throttle_pending, false);
+}
+
+static void cpu_throttle_timer_tick(void *opaque)
+{
+    int64_t now = qemu_clock_get_ns(QEMU_CLOCK_REALTIME);
+    bool active = false;
+    CPUState *cpu;
+
+    CPU_FOREACH(cpu) {
+        int pct = atomic_read(&cpu->throttle_percentage);
+
+        if (!pct) {
+            continue;
+        }
+        active = true;
+        cpu->throttle_until = now + CPU_THROTTLE_TIMESLICE_NS / 100 * pct;
+        if (tcg_enabled()) {
+            cpu_exit(cpu);
+        } else if (!atomic_xchg(&cpu->throttle_pending, true)) {
+            async_run_on_cpu(cpu, cpu_throttle_thread, cpu);
+        }
+    }
+    if (active) {
+        timer_mod(throttle_timer, qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL_RT) +
+                                  CPU_THROTTLE_TIMESLICE_NS);
+    }
+}
+
+void cpu_throttle_set(CPUState *cpu, int new_throttle_pct)
+{
+    new_throttle_pct = MIN(MAX(new_throttle_pct, 0), CPU_THROTTLE_PCT_MAX);
+    atomic_set(&cpu->throttle_percentage, new_throttle_pct);
+    if (!new_throttle_pct) {
+        cpu->throttle_until = 0;
+        return;
+    }
+
+    if (!throttle_timer) {
+        throttle_timer = timer_new_ns(QEMU_CLOCK_VIRTUAL_RT,
+                                      cpu_throttle_timer_tick, NULL);
+    }
+    if (!timer_pending(throttle_timer)) {
+        timer_mod(throttle_timer, qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL_RT) +
+                                  CPU_THROTTLE_TIMESLICE_NS);
+    }
+}
+
+void cpu_throttle_stop(void)
+{
+    CPUState *cpu;
+
+    CPU_FOREACH(cpu) {
+        cpu_throttle_set(cpu, 0);
+    }
+    if (throttle_timer) {
+        timer_del(throttle_timer);
+    }
+}
+
+int cpu_throttle_get_percentage(CPUState *cpu)
+{
+    return atomic_read(&cpu->throttle_percentage);
+}
+
+/* Sleep while every vCPU that has something to do is throttled */
+static void qemu_tcg_throttle_wait(void)
+{
+    int64_t now = qemu_clock_get_ns(QEMU_CLOCK_REALTIME);
+    int64_t until = INT64_MAX;
+    CPUState *cpu;
+
+    CPU_FOREACH(cpu) {
+        if (cpu->stop || cpu->queued_work_first) {
+            return;
+        }
+        if (cpu_thread_is_idle(cpu)) {
+            continue;
+        }
+        if (!cpu_throttled(cpu, now)) {
+            return;
+        }
+        until = MIN(until, cpu->throttle_until);
+    }
+
+    if (until != INT64_MAX) {
+        qemu_mutex_unlock_iothread();
+        g_usleep((until - now) / SCALE_US);
+        qemu_mutex_lock_iothread();
+    }
+}
+
 static void qemu_wait_io_event_common(CPUState *cpu)
 {
     if (cpu->stop) {
@@ -932,6 +1050,8 @@ static void qemu_tcg_wait_io_event(void)
         qemu_cond_wait(tcg_halt_cond, &qemu_global_mutex);
     }
 
+    qemu_tcg_throttle_wait();
+
     while (iothread_requesting_mutex) {
         qemu_cond_wait(&qemu_io_proceeded_cond, &qemu_global_mutex);
     }
@@ -1466,6 +1586,9 @@ static void tcg_exec_all(void)
                           (cpu->singlestep_enabled & SSTEP_NOTIMER) == 0);
 
         if (cpu_can_run(cpu)) {
+            if (cpu_throttled(cpu, qemu_clock_get_ns(QEMU_CLOCK_REALTIME))) {
+                continue;
+            }
             r = tcg_cpu_exec(cpu);
             if (r == EXCP_DEBUG) {
                 cpu_handle_guest_debug(cpu);
@@ -54,6 +54,7 @@
 
 #include "exec/memory-internal.h"
 #include "exec/ram_addr.h"
+#include "exec/ramlist.h"
 
 #include "qemu/range.h"
 
@@ -892,7 +893,7 @@ found:
     return block;
 }
 
-static void tlb_reset_dirty_range_all(ram_addr_t start, ram_addr_t length)
+void tlb_reset_dirty_range_all(ram_addr_t start, ram_addr_t length)
 {
     ram_addr_t start1;
     RAMBlock *block;
@@ -1386,6 +1387,28 @@ static int memory_try_enable_merging(void *addr, size_t len)
     return qemu_madvise(addr, len, QEMU_MADV_MERGEABLE);
 }
 
+/* Return true if the host memory of @rb was allocated by QEMU as
+ * anonymous private memory, so that it may be replaced by another private
+ * mapping at the same address (see the mapped-ram migration capability).
+ */
+bool qemu_ram_is_anonymous(RAMBlock *rb)
+{
+    return !(rb->flags & RAM_PREALLOC) && rb->fd < 0 && !xen_enabled() &&
+           phys_mem_alloc == qemu_anon_ram_alloc;
+}
+
+/* @addr was mapped again after qemu_ram_is_anonymous() memory was replaced
+ * (e.g. by mapped-ram migration): give it back the madvise settings that
+ * ram_block_add() applied to the old mapping.
+ */
+void qemu_ram_advise_remapped(void *addr, ram_addr_t length)
+{
+    memory_try_enable_merging(addr, length);
+    qemu_ram_setup_dump(addr, length);
+    qemu_madvise(addr, length, QEMU_MADV_HUGEPAGE);
+    qemu_madvise(addr, length, QEMU_MADV_DONTFORK);
+}
+
 /* Only legal before guest might have detected the memory size: e.g. on
  * incoming migration, or right after reset.
  *
@@ -1513,6 +1536,7 @@ static ram_addr_t ram_block_add(RAMBlock *new_block, Error **errp)
         if (kvm_enabled()) {
             kvm_setup_guest_memory(new_block->host, new_block->max_length);
         }
+        ram_block_notify_add(new_block->host, new_block->max_length);
     }
 
     return new_block->offset;
@@ -1630,6 +1654,7 @@ void qemu_ram_free_from_ptr(ram_addr_t addr)
     qemu_mutex_lock_ramlist();
     QLIST_FOREACH_RCU(block, &ram_list.blocks, next) {
         if (addr == block->offset) {
+            ram_block_notify_remove(block->host, block->max_length);
             QLIST_REMOVE_RCU(block, next);
             ram_list.mru_block = NULL;
             /* Write list before version */
@@ -1666,6 +1691,9 @@ void qemu_ram_free(ram_addr_t addr)
     qemu_mutex_lock_ramlist();
     QLIST_FOREACH_RCU(block, &ram_list.blocks, next) {
         if (addr == block->offset) {
+            if (block->host) {
+                ram_block_notify_remove(block->host, block->max_length);
+            }
             QLIST_REMOVE_RCU(block, next);
             ram_list.mru_block = NULL;
             /* Write list before version */
@@ -1892,6 +1920,10 @@ static void notdirty_mem_write(void *opaque, hwaddr ram_addr,
     default:
         abort();
     }
+    /* Lets migration throttle the vCPUs that dirty the most memory */
+    if (!cpu_physical_memory_get_dirty_flag(ram_addr, DIRTY_MEMORY_MIGRATION)) {
+        current_cpu->dirty_pages++;
+    }
     /* Set both VGA and migration bits for simplicity and to remove
      * the notdirty callback faster.
      */
@@ -2352,6 +2384,12 @@ static void invalidate_and_set_dirty(MemoryRegion *mr, hwaddr addr,
     cpu_physical_memory_set_dirty_range(addr, length, dirty_log_mask);
 }
 
+void memory_region_invalidate_and_set_dirty(MemoryRegion *mr, hwaddr addr,
+                                            hwaddr size)
+{
+    invalidate_and_set_dirty(mr, memory_region_get_ram_addr(mr) + addr, size);
+}
+
 static int memory_access_size(MemoryRegion *mr, unsigned l, hwaddr addr)
 {
     unsigned access_size_max = mr->ops->valid.max_access_size;
@@ -3498,4 +3536,45 @@ int qemu_ram_foreach_block(RAMBlockIterFunc func, void *opaque)
     rcu_read_unlock();
     return ret;
 }
+
+static QLIST_HEAD(, RAMBlockNotifier) ram_block_notifiers =
+    QLIST_HEAD_INITIALIZER(ram_block_notifiers);
+
+void ram_block_notifier_add(RAMBlockNotifier *n)
+{
+    RAMBlock *block;
+
+    QLIST_INSERT_HEAD(&ram_block_notifiers, n, next);
+
+    rcu_read_lock();
+    QLIST_FOREACH_RCU(block, &ram_list.blocks, next) {
+        if (block->host) {
+            n->ram_block_added(n, block->host, block->max_length);
+        }
+    }
+    rcu_read_unlock();
+}
+
+void ram_block_notifier_remove(RAMBlockNotifier *n)
+{
+    QLIST_REMOVE(n, next);
+}
+
+void ram_block_notify_add(void *host, size_t size)
+{
+    RAMBlockNotifier *notifier;
+
+    QLIST_FOREACH(notifier, &ram_block_notifiers, next) {
+        notifier->ram_block_added(notifier, host, size);
+    }
+}
+
+void ram_block_notify_remove(void *host, size_t size)
+{
+    RAMBlockNotifier *notifier;
+
+    QLIST_FOREACH(notifier, &ram_block_notifiers, next) {
+        notifier->ram_block_removed(notifier, host, size);
+    }
+}
 #endif
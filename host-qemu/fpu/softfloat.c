@@ -89,6 +89,10 @@ this code that are retained.
 /* We only need stdlib for abort() */
 #include <stdlib.h>
 
+/* The host FPU fast path below needs the host's own float and double.  */
+#include <float.h>
+#include <math.h>
+
 /*----------------------------------------------------------------------------
 | Primitive arithmetic functions, including multi-word arithmetic, and
 | division and square root approximations.  (Can be specialized to target if
@@ -2159,7 +2163,7 @@ static float32 subFloat32Sigs(float32 a, float32 b, flag zSign,
 | Binary Floating-Point Arithmetic.
 *----------------------------------------------------------------------------*/
 
-float32 float32_add(float32 a, float32 b, float_status *status)
+static float32 soft_float32_add(float32 a, float32 b, float_status *status)
 {
     flag aSign, bSign;
     a = float32_squash_input_denormal(a, status);
@@ -2182,7 +2186,7 @@ float32 float32_add(float32 a, float32 b, float_status *status)
 | for Binary Floating-Point Arithmetic.
 *----------------------------------------------------------------------------*/
 
-float32 float32_sub(float32 a, float32 b, float_status *status)
+static float32 soft_float32_sub(float32 a, float32 b, float_status *status)
 {
     flag aSign, bSign;
     a = float32_squash_input_denormal(a, status);
@@ -2205,7 +2209,7 @@ float32 float32_sub(float32 a, float32 b, float_status *status)
 | for Binary Floating-Point Arithmetic.
 *----------------------------------------------------------------------------*/
 
-float32 float32_mul(float32 a, float32 b, float_status *status)
+static float32 soft_float32_mul(float32 a, float32 b, float_status *status)
 {
     flag aSign, bSign, zSign;
     int_fast16_t aExp, bExp, zExp;
@@ -2270,7 +2274,7 @@ float32 float32_mul(float32 a, float32 b, float_status *status)
 | IEC/IEEE Standard for Binary Floating-Point Arithmetic.
 *----------------------------------------------------------------------------*/
 
-float32 float32_div(float32 a, float32 b, float_status *status)
+static float32 soft_float32_div(float32 a, float32 b, float_status *status)
 {
     flag aSign, bSign, zSign;
     int_fast16_t aExp, bExp, zExp;
@@ -2447,8 +2451,8 @@ float32 float32_rem(float32 a, float32 b, float_status *status)
 | externally will flip the sign bit on NaNs.)
 *----------------------------------------------------------------------------*/
 
-float32 float32_muladd(float32 a, float32 b, float32 c, int flags,
-                       float_status *status)
+static float32 soft_float32_muladd(float32 a, float32 b, float32 c,
+                                  int flags, float_status *status)
 {
     flag aSign, bSign, cSign, zSign;
     int_fast16_t aExp, bExp, cExp, pExp, zExp, expDiff;
@@ -2668,7 +2672,7 @@ float32 float32_muladd(float32 a, float32 b, float32 c, int flags,
 | Floating-Point Arithmetic.
 *----------------------------------------------------------------------------*/
 
-float32 float32_sqrt(float32 a, float_status *status)
+static float32 soft_float32_sqrt(float32 a, float_status *status)
 {
     flag aSign;
     int_fast16_t aExp, zExp;
@@ -3945,7 +3949,7 @@ static float64 subFloat64Sigs(float64 a, float64 b, flag zSign,
 | Binary Floating-Point Arithmetic.
 *----------------------------------------------------------------------------*/
 
-float64 float64_add(float64 a, float64 b, float_status *status)
+static float64 soft_float64_add(float64 a, float64 b, float_status *status)
 {
     flag aSign, bSign;
     a = float64_squash_input_denormal(a, status);
@@ -3968,7 +3972,7 @@ float64 float64_add(float64 a, float64 b, float_status *status)
 | for Binary Floating-Point Arithmetic.
 *----------------------------------------------------------------------------*/
 
-float64 float64_sub(float64 a, float64 b, float_status *status)
+static float64 soft_float64_sub(float64 a, float64 b, float_status *status)
 {
     flag aSign, bSign;
     a = float64_squash_input_denormal(a, status);
@@ -3991,7 +3995,7 @@ float64 float64_sub(float64 a, float64 b, float_status *status)
 | for Binary Floating-Point Arithmetic.
 *----------------------------------------------------------------------------*/
 
-float64 float64_mul(float64 a, float64 b, float_status *status)
+static float64 soft_float64_mul(float64 a, float64 b, float_status *status)
 {
     flag aSign, bSign, zSign;
     int_fast16_t aExp, bExp, zExp;
@@ -4054,7 +4058,7 @@ float64 float64_mul(float64 a, float64 b, float_status *status)
 | the IEC/IEEE Standard for Binary Floating-Point Arithmetic.
 *----------------------------------------------------------------------------*/
 
-float64 float64_div(float64 a, float64 b, float_status *status)
+static float64 soft_float64_div(float64 a, float64 b, float_status *status)
 {
     flag aSign, bSign, zSign;
     int_fast16_t aExp, bExp, zExp;
@@ -4225,8 +4229,8 @@ float64 float64_rem(float64 a, float64 b, float_status *status)
 | externally will flip the sign bit on NaNs.)
 *----------------------------------------------------------------------------*/
 
-float64 float64_muladd(float64 a, float64 b, float64 c, int flags,
-                       float_status *status)
+static float64 soft_float64_muladd(float64 a, float64 b, float64 c,
+                                  int flags, float_status *status)
 {
     flag aSign, bSign, cSign, zSign;
     int_fast16_t aExp, bExp, cExp, pExp, zExp, expDiff;
@@ -4467,7 +4471,7 @@ float64 float64_muladd(float64 a, float64 b, float64 c, int flags,
 | Floating-Point Arithmetic.
 *----------------------------------------------------------------------------*/
 
-float64 float64_sqrt(float64 a, float_status *status)
+static float64 soft_float64_sqrt(float64 a, float_status *status)
 {
     flag aSign;
     int_fast16_t aExp, zExp;
@@ -7720,3 +7724,187 @@ float128 float128_scalbn(float128 a, int n, float_status *status)
                                          , status);
 
 }
+
+/*----------------------------------------------------------------------------
+| Host FPU fast path for the common arithmetic operations.
+|
+| When both operands are zero or normal, the rounding mode is round to
+| nearest even and the inexact flag has already been raised, the host's
+| IEEE arithmetic gives bit-identical results to the code above as long
+| as the result is itself normal and finite: no exception other than
+| inexact can occur, and inexact being sticky means it need not be
+| detected.  Anything else (NaNs, infinities, denormals, overflow, results
+| that may be tiny, other rounding modes, or an inexact flag that the
+| guest has cleared) is handed to the softfloat implementation, which
+| also takes care of raising the flags.
+|
+| Only enabled on hosts whose float and double arithmetic is performed
+| at exactly that precision.
+*----------------------------------------------------------------------------*/
+
+#if defined(__x86_64__) || defined(__aarch64__)
+#define QEMU_HARDFLOAT 1
+#else
+#define QEMU_HARDFLOAT 0
+#endif
+
+#if defined(__aarch64__) || (defined(__FP_FAST_FMA) && defined(__FP_FAST_FMAF))
+#define QEMU_HARDFLOAT_FMA 1
+#else
+#define QEMU_HARDFLOAT_FMA 0
+#endif
+
+typedef union {
+    float32 s;
+    float h;
+} union_float32;
+
+typedef union {
+    float64 s;
+    double h;
+} union_float64;
+
+static inline bool can_use_fpu(const float_status *status)
+{
+    return likely((status->float_exception_flags & float_flag_inexact) &&
+                  status->float_rounding_mode == float_round_nearest_even);
+}
+
+static inline bool float32_is_zero_or_normal(float32 a)
+{
+    int_fast16_t exp = extractFloat32Exp(a);
+
+    return exp != 0xFF && (exp != 0 || extractFloat32Frac(a) == 0);
+}
+
+static inline bool float64_is_zero_or_normal(float64 a)
+{
+    int_fast16_t exp = extractFloat64Exp(a);
+
+    return exp != 0x7FF && (exp != 0 || extractFloat64Frac(a) == 0);
+}
+
+static inline bool float32_is_normal(float32 a)
+{
+    int_fast16_t exp = extractFloat32Exp(a);
+
+    return exp != 0xFF && exp != 0;
+}
+
+static inline bool float64_is_normal(float64 a)
+{
+    int_fast16_t exp = extractFloat64Exp(a);
+
+    return exp != 0x7FF && exp != 0;
+}
+
+/* Is the host result safe to return as is?  Zero results are excluded
+   too, since their sign may depend on the operands' classes.  */
+static inline bool hard_float32_ok(float h)
+{
+    return fabsf(h) > FLT_MIN && fabsf(h) <= FLT_MAX;
+}
+
+static inline bool hard_float64_ok(double h)
+{
+    return fabs(h) > DBL_MIN && fabs(h) <= DBL_MAX;
+}
+
+#define GEN_HARDFLOAT_2(name, bits, op, cond)                              \
+float##bits float##bits##_##name(float##bits a, float##bits b,             \
+                                 float_status *status)                     \
+{                                                                          \
+    if (QEMU_HARDFLOAT && can_use_fpu(status) && (cond)) {                 \
+        union_float##bits ua, ub, ur;                                      \
+                                                                           \
+        ua.s = a;                                                          \
+        ub.s = b;                                                          \
+        ur.h = ua.h op ub.h;                                               \
+        if (hard_float##bits##_ok(ur.h)) {                                 \
+            return ur.s;                                                   \
+        }                                                                  \
+    }                                                                      \
+    return soft_float##bits##_##name(a, b, status);                        \
+}
+
+GEN_HARDFLOAT_2(add, 32, +,
+                float32_is_zero_or_normal(a) && float32_is_zero_or_normal(b))
+GEN_HARDFLOAT_2(sub, 32, -,
+                float32_is_zero_or_normal(a) && float32_is_zero_or_normal(b))
+GEN_HARDFLOAT_2(mul, 32, *,
+                float32_is_zero_or_normal(a) && float32_is_zero_or_normal(b))
+GEN_HARDFLOAT_2(div, 32, /,
+                float32_is_zero_or_normal(a) && float32_is_normal(b))
+
+GEN_HARDFLOAT_2(add, 64, +,
+                float64_is_zero_or_normal(a) && float64_is_zero_or_normal(b))
+GEN_HARDFLOAT_2(sub, 64, -,
+                float64_is_zero_or_normal(a) && float64_is_zero_or_normal(b))
+GEN_HARDFLOAT_2(mul, 64, *,
+                float64_is_zero_or_normal(a) && float64_is_zero_or_normal(b))
+GEN_HARDFLOAT_2(div, 64, /,
+                float64_is_zero_or_normal(a) && float64_is_normal(b))
+
+float32 float32_sqrt(float32 a, float_status *status)
+{
+    if (QEMU_HARDFLOAT && can_use_fpu(status) &&
+        float32_is_normal(a) && !extractFloat32Sign(a)) {
+        union_float32 ua, ur;
+
+        ua.s = a;
+        ur.h = sqrtf(ua.h);
+        return ur.s;
+    }
+    return soft_float32_sqrt(a, status);
+}
+
+float64 float64_sqrt(float64 a, float_status *status)
+{
+    if (QEMU_HARDFLOAT && can_use_fpu(status) &&
+        float64_is_normal(a) && !extractFloat64Sign(a)) {
+        union_float64 ua, ur;
+
+        ua.s = a;
+        ur.h = sqrt(ua.h);
+        return ur.s;
+    }
+    return soft_float64_sqrt(a, status);
+}
+
+float32 float32_muladd(float32 a, float32 b, float32 c, int flags,
+                       float_status *status)
+{
+    if (QEMU_HARDFLOAT_FMA && flags == 0 && can_use_fpu(status) &&
+        float32_is_zero_or_normal(a) && float32_is_zero_or_normal(b) &&
+        float32_is_zero_or_normal(c)) {
+        union_float32 ua, ub, uc, ur;
+
+        ua.s = a;
+        ub.s = b;
+        uc.s = c;
+        ur.h = fmaf(ua.h, ub.h, uc.h);
+        if (hard_float32_ok(ur.h)) {
+            return ur.s;
+        }
+    }
+    return soft_float32_muladd(a, b, c, flags, status);
+}
+
+float64 float64_muladd(float64 a, float64 b, float64 c, int flags,
+                       float_status *status)
+{
+    if (QEMU_HARDFLOAT_FMA && flags == 0 && can_use_fpu(status) &&
+        float64_is_zero_or_normal(a) && float64_is_zero_or_normal(b) &&
+        float64_is_zero_or_normal(c)) {
+        union_float64 ua, ub, uc, ur;
+
+        ua.s = a;
+        ub.s = b;
+        uc.s = c;
+        ur.h = fma(ua.h, ub.h, uc.h);
+        if (hard_float64_ok(ur.h)) {
+            return ur.s;
+        }
+    }
+    return soft_float64_muladd(a, b, c, flags, status);
+}
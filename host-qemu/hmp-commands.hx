@@ -370,6 +370,22 @@ STEXI
 @findex singlestep
 Run the emulation in single step mode.
 If called with option off, the emulation returns to normal mode.
+ETEXI
+
+    {
+        .name       = "tb_profile",
+        .args_type  = "reset:-r,enable:b",
+        .params     = "[-r] on|off",
+        .help       = "start or stop counting TB executions and translation "
+                      "time (-r clears the gathered statistics)",
+        .mhandler.cmd = hmp_tb_profile,
+    },
+
+STEXI
+@item tb_profile [-r] on|off
+@findex tb_profile
+Start or stop the TCG translation block profiler; see @code{info tb-profile}.
+With @option{-r}, the statistics gathered so far are cleared.
 ETEXI
 
     {
@@ -1740,6 +1756,8 @@ show virtual to physical memory mappings (i386, SH4, SPARC, PPC, and Xtensa only
 show the active virtual memory mappings (i386 only)
 @item info jit
 show dynamic compiler info
+@item info tb-profile [@var{top}]
+show the @var{top} most executed and slowest to translate TBs
 @item info numa
 show NUMA information
 @item info kvm
@@ -181,6 +181,10 @@ void hmp_info_migrate(Monitor *mon, const QDict *qdict)
             monitor_printf(mon, "setup: %" PRIu64 " milliseconds\n",
                            info->setup_time);
         }
+        if (info->has_cpu_throttle_percentage) {
+            monitor_printf(mon, "cpu throttle percentage: %" PRIu64 "\n",
+                           info->cpu_throttle_percentage);
+        }
     }
 
     if (info->has_ram) {
@@ -208,6 +212,18 @@ void hmp_info_migrate(Monitor *mon, const QDict *qdict)
         }
     }
 
+    if (info->has_vcpu_throttle) {
+        MigrationVcpuThrottleList *vcpu;
+
+        for (vcpu = info->vcpu_throttle; vcpu; vcpu = vcpu->next) {
+            monitor_printf(mon, "vcpu %" PRId64 ": dirty pages rate: %" PRIu64
+                           " pages, throttle: %" PRIu64 " %%\n",
+                           vcpu->value->cpu_index,
+                           vcpu->value->dirty_pages_rate,
+                           vcpu->value->throttle_percentage);
+        }
+    }
+
     if (info->has_disk) {
         monitor_printf(mon, "transferred disk: %" PRIu64 " kbytes\n",
                        info->disk->transferred >> 10);
@@ -272,6 +288,12 @@ void hmp_info_migrate_parameters(Monitor *mon, const QDict *qdict)
         monitor_printf(mon, " %s: %" PRId64,
             MigrationParameter_lookup[MIGRATION_PARAMETER_DECOMPRESS_THREADS],
             params->decompress_threads);
+        monitor_printf(mon, " %s: %" PRId64,
+            MigrationParameter_lookup[MIGRATION_PARAMETER_MULTIFD_CHANNELS],
+            params->multifd_channels);
+        monitor_printf(mon, " %s: %" PRId64,
+            MigrationParameter_lookup[MIGRATION_PARAMETER_XBZRLE_THREADS],
+            params->xbzrle_threads);
         monitor_printf(mon, "\n");
     }
 
@@ -1221,6 +1243,8 @@ void hmp_migrate_set_parameter(Monitor *mon, const QDict *qdict)
     bool has_compress_level = false;
     bool has_compress_threads = false;
     bool has_decompress_threads = false;
+    bool has_multifd_channels = false;
+    bool has_xbzrle_threads = false;
     int i;
 
     for (i = 0; i < MIGRATION_PARAMETER_MAX; i++) {
@@ -1235,10 +1259,18 @@ void hmp_migrate_set_parameter(Monitor *mon, const QDict *qdict)
             case MIGRATION_PARAMETER_DECOMPRESS_THREADS:
                 has_decompress_threads = true;
                 break;
+            case MIGRATION_PARAMETER_MULTIFD_CHANNELS:
+                has_multifd_channels = true;
+                break;
+            case MIGRATION_PARAMETER_XBZRLE_THREADS:
+                has_xbzrle_threads = true;
+                break;
             }
             qmp_migrate_set_parameters(has_compress_level, value,
                                        has_compress_threads, value,
                                        has_decompress_threads, value,
+                                       has_multifd_channels, value,
+                                       has_xbzrle_threads, value,
                                        &err);
             break;
         }
@@ -1963,6 +1995,52 @@ void hmp_info_memory_devices(Monitor *mon, const QDict *qdict)
     qapi_free_MemoryDeviceInfoList(info_list);
 }
 
+static void hmp_print_tb_profile_list(Monitor *mon, TbProfileEntryList *list)
+{
+    monitor_printf(mon, "  %-18s %5s %12s %6s %12s\n",
+                   "pc", "size", "executions", "trans", "trans-ns");
+    for (; list; list = list->next) {
+        TbProfileEntry *e = list->value;
+
+        monitor_printf(mon, "  0x%016" PRIx64 " %5" PRId64 " %12" PRId64
+                       " %6" PRId64 " %12" PRId64 "\n",
+                       e->pc, e->size, e->executions, e->translations,
+                       e->translation_time_ns);
+    }
+}
+
+void hmp_info_tb_profile(Monitor *mon, const QDict *qdict)
+{
+    int64_t top = qdict_get_try_int(qdict, "top", 20);
+    TbProfileInfo *info;
+
+    info = qmp_query_tb_profile(true, top, NULL);
+    monitor_printf(mon, "TB profiling %s\n",
+                   info->enabled ? "enabled" : "disabled");
+    monitor_printf(mon, "blocks %" PRId64 ", executions %" PRId64
+                   ", translations %" PRId64 " in %" PRId64 " ns\n",
+                   info->blocks, info->executions, info->translations,
+                   info->translation_time_ns);
+    if (info->blocks) {
+        monitor_printf(mon, "Most executed:\n");
+        hmp_print_tb_profile_list(mon, info->by_executions);
+        monitor_printf(mon, "Most translation time:\n");
+        hmp_print_tb_profile_list(mon, info->by_time);
+    }
+
+    qapi_free_TbProfileInfo(info);
+}
+
+void hmp_tb_profile(Monitor *mon, const QDict *qdict)
+{
+    bool enable = qdict_get_bool(qdict, "enable");
+    bool reset = qdict_get_try_bool(qdict, "reset", false);
+    Error *err = NULL;
+
+    qmp_tb_profile(enable, true, reset, &err);
+    hmp_handle_error(mon, &err);
+}
+
 void hmp_qom_list(Monitor *mon, const QDict *qdict)
 {
     const char *path = qdict_get_try_str(qdict, "path");
@@ -88,13 +88,10 @@ static void complete_request_vring(VirtIOBlockReq *req, unsigned char status)
     qemu_bh_schedule(s->bh);
 }
 
-static void handle_notify(EventNotifier *e)
+static void process_vring(VirtIOBlockDataPlane *s)
 {
-    VirtIOBlockDataPlane *s = container_of(e, VirtIOBlockDataPlane,
-                                           host_notifier);
     VirtIOBlock *vblk = VIRTIO_BLK(s->vdev);
 
-    event_notifier_test_and_clear(&s->host_notifier);
     blk_io_plug(s->conf->conf.blk);
     for (;;) {
         MultiReqBuffer mrb = {};
@@ -137,6 +134,30 @@ static void handle_notify(EventNotifier *e)
     blk_io_unplug(s->conf->conf.blk);
 }
 
+static void handle_notify(EventNotifier *e)
+{
+    VirtIOBlockDataPlane *s = container_of(e, VirtIOBlockDataPlane,
+                                           host_notifier);
+
+    event_notifier_test_and_clear(&s->host_notifier);
+    process_vring(s);
+}
+
+/* Busy polling callback: pick up new requests without waiting for a kick */
+static bool poll_notify(void *opaque)
+{
+    EventNotifier *e = opaque;
+    VirtIOBlockDataPlane *s = container_of(e, VirtIOBlockDataPlane,
+                                           host_notifier);
+
+    if (s->vring.broken || !vring_more_avail(s->vdev, &s->vring)) {
+        return false;
+    }
+
+    process_vring(s);
+    return true;
+}
+
 /* Context: QEMU global mutex held */
 void virtio_blk_data_plane_create(VirtIODevice *vdev, VirtIOBlkConf *conf,
                                   VirtIOBlockDataPlane **dataplane,
@@ -284,6 +305,7 @@ void virtio_blk_data_plane_start(VirtIOBlockDataPlane *s)
     /* Get this show started by hooking up our callbacks */
     aio_context_acquire(s->ctx);
     aio_set_event_notifier(s->ctx, &s->host_notifier, handle_notify);
+    aio_set_event_notifier_poll(s->ctx, &s->host_notifier, poll_notify);
     aio_context_release(s->ctx);
     return;
 
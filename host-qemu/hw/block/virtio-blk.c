@@ -187,16 +187,28 @@ out:
 
 #endif
 
-static VirtIOBlockReq *virtio_blk_get_request(VirtIOBlock *s)
+/* Requests popped from the virtqueue with one virtqueue_pop_batch() call */
+#define VIRTIO_BLK_POP_BATCH 16
+
+/* Pop up to VIRTIO_BLK_POP_BATCH requests, returning how many were popped */
+static unsigned int virtio_blk_get_requests(VirtIOBlock *s,
+                                            VirtIOBlockReq **reqs)
 {
-    VirtIOBlockReq *req = virtio_blk_alloc_request(s);
+    VirtQueueElement *elems[VIRTIO_BLK_POP_BATCH];
+    unsigned int i, n, popped;
 
-    if (!virtqueue_pop(s->vq, &req->elem)) {
-        virtio_blk_free_request(req);
-        return NULL;
+    n = MIN(virtqueue_avail_heads(s->vq), VIRTIO_BLK_POP_BATCH);
+    for (i = 0; i < n; i++) {
+        reqs[i] = virtio_blk_alloc_request(s);
+        elems[i] = &reqs[i]->elem;
     }
 
-    return req;
+    popped = virtqueue_pop_batch(s->vq, elems, n);
+    for (i = popped; i < n; i++) {
+        virtio_blk_free_request(reqs[i]);
+    }
+
+    return popped;
 }
 
 static int virtio_blk_handle_scsi_req(VirtIOBlockReq *req)
@@ -589,7 +601,8 @@ void virtio_blk_handle_request(VirtIOBlockReq *req, MultiReqBuffer *mrb)
 static void virtio_blk_handle_output(VirtIODevice *vdev, VirtQueue *vq)
 {
     VirtIOBlock *s = VIRTIO_BLK(vdev);
-    VirtIOBlockReq *req;
+    VirtIOBlockReq *reqs[VIRTIO_BLK_POP_BATCH];
+    unsigned int i, n;
     MultiReqBuffer mrb = {};
 
     /* Some guests kick before setting VIRTIO_CONFIG_S_DRIVER_OK so start
@@ -601,8 +614,10 @@ static void virtio_blk_handle_output(VirtIODevice *vdev, VirtQueue *vq)
         return;
     }
 
-    while ((req = virtio_blk_get_request(s))) {        
-        virtio_blk_handle_request(req, &mrb);
+    while ((n = virtio_blk_get_requests(s, reqs))) {
+        for (i = 0; i < n; i++) {
+            virtio_blk_handle_request(reqs[i], &mrb);
+        }
     }
 
     if (mrb.num_reqs) {
@@ -751,6 +766,10 @@ static uint64_t virtio_blk_get_features(VirtIODevice *vdev, uint64_t features,
     if (blk_is_read_only(s->blk)) {
         virtio_add_feature(&features, VIRTIO_BLK_F_RO);
     }
+    if (s->conf.iothread) {
+        /* dataplane only knows the split ring */
+        virtio_clear_feature(&features, VIRTIO_F_RING_PACKED);
+    }
 
     return features;
 }
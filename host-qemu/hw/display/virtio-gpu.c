@@ -22,6 +22,8 @@
 static struct virtio_gpu_simple_resource*
 virtio_gpu_find_resource(VirtIOGPU *g, uint32_t resource_id);
 
+static void virtio_gpu_cleanup_mapping(struct virtio_gpu_simple_resource *res);
+
 static void update_cursor_data_simple(VirtIOGPU *g,
                                       struct virtio_gpu_scanout *s,
                                       uint32_t resource_id)
@@ -281,10 +283,115 @@ static void virtio_gpu_resource_destroy(VirtIOGPU *g,
                                         struct virtio_gpu_simple_resource *res)
 {
     pixman_image_unref(res->image);
+    if (res->iov) {
+        virtio_gpu_cleanup_mapping(res);
+    }
     QTAILQ_REMOVE(&g->reslist, res, next);
     g_free(res);
 }
 
+/* Create a surface for the part of @res that a scanout shows */
+static DisplaySurface *
+virtio_gpu_create_scanout_surface(struct virtio_gpu_simple_resource *res,
+                                  int x, int y, int width, int height)
+{
+    pixman_format_code_t format = pixman_image_get_format(res->image);
+    int bpp = (PIXMAN_FORMAT_BPP(format) + 7) / 8;
+    int stride = pixman_image_get_stride(res->image);
+    uint8_t *data = (uint8_t *)pixman_image_get_data(res->image);
+
+    return qemu_create_displaysurface_from(width, height, format, stride,
+                                           data + y * stride + x * bpp);
+}
+
+/* Move the scanouts that show @res to its current image */
+static void virtio_gpu_update_scanouts(VirtIOGPU *g,
+                                       struct virtio_gpu_simple_resource *res)
+{
+    struct virtio_gpu_scanout *scanout;
+    int i;
+
+    for (i = 0; i < g->conf.max_outputs; i++) {
+        if (!(res->scanout_bitmask & (1 << i))) {
+            continue;
+        }
+        scanout = &g->scanout[i];
+        scanout->ds = virtio_gpu_create_scanout_surface(res,
+                                                        scanout->x, scanout->y,
+                                                        scanout->width,
+                                                        scanout->height);
+        dpy_gfx_replace_surface(scanout->con, scanout->ds);
+    }
+}
+
+/*
+ * In zero-copy mode, a resource whose backing is contiguous in host memory
+ * is displayed straight from guest RAM: its image is the backing itself,
+ * so transfers have nothing to copy and flushes only report damage.  Like
+ * transfers, this expects the rows of the resource in the backing without
+ * padding between them.
+ */
+static void virtio_gpu_resource_map_backing(VirtIOGPU *g,
+                                       struct virtio_gpu_simple_resource *res)
+{
+    pixman_format_code_t format = pixman_image_get_format(res->image);
+    int stride = res->width * ((PIXMAN_FORMAT_BPP(format) + 7) / 8);
+    pixman_image_t *image;
+    uint8_t *base;
+    size_t len;
+    int i;
+
+    if (!virtio_gpu_zero_copy_enabled(g->conf) || !res->iov_cnt) {
+        return;
+    }
+
+    base = res->iov[0].iov_base;
+    len = res->iov[0].iov_len;
+    for (i = 1; i < res->iov_cnt; i++) {
+        if (res->iov[i].iov_base != base + len) {
+            return;
+        }
+        len += res->iov[i].iov_len;
+    }
+    if (len < (uint64_t)stride * res->height) {
+        return;
+    }
+
+    image = pixman_image_create_bits(format, res->width, res->height,
+                                     (uint32_t *)base, stride);
+    if (!image) {
+        return;
+    }
+    pixman_image_unref(res->image);
+    res->image = image;
+    res->zero_copy = true;
+    virtio_gpu_update_scanouts(g, res);
+}
+
+/* Copy a zero-copy resource to host memory before its backing goes away */
+static bool virtio_gpu_resource_unmap_backing(VirtIOGPU *g,
+                                       struct virtio_gpu_simple_resource *res)
+{
+    pixman_image_t *image;
+
+    if (!res->zero_copy) {
+        return true;
+    }
+
+    image = pixman_image_create_bits(pixman_image_get_format(res->image),
+                                     res->width, res->height, NULL, 0);
+    if (!image) {
+        return false;
+    }
+    pixman_image_composite(PIXMAN_OP_SRC, res->image, NULL, image,
+                           0, 0, 0, 0, 0, 0, res->width, res->height);
+    pixman_image_unref(res->image);
+    res->image = image;
+    res->zero_copy = false;
+    virtio_gpu_update_scanouts(g, res);
+    return true;
+}
+
 static void virtio_gpu_resource_unref(VirtIOGPU *g,
                                       struct virtio_gpu_ctrl_command *cmd)
 {
@@ -308,8 +415,7 @@ static void virtio_gpu_transfer_to_host_2d(VirtIOGPU *g,
                                            struct virtio_gpu_ctrl_command *cmd)
 {
     struct virtio_gpu_simple_resource *res;
-    int h;
-    uint32_t src_offset, dst_offset, stride;
+    uint32_t dst_offset, stride;
     int bpp;
     pixman_format_code_t format;
     struct virtio_gpu_transfer_to_host_2d t2d;
@@ -339,27 +445,19 @@ static void virtio_gpu_transfer_to_host_2d(VirtIOGPU *g,
         return;
     }
 
+    if (res->zero_copy) {
+        /* the backing is the image */
+        return;
+    }
+
     format = pixman_image_get_format(res->image);
     bpp = (PIXMAN_FORMAT_BPP(format) + 7) / 8;
     stride = pixman_image_get_stride(res->image);
+    dst_offset = t2d.r.y * stride + t2d.r.x * bpp;
 
-    if (t2d.offset || t2d.r.x || t2d.r.y ||
-        t2d.r.width != pixman_image_get_width(res->image)) {
-        void *img_data = pixman_image_get_data(res->image);
-        for (h = 0; h < t2d.r.height; h++) {
-            src_offset = t2d.offset + stride * h;
-            dst_offset = (t2d.r.y + h) * stride + (t2d.r.x * bpp);
-
-            iov_to_buf(res->iov, res->iov_cnt, src_offset,
-                       (uint8_t *)img_data
-                       + dst_offset, t2d.r.width * bpp);
-        }
-    } else {
-        iov_to_buf(res->iov, res->iov_cnt, 0,
-                   pixman_image_get_data(res->image),
-                   pixman_image_get_stride(res->image)
-                   * pixman_image_get_height(res->image));
-    }
+    iov_to_buf_2d(res->iov, res->iov_cnt, t2d.offset, stride,
+                  (uint8_t *)pixman_image_get_data(res->image) + dst_offset,
+                  stride, t2d.r.width * bpp, t2d.r.height);
 }
 
 static void virtio_gpu_resource_flush(VirtIOGPU *g,
@@ -416,10 +514,12 @@ static void virtio_gpu_resource_flush(VirtIOGPU *g,
         pixman_region_translate(&finalregion, -scanout->x, -scanout->y);
         extents = pixman_region_extents(&finalregion);
         /* work out the area we need to update for each console */
-        dpy_gfx_update(g->scanout[i].con,
-                       extents->x1, extents->y1,
-                       extents->x2 - extents->x1,
-                       extents->y2 - extents->y1);
+        if (pixman_region_not_empty(&finalregion)) {
+            dpy_gfx_update(g->scanout[i].con,
+                           extents->x1, extents->y1,
+                           extents->x2 - extents->x1,
+                           extents->y2 - extents->y1);
+        }
 
         pixman_region_fini(&region);
         pixman_region_fini(&finalregion);
@@ -506,10 +606,9 @@ static void virtio_gpu_set_scanout(VirtIOGPU *g,
         scanout->width != ss.r.width ||
         scanout->height != ss.r.height) {
         /* realloc the surface ptr */
-        scanout->ds = qemu_create_displaysurface_from
-            (ss.r.width, ss.r.height, format,
-             pixman_image_get_stride(res->image),
-             (uint8_t *)pixman_image_get_data(res->image) + offset);
+        scanout->ds = virtio_gpu_create_scanout_surface(res, ss.r.x, ss.r.y,
+                                                        ss.r.width,
+                                                        ss.r.height);
         if (!scanout->ds) {
             cmd->error = VIRTIO_GPU_RESP_ERR_UNSPEC;
             return;
@@ -616,6 +715,7 @@ virtio_gpu_resource_attach_backing(VirtIOGPU *g,
     }
 
     res->iov_cnt = ab.nr_entries;
+    virtio_gpu_resource_map_backing(g, res);
 }
 
 static void
@@ -635,6 +735,10 @@ virtio_gpu_resource_detach_backing(VirtIOGPU *g,
         cmd->error = VIRTIO_GPU_RESP_ERR_INVALID_RESOURCE_ID;
         return;
     }
+    if (!virtio_gpu_resource_unmap_backing(g, res)) {
+        cmd->error = VIRTIO_GPU_RESP_ERR_OUT_OF_MEMORY;
+        return;
+    }
     virtio_gpu_cleanup_mapping(res);
 }
 
@@ -873,6 +977,8 @@ static void virtio_gpu_reset(VirtIODevice *vdev)
 
 static Property virtio_gpu_properties[] = {
     DEFINE_PROP_UINT32("max_outputs", VirtIOGPU, conf.max_outputs, 1),
+    DEFINE_PROP_BIT("zero-copy", VirtIOGPU, conf.flags,
+                    VIRTIO_GPU_FLAG_ZERO_COPY_ENABLED, false),
     DEFINE_PROP_END_OF_LIST(),
 };
 
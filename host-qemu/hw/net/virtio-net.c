@@ -24,12 +24,16 @@
 #include "qapi/qmp/qjson.h"
 #include "qapi-event.h"
 #include "hw/virtio/virtio-access.h"
+#include "hw/virtio/dataplane/vring-accessors.h"
 
 #define VIRTIO_NET_VM_VERSION    11
 
 #define MAC_TABLE_ENTRIES    64
 #define MAX_VLAN    (1 << 12)   /* Per 802.1Q definition */
 
+/* TX elements popped with one virtqueue_pop_batch() call */
+#define VIRTIO_NET_TX_BATCH 8
+
 /*
  * Calculate the number of bytes up to and including the given 'field' of
  * 'container'.
@@ -64,10 +68,171 @@ static int vq2q(int queue_index)
     return queue_index / 2;
 }
 
+/* While a queue pair is served from an IOThread its rings are accessed
+ * through a Vring, because the VirtQueue functions need the global mutex.
+ * These wrappers pick the right one; the Vring is NULL otherwise.
+ */
+static Vring *virtio_net_vring(VirtIONetQueue *q, VirtQueue *vq)
+{
+    if (!q->dataplane) {
+        return NULL;
+    }
+    return vq == q->rx_vq ? &q->rx_vring : &q->tx_vring;
+}
+
+static int virtio_net_pop(VirtIONetQueue *q, VirtQueue *vq,
+                          VirtQueueElement *elem)
+{
+    Vring *vring = virtio_net_vring(q, vq);
+
+    if (vring) {
+        return vring_pop(VIRTIO_DEVICE(q->n), vring, elem) >= 0;
+    }
+    return virtqueue_pop(vq, elem);
+}
+
+static unsigned int virtio_net_pop_batch(VirtIONetQueue *q, VirtQueue *vq,
+                                         VirtQueueElement **elems,
+                                         unsigned int max)
+{
+    Vring *vring = virtio_net_vring(q, vq);
+    unsigned int i;
+
+    if (!vring) {
+        return virtqueue_pop_batch(vq, elems, max);
+    }
+    for (i = 0; i < max; i++) {
+        if (vring_pop(VIRTIO_DEVICE(q->n), vring, elems[i]) < 0) {
+            break;
+        }
+    }
+    return i;
+}
+
+static void virtio_net_discard(VirtIONetQueue *q, VirtQueue *vq,
+                               VirtQueueElement *elem)
+{
+    Vring *vring = virtio_net_vring(q, vq);
+
+    if (vring) {
+        vring_discard(vring, elem);
+    } else {
+        virtqueue_discard(vq, elem, 0);
+    }
+}
+
+static void virtio_net_fill(VirtIONetQueue *q, VirtQueue *vq,
+                            VirtQueueElement *elem, unsigned int len,
+                            unsigned int idx)
+{
+    Vring *vring = virtio_net_vring(q, vq);
+
+    if (vring) {
+        vring_fill(VIRTIO_DEVICE(q->n), vring, elem, len, idx);
+    } else {
+        virtqueue_fill(vq, elem, len, idx);
+    }
+}
+
+static void virtio_net_flush(VirtIONetQueue *q, VirtQueue *vq,
+                             unsigned int count)
+{
+    Vring *vring = virtio_net_vring(q, vq);
+
+    if (vring) {
+        vring_flush(VIRTIO_DEVICE(q->n), vring, count);
+    } else {
+        virtqueue_flush(vq, count);
+    }
+}
+
+static void virtio_net_push(VirtIONetQueue *q, VirtQueue *vq,
+                            VirtQueueElement *elem, unsigned int len)
+{
+    Vring *vring = virtio_net_vring(q, vq);
+
+    if (vring) {
+        vring_push(VIRTIO_DEVICE(q->n), vring, elem, len);
+    } else {
+        virtqueue_push(vq, elem, len);
+    }
+}
+
+/* From an IOThread the interrupt goes through the guest notifier, which
+ * the main loop turns into virtio_irq().
+ */
+static void virtio_net_notify(VirtIONetQueue *q, VirtQueue *vq)
+{
+    VirtIODevice *vdev = VIRTIO_DEVICE(q->n);
+    Vring *vring = virtio_net_vring(q, vq);
+
+    if (!vring) {
+        virtio_notify(vdev, vq);
+    } else if (vring_should_notify(vdev, vring)) {
+        event_notifier_set(virtio_queue_get_guest_notifier(vq));
+    }
+}
+
+static void virtio_net_set_notification(VirtIONetQueue *q, VirtQueue *vq,
+                                        int enable)
+{
+    VirtIODevice *vdev = VIRTIO_DEVICE(q->n);
+    Vring *vring = virtio_net_vring(q, vq);
+
+    if (!vring) {
+        virtio_queue_set_notification(vq, enable);
+    } else if (enable) {
+        vring_enable_notification(vdev, vring);
+    } else {
+        vring_disable_notification(vdev, vring);
+    }
+}
+
+/* Whether the guest has not made room for a @bufsize packet yet.  The
+ * sizes of the buffers in a Vring are only known once they are popped,
+ * so there it can only tell whether the ring is empty.
+ */
+static bool virtio_net_rx_full(VirtIONetQueue *q, int bufsize)
+{
+    VirtIONet *n = q->n;
+
+    if (q->dataplane) {
+        return !vring_more_avail(VIRTIO_DEVICE(n), &q->rx_vring);
+    }
+    return virtio_queue_empty(q->rx_vq) ||
+           (n->mergeable_rx_bufs &&
+            !virtqueue_avail_bytes(q->rx_vq, bufsize, 0));
+}
+
 /* TODO
  * - we could suppress RX interrupt if we were so inclined.
  */
 
+/*
+ * While the dataplane is started, virtio_net_receive() runs in the
+ * IOThreads and reads the MAC address, the receive filter and the offloads.
+ * The main loop changes those with the IOThreads' AioContexts held.  These
+ * do not depend on which queues are on the dataplane, which may change in
+ * between.  Context: QEMU global mutex held
+ */
+static void virtio_net_iothreads_acquire(VirtIONet *n)
+{
+    int i;
+
+    for (i = 0; i < n->net_conf.num_iothreads; i++) {
+        aio_context_acquire(iothread_get_aio_context(n->iothreads[i]));
+    }
+}
+
+static void virtio_net_iothreads_release(VirtIONet *n)
+{
+    int i;
+
+    for (i = n->net_conf.num_iothreads - 1; i >= 0; i--) {
+        aio_context_release(iothread_get_aio_context(n->iothreads[i]));
+    }
+}
+
 static void virtio_net_get_config(VirtIODevice *vdev, uint8_t *config)
 {
     VirtIONet *n = VIRTIO_NET(vdev);
@@ -89,7 +254,9 @@ static void virtio_net_set_config(VirtIODevice *vdev, const uint8_t *config)
     if (!virtio_has_feature(vdev, VIRTIO_NET_F_CTRL_MAC_ADDR) &&
         !virtio_has_feature(vdev, VIRTIO_F_VERSION_1) &&
         memcmp(netcfg.mac, n->mac, ETH_ALEN)) {
+        virtio_net_iothreads_acquire(n);
         memcpy(n->mac, netcfg.mac, ETH_ALEN);
+        virtio_net_iothreads_release(n);
         qemu_format_nic_info_str(qemu_get_queue(n->nic), n->mac);
     }
 }
@@ -152,6 +319,8 @@ static void virtio_net_vhost_status(VirtIONet *n, uint8_t status)
     }
 }
 
+static void virtio_net_dataplane_status(VirtIONet *n, uint8_t status);
+
 static void virtio_net_set_status(struct VirtIODevice *vdev, uint8_t status)
 {
     VirtIONet *n = VIRTIO_NET(vdev);
@@ -160,12 +329,17 @@ static void virtio_net_set_status(struct VirtIODevice *vdev, uint8_t status)
     uint8_t queue_status;
 
     virtio_net_vhost_status(n, status);
+    virtio_net_dataplane_status(n, status);
 
     for (i = 0; i < n->max_queues; i++) {
         NetClientState *ncs = qemu_get_subqueue(n->nic, i);
         bool queue_started;
         q = &n->vqs[i];
 
+        if (q->dataplane) {
+            continue;
+        }
+
         if ((!n->multiqueue && i != 0) || i >= n->curr_queues) {
             queue_status = 0;
         } else {
@@ -815,6 +989,7 @@ static void virtio_net_handle_ctrl(VirtIODevice *vdev, VirtQueue *vq)
     struct iovec *iov, *iov2;
     unsigned int iov_cnt;
 
+    virtio_net_iothreads_acquire(n);
     while (virtqueue_pop(vq, &elem)) {
         if (iov_size(elem.in_sg, elem.in_num) < sizeof(status) ||
             iov_size(elem.out_sg, elem.out_num) < sizeof(ctrl)) {
@@ -849,6 +1024,7 @@ static void virtio_net_handle_ctrl(VirtIODevice *vdev, VirtQueue *vq)
         virtio_notify(vdev, vq);
         g_free(iov2);
     }
+    virtio_net_iothreads_release(n);
 }
 
 /* RX */
@@ -858,6 +1034,11 @@ static void virtio_net_handle_rx(VirtIODevice *vdev, VirtQueue *vq)
     VirtIONet *n = VIRTIO_NET(vdev);
     int queue_index = vq2q(virtio_get_queue_index(vq));
 
+    if (n->vqs[queue_index].dataplane) {
+        /* Without ioeventfd (TCG) kicks still come here */
+        event_notifier_set(virtio_queue_get_host_notifier(vq));
+        return;
+    }
     qemu_flush_queued_packets(qemu_get_subqueue(n->nic, queue_index));
 }
 
@@ -885,24 +1066,19 @@ static int virtio_net_can_receive(NetClientState *nc)
 
 static int virtio_net_has_buffers(VirtIONetQueue *q, int bufsize)
 {
-    VirtIONet *n = q->n;
-    if (virtio_queue_empty(q->rx_vq) ||
-        (n->mergeable_rx_bufs &&
-         !virtqueue_avail_bytes(q->rx_vq, bufsize, 0))) {
-        virtio_queue_set_notification(q->rx_vq, 1);
+    if (virtio_net_rx_full(q, bufsize)) {
+        virtio_net_set_notification(q, q->rx_vq, 1);
 
         /* To avoid a race condition where the guest has made some buffers
          * available after the above check but before notification was
          * enabled, check for available buffers again.
          */
-        if (virtio_queue_empty(q->rx_vq) ||
-            (n->mergeable_rx_bufs &&
-             !virtqueue_avail_bytes(q->rx_vq, bufsize, 0))) {
+        if (virtio_net_rx_full(q, bufsize)) {
             return 0;
         }
     }
 
-    virtio_queue_set_notification(q->rx_vq, 0);
+    virtio_net_set_notification(q, q->rx_vq, 0);
     return 1;
 }
 
@@ -1042,9 +1218,24 @@ static ssize_t virtio_net_receive(NetClientState *nc, const uint8_t *buf, size_t
 
         total = 0;
 
-        if (virtqueue_pop(q->rx_vq, &elem) == 0) {
+        if (virtio_net_pop(q, q->rx_vq, &elem) == 0) {
             if (i == 0)
                 return -1;
+            if (q->dataplane) {
+                /* The avail bytes were not checked; wait for the guest to
+                 * add buffers, or give back those filled so far and retry
+                 * the packet later.
+                 */
+                if (q->rx_vring.broken) {
+                    return size;
+                }
+                if (!vring_enable_notification(vdev, &q->rx_vring)) {
+                    vring_disable_notification(vdev, &q->rx_vring);
+                    continue;
+                }
+                vring_rewind(&q->rx_vring, i);
+                return 0;
+            }
             error_report("virtio-net unexpected empty queue: "
                          "i %zd mergeable %d offset %zd, size %zd, "
                          "guest hdr len %zd, host hdr len %zd "
@@ -1097,7 +1288,7 @@ static ssize_t virtio_net_receive(NetClientState *nc, const uint8_t *buf, size_t
         }
 
         /* signal other side */
-        virtqueue_fill(q->rx_vq, &elem, total, i++);
+        virtio_net_fill(q, q->rx_vq, &elem, total, i++);
     }
 
     if (mhdr_cnt) {
@@ -1107,35 +1298,85 @@ static ssize_t virtio_net_receive(NetClientState *nc, const uint8_t *buf, size_t
                      &mhdr.num_buffers, sizeof mhdr.num_buffers);
     }
 
-    virtqueue_flush(q->rx_vq, i);
-    virtio_notify(vdev, q->rx_vq);
+    virtio_net_flush(q, q->rx_vq, i);
+    if (q->rx_plugged) {
+        q->rx_notify_pending = true;
+    } else {
+        virtio_net_notify(q, q->rx_vq);
+    }
 
     return size;
 }
 
+/* Context: the subqueue's AioContext, if it has one (see net/queue.c) */
+static void virtio_net_plug(NetClientState *nc)
+{
+    VirtIONetQueue *q = virtio_net_get_subqueue(nc);
+
+    q->rx_plugged++;
+}
+
+static void virtio_net_unplug(NetClientState *nc)
+{
+    VirtIONetQueue *q = virtio_net_get_subqueue(nc);
+
+    assert(q->rx_plugged > 0);
+    if (--q->rx_plugged == 0 && q->rx_notify_pending) {
+        q->rx_notify_pending = false;
+        virtio_net_notify(q, q->rx_vq);
+    }
+}
+
 static int32_t virtio_net_flush_tx(VirtIONetQueue *q);
 
 static void virtio_net_tx_complete(NetClientState *nc, ssize_t len)
 {
-    VirtIONet *n = qemu_get_nic_opaque(nc);
     VirtIONetQueue *q = virtio_net_get_subqueue(nc);
-    VirtIODevice *vdev = VIRTIO_DEVICE(n);
 
-    virtqueue_push(q->tx_vq, &q->async_tx.elem, 0);
-    virtio_notify(vdev, q->tx_vq);
+    virtio_net_push(q, q->tx_vq, &q->async_tx.elem, 0);
+    virtio_net_notify(q, q->tx_vq);
 
     q->async_tx.elem.out_num = q->async_tx.len = 0;
 
-    virtio_queue_set_notification(q->tx_vq, 1);
+    /* Switching to or from an IOThread; whoever runs the queue next will
+     * look at the ring
+     */
+    if (q->tx_draining) {
+        return;
+    }
+
+    virtio_net_set_notification(q, q->tx_vq, 1);
     virtio_net_flush_tx(q);
 }
 
+/* Complete the packet that is waiting for the backend, if any, so that no
+ * element popped from the VirtQueue is pushed to the Vring or vice versa.
+ * The backend gets one more chance to take the packet; if it still cannot,
+ * the packet is dropped (and counted in tx-dropped) and the guest gets its
+ * buffer back.
+ */
+static void virtio_net_drain_tx(VirtIONetQueue *q)
+{
+    int queue_index = vq2q(virtio_get_queue_index(q->tx_vq));
+    NetClientState *nc = qemu_get_subqueue(q->n->nic, queue_index);
+
+    q->tx_draining = true;
+    if (q->async_tx.elem.out_num) {
+        qemu_flush_queued_packets(nc->peer);
+    }
+    if (q->async_tx.elem.out_num) {
+        qemu_purge_queued_packets(nc);
+    }
+    q->tx_draining = false;
+}
+
 /* TX */
 static int32_t virtio_net_flush_tx(VirtIONetQueue *q)
 {
     VirtIONet *n = q->n;
     VirtIODevice *vdev = VIRTIO_DEVICE(n);
-    VirtQueueElement elem;
+    VirtQueueElement *elems[VIRTIO_NET_TX_BATCH];
+    unsigned int i, count;
     int32_t num_packets = 0;
     int queue_index = vq2q(virtio_get_queue_index(q->tx_vq));
     if (!(vdev->status & VIRTIO_CONFIG_S_DRIVER_OK)) {
@@ -1143,17 +1384,41 @@ static int32_t virtio_net_flush_tx(VirtIONetQueue *q)
     }
 
     if (q->async_tx.elem.out_num) {
-        virtio_queue_set_notification(q->tx_vq, 0);
+        virtio_net_set_notification(q, q->tx_vq, 0);
         return num_packets;
     }
 
-    while (virtqueue_pop(q->tx_vq, &elem)) {
+    for (i = 0; i < VIRTIO_NET_TX_BATCH; i++) {
+        elems[i] = &q->tx_elems[i];
+    }
+
+    i = count = 0;
+    for (;;) {
+        VirtQueueElement *elem;
         ssize_t ret, len;
-        unsigned int out_num = elem.out_num;
-        struct iovec *out_sg = &elem.out_sg[0];
+        unsigned int out_num;
+        struct iovec *out_sg;
         struct iovec sg[VIRTQUEUE_MAX_SIZE], sg2[VIRTQUEUE_MAX_SIZE + 1];
         struct virtio_net_hdr_mrg_rxbuf mhdr;
 
+        /* Never pop more than the burst allows, so that no popped element
+         * is left over when the loop ends
+         */
+        if (i == count) {
+            int32_t budget = MIN(VIRTIO_NET_TX_BATCH,
+                                 n->tx_burst - num_packets);
+
+            i = 0;
+            count = virtio_net_pop_batch(q, q->tx_vq, elems,
+                                         MAX(budget, 1));
+            if (!count) {
+                break;
+            }
+        }
+        elem = elems[i++];
+        out_num = elem->out_num;
+        out_sg = &elem->out_sg[0];
+
         if (out_num < 1) {
             error_report("virtio-net header not in first element");
             exit(1);
@@ -1201,21 +1466,31 @@ static int32_t virtio_net_flush_tx(VirtIONetQueue *q)
         ret = qemu_sendv_packet_async(qemu_get_subqueue(n->nic, queue_index),
                                       out_sg, out_num, virtio_net_tx_complete);
         if (ret == 0) {
-            virtio_queue_set_notification(q->tx_vq, 0);
-            q->async_tx.elem = elem;
+            virtio_net_set_notification(q, q->tx_vq, 0);
+            q->async_tx.elem = *elem;
             q->async_tx.len  = len;
+            /* virtio_net_tx_complete will pop the rest of the batch again */
+            while (count > i) {
+                virtio_net_discard(q, q->tx_vq, elems[--count]);
+            }
+            if (num_packets) {
+                virtio_net_notify(q, q->tx_vq);
+            }
             return -EBUSY;
         }
 
         len += ret;
 drop:
-        virtqueue_push(q->tx_vq, &elem, 0);
-        virtio_notify(vdev, q->tx_vq);
+        virtio_net_push(q, q->tx_vq, elem, 0);
 
         if (++num_packets >= n->tx_burst) {
             break;
         }
     }
+    /* One interrupt for the whole burst */
+    if (num_packets) {
+        virtio_net_notify(q, q->tx_vq);
+    }
     return num_packets;
 }
 
@@ -1243,10 +1518,14 @@ static void virtio_net_handle_tx_timer(VirtIODevice *vdev, VirtQueue *vq)
     }
 }
 
-static void virtio_net_handle_tx_bh(VirtIODevice *vdev, VirtQueue *vq)
+static void virtio_net_schedule_tx(VirtIONetQueue *q)
 {
-    VirtIONet *n = VIRTIO_NET(vdev);
-    VirtIONetQueue *q = &n->vqs[vq2q(virtio_get_queue_index(vq))];
+    qemu_bh_schedule(q->dataplane ? q->dataplane_tx_bh : q->tx_bh);
+}
+
+static void virtio_net_tx_kick(VirtIONetQueue *q)
+{
+    VirtIODevice *vdev = VIRTIO_DEVICE(q->n);
 
     if (unlikely(q->tx_waiting)) {
         return;
@@ -1256,8 +1535,21 @@ static void virtio_net_handle_tx_bh(VirtIODevice *vdev, VirtQueue *vq)
     if (!vdev->vm_running) {
         return;
     }
-    virtio_queue_set_notification(vq, 0);
-    qemu_bh_schedule(q->tx_bh);
+    virtio_net_set_notification(q, q->tx_vq, 0);
+    virtio_net_schedule_tx(q);
+}
+
+static void virtio_net_handle_tx_bh(VirtIODevice *vdev, VirtQueue *vq)
+{
+    VirtIONet *n = VIRTIO_NET(vdev);
+    VirtIONetQueue *q = &n->vqs[vq2q(virtio_get_queue_index(vq))];
+
+    if (q->dataplane) {
+        /* Without ioeventfd (TCG) kicks still come here */
+        event_notifier_set(virtio_queue_get_host_notifier(vq));
+        return;
+    }
+    virtio_net_tx_kick(q);
 }
 
 static void virtio_net_tx_timer(void *opaque)
@@ -1312,7 +1604,7 @@ static void virtio_net_tx_bh(void *opaque)
     /* If we flush a full burst of packets, assume there are
      * more coming and immediately reschedule */
     if (ret >= n->tx_burst) {
-        qemu_bh_schedule(q->tx_bh);
+        virtio_net_schedule_tx(q);
         q->tx_waiting = 1;
         return;
     }
@@ -1320,10 +1612,10 @@ static void virtio_net_tx_bh(void *opaque)
     /* If less than a full burst, re-enable notification and flush
      * anything that may have come in while we weren't looking.  If
      * we find something, assume the guest is still active and reschedule */
-    virtio_queue_set_notification(q->tx_vq, 1);
+    virtio_net_set_notification(q, q->tx_vq, 1);
     if (virtio_net_flush_tx(q) > 0) {
-        virtio_queue_set_notification(q->tx_vq, 0);
-        qemu_bh_schedule(q->tx_bh);
+        virtio_net_set_notification(q, q->tx_vq, 0);
+        virtio_net_schedule_tx(q);
         q->tx_waiting = 1;
     }
 }
@@ -1345,6 +1637,7 @@ static void virtio_net_add_queue(VirtIONet *n, int index)
         n->vqs[index].tx_bh = qemu_bh_new(virtio_net_tx_bh, &n->vqs[index]);
     }
 
+    n->vqs[index].tx_elems = g_new(VirtQueueElement, VIRTIO_NET_TX_BATCH);
     n->vqs[index].tx_waiting = 0;
     n->vqs[index].n = n;
 }
@@ -1364,9 +1657,184 @@ static void virtio_net_del_queue(VirtIONet *n, int index)
     } else {
         qemu_bh_delete(q->tx_bh);
     }
+    g_free(q->tx_elems);
+    q->tx_elems = NULL;
     virtio_del_queue(vdev, index * 2 + 1);
 }
 
+static void virtio_net_dataplane_handle_rx(EventNotifier *e)
+{
+    VirtIONetQueue *q = container_of(e, VirtIONetQueue, rx_host_notifier);
+    int queue_index = vq2q(virtio_get_queue_index(q->rx_vq));
+
+    if (event_notifier_test_and_clear(e)) {
+        qemu_flush_queued_packets(qemu_get_subqueue(q->n->nic, queue_index));
+    }
+}
+
+static void virtio_net_dataplane_handle_tx(EventNotifier *e)
+{
+    VirtIONetQueue *q = container_of(e, VirtIONetQueue, tx_host_notifier);
+
+    if (event_notifier_test_and_clear(e)) {
+        virtio_net_tx_kick(q);
+    }
+}
+
+/* Context: QEMU global mutex held */
+static int virtio_net_dataplane_start_queue(VirtIONet *n, int index)
+{
+    VirtIODevice *vdev = VIRTIO_DEVICE(n);
+    BusState *qbus = BUS(qdev_get_parent_bus(DEVICE(vdev)));
+    VirtioBusClass *k = VIRTIO_BUS_GET_CLASS(qbus);
+    VirtIONetQueue *q = &n->vqs[index];
+    NetClientState *nc = qemu_get_subqueue(n->nic, index);
+    IOThread *iothread = n->iothreads[index % n->net_conf.num_iothreads];
+    int r;
+
+    qemu_bh_cancel(q->tx_bh);
+    q->tx_waiting = 0;
+    virtio_net_drain_tx(q);
+
+    if (!vring_setup(&q->rx_vring, vdev, index * 2)) {
+        return -EINVAL;
+    }
+    if (!vring_setup(&q->tx_vring, vdev, index * 2 + 1)) {
+        r = -EINVAL;
+        goto fail_tx_vring;
+    }
+    r = k->set_host_notifier(qbus->parent, index * 2, true);
+    if (r != 0) {
+        goto fail_rx_notifier;
+    }
+    r = k->set_host_notifier(qbus->parent, index * 2 + 1, true);
+    if (r != 0) {
+        goto fail_tx_notifier;
+    }
+    q->rx_host_notifier = *virtio_queue_get_host_notifier(q->rx_vq);
+    q->tx_host_notifier = *virtio_queue_get_host_notifier(q->tx_vq);
+
+    q->ctx = iothread_get_aio_context(iothread);
+    q->dataplane_tx_bh = aio_bh_new(q->ctx, virtio_net_tx_bh, q);
+    q->dataplane = true;
+
+    aio_context_acquire(q->ctx);
+    qemu_set_aio_context(nc->peer, q->ctx);
+    aio_set_event_notifier(q->ctx, &q->rx_host_notifier,
+                           virtio_net_dataplane_handle_rx);
+    aio_set_event_notifier(q->ctx, &q->tx_host_notifier,
+                           virtio_net_dataplane_handle_tx);
+    aio_context_release(q->ctx);
+
+    /* Pick up the buffers and packets the guest queued before the switch */
+    event_notifier_set(&q->rx_host_notifier);
+    event_notifier_set(&q->tx_host_notifier);
+    return 0;
+
+  fail_tx_notifier:
+    k->set_host_notifier(qbus->parent, index * 2, false);
+  fail_rx_notifier:
+    vring_teardown(&q->tx_vring, vdev, index * 2 + 1);
+  fail_tx_vring:
+    vring_teardown(&q->rx_vring, vdev, index * 2);
+    return r;
+}
+
+/* Context: QEMU global mutex held */
+static void virtio_net_dataplane_stop_queue(VirtIONet *n, int index)
+{
+    VirtIODevice *vdev = VIRTIO_DEVICE(n);
+    BusState *qbus = BUS(qdev_get_parent_bus(DEVICE(vdev)));
+    VirtioBusClass *k = VIRTIO_BUS_GET_CLASS(qbus);
+    VirtIONetQueue *q = &n->vqs[index];
+    NetClientState *nc = qemu_get_subqueue(n->nic, index);
+
+    aio_context_acquire(q->ctx);
+    aio_set_event_notifier(q->ctx, &q->rx_host_notifier, NULL);
+    aio_set_event_notifier(q->ctx, &q->tx_host_notifier, NULL);
+    virtio_net_drain_tx(q);
+    qemu_bh_delete(q->dataplane_tx_bh);
+    q->dataplane_tx_bh = NULL;
+    qemu_set_aio_context(nc->peer, NULL);
+    aio_context_release(q->ctx);
+
+    /* Sync the rings back to the VirtQueues before the main loop uses them */
+    vring_teardown(&q->rx_vring, vdev, index * 2);
+    vring_teardown(&q->tx_vring, vdev, index * 2 + 1);
+    k->set_host_notifier(qbus->parent, index * 2, false);
+    k->set_host_notifier(qbus->parent, index * 2 + 1, false);
+
+    q->dataplane = false;
+    q->ctx = NULL;
+    /* Kicks that raced with the switch are lost; look at the ring anyway */
+    q->tx_waiting = 1;
+}
+
+static void virtio_net_dataplane_stop(VirtIONet *n)
+{
+    VirtIODevice *vdev = VIRTIO_DEVICE(n);
+    BusState *qbus = BUS(qdev_get_parent_bus(DEVICE(vdev)));
+    VirtioBusClass *k = VIRTIO_BUS_GET_CLASS(qbus);
+    int i;
+
+    for (i = 0; i < n->dataplane_queues; i++) {
+        virtio_net_dataplane_stop_queue(n, i);
+    }
+    k->set_guest_notifiers(qbus->parent, n->dataplane_queues * 2, false);
+    n->dataplane_started = false;
+}
+
+static void virtio_net_dataplane_start(VirtIONet *n, int queues)
+{
+    VirtIODevice *vdev = VIRTIO_DEVICE(n);
+    BusState *qbus = BUS(qdev_get_parent_bus(DEVICE(vdev)));
+    VirtioBusClass *k = VIRTIO_BUS_GET_CLASS(qbus);
+    int i, r;
+
+    r = k->set_guest_notifiers(qbus->parent, queues * 2, true);
+    if (r != 0) {
+        goto fail;
+    }
+    for (i = 0; i < queues; i++) {
+        r = virtio_net_dataplane_start_queue(n, i);
+        if (r != 0) {
+            while (--i >= 0) {
+                virtio_net_dataplane_stop_queue(n, i);
+            }
+            k->set_guest_notifiers(qbus->parent, queues * 2, false);
+            goto fail;
+        }
+    }
+    n->dataplane_queues = queues;
+    n->dataplane_started = true;
+    return;
+
+fail:
+    error_report("virtio-net: unable to start IOThread dataplane: %d: "
+                 "falling back on the main loop", -r);
+    n->dataplane_disabled = true;
+}
+
+/* Context: QEMU global mutex held */
+static void virtio_net_dataplane_status(VirtIONet *n, uint8_t status)
+{
+    int queues = n->multiqueue ? n->curr_queues : 1;
+    bool start = n->net_conf.num_iothreads &&
+                 virtio_net_started(n, status) && !n->vhost_started;
+
+    if (!start) {
+        /* Better luck next time */
+        n->dataplane_disabled = false;
+    }
+    if (n->dataplane_started &&
+        (!start || queues != n->dataplane_queues)) {
+        virtio_net_dataplane_stop(n);
+    }
+    if (start && !n->dataplane_started && !n->dataplane_disabled) {
+        virtio_net_dataplane_start(n, queues);
+    }
+}
+
 static void virtio_net_change_num_queues(VirtIONet *n, int new_max_queues)
 {
     VirtIODevice *vdev = VIRTIO_DEVICE(n);
@@ -1603,6 +2071,8 @@ static NetClientInfo net_virtio_info = {
     .size = sizeof(NICState),
     .can_receive = virtio_net_can_receive,
     .receive = virtio_net_receive,
+    .plug = virtio_net_plug,
+    .unplug = virtio_net_unplug,
     .link_status_changed = virtio_net_set_link_status,
     .query_rx_filter = virtio_net_query_rxfilter,
 };
@@ -1611,7 +2081,11 @@ static bool virtio_net_guest_notifier_pending(VirtIODevice *vdev, int idx)
 {
     VirtIONet *n = VIRTIO_NET(vdev);
     NetClientState *nc = qemu_get_subqueue(n->nic, vq2q(idx));
-    assert(n->vhost_started);
+
+    /* The IOThread dataplane assigns guest notifiers too */
+    if (!n->vhost_started) {
+        return false;
+    }
     return vhost_net_virtqueue_pending(get_vhost_net(nc->peer), idx);
 }
 
@@ -1620,7 +2094,10 @@ static void virtio_net_guest_notifier_mask(VirtIODevice *vdev, int idx,
 {
     VirtIONet *n = VIRTIO_NET(vdev);
     NetClientState *nc = qemu_get_subqueue(n->nic, vq2q(idx));
-    assert(n->vhost_started);
+
+    if (!n->vhost_started) {
+        return;
+    }
     vhost_net_virtqueue_mask(get_vhost_net(nc->peer),
                              vdev, idx, mask);
 }
@@ -1637,6 +2114,72 @@ static void virtio_net_set_config_size(VirtIONet *n, uint64_t host_features)
     n->config_size = config_size;
 }
 
+static void virtio_net_put_iothreads(VirtIONet *n, int count)
+{
+    while (--count >= 0) {
+        object_unref(OBJECT(n->iothreads[count]));
+    }
+    g_free(n->iothreads);
+    n->iothreads = NULL;
+}
+
+/* Look up the IOThreads the queue pairs are served from, if any */
+static void virtio_net_get_iothreads(VirtIONet *n, Error **errp)
+{
+    BusState *qbus = BUS(qdev_get_parent_bus(DEVICE(n)));
+    VirtioBusClass *k = VIRTIO_BUS_GET_CLASS(qbus);
+    uint32_t num = n->net_conf.num_iothreads;
+    int i;
+
+    if (!num) {
+        return;
+    }
+    if (n->net_conf.tx && !strcmp(n->net_conf.tx, "timer")) {
+        error_setg(errp, "iothreads cannot be used with tx=timer");
+        return;
+    }
+    if (num > n->max_queues) {
+        error_setg(errp, "%" PRIu32 " iothreads given for %" PRIu16
+                   " queue pairs", num, n->max_queues);
+        return;
+    }
+    if (!k->set_guest_notifiers || !k->set_host_notifier) {
+        error_setg(errp, "iothreads are not supported by this transport");
+        return;
+    }
+    for (i = 0; i < n->max_queues; i++) {
+        NetClientState *peer = n->nic_conf.peers.ncs[i];
+
+        if (!peer || !peer->info->set_aio_context) {
+            error_setg(errp, "iothreads need a netdev that supports them, "
+                       "such as tap");
+            return;
+        }
+        if (get_vhost_net(peer)) {
+            error_setg(errp, "iothreads cannot be used with vhost");
+            return;
+        }
+    }
+
+    n->iothreads = g_new0(IOThread *, num);
+    for (i = 0; i < num; i++) {
+        const char *id = n->net_conf.iothreads[i];
+        Object *obj = NULL;
+
+        if (id) {
+            obj = object_resolve_path_component(object_get_objects_root(),
+                                                id);
+        }
+        n->iothreads[i] = (IOThread *)object_dynamic_cast(obj, TYPE_IOTHREAD);
+        if (!n->iothreads[i]) {
+            error_setg(errp, "iothread \"%s\" not found", id ? id : "");
+            virtio_net_put_iothreads(n, i);
+            return;
+        }
+        object_ref(OBJECT(n->iothreads[i]));
+    }
+}
+
 void virtio_net_set_netclient_name(VirtIONet *n, const char *name,
                                    const char *type)
 {
@@ -1656,6 +2199,7 @@ static void virtio_net_device_realize(DeviceState *dev, Error **errp)
     VirtIODevice *vdev = VIRTIO_DEVICE(dev);
     VirtIONet *n = VIRTIO_NET(dev);
     NetClientState *nc;
+    Error *local_err = NULL;
     int i;
 
     virtio_net_set_config_size(n, n->host_features);
@@ -1669,6 +2213,12 @@ static void virtio_net_device_realize(DeviceState *dev, Error **errp)
         virtio_cleanup(vdev);
         return;
     }
+    virtio_net_get_iothreads(n, &local_err);
+    if (local_err) {
+        error_propagate(errp, local_err);
+        virtio_cleanup(vdev);
+        return;
+    }
     n->vqs = g_malloc0(sizeof(VirtIONetQueue) * n->max_queues);
     n->curr_queues = 1;
     n->tx_timeout = n->net_conf.txtimer;
@@ -1760,6 +2310,7 @@ static void virtio_net_device_unrealize(DeviceState *dev, Error **errp)
     timer_free(n->announce_timer);
     g_free(n->vqs);
     qemu_del_nic(n->nic);
+    virtio_net_put_iothreads(n, n->iothreads ? n->net_conf.num_iothreads : 0);
     virtio_cleanup(vdev);
 }
 
@@ -1777,6 +2328,14 @@ static void virtio_net_instance_init(Object *obj)
                                   DEVICE(n), NULL);
 }
 
+static void virtio_net_instance_finalize(Object *obj)
+{
+    VirtIONet *n = VIRTIO_NET(obj);
+
+    /* The elements are freed with the properties, the array is not */
+    g_free(n->net_conf.iothreads);
+}
+
 static Property virtio_net_properties[] = {
     DEFINE_PROP_BIT("csum", VirtIONet, host_features, VIRTIO_NET_F_CSUM, true),
     DEFINE_PROP_BIT("guest_csum", VirtIONet, host_features,
@@ -1822,6 +2381,8 @@ static Property virtio_net_properties[] = {
                        TX_TIMER_INTERVAL),
     DEFINE_PROP_INT32("x-txburst", VirtIONet, net_conf.txburst, TX_BURST),
     DEFINE_PROP_STRING("tx", VirtIONet, net_conf.tx),
+    DEFINE_PROP_ARRAY("iothreads", VirtIONet, net_conf.num_iothreads,
+                      net_conf.iothreads, qdev_prop_string, char *),
     DEFINE_PROP_END_OF_LIST(),
 };
 
@@ -1852,6 +2413,7 @@ static const TypeInfo virtio_net_info = {
     .parent = TYPE_VIRTIO_DEVICE,
     .instance_size = sizeof(VirtIONet),
     .instance_init = virtio_net_instance_init,
+    .instance_finalize = virtio_net_instance_finalize,
     .class_init = virtio_net_class_init,
 };
 
@@ -633,9 +633,14 @@ static uint64_t virtio_scsi_get_features(VirtIODevice *vdev,
                                          Error **errp)
 {
     VirtIOSCSI *s = VIRTIO_SCSI(vdev);
+    VirtIOSCSICommon *vs = VIRTIO_SCSI_COMMON(vdev);
 
     /* Firstly sync all virtio-scsi possible supported features */
     requested_features |= s->host_features;
+    if (vs->conf.iothread) {
+        /* dataplane only knows the split ring */
+        virtio_clear_feature(&requested_features, VIRTIO_F_RING_PACKED);
+    }
     return requested_features;
 }
 
@@ -73,6 +73,12 @@ bool vring_setup(Vring *vring, VirtIODevice *vdev, int n)
 
     vring->broken = false;
 
+    if (virtio_has_feature(vdev, VIRTIO_F_RING_PACKED)) {
+        error_report("Packed virtqueues are not supported by dataplane");
+        vring->broken = true;
+        return false;
+    }
+
     vring_ptr = vring_map(&vring->mr, vring_addr, vring_size, true);
     if (!vring_ptr) {
         error_report("Failed to map vring "
@@ -418,15 +424,31 @@ out:
     return ret;
 }
 
-/* After we've used one of their buffers, we tell them about it.
- *
- * Stolen from linux/drivers/vhost/vhost.c.
+/* Give back the element that vring_pop() returned last, e.g. because there
+ * is no room for it yet.  It is returned again by the next vring_pop().
  */
-void vring_push(VirtIODevice *vdev, Vring *vring, VirtQueueElement *elem,
-                int len)
+void vring_discard(Vring *vring, VirtQueueElement *elem)
+{
+    vring_unmap_element(elem);
+    vring->last_avail_idx--;
+}
+
+/* Give back the last @num elements that were popped and then passed to
+ * vring_fill() but not to vring_flush().
+ */
+void vring_rewind(Vring *vring, unsigned int num)
+{
+    vring->last_avail_idx -= num;
+}
+
+/* Put a buffer in the used ring, @idx entries after the next free one.  The
+ * guest does not see it until vring_flush() is called.
+ */
+void vring_fill(VirtIODevice *vdev, Vring *vring, VirtQueueElement *elem,
+                int len, unsigned int idx)
 {
     unsigned int head = elem->index;
-    uint16_t new;
+    uint16_t i;
 
     vring_unmap_element(elem);
 
@@ -437,17 +459,39 @@ void vring_push(VirtIODevice *vdev, Vring *vring, VirtQueueElement *elem,
 
     /* The virtqueue contains a ring of used buffers.  Get a pointer to the
      * next entry in that used ring. */
-    vring_set_used_ring_id(vdev, vring, vring->last_used_idx % vring->vr.num,
-                           head);
-    vring_set_used_ring_len(vdev, vring, vring->last_used_idx % vring->vr.num,
-                            len);
+    i = (uint16_t)(vring->last_used_idx + idx) % vring->vr.num;
+    vring_set_used_ring_id(vdev, vring, i, head);
+    vring_set_used_ring_len(vdev, vring, i, len);
+}
+
+/* Tell the guest about the last @count buffers that were filled */
+void vring_flush(VirtIODevice *vdev, Vring *vring, unsigned int count)
+{
+    uint16_t old, new;
+
+    if (vring->broken) {
+        return;
+    }
 
     /* Make sure buffer is written before we update index. */
     smp_wmb();
 
-    new = ++vring->last_used_idx;
+    old = vring->last_used_idx;
+    new = vring->last_used_idx = old + count;
     vring_set_used_idx(vdev, vring, new);
-    if (unlikely((int16_t)(new - vring->signalled_used) < (uint16_t)1)) {
+    if (unlikely((int16_t)(new - vring->signalled_used) <
+                 (uint16_t)(new - old))) {
         vring->signalled_used_valid = false;
     }
 }
+
+/* After we've used one of their buffers, we tell them about it.
+ *
+ * Stolen from linux/drivers/vhost/vhost.c.
+ */
+void vring_push(VirtIODevice *vdev, Vring *vring, VirtQueueElement *elem,
+                int len)
+{
+    vring_fill(vdev, vring, elem, len, 0);
+    vring_flush(vdev, vring, 1);
+}
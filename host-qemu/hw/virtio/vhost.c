@@ -932,7 +932,8 @@ int vhost_dev_init(struct vhost_dev *hdev, void *opaque,
             goto fail_vq;
         }
     }
-    hdev->features = features;
+    /* Only the split ring layout is set up for the backend */
+    hdev->features = features & ~(1ULL << VIRTIO_F_RING_PACKED);
 
     hdev->memory_listener = (MemoryListener) {
         .begin = vhost_begin,
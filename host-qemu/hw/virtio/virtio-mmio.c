@@ -122,6 +122,55 @@ static void virtio_mmio_stop_ioeventfd(VirtIOMMIOProxy *proxy)
     proxy->ioeventfd_started = false;
 }
 
+static void virtio_mmio_reset_queues(VirtIOMMIOProxy *proxy)
+{
+    proxy->guest_features[0] = proxy->guest_features[1] = 0;
+    memset(proxy->vqs, 0, sizeof(proxy->vqs));
+}
+
+/* Store half of a ring address written by a version 2 driver */
+static void virtio_mmio_queue_addr(VirtIOMMIOQueue *q, hwaddr offset,
+                                   uint32_t value)
+{
+    switch (offset) {
+    case VIRTIO_MMIO_QUEUEDESCLOW:
+    case VIRTIO_MMIO_QUEUEDESCHIGH:
+        q->desc[offset == VIRTIO_MMIO_QUEUEDESCHIGH] = value;
+        break;
+    case VIRTIO_MMIO_QUEUEAVAILLOW:
+    case VIRTIO_MMIO_QUEUEAVAILHIGH:
+        q->avail[offset == VIRTIO_MMIO_QUEUEAVAILHIGH] = value;
+        break;
+    case VIRTIO_MMIO_QUEUEUSEDLOW:
+    case VIRTIO_MMIO_QUEUEUSEDHIGH:
+        q->used[offset == VIRTIO_MMIO_QUEUEUSEDHIGH] = value;
+        break;
+    default:
+        abort();
+    }
+}
+
+static void virtio_mmio_queue_ready(VirtIOMMIOProxy *proxy, int n,
+                                    uint32_t value)
+{
+    VirtIODevice *vdev = virtio_bus_get_device(&proxy->bus);
+    VirtIOMMIOQueue *q = &proxy->vqs[n];
+
+    if (value) {
+        /* For a packed ring, avail and used are the driver and device
+         * event suppression areas.
+         */
+        virtio_queue_set_num(vdev, n, q->num);
+        virtio_queue_set_rings(vdev, n,
+                               ((uint64_t)q->desc[1] << 32) | q->desc[0],
+                               ((uint64_t)q->avail[1] << 32) | q->avail[0],
+                               ((uint64_t)q->used[1] << 32) | q->used[0]);
+        q->enabled = true;
+    } else {
+        q->enabled = false;
+    }
+}
+
 static uint64_t virtio_mmio_read(void *opaque, hwaddr offset, unsigned size)
 {
     VirtIOMMIOProxy *proxy = (VirtIOMMIOProxy *)opaque;
@@ -142,7 +191,7 @@ static uint64_t virtio_mmio_read(void *opaque, hwaddr offset, unsigned size)
         case VIRTIO_MMIO_MAGIC:
             return VIRT_MAGIC;
         case VIRTIO_MMIO_VERSION:
-            return VIRT_VERSION;
+            return proxy->legacy ? VIRT_VERSION_LEGACY : VIRT_VERSION;
         case VIRTIO_MMIO_VENDORID:
             return VIRT_VENDOR;
         default:
@@ -152,6 +201,18 @@ static uint64_t virtio_mmio_read(void *opaque, hwaddr offset, unsigned size)
 
     if (offset >= VIRTIO_MMIO_CONFIG) {
         offset -= VIRTIO_MMIO_CONFIG;
+        if (!proxy->legacy) {
+            switch (size) {
+            case 1:
+                return virtio_config_modern_readb(vdev, offset);
+            case 2:
+                return virtio_config_modern_readw(vdev, offset);
+            case 4:
+                return virtio_config_modern_readl(vdev, offset);
+            default:
+                abort();
+            }
+        }
         switch (size) {
         case 1:
             return virtio_config_readb(vdev, offset);
@@ -171,28 +232,50 @@ static uint64_t virtio_mmio_read(void *opaque, hwaddr offset, unsigned size)
     case VIRTIO_MMIO_MAGIC:
         return VIRT_MAGIC;
     case VIRTIO_MMIO_VERSION:
-        return VIRT_VERSION;
+        return proxy->legacy ? VIRT_VERSION_LEGACY : VIRT_VERSION;
     case VIRTIO_MMIO_DEVICEID:
         return vdev->device_id;
     case VIRTIO_MMIO_VENDORID:
         return VIRT_VENDOR;
     case VIRTIO_MMIO_HOSTFEATURES:
-        if (proxy->host_features_sel) {
+        if (proxy->legacy) {
+            if (proxy->host_features_sel) {
+                return 0;
+            }
+            return vdev->host_features;
+        }
+        if (proxy->host_features_sel > 1) {
             return 0;
         }
-        return vdev->host_features;
+        return vdev->host_features >> (32 * proxy->host_features_sel);
     case VIRTIO_MMIO_QUEUENUMMAX:
         if (!virtio_queue_get_num(vdev, vdev->queue_sel)) {
             return 0;
         }
         return VIRTQUEUE_MAX_SIZE;
     case VIRTIO_MMIO_QUEUEPFN:
+        if (!proxy->legacy) {
+            DPRINTF("read of legacy register in version 2 mode\n");
+            return 0;
+        }
         return virtio_queue_get_addr(vdev, vdev->queue_sel)
             >> proxy->guest_page_shift;
+    case VIRTIO_MMIO_QUEUEREADY:
+        if (proxy->legacy) {
+            DPRINTF("read of version 2 register in legacy mode\n");
+            return 0;
+        }
+        return proxy->vqs[vdev->queue_sel].enabled;
     case VIRTIO_MMIO_INTERRUPTSTATUS:
         return vdev->isr;
     case VIRTIO_MMIO_STATUS:
         return vdev->status;
+    case VIRTIO_MMIO_CONFIGGENERATION:
+        if (proxy->legacy) {
+            DPRINTF("read of version 2 register in legacy mode\n");
+            return 0;
+        }
+        return vdev->generation;
     case VIRTIO_MMIO_HOSTFEATURESSEL:
     case VIRTIO_MMIO_GUESTFEATURES:
     case VIRTIO_MMIO_GUESTFEATURESSEL:
@@ -202,6 +285,12 @@ static uint64_t virtio_mmio_read(void *opaque, hwaddr offset, unsigned size)
     case VIRTIO_MMIO_QUEUEALIGN:
     case VIRTIO_MMIO_QUEUENOTIFY:
     case VIRTIO_MMIO_INTERRUPTACK:
+    case VIRTIO_MMIO_QUEUEDESCLOW:
+    case VIRTIO_MMIO_QUEUEDESCHIGH:
+    case VIRTIO_MMIO_QUEUEAVAILLOW:
+    case VIRTIO_MMIO_QUEUEAVAILHIGH:
+    case VIRTIO_MMIO_QUEUEUSEDLOW:
+    case VIRTIO_MMIO_QUEUEUSEDHIGH:
         DPRINTF("read of write-only register\n");
         return 0;
     default:
@@ -230,6 +319,22 @@ static void virtio_mmio_write(void *opaque, hwaddr offset, uint64_t value,
 
     if (offset >= VIRTIO_MMIO_CONFIG) {
         offset -= VIRTIO_MMIO_CONFIG;
+        if (!proxy->legacy) {
+            switch (size) {
+            case 1:
+                virtio_config_modern_writeb(vdev, offset, value);
+                break;
+            case 2:
+                virtio_config_modern_writew(vdev, offset, value);
+                break;
+            case 4:
+                virtio_config_modern_writel(vdev, offset, value);
+                break;
+            default:
+                abort();
+            }
+            return;
+        }
         switch (size) {
         case 1:
             virtio_config_writeb(vdev, offset, value);
@@ -254,7 +359,12 @@ static void virtio_mmio_write(void *opaque, hwaddr offset, uint64_t value,
         proxy->host_features_sel = value;
         break;
     case VIRTIO_MMIO_GUESTFEATURES:
-        if (!proxy->guest_features_sel) {
+        if (!proxy->legacy) {
+            /* Applied together when the driver sets FEATURES_OK */
+            if (proxy->guest_features_sel < 2) {
+                proxy->guest_features[proxy->guest_features_sel] = value;
+            }
+        } else if (!proxy->guest_features_sel) {
             virtio_set_features(vdev, value);
         }
         break;
@@ -262,6 +372,10 @@ static void virtio_mmio_write(void *opaque, hwaddr offset, uint64_t value,
         proxy->guest_features_sel = value;
         break;
     case VIRTIO_MMIO_GUESTPAGESIZE:
+        if (!proxy->legacy) {
+            DPRINTF("write to legacy register in version 2 mode\n");
+            break;
+        }
         proxy->guest_page_shift = ctz32(value);
         if (proxy->guest_page_shift > 31) {
             proxy->guest_page_shift = 0;
@@ -276,15 +390,27 @@ static void virtio_mmio_write(void *opaque, hwaddr offset, uint64_t value,
         break;
     case VIRTIO_MMIO_QUEUENUM:
         DPRINTF("mmio_queue write %d max %d\n", (int)value, VIRTQUEUE_MAX_SIZE);
+        if (!proxy->legacy) {
+            proxy->vqs[vdev->queue_sel].num = value;
+            break;
+        }
         virtio_queue_set_num(vdev, vdev->queue_sel, value);
         /* Note: only call this function for legacy devices */
         virtio_queue_update_rings(vdev, vdev->queue_sel);
         break;
     case VIRTIO_MMIO_QUEUEALIGN:
+        if (!proxy->legacy) {
+            DPRINTF("write to legacy register in version 2 mode\n");
+            break;
+        }
         /* Note: this is only valid for legacy devices */
         virtio_queue_set_align(vdev, vdev->queue_sel, value);
         break;
     case VIRTIO_MMIO_QUEUEPFN:
+        if (!proxy->legacy) {
+            DPRINTF("write to legacy register in version 2 mode\n");
+            break;
+        }
         if (value == 0) {
             virtio_reset(vdev);
         } else {
@@ -292,6 +418,25 @@ static void virtio_mmio_write(void *opaque, hwaddr offset, uint64_t value,
                                   value << proxy->guest_page_shift);
         }
         break;
+    case VIRTIO_MMIO_QUEUEREADY:
+        if (proxy->legacy) {
+            DPRINTF("write to version 2 register in legacy mode\n");
+            break;
+        }
+        virtio_mmio_queue_ready(proxy, vdev->queue_sel, value);
+        break;
+    case VIRTIO_MMIO_QUEUEDESCLOW:
+    case VIRTIO_MMIO_QUEUEDESCHIGH:
+    case VIRTIO_MMIO_QUEUEAVAILLOW:
+    case VIRTIO_MMIO_QUEUEAVAILHIGH:
+    case VIRTIO_MMIO_QUEUEUSEDLOW:
+    case VIRTIO_MMIO_QUEUEUSEDHIGH:
+        if (proxy->legacy) {
+            DPRINTF("write to version 2 register in legacy mode\n");
+            break;
+        }
+        virtio_mmio_queue_addr(&proxy->vqs[vdev->queue_sel], offset, value);
+        break;
     case VIRTIO_MMIO_QUEUENOTIFY:
         if (value < VIRTIO_QUEUE_MAX) {
             virtio_queue_notify(vdev, value);
@@ -306,6 +451,13 @@ static void virtio_mmio_write(void *opaque, hwaddr offset, uint64_t value,
             virtio_mmio_stop_ioeventfd(proxy);
         }
 
+        if (!proxy->legacy && (value & VIRTIO_CONFIG_S_FEATURES_OK) &&
+            !(vdev->status & VIRTIO_CONFIG_S_FEATURES_OK)) {
+            virtio_set_features(vdev,
+                                ((uint64_t)proxy->guest_features[1] << 32) |
+                                proxy->guest_features[0]);
+        }
+
         virtio_set_status(vdev, value & 0xff);
 
         if (value & VIRTIO_CONFIG_S_DRIVER_OK) {
@@ -314,6 +466,7 @@ static void virtio_mmio_write(void *opaque, hwaddr offset, uint64_t value,
 
         if (vdev->status == 0) {
             virtio_reset(vdev);
+            virtio_mmio_reset_queues(proxy);
         }
         break;
     case VIRTIO_MMIO_MAGIC:
@@ -323,6 +476,7 @@ static void virtio_mmio_write(void *opaque, hwaddr offset, uint64_t value,
     case VIRTIO_MMIO_HOSTFEATURES:
     case VIRTIO_MMIO_QUEUENUMMAX:
     case VIRTIO_MMIO_INTERRUPTSTATUS:
+    case VIRTIO_MMIO_CONFIGGENERATION:
         DPRINTF("write to readonly register\n");
         break;
 
@@ -358,6 +512,10 @@ static int virtio_mmio_load_config(DeviceState *opaque, QEMUFile *f)
     proxy->host_features_sel = qemu_get_be32(f);
     proxy->guest_features_sel = qemu_get_be32(f);
     proxy->guest_page_shift = qemu_get_be32(f);
+    if (!proxy->legacy) {
+        proxy->guest_features[0] = qemu_get_be32(f);
+        proxy->guest_features[1] = qemu_get_be32(f);
+    }
     return 0;
 }
 
@@ -368,6 +526,45 @@ static void virtio_mmio_save_config(DeviceState *opaque, QEMUFile *f)
     qemu_put_be32(f, proxy->host_features_sel);
     qemu_put_be32(f, proxy->guest_features_sel);
     qemu_put_be32(f, proxy->guest_page_shift);
+    if (!proxy->legacy) {
+        qemu_put_be32(f, proxy->guest_features[0]);
+        qemu_put_be32(f, proxy->guest_features[1]);
+    }
+}
+
+static int virtio_mmio_load_queue(DeviceState *opaque, int n, QEMUFile *f)
+{
+    VirtIOMMIOProxy *proxy = VIRTIO_MMIO(opaque);
+    VirtIOMMIOQueue *q = &proxy->vqs[n];
+
+    if (!proxy->legacy) {
+        q->num = qemu_get_be16(f);
+        q->enabled = qemu_get_byte(f);
+        q->desc[0] = qemu_get_be32(f);
+        q->desc[1] = qemu_get_be32(f);
+        q->avail[0] = qemu_get_be32(f);
+        q->avail[1] = qemu_get_be32(f);
+        q->used[0] = qemu_get_be32(f);
+        q->used[1] = qemu_get_be32(f);
+    }
+    return 0;
+}
+
+static void virtio_mmio_save_queue(DeviceState *opaque, int n, QEMUFile *f)
+{
+    VirtIOMMIOProxy *proxy = VIRTIO_MMIO(opaque);
+    VirtIOMMIOQueue *q = &proxy->vqs[n];
+
+    if (!proxy->legacy) {
+        qemu_put_be16(f, q->num);
+        qemu_put_byte(f, q->enabled);
+        qemu_put_be32(f, q->desc[0]);
+        qemu_put_be32(f, q->desc[1]);
+        qemu_put_be32(f, q->avail[0]);
+        qemu_put_be32(f, q->avail[1]);
+        qemu_put_be32(f, q->used[0]);
+        qemu_put_be32(f, q->used[1]);
+    }
 }
 
 static void virtio_mmio_reset(DeviceState *d)
@@ -379,6 +576,21 @@ static void virtio_mmio_reset(DeviceState *d)
     proxy->host_features_sel = 0;
     proxy->guest_features_sel = 0;
     proxy->guest_page_shift = 0;
+    virtio_mmio_reset_queues(proxy);
+}
+
+/* This is called by virtio-bus just after the device is plugged. */
+static void virtio_mmio_device_plugged(DeviceState *opaque, Error **errp)
+{
+    VirtIOMMIOProxy *proxy = VIRTIO_MMIO(opaque);
+    VirtIODevice *vdev = virtio_bus_get_device(&proxy->bus);
+
+    if (proxy->legacy) {
+        /* A legacy driver only sees the low 32 feature bits */
+        virtio_clear_feature(&vdev->host_features, VIRTIO_F_RING_PACKED);
+    } else {
+        virtio_add_feature(&vdev->host_features, VIRTIO_F_VERSION_1);
+    }
 }
 
 static int virtio_mmio_set_guest_notifier(DeviceState *d, int n, bool assign,
@@ -475,12 +687,18 @@ static void virtio_mmio_realizefn(DeviceState *d, Error **errp)
     sysbus_init_mmio(sbd, &proxy->iomem);
 }
 
+static Property virtio_mmio_properties[] = {
+    DEFINE_PROP_BOOL("force-legacy", VirtIOMMIOProxy, legacy, true),
+    DEFINE_PROP_END_OF_LIST(),
+};
+
 static void virtio_mmio_class_init(ObjectClass *klass, void *data)
 {
     DeviceClass *dc = DEVICE_CLASS(klass);
 
     dc->realize = virtio_mmio_realizefn;
     dc->reset = virtio_mmio_reset;
+    dc->props = virtio_mmio_properties;
     set_bit(DEVICE_CATEGORY_MISC, dc->categories);
 }
 
@@ -501,6 +719,9 @@ static void virtio_mmio_bus_class_init(ObjectClass *klass, void *data)
     k->notify = virtio_mmio_update_irq;
     k->save_config = virtio_mmio_save_config;
     k->load_config = virtio_mmio_load_config;
+    k->save_queue = virtio_mmio_save_queue;
+    k->load_queue = virtio_mmio_load_queue;
+    k->device_plugged = virtio_mmio_device_plugged;
     k->set_host_notifier = virtio_mmio_set_host_notifier;
     k->set_guest_notifiers = virtio_mmio_set_guest_notifiers;
     k->has_variable_vring_alignment = true;
@@ -63,20 +63,38 @@
 #define VIRTIO_MMIO_QUEUENUM 0x38
 #define VIRTIO_MMIO_QUEUEALIGN 0x3c
 #define VIRTIO_MMIO_QUEUEPFN 0x40
+#define VIRTIO_MMIO_QUEUEREADY 0x44
 #define VIRTIO_MMIO_QUEUENOTIFY 0x50
 #define VIRTIO_MMIO_INTERRUPTSTATUS 0x60
 #define VIRTIO_MMIO_INTERRUPTACK 0x64
 #define VIRTIO_MMIO_STATUS 0x70
+#define VIRTIO_MMIO_QUEUEDESCLOW 0x80
+#define VIRTIO_MMIO_QUEUEDESCHIGH 0x84
+#define VIRTIO_MMIO_QUEUEAVAILLOW 0x90
+#define VIRTIO_MMIO_QUEUEAVAILHIGH 0x94
+#define VIRTIO_MMIO_QUEUEUSEDLOW 0xa0
+#define VIRTIO_MMIO_QUEUEUSEDHIGH 0xa4
+#define VIRTIO_MMIO_CONFIGGENERATION 0xfc
 /* Device specific config space starts here */
 #define VIRTIO_MMIO_CONFIG 0x100
 
 #define VIRT_MAGIC 0x74726976 /* 'virt' */
-#define VIRT_VERSION 1
+#define VIRT_VERSION 2
+#define VIRT_VERSION_LEGACY 1
 #define VIRT_VENDOR 0x554D4551 /* 'QEMU' */
 
 #define TYPE_VIRTIO_BLK_MMIO "virtio-blk-mmio"
 #define TYPE_VIRTIO_MSG_MMIO	"virtio-msg-mmio"
 
+/* Queue setup written by a version 2 driver, applied on QueueReady */
+typedef struct VirtIOMMIOQueue {
+    uint16_t num;
+    bool enabled;
+    uint32_t desc[2];
+    uint32_t avail[2];
+    uint32_t used[2];
+} VirtIOMMIOQueue;
+
 typedef struct {
     /* Generic */
     SysBusDevice parent_obj;
@@ -86,10 +104,15 @@ typedef struct {
     uint32_t host_features_sel;
     uint32_t guest_features_sel;
     uint32_t guest_page_shift;
+    /* Version 2 only */
+    uint32_t guest_features[2];
+    VirtIOMMIOQueue vqs[VIRTIO_QUEUE_MAX];
     /* virtio-bus */
     VirtioBusState bus;
     bool ioeventfd_disabled;
     bool ioeventfd_started;
+    /* Expose the version 1 register layout only */
+    bool legacy;
 } VirtIOMMIOProxy;
 
 
@@ -1489,6 +1489,9 @@ static void virtio_pci_device_plugged(DeviceState *d, Error **errp)
         pci_set_long((uint8_t *)&cfg_mask->cap.offset, ~0x0);
         pci_set_long((uint8_t *)&cfg_mask->cap.length, ~0x0);
         pci_set_long(cfg_mask->pci_cfg_data, ~0x0);
+    } else {
+        /* The packed layout needs a virtio 1 driver */
+        virtio_clear_feature(&vdev->host_features, VIRTIO_F_RING_PACKED);
     }
 
     if (proxy->nvectors &&
@@ -2065,6 +2068,49 @@ static const TypeInfo virtio_rng_pci_info = {
     .class_init    = virtio_rng_pci_class_init,
 };
 
+/* virtio-ring-bench-pci */
+
+static void virtio_ring_bench_pci_realize(VirtIOPCIProxy *vpci_dev,
+                                          Error **errp)
+{
+    VirtIORingBenchPCI *dev = VIRTIO_RING_BENCH_PCI(vpci_dev);
+    DeviceState *vdev = DEVICE(&dev->vdev);
+
+    qdev_set_parent_bus(vdev, BUS(&vpci_dev->bus));
+    object_property_set_bool(OBJECT(vdev), true, "realized", errp);
+}
+
+static void virtio_ring_bench_pci_class_init(ObjectClass *klass, void *data)
+{
+    DeviceClass *dc = DEVICE_CLASS(klass);
+    VirtioPCIClass *k = VIRTIO_PCI_CLASS(klass);
+    PCIDeviceClass *pcidev_k = PCI_DEVICE_CLASS(klass);
+
+    k->realize = virtio_ring_bench_pci_realize;
+    set_bit(DEVICE_CATEGORY_MISC, dc->categories);
+
+    pcidev_k->vendor_id = PCI_VENDOR_ID_REDHAT_QUMRANET;
+    pcidev_k->device_id = PCI_DEVICE_ID_VIRTIO_RING_BENCH;
+    pcidev_k->revision = VIRTIO_PCI_ABI_VERSION;
+    pcidev_k->class_id = PCI_CLASS_OTHERS;
+}
+
+static void virtio_ring_bench_pci_instance_init(Object *obj)
+{
+    VirtIORingBenchPCI *dev = VIRTIO_RING_BENCH_PCI(obj);
+
+    virtio_instance_init_common(obj, &dev->vdev, sizeof(dev->vdev),
+                                TYPE_VIRTIO_RING_BENCH);
+}
+
+static const TypeInfo virtio_ring_bench_pci_info = {
+    .name          = TYPE_VIRTIO_RING_BENCH_PCI,
+    .parent        = TYPE_VIRTIO_PCI,
+    .instance_size = sizeof(VirtIORingBenchPCI),
+    .instance_init = virtio_ring_bench_pci_instance_init,
+    .class_init    = virtio_ring_bench_pci_class_init,
+};
+
 /* virtio-input-pci */
 
 static Property virtio_input_pci_properties[] = {
@@ -2230,6 +2276,7 @@ static const TypeInfo virtio_pci_bus_info = {
 static void virtio_pci_register_types(void)
 {
     type_register_static(&virtio_rng_pci_info);
+    type_register_static(&virtio_ring_bench_pci_info);
     type_register_static(&virtio_input_pci_info);
     type_register_static(&virtio_input_hid_pci_info);
     type_register_static(&virtio_keyboard_pci_info);
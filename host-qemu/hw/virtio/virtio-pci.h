@@ -26,6 +26,7 @@
 #include "hw/virtio/virtio-9p.h"
 #include "hw/virtio/virtio-input.h"
 #include "hw/virtio/virtio-gpu.h"
+#include "hw/virtio/virtio-ring-bench.h"
 #ifdef CONFIG_VIRTFS
 #include "hw/9pfs/virtio-9p.h"
 #endif
@@ -41,6 +42,7 @@ typedef struct VirtIOSerialPCI VirtIOSerialPCI;
 typedef struct VirtIONetPCI VirtIONetPCI;
 typedef struct VHostSCSIPCI VHostSCSIPCI;
 typedef struct VirtIORngPCI VirtIORngPCI;
+typedef struct VirtIORingBenchPCI VirtIORingBenchPCI;
 typedef struct VirtIOInputPCI VirtIOInputPCI;
 typedef struct VirtIOInputHIDPCI VirtIOInputHIDPCI;
 typedef struct VirtIOInputHostPCI VirtIOInputHostPCI;
@@ -243,6 +245,18 @@ struct VirtIORngPCI {
     VirtIORNG vdev;
 };
 
+/*
+ * virtio-ring-bench-pci: This extends VirtioPCIProxy.
+ */
+#define TYPE_VIRTIO_RING_BENCH_PCI "virtio-ring-bench-pci"
+#define VIRTIO_RING_BENCH_PCI(obj) \
+        OBJECT_CHECK(VirtIORingBenchPCI, (obj), TYPE_VIRTIO_RING_BENCH_PCI)
+
+struct VirtIORingBenchPCI {
+    VirtIOPCIProxy parent_obj;
+    VirtIORingBench vdev;
+};
+
 /*
  * virtio-input-pci: This extends VirtioPCIProxy.
  */
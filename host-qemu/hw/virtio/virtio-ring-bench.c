@@ -0,0 +1,173 @@
+/*
+ * Virtio ring benchmark device
+ *
+ * A synthetic device that measures the cost of the virtqueue code itself.
+ * When the driver kicks its only queue, the device pops the available
+ * buffers, pushes them back to the used ring without touching them and
+ * then, playing the driver, makes the same buffers available again, until
+ * it has done "iterations" pop/push cycles.  It then interrupts the driver,
+ * which can read the number of cycles and the time they took from the
+ * configuration space.
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or
+ * (at your option) any later version.  See the COPYING file in the
+ * top-level directory.
+ */
+
+#include "qemu/timer.h"
+#include "qemu/atomic.h"
+#include "hw/qdev.h"
+#include "hw/virtio/virtio.h"
+#include "hw/virtio/virtio-access.h"
+#include "hw/virtio/virtio-ring-bench.h"
+
+/* Layout of the avail ring */
+#define VRING_AVAIL_IDX     2
+#define VRING_AVAIL_RING    4
+
+static void virtio_ring_bench_run(VirtIORingBench *s)
+{
+    VirtIODevice *vdev = VIRTIO_DEVICE(s);
+    VirtQueue *vq = s->vq;
+    hwaddr avail = virtio_queue_get_avail_addr(vdev, 0);
+    unsigned int num = virtio_queue_get_num(vdev, 0);
+    unsigned int i, n;
+    uint64_t cycles = 0;
+    uint16_t avail_idx;
+    int64_t start;
+
+    avail_idx = virtio_lduw_phys(vdev, avail + VRING_AVAIL_IDX);
+    start = get_clock();
+    while (cycles < s->iterations) {
+        if (s->batch) {
+            n = MIN(s->batch, s->iterations - cycles);
+            n = virtqueue_pop_batch(vq, s->elems, n);
+        } else {
+            n = virtqueue_pop(vq, s->elems[0]) ? 1 : 0;
+        }
+        if (!n) {
+            /* the driver did not make any buffer available */
+            break;
+        }
+
+        for (i = 0; i < n; i++) {
+            virtqueue_fill(vq, s->elems[i], 0, i);
+        }
+        virtqueue_flush(vq, n);
+
+        for (i = 0; i < n; i++) {
+            virtio_stw_phys(vdev, avail + VRING_AVAIL_RING +
+                                  (avail_idx++ % num) * sizeof(uint16_t),
+                            s->elems[i]->index);
+        }
+        smp_wmb();
+        virtio_stw_phys(vdev, avail + VRING_AVAIL_IDX, avail_idx);
+        cycles += n;
+    }
+    s->elapsed_ns = get_clock() - start;
+    s->cycles = cycles;
+    virtio_notify(vdev, vq);
+}
+
+static void virtio_ring_bench_handle_output(VirtIODevice *vdev, VirtQueue *vq)
+{
+    virtio_ring_bench_run(VIRTIO_RING_BENCH(vdev));
+}
+
+static void virtio_ring_bench_get_config(VirtIODevice *vdev, uint8_t *data)
+{
+    VirtIORingBench *s = VIRTIO_RING_BENCH(vdev);
+    struct virtio_ring_bench_config config;
+
+    virtio_stq_p(vdev, &config.cycles, s->cycles);
+    virtio_stq_p(vdev, &config.elapsed_ns, s->elapsed_ns);
+    memcpy(data, &config, sizeof(config));
+}
+
+static uint64_t virtio_ring_bench_get_features(VirtIODevice *vdev,
+                                               uint64_t features,
+                                               Error **errp)
+{
+    /* The device re-posts buffers through the split avail ring */
+    virtio_clear_feature(&features, VIRTIO_F_RING_PACKED);
+    return features;
+}
+
+static void virtio_ring_bench_reset(VirtIODevice *vdev)
+{
+    VirtIORingBench *s = VIRTIO_RING_BENCH(vdev);
+
+    s->cycles = 0;
+    s->elapsed_ns = 0;
+}
+
+static void virtio_ring_bench_device_realize(DeviceState *dev, Error **errp)
+{
+    VirtIODevice *vdev = VIRTIO_DEVICE(dev);
+    VirtIORingBench *s = VIRTIO_RING_BENCH(dev);
+    unsigned int i, count;
+
+    if (s->batch > VIRTIO_RING_BENCH_QUEUE_SIZE) {
+        error_setg(errp, "'batch' must not be larger than %d",
+                   VIRTIO_RING_BENCH_QUEUE_SIZE);
+        return;
+    }
+
+    virtio_init(vdev, "virtio-ring-bench", VIRTIO_ID_RING_BENCH,
+                sizeof(struct virtio_ring_bench_config));
+    s->vq = virtio_add_queue(vdev, VIRTIO_RING_BENCH_QUEUE_SIZE,
+                             virtio_ring_bench_handle_output);
+
+    count = MAX(s->batch, 1);
+    s->elems = g_new(VirtQueueElement *, count);
+    for (i = 0; i < count; i++) {
+        s->elems[i] = g_new(VirtQueueElement, 1);
+    }
+}
+
+static void virtio_ring_bench_device_unrealize(DeviceState *dev, Error **errp)
+{
+    VirtIODevice *vdev = VIRTIO_DEVICE(dev);
+    VirtIORingBench *s = VIRTIO_RING_BENCH(dev);
+    unsigned int i;
+
+    for (i = 0; i < MAX(s->batch, 1); i++) {
+        g_free(s->elems[i]);
+    }
+    g_free(s->elems);
+    virtio_cleanup(vdev);
+}
+
+static Property virtio_ring_bench_properties[] = {
+    DEFINE_PROP_UINT32("iterations", VirtIORingBench, iterations, 1000000),
+    DEFINE_PROP_UINT32("batch", VirtIORingBench, batch, 0),
+    DEFINE_PROP_END_OF_LIST(),
+};
+
+static void virtio_ring_bench_class_init(ObjectClass *klass, void *data)
+{
+    DeviceClass *dc = DEVICE_CLASS(klass);
+    VirtioDeviceClass *vdc = VIRTIO_DEVICE_CLASS(klass);
+
+    dc->props = virtio_ring_bench_properties;
+    set_bit(DEVICE_CATEGORY_MISC, dc->categories);
+    vdc->realize = virtio_ring_bench_device_realize;
+    vdc->unrealize = virtio_ring_bench_device_unrealize;
+    vdc->get_config = virtio_ring_bench_get_config;
+    vdc->get_features = virtio_ring_bench_get_features;
+    vdc->reset = virtio_ring_bench_reset;
+}
+
+static const TypeInfo virtio_ring_bench_info = {
+    .name = TYPE_VIRTIO_RING_BENCH,
+    .parent = TYPE_VIRTIO_DEVICE,
+    .instance_size = sizeof(VirtIORingBench),
+    .class_init = virtio_ring_bench_class_init,
+};
+
+static void virtio_ring_bench_register_types(void)
+{
+    type_register_static(&virtio_ring_bench_info);
+}
+
+type_init(virtio_ring_bench_register_types)
@@ -21,6 +21,7 @@
 #include "hw/virtio/virtio-bus.h"
 #include "migration/migration.h"
 #include "hw/virtio/virtio-access.h"
+#include "hw/xen/xen.h"
 
 /*
  * The alignment to use between consumer and producer parts of vring.
@@ -57,6 +58,28 @@ typedef struct VRingUsed
     VRingUsedElem ring[0];
 } VRingUsed;
 
+typedef struct VRingPackedDesc
+{
+    uint64_t addr;
+    uint32_t len;
+    uint16_t id;
+    uint16_t flags;
+} VRingPackedDesc;
+
+typedef struct VRingPackedDescEvent
+{
+    uint16_t off_wrap;
+    uint16_t flags;
+} VRingPackedDescEvent;
+
+/* A buffer filled but not flushed yet, in a packed ring */
+typedef struct VRingPackedUsed
+{
+    uint16_t id;
+    uint16_t ndescs;
+    uint32_t len;
+} VRingPackedUsed;
+
 typedef struct VRing
 {
     unsigned int num;
@@ -66,10 +89,30 @@ typedef struct VRing
     hwaddr used;
 } VRing;
 
+/* Host mapping of one ring, see virtqueue_map_rings() */
+typedef struct VRingMap
+{
+    MemoryRegion *mr;
+    hwaddr offset;
+    void *ptr;
+} VRingMap;
+
+/* With VIRTIO_F_RING_PACKED, vring.desc is the descriptor ring, vring.avail
+ * the driver event suppression structure and vring.used the device one.
+ * last_avail_idx and used_idx are then positions in the descriptor ring,
+ * each with its wrap counter.
+ */
 struct VirtQueue
 {
     VRing vring;
     uint16_t last_avail_idx;
+    bool last_avail_wrap_counter;
+
+    /* Packed ring: next descriptor to write a used buffer to */
+    uint16_t used_idx;
+    bool used_wrap_counter;
+    /* Packed ring: buffers filled since the last flush */
+    VRingPackedUsed *used_elems;
     /* Last used index value we have signalled on */
     uint16_t signalled_used;
 
@@ -79,6 +122,9 @@ struct VirtQueue
     /* Notification enabled? */
     bool notification;
 
+    /* Are desc_map, avail_map and used_map valid? */
+    bool rings_mapped;
+
     uint16_t queue_index;
 
     int inuse;
@@ -89,13 +135,148 @@ struct VirtQueue
     EventNotifier guest_notifier;
     EventNotifier host_notifier;
     QLIST_ENTRY(VirtQueue) node;
+
+    VRingMap desc_map;
+    VRingMap avail_map;
+    VRingMap used_map;
+    QLIST_ENTRY(VirtQueue) mapped_node;
 };
 
+/* Queues with mapped rings.  Any change to the guest memory map unmaps them
+ * all; each is mapped again the next time its rings are accessed.
+ */
+static QLIST_HEAD(, VirtQueue) mapped_queues =
+    QLIST_HEAD_INITIALIZER(mapped_queues);
+static bool virtio_memory_listener_registered;
+static bool virtio_memory_changed;
+
+static void vring_unmap_ring(VRingMap *map)
+{
+    if (map->mr) {
+        memory_region_unref(map->mr);
+    }
+    map->mr = NULL;
+    map->ptr = NULL;
+}
+
+static void virtqueue_unmap_rings(VirtQueue *vq)
+{
+    if (!vq->rings_mapped) {
+        return;
+    }
+    vring_unmap_ring(&vq->desc_map);
+    vring_unmap_ring(&vq->avail_map);
+    vring_unmap_ring(&vq->used_map);
+    QLIST_REMOVE(vq, mapped_node);
+    vq->rings_mapped = false;
+}
+
+static void virtio_memory_region_change(MemoryListener *listener,
+                                        MemoryRegionSection *section)
+{
+    virtio_memory_changed = true;
+}
+
+static void virtio_memory_commit(MemoryListener *listener)
+{
+    /* commit is called for every address space, region_add and region_del
+     * only for the guest memory one
+     */
+    if (!virtio_memory_changed) {
+        return;
+    }
+    virtio_memory_changed = false;
+    while (!QLIST_EMPTY(&mapped_queues)) {
+        virtqueue_unmap_rings(QLIST_FIRST(&mapped_queues));
+    }
+}
+
+static MemoryListener virtio_memory_listener = {
+    .region_add = virtio_memory_region_change,
+    .region_del = virtio_memory_region_change,
+    .commit = virtio_memory_commit,
+};
+
+static inline bool virtqueue_packed(VirtQueue *vq)
+{
+    return virtio_has_feature(vq->vdev, VIRTIO_F_RING_PACKED);
+}
+
+/* Rings that are not entirely inside one RAM region are left unmapped and
+ * accessed through the address space instead.
+ */
+static void vring_map_ring(VRingMap *map, hwaddr pa, hwaddr size,
+                           bool is_write)
+{
+    MemoryRegionSection section;
+
+    section = memory_region_find(get_system_memory(), pa, size);
+    if (!section.mr) {
+        return;
+    }
+    if (int128_get64(section.size) < size ||
+        !memory_region_is_ram(section.mr) ||
+        (is_write && section.readonly)) {
+        memory_region_unref(section.mr);
+        return;
+    }
+    map->mr = section.mr;
+    map->offset = section.offset_within_region;
+    map->ptr = memory_region_get_ram_ptr(section.mr) +
+               section.offset_within_region;
+}
+
+/* Look up the host addresses of the rings once instead of translating every
+ * guest physical address in the fast path.  The memory regions are
+ * referenced until the queue is reconfigured or the memory map changes.
+ */
+static void virtqueue_map_rings(VirtQueue *vq)
+{
+    unsigned int num = vq->vring.num;
+
+    if (!virtio_memory_listener_registered) {
+        memory_listener_register(&virtio_memory_listener,
+                                 &address_space_memory);
+        virtio_memory_listener_registered = true;
+    }
+
+    /* The Xen map cache may move RAM around, keep using the slow path */
+    if (vq->vring.desc && !xen_enabled() && virtqueue_packed(vq)) {
+        /* used buffers are written back to the descriptor ring */
+        vring_map_ring(&vq->desc_map, vq->vring.desc,
+                       num * sizeof(VRingPackedDesc), true);
+        vring_map_ring(&vq->avail_map, vq->vring.avail,
+                       sizeof(VRingPackedDescEvent), false);
+        vring_map_ring(&vq->used_map, vq->vring.used,
+                       sizeof(VRingPackedDescEvent), true);
+    } else if (vq->vring.desc && !xen_enabled()) {
+        vring_map_ring(&vq->desc_map, vq->vring.desc,
+                       num * sizeof(VRingDesc), false);
+        /* avail and used end with used_event and avail_event */
+        vring_map_ring(&vq->avail_map, vq->vring.avail,
+                       offsetof(VRingAvail, ring[num + 1]), false);
+        vring_map_ring(&vq->used_map, vq->vring.used,
+                       offsetof(VRingUsed, ring[num]) + sizeof(uint16_t),
+                       true);
+    }
+    QLIST_INSERT_HEAD(&mapped_queues, vq, mapped_node);
+    vq->rings_mapped = true;
+}
+
+static inline void *vring_ring_ptr(VirtQueue *vq, VRingMap *map)
+{
+    if (unlikely(!vq->rings_mapped)) {
+        virtqueue_map_rings(vq);
+    }
+    return map->ptr;
+}
+
 /* virt queue functions */
 void virtio_queue_update_rings(VirtIODevice *vdev, int n)
 {
     VRing *vring = &vdev->vq[n].vring;
 
+    virtqueue_unmap_rings(&vdev->vq[n]);
     if (!vring->desc) {
         /* not yet setup -> nothing to do */
         return;
@@ -106,56 +287,72 @@ void virtio_queue_update_rings(VirtIODevice *vdev, int n)
                               vring->align);
 }
 
-static inline uint64_t vring_desc_addr(VirtIODevice *vdev, hwaddr desc_pa,
-                                       int i)
+/* Read descriptor @i of a table, in host endianness.  The whole descriptor
+ * is copied at once so that the guest cannot change it under our feet.
+ */
+static void vring_desc_read(VirtIODevice *vdev, VRingDesc *desc,
+                            hwaddr desc_pa, const VRingDesc *desc_ptr,
+                            unsigned int i)
 {
-    hwaddr pa;
-    pa = desc_pa + sizeof(VRingDesc) * i + offsetof(VRingDesc, addr);
-    return virtio_ldq_phys(vdev, pa);
+    if (desc_ptr) {
+        memcpy(desc, desc_ptr + i, sizeof(*desc));
+    } else {
+        cpu_physical_memory_read(desc_pa + i * sizeof(*desc), desc,
+                                 sizeof(*desc));
+    }
+    virtio_tswap64s(vdev, &desc->addr);
+    virtio_tswap32s(vdev, &desc->len);
+    virtio_tswap16s(vdev, &desc->flags);
+    virtio_tswap16s(vdev, &desc->next);
 }
 
-static inline uint32_t vring_desc_len(VirtIODevice *vdev, hwaddr desc_pa, int i)
+/* Indirect tables are mapped for the duration of a single walk; NULL means
+ * the table is read through the address space.
+ */
+static const void *vring_map_indirect(hwaddr pa, hwaddr size)
 {
-    hwaddr pa;
-    pa = desc_pa + sizeof(VRingDesc) * i + offsetof(VRingDesc, len);
-    return virtio_ldl_phys(vdev, pa);
+    hwaddr len = size;
+    void *ptr;
+
+    ptr = cpu_physical_memory_map(pa, &len, 0);
+    if (ptr && len < size) {
+        cpu_physical_memory_unmap(ptr, len, 0, 0);
+        return NULL;
+    }
+    return ptr;
 }
 
-static inline uint16_t vring_desc_flags(VirtIODevice *vdev, hwaddr desc_pa,
-                                        int i)
+static void vring_unmap_indirect(const void *desc_ptr, hwaddr size)
 {
-    hwaddr pa;
-    pa = desc_pa + sizeof(VRingDesc) * i + offsetof(VRingDesc, flags);
-    return virtio_lduw_phys(vdev, pa);
+    if (desc_ptr) {
+        cpu_physical_memory_unmap((void *)desc_ptr, size, 0, 0);
+    }
 }
 
-static inline uint16_t vring_desc_next(VirtIODevice *vdev, hwaddr desc_pa,
-                                       int i)
+/* Load a 16-bit field of the avail ring at @offset */
+static inline uint16_t vring_avail_lduw(VirtQueue *vq, hwaddr offset)
 {
-    hwaddr pa;
-    pa = desc_pa + sizeof(VRingDesc) * i + offsetof(VRingDesc, next);
-    return virtio_lduw_phys(vdev, pa);
+    uint8_t *avail = vring_ring_ptr(vq, &vq->avail_map);
+
+    if (avail) {
+        return virtio_lduw_p(vq->vdev, avail + offset);
+    }
+    return virtio_lduw_phys(vq->vdev, vq->vring.avail + offset);
 }
 
 static inline uint16_t vring_avail_flags(VirtQueue *vq)
 {
-    hwaddr pa;
-    pa = vq->vring.avail + offsetof(VRingAvail, flags);
-    return virtio_lduw_phys(vq->vdev, pa);
+    return vring_avail_lduw(vq, offsetof(VRingAvail, flags));
 }
 
 static inline uint16_t vring_avail_idx(VirtQueue *vq)
 {
-    hwaddr pa;
-    pa = vq->vring.avail + offsetof(VRingAvail, idx);
-    return virtio_lduw_phys(vq->vdev, pa);
+    return vring_avail_lduw(vq, offsetof(VRingAvail, idx));
 }
 
 static inline uint16_t vring_avail_ring(VirtQueue *vq, int i)
 {
-    hwaddr pa;
-    pa = vq->vring.avail + offsetof(VRingAvail, ring[i]);
-    return virtio_lduw_phys(vq->vdev, pa);
+    return vring_avail_lduw(vq, offsetof(VRingAvail, ring[i]));
 }
 
 static inline uint16_t vring_get_used_event(VirtQueue *vq)
@@ -163,64 +360,250 @@ static inline uint16_t vring_get_used_event(VirtQueue *vq)
     return vring_avail_ring(vq, vq->vring.num);
 }
 
-static inline void vring_used_ring_id(VirtQueue *vq, int i, uint32_t val)
+static inline void vring_used_write(VirtQueue *vq, int i, uint32_t id,
+                                    uint32_t len)
 {
-    hwaddr pa;
-    pa = vq->vring.used + offsetof(VRingUsed, ring[i].id);
-    virtio_stl_phys(vq->vdev, pa, val);
-}
+    VRingUsed *used = vring_ring_ptr(vq, &vq->used_map);
+    VRingUsedElem uelem;
+    hwaddr offset = offsetof(VRingUsed, ring[i]);
 
-static inline void vring_used_ring_len(VirtQueue *vq, int i, uint32_t val)
-{
-    hwaddr pa;
-    pa = vq->vring.used + offsetof(VRingUsed, ring[i].len);
-    virtio_stl_phys(vq->vdev, pa, val);
+    if (used) {
+        virtio_stl_p(vq->vdev, &used->ring[i].id, id);
+        virtio_stl_p(vq->vdev, &used->ring[i].len, len);
+        memory_region_invalidate_and_set_dirty(vq->used_map.mr,
+                                               vq->used_map.offset + offset,
+                                               sizeof(uelem));
+        return;
+    }
+    uelem.id = virtio_tswap32(vq->vdev, id);
+    uelem.len = virtio_tswap32(vq->vdev, len);
+    cpu_physical_memory_write(vq->vring.used + offset, &uelem, sizeof(uelem));
 }
 
 static uint16_t vring_used_idx(VirtQueue *vq)
 {
+    VRingUsed *used = vring_ring_ptr(vq, &vq->used_map);
     hwaddr pa;
+
+    if (used) {
+        return virtio_lduw_p(vq->vdev, &used->idx);
+    }
     pa = vq->vring.used + offsetof(VRingUsed, idx);
     return virtio_lduw_phys(vq->vdev, pa);
 }
 
+/* Store a 16-bit field of the used ring at @offset */
+static inline void vring_used_stw(VirtQueue *vq, hwaddr offset, uint16_t val)
+{
+    uint8_t *used = vring_ring_ptr(vq, &vq->used_map);
+
+    if (used) {
+        virtio_stw_p(vq->vdev, used + offset, val);
+        memory_region_invalidate_and_set_dirty(vq->used_map.mr,
+                                               vq->used_map.offset + offset,
+                                               sizeof(val));
+        return;
+    }
+    virtio_stw_phys(vq->vdev, vq->vring.used + offset, val);
+}
+
 static inline void vring_used_idx_set(VirtQueue *vq, uint16_t val)
 {
-    hwaddr pa;
-    pa = vq->vring.used + offsetof(VRingUsed, idx);
-    virtio_stw_phys(vq->vdev, pa, val);
+    vring_used_stw(vq, offsetof(VRingUsed, idx), val);
 }
 
-static inline void vring_used_flags_set_bit(VirtQueue *vq, int mask)
+static inline uint16_t vring_used_flags(VirtQueue *vq)
 {
-    VirtIODevice *vdev = vq->vdev;
+    VRingUsed *used = vring_ring_ptr(vq, &vq->used_map);
     hwaddr pa;
+
+    if (used) {
+        return virtio_lduw_p(vq->vdev, &used->flags);
+    }
     pa = vq->vring.used + offsetof(VRingUsed, flags);
-    virtio_stw_phys(vdev, pa, virtio_lduw_phys(vdev, pa) | mask);
+    return virtio_lduw_phys(vq->vdev, pa);
+}
+
+static inline void vring_used_flags_set_bit(VirtQueue *vq, int mask)
+{
+    vring_used_stw(vq, offsetof(VRingUsed, flags),
+                   vring_used_flags(vq) | mask);
 }
 
 static inline void vring_used_flags_unset_bit(VirtQueue *vq, int mask)
 {
-    VirtIODevice *vdev = vq->vdev;
-    hwaddr pa;
-    pa = vq->vring.used + offsetof(VRingUsed, flags);
-    virtio_stw_phys(vdev, pa, virtio_lduw_phys(vdev, pa) & ~mask);
+    vring_used_stw(vq, offsetof(VRingUsed, flags),
+                   vring_used_flags(vq) & ~mask);
 }
 
 static inline void vring_set_avail_event(VirtQueue *vq, uint16_t val)
 {
+    if (!vq->notification) {
+        return;
+    }
+    vring_used_stw(vq, offsetof(VRingUsed, ring[vq->vring.num]), val);
+}
+
+/* Packed ring accessors.  The driver event suppression structure takes the
+ * place of the avail ring and the device one that of the used ring, so they
+ * go through vring_avail_lduw() and vring_used_stw().
+ */
+
+static inline bool is_desc_avail(uint16_t flags, bool wrap_counter)
+{
+    bool avail = !!(flags & (1 << VRING_PACKED_DESC_F_AVAIL));
+    bool used = !!(flags & (1 << VRING_PACKED_DESC_F_USED));
+
+    return avail != used && avail == wrap_counter;
+}
+
+static uint16_t vring_packed_desc_flags(VirtQueue *vq, unsigned int i)
+{
+    VRingPackedDesc *desc = vring_ring_ptr(vq, &vq->desc_map);
     hwaddr pa;
+
+    if (desc) {
+        return virtio_lduw_p(vq->vdev, &desc[i].flags);
+    }
+    pa = vq->vring.desc + i * sizeof(VRingPackedDesc) +
+         offsetof(VRingPackedDesc, flags);
+    return virtio_lduw_phys(vq->vdev, pa);
+}
+
+/* Has the driver made descriptor @i available in its lap @wrap_counter?
+ * On success the rest of the descriptor can be read.
+ */
+static bool vring_packed_desc_avail(VirtQueue *vq, unsigned int i,
+                                    bool wrap_counter)
+{
+    if (!is_desc_avail(vring_packed_desc_flags(vq, i), wrap_counter)) {
+        return false;
+    }
+    /* Make sure the descriptor is read after its flags */
+    smp_rmb();
+    return true;
+}
+
+static void vring_packed_desc_read(VirtIODevice *vdev, VRingPackedDesc *desc,
+                                   hwaddr desc_pa,
+                                   const VRingPackedDesc *desc_ptr,
+                                   unsigned int i)
+{
+    if (desc_ptr) {
+        memcpy(desc, desc_ptr + i, sizeof(*desc));
+    } else {
+        cpu_physical_memory_read(desc_pa + i * sizeof(*desc), desc,
+                                 sizeof(*desc));
+    }
+    virtio_tswap64s(vdev, &desc->addr);
+    virtio_tswap32s(vdev, &desc->len);
+    virtio_tswap16s(vdev, &desc->id);
+    virtio_tswap16s(vdev, &desc->flags);
+}
+
+/* Write @used to the descriptor @offset entries after used_idx.  The flags
+ * hand the descriptor back to the driver; with @strict_order they are
+ * written after everything that was stored to the ring before.
+ */
+static void vring_packed_desc_write_used(VirtQueue *vq,
+                                         const VRingPackedUsed *used,
+                                         unsigned int offset,
+                                         bool strict_order)
+{
+    VRingPackedDesc *desc = vring_ring_ptr(vq, &vq->desc_map);
+    unsigned int i = vq->used_idx + offset;
+    bool wrap_counter = vq->used_wrap_counter;
+    uint16_t flags = 0;
+    hwaddr pa;
+
+    if (i >= vq->vring.num) {
+        i -= vq->vring.num;
+        wrap_counter ^= 1;
+    }
+    if (wrap_counter) {
+        flags = (1 << VRING_PACKED_DESC_F_AVAIL) |
+                (1 << VRING_PACKED_DESC_F_USED);
+    }
+
+    if (desc) {
+        virtio_stw_p(vq->vdev, &desc[i].id, used->id);
+        virtio_stl_p(vq->vdev, &desc[i].len, used->len);
+        if (strict_order) {
+            smp_wmb();
+        }
+        virtio_stw_p(vq->vdev, &desc[i].flags, flags);
+        memory_region_invalidate_and_set_dirty(vq->desc_map.mr,
+                                               vq->desc_map.offset +
+                                               i * sizeof(*desc),
+                                               sizeof(*desc));
+        return;
+    }
+    pa = vq->vring.desc + i * sizeof(VRingPackedDesc);
+    virtio_stw_phys(vq->vdev, pa + offsetof(VRingPackedDesc, id), used->id);
+    virtio_stl_phys(vq->vdev, pa + offsetof(VRingPackedDesc, len), used->len);
+    if (strict_order) {
+        smp_wmb();
+    }
+    virtio_stw_phys(vq->vdev, pa + offsetof(VRingPackedDesc, flags), flags);
+}
+
+static void vring_packed_driver_event(VirtQueue *vq, VRingPackedDescEvent *e)
+{
+    e->flags = vring_avail_lduw(vq, offsetof(VRingPackedDescEvent, flags));
+    /* Make sure off_wrap is read after flags */
+    smp_rmb();
+    e->off_wrap = vring_avail_lduw(vq,
+                                   offsetof(VRingPackedDescEvent, off_wrap));
+}
+
+/* Ask for a notification when the driver makes last_avail_idx available */
+static inline void vring_packed_set_avail_event(VirtQueue *vq)
+{
     if (!vq->notification) {
         return;
     }
-    pa = vq->vring.used + offsetof(VRingUsed, ring[vq->vring.num]);
-    virtio_stw_phys(vq->vdev, pa, val);
+    vring_used_stw(vq, offsetof(VRingPackedDescEvent, off_wrap),
+                   vq->last_avail_idx |
+                   vq->last_avail_wrap_counter <<
+                   VRING_PACKED_EVENT_F_WRAP_CTR);
+}
+
+static void virtio_queue_packed_set_notification(VirtQueue *vq, int enable)
+{
+    uint16_t flags;
+
+    if (!enable) {
+        flags = VRING_PACKED_EVENT_FLAG_DISABLE;
+    } else if (virtio_has_feature(vq->vdev, VIRTIO_RING_F_EVENT_IDX)) {
+        vring_packed_set_avail_event(vq);
+        /* Make sure off_wrap is written before flags */
+        smp_wmb();
+        flags = VRING_PACKED_EVENT_FLAG_DESC;
+    } else {
+        flags = VRING_PACKED_EVENT_FLAG_ENABLE;
+    }
+    vring_used_stw(vq, offsetof(VRingPackedDescEvent, flags), flags);
+}
+
+/* With VIRTIO_RING_F_EVENT_IDX, tell the driver how far we got */
+static void virtqueue_update_avail_event(VirtQueue *vq)
+{
+    if (!virtio_has_feature(vq->vdev, VIRTIO_RING_F_EVENT_IDX)) {
+        return;
+    }
+    if (virtqueue_packed(vq)) {
+        vring_packed_set_avail_event(vq);
+    } else {
+        vring_set_avail_event(vq, vq->last_avail_idx);
+    }
 }
 
 void virtio_queue_set_notification(VirtQueue *vq, int enable)
 {
     vq->notification = enable;
-    if (virtio_has_feature(vq->vdev, VIRTIO_RING_F_EVENT_IDX)) {
+    if (virtqueue_packed(vq)) {
+        virtio_queue_packed_set_notification(vq, enable);
+    } else if (virtio_has_feature(vq->vdev, VIRTIO_RING_F_EVENT_IDX)) {
         vring_set_avail_event(vq, vring_avail_idx(vq));
     } else if (enable) {
         vring_used_flags_unset_bit(vq, VRING_USED_F_NO_NOTIFY);
@@ -240,17 +623,19 @@ int virtio_queue_ready(VirtQueue *vq)
 
 int virtio_queue_empty(VirtQueue *vq)
 {
+    if (virtqueue_packed(vq)) {
+        return !is_desc_avail(vring_packed_desc_flags(vq, vq->last_avail_idx),
+                              vq->last_avail_wrap_counter);
+    }
     return vring_avail_idx(vq) == vq->last_avail_idx;
 }
 
-void virtqueue_fill(VirtQueue *vq, const VirtQueueElement *elem,
-                    unsigned int len, unsigned int idx)
+static void virtqueue_unmap_sg(VirtQueue *vq, const VirtQueueElement *elem,
+                               unsigned int len)
 {
     unsigned int offset;
     int i;
 
-    trace_virtqueue_fill(vq, elem, len, idx);
-
     offset = 0;
     for (i = 0; i < elem->in_num; i++) {
         size_t size = MIN(len - offset, elem->in_sg[i].iov_len);
@@ -266,17 +651,70 @@ void virtqueue_fill(VirtQueue *vq, const VirtQueueElement *elem,
         cpu_physical_memory_unmap(elem->out_sg[i].iov_base,
                                   elem->out_sg[i].iov_len,
                                   0, elem->out_sg[i].iov_len);
+}
+
+void virtqueue_fill(VirtQueue *vq, const VirtQueueElement *elem,
+                    unsigned int len, unsigned int idx)
+{
+    trace_virtqueue_fill(vq, elem, len, idx);
+
+    virtqueue_unmap_sg(vq, elem, len);
+
+    if (virtqueue_packed(vq)) {
+        /* Written to the ring by virtqueue_flush() */
+        if (!vq->used_elems) {
+            vq->used_elems = g_new(VRingPackedUsed, VIRTQUEUE_MAX_SIZE);
+        }
+        vq->used_elems[idx].id = elem->index;
+        vq->used_elems[idx].ndescs = elem->ndescs;
+        vq->used_elems[idx].len = len;
+        return;
+    }
 
     idx = (idx + vring_used_idx(vq)) % vq->vring.num;
 
     /* Get a pointer to the next entry in the used ring. */
-    vring_used_ring_id(vq, idx, elem->index);
-    vring_used_ring_len(vq, idx, len);
+    vring_used_write(vq, idx, elem->index, len);
+}
+
+static void virtqueue_packed_flush(VirtQueue *vq, unsigned int count)
+{
+    unsigned int i, ndescs;
+
+    if (!count) {
+        return;
+    }
+
+    /* Each buffer takes the place of as many descriptors as it was made of.
+     * The driver looks at the first one to find out whether anything was
+     * used, so it is written last.
+     */
+    ndescs = vq->used_elems[0].ndescs;
+    for (i = 1; i < count; i++) {
+        vring_packed_desc_write_used(vq, &vq->used_elems[i], ndescs, false);
+        ndescs += vq->used_elems[i].ndescs;
+    }
+    vring_packed_desc_write_used(vq, &vq->used_elems[0], 0, true);
+
+    vq->inuse -= ndescs;
+    vq->used_idx += ndescs;
+    if (vq->used_idx >= vq->vring.num) {
+        vq->used_idx -= vq->vring.num;
+        vq->used_wrap_counter ^= 1;
+        vq->signalled_used_valid = false;
+    }
 }
 
 void virtqueue_flush(VirtQueue *vq, unsigned int count)
 {
     uint16_t old, new;
+
+    if (virtqueue_packed(vq)) {
+        trace_virtqueue_flush(vq, count);
+        virtqueue_packed_flush(vq, count);
+        return;
+    }
+
     /* Make sure buffer is written before we update index. */
     smp_wmb();
     trace_virtqueue_flush(vq, count);
@@ -331,29 +769,155 @@ static unsigned int virtqueue_get_head(VirtQueue *vq, unsigned int idx)
     return head;
 }
 
-static unsigned virtqueue_next_desc(VirtIODevice *vdev, hwaddr desc_pa,
-                                    unsigned int i, unsigned int max)
+/* Advance @desc to the next descriptor in the chain, returning its index or
+ * @max if @desc was the last one.
+ */
+static unsigned virtqueue_read_next_desc(VirtIODevice *vdev, VRingDesc *desc,
+                                         hwaddr desc_pa,
+                                         const VRingDesc *desc_ptr,
+                                         unsigned int max)
 {
     unsigned int next;
 
     /* If this descriptor says it doesn't chain, we're done. */
-    if (!(vring_desc_flags(vdev, desc_pa, i) & VRING_DESC_F_NEXT)) {
+    if (!(desc->flags & VRING_DESC_F_NEXT)) {
         return max;
     }
 
     /* Check they're not leading us off end of descriptors. */
-    next = vring_desc_next(vdev, desc_pa, i);
-    /* Make sure compiler knows to grab that: we don't want it changing! */
-    smp_wmb();
-
+    next = desc->next;
     if (next >= max) {
         error_report("Desc next is %u", next);
         exit(1);
     }
 
+    vring_desc_read(vdev, desc, desc_pa, desc_ptr, next);
     return next;
 }
 
+/* Iterator over the descriptors of one buffer in a packed ring.  desc is
+ * the current descriptor, ndescs the number of ring entries taken by the
+ * buffer and id its buffer ID.
+ */
+typedef struct VRingPackedWalk
+{
+    VirtIODevice *vdev;
+    const VRingPackedDesc *desc_ptr;
+    hwaddr desc_pa;
+    hwaddr indirect_len;
+    unsigned int i;
+    unsigned int max;
+    unsigned int count;
+    unsigned int ndescs;
+    uint16_t id;
+    VRingPackedDesc desc;
+} VRingPackedWalk;
+
+/* Start at the buffer at @idx, which must be available */
+static void vring_packed_walk_start(VRingPackedWalk *w, VirtQueue *vq,
+                                    unsigned int idx)
+{
+    w->vdev = vq->vdev;
+    w->desc_pa = vq->vring.desc;
+    w->desc_ptr = vring_ring_ptr(vq, &vq->desc_map);
+    w->indirect_len = 0;
+    w->i = idx;
+    w->max = vq->vring.num;
+    w->count = 1;
+    w->ndescs = 1;
+    vring_packed_desc_read(w->vdev, &w->desc, w->desc_pa, w->desc_ptr, idx);
+    w->id = w->desc.id;
+
+    if (w->desc.flags & VRING_DESC_F_INDIRECT) {
+        if (!w->desc.len || w->desc.len % sizeof(VRingPackedDesc)) {
+            error_report("Invalid size for indirect buffer table");
+            exit(1);
+        }
+
+        /* loop over the indirect descriptor table */
+        w->max = w->desc.len / sizeof(VRingPackedDesc);
+        w->desc_pa = w->desc.addr;
+        w->indirect_len = w->desc.len;
+        w->desc_ptr = vring_map_indirect(w->desc_pa, w->indirect_len);
+        w->i = 0;
+        vring_packed_desc_read(w->vdev, &w->desc, w->desc_pa, w->desc_ptr, 0);
+    }
+}
+
+/* Move to the next descriptor of the buffer, false if there is none */
+static bool vring_packed_walk_next(VRingPackedWalk *w)
+{
+    if (w->indirect_len) {
+        /* The whole table makes up the buffer */
+        if (++w->i == w->max) {
+            return false;
+        }
+    } else {
+        if (!(w->desc.flags & VRING_DESC_F_NEXT)) {
+            return false;
+        }
+        if (++w->i == w->max) {
+            w->i = 0;
+        }
+        w->ndescs++;
+    }
+
+    /* If we've got too many, that implies a descriptor loop. */
+    if (++w->count > w->max) {
+        error_report("Looped descriptor");
+        exit(1);
+    }
+
+    vring_packed_desc_read(w->vdev, &w->desc, w->desc_pa, w->desc_ptr, w->i);
+    if (!w->indirect_len) {
+        /* The buffer ID of a chain is in its last descriptor */
+        w->id = w->desc.id;
+    }
+    return true;
+}
+
+static void vring_packed_walk_end(VRingPackedWalk *w)
+{
+    if (w->indirect_len) {
+        vring_unmap_indirect(w->desc_ptr, w->indirect_len);
+    }
+}
+
+static void virtqueue_packed_get_avail_bytes(VirtQueue *vq,
+                                             unsigned int *in_total,
+                                             unsigned int *out_total,
+                                             unsigned max_in_bytes,
+                                             unsigned max_out_bytes)
+{
+    unsigned int idx = vq->last_avail_idx, total_bufs = 0;
+    bool wrap_counter = vq->last_avail_wrap_counter;
+    VRingPackedWalk w;
+
+    while (total_bufs < vq->vring.num &&
+           vring_packed_desc_avail(vq, idx, wrap_counter)) {
+        vring_packed_walk_start(&w, vq, idx);
+        do {
+            if (w.desc.flags & VRING_DESC_F_WRITE) {
+                *in_total += w.desc.len;
+            } else {
+                *out_total += w.desc.len;
+            }
+            if (*in_total >= max_in_bytes && *out_total >= max_out_bytes) {
+                vring_packed_walk_end(&w);
+                return;
+            }
+        } while (vring_packed_walk_next(&w));
+        vring_packed_walk_end(&w);
+
+        total_bufs += w.ndescs;
+        idx += w.ndescs;
+        if (idx >= vq->vring.num) {
+            idx -= vq->vring.num;
+            wrap_counter ^= 1;
+        }
+    }
+}
+
 void virtqueue_get_avail_bytes(VirtQueue *vq, unsigned int *in_bytes,
                                unsigned int *out_bytes,
                                unsigned max_in_bytes, unsigned max_out_bytes)
@@ -364,19 +928,28 @@ void virtqueue_get_avail_bytes(VirtQueue *vq, unsigned int *in_bytes,
     idx = vq->last_avail_idx;
 
     total_bufs = in_total = out_total = 0;
+    if (virtqueue_packed(vq)) {
+        virtqueue_packed_get_avail_bytes(vq, &in_total, &out_total,
+                                         max_in_bytes, max_out_bytes);
+        goto done;
+    }
     while (virtqueue_num_heads(vq, idx)) {
         VirtIODevice *vdev = vq->vdev;
         unsigned int max, num_bufs, indirect = 0;
-        hwaddr desc_pa;
+        const VRingDesc *desc_ptr, *indirect_ptr = NULL;
+        hwaddr desc_pa, indirect_len = 0;
+        VRingDesc desc;
         int i;
 
         max = vq->vring.num;
         num_bufs = total_bufs;
         i = virtqueue_get_head(vq, idx++);
         desc_pa = vq->vring.desc;
+        desc_ptr = vring_ring_ptr(vq, &vq->desc_map);
+        vring_desc_read(vdev, &desc, desc_pa, desc_ptr, i);
 
-        if (vring_desc_flags(vdev, desc_pa, i) & VRING_DESC_F_INDIRECT) {
-            if (vring_desc_len(vdev, desc_pa, i) % sizeof(VRingDesc)) {
+        if (desc.flags & VRING_DESC_F_INDIRECT) {
+            if (desc.len % sizeof(VRingDesc)) {
                 error_report("Invalid size for indirect buffer table");
                 exit(1);
             }
@@ -389,9 +962,13 @@ void virtqueue_get_avail_bytes(VirtQueue *vq, unsigned int *in_bytes,
 
             /* loop over the indirect descriptor table */
             indirect = 1;
-            max = vring_desc_len(vdev, desc_pa, i) / sizeof(VRingDesc);
-            desc_pa = vring_desc_addr(vdev, desc_pa, i);
+            max = desc.len / sizeof(VRingDesc);
+            desc_pa = desc.addr;
+            indirect_len = desc.len;
+            desc_ptr = indirect_ptr = vring_map_indirect(desc_pa,
+                                                         indirect_len);
             num_bufs = i = 0;
+            vring_desc_read(vdev, &desc, desc_pa, desc_ptr, i);
         }
 
         do {
@@ -401,15 +978,19 @@ void virtqueue_get_avail_bytes(VirtQueue *vq, unsigned int *in_bytes,
                 exit(1);
             }
 
-            if (vring_desc_flags(vdev, desc_pa, i) & VRING_DESC_F_WRITE) {
-                in_total += vring_desc_len(vdev, desc_pa, i);
+            if (desc.flags & VRING_DESC_F_WRITE) {
+                in_total += desc.len;
             } else {
-                out_total += vring_desc_len(vdev, desc_pa, i);
+                out_total += desc.len;
             }
             if (in_total >= max_in_bytes && out_total >= max_out_bytes) {
+                vring_unmap_indirect(indirect_ptr, indirect_len);
                 goto done;
             }
-        } while ((i = virtqueue_next_desc(vdev, desc_pa, i, max)) != max);
+        } while ((i = virtqueue_read_next_desc(vdev, &desc, desc_pa, desc_ptr,
+                                               max)) != max);
+
+        vring_unmap_indirect(indirect_ptr, indirect_len);
 
         if (!indirect)
             total_bufs = num_bufs;
@@ -457,65 +1038,76 @@ void virtqueue_map_sg(struct iovec *sg, hwaddr *addr,
     }
 }
 
-int virtqueue_pop(VirtQueue *vq, VirtQueueElement *elem)
+/* Append the buffer of one descriptor to @elem */
+static void virtqueue_elem_add_sg(VirtQueueElement *elem, hwaddr addr,
+                                  uint32_t len, bool is_write)
 {
-    unsigned int i, head, max;
-    hwaddr desc_pa = vq->vring.desc;
-    VirtIODevice *vdev = vq->vdev;
+    struct iovec *sg;
 
-    if (!virtqueue_num_heads(vq, vq->last_avail_idx))
-        return 0;
+    if (is_write) {
+        if (elem->in_num >= ARRAY_SIZE(elem->in_sg)) {
+            error_report("Too many write descriptors in indirect table");
+            exit(1);
+        }
+        elem->in_addr[elem->in_num] = addr;
+        sg = &elem->in_sg[elem->in_num++];
+    } else {
+        if (elem->out_num >= ARRAY_SIZE(elem->out_sg)) {
+            error_report("Too many read descriptors in indirect table");
+            exit(1);
+        }
+        elem->out_addr[elem->out_num] = addr;
+        sg = &elem->out_sg[elem->out_num++];
+    }
+
+    sg->iov_len = len;
+}
+
+/* Collect and map the descriptor chain starting at @head into @elem */
+static void virtqueue_read_elem(VirtQueue *vq, VirtQueueElement *elem,
+                                unsigned int head)
+{
+    VirtIODevice *vdev = vq->vdev;
+    const VRingDesc *desc_ptr, *indirect_ptr = NULL;
+    hwaddr desc_pa = vq->vring.desc, indirect_len = 0;
+    unsigned int i = head, max = vq->vring.num;
+    VRingDesc desc;
 
     /* When we start there are none of either input nor output. */
     elem->out_num = elem->in_num = 0;
 
-    max = vq->vring.num;
+    desc_ptr = vring_ring_ptr(vq, &vq->desc_map);
+    vring_desc_read(vdev, &desc, desc_pa, desc_ptr, i);
 
-    i = head = virtqueue_get_head(vq, vq->last_avail_idx++);
-    if (virtio_has_feature(vdev, VIRTIO_RING_F_EVENT_IDX)) {
-        vring_set_avail_event(vq, vq->last_avail_idx);
-    }
-
-    if (vring_desc_flags(vdev, desc_pa, i) & VRING_DESC_F_INDIRECT) {
-        if (vring_desc_len(vdev, desc_pa, i) % sizeof(VRingDesc)) {
+    if (desc.flags & VRING_DESC_F_INDIRECT) {
+        if (desc.len % sizeof(VRingDesc)) {
             error_report("Invalid size for indirect buffer table");
             exit(1);
         }
 
         /* loop over the indirect descriptor table */
-        max = vring_desc_len(vdev, desc_pa, i) / sizeof(VRingDesc);
-        desc_pa = vring_desc_addr(vdev, desc_pa, i);
+        max = desc.len / sizeof(VRingDesc);
+        desc_pa = desc.addr;
+        indirect_len = desc.len;
+        desc_ptr = indirect_ptr = vring_map_indirect(desc_pa, indirect_len);
         i = 0;
+        vring_desc_read(vdev, &desc, desc_pa, desc_ptr, i);
     }
 
     /* Collect all the descriptors */
     do {
-        struct iovec *sg;
-
-        if (vring_desc_flags(vdev, desc_pa, i) & VRING_DESC_F_WRITE) {
-            if (elem->in_num >= ARRAY_SIZE(elem->in_sg)) {
-                error_report("Too many write descriptors in indirect table");
-                exit(1);
-            }
-            elem->in_addr[elem->in_num] = vring_desc_addr(vdev, desc_pa, i);
-            sg = &elem->in_sg[elem->in_num++];
-        } else {
-            if (elem->out_num >= ARRAY_SIZE(elem->out_sg)) {
-                error_report("Too many read descriptors in indirect table");
-                exit(1);
-            }
-            elem->out_addr[elem->out_num] = vring_desc_addr(vdev, desc_pa, i);
-            sg = &elem->out_sg[elem->out_num++];
-        }
-
-        sg->iov_len = vring_desc_len(vdev, desc_pa, i);
+        virtqueue_elem_add_sg(elem, desc.addr, desc.len,
+                              desc.flags & VRING_DESC_F_WRITE);
 
         /* If we've got too many, that implies a descriptor loop. */
         if ((elem->in_num + elem->out_num) > max) {
             error_report("Looped descriptor");
             exit(1);
         }
-    } while ((i = virtqueue_next_desc(vdev, desc_pa, i, max)) != max);
+    } while ((i = virtqueue_read_next_desc(vdev, &desc, desc_pa, desc_ptr,
+                                           max)) != max);
+
+    vring_unmap_indirect(indirect_ptr, indirect_len);
 
     /* Now map what we have collected */
     
@@ -523,13 +1115,147 @@ int virtqueue_pop(VirtQueue *vq, VirtQueueElement *elem)
     virtqueue_map_sg(elem->out_sg, elem->out_addr, elem->out_num, 0);
 
     elem->index = head;
+    elem->ndescs = 1;
 
     vq->inuse++;
 
     trace_virtqueue_pop(vq, elem, elem->in_num, elem->out_num);
+}
+
+/* Collect and map the next available buffer of a packed ring into @elem */
+static bool virtqueue_packed_read_elem(VirtQueue *vq, VirtQueueElement *elem)
+{
+    VRingPackedWalk w;
+
+    if (!vring_packed_desc_avail(vq, vq->last_avail_idx,
+                                 vq->last_avail_wrap_counter)) {
+        return false;
+    }
+
+    elem->out_num = elem->in_num = 0;
+
+    vring_packed_walk_start(&w, vq, vq->last_avail_idx);
+    do {
+        virtqueue_elem_add_sg(elem, w.desc.addr, w.desc.len,
+                              w.desc.flags & VRING_DESC_F_WRITE);
+    } while (vring_packed_walk_next(&w));
+    vring_packed_walk_end(&w);
+
+    virtqueue_map_sg(elem->in_sg, elem->in_addr, elem->in_num, 1);
+    virtqueue_map_sg(elem->out_sg, elem->out_addr, elem->out_num, 0);
+
+    elem->index = w.id;
+    elem->ndescs = w.ndescs;
+
+    vq->last_avail_idx += w.ndescs;
+    if (vq->last_avail_idx >= vq->vring.num) {
+        vq->last_avail_idx -= vq->vring.num;
+        vq->last_avail_wrap_counter ^= 1;
+    }
+    vq->inuse += w.ndescs;
+
+    trace_virtqueue_pop(vq, elem, elem->in_num, elem->out_num);
+    return true;
+}
+
+/* Number of buffers available in a packed ring */
+static unsigned int virtqueue_packed_num_heads(VirtQueue *vq)
+{
+    unsigned int i = vq->last_avail_idx, ndescs, num_heads = 0;
+    bool wrap_counter = vq->last_avail_wrap_counter;
+    uint16_t flags;
+
+    for (ndescs = 0; ndescs < vq->vring.num; ndescs++) {
+        flags = vring_packed_desc_flags(vq, i);
+        if (!is_desc_avail(flags, wrap_counter)) {
+            break;
+        }
+        if (!(flags & VRING_DESC_F_NEXT)) {
+            num_heads++;
+        }
+        if (++i == vq->vring.num) {
+            i = 0;
+            wrap_counter ^= 1;
+        }
+    }
+    return num_heads;
+}
+
+int virtqueue_pop(VirtQueue *vq, VirtQueueElement *elem)
+{
+    unsigned int head;
+
+    if (virtqueue_packed(vq)) {
+        if (!virtqueue_packed_read_elem(vq, elem)) {
+            return 0;
+        }
+        virtqueue_update_avail_event(vq);
+        return elem->in_num + elem->out_num;
+    }
+
+    if (!virtqueue_num_heads(vq, vq->last_avail_idx))
+        return 0;
+
+    head = virtqueue_get_head(vq, vq->last_avail_idx++);
+    virtqueue_update_avail_event(vq);
+
+    virtqueue_read_elem(vq, elem, head);
     return elem->in_num + elem->out_num;
 }
 
+unsigned int virtqueue_avail_heads(VirtQueue *vq)
+{
+    if (virtqueue_packed(vq)) {
+        return virtqueue_packed_num_heads(vq);
+    }
+    return virtqueue_num_heads(vq, vq->last_avail_idx);
+}
+
+unsigned int virtqueue_pop_batch(VirtQueue *vq, VirtQueueElement **elems,
+                                 unsigned int max)
+{
+    unsigned int i, n;
+
+    if (virtqueue_packed(vq)) {
+        for (n = 0; n < max; n++) {
+            if (!virtqueue_packed_read_elem(vq, elems[n])) {
+                break;
+            }
+        }
+    } else {
+        n = MIN(virtqueue_num_heads(vq, vq->last_avail_idx), max);
+        for (i = 0; i < n; i++) {
+            virtqueue_read_elem(vq, elems[i],
+                                virtqueue_get_head(vq, vq->last_avail_idx++));
+        }
+    }
+
+    /* One avail_event update for the whole batch */
+    if (n) {
+        virtqueue_update_avail_event(vq);
+    }
+
+    trace_virtqueue_pop_batch(vq, n);
+    return n;
+}
+
+void virtqueue_discard(VirtQueue *vq, const VirtQueueElement *elem,
+                       unsigned int len)
+{
+    virtqueue_unmap_sg(vq, elem, len);
+    if (virtqueue_packed(vq)) {
+        if (vq->last_avail_idx < elem->ndescs) {
+            vq->last_avail_idx += vq->vring.num;
+            vq->last_avail_wrap_counter ^= 1;
+        }
+        vq->last_avail_idx -= elem->ndescs;
+        vq->inuse -= elem->ndescs;
+        return;
+    }
+    vq->last_avail_idx--;
+    vq->inuse--;
+}
+
 /* virtio device */
 static void virtio_notify_vector(VirtIODevice *vdev, uint16_t vector)
 {
@@ -627,10 +1353,14 @@ void virtio_reset(void *opaque)
     virtio_notify_vector(vdev, vdev->config_vector);
 
     for(i = 0; i < VIRTIO_QUEUE_MAX; i++) {
+        virtqueue_unmap_rings(&vdev->vq[i]);
         vdev->vq[i].vring.desc = 0;
         vdev->vq[i].vring.avail = 0;
         vdev->vq[i].vring.used = 0;
         vdev->vq[i].last_avail_idx = 0;
+        vdev->vq[i].last_avail_wrap_counter = true;
+        vdev->vq[i].used_idx = 0;
+        vdev->vq[i].used_wrap_counter = true;
         virtio_queue_set_vector(vdev, i, VIRTIO_NO_VECTOR);
         vdev->vq[i].signalled_used = 0;
         vdev->vq[i].signalled_used_valid = false;
@@ -841,6 +1571,7 @@ hwaddr virtio_queue_get_addr(VirtIODevice *vdev, int n)
 void virtio_queue_set_rings(VirtIODevice *vdev, int n, hwaddr desc,
                             hwaddr avail, hwaddr used)
 {
+    virtqueue_unmap_rings(&vdev->vq[n]);
     vdev->vq[n].vring.desc = desc;
     vdev->vq[n].vring.avail = avail;
     vdev->vq[n].vring.used = used;
@@ -856,6 +1587,7 @@ void virtio_queue_set_num(VirtIODevice *vdev, int n, int num)
         num < 0) {
         return;
     }
+    virtqueue_unmap_rings(&vdev->vq[n]);
     vdev->vq[n].vring.num = num;
 }
 
@@ -968,6 +1700,8 @@ VirtQueue *virtio_add_queue(VirtIODevice *vdev, int queue_size,
     vdev->vq[i].vring.num = queue_size;
     vdev->vq[i].vring.align = VIRTIO_PCI_VRING_ALIGN;
     vdev->vq[i].handle_output = handle_output;
+    vdev->vq[i].last_avail_wrap_counter = true;
+    vdev->vq[i].used_wrap_counter = true;
 
     return &vdev->vq[i];
 }
@@ -978,6 +1712,9 @@ void virtio_del_queue(VirtIODevice *vdev, int n)
         abort();
     }
 
+    virtqueue_unmap_rings(&vdev->vq[n]);
+    g_free(vdev->vq[n].used_elems);
+    vdev->vq[n].used_elems = NULL;
     vdev->vq[n].vring.num = 0;
 }
 
@@ -988,12 +1725,54 @@ void virtio_irq(VirtQueue *vq)
     virtio_notify_vector(vq->vdev, vq->vector);
 }
 
+/* Like vring_need_event, with the event offset of a packed ring's driver
+ * event area.  An offset from the previous lap of the ring counts as
+ * negative.
+ */
+static bool vring_packed_need_event(VirtQueue *vq, bool wrap, uint16_t off_wrap,
+                                    uint16_t new, uint16_t old)
+{
+    int off = off_wrap & ~(1 << VRING_PACKED_EVENT_F_WRAP_CTR);
+
+    if (wrap != off_wrap >> VRING_PACKED_EVENT_F_WRAP_CTR) {
+        off -= vq->vring.num;
+    }
+    return vring_need_event(off, new, old);
+}
+
+static bool vring_packed_notify(VirtIODevice *vdev, VirtQueue *vq)
+{
+    VRingPackedDescEvent e;
+    uint16_t old, new;
+    bool v;
+
+    vring_packed_driver_event(vq, &e);
+
+    old = vq->signalled_used;
+    new = vq->signalled_used = vq->used_idx;
+    v = vq->signalled_used_valid;
+    vq->signalled_used_valid = true;
+
+    if (e.flags == VRING_PACKED_EVENT_FLAG_DISABLE) {
+        return false;
+    } else if (e.flags == VRING_PACKED_EVENT_FLAG_ENABLE) {
+        return true;
+    }
+
+    return !v || vring_packed_need_event(vq, vq->used_wrap_counter,
+                                         e.off_wrap, new, old);
+}
+
 static bool vring_notify(VirtIODevice *vdev, VirtQueue *vq)
 {
     uint16_t old, new;
     bool v;
     /* We need to expose used array entries before checking used event. */
     smp_mb();
+
+    if (virtqueue_packed(vq)) {
+        return vring_packed_notify(vdev, vq);
+    }
     /* Always notify when queue is empty (when feature acknowledge) */
     if (virtio_has_feature(vdev, VIRTIO_F_NOTIFY_ON_EMPTY) &&
         !vq->inuse && vring_avail_idx(vq) == vq->last_avail_idx) {
@@ -1075,6 +1854,7 @@ static int get_virtqueue_state(QEMUFile *f, void *pv, size_t size)
     int i;
 
     for (i = 0; i < VIRTIO_QUEUE_MAX; i++) {
+        virtqueue_unmap_rings(&vdev->vq[i]);
         vdev->vq[i].vring.avail = qemu_get_be64(f);
         vdev->vq[i].vring.used = qemu_get_be64(f);
     }
@@ -1087,6 +1867,65 @@ static VMStateInfo vmstate_info_virtqueue = {
     .put = put_virtqueue_state,
 };
 
+static bool virtio_packed_virtqueue_needed(void *opaque)
+{
+    VirtIODevice *vdev = opaque;
+
+    return virtio_host_has_feature(vdev, VIRTIO_F_RING_PACKED);
+}
+
+static void put_packed_virtqueue_state(QEMUFile *f, void *pv, size_t size)
+{
+    VirtIODevice *vdev = pv;
+    int i;
+
+    for (i = 0; i < VIRTIO_QUEUE_MAX; i++) {
+        qemu_put_byte(f, vdev->vq[i].last_avail_wrap_counter);
+        qemu_put_be16(f, vdev->vq[i].used_idx);
+        qemu_put_byte(f, vdev->vq[i].used_wrap_counter);
+    }
+}
+
+static int get_packed_virtqueue_state(QEMUFile *f, void *pv, size_t size)
+{
+    VirtIODevice *vdev = pv;
+    int i;
+
+    /* The indices are checked by virtio_load(), once it is known whether
+     * the rings are packed at all */
+    for (i = 0; i < VIRTIO_QUEUE_MAX; i++) {
+        vdev->vq[i].last_avail_wrap_counter = qemu_get_byte(f);
+        vdev->vq[i].used_idx = qemu_get_be16(f);
+        vdev->vq[i].used_wrap_counter = qemu_get_byte(f);
+    }
+    return 0;
+}
+
+static VMStateInfo vmstate_info_packed_virtqueue = {
+    .name = "packed_virtqueue_state",
+    .get = get_packed_virtqueue_state,
+    .put = put_packed_virtqueue_state,
+};
+
+static const VMStateDescription vmstate_virtio_packed_virtqueues = {
+    .name = "virtio/packed_virtqueues",
+    .version_id = 1,
+    .minimum_version_id = 1,
+    .needed = &virtio_packed_virtqueue_needed,
+    .fields = (VMStateField[]) {
+        {
+            .name         = "packed_virtqueues",
+            .version_id   = 0,
+            .field_exists = NULL,
+            .size         = 0,
+            .info         = &vmstate_info_packed_virtqueue,
+            .flags        = VMS_SINGLE,
+            .offset       = 0,
+        },
+        VMSTATE_END_OF_LIST()
+    }
+};
+
 static const VMStateDescription vmstate_virtio_virtqueues = {
     .name = "virtio/virtqueues",
     .version_id = 1,
@@ -1140,6 +1979,7 @@ static const VMStateDescription vmstate_virtio = {
         &vmstate_virtio_device_endian,
         &vmstate_virtio_64bit_features,
         &vmstate_virtio_virtqueues,
+        &vmstate_virtio_packed_virtqueues,
         NULL
     }
 };
@@ -1198,11 +2038,18 @@ static int virtio_set_features_nocheck(VirtIODevice *vdev, uint64_t val)
 {
     VirtioDeviceClass *k = VIRTIO_DEVICE_GET_CLASS(vdev);
     bool bad = (val & ~(vdev->host_features)) != 0;
+    int i;
 
     val &= vdev->host_features;
     if (k->set_features) {
         k->set_features(vdev, val);
     }
+    if ((val ^ vdev->guest_features) & (1ULL << VIRTIO_F_RING_PACKED)) {
+        /* The cached mappings have the sizes of the other ring layout */
+        for (i = 0; i < VIRTIO_QUEUE_MAX; i++) {
+            virtqueue_unmap_rings(&vdev->vq[i]);
+        }
+    }
     vdev->guest_features = val;
     return bad ? -1 : 0;
 }
@@ -1271,6 +2118,7 @@ int virtio_load(VirtIODevice *vdev, QEMUFile *f, int version_id)
     }
 
     for (i = 0; i < num; i++) {
+        virtqueue_unmap_rings(&vdev->vq[i]);
         vdev->vq[i].vring.num = qemu_get_be32(f);
         if (k->has_variable_vring_alignment) {
             vdev->vq[i].vring.align = qemu_get_be32(f);
@@ -1338,7 +2186,19 @@ int virtio_load(VirtIODevice *vdev, QEMUFile *f, int version_id)
     }
 
     for (i = 0; i < num; i++) {
-        if (vdev->vq[i].vring.desc) {
+        /* A packed ring has no avail index to check against, but its
+         * indices are descriptor offsets within the ring.  */
+        if (vdev->vq[i].vring.desc && virtqueue_packed(&vdev->vq[i])) {
+            if (vdev->vq[i].last_avail_idx >= vdev->vq[i].vring.num ||
+                vdev->vq[i].used_idx >= vdev->vq[i].vring.num) {
+                error_report("VQ %d size 0x%x: packed ring Host index 0x%x "
+                             "or used index 0x%x out of range",
+                             i, vdev->vq[i].vring.num,
+                             vdev->vq[i].last_avail_idx,
+                             vdev->vq[i].used_idx);
+                return -1;
+            }
+        } else if (vdev->vq[i].vring.desc) {
             uint16_t nheads;
             nheads = vring_avail_idx(&vdev->vq[i]) - vdev->vq[i].last_avail_idx;
             /* Check it isn't doing strange things with descriptor numbers. */
@@ -1358,6 +2218,12 @@ int virtio_load(VirtIODevice *vdev, QEMUFile *f, int version_id)
 
 void virtio_cleanup(VirtIODevice *vdev)
 {
+    int i;
+
+    for (i = 0; i < VIRTIO_QUEUE_MAX; i++) {
+        virtqueue_unmap_rings(&vdev->vq[i]);
+        g_free(vdev->vq[i].used_elems);
+    }
     qemu_del_vm_change_state_handler(vdev->vmstate);
     g_free(vdev->config);
     g_free(vdev->vq);
@@ -47,6 +47,7 @@ void qemu_aio_ref(void *p);
 typedef struct AioHandler AioHandler;
 typedef void QEMUBHFunc(void *opaque);
 typedef void IOHandler(void *opaque);
+typedef bool AioPollFn(void *opaque);
 
 struct AioContext {
     GSource source;
@@ -122,6 +123,22 @@ struct AioContext {
 
     /* TimerLists for calling timers - one per clock type */
     QEMUTimerListGroup tlg;
+
+    /* Number of handlers that have no io_poll callback; while it is
+     * non-zero aio_poll() goes straight to ppoll().
+     */
+    int poll_disable_cnt;
+
+    /* Adaptive busy polling, see aio_context_set_poll_params() */
+    int64_t poll_ns;        /* current polling time in nanoseconds */
+    int64_t poll_max_ns;    /* maximum polling time in nanoseconds */
+    int64_t poll_grow;      /* polling time growth factor */
+    int64_t poll_shrink;    /* polling time shrink factor */
+
+    /* Statistics, only written by the thread that runs aio_poll() */
+    int64_t poll_time_ns;   /* total time spent busy polling */
+    int64_t poll_hits;      /* polls that found an event */
+    int64_t poll_misses;    /* polls that timed out */
 };
 
 /**
@@ -314,6 +331,24 @@ void aio_set_event_notifier(AioContext *ctx,
                             EventNotifier *notifier,
                             EventNotifierHandler *io_read);
 
+/* Set a callback that aio_poll() invokes in a busy loop before it blocks
+ * in ppoll(), instead of waiting for the file descriptor to become
+ * readable.  The callback should check for new work, process it and return
+ * true if it did anything.  It must be cheap when there is nothing to do.
+ *
+ * The file descriptor must already have a handler; the poll callback goes
+ * away together with it.  Busy polling is skipped altogether while the
+ * AioContext has any handler without a poll callback.
+ */
+void aio_set_poll_handler(AioContext *ctx, int fd, AioPollFn *io_poll);
+
+/* Set a poll callback, see aio_set_poll_handler(), for an event notifier
+ * that was registered with aio_set_event_notifier().
+ */
+void aio_set_event_notifier_poll(AioContext *ctx,
+                                 EventNotifier *notifier,
+                                 AioPollFn *io_poll);
+
 /* Return a GSource that lets the main loop poll the file descriptors attached
  * to this AioContext.
  */
@@ -373,4 +408,18 @@ static inline void aio_timer_init(AioContext *ctx,
  */
 int64_t aio_compute_timeout(AioContext *ctx);
 
+/**
+ * aio_context_set_poll_params:
+ * @ctx: the aio context
+ * @max_ns: how long to busy poll for, in nanoseconds; 0 disables polling
+ * @grow: polling time growth factor, 0 selects the default
+ * @shrink: polling time shrink factor, 0 stops polling at the first miss
+ *
+ * Busy polling starts at a few microseconds and self-tunes between 0 and
+ * @max_ns: it grows by @grow when an event arrived soon after polling gave
+ * up, and shrinks by @shrink when nothing arrived within @max_ns.
+ */
+void aio_context_set_poll_params(AioContext *ctx, int64_t max_ns,
+                                 int64_t grow, int64_t shrink, Error **errp);
+
 #endif
@@ -24,6 +24,16 @@ typedef int ThreadPoolFunc(void *opaque);
 
 typedef struct ThreadPool ThreadPool;
 
+typedef struct ThreadPoolStats {
+    int max_threads;
+    int threads;            /* worker threads, idle or not */
+    int idle_threads;       /* workers waiting for requests */
+    int active;             /* requests being run by a worker */
+    int queued;             /* requests waiting for a worker */
+    uint64_t completed;     /* requests completed since the pool was created */
+    uint64_t stolen;        /* ... of which run by another pool's worker */
+} ThreadPoolStats;
+
 ThreadPool *thread_pool_new(struct AioContext *ctx);
 void thread_pool_free(ThreadPool *pool);
 
@@ -33,5 +43,6 @@ BlockAIOCB *thread_pool_submit_aio(ThreadPool *pool,
 int coroutine_fn thread_pool_submit_co(ThreadPool *pool,
         ThreadPoolFunc *func, void *arg);
 void thread_pool_submit(ThreadPool *pool, ThreadPoolFunc *func, void *arg);
+void thread_pool_get_stats(ThreadPool *pool, ThreadPoolStats *stats);
 
 #endif
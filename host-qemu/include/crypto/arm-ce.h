@@ -0,0 +1,71 @@
+/*
+ * ARMv8 Crypto Extensions primitives
+ *
+ * Copyright (C) 2013 - 2014 Linaro Ltd <ard.biesheuvel@linaro.org>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ */
+
+#ifndef QEMU_CRYPTO_ARM_CE_H
+#define QEMU_CRYPTO_ARM_CE_H
+
+#include "qemu-common.h"
+
+/*
+ * The 128-bit state operated on by the AES and SHA instructions, held as
+ * the two 64-bit halves of a guest vector register.  Bytes and words are
+ * numbered as in the ARM ARM; use the ARM_CE_BYTE() and ARM_CE_WORD()
+ * accessors rather than indexing the arrays directly.
+ */
+typedef union ArmCEState {
+    uint8_t    bytes[16];
+    uint32_t   words[4];
+    uint64_t   l[2];
+} ArmCEState;
+
+#ifdef HOST_WORDS_BIGENDIAN
+#define ARM_CE_BYTE(st, i)   ((st)->bytes[(15 - (i)) ^ 8])
+#define ARM_CE_WORD(st, i)   ((st)->words[(3 - (i)) ^ 2])
+#else
+#define ARM_CE_BYTE(st, i)   ((st)->bytes[i])
+#define ARM_CE_WORD(st, i)   ((st)->words[i])
+#endif
+
+/*
+ * One entry per instruction (or instruction pair selected by an argument).
+ * Each takes the destination register's state in D/ST and updates it in
+ * place; for sha1_3reg, N is clobbered.
+ */
+typedef struct ArmCEOps {
+    /* AESE (decrypt = false) and AESD (decrypt = true) */
+    void (*aese)(ArmCEState *st, const ArmCEState *rk, bool decrypt);
+    /* AESMC (decrypt = false) and AESIMC (decrypt = true) */
+    void (*aesmc)(ArmCEState *st, bool decrypt);
+    /* SHA1C (0), SHA1P (1), SHA1M (2) and SHA1SU0 (3) */
+    void (*sha1_3reg)(ArmCEState *d, ArmCEState *n, const ArmCEState *m,
+                      int op);
+    void (*sha1su1)(ArmCEState *d, const ArmCEState *m);
+    void (*sha256h)(ArmCEState *d, const ArmCEState *n, const ArmCEState *m);
+    void (*sha256h2)(ArmCEState *d, const ArmCEState *n, const ArmCEState *m);
+    void (*sha256su0)(ArmCEState *d, const ArmCEState *m);
+    void (*sha256su1)(ArmCEState *d, const ArmCEState *n,
+                      const ArmCEState *m);
+} ArmCEOps;
+
+/* Portable table-driven implementations.  */
+extern const ArmCEOps arm_ce_generic_ops;
+
+/* The portable implementations with every entry for which the host CPU
+ * has an equivalent instruction (AES-NI/SHA-NI on x86, the Crypto
+ * Extensions on AArch64) replaced by the accelerated version.  Filled in
+ * at startup from CPUID or the ELF hwcaps.
+ */
+extern ArmCEOps arm_ce_ops;
+
+/* Return the number of entries of arm_ce_ops that are host-accelerated.  */
+int arm_ce_accel_count(void);
+
+#endif
@@ -174,8 +174,27 @@ struct TranslationBlock {
        jmp_first */
     struct TranslationBlock *jmp_next[2];
     struct TranslationBlock *jmp_first;
+    /* execution statistics for this guest PC, NULL unless profiling */
+    struct TBProfile *profile;
 };
 
+/* Per guest PC statistics, gathered while TB profiling is enabled.
+   They survive TB invalidation and flushes, so retranslations of the
+   same code accumulate in one entry.  */
+typedef struct TBProfile {
+    uint64_t pc;
+    uint64_t exec_count;    /* incremented by the generated code */
+    uint64_t translations;
+    int64_t gen_time;       /* host ns spent translating */
+    uint16_t size;          /* guest size of the last translation */
+} TBProfile;
+
+extern bool tb_profile_enabled;
+void tb_profile_set_enabled(CPUState *cpu, bool enable);
+void tb_profile_reset(CPUState *cpu);
+void tb_profile_foreach(void (*fn)(TBProfile *prof, void *opaque),
+                        void *opaque);
+
 #include "exec/spinlock.h"
 
 typedef struct TBContext TBContext;
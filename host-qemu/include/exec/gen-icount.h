@@ -21,6 +21,17 @@ static inline void gen_tb_start(TranslationBlock *tb)
     tcg_gen_brcondi_i32(TCG_COND_NE, flag, 0, exitreq_label);
     tcg_temp_free_i32(flag);
 
+    if (tb->profile) {
+        TCGv_ptr ptr = tcg_const_ptr(&tb->profile->exec_count);
+        TCGv_i64 execs = tcg_temp_new_i64();
+
+        tcg_gen_ld_i64(execs, ptr, 0);
+        tcg_gen_addi_i64(execs, execs, 1);
+        tcg_gen_st_i64(execs, ptr, 0);
+        tcg_temp_free_i64(execs);
+        tcg_temp_free_ptr(ptr);
+    }
+
     if (!(tb->cflags & CF_USE_ICOUNT)) {
         return;
     }
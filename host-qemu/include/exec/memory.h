@@ -696,6 +696,21 @@ bool memory_region_get_dirty(MemoryRegion *mr, hwaddr addr,
 void memory_region_set_dirty(MemoryRegion *mr, hwaddr addr,
                              hwaddr size);
 
+/**
+ * memory_region_invalidate_and_set_dirty: Mark a range of bytes as written
+ * by a device.
+ *
+ * Like memory_region_set_dirty(), but also invalidates any translated code
+ * in the range, the same as a DMA write through address_space_rw() would.
+ * For devices that keep a host pointer into guest RAM and write through it.
+ *
+ * @mr: the RAM memory region being written.
+ * @addr: the address (relative to the start of the region) being written.
+ * @size: size of the range being written.
+ */
+void memory_region_invalidate_and_set_dirty(MemoryRegion *mr, hwaddr addr,
+                                            hwaddr size);
+
 /**
  * memory_region_test_and_clear_dirty: Check whether a range of bytes is dirty
  *                                     for a specified client. It clears them.
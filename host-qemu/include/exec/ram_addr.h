@@ -40,6 +40,8 @@ void qemu_ram_free(ram_addr_t addr);
 void qemu_ram_free_from_ptr(ram_addr_t addr);
 
 int qemu_ram_resize(ram_addr_t base, ram_addr_t newsize, Error **errp);
+bool qemu_ram_is_anonymous(RAMBlock *rb);
+void qemu_ram_advise_remapped(void *addr, ram_addr_t length);
 
 #define DIRTY_CLIENTS_ALL     ((1 << DIRTY_MEMORY_NUM) - 1)
 #define DIRTY_CLIENTS_NOCODE  (DIRTY_CLIENTS_ALL & ~(1 << DIRTY_MEMORY_CODE))
@@ -197,6 +199,7 @@ static inline void cpu_physical_memory_set_dirty_lebitmap(unsigned long *bitmap,
 bool cpu_physical_memory_test_and_clear_dirty(ram_addr_t start,
                                               ram_addr_t length,
                                               unsigned client);
+void tlb_reset_dirty_range_all(ram_addr_t start, ram_addr_t length);
 
 static inline void cpu_physical_memory_clear_dirty_range(ram_addr_t start,
                                                          ram_addr_t length)
@@ -221,6 +224,7 @@ uint64_t cpu_physical_memory_sync_dirty_bitmap(unsigned long *dest,
         int k;
         int nr = BITS_TO_LONGS(length >> TARGET_PAGE_BITS);
         unsigned long *src = ram_list.dirty_memory[DIRTY_MEMORY_MIGRATION];
+        bool cleared = false;
 
         for (k = page; k < page + nr; k++) {
             if (src[k]) {
@@ -230,8 +234,16 @@ uint64_t cpu_physical_memory_sync_dirty_bitmap(unsigned long *dest,
                 dest[k] |= bits;
                 new_dirty &= bits;
                 num_dirty += ctpopl(new_dirty);
+                cleared = true;
             }
         }
+
+        /* Like cpu_physical_memory_test_and_clear_dirty(), make TCG trap
+         * the next write to the pages again.
+         */
+        if (cleared && tcg_enabled()) {
+            tlb_reset_dirty_range_all(start, length);
+        }
     } else {
         for (addr = 0; addr < length; addr += TARGET_PAGE_SIZE) {
             if (cpu_physical_memory_test_and_clear_dirty(
@@ -0,0 +1,33 @@
+/*
+ * Notifiers for guest RAM blocks
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#ifndef QEMU_EXEC_RAMLIST_H
+#define QEMU_EXEC_RAMLIST_H
+
+#include "qemu/queue.h"
+
+typedef struct RAMBlockNotifier RAMBlockNotifier;
+
+/*
+ * Told about the host memory of every RAM block that is added or removed.
+ * @host and @size cover the maximum size of the block.  ram_block_removed
+ * is called before the memory is unmapped.  Notifiers are added, removed
+ * and called with the iothread lock held.
+ */
+struct RAMBlockNotifier {
+    void (*ram_block_added)(RAMBlockNotifier *n, void *host, size_t size);
+    void (*ram_block_removed)(RAMBlockNotifier *n, void *host, size_t size);
+    QLIST_ENTRY(RAMBlockNotifier) next;
+};
+
+/* ram_block_notifier_add() calls ram_block_added for the existing blocks */
+void ram_block_notifier_add(RAMBlockNotifier *n);
+void ram_block_notifier_remove(RAMBlockNotifier *n);
+void ram_block_notify_add(void *host, size_t size);
+void ram_block_notify_remove(void *host, size_t size);
+
+#endif
@@ -0,0 +1,26 @@
+/*
+ * Persistent translation block cache
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#ifndef EXEC_TB_CACHE_H
+#define EXEC_TB_CACHE_H
+
+#include "exec/exec-all.h"
+
+extern bool tb_cache_enabled;
+
+/* Fill TB, whose pc, cs_base, flags, cflags and tc_ptr are set, from the
+   cache.  Return false if there is no usable entry.  */
+bool tb_cache_load(CPUState *cpu, TranslationBlock *tb,
+                   tb_page_addr_t phys_pc, int *code_size);
+
+/* Remember TB, which has just been translated, for the next run.  */
+void tb_cache_record(CPUState *cpu, TranslationBlock *tb,
+                     tb_page_addr_t phys_pc, int code_size);
+
+void tb_cache_dump_info(FILE *f, fprintf_function cpu_fprintf);
+
+#endif
@@ -43,6 +43,11 @@ void vring_disable_notification(VirtIODevice *vdev, Vring *vring);
 bool vring_enable_notification(VirtIODevice *vdev, Vring *vring);
 bool vring_should_notify(VirtIODevice *vdev, Vring *vring);
 int vring_pop(VirtIODevice *vdev, Vring *vring, VirtQueueElement *elem);
+void vring_discard(Vring *vring, VirtQueueElement *elem);
+void vring_rewind(Vring *vring, unsigned int num);
+void vring_fill(VirtIODevice *vdev, Vring *vring, VirtQueueElement *elem,
+                int len, unsigned int idx);
+void vring_flush(VirtIODevice *vdev, Vring *vring, unsigned int count);
 void vring_push(VirtIODevice *vdev, Vring *vring, VirtQueueElement *elem,
                 int len);
 
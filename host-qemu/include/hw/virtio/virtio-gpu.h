@@ -38,6 +38,7 @@ struct virtio_gpu_simple_resource {
     unsigned int iov_cnt;
     uint32_t scanout_bitmask;
     pixman_image_t *image;
+    bool zero_copy;             /* image is the guest backing itself */
     QTAILQ_ENTRY(virtio_gpu_simple_resource) next;
 };
 
@@ -56,8 +57,15 @@ struct virtio_gpu_requested_state {
     int x, y;
 };
 
+enum virtio_gpu_conf_flags {
+    VIRTIO_GPU_FLAG_ZERO_COPY_ENABLED = 1,
+};
+#define virtio_gpu_zero_copy_enabled(_cfg) \
+    (_cfg.flags & (1 << VIRTIO_GPU_FLAG_ZERO_COPY_ENABLED))
+
 struct virtio_gpu_conf {
     uint32_t max_outputs;
+    uint32_t flags;
 };
 
 struct virtio_gpu_ctrl_command {
@@ -16,6 +16,8 @@
 
 #include "standard-headers/linux/virtio_net.h"
 #include "hw/virtio/virtio.h"
+#include "hw/virtio/dataplane/vring.h"
+#include "sysemu/iothread.h"
 
 #define TYPE_VIRTIO_NET "virtio-net-device"
 #define VIRTIO_NET(obj) \
@@ -35,6 +37,8 @@ typedef struct virtio_net_conf
     uint32_t txtimer;
     int32_t txburst;
     char *tx;
+    uint32_t num_iothreads;
+    char **iothreads;
 } virtio_net_conf;
 
 /* Maximum packet size we can receive from tap device: header + 64k */
@@ -50,7 +54,21 @@ typedef struct VirtIONetQueue {
         VirtQueueElement elem;
         ssize_t len;
     } async_tx;
+    /* VIRTIO_NET_TX_BATCH elements for virtqueue_pop_batch() */
+    VirtQueueElement *tx_elems;
     struct VirtIONet *n;
+    /* Set while the queue pair is served from an IOThread */
+    AioContext *ctx;
+    bool dataplane;
+    bool tx_draining;
+    Vring rx_vring;
+    Vring tx_vring;
+    EventNotifier rx_host_notifier;
+    EventNotifier tx_host_notifier;
+    QEMUBH *dataplane_tx_bh;
+    /* Guest interrupts for received packets are put off while plugged */
+    unsigned int rx_plugged;
+    bool rx_notify_pending;
 } VirtIONetQueue;
 
 typedef struct VirtIONet {
@@ -95,6 +113,10 @@ typedef struct VirtIONet {
     uint64_t curr_guest_offloads;
     QEMUTimer *announce_timer;
     int announce_counter;
+    IOThread **iothreads;
+    bool dataplane_started;
+    bool dataplane_disabled;
+    int dataplane_queues;
 } VirtIONet;
 
 void virtio_net_set_netclient_name(VirtIONet *n, const char *name,
@@ -0,0 +1,44 @@
+/*
+ * Virtio ring benchmark device
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or
+ * (at your option) any later version.  See the COPYING file in the
+ * top-level directory.
+ */
+
+#ifndef _QEMU_VIRTIO_RING_BENCH_H
+#define _QEMU_VIRTIO_RING_BENCH_H
+
+#include "hw/virtio/virtio.h"
+
+#define TYPE_VIRTIO_RING_BENCH "virtio-ring-bench-device"
+#define VIRTIO_RING_BENCH(obj) \
+        OBJECT_CHECK(VirtIORingBench, (obj), TYPE_VIRTIO_RING_BENCH)
+
+/* Not assigned by the virtio specification; the last legacy PCI device ID */
+#define VIRTIO_ID_RING_BENCH 63
+
+#define VIRTIO_RING_BENCH_QUEUE_SIZE 256
+
+/* Results of the last run, in the device's endianness */
+struct virtio_ring_bench_config {
+    uint64_t cycles;
+    uint64_t elapsed_ns;
+} QEMU_PACKED;
+
+typedef struct VirtIORingBench {
+    VirtIODevice parent_obj;
+
+    VirtQueue *vq;
+
+    /* Pop/push cycles per run */
+    uint32_t iterations;
+    /* Buffers per virtqueue_pop_batch() call, 0 to use virtqueue_pop() */
+    uint32_t batch;
+
+    VirtQueueElement **elems;
+    uint64_t cycles;
+    uint64_t elapsed_ns;
+} VirtIORingBench;
+
+#endif
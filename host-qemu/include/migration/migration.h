@@ -76,10 +76,12 @@ struct MigrationState
     int64_t expected_downtime;
     int64_t dirty_pages_rate;
     int64_t dirty_bytes_rate;
+    int64_t dirty_sync_bytes;
     bool enabled_capabilities[MIGRATION_CAPABILITY_MAX];
     int64_t xbzrle_cache_size;
     int64_t setup_time;
     int64_t dirty_sync_count;
+    char *uri;
 };
 
 void process_incoming_migration(QEMUFile *f);
@@ -100,6 +102,16 @@ void unix_start_incoming_migration(const char *path, Error **errp);
 
 void unix_start_outgoing_migration(MigrationState *s, const char *path, Error **errp);
 
+void file_start_incoming_migration(const char *path, Error **errp);
+
+void file_start_outgoing_migration(MigrationState *s, const char *path,
+                                   Error **errp);
+
+int mapped_ram_truncate(uint64_t size);
+int mapped_ram_write(const void *buf, size_t len, uint64_t offset);
+int mapped_ram_load(void *host, size_t len, uint64_t offset, bool can_map);
+void mapped_ram_load_done(void);
+
 void fd_start_incoming_migration(const char *path, Error **errp);
 
 void fd_start_outgoing_migration(MigrationState *s, const char *fdname, Error **errp);
@@ -125,6 +137,11 @@ void migrate_compress_threads_create(void);
 void migrate_compress_threads_join(void);
 void migrate_decompress_threads_create(void);
 void migrate_decompress_threads_join(void);
+void migrate_multifd_send_threads_create(void);
+void migrate_multifd_send_threads_join(void);
+void migrate_multifd_send_shutdown(void);
+void migrate_multifd_recv_threads_create(int listen_fd);
+void migrate_multifd_recv_threads_join(void);
 uint64_t ram_bytes_remaining(void);
 uint64_t ram_bytes_transferred(void);
 uint64_t ram_bytes_total(void);
@@ -177,7 +194,12 @@ bool migrate_use_compression(void);
 int migrate_compress_level(void);
 int migrate_compress_threads(void);
 int migrate_decompress_threads(void);
+int migrate_xbzrle_threads(void);
 bool migrate_use_events(void);
+bool migrate_use_multifd(void);
+bool migrate_use_mapped_ram(void);
+int migrate_multifd_channels(void);
+int migrate_multifd_connect(Error **errp);
 
 void ram_control_before_iterate(QEMUFile *f, uint64_t flags);
 void ram_control_after_iterate(QEMUFile *f, uint64_t flags);
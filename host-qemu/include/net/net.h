@@ -57,6 +57,8 @@ typedef void (SetOffload)(NetClientState *, int, int, int, int, int);
 typedef void (SetVnetHdrLen)(NetClientState *, int);
 typedef int (SetVnetLE)(NetClientState *, bool);
 typedef int (SetVnetBE)(NetClientState *, bool);
+typedef void (SetAioContext)(NetClientState *, AioContext *);
+typedef void (NetPlug)(NetClientState *);
 
 typedef struct NetClientInfo {
     NetClientOptionsKind type;
@@ -77,8 +79,24 @@ typedef struct NetClientInfo {
     SetVnetHdrLen *set_vnet_hdr_len;
     SetVnetLE *set_vnet_le;
     SetVnetBE *set_vnet_be;
+    SetAioContext *set_aio_context;
+    NetPlug *plug;
+    NetPlug *unplug;
 } NetClientInfo;
 
+/* Packets delivered to (rx) and by (tx) a net client.  They are updated
+ * with atomic_add() from the thread that processes the client's packets,
+ * an IOThread or the main loop, and read by the monitor.
+ */
+typedef struct NetClientStats {
+    uint64_t rx_packets;
+    uint64_t rx_bytes;
+    uint64_t rx_dropped;
+    uint64_t tx_packets;
+    uint64_t tx_bytes;
+    uint64_t tx_dropped;
+} NetClientStats;
+
 struct NetClientState {
     NetClientInfo *info;
     int link_down;
@@ -92,6 +110,8 @@ struct NetClientState {
     NetClientDestructor *destructor;
     unsigned int queue_index;
     unsigned rxfilter_notify_enabled:1;
+    NetClientStats stats;
+    AioContext *aio_context;    /* set by qemu_set_aio_context() */
 };
 
 typedef struct NICState {
@@ -145,6 +165,9 @@ void qemu_set_offload(NetClientState *nc, int csum, int tso4, int tso6,
 void qemu_set_vnet_hdr_len(NetClientState *nc, int len);
 int qemu_set_vnet_le(NetClientState *nc, bool is_le);
 int qemu_set_vnet_be(NetClientState *nc, bool is_be);
+int qemu_set_aio_context(NetClientState *nc, AioContext *ctx);
+void qemu_net_plug(NetClientState *nc);
+void qemu_net_unplug(NetClientState *nc);
 void qemu_macaddr_default_if_unset(MACAddr *macaddr);
 int qemu_show_nic_models(const char *arg, const char *const *models);
 void qemu_check_nic_model(NICInfo *nd, const char *model);
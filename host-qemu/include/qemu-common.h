@@ -380,6 +380,7 @@ typedef struct PCIHostDeviceAddress {
 } PCIHostDeviceAddress;
 
 void tcg_exec_init(unsigned long tb_size);
+void tb_cache_init(const char *path, Error **errp);
 bool tcg_enabled(void);
 
 void cpu_exec_init_all(void);
@@ -592,6 +593,14 @@ can_use_buffer_find_nonzero_offset(const void *buf, size_t len)
 }
 size_t buffer_find_nonzero_offset(const void *buf, size_t len);
 
+#ifdef CONFIG_AVX2_OPT
+/*
+ * Whether functions built with __attribute__((target("avx2"))) can run
+ * on this host: the CPU has AVX2 and the OS saves the YMM registers.
+ */
+bool host_avx2_usable(void);
+#endif
+
 /*
  * helper to parse debug environment variables
  */
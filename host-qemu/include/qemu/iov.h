@@ -44,6 +44,20 @@ size_t iov_from_buf(const struct iovec *iov, unsigned int iov_cnt,
 size_t iov_to_buf(const struct iovec *iov, const unsigned int iov_cnt,
                   size_t offset, void *buf, size_t bytes);
 
+/**
+ * Copy `rows' rows of `row_bytes' bytes each from an iovec to a single
+ * continuous buffer, like calling iov_to_buf() once per row but walking
+ * the iovec only once.  Row r starts at byte position
+ * `offset + r * iov_stride' within the iovec and is copied to
+ * `buf + r * buf_stride'; `iov_stride' must not be smaller than
+ * `row_bytes'.  Copying stops at the end of the iovec.  Returns the
+ * number of bytes actually copied.
+ */
+size_t iov_to_buf_2d(const struct iovec *iov, const unsigned int iov_cnt,
+                     size_t offset, size_t iov_stride,
+                     void *buf, size_t buf_stride,
+                     size_t row_bytes, unsigned int rows);
+
 /**
  * Set data bytes pointed out by iovec `iov' of size `iov_cnt' elements,
  * starting at byte offset `start', to value `fillc', repeating it
@@ -211,6 +211,9 @@ struct kvm_run;
 #define TB_JMP_CACHE_BITS 12
 #define TB_JMP_CACHE_SIZE (1 << TB_JMP_CACHE_BITS)
 
+#define CPU_THROTTLE_PCT_MAX 99
+#define CPU_THROTTLE_TIMESLICE_NS 10000000
+
 /**
  * CPUState:
  * @cpu_index: CPU index (informative).
@@ -242,6 +245,14 @@ struct kvm_run;
  * @mem_io_pc: Host Program Counter at which the memory was accessed.
  * @mem_io_vaddr: Target virtual address at which the memory was accessed.
  * @kvm_fd: vCPU file descriptor for KVM.
+ * @dirty_pages: Pages this vCPU has written to while they were clean for
+ * migration, counted by TCG only.  Reset by the migration code.
+ * @dirty_pages_rate: Pages per second this vCPU dirtied, as last measured
+ * by the migration code.
+ * @throttle_percentage: Share of each time slice this vCPU is kept from
+ * running, see cpu_throttle_set().
+ * @throttle_until: QEMU_CLOCK_REALTIME time until which the vCPU sleeps.
+ * @throttle_pending: A sleep has been queued on the vCPU thread.
  *
  * State of one CPU core or thread.
  */
@@ -304,6 +315,12 @@ struct CPUState {
     struct KVMState *kvm_state;
     struct kvm_run *kvm_run;
 
+    uint64_t dirty_pages;
+    int64_t dirty_pages_rate;
+    int throttle_percentage;
+    int64_t throttle_until;
+    bool throttle_pending;
+
     /* TODO Move common fields from CPUArchState here. */
     int cpu_index; /* used by alpha TCG */
     uint32_t halted; /* used by alpha, cris, ppc TCG */
@@ -539,6 +556,34 @@ void run_on_cpu(CPUState *cpu, void (*func)(void *data), void *data);
  */
 void async_run_on_cpu(CPUState *cpu, void (*func)(void *data), void *data);
 
+/**
+ * cpu_throttle_set:
+ * @cpu: The vCPU to throttle.
+ * @new_throttle_pct: Percentage of its time @cpu should not run, from 0
+ * to CPU_THROTTLE_PCT_MAX.
+ *
+ * Keeps @cpu from running for @new_throttle_pct percent of every
+ * CPU_THROTTLE_TIMESLICE_NS time slice; 0 lets it run freely again.
+ * Other vCPUs are not affected, even under TCG where all vCPUs share one
+ * thread.
+ */
+void cpu_throttle_set(CPUState *cpu, int new_throttle_pct);
+
+/**
+ * cpu_throttle_stop:
+ *
+ * Stops throttling all vCPUs.
+ */
+void cpu_throttle_stop(void);
+
+/**
+ * cpu_throttle_get_percentage:
+ * @cpu: The vCPU to check.
+ *
+ * Returns: The throttle percentage last set for @cpu.
+ */
+int cpu_throttle_get_percentage(CPUState *cpu);
+
 /**
  * qemu_get_cpu:
  * @index: The CPUState@cpu_index value of the CPU to obtain.
@@ -0,0 +1,215 @@
+/*
+ * QEMU live migration to and from a file
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include "qemu-common.h"
+#include "qemu/error-report.h"
+#include "qemu/main-loop.h"
+#include "qemu/osdep.h"
+#include "migration/migration.h"
+#include "migration/qemu-file.h"
+
+//#define DEBUG_MIGRATION_FILE
+
+#ifdef DEBUG_MIGRATION_FILE
+#define DPRINTF(fmt, ...) \
+    do { printf("migration-file: " fmt, ## __VA_ARGS__); } while (0)
+#else
+#define DPRINTF(fmt, ...) \
+    do { } while (0)
+#endif
+
+/*
+ * With the mapped-ram capability guest RAM is not part of the stream in
+ * FILE but is stored in FILE.ram, every RAMBlock at a page aligned offset.
+ * While saving, the RAM file is written as FILE.ram.tmp and only renamed
+ * once the migration has completed: a guest restored from the previous
+ * FILE.ram may still have it mapped, and must not see it change.
+ */
+static int ram_fd = -1;
+static int incoming_ram_fd = -1;
+static char *ram_path;
+static char *ram_tmp_path;
+static Notifier ram_file_notifier;
+
+static void ram_file_state_changed(Notifier *notifier, void *data)
+{
+    MigrationState *s = data;
+
+    if (ram_fd < 0 || migration_in_setup(s)) {
+        return;
+    }
+    if (migration_has_finished(s)) {
+        if (qemu_fdatasync(ram_fd) < 0 || rename(ram_tmp_path, ram_path) < 0) {
+            error_report("failed to write RAM file %s: %s", ram_path,
+                         strerror(errno));
+            unlink(ram_tmp_path);
+        }
+    } else if (migration_has_failed(s)) {
+        unlink(ram_tmp_path);
+    } else {
+        return;
+    }
+
+    close(ram_fd);
+    ram_fd = -1;
+    g_free(ram_path);
+    g_free(ram_tmp_path);
+    ram_path = ram_tmp_path = NULL;
+    remove_migration_state_change_notifier(&ram_file_notifier);
+}
+
+void file_start_outgoing_migration(MigrationState *s, const char *path,
+                                   Error **errp)
+{
+    if (migrate_use_mapped_ram()) {
+        if (ram_fd >= 0) {
+            error_setg(errp, "a RAM file is still being written");
+            return;
+        }
+        ram_path = g_strdup_printf("%s.ram", path);
+        ram_tmp_path = g_strdup_printf("%s.ram.tmp", path);
+        ram_fd = qemu_open(ram_tmp_path, O_RDWR | O_CREAT | O_TRUNC, 0600);
+        if (ram_fd < 0) {
+            error_setg_errno(errp, errno, "failed to open %s", ram_tmp_path);
+            g_free(ram_path);
+            g_free(ram_tmp_path);
+            ram_path = ram_tmp_path = NULL;
+            return;
+        }
+        ram_file_notifier.notify = ram_file_state_changed;
+        add_migration_state_change_notifier(&ram_file_notifier);
+    }
+
+    s->file = qemu_fopen(path, "wb");
+    if (!s->file) {
+        error_setg_errno(errp, errno, "failed to open %s", path);
+        if (ram_fd >= 0) {
+            unlink(ram_tmp_path);
+            close(ram_fd);
+            ram_fd = -1;
+            remove_migration_state_change_notifier(&ram_file_notifier);
+        }
+        return;
+    }
+
+    migrate_fd_connect(s);
+}
+
+static void file_accept_incoming_migration(void *opaque)
+{
+    QEMUFile *f = opaque;
+
+    qemu_set_fd_handler(qemu_get_fd(f), NULL, NULL, NULL);
+    process_incoming_migration(f);
+}
+
+void file_start_incoming_migration(const char *path, Error **errp)
+{
+    char *path_ram;
+    QEMUFile *f;
+    int fd;
+
+    DPRINTF("Attempting to start an incoming migration from %s\n", path);
+
+    fd = qemu_open(path, O_RDONLY);
+    if (fd < 0) {
+        error_setg_errno(errp, errno, "failed to open %s", path);
+        return;
+    }
+
+    /* Only needed if the stream turns out to use mapped RAM */
+    path_ram = g_strdup_printf("%s.ram", path);
+    if (incoming_ram_fd >= 0) {
+        close(incoming_ram_fd);
+    }
+    incoming_ram_fd = qemu_open(path_ram, O_RDONLY);
+    g_free(path_ram);
+
+    f = qemu_fdopen(fd, "rb");
+    qemu_set_fd_handler(fd, file_accept_incoming_migration, NULL, f);
+}
+
+int mapped_ram_truncate(uint64_t size)
+{
+    return ftruncate(ram_fd, size) < 0 ? -errno : 0;
+}
+
+int mapped_ram_write(const void *buf, size_t len, uint64_t offset)
+{
+    const uint8_t *p = buf;
+
+    while (len) {
+        ssize_t ret = pwrite(ram_fd, p, len, offset);
+
+        if (ret < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -errno;
+        }
+        p += ret;
+        len -= ret;
+        offset += ret;
+    }
+    return 0;
+}
+
+/*
+ * Fill @host with @len bytes of the RAM file starting at @offset.  If
+ * @can_map, the file is mapped copy-on-write over @host so that pages are
+ * only read when the guest first touches them.
+ */
+int mapped_ram_load(void *host, size_t len, uint64_t offset, bool can_map)
+{
+    uintptr_t mask = getpagesize() - 1;
+    uint8_t *p = host;
+
+    if (incoming_ram_fd < 0) {
+        return -ENOENT;
+    }
+
+    if (can_map && !((uintptr_t)host & mask) && !(len & mask) &&
+        !(offset & mask)) {
+        void *ptr = mmap(host, len, PROT_READ | PROT_WRITE,
+                         MAP_PRIVATE | MAP_FIXED, incoming_ram_fd, offset);
+
+        if (ptr != MAP_FAILED) {
+            return 0;
+        }
+        DPRINTF("mmap failed (%s), reading instead\n", strerror(errno));
+    }
+
+    while (len) {
+        ssize_t ret = pread(incoming_ram_fd, p, len, offset);
+
+        if (ret < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -errno;
+        }
+        if (ret == 0) {
+            /* Past the end of a sparse file: the rest is zero */
+            memset(p, 0, len);
+            break;
+        }
+        p += ret;
+        len -= ret;
+        offset += ret;
+    }
+    return 0;
+}
+
+/* Called once the incoming migration has completed or failed.  Pages
+ * mapped by mapped_ram_load keep their own reference to the file.  */
+void mapped_ram_load_done(void)
+{
+    if (incoming_ram_fd >= 0) {
+        close(incoming_ram_fd);
+        incoming_ram_fd = -1;
+    }
+}
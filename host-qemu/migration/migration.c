@@ -29,6 +29,7 @@
 #include "trace.h"
 #include "qapi/util.h"
 #include "qapi-event.h"
+#include "qom/cpu.h"
 
 #define MAX_THROTTLE  (32 << 20)      /* Migration speed throttling */
 
@@ -44,6 +45,10 @@
 #define DEFAULT_MIGRATE_DECOMPRESS_THREAD_COUNT 2
 /*0: means nocompress, 1: best speed, ... 9: best compress ratio */
 #define DEFAULT_MIGRATE_COMPRESS_LEVEL 1
+/* Default number of multifd channels */
+#define DEFAULT_MIGRATE_MULTIFD_CHANNELS 2
+/* Default number of xbzrle threads, 1 means encoding in the migration thread */
+#define DEFAULT_MIGRATE_XBZRLE_THREAD_COUNT 1
 
 /* Migration XBZRLE default cache size */
 #define DEFAULT_MIGRATE_CACHE_SIZE (64 * 1024 * 1024)
@@ -71,6 +76,10 @@ MigrationState *migrate_get_current(void)
                 DEFAULT_MIGRATE_COMPRESS_THREAD_COUNT,
         .parameters[MIGRATION_PARAMETER_DECOMPRESS_THREADS] =
                 DEFAULT_MIGRATE_DECOMPRESS_THREAD_COUNT,
+        .parameters[MIGRATION_PARAMETER_MULTIFD_CHANNELS] =
+                DEFAULT_MIGRATE_MULTIFD_CHANNELS,
+        .parameters[MIGRATION_PARAMETER_XBZRLE_THREADS] =
+                DEFAULT_MIGRATE_XBZRLE_THREAD_COUNT,
     };
 
     return &current_migration;
@@ -256,6 +265,8 @@ void qemu_start_incoming_migration(const char *uri, Error **errp)
 #if !defined(WIN32)
     } else if (strstart(uri, "exec:", &p)) {
         exec_start_incoming_migration(p, errp);
+    } else if (strstart(uri, "file:", &p)) {
+        file_start_incoming_migration(p, errp);
     } else if (strstart(uri, "unix:", &p)) {
         unix_start_incoming_migration(p, errp);
     } else if (strstart(uri, "fd:", &p)) {
@@ -277,6 +288,7 @@ static void process_incoming_migration_co(void *opaque)
     ret = qemu_loadvm_state(f);
 
     qemu_fclose(f);
+    mapped_ram_load_done();
     free_xbzrle_decoded_buf();
     migration_incoming_state_destroy();
 
@@ -284,6 +296,7 @@ static void process_incoming_migration_co(void *opaque)
         migrate_generate_event(MIGRATION_STATUS_FAILED);
         error_report("load of migration failed: %s", strerror(-ret));
         migrate_decompress_threads_join();
+        migrate_multifd_recv_threads_join();
         exit(EXIT_FAILURE);
     }
     migrate_generate_event(MIGRATION_STATUS_COMPLETED);
@@ -294,6 +307,7 @@ static void process_incoming_migration_co(void *opaque)
     if (local_err) {
         error_report_err(local_err);
         migrate_decompress_threads_join();
+        migrate_multifd_recv_threads_join();
         exit(EXIT_FAILURE);
     }
 
@@ -312,6 +326,7 @@ static void process_incoming_migration_co(void *opaque)
         runstate_set(global_state_get_runstate());
     }
     migrate_decompress_threads_join();
+    migrate_multifd_recv_threads_join();
 }
 
 void process_incoming_migration(QEMUFile *f)
@@ -372,6 +387,10 @@ MigrationParameters *qmp_query_migrate_parameters(Error **errp)
             s->parameters[MIGRATION_PARAMETER_COMPRESS_THREADS];
     params->decompress_threads =
             s->parameters[MIGRATION_PARAMETER_DECOMPRESS_THREADS];
+    params->multifd_channels =
+            s->parameters[MIGRATION_PARAMETER_MULTIFD_CHANNELS];
+    params->xbzrle_threads =
+            s->parameters[MIGRATION_PARAMETER_XBZRLE_THREADS];
 
     return params;
 }
@@ -390,6 +409,36 @@ static void get_xbzrle_cache_stats(MigrationInfo *info)
     }
 }
 
+static void get_throttle_info(MigrationInfo *info)
+{
+    MigrationVcpuThrottleList *head = NULL, **tail = &head;
+    int64_t total = 0;
+    int ncpus = 0;
+    CPUState *cpu;
+
+    if (!migrate_auto_converge()) {
+        return;
+    }
+
+    CPU_FOREACH(cpu) {
+        MigrationVcpuThrottleList *entry = g_malloc0(sizeof(*entry));
+
+        entry->value = g_malloc0(sizeof(*entry->value));
+        entry->value->cpu_index = cpu->cpu_index;
+        entry->value->dirty_pages_rate = cpu->dirty_pages_rate;
+        entry->value->throttle_percentage = cpu_throttle_get_percentage(cpu);
+        total += entry->value->throttle_percentage;
+        ncpus++;
+        *tail = entry;
+        tail = &entry->next;
+    }
+
+    info->has_cpu_throttle_percentage = true;
+    info->cpu_throttle_percentage = ncpus ? total / ncpus : 0;
+    info->has_vcpu_throttle = true;
+    info->vcpu_throttle = head;
+}
+
 MigrationInfo *qmp_query_migrate(Error **errp)
 {
     MigrationInfo *info = g_malloc0(sizeof(*info));
@@ -436,6 +485,7 @@ MigrationInfo *qmp_query_migrate(Error **errp)
         }
 
         get_xbzrle_cache_stats(info);
+        get_throttle_info(info);
         break;
     case MIGRATION_STATUS_COMPLETED:
         get_xbzrle_cache_stats(info);
@@ -494,7 +544,11 @@ void qmp_migrate_set_parameters(bool has_compress_level,
                                 bool has_compress_threads,
                                 int64_t compress_threads,
                                 bool has_decompress_threads,
-                                int64_t decompress_threads, Error **errp)
+                                int64_t decompress_threads,
+                                bool has_multifd_channels,
+                                int64_t multifd_channels,
+                                bool has_xbzrle_threads,
+                                int64_t xbzrle_threads, Error **errp)
 {
     MigrationState *s = migrate_get_current();
 
@@ -517,6 +571,20 @@ void qmp_migrate_set_parameters(bool has_compress_level,
                    "is invalid, it should be in the range of 1 to 255");
         return;
     }
+    if (has_multifd_channels &&
+            (multifd_channels < 1 || multifd_channels > 64)) {
+        error_setg(errp, QERR_INVALID_PARAMETER_VALUE,
+                   "multifd_channels",
+                   "is invalid, it should be in the range of 1 to 64");
+        return;
+    }
+    if (has_xbzrle_threads &&
+            (xbzrle_threads < 1 || xbzrle_threads > 64)) {
+        error_setg(errp, QERR_INVALID_PARAMETER_VALUE,
+                   "xbzrle_threads",
+                   "is invalid, it should be in the range of 1 to 64");
+        return;
+    }
 
     if (has_compress_level) {
         s->parameters[MIGRATION_PARAMETER_COMPRESS_LEVEL] = compress_level;
@@ -528,6 +596,12 @@ void qmp_migrate_set_parameters(bool has_compress_level,
         s->parameters[MIGRATION_PARAMETER_DECOMPRESS_THREADS] =
                                                     decompress_threads;
     }
+    if (has_multifd_channels) {
+        s->parameters[MIGRATION_PARAMETER_MULTIFD_CHANNELS] = multifd_channels;
+    }
+    if (has_xbzrle_threads) {
+        s->parameters[MIGRATION_PARAMETER_XBZRLE_THREADS] = xbzrle_threads;
+    }
 }
 
 /* shared migration helpers */
@@ -554,6 +628,7 @@ static void migrate_fd_cleanup(void *opaque)
         qemu_mutex_lock_iothread();
 
         migrate_compress_threads_join();
+        migrate_multifd_send_threads_join();
         qemu_fclose(s->file);
         s->file = NULL;
     }
@@ -603,6 +678,7 @@ static void migrate_fd_cancel(MigrationState *s)
      */
     if (s->state == MIGRATION_STATUS_CANCELLING && f) {
         qemu_file_shutdown(f);
+        migrate_multifd_send_shutdown();
     }
 }
 
@@ -643,6 +719,9 @@ static MigrationState *migrate_init(const MigrationParams *params)
             s->parameters[MIGRATION_PARAMETER_COMPRESS_THREADS];
     int decompress_thread_count =
             s->parameters[MIGRATION_PARAMETER_DECOMPRESS_THREADS];
+    int multifd_channels = s->parameters[MIGRATION_PARAMETER_MULTIFD_CHANNELS];
+    int xbzrle_thread_count = s->parameters[MIGRATION_PARAMETER_XBZRLE_THREADS];
+    char *uri = s->uri;
 
     memcpy(enabled_capabilities, s->enabled_capabilities,
            sizeof(enabled_capabilities));
@@ -658,6 +737,9 @@ static MigrationState *migrate_init(const MigrationParams *params)
                compress_thread_count;
     s->parameters[MIGRATION_PARAMETER_DECOMPRESS_THREADS] =
                decompress_thread_count;
+    s->parameters[MIGRATION_PARAMETER_MULTIFD_CHANNELS] = multifd_channels;
+    s->parameters[MIGRATION_PARAMETER_XBZRLE_THREADS] = xbzrle_thread_count;
+    g_free(uri);
     s->bandwidth_limit = bandwidth_limit;
     migrate_set_state(s, MIGRATION_STATUS_NONE, MIGRATION_STATUS_SETUP);
 
@@ -732,6 +814,31 @@ void qmp_migrate(const char *uri, bool has_blk, bool blk,
         return;
     }
 
+    if (migrate_use_multifd()) {
+        if (!strstart(uri, "tcp:", NULL) && !strstart(uri, "unix:", NULL)) {
+            error_setg(errp, "multifd migration requires a tcp: or unix: URI");
+            return;
+        }
+        if (migrate_use_xbzrle() || migrate_use_compression()) {
+            error_setg(errp, "multifd cannot be combined with xbzrle or "
+                       "compress");
+            return;
+        }
+    }
+
+    if (migrate_use_mapped_ram()) {
+        if (!strstart(uri, "file:", NULL)) {
+            error_setg(errp, "mapped-ram migration requires a file: URI");
+            return;
+        }
+        if (migrate_use_xbzrle() || migrate_use_compression() ||
+            migrate_use_multifd()) {
+            error_setg(errp, "mapped-ram cannot be combined with xbzrle, "
+                       "compress or multifd");
+            return;
+        }
+    }
+
     /* We are starting a new migration, so we want to start in a clean
        state.  This change is only needed if previous migration
        failed/was cancelled.  We don't use migrate_set_state() because
@@ -739,6 +846,7 @@ void qmp_migrate(const char *uri, bool has_blk, bool blk,
     s->state = MIGRATION_STATUS_NONE;
 
     s = migrate_init(&params);
+    s->uri = g_strdup(uri);
 
     if (strstart(uri, "tcp:", &p)) {
         tcp_start_outgoing_migration(s, p, &local_err);
@@ -749,6 +857,8 @@ void qmp_migrate(const char *uri, bool has_blk, bool blk,
 #if !defined(WIN32)
     } else if (strstart(uri, "exec:", &p)) {
         exec_start_outgoing_migration(s, p, &local_err);
+    } else if (strstart(uri, "file:", &p)) {
+        file_start_outgoing_migration(s, p, &local_err);
     } else if (strstart(uri, "unix:", &p)) {
         unix_start_outgoing_migration(s, p, &local_err);
     } else if (strstart(uri, "fd:", &p)) {
@@ -886,6 +996,63 @@ int migrate_decompress_threads(void)
     return s->parameters[MIGRATION_PARAMETER_DECOMPRESS_THREADS];
 }
 
+int migrate_xbzrle_threads(void)
+{
+    MigrationState *s;
+
+    s = migrate_get_current();
+
+    return s->parameters[MIGRATION_PARAMETER_XBZRLE_THREADS];
+}
+
+bool migrate_use_multifd(void)
+{
+    MigrationState *s;
+
+    s = migrate_get_current();
+
+    return s->enabled_capabilities[MIGRATION_CAPABILITY_MULTIFD];
+}
+
+bool migrate_use_mapped_ram(void)
+{
+    MigrationState *s;
+
+    s = migrate_get_current();
+
+    return s->enabled_capabilities[MIGRATION_CAPABILITY_MAPPED_RAM];
+}
+
+int migrate_multifd_channels(void)
+{
+    MigrationState *s;
+
+    s = migrate_get_current();
+
+    return s->parameters[MIGRATION_PARAMETER_MULTIFD_CHANNELS];
+}
+
+/*
+ * Open one more connection to the destination of the current outgoing
+ * migration, for use as a multifd channel.  Called from the multifd
+ * threads, so the connection is made in blocking mode.
+ */
+int migrate_multifd_connect(Error **errp)
+{
+    MigrationState *s = migrate_get_current();
+    const char *p;
+
+    if (strstart(s->uri, "tcp:", &p)) {
+        return inet_connect(p, errp);
+#if !defined(WIN32)
+    } else if (strstart(s->uri, "unix:", &p)) {
+        return unix_connect(p, errp);
+#endif
+    }
+    error_setg(errp, "multifd migration requires a tcp: or unix: URI");
+    return -1;
+}
+
 bool migrate_use_events(void)
 {
     MigrationState *s;
@@ -993,8 +1160,8 @@ static void *migration_thread(void *opaque)
                                       bandwidth, max_size);
             /* if we haven't sent anything, we don't want to recalculate
                10000 is a small enough number for our purposes */
-            if (s->dirty_bytes_rate && transferred_bytes > 10000) {
-                s->expected_downtime = s->dirty_bytes_rate / bandwidth;
+            if (s->dirty_sync_bytes && transferred_bytes > 10000) {
+                s->expected_downtime = s->dirty_sync_bytes / bandwidth;
             }
 
             qemu_file_reset_rate_limit(s->file);
@@ -1043,6 +1210,7 @@ void migrate_fd_connect(MigrationState *s)
     notifier_list_notify(&migration_state_notifiers, s);
 
     migrate_compress_threads_create();
+    migrate_multifd_send_threads_create();
     qemu_thread_create(&s->thread, "migration", migration_thread, s,
                        QEMU_THREAD_JOINABLE);
 }
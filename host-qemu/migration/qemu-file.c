@@ -239,6 +239,16 @@ void qemu_update_position(QEMUFile *f, size_t size)
     f->pos += size;
 }
 
+/*
+ * Account for data that was sent on behalf of this file through another
+ * channel, so that rate limiting and bandwidth estimates still see it.
+ */
+void qemu_file_credit_transfer(QEMUFile *f, size_t size)
+{
+    f->pos += size;
+    f->bytes_xfer += size;
+}
+
 /** Closes the file
  *
  * Returns negative error value if any error happened on previous operations or
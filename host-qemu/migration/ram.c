@@ -37,7 +37,10 @@
 #include "qemu/error-report.h"
 #include "trace.h"
 #include "exec/ram_addr.h"
+#include "exec/ramlist.h"
 #include "qemu/rcu_queue.h"
+#include "qemu/iov.h"
+#include "qemu/sockets.h"
 
 #ifdef DEBUG_MIGRATION_RAM
 #define DPRINTF(fmt, ...) \
@@ -47,16 +50,15 @@
     do { } while (0)
 #endif
 
-static bool mig_throttle_on;
 static int dirty_rate_high_cnt;
-static void check_guest_throttling(void);
 
 static uint64_t bitmap_sync_count;
 
 /***********************************************************/
 /* ram save/restore */
 
-#define RAM_SAVE_FLAG_FULL     0x01 /* Obsolete, not used anymore */
+/* 0x01 was RAM_SAVE_FLAG_FULL, which has not been used for a long time */
+#define RAM_SAVE_FLAG_MAPPED_RAM 0x01
 #define RAM_SAVE_FLAG_COMPRESS 0x02
 #define RAM_SAVE_FLAG_MEM_SIZE 0x04
 #define RAM_SAVE_FLAG_PAGE     0x08
@@ -65,6 +67,7 @@ static uint64_t bitmap_sync_count;
 #define RAM_SAVE_FLAG_XBZRLE   0x40
 /* 0x80 is reserved in migration.h start with 0x100 next */
 #define RAM_SAVE_FLAG_COMPRESS_PAGE    0x100
+#define RAM_SAVE_FLAG_MULTIFD_SYNC     0x200
 
 static const uint8_t ZERO_TARGET_PAGE[TARGET_PAGE_SIZE];
 
@@ -73,6 +76,9 @@ static inline bool is_zero_range(uint8_t *p, uint64_t size)
     return buffer_find_nonzero_offset(p, size) == size;
 }
 
+typedef struct XBZRLEJob XBZRLEJob;
+typedef struct XBZRLEParam XBZRLEParam;
+
 /* struct contains XBZRLE cache and a static page
    used by the compression */
 static struct {
@@ -83,6 +89,16 @@ static struct {
     /* Cache for XBZRLE, Protected by lock. */
     PageCache *cache;
     QemuMutex lock;
+    /* With xbzrle-threads > 1 the threads have a shard of the cache each,
+       and cache is NULL; see "Parallel XBZRLE" below. */
+    XBZRLEParam *params;
+    XBZRLEJob *pending;
+    int threads;
+    QemuMutex done_lock;
+    QemuCond done_cond;
+    /* Cache size set while the threads are running, or 0.  Protected by
+       lock. */
+    int64_t new_cache_size;
 } XBZRLE;
 
 /* buffer used for XBZRLE decoding */
@@ -131,6 +147,9 @@ int64_t xbzrle_cache_resize(int64_t new_size)
 
         cache_fini(XBZRLE.cache);
         XBZRLE.cache = new_cache;
+    } else if (XBZRLE.params != NULL) {
+        /* The shards are resized when the threads are next idle */
+        XBZRLE.new_cache_size = pow2floor(new_size);
     }
 
 out_new_size:
@@ -548,6 +567,124 @@ static void migration_bitmap_sync_init(void)
     iterations_prev = 0;
 }
 
+/* Auto-converge keeps the guest from dirtying memory faster than this
+ * share of the migration bandwidth...
+ */
+#define THROTTLE_DIRTY_RATIO 0.5
+/* ...once the dirty rate has been above it for this many periods */
+#define THROTTLE_START_PERIODS 2
+
+/*
+ * Auto-converge controller, run once per measurement period with the
+ * bytes dirtied and transferred in the period.
+ *
+ * The dirty rate is split among the vCPUs by the pages each of them
+ * dirtied (only counted by TCG; with KVM it is split evenly), and divided
+ * by the share of the period each vCPU was allowed to run to estimate
+ * u[i], what the vCPU dirties when it is not throttled.  The throttles
+ * t[i] are then chosen proportional to u[i], so that
+ *
+ *     sum(u[i] * (1 - t[i])) = target
+ *
+ * The vCPUs dirtying the most memory are slowed down the most, and vCPUs
+ * that do not write to memory keep running at full speed.  A vCPU whose
+ * throttle would exceed CPU_THROTTLE_PCT_MAX is capped, and the rest of
+ * the reduction is shared among the others.
+ *
+ * Called with iothread lock held.
+ */
+static void migration_throttle_adjust(int64_t period_ms,
+                                      uint64_t dirty_bytes,
+                                      uint64_t xfer_bytes)
+{
+    double max = CPU_THROTTLE_PCT_MAX / 100.0;
+    double target = xfer_bytes * THROTTLE_DIRTY_RATIO;
+    double total = 0, excess;
+    uint64_t dirty_total = 0;
+    uint64_t *dirty;
+    double *u, *t;
+    bool *capped, throttled = false, changed;
+    int ncpus = 0, i;
+    CPUState *cpu;
+
+    CPU_FOREACH(cpu) {
+        ncpus++;
+    }
+    dirty = g_new0(uint64_t, ncpus);
+    u = g_new0(double, ncpus);
+    t = g_new0(double, ncpus);
+    capped = g_new0(bool, ncpus);
+
+    i = 0;
+    CPU_FOREACH(cpu) {
+        dirty[i] = cpu->dirty_pages;
+        cpu->dirty_pages = 0;
+        cpu->dirty_pages_rate = dirty[i] * 1000 / period_ms;
+        dirty_total += dirty[i];
+        throttled |= cpu_throttle_get_percentage(cpu) != 0;
+        i++;
+    }
+
+    i = 0;
+    CPU_FOREACH(cpu) {
+        double share = dirty_total ? (double)dirty[i] / dirty_total
+                                   : 1.0 / ncpus;
+
+        u[i] = dirty_bytes * share /
+               (1 - cpu_throttle_get_percentage(cpu) / 100.0);
+        total += u[i];
+        i++;
+    }
+
+    if (total <= target) {
+        dirty_rate_high_cnt = 0;
+    } else if (throttled || ++dirty_rate_high_cnt >= THROTTLE_START_PERIODS) {
+        excess = total - target;
+        do {
+            double sumsq = 0;
+
+            changed = false;
+            for (i = 0; i < ncpus; i++) {
+                if (!capped[i]) {
+                    sumsq += u[i] * u[i];
+                }
+            }
+            if (sumsq == 0) {
+                break;
+            }
+            for (i = 0; i < ncpus; i++) {
+                if (capped[i]) {
+                    continue;
+                }
+                t[i] = excess / sumsq * u[i];
+                if (t[i] > max) {
+                    t[i] = max;
+                    capped[i] = true;
+                    excess -= u[i] * max;
+                    changed = true;
+                }
+            }
+        } while (changed);
+    }
+
+    i = 0;
+    CPU_FOREACH(cpu) {
+        int pct = t[i] * 100 + 0.5;
+
+        if (pct != cpu_throttle_get_percentage(cpu)) {
+            trace_migration_throttle(cpu->cpu_index, cpu->dirty_pages_rate,
+                                     pct);
+            cpu_throttle_set(cpu, pct);
+        }
+        i++;
+    }
+
+    g_free(dirty);
+    g_free(u);
+    g_free(t);
+    g_free(capped);
+}
+
 /* Called with iothread lock held, to protect ram_list.dirty_memory[] */
 static void migration_bitmap_sync(void)
 {
@@ -583,27 +720,17 @@ static void migration_bitmap_sync(void)
     num_dirty_pages_period += migration_dirty_pages - num_dirty_pages_init;
     end_time = qemu_clock_get_ms(QEMU_CLOCK_REALTIME);
 
+    s->dirty_sync_bytes = migration_dirty_pages * TARGET_PAGE_SIZE;
+
     /* more than 1 second = 1000 millisecons */
     if (end_time > start_time + 1000) {
+        bytes_xfer_now = ram_bytes_transferred();
         if (migrate_auto_converge()) {
-            /* The following detection logic can be refined later. For now:
-               Check to see if the dirtied bytes is 50% more than the approx.
-               amount of bytes that just got transferred since the last time we
-               were in this routine. If that happens >N times (for now N==4)
-               we turn on the throttle down logic */
-            bytes_xfer_now = ram_bytes_transferred();
-            if (s->dirty_pages_rate &&
-               (num_dirty_pages_period * TARGET_PAGE_SIZE >
-                   (bytes_xfer_now - bytes_xfer_prev)/2) &&
-               (dirty_rate_high_cnt++ > 4)) {
-                    trace_migration_throttle();
-                    mig_throttle_on = true;
-                    dirty_rate_high_cnt = 0;
-             }
-             bytes_xfer_prev = bytes_xfer_now;
-        } else {
-             mig_throttle_on = false;
+            migration_throttle_adjust(end_time - start_time,
+                                      num_dirty_pages_period * TARGET_PAGE_SIZE,
+                                      bytes_xfer_now - bytes_xfer_prev);
         }
+        bytes_xfer_prev = bytes_xfer_now;
         if (migrate_use_xbzrle()) {
             if (iterations_prev != acct_info.iterations) {
                 acct_info.xbzrle_cache_miss_rate =
@@ -909,154 +1036,1130 @@ static int ram_save_compressed_page(QEMUFile *f, RAMBlock *block,
     return pages;
 }
 
-/**
- * ram_find_and_save_block: Finds a dirty page and sends it to f
+/* Parallel XBZRLE
  *
- * Called within an RCU critical section.
- *
- * Returns:  The number of pages written
- *           0 means no dirty pages
- *
- * @f: QEMUFile where to send the data
- * @last_stage: if we are at the completion stage
- * @bytes_transferred: increase it with the number of transferred bytes
+ * With more than one xbzrle thread, the XBZRLE cache is split into one
+ * shard per thread: page N of the RAM address space belongs to shard
+ * N % threads.  Once the bulk stage is over, the migration thread only
+ * walks the dirty bitmap and queues each page for the thread that owns its
+ * shard.  That thread does the zero page check, the cache lookup and the
+ * encoding, and writes the page records into its own buffer, which the
+ * migration thread then copies into the stream.  The first record of each
+ * job carries the block name, so the output of the threads can be put on
+ * the stream in any order.
  */
 
-static int ram_find_and_save_block(QEMUFile *f, bool last_stage,
-                                   uint64_t *bytes_transferred)
+#define XBZRLE_JOB_PAGES 32
+/* Largest page record: header with the block name, then a page or delta */
+#define XBZRLE_RECORD_MAX (8 + 1 + 255 + 1 + 2 + TARGET_PAGE_SIZE)
+
+struct XBZRLEJob {
+    RAMBlock *block;
+    /* looked up by the migration thread, which holds the RCU read lock */
+    uint8_t *host;
+    bool last_stage;
+    uint64_t age;
+    int num;
+    ram_addr_t offset[XBZRLE_JOB_PAGES];
+};
+
+typedef struct XBZRLEStats {
+    uint64_t dup_pages;
+    uint64_t norm_pages;
+    uint64_t xbzrle_bytes;
+    uint64_t xbzrle_pages;
+    uint64_t xbzrle_cache_miss;
+    uint64_t xbzrle_overflows;
+} XBZRLEStats;
+
+struct XBZRLEParam {
+    QemuThread thread;
+    /* protects start and quit */
+    QemuMutex mutex;
+    QemuCond cond;
+    bool start;
+    bool quit;
+    /* protected by XBZRLE.done_lock */
+    bool done;
+    /* owned by the thread while it is not done */
+    PageCache *cache;
+    XBZRLEJob job;
+    uint8_t *current_buf;
+    uint8_t *encoded_buf;
+    uint8_t *out;
+    size_t out_len;
+    XBZRLEStats stats;
+};
+
+static inline int xbzrle_shard(ram_addr_t addr)
 {
-    RAMBlock *block = last_seen_block;
-    ram_addr_t offset = last_offset;
-    bool complete_round = false;
-    int pages = 0;
-    MemoryRegion *mr;
+    return (addr >> TARGET_PAGE_BITS) % XBZRLE.threads;
+}
 
-    if (!block)
-        block = QLIST_FIRST_RCU(&ram_list.blocks);
+/* Address of a page within its shard, so that the shard's cache slots are
+ * all used.  */
+static inline uint64_t xbzrle_shard_addr(ram_addr_t addr)
+{
+    return ((addr >> TARGET_PAGE_BITS) / XBZRLE.threads) << TARGET_PAGE_BITS;
+}
 
-    while (true) {
-        mr = block->mr;
-        offset = migration_bitmap_find_and_reset_dirty(mr, offset);
-        if (complete_round && block == last_seen_block &&
-            offset >= last_offset) {
-            break;
+/* Same as save_page_header, but into a buffer */
+static uint8_t *xbzrle_put_header(uint8_t *p, RAMBlock *block,
+                                  ram_addr_t offset)
+{
+    stq_be_p(p, offset);
+    p += 8;
+
+    if (!(offset & RAM_SAVE_FLAG_CONTINUE)) {
+        size_t len = strlen(block->idstr);
+
+        *p++ = len;
+        memcpy(p, block->idstr, len);
+        p += len;
+    }
+    return p;
+}
+
+/* The equivalent of ram_save_page and save_xbzrle_page for every page of
+ * the job, using the thread's shard of the cache.  */
+static void xbzrle_save_job(XBZRLEParam *param)
+{
+    XBZRLEJob *job = &param->job;
+    RAMBlock *block = job->block;
+    XBZRLEStats *stats = &param->stats;
+    uint8_t *out = param->out;
+    ram_addr_t cont = 0;
+    int i;
+
+    for (i = 0; i < job->num; i++) {
+        ram_addr_t offset = job->offset[i];
+        uint64_t addr = xbzrle_shard_addr(block->offset + offset);
+        uint8_t *p = job->host + offset;
+        uint8_t *prev_cached_page, *start;
+        int encoded_len;
+
+        if (is_zero_range(p, TARGET_PAGE_SIZE)) {
+            stats->dup_pages++;
+            out = xbzrle_put_header(out, block,
+                                    offset | cont | RAM_SAVE_FLAG_COMPRESS);
+            *out++ = 0;
+            cont = RAM_SAVE_FLAG_CONTINUE;
+            /* see xbzrle_cache_zero_page */
+            cache_insert(param->cache, addr, ZERO_TARGET_PAGE, job->age);
+            continue;
         }
-        if (offset >= block->used_length) {
-            offset = 0;
-            block = QLIST_NEXT_RCU(block, next);
-            if (!block) {
-                block = QLIST_FIRST_RCU(&ram_list.blocks);
-                complete_round = true;
-                ram_bulk_stage = false;
-                if (migrate_use_xbzrle()) {
-                    /* If xbzrle is on, stop using the data compression at this
-                     * point. In theory, xbzrle can do better than compression.
-                     */
-                    flush_compressed_data(f);
-                    compression_switch = false;
-                }
+
+        if (!cache_is_cached(param->cache, addr, job->age)) {
+            stats->xbzrle_cache_miss++;
+            if (!job->last_stage &&
+                cache_insert(param->cache, addr, p, job->age) == 0) {
+                p = get_cached_data(param->cache, addr);
             }
         } else {
-            if (compression_switch && migrate_use_compression()) {
-                pages = ram_save_compressed_page(f, block, offset, last_stage,
-                                                 bytes_transferred);
-            } else {
-                pages = ram_save_page(f, block, offset, last_stage,
-                                      bytes_transferred);
+            prev_cached_page = get_cached_data(param->cache, addr);
+            memcpy(param->current_buf, p, TARGET_PAGE_SIZE);
+            encoded_len = xbzrle_encode_buffer(prev_cached_page,
+                                               param->current_buf,
+                                               TARGET_PAGE_SIZE,
+                                               param->encoded_buf,
+                                               TARGET_PAGE_SIZE);
+            if (encoded_len == 0) {
+                /* unmodified page */
+                continue;
             }
-
-            /* if page is unmodified, continue to the next */
-            if (pages > 0) {
-                last_sent_block = block;
-                break;
+            if (encoded_len > 0) {
+                if (!job->last_stage) {
+                    memcpy(prev_cached_page, param->current_buf,
+                           TARGET_PAGE_SIZE);
+                }
+                start = out;
+                out = xbzrle_put_header(out, block,
+                                        offset | cont | RAM_SAVE_FLAG_XBZRLE);
+                *out++ = ENCODING_FLAG_XBZRLE;
+                stw_be_p(out, encoded_len);
+                out += 2;
+                memcpy(out, param->encoded_buf, encoded_len);
+                out += encoded_len;
+                cont = RAM_SAVE_FLAG_CONTINUE;
+                stats->xbzrle_pages++;
+                stats->xbzrle_bytes += out - start;
+                continue;
+            }
+            stats->xbzrle_overflows++;
+            if (!job->last_stage) {
+                memcpy(prev_cached_page, p, TARGET_PAGE_SIZE);
+                p = prev_cached_page;
             }
         }
-    }
 
-    last_seen_block = block;
-    last_offset = offset;
-
-    return pages;
+        /* cache miss or overflow, send the whole page */
+        out = xbzrle_put_header(out, block,
+                                offset | cont | RAM_SAVE_FLAG_PAGE);
+        memcpy(out, p, TARGET_PAGE_SIZE);
+        out += TARGET_PAGE_SIZE;
+        cont = RAM_SAVE_FLAG_CONTINUE;
+        stats->norm_pages++;
+    }
+    param->out_len = out - param->out;
 }
 
-void acct_update_position(QEMUFile *f, size_t size, bool zero)
+static void *do_xbzrle_thread(void *opaque)
 {
-    uint64_t pages = size / TARGET_PAGE_SIZE;
-    if (zero) {
-        acct_info.dup_pages += pages;
-    } else {
-        acct_info.norm_pages += pages;
-        bytes_transferred += size;
-        qemu_update_position(f, size);
+    XBZRLEParam *param = opaque;
+
+    qemu_mutex_lock(&param->mutex);
+    while (true) {
+        while (!param->start && !param->quit) {
+            qemu_cond_wait(&param->cond, &param->mutex);
+        }
+        if (param->quit) {
+            break;
+        }
+        param->start = false;
+        qemu_mutex_unlock(&param->mutex);
+
+        xbzrle_save_job(param);
+
+        qemu_mutex_lock(&XBZRLE.done_lock);
+        param->done = true;
+        qemu_cond_signal(&XBZRLE.done_cond);
+        qemu_mutex_unlock(&XBZRLE.done_lock);
+
+        qemu_mutex_lock(&param->mutex);
     }
-}
+    qemu_mutex_unlock(&param->mutex);
 
-static ram_addr_t ram_save_remaining(void)
-{
-    return migration_dirty_pages;
+    return NULL;
 }
 
-uint64_t ram_bytes_remaining(void)
+/* Wait until thread @idx is idle, and put the output of its last job on
+ * the stream.  */
+static void xbzrle_thread_collect(QEMUFile *f, int idx)
 {
-    return ram_save_remaining() * TARGET_PAGE_SIZE;
-}
+    XBZRLEParam *param = &XBZRLE.params[idx];
+    XBZRLEStats *stats = &param->stats;
 
-uint64_t ram_bytes_transferred(void)
-{
-    return bytes_transferred;
+    qemu_mutex_lock(&XBZRLE.done_lock);
+    while (!param->done) {
+        qemu_cond_wait(&XBZRLE.done_cond, &XBZRLE.done_lock);
+    }
+    qemu_mutex_unlock(&XBZRLE.done_lock);
+
+    if (param->out_len) {
+        qemu_put_buffer(f, param->out, param->out_len);
+        bytes_transferred += param->out_len;
+        param->out_len = 0;
+    }
+    acct_info.dup_pages += stats->dup_pages;
+    acct_info.norm_pages += stats->norm_pages;
+    acct_info.xbzrle_bytes += stats->xbzrle_bytes;
+    acct_info.xbzrle_pages += stats->xbzrle_pages;
+    acct_info.xbzrle_cache_miss += stats->xbzrle_cache_miss;
+    acct_info.xbzrle_overflows += stats->xbzrle_overflows;
+    memset(stats, 0, sizeof(*stats));
 }
 
-uint64_t ram_bytes_total(void)
+static void xbzrle_thread_start(QEMUFile *f, int idx)
 {
-    RAMBlock *block;
-    uint64_t total = 0;
+    XBZRLEParam *param = &XBZRLE.params[idx];
+    XBZRLEJob *job = &XBZRLE.pending[idx];
 
-    rcu_read_lock();
-    QLIST_FOREACH_RCU(block, &ram_list.blocks, next)
-        total += block->used_length;
-    rcu_read_unlock();
-    return total;
+    xbzrle_thread_collect(f, idx);
+    param->job = *job;
+    param->done = false;
+    job->num = 0;
+
+    qemu_mutex_lock(&param->mutex);
+    param->start = true;
+    qemu_cond_signal(&param->cond);
+    qemu_mutex_unlock(&param->mutex);
 }
 
-void free_xbzrle_decoded_buf(void)
+/**
+ * ram_save_xbzrle_threaded: queue a page for its xbzrle thread
+ *
+ * Returns: Number of pages written.
+ *
+ * @f: QEMUFile where to send the data
+ * @block: block that contains the page we want to send
+ * @offset: offset inside the block for the page
+ * @last_stage: if we are at the completion stage
+ * @bytes_transferred: increase it with the number of transferred bytes
+ */
+static int ram_save_xbzrle_threaded(QEMUFile *f, RAMBlock *block,
+                                    ram_addr_t offset, bool last_stage,
+                                    uint64_t *bytes_transferred)
 {
-    g_free(xbzrle_decoded_buf);
-    xbzrle_decoded_buf = NULL;
+    int idx = xbzrle_shard(block->offset + offset);
+    XBZRLEJob *job = &XBZRLE.pending[idx];
+    uint64_t bytes_xmit = 0;
+    int ret;
+
+    /* As in ram_save_page(), a transport with its own save_page hook
+     * (e.g. RDMA) sends the page itself and the threads never see it.
+     */
+    ret = ram_control_save_page(f, block->offset,
+                                offset, TARGET_PAGE_SIZE, &bytes_xmit);
+    if (ret != RAM_SAVE_CONTROL_NOT_SUPP) {
+        if (bytes_xmit) {
+            *bytes_transferred += bytes_xmit;
+        }
+        if (ret != RAM_SAVE_CONTROL_DELAYED) {
+            if (bytes_xmit > 0) {
+                acct_info.norm_pages++;
+            } else if (bytes_xmit == 0) {
+                acct_info.dup_pages++;
+            }
+        }
+        return 1;
+    }
+
+    if (job->num &&
+        (job->block != block || job->num == XBZRLE_JOB_PAGES)) {
+        xbzrle_thread_start(f, idx);
+    }
+    if (!job->num) {
+        job->block = block;
+        job->host = memory_region_get_ram_ptr(block->mr);
+    }
+    job->last_stage = last_stage;
+    job->age = bitmap_sync_count;
+    job->offset[job->num++] = offset;
+    return 1;
 }
 
-static void migration_end(void)
+/* Send the queued pages and wait for all xbzrle threads to finish */
+static void flush_xbzrle_threads(QEMUFile *f)
 {
-    /* caller have hold iothread lock or is in a bh, so there is
-     * no writing race against this migration_bitmap
-     */
-    unsigned long *bitmap = migration_bitmap;
-    atomic_rcu_set(&migration_bitmap, NULL);
-    if (bitmap) {
-        memory_global_dirty_log_stop();
-        synchronize_rcu();
-        g_free(bitmap);
+    int idx;
+
+    if (!XBZRLE.params) {
+        return;
+    }
+    for (idx = 0; idx < XBZRLE.threads; idx++) {
+        if (XBZRLE.pending[idx].num) {
+            xbzrle_thread_start(f, idx);
+        }
     }
+    for (idx = 0; idx < XBZRLE.threads; idx++) {
+        xbzrle_thread_collect(f, idx);
+    }
+    /* The jobs may have changed the block that the destination will use
+     * for a RAM_SAVE_FLAG_CONTINUE page.  */
+    last_sent_block = NULL;
 
+    /* The threads are idle, so the shards can be resized now */
     XBZRLE_cache_lock();
-    if (XBZRLE.cache) {
-        cache_fini(XBZRLE.cache);
-        g_free(XBZRLE.encoded_buf);
-        g_free(XBZRLE.current_buf);
-        XBZRLE.cache = NULL;
-        XBZRLE.encoded_buf = NULL;
-        XBZRLE.current_buf = NULL;
+    if (XBZRLE.new_cache_size) {
+        int64_t pages = XBZRLE.new_cache_size / TARGET_PAGE_SIZE /
+                        XBZRLE.threads;
+
+        for (idx = 0; idx < XBZRLE.threads; idx++) {
+            if (cache_resize(XBZRLE.params[idx].cache, MAX(pages, 1)) < 0) {
+                error_report("Error resizing cache");
+            }
+        }
+        XBZRLE.new_cache_size = 0;
     }
     XBZRLE_cache_unlock();
 }
 
-static void ram_migration_cancel(void *opaque)
+static void xbzrle_threads_free(void)
 {
-    migration_end();
+    int idx;
+
+    for (idx = 0; idx < XBZRLE.threads; idx++) {
+        XBZRLEParam *param = &XBZRLE.params[idx];
+
+        if (param->cache) {
+            cache_fini(param->cache);
+        }
+        g_free(param->current_buf);
+        g_free(param->encoded_buf);
+        g_free(param->out);
+    }
+    qemu_mutex_destroy(&XBZRLE.done_lock);
+    qemu_cond_destroy(&XBZRLE.done_cond);
+    g_free(XBZRLE.params);
+    g_free(XBZRLE.pending);
+    XBZRLE.params = NULL;
+    XBZRLE.pending = NULL;
+    XBZRLE.threads = 0;
+    XBZRLE.new_cache_size = 0;
 }
 
-static void reset_ram_globals(void)
+/* Called with XBZRLE.lock held */
+static int xbzrle_threads_create(void)
 {
-    last_seen_block = NULL;
+    int idx, threads = migrate_xbzrle_threads();
+    int64_t pages = migrate_xbzrle_cache_size() / TARGET_PAGE_SIZE / threads;
+
+    XBZRLE.threads = threads;
+    XBZRLE.params = g_new0(XBZRLEParam, threads);
+    XBZRLE.pending = g_new0(XBZRLEJob, threads);
+    qemu_mutex_init(&XBZRLE.done_lock);
+    qemu_cond_init(&XBZRLE.done_cond);
+
+    /* We prefer not to abort if there is no memory */
+    for (idx = 0; idx < threads; idx++) {
+        XBZRLEParam *param = &XBZRLE.params[idx];
+
+        param->cache = cache_init(MAX(pages, 1), TARGET_PAGE_SIZE);
+        param->current_buf = g_try_malloc(TARGET_PAGE_SIZE);
+        param->encoded_buf = g_try_malloc(TARGET_PAGE_SIZE);
+        param->out = g_try_malloc(XBZRLE_JOB_PAGES * XBZRLE_RECORD_MAX);
+        if (!param->cache || !param->current_buf || !param->encoded_buf ||
+            !param->out) {
+            xbzrle_threads_free();
+            return -1;
+        }
+    }
+
+    for (idx = 0; idx < threads; idx++) {
+        XBZRLEParam *param = &XBZRLE.params[idx];
+
+        param->done = true;
+        qemu_mutex_init(&param->mutex);
+        qemu_cond_init(&param->cond);
+        qemu_thread_create(&param->thread, "xbzrle", do_xbzrle_thread,
+                           param, QEMU_THREAD_JOINABLE);
+    }
+    return 0;
+}
+
+/* Called with XBZRLE.lock held */
+static void xbzrle_threads_join(void)
+{
+    int idx;
+
+    for (idx = 0; idx < XBZRLE.threads; idx++) {
+        XBZRLEParam *param = &XBZRLE.params[idx];
+
+        qemu_mutex_lock(&param->mutex);
+        param->quit = true;
+        qemu_cond_signal(&param->cond);
+        qemu_mutex_unlock(&param->mutex);
+    }
+    for (idx = 0; idx < XBZRLE.threads; idx++) {
+        XBZRLEParam *param = &XBZRLE.params[idx];
+
+        qemu_thread_join(&param->thread);
+        qemu_mutex_destroy(&param->mutex);
+        qemu_cond_destroy(&param->cond);
+    }
+    xbzrle_threads_free();
+}
+
+/* Multiple fd migration
+ *
+ * With the multifd capability RAM pages do not go through the main
+ * stream.  The migration thread collects runs of dirty pages from one
+ * RAMBlock and hands each run to an idle channel; every channel has its
+ * own connection and its own thread on both sides.  At the end of each
+ * iteration every channel sends a sync packet and the main stream gets a
+ * RAM_SAVE_FLAG_MULTIFD_SYNC marker; the destination does not go past the
+ * marker until all channels have delivered their sync packet, so a page
+ * sent again in the next iteration can never be overwritten by its older
+ * copy travelling on another channel.
+ */
+
+#define MULTIFD_MAGIC 0x11223344U
+#define MULTIFD_VERSION 2
+#define MULTIFD_PAGES_PER_PACKET 128
+
+#define MULTIFD_FLAG_SYNC 0x1
+/* Set in the (page aligned) offset of a page that is all zeroes; the
+ * page data is not sent.  */
+#define MULTIFD_PAGE_ZERO 0x1
+
+/* Sent once when a channel is opened; count is the number of channels
+ * that the source opens.  */
+typedef struct QEMU_PACKED {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t id;
+    uint32_t count;
+} MultiFDInit;
+
+/* Followed by num big-endian offsets, then the data of the non-zero pages */
+typedef struct QEMU_PACKED {
+    uint32_t magic;
+    uint32_t flags;
+    uint32_t num;
+    char idstr[256];
+} MultiFDPacket;
+
+typedef struct MultiFDPages {
+    RAMBlock *block;
+    /* looked up by the migration thread, which holds the RCU read lock */
+    uint8_t *host;
+    int num;
+    ram_addr_t offset[MULTIFD_PAGES_PER_PACKET];
+} MultiFDPages;
+
+typedef struct MultiFDSendParam {
+    int id;
+    QemuThread thread;
+    /* protects fd, start and quit */
+    QemuMutex mutex;
+    QemuCond cond;
+    int fd;
+    bool start;
+    bool quit;
+    /* protected by multifd_send_state->done_lock */
+    bool done;
+    /* owned by the channel thread while it is not done */
+    bool sync;
+    MultiFDPages pages;
+    MultiFDPacket packet;
+    uint64_t wire_offset[MULTIFD_PAGES_PER_PACKET];
+    struct iovec iov[MULTIFD_PAGES_PER_PACKET + 2];
+} MultiFDSendParam;
+
+typedef struct MultiFDSendState {
+    MultiFDSendParam *params;
+    int count;
+    /* done_cond is signalled when a channel becomes idle or fails */
+    QemuMutex done_lock;
+    QemuCond done_cond;
+    bool error;
+    /* bytes sent by all channels, and how many of them have already been
+     * credited to the main stream by the migration thread */
+    uint64_t bytes;
+    uint64_t bytes_credited;
+    int next;
+    /* pages collected by the migration thread, not yet handed out */
+    MultiFDPages pending;
+} MultiFDSendState;
+
+static MultiFDSendState *multifd_send_state;
+
+static void multifd_send_set_error(void)
+{
+    qemu_mutex_lock(&multifd_send_state->done_lock);
+    multifd_send_state->error = true;
+    qemu_cond_broadcast(&multifd_send_state->done_cond);
+    qemu_mutex_unlock(&multifd_send_state->done_lock);
+}
+
+static int multifd_send_packet(MultiFDSendParam *p)
+{
+    MultiFDPages *pages = &p->pages;
+    uint64_t zero = 0, normal = 0;
+    uint8_t *base = NULL;
+    int i, iovcnt = 2;
+    size_t len;
+
+    memset(&p->packet, 0, sizeof(p->packet));
+    p->packet.magic = cpu_to_be32(MULTIFD_MAGIC);
+    p->packet.flags = cpu_to_be32(p->sync ? MULTIFD_FLAG_SYNC : 0);
+    p->packet.num = cpu_to_be32(pages->num);
+    if (pages->num) {
+        pstrcpy(p->packet.idstr, sizeof(p->packet.idstr), pages->block->idstr);
+        base = pages->host;
+    }
+
+    for (i = 0; i < pages->num; i++) {
+        uint64_t offset = pages->offset[i];
+        uint8_t *page = base + offset;
+
+        if (is_zero_range(page, TARGET_PAGE_SIZE)) {
+            offset |= MULTIFD_PAGE_ZERO;
+            zero++;
+        } else {
+            p->iov[iovcnt].iov_base = page;
+            p->iov[iovcnt].iov_len = TARGET_PAGE_SIZE;
+            iovcnt++;
+            normal++;
+        }
+        p->wire_offset[i] = cpu_to_be64(offset);
+    }
+    p->iov[0].iov_base = &p->packet;
+    p->iov[0].iov_len = sizeof(p->packet);
+    p->iov[1].iov_base = p->wire_offset;
+    p->iov[1].iov_len = pages->num * sizeof(p->wire_offset[0]);
+
+    len = iov_size(p->iov, iovcnt);
+    if (iov_send(p->fd, p->iov, iovcnt, 0, len) != len) {
+        return -1;
+    }
+
+    atomic_add(&acct_info.dup_pages, zero);
+    atomic_add(&acct_info.norm_pages, normal);
+    atomic_add(&multifd_send_state->bytes, len);
+    p->sync = false;
+    pages->num = 0;
+    return 0;
+}
+
+static void *multifd_send_thread(void *opaque)
+{
+    MultiFDSendParam *p = opaque;
+    Error *local_err = NULL;
+    MultiFDInit init;
+    struct iovec iov;
+    bool quit;
+    int fd;
+
+    fd = migrate_multifd_connect(&local_err);
+    if (fd < 0) {
+        error_report_err(local_err);
+        goto out_error;
+    }
+    qemu_mutex_lock(&p->mutex);
+    p->fd = fd;
+    qemu_mutex_unlock(&p->mutex);
+
+    init.magic = cpu_to_be32(MULTIFD_MAGIC);
+    init.version = cpu_to_be32(MULTIFD_VERSION);
+    init.id = cpu_to_be32(p->id);
+    init.count = cpu_to_be32(multifd_send_state->count);
+    iov.iov_base = &init;
+    iov.iov_len = sizeof(init);
+    if (iov_send(fd, &iov, 1, 0, sizeof(init)) != sizeof(init)) {
+        goto out_send_error;
+    }
+
+    while (true) {
+        qemu_mutex_lock(&multifd_send_state->done_lock);
+        p->done = true;
+        qemu_cond_signal(&multifd_send_state->done_cond);
+        qemu_mutex_unlock(&multifd_send_state->done_lock);
+
+        qemu_mutex_lock(&p->mutex);
+        while (!p->start && !p->quit) {
+            qemu_cond_wait(&p->cond, &p->mutex);
+        }
+        p->start = false;
+        quit = p->quit;
+        qemu_mutex_unlock(&p->mutex);
+        if (quit) {
+            return NULL;
+        }
+
+        if (multifd_send_packet(p) < 0) {
+            goto out_send_error;
+        }
+    }
+
+out_send_error:
+    if (!atomic_read(&p->quit)) {
+        error_report("multifd channel %d: %s", p->id, strerror(errno));
+    }
+out_error:
+    multifd_send_set_error();
+    return NULL;
+}
+
+static void multifd_start_channel(MultiFDSendParam *p)
+{
+    qemu_mutex_lock(&p->mutex);
+    p->start = true;
+    qemu_cond_signal(&p->cond);
+    qemu_mutex_unlock(&p->mutex);
+}
+
+/* Wait until channel P is idle; if CLAIM, take it for the migration
+ * thread.  */
+static int multifd_wait_channel(QEMUFile *f, MultiFDSendParam *p, bool claim)
+{
+    qemu_mutex_lock(&multifd_send_state->done_lock);
+    while (!p->done && !multifd_send_state->error) {
+        qemu_cond_wait(&multifd_send_state->done_cond,
+                       &multifd_send_state->done_lock);
+    }
+    if (claim) {
+        p->done = false;
+    }
+    qemu_mutex_unlock(&multifd_send_state->done_lock);
+
+    if (multifd_send_state->error) {
+        qemu_file_set_error(f, -EIO);
+        return -1;
+    }
+    return 0;
+}
+
+/* Account the bytes sent by the channels to the main stream, so that rate
+ * limiting and the bandwidth estimate take them into account.  */
+static void multifd_credit_transfer(QEMUFile *f)
+{
+    uint64_t sent = atomic_read(&multifd_send_state->bytes);
+    uint64_t delta = sent - multifd_send_state->bytes_credited;
+
+    multifd_send_state->bytes_credited = sent;
+    bytes_transferred += delta;
+    qemu_file_credit_transfer(f, delta);
+}
+
+/* Hand the pending pages to the next idle channel */
+static int multifd_send_pending(QEMUFile *f)
+{
+    MultiFDSendParam *p = NULL;
+    int i, count = multifd_send_state->count;
+
+    qemu_mutex_lock(&multifd_send_state->done_lock);
+    while (!multifd_send_state->error) {
+        for (i = 0; i < count; i++) {
+            int idx = (multifd_send_state->next + i) % count;
+
+            if (multifd_send_state->params[idx].done) {
+                p = &multifd_send_state->params[idx];
+                multifd_send_state->next = idx + 1;
+                break;
+            }
+        }
+        if (p) {
+            p->done = false;
+            break;
+        }
+        qemu_cond_wait(&multifd_send_state->done_cond,
+                       &multifd_send_state->done_lock);
+    }
+    qemu_mutex_unlock(&multifd_send_state->done_lock);
+
+    if (!p) {
+        multifd_send_state->pending.num = 0;
+        qemu_file_set_error(f, -EIO);
+        return -1;
+    }
+
+    p->pages = multifd_send_state->pending;
+    multifd_send_state->pending.num = 0;
+    multifd_start_channel(p);
+    multifd_credit_transfer(f);
+    return 0;
+}
+
+/**
+ * ram_save_multifd_page: queue the given page for a multifd channel
+ *
+ * Returns: Number of pages queued.  Errors are reported through @f.
+ *
+ * @f: QEMUFile where to send the data
+ * @block: block that contains the page we want to send
+ * @offset: offset inside the block for the page
+ */
+static int ram_save_multifd_page(QEMUFile *f, RAMBlock *block,
+                                 ram_addr_t offset)
+{
+    MultiFDPages *pending = &multifd_send_state->pending;
+
+    if (pending->num &&
+        (pending->block != block ||
+         pending->num == MULTIFD_PAGES_PER_PACKET)) {
+        multifd_send_pending(f);
+    }
+    if (!pending->num) {
+        pending->block = block;
+        pending->host = memory_region_get_ram_ptr(block->mr);
+    }
+    pending->offset[pending->num++] = offset;
+    return 1;
+}
+
+/* Flush the pending pages and send a sync packet on every channel, then
+ * put the sync marker on the main stream.  */
+static void multifd_send_sync_main(QEMUFile *f)
+{
+    int i;
+
+    if (!migrate_use_multifd()) {
+        return;
+    }
+    if (multifd_send_state->pending.num && multifd_send_pending(f) < 0) {
+        return;
+    }
+    for (i = 0; i < multifd_send_state->count; i++) {
+        MultiFDSendParam *p = &multifd_send_state->params[i];
+
+        if (multifd_wait_channel(f, p, true) < 0) {
+            return;
+        }
+        p->pages.num = 0;
+        p->sync = true;
+        multifd_start_channel(p);
+    }
+    /* Wait for the sync packets to be on the wire before the marker */
+    for (i = 0; i < multifd_send_state->count; i++) {
+        MultiFDSendParam *p = &multifd_send_state->params[i];
+
+        if (multifd_wait_channel(f, p, false) < 0) {
+            return;
+        }
+    }
+    multifd_credit_transfer(f);
+
+    qemu_put_be64(f, RAM_SAVE_FLAG_MULTIFD_SYNC);
+    bytes_transferred += 8;
+}
+
+void migrate_multifd_send_threads_create(void)
+{
+    int i, thread_count;
+
+    if (!migrate_use_multifd()) {
+        return;
+    }
+    thread_count = migrate_multifd_channels();
+    multifd_send_state = g_new0(MultiFDSendState, 1);
+    multifd_send_state->params = g_new0(MultiFDSendParam, thread_count);
+    multifd_send_state->count = thread_count;
+    qemu_mutex_init(&multifd_send_state->done_lock);
+    qemu_cond_init(&multifd_send_state->done_cond);
+    for (i = 0; i < thread_count; i++) {
+        MultiFDSendParam *p = &multifd_send_state->params[i];
+
+        p->id = i;
+        p->fd = -1;
+        qemu_mutex_init(&p->mutex);
+        qemu_cond_init(&p->cond);
+        qemu_thread_create(&p->thread, "multifd_send",
+                           multifd_send_thread, p, QEMU_THREAD_JOINABLE);
+    }
+}
+
+/* Unblock channels stuck in a send, e.g. when the migration is cancelled */
+void migrate_multifd_send_shutdown(void)
+{
+    int i;
+
+    if (!multifd_send_state) {
+        return;
+    }
+    for (i = 0; i < multifd_send_state->count; i++) {
+        MultiFDSendParam *p = &multifd_send_state->params[i];
+
+        qemu_mutex_lock(&p->mutex);
+        if (p->fd >= 0) {
+            shutdown(p->fd, SHUT_RDWR);
+        }
+        qemu_mutex_unlock(&p->mutex);
+    }
+    multifd_send_set_error();
+}
+
+void migrate_multifd_send_threads_join(void)
+{
+    int i;
+
+    if (!multifd_send_state) {
+        return;
+    }
+    for (i = 0; i < multifd_send_state->count; i++) {
+        MultiFDSendParam *p = &multifd_send_state->params[i];
+
+        qemu_mutex_lock(&p->mutex);
+        p->quit = true;
+        if (p->fd >= 0) {
+            shutdown(p->fd, SHUT_RDWR);
+        }
+        qemu_cond_signal(&p->cond);
+        qemu_mutex_unlock(&p->mutex);
+    }
+    for (i = 0; i < multifd_send_state->count; i++) {
+        MultiFDSendParam *p = &multifd_send_state->params[i];
+
+        qemu_thread_join(&p->thread);
+        if (p->fd >= 0) {
+            closesocket(p->fd);
+        }
+        qemu_mutex_destroy(&p->mutex);
+        qemu_cond_destroy(&p->cond);
+    }
+    qemu_mutex_destroy(&multifd_send_state->done_lock);
+    qemu_cond_destroy(&multifd_send_state->done_cond);
+    g_free(multifd_send_state->params);
+    g_free(multifd_send_state);
+    multifd_send_state = NULL;
+}
+
+/* Mapped RAM: pages go to the RAM file at their ram_addr_t offset */
+
+/* Contiguous dirty pages are written to the RAM file with a single call */
+#define MAPPED_RAM_MAX_RUN (1 << 20)
+
+static struct {
+    RAMBlock *block;
+    ram_addr_t start;
+    ram_addr_t len;
+} mapped_ram_run;
+
+static void mapped_ram_flush(QEMUFile *f)
+{
+    RAMBlock *block = mapped_ram_run.block;
+    ram_addr_t len = mapped_ram_run.len;
+    int ret;
+
+    if (!len) {
+        return;
+    }
+    mapped_ram_run.len = 0;
+    ret = mapped_ram_write(memory_region_get_ram_ptr(block->mr) +
+                           mapped_ram_run.start, len,
+                           block->offset + mapped_ram_run.start);
+    if (ret < 0) {
+        error_report("failed to write RAM file: %s", strerror(-ret));
+        qemu_file_set_error(f, ret);
+        return;
+    }
+    bytes_transferred += len;
+    qemu_file_credit_transfer(f, len);
+}
+
+/**
+ * ram_save_mapped_page: queue a page for the RAM file
+ *
+ * Returns: Number of pages written.
+ *
+ * @f: QEMUFile where to send the data
+ * @block: block that contains the page we want to send
+ * @offset: offset inside the block for the page
+ */
+static int ram_save_mapped_page(QEMUFile *f, RAMBlock *block,
+                                ram_addr_t offset)
+{
+    uint8_t *p = memory_region_get_ram_ptr(block->mr) + offset;
+
+    /* The RAM file starts out sparse, so zero pages need not be written
+     * until they have been dirtied.  */
+    if (ram_bulk_stage && is_zero_range(p, TARGET_PAGE_SIZE)) {
+        acct_info.dup_pages++;
+        return 1;
+    }
+    acct_info.norm_pages++;
+
+    if (mapped_ram_run.len &&
+        (mapped_ram_run.block != block ||
+         mapped_ram_run.start + mapped_ram_run.len != offset ||
+         mapped_ram_run.len == MAPPED_RAM_MAX_RUN)) {
+        mapped_ram_flush(f);
+    }
+    if (!mapped_ram_run.len) {
+        mapped_ram_run.block = block;
+        mapped_ram_run.start = offset;
+    }
+    mapped_ram_run.len += TARGET_PAGE_SIZE;
+    return 1;
+}
+
+/* Map or read the RAM file over each RAMBlock listed in the stream */
+static int ram_load_mapped(QEMUFile *f)
+{
+    int ret = 0;
+
+    while (!ret) {
+        RAMBlock *block;
+        char id[256];
+        uint64_t file_offset, length;
+        void *host;
+        bool can_map;
+        int len;
+
+        len = qemu_get_byte(f);
+        if (!len) {
+            break;
+        }
+        qemu_get_buffer(f, (uint8_t *)id, len);
+        id[len] = 0;
+        file_offset = qemu_get_be64(f);
+        length = qemu_get_be64(f);
+
+        QLIST_FOREACH_RCU(block, &ram_list.blocks, next) {
+            if (!strncmp(id, block->idstr, sizeof(id))) {
+                break;
+            }
+        }
+        if (!block || length > block->used_length) {
+            error_report("RAM file does not match ramblock \"%s\"", id);
+            return -EINVAL;
+        }
+
+        /* The RAM file may be mapped over the block, replacing its pages:
+         * let users of the old pages, such as io_uring registered buffers,
+         * drop them first.  */
+        host = memory_region_get_ram_ptr(block->mr);
+        can_map = qemu_ram_is_anonymous(block);
+        if (can_map) {
+            ram_block_notify_remove(host, block->max_length);
+        }
+        ret = mapped_ram_load(host, length, file_offset, can_map);
+        if (can_map) {
+            /* Harmless if the file was read rather than mapped */
+            qemu_ram_advise_remapped(host, length);
+            ram_block_notify_add(host, block->max_length);
+        }
+        if (ret == -ENOENT) {
+            error_report("migration stream has mapped RAM, it must be "
+                         "restored with -incoming file:");
+        } else if (ret < 0) {
+            error_report("failed to load ramblock \"%s\" from RAM file: %s",
+                         id, strerror(-ret));
+        }
+    }
+    return ret;
+}
+
+/**
+ * ram_find_and_save_block: Finds a dirty page and sends it to f
+ *
+ * Called within an RCU critical section.
+ *
+ * Returns:  The number of pages written
+ *           0 means no dirty pages
+ *
+ * @f: QEMUFile where to send the data
+ * @last_stage: if we are at the completion stage
+ * @bytes_transferred: increase it with the number of transferred bytes
+ */
+
+static int ram_find_and_save_block(QEMUFile *f, bool last_stage,
+                                   uint64_t *bytes_transferred)
+{
+    RAMBlock *block = last_seen_block;
+    ram_addr_t offset = last_offset;
+    bool complete_round = false;
+    int pages = 0;
+    MemoryRegion *mr;
+
+    if (!block)
+        block = QLIST_FIRST_RCU(&ram_list.blocks);
+
+    while (true) {
+        mr = block->mr;
+        offset = migration_bitmap_find_and_reset_dirty(mr, offset);
+        if (complete_round && block == last_seen_block &&
+            offset >= last_offset) {
+            break;
+        }
+        if (offset >= block->used_length) {
+            offset = 0;
+            block = QLIST_NEXT_RCU(block, next);
+            if (!block) {
+                block = QLIST_FIRST_RCU(&ram_list.blocks);
+                complete_round = true;
+                ram_bulk_stage = false;
+                if (migrate_use_xbzrle()) {
+                    /* If xbzrle is on, stop using the data compression at this
+                     * point. In theory, xbzrle can do better than compression.
+                     */
+                    flush_compressed_data(f);
+                    compression_switch = false;
+                }
+            }
+        } else {
+            if (migrate_use_multifd()) {
+                pages = ram_save_multifd_page(f, block, offset);
+            } else if (migrate_use_mapped_ram()) {
+                pages = ram_save_mapped_page(f, block, offset);
+            } else if (!ram_bulk_stage && XBZRLE.params) {
+                pages = ram_save_xbzrle_threaded(f, block, offset,
+                                                 last_stage,
+                                                 bytes_transferred);
+            } else if (compression_switch && migrate_use_compression()) {
+                pages = ram_save_compressed_page(f, block, offset, last_stage,
+                                                 bytes_transferred);
+            } else {
+                pages = ram_save_page(f, block, offset, last_stage,
+                                      bytes_transferred);
+            }
+
+            /* if page is unmodified, continue to the next */
+            if (pages > 0) {
+                last_sent_block = block;
+                break;
+            }
+        }
+    }
+
+    last_seen_block = block;
+    last_offset = offset;
+
+    return pages;
+}
+
+void acct_update_position(QEMUFile *f, size_t size, bool zero)
+{
+    uint64_t pages = size / TARGET_PAGE_SIZE;
+    if (zero) {
+        acct_info.dup_pages += pages;
+    } else {
+        acct_info.norm_pages += pages;
+        bytes_transferred += size;
+        qemu_update_position(f, size);
+    }
+}
+
+static ram_addr_t ram_save_remaining(void)
+{
+    return migration_dirty_pages;
+}
+
+uint64_t ram_bytes_remaining(void)
+{
+    return ram_save_remaining() * TARGET_PAGE_SIZE;
+}
+
+uint64_t ram_bytes_transferred(void)
+{
+    return bytes_transferred;
+}
+
+uint64_t ram_bytes_total(void)
+{
+    RAMBlock *block;
+    uint64_t total = 0;
+
+    rcu_read_lock();
+    QLIST_FOREACH_RCU(block, &ram_list.blocks, next)
+        total += block->used_length;
+    rcu_read_unlock();
+    return total;
+}
+
+void free_xbzrle_decoded_buf(void)
+{
+    g_free(xbzrle_decoded_buf);
+    xbzrle_decoded_buf = NULL;
+}
+
+static void migration_end(void)
+{
+    /* caller have hold iothread lock or is in a bh, so there is
+     * no writing race against this migration_bitmap
+     */
+    unsigned long *bitmap = migration_bitmap;
+    atomic_rcu_set(&migration_bitmap, NULL);
+    cpu_throttle_stop();
+    if (bitmap) {
+        memory_global_dirty_log_stop();
+        synchronize_rcu();
+        g_free(bitmap);
+    }
+
+    XBZRLE_cache_lock();
+    if (XBZRLE.cache) {
+        cache_fini(XBZRLE.cache);
+        g_free(XBZRLE.encoded_buf);
+        g_free(XBZRLE.current_buf);
+        XBZRLE.cache = NULL;
+        XBZRLE.encoded_buf = NULL;
+        XBZRLE.current_buf = NULL;
+    }
+    if (XBZRLE.params) {
+        xbzrle_threads_join();
+    }
+    XBZRLE_cache_unlock();
+}
+
+static void ram_migration_cancel(void *opaque)
+{
+    migration_end();
+}
+
+static void reset_ram_globals(void)
+{
+    last_seen_block = NULL;
     last_sent_block = NULL;
     last_offset = 0;
     last_version = ram_list.version;
@@ -1099,15 +2202,25 @@ void migration_bitmap_extend(ram_addr_t old, ram_addr_t new)
 static int ram_save_setup(QEMUFile *f, void *opaque)
 {
     RAMBlock *block;
+    CPUState *cpu;
     int64_t ram_bitmap_pages; /* Size of bitmap in pages, including gaps */
 
-    mig_throttle_on = false;
     dirty_rate_high_cnt = 0;
     bitmap_sync_count = 0;
     migration_bitmap_sync_init();
     qemu_mutex_init(&migration_bitmap_mutex);
 
-    if (migrate_use_xbzrle()) {
+    if (migrate_use_xbzrle() && migrate_xbzrle_threads() > 1) {
+        XBZRLE_cache_lock();
+        if (xbzrle_threads_create() < 0) {
+            XBZRLE_cache_unlock();
+            error_report("Error creating xbzrle threads");
+            return -1;
+        }
+        XBZRLE_cache_unlock();
+
+        acct_clear();
+    } else if (migrate_use_xbzrle()) {
         XBZRLE_cache_lock();
         XBZRLE.cache = cache_init(migrate_xbzrle_cache_size() /
                                   TARGET_PAGE_SIZE,
@@ -1154,6 +2267,10 @@ static int ram_save_setup(QEMUFile *f, void *opaque)
      */
     migration_dirty_pages = ram_bytes_total() >> TARGET_PAGE_BITS;
 
+    CPU_FOREACH(cpu) {
+        cpu->dirty_pages = 0;
+        cpu->dirty_pages_rate = 0;
+    }
     memory_global_dirty_log_start();
     migration_bitmap_sync();
     qemu_mutex_unlock_ramlist();
@@ -1167,6 +2284,25 @@ static int ram_save_setup(QEMUFile *f, void *opaque)
         qemu_put_be64(f, block->used_length);
     }
 
+    if (migrate_use_mapped_ram()) {
+        int ret = mapped_ram_truncate(last_ram_offset());
+
+        if (ret < 0) {
+            rcu_read_unlock();
+            error_report("failed to size RAM file: %s", strerror(-ret));
+            return ret;
+        }
+        mapped_ram_run.len = 0;
+        qemu_put_be64(f, RAM_SAVE_FLAG_MAPPED_RAM);
+        QLIST_FOREACH_RCU(block, &ram_list.blocks, next) {
+            qemu_put_byte(f, strlen(block->idstr));
+            qemu_put_buffer(f, (uint8_t *)block->idstr, strlen(block->idstr));
+            qemu_put_be64(f, block->offset);
+            qemu_put_be64(f, block->used_length);
+        }
+        qemu_put_byte(f, 0);
+    }
+
     rcu_read_unlock();
 
     ram_control_before_iterate(f, RAM_CONTROL_SETUP);
@@ -1206,7 +2342,6 @@ static int ram_save_iterate(QEMUFile *f, void *opaque)
         }
         pages_sent += pages;
         acct_info.iterations++;
-        check_guest_throttling();
         /* we want to check in the 1st loop, just in case it was the 1st time
            and we had to sync the dirty bitmap.
            qemu_get_clock_ns() is a bit expensive, so we only check each some
@@ -1223,6 +2358,9 @@ static int ram_save_iterate(QEMUFile *f, void *opaque)
         i++;
     }
     flush_compressed_data(f);
+    flush_xbzrle_threads(f);
+    multifd_send_sync_main(f);
+    mapped_ram_flush(f);
     rcu_read_unlock();
 
     /*
@@ -1265,6 +2403,9 @@ static int ram_save_complete(QEMUFile *f, void *opaque)
     }
 
     flush_compressed_data(f);
+    flush_xbzrle_threads(f);
+    multifd_send_sync_main(f);
+    mapped_ram_flush(f);
     ram_control_after_iterate(f, RAM_CONTROL_FINISH);
 
     rcu_read_unlock();
@@ -1466,6 +2607,266 @@ static void decompress_data_with_multi_threads(uint8_t *compbuf,
     }
 }
 
+typedef struct MultiFDRecvParam {
+    QemuThread thread;
+    /* protected by multifd_recv_state->mutex */
+    int fd;
+    /* posted by the main thread once it has seen the sync marker */
+    QemuSemaphore sem_sync;
+    MultiFDPacket packet;
+    uint64_t wire_offset[MULTIFD_PAGES_PER_PACKET];
+    struct iovec iov[MULTIFD_PAGES_PER_PACKET];
+} MultiFDRecvParam;
+
+typedef struct MultiFDRecvState {
+    MultiFDRecvParam *params;
+    int count;
+    int listen_fd;
+    /* protects quit and the channel fds */
+    QemuMutex mutex;
+    bool quit;
+    bool error;
+    /* posted by each channel on a sync packet, or when it goes away */
+    QemuSemaphore sem_sync;
+} MultiFDRecvState;
+
+static MultiFDRecvState *multifd_recv_state;
+
+static ssize_t multifd_recv_full(int fd, void *buf, size_t len)
+{
+    struct iovec iov = { .iov_base = buf, .iov_len = len };
+
+    return iov_recv(fd, &iov, 1, 0, len);
+}
+
+/* Returns 1 for a packet, 0 if the source closed the channel, -1 on error */
+static int multifd_recv_packet(MultiFDRecvParam *p)
+{
+    MultiFDPacket *packet = &p->packet;
+    RAMBlock *block;
+    uint8_t *base;
+    uint32_t num;
+    ssize_t ret;
+    int i, iovcnt = 0;
+
+    ret = multifd_recv_full(p->fd, packet, sizeof(*packet));
+    if (ret == 0) {
+        return 0;
+    }
+    if (ret != sizeof(*packet)) {
+        return -1;
+    }
+    num = be32_to_cpu(packet->num);
+    if (be32_to_cpu(packet->magic) != MULTIFD_MAGIC ||
+        num > MULTIFD_PAGES_PER_PACKET) {
+        error_report("multifd: bad packet header");
+        return -1;
+    }
+    if (!num) {
+        return 1;
+    }
+
+    ret = multifd_recv_full(p->fd, p->wire_offset,
+                            num * sizeof(p->wire_offset[0]));
+    if (ret != num * sizeof(p->wire_offset[0])) {
+        return -1;
+    }
+
+    packet->idstr[sizeof(packet->idstr) - 1] = 0;
+    rcu_read_lock();
+    QLIST_FOREACH_RCU(block, &ram_list.blocks, next) {
+        if (!strcmp(packet->idstr, block->idstr)) {
+            break;
+        }
+    }
+    if (!block) {
+        rcu_read_unlock();
+        error_report("multifd: can't find block %s", packet->idstr);
+        return -1;
+    }
+
+    base = memory_region_get_ram_ptr(block->mr);
+    for (i = 0; i < num; i++) {
+        uint64_t offset = be64_to_cpu(p->wire_offset[i]);
+        ram_addr_t addr = offset & TARGET_PAGE_MASK;
+
+        if (addr >= block->max_length ||
+            (offset & ~TARGET_PAGE_MASK & ~MULTIFD_PAGE_ZERO)) {
+            rcu_read_unlock();
+            error_report("multifd: illegal RAM offset %" PRIx64, offset);
+            return -1;
+        }
+        if (offset & MULTIFD_PAGE_ZERO) {
+            ram_handle_compressed(base + addr, 0, TARGET_PAGE_SIZE);
+        } else {
+            p->iov[iovcnt].iov_base = base + addr;
+            p->iov[iovcnt].iov_len = TARGET_PAGE_SIZE;
+            iovcnt++;
+        }
+    }
+    ret = iov_recv(p->fd, p->iov, iovcnt, 0, iovcnt * TARGET_PAGE_SIZE);
+    rcu_read_unlock();
+
+    return ret == iovcnt * TARGET_PAGE_SIZE ? 1 : -1;
+}
+
+static bool multifd_recv_init(int fd)
+{
+    MultiFDInit init;
+
+    if (multifd_recv_full(fd, &init, sizeof(init)) != sizeof(init) ||
+        be32_to_cpu(init.magic) != MULTIFD_MAGIC ||
+        be32_to_cpu(init.version) != MULTIFD_VERSION) {
+        error_report("multifd: bad channel header");
+        return false;
+    }
+    if (be32_to_cpu(init.count) != multifd_recv_state->count) {
+        error_report("multifd: source uses %u channels, but "
+                     "multifd-channels is %d here", be32_to_cpu(init.count),
+                     multifd_recv_state->count);
+        return false;
+    }
+    if (be32_to_cpu(init.id) >= multifd_recv_state->count) {
+        error_report("multifd: invalid channel id %u",
+                     be32_to_cpu(init.id));
+        return false;
+    }
+    return true;
+}
+
+static void *multifd_recv_thread(void *opaque)
+{
+    MultiFDRecvParam *p = opaque;
+    int fd, ret;
+
+    rcu_register_thread();
+
+    do {
+        fd = qemu_accept(multifd_recv_state->listen_fd, NULL, NULL);
+    } while (fd < 0 && errno == EINTR);
+    if (fd < 0) {
+        goto out;
+    }
+    qemu_set_block(fd);
+    qemu_mutex_lock(&multifd_recv_state->mutex);
+    if (multifd_recv_state->quit) {
+        closesocket(fd);
+        fd = -1;
+    }
+    p->fd = fd;
+    qemu_mutex_unlock(&multifd_recv_state->mutex);
+    if (fd < 0) {
+        goto out;
+    }
+
+    if (!multifd_recv_init(fd)) {
+        /* The other channels may never connect: make them give up too, so
+         * that the main stream sees the error at the next sync marker.  */
+        shutdown(multifd_recv_state->listen_fd, SHUT_RDWR);
+        goto out;
+    }
+
+    while ((ret = multifd_recv_packet(p)) > 0) {
+        if (be32_to_cpu(p->packet.flags) & MULTIFD_FLAG_SYNC) {
+            qemu_sem_post(&multifd_recv_state->sem_sync);
+            qemu_sem_wait(&p->sem_sync);
+            if (atomic_read(&multifd_recv_state->quit)) {
+                break;
+            }
+        }
+    }
+
+out:
+    /* Whatever the reason, a channel going away before the main stream is
+     * done means that the migration can't complete.  */
+    atomic_set(&multifd_recv_state->error, true);
+    qemu_sem_post(&multifd_recv_state->sem_sync);
+    rcu_unregister_thread();
+    return NULL;
+}
+
+/* Wait for every channel to reach the sync packet matching the marker just
+ * read from the main stream, then let them carry on.  */
+static int multifd_recv_sync_main(void)
+{
+    int i;
+
+    if (!multifd_recv_state) {
+        error_report("multifd stream received, but the multifd capability "
+                     "is not enabled");
+        return -EINVAL;
+    }
+    for (i = 0; i < multifd_recv_state->count; i++) {
+        qemu_sem_wait(&multifd_recv_state->sem_sync);
+    }
+    if (atomic_read(&multifd_recv_state->error)) {
+        return -EIO;
+    }
+    for (i = 0; i < multifd_recv_state->count; i++) {
+        qemu_sem_post(&multifd_recv_state->params[i].sem_sync);
+    }
+    return 0;
+}
+
+void migrate_multifd_recv_threads_create(int listen_fd)
+{
+    int i, thread_count;
+
+    thread_count = migrate_multifd_channels();
+    multifd_recv_state = g_new0(MultiFDRecvState, 1);
+    multifd_recv_state->params = g_new0(MultiFDRecvParam, thread_count);
+    multifd_recv_state->count = thread_count;
+    multifd_recv_state->listen_fd = listen_fd;
+    qemu_mutex_init(&multifd_recv_state->mutex);
+    qemu_sem_init(&multifd_recv_state->sem_sync, 0);
+    for (i = 0; i < thread_count; i++) {
+        MultiFDRecvParam *p = &multifd_recv_state->params[i];
+
+        p->fd = -1;
+        qemu_sem_init(&p->sem_sync, 0);
+        qemu_thread_create(&p->thread, "multifd_recv",
+                           multifd_recv_thread, p, QEMU_THREAD_JOINABLE);
+    }
+}
+
+void migrate_multifd_recv_threads_join(void)
+{
+    int i;
+
+    if (!multifd_recv_state) {
+        return;
+    }
+    qemu_mutex_lock(&multifd_recv_state->mutex);
+    multifd_recv_state->quit = true;
+    /* Wake up threads still waiting in accept() or recv() */
+    shutdown(multifd_recv_state->listen_fd, SHUT_RDWR);
+    for (i = 0; i < multifd_recv_state->count; i++) {
+        MultiFDRecvParam *p = &multifd_recv_state->params[i];
+
+        if (p->fd >= 0) {
+            shutdown(p->fd, SHUT_RDWR);
+        }
+        qemu_sem_post(&p->sem_sync);
+    }
+    qemu_mutex_unlock(&multifd_recv_state->mutex);
+
+    for (i = 0; i < multifd_recv_state->count; i++) {
+        MultiFDRecvParam *p = &multifd_recv_state->params[i];
+
+        qemu_thread_join(&p->thread);
+        if (p->fd >= 0) {
+            closesocket(p->fd);
+        }
+        qemu_sem_destroy(&p->sem_sync);
+    }
+    closesocket(multifd_recv_state->listen_fd);
+    qemu_mutex_destroy(&multifd_recv_state->mutex);
+    qemu_sem_destroy(&multifd_recv_state->sem_sync);
+    g_free(multifd_recv_state->params);
+    g_free(multifd_recv_state);
+    multifd_recv_state = NULL;
+}
+
 static int ram_load(QEMUFile *f, void *opaque, int version_id)
 {
     int flags = 0, ret = 0;
@@ -1582,6 +2983,12 @@ static int ram_load(QEMUFile *f, void *opaque, int version_id)
                 break;
             }
             break;
+        case RAM_SAVE_FLAG_MULTIFD_SYNC:
+            ret = multifd_recv_sync_main();
+            break;
+        case RAM_SAVE_FLAG_MAPPED_RAM:
+            ret = ram_load_mapped(f);
+            break;
         case RAM_SAVE_FLAG_EOS:
             /* normal exit */
             break;
@@ -1619,52 +3026,3 @@ void ram_mig_init(void)
     qemu_mutex_init(&XBZRLE.lock);
     register_savevm_live(NULL, "ram", 0, 4, &savevm_ram_handlers, NULL);
 }
-/* Stub function that's gets run on the vcpu when its brought out of the
-   VM to run inside qemu via async_run_on_cpu()*/
-
-static void mig_sleep_cpu(void *opq)
-{
-    qemu_mutex_unlock_iothread();
-    g_usleep(30*1000);
-    qemu_mutex_lock_iothread();
-}
-
-/* To reduce the dirty rate explicitly disallow the VCPUs from spending
-   much time in the VM. The migration thread will try to catchup.
-   Workload will experience a performance drop.
-*/
-static void mig_throttle_guest_down(void)
-{
-    CPUState *cpu;
-
-    qemu_mutex_lock_iothread();
-    CPU_FOREACH(cpu) {
-        async_run_on_cpu(cpu, mig_sleep_cpu, NULL);
-    }
-    qemu_mutex_unlock_iothread();
-}
-
-static void check_guest_throttling(void)
-{
-    static int64_t t0;
-    int64_t        t1;
-
-    if (!mig_throttle_on) {
-        return;
-    }
-
-    if (!t0)  {
-        t0 = qemu_clock_get_ns(QEMU_CLOCK_REALTIME);
-        return;
-    }
-
-    t1 = qemu_clock_get_ns(QEMU_CLOCK_REALTIME);
-
-    /* If it has been more than 40 ms since the last time the guest
-     * was throttled then do it again.
-     */
-    if (40 < (t1-t0)/1000000) {
-        mig_throttle_guest_down();
-        t0 = t1;
-    }
-}
@@ -66,7 +66,12 @@ static void tcp_accept_incoming_migration(void *opaque)
         err = socket_error();
     } while (c < 0 && err == EINTR);
     qemu_set_fd_handler(s, NULL, NULL, NULL);
-    closesocket(s);
+    if (c >= 0 && migrate_use_multifd()) {
+        /* The multifd channels are accepted on the same socket */
+        migrate_multifd_recv_threads_create(s);
+    } else {
+        closesocket(s);
+    }
 
     DPRINTF("accepted migration\n");
 
@@ -66,7 +66,12 @@ static void unix_accept_incoming_migration(void *opaque)
         err = errno;
     } while (c < 0 && err == EINTR);
     qemu_set_fd_handler(s, NULL, NULL, NULL);
-    close(s);
+    if (c >= 0 && migrate_use_multifd()) {
+        /* The multifd channels are accepted on the same socket */
+        migrate_multifd_recv_threads_create(s);
+    } else {
+        close(s);
+    }
 
     DPRINTF("accepted migration\n");
 
@@ -11,8 +11,216 @@
  *
  */
 #include "qemu-common.h"
+#include "qemu/host-utils.h"
 #include "include/migration/migration.h"
 
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#endif
+#ifdef CONFIG_AVX2_OPT
+#include <immintrin.h>
+#endif
+
+/*
+ * The encoder spends its time finding where runs end: the first byte at
+ * or after @i where @old_buf and @new_buf differ (find_diff), or are equal
+ * again (find_same).  Both return @len if there is no such byte.
+ */
+typedef int (*XBZRLEScanFunc)(const uint8_t *old_buf, const uint8_t *new_buf,
+                              int i, int len);
+
+#if defined(__SSE2__)
+
+static int find_diff_vec(const uint8_t *old_buf, const uint8_t *new_buf,
+                         int i, int len)
+{
+    for (; i + 16 <= len; i += 16) {
+        __m128i x = _mm_loadu_si128((const __m128i *)(old_buf + i));
+        __m128i y = _mm_loadu_si128((const __m128i *)(new_buf + i));
+        uint32_t mask = _mm_movemask_epi8(_mm_cmpeq_epi8(x, y)) ^ 0xffff;
+
+        if (mask) {
+            return i + ctz32(mask);
+        }
+    }
+    while (i < len && old_buf[i] == new_buf[i]) {
+        i++;
+    }
+    return i;
+}
+
+static int find_same_vec(const uint8_t *old_buf, const uint8_t *new_buf,
+                         int i, int len)
+{
+    for (; i + 16 <= len; i += 16) {
+        __m128i x = _mm_loadu_si128((const __m128i *)(old_buf + i));
+        __m128i y = _mm_loadu_si128((const __m128i *)(new_buf + i));
+        uint32_t mask = _mm_movemask_epi8(_mm_cmpeq_epi8(x, y));
+
+        if (mask) {
+            return i + ctz32(mask);
+        }
+    }
+    while (i < len && old_buf[i] != new_buf[i]) {
+        i++;
+    }
+    return i;
+}
+
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+
+/* Four bits per byte of x, all set where the byte is equal in y */
+static inline uint64_t neon_eq_mask(uint8x16_t x, uint8x16_t y)
+{
+    uint8x16_t eq = vceqq_u8(x, y);
+
+    return vget_lane_u64(vreinterpret_u64_u8(
+               vshrn_n_u16(vreinterpretq_u16_u8(eq), 4)), 0);
+}
+
+static int find_diff_vec(const uint8_t *old_buf, const uint8_t *new_buf,
+                         int i, int len)
+{
+    for (; i + 16 <= len; i += 16) {
+        uint64_t mask = ~neon_eq_mask(vld1q_u8(old_buf + i),
+                                      vld1q_u8(new_buf + i));
+
+        if (mask) {
+            return i + ctz64(mask) / 4;
+        }
+    }
+    while (i < len && old_buf[i] == new_buf[i]) {
+        i++;
+    }
+    return i;
+}
+
+static int find_same_vec(const uint8_t *old_buf, const uint8_t *new_buf,
+                         int i, int len)
+{
+    for (; i + 16 <= len; i += 16) {
+        uint64_t mask = neon_eq_mask(vld1q_u8(old_buf + i),
+                                     vld1q_u8(new_buf + i));
+
+        if (mask) {
+            return i + ctz64(mask) / 4;
+        }
+    }
+    while (i < len && old_buf[i] != new_buf[i]) {
+        i++;
+    }
+    return i;
+}
+
+#else
+
+static int find_diff_vec(const uint8_t *old_buf, const uint8_t *new_buf,
+                         int i, int len)
+{
+    /* not aligned to sizeof(long) */
+    while (i < len && (i % sizeof(long)) && old_buf[i] == new_buf[i]) {
+        i++;
+    }
+
+    /* word at a time for speed */
+    if (!(i % sizeof(long))) {
+        while (i + sizeof(long) <= len &&
+               (*(long *)(old_buf + i)) == (*(long *)(new_buf + i))) {
+            i += sizeof(long);
+        }
+    }
+
+    /* go over the rest */
+    while (i < len && old_buf[i] == new_buf[i]) {
+        i++;
+    }
+    return i;
+}
+
+static int find_same_vec(const uint8_t *old_buf, const uint8_t *new_buf,
+                         int i, int len)
+{
+    /* truncation to 32-bit long okay */
+    unsigned long mask = (unsigned long)0x0101010101010101ULL;
+
+    /* not aligned to sizeof(long) */
+    while (i < len && (i % sizeof(long)) && old_buf[i] != new_buf[i]) {
+        i++;
+    }
+
+    /* word at a time for speed, stop at the first long with an equal byte */
+    if (!(i % sizeof(long))) {
+        while (i + sizeof(long) <= len) {
+            unsigned long xor;
+            xor = *(unsigned long *)(old_buf + i)
+                ^ *(unsigned long *)(new_buf + i);
+            if ((xor - mask) & ~xor & (mask << 7)) {
+                break;
+            }
+            i += sizeof(long);
+        }
+    }
+
+    while (i < len && old_buf[i] != new_buf[i]) {
+        i++;
+    }
+    return i;
+}
+
+#endif
+
+#ifdef CONFIG_AVX2_OPT
+
+static __attribute__((target("avx2")))
+int find_diff_avx2(const uint8_t *old_buf, const uint8_t *new_buf,
+                   int i, int len)
+{
+    for (; i + 32 <= len; i += 32) {
+        __m256i x = _mm256_loadu_si256((const __m256i *)(old_buf + i));
+        __m256i y = _mm256_loadu_si256((const __m256i *)(new_buf + i));
+        uint32_t mask = ~(uint32_t)_mm256_movemask_epi8(
+                                        _mm256_cmpeq_epi8(x, y));
+
+        if (mask) {
+            return i + ctz32(mask);
+        }
+    }
+    return find_diff_vec(old_buf, new_buf, i, len);
+}
+
+static __attribute__((target("avx2")))
+int find_same_avx2(const uint8_t *old_buf, const uint8_t *new_buf,
+                   int i, int len)
+{
+    for (; i + 32 <= len; i += 32) {
+        __m256i x = _mm256_loadu_si256((const __m256i *)(old_buf + i));
+        __m256i y = _mm256_loadu_si256((const __m256i *)(new_buf + i));
+        uint32_t mask = _mm256_movemask_epi8(_mm256_cmpeq_epi8(x, y));
+
+        if (mask) {
+            return i + ctz32(mask);
+        }
+    }
+    return find_same_vec(old_buf, new_buf, i, len);
+}
+
+#endif
+
+static XBZRLEScanFunc find_diff = find_diff_vec;
+static XBZRLEScanFunc find_same = find_same_vec;
+
+static void __attribute__((constructor)) xbzrle_init_accel(void)
+{
+#ifdef CONFIG_AVX2_OPT
+    if (host_avx2_usable()) {
+        find_diff = find_diff_avx2;
+        find_same = find_same_avx2;
+    }
+#endif
+}
+
 /*
   page = zrun nzrun
        | zrun nzrun page
@@ -26,10 +234,9 @@
 int xbzrle_encode_buffer(uint8_t *old_buf, uint8_t *new_buf, int slen,
                          uint8_t *dst, int dlen)
 {
-    uint32_t zrun_len = 0, nzrun_len = 0;
-    int d = 0, i = 0;
-    long res;
-    uint8_t *nzrun_start = NULL;
+    uint32_t zrun_len, nzrun_len;
+    int d = 0, i = 0, end;
+    uint8_t *nzrun_start;
 
     g_assert(!(((uintptr_t)old_buf | (uintptr_t)new_buf | slen) %
                sizeof(long)));
@@ -40,28 +247,9 @@ int xbzrle_encode_buffer(uint8_t *old_buf, uint8_t *new_buf, int slen,
             return -1;
         }
 
-        /* not aligned to sizeof(long) */
-        res = (slen - i) % sizeof(long);
-        while (res && old_buf[i] == new_buf[i]) {
-            zrun_len++;
-            i++;
-            res--;
-        }
-
-        /* word at a time for speed */
-        if (!res) {
-            while (i < slen &&
-                   (*(long *)(old_buf + i)) == (*(long *)(new_buf + i))) {
-                i += sizeof(long);
-                zrun_len += sizeof(long);
-            }
-
-            /* go over the rest */
-            while (i < slen && old_buf[i] == new_buf[i]) {
-                zrun_len++;
-                i++;
-            }
-        }
+        end = find_diff(old_buf, new_buf, i, slen);
+        zrun_len = end - i;
+        i = end;
 
         /* buffer unchanged */
         if (zrun_len == slen) {
@@ -75,42 +263,16 @@ int xbzrle_encode_buffer(uint8_t *old_buf, uint8_t *new_buf, int slen,
 
         d += uleb128_encode_small(dst + d, zrun_len);
 
-        zrun_len = 0;
         nzrun_start = new_buf + i;
 
         /* overflow */
         if (d + 2 > dlen) {
             return -1;
         }
-        /* not aligned to sizeof(long) */
-        res = (slen - i) % sizeof(long);
-        while (res && old_buf[i] != new_buf[i]) {
-            i++;
-            nzrun_len++;
-            res--;
-        }
-
-        /* word at a time for speed, use of 32-bit long okay */
-        if (!res) {
-            /* truncation to 32-bit long okay */
-            unsigned long mask = (unsigned long)0x0101010101010101ULL;
-            while (i < slen) {
-                unsigned long xor;
-                xor = *(unsigned long *)(old_buf + i)
-                    ^ *(unsigned long *)(new_buf + i);
-                if ((xor - mask) & ~xor & (mask << 7)) {
-                    /* found the end of an nzrun within the current long */
-                    while (old_buf[i] != new_buf[i]) {
-                        nzrun_len++;
-                        i++;
-                    }
-                    break;
-                } else {
-                    i += sizeof(long);
-                    nzrun_len += sizeof(long);
-                }
-            }
-        }
+
+        end = find_same(old_buf, new_buf, i, slen);
+        nzrun_len = end - i;
+        i = end;
 
         d += uleb128_encode_small(dst + d, nzrun_len);
         /* overflow */
@@ -119,7 +281,6 @@ int xbzrle_encode_buffer(uint8_t *old_buf, uint8_t *new_buf, int slen,
         }
         memcpy(dst + d, nzrun_start, nzrun_len);
         d += nzrun_len;
-        nzrun_len = 0;
     }
 
     return d;
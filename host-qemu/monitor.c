@@ -972,6 +972,97 @@ static void hmp_info_opcount(Monitor *mon, const QDict *qdict)
     dump_opcount_info((FILE *)mon, monitor_fprintf);
 }
 
+void qmp_tb_profile(bool enable, bool has_reset, bool reset, Error **errp)
+{
+    if (!tcg_enabled()) {
+        error_setg(errp, "TB profiling requires the TCG accelerator");
+        return;
+    }
+    if (!first_cpu) {
+        error_setg(errp, "No CPU to profile");
+        return;
+    }
+    if (has_reset && reset) {
+        tb_profile_reset(first_cpu);
+    }
+    tb_profile_set_enabled(first_cpu, enable);
+}
+
+static void tb_profile_collect(TBProfile *prof, void *opaque)
+{
+    g_ptr_array_add(opaque, prof);
+}
+
+static gint tb_profile_cmp_execs(gconstpointer a, gconstpointer b)
+{
+    const TBProfile *pa = *(TBProfile * const *)a;
+    const TBProfile *pb = *(TBProfile * const *)b;
+
+    return pa->exec_count < pb->exec_count ? 1 :
+           pa->exec_count > pb->exec_count ? -1 : 0;
+}
+
+static gint tb_profile_cmp_time(gconstpointer a, gconstpointer b)
+{
+    const TBProfile *pa = *(TBProfile * const *)a;
+    const TBProfile *pb = *(TBProfile * const *)b;
+
+    return pa->gen_time < pb->gen_time ? 1 :
+           pa->gen_time > pb->gen_time ? -1 : 0;
+}
+
+static TbProfileEntryList *tb_profile_top(GPtrArray *profs, int64_t top)
+{
+    TbProfileEntryList *head = NULL, **tail = &head;
+    int64_t i;
+
+    for (i = 0; i < top && i < profs->len; i++) {
+        TBProfile *prof = g_ptr_array_index(profs, i);
+        TbProfileEntryList *entry = g_new0(TbProfileEntryList, 1);
+
+        entry->value = g_new0(TbProfileEntry, 1);
+        entry->value->pc = prof->pc;
+        entry->value->size = prof->size;
+        entry->value->executions = prof->exec_count;
+        entry->value->translations = prof->translations;
+        entry->value->translation_time_ns = prof->gen_time;
+        *tail = entry;
+        tail = &entry->next;
+    }
+    return head;
+}
+
+TbProfileInfo *qmp_query_tb_profile(bool has_top, int64_t top, Error **errp)
+{
+    TbProfileInfo *info = g_new0(TbProfileInfo, 1);
+    GPtrArray *profs = g_ptr_array_new();
+    guint i;
+
+    if (!has_top) {
+        top = 20;
+    }
+
+    tb_profile_foreach(tb_profile_collect, profs);
+
+    info->enabled = tb_profile_enabled;
+    info->blocks = profs->len;
+    for (i = 0; i < profs->len; i++) {
+        TBProfile *prof = g_ptr_array_index(profs, i);
+
+        info->executions += prof->exec_count;
+        info->translations += prof->translations;
+        info->translation_time_ns += prof->gen_time;
+    }
+
+    g_ptr_array_sort(profs, tb_profile_cmp_execs);
+    info->by_executions = tb_profile_top(profs, top);
+    g_ptr_array_sort(profs, tb_profile_cmp_time);
+    info->by_time = tb_profile_top(profs, top);
+
+    g_ptr_array_free(profs, true);
+    return info;
+}
+
 static void hmp_info_history(Monitor *mon, const QDict *qdict)
 {
     int i;
@@ -2649,6 +2740,14 @@ static mon_cmd_t info_cmds[] = {
         .help       = "show dynamic compiler opcode counters",
         .mhandler.cmd = hmp_info_opcount,
     },
+    {
+        .name       = "tb-profile",
+        .args_type  = "top:i?",
+        .params     = "[top]",
+        .help       = "show the most executed and the slowest to translate "
+                      "TBs",
+        .mhandler.cmd = hmp_info_tb_profile,
+    },
     {
         .name       = "kvm",
         .args_type  = "",
@@ -533,6 +533,43 @@ int qemu_set_vnet_be(NetClientState *nc, bool is_be)
     return nc->info->set_vnet_be(nc, is_be);
 }
 
+/* Move the file descriptor handlers of a backend to @ctx, or back to the
+ * main loop if @ctx is NULL.  From then on the backend's packets must only
+ * be sent and received from the thread that runs @ctx; the main loop takes
+ * @ctx to flush or purge the queues of the backend and of its peer.
+ */
+int qemu_set_aio_context(NetClientState *nc, AioContext *ctx)
+{
+    if (!nc || !nc->info->set_aio_context) {
+        return -ENOSYS;
+    }
+
+    nc->info->set_aio_context(nc, ctx);
+    nc->aio_context = ctx;
+    if (nc->peer) {
+        nc->peer->aio_context = ctx;
+    }
+    return 0;
+}
+
+/* Tell @nc that a burst of packets is about to be delivered to it, so that
+ * it can put off per-packet work such as guest interrupts until the
+ * matching qemu_net_unplug().  Calls nest.
+ */
+void qemu_net_plug(NetClientState *nc)
+{
+    if (nc && nc->info->plug) {
+        nc->info->plug(nc);
+    }
+}
+
+void qemu_net_unplug(NetClientState *nc)
+{
+    if (nc && nc->info->unplug) {
+        nc->info->unplug(nc);
+    }
+}
+
 int qemu_can_send_packet(NetClientState *sender)
 {
     int vm_running = runstate_is_running();
@@ -554,6 +591,20 @@ int qemu_can_send_packet(NetClientState *sender)
     return 1;
 }
 
+static void qemu_net_account(NetClientState *sender, NetClientState *nc,
+                             size_t size, ssize_t ret)
+{
+    if (ret > 0) {
+        atomic_inc(&sender->stats.tx_packets);
+        atomic_add(&sender->stats.tx_bytes, size);
+        atomic_inc(&nc->stats.rx_packets);
+        atomic_add(&nc->stats.rx_bytes, size);
+    } else if (ret < 0) {
+        atomic_inc(&sender->stats.tx_dropped);
+        atomic_inc(&nc->stats.rx_dropped);
+    }
+}
+
 ssize_t qemu_deliver_packet(NetClientState *sender,
                             unsigned flags,
                             const uint8_t *data,
@@ -580,22 +631,36 @@ ssize_t qemu_deliver_packet(NetClientState *sender,
     if (ret == 0) {
         nc->receive_disabled = 1;
     }
+    qemu_net_account(sender, nc, size, ret);
 
     return ret;
 }
 
 void qemu_purge_queued_packets(NetClientState *nc)
 {
+    AioContext *ctx = nc->aio_context;
+
     if (!nc->peer) {
         return;
     }
 
+    if (ctx) {
+        aio_context_acquire(ctx);
+    }
     qemu_net_queue_purge(nc->peer->incoming_queue, nc);
+    if (ctx) {
+        aio_context_release(ctx);
+    }
 }
 
 static
 void qemu_flush_or_purge_queued_packets(NetClientState *nc, bool purge)
 {
+    AioContext *ctx = nc->aio_context;
+
+    if (ctx) {
+        aio_context_acquire(ctx);
+    }
     nc->receive_disabled = 0;
 
     if (nc->peer && nc->peer->info->type == NET_CLIENT_OPTIONS_KIND_HUBPORT) {
@@ -612,6 +677,9 @@ void qemu_flush_or_purge_queued_packets(NetClientState *nc, bool purge)
         /* Unable to empty the queue, purge remaining packets */
         qemu_net_queue_purge(nc->incoming_queue, nc);
     }
+    if (ctx) {
+        aio_context_release(ctx);
+    }
 }
 
 void qemu_flush_queued_packets(NetClientState *nc)
@@ -696,6 +764,7 @@ ssize_t qemu_deliver_packet_iov(NetClientState *sender,
     if (ret == 0) {
         nc->receive_disabled = 1;
     }
+    qemu_net_account(sender, nc, iov_size(iov, iovcnt), ret);
 
     return ret;
 }
@@ -1183,6 +1252,49 @@ RxFilterInfoList *qmp_query_rx_filter(bool has_name, const char *name,
     return filter_list;
 }
 
+/* atomic_read() can tear 64-bit counters on 32-bit hosts */
+static uint64_t net_stats_read(uint64_t *counter)
+{
+    return atomic_fetch_add(counter, 0);
+}
+
+NetQueueStatsList *qmp_query_net_queue_stats(bool has_name, const char *name,
+                                             Error **errp)
+{
+    NetClientState *nc;
+    NetQueueStatsList *head = NULL, **tail = &head;
+
+    QTAILQ_FOREACH(nc, &net_clients, next) {
+        NetQueueStatsList *entry;
+        NetQueueStats *info;
+
+        if (has_name && strcmp(nc->name, name) != 0) {
+            continue;
+        }
+
+        info = g_new0(NetQueueStats, 1);
+        info->name = g_strdup(nc->name);
+        info->queue = nc->queue_index;
+        info->rx_packets = net_stats_read(&nc->stats.rx_packets);
+        info->rx_bytes = net_stats_read(&nc->stats.rx_bytes);
+        info->rx_dropped = net_stats_read(&nc->stats.rx_dropped);
+        info->tx_packets = net_stats_read(&nc->stats.tx_packets);
+        info->tx_bytes = net_stats_read(&nc->stats.tx_bytes);
+        info->tx_dropped = net_stats_read(&nc->stats.tx_dropped);
+
+        entry = g_new0(NetQueueStatsList, 1);
+        entry->value = info;
+        *tail = entry;
+        tail = &entry->next;
+    }
+
+    if (head == NULL && has_name) {
+        error_setg(errp, "invalid net client name: %s", name);
+    }
+
+    return head;
+}
+
 void hmp_info_network(Monitor *mon, const QDict *qdict)
 {
     NetClientState *nc, *peer;
@@ -24,6 +24,7 @@
 #include "net/queue.h"
 #include "qemu/queue.h"
 #include "net/net.h"
+#include "block/aio.h"
 
 /* The delivery handler may only return zero if it will call
  * qemu_net_queue_flush() when it determines that it is once again able
@@ -87,6 +88,14 @@ void qemu_del_net_queue(NetQueue *queue)
     g_free(queue);
 }
 
+static void qemu_net_queue_drop(NetQueue *queue, NetClientState *sender)
+{
+    NetClientState *nc = queue->opaque;
+
+    atomic_inc(&sender->stats.tx_dropped);
+    atomic_inc(&nc->stats.rx_dropped);
+}
+
 static void qemu_net_queue_append(NetQueue *queue,
                                   NetClientState *sender,
                                   unsigned flags,
@@ -97,6 +106,7 @@ static void qemu_net_queue_append(NetQueue *queue,
     NetPacket *packet;
 
     if (queue->nq_count >= queue->nq_maxlen && !sent_cb) {
+        qemu_net_queue_drop(queue, sender);
         return; /* drop if queue full and no callback */
     }
     packet = g_malloc(sizeof(NetPacket) + size);
@@ -122,6 +132,7 @@ static void qemu_net_queue_append_iov(NetQueue *queue,
     int i;
 
     if (queue->nq_count >= queue->nq_maxlen && !sent_cb) {
+        qemu_net_queue_drop(queue, sender);
         return; /* drop if queue full and no callback */
     }
     for (i = 0; i < iovcnt; i++) {
@@ -233,6 +244,7 @@ void qemu_net_queue_purge(NetQueue *queue, NetClientState *from)
         if (packet->sender == from) {
             QTAILQ_REMOVE(&queue->packets, packet, entry);
             queue->nq_count--;
+            qemu_net_queue_drop(queue, packet->sender);
             if (packet->sent_cb) {
                 packet->sent_cb(packet->sender, 0);
             }
@@ -243,6 +255,17 @@ void qemu_net_queue_purge(NetQueue *queue, NetClientState *from)
 
 bool qemu_net_queue_flush(NetQueue *queue)
 {
+    NetClientState *nc = queue->opaque;
+    AioContext *ctx = nc ? nc->aio_context : NULL;
+    bool done = true;
+
+    /* The receiver may run in an IOThread, which also plugs and unplugs it
+     * and delivers packets to it.  Do the same from its AioContext.  */
+    if (ctx) {
+        aio_context_acquire(ctx);
+    }
+    /* Let the receiver handle the queued packets as one burst */
+    qemu_net_plug(nc);
     while (!QTAILQ_EMPTY(&queue->packets)) {
         NetPacket *packet;
         int ret;
@@ -259,7 +282,8 @@ bool qemu_net_queue_flush(NetQueue *queue)
         if (ret == 0) {
             queue->nq_count++;
             QTAILQ_INSERT_HEAD(&queue->packets, packet, entry);
-            return false;
+            done = false;
+            break;
         }
 
         if (packet->sent_cb) {
@@ -268,5 +292,9 @@ bool qemu_net_queue_flush(NetQueue *queue)
 
         g_free(packet);
     }
-    return true;
+    qemu_net_unplug(nc);
+    if (ctx) {
+        aio_context_release(ctx);
+    }
+    return done;
 }
@@ -34,9 +34,11 @@
 #include "hub.h"
 #include "monitor/monitor.h"
 #include "qemu/error-report.h"
+#include "qemu/iov.h"
 #include "qemu/sockets.h"
 #include "slirp/libslirp.h"
 #include "sysemu/char.h"
+#include "standard-headers/linux/virtio_net.h"
 
 static int get_str_sep(char *buf, int buf_size, const char **pp, int sep)
 {
@@ -74,6 +76,9 @@ typedef struct SlirpState {
     NetClientState nc;
     QTAILQ_ENTRY(SlirpState) entry;
     Slirp *slirp;
+    bool offload;           /* offer virtio-net headers to the NIC */
+    bool using_vnet_hdr;    /* packets start with a virtio-net header */
+    int vnet_hdr_len;
 #ifndef _WIN32
     char smb_dir[128];
 #endif
@@ -101,13 +106,89 @@ static inline void slirp_smb_cleanup(SlirpState *s) { }
 #endif
 
 void slirp_output(void *opaque, const uint8_t *pkt, int pkt_len)
+{
+    struct iovec iov = {
+        .iov_base = (void *)pkt,
+        .iov_len = pkt_len,
+    };
+
+    slirp_output_iov(opaque, &iov, 1, NULL);
+}
+
+void slirp_output_iov(void *opaque, const struct iovec *iov, int iovcnt,
+                      const SlirpOffload *offload)
 {
     SlirpState *s = opaque;
+    struct virtio_net_hdr_mrg_rxbuf hdr;
+    struct iovec vec[4];
+
+    if (!s->using_vnet_hdr) {
+        qemu_sendv_packet(&s->nc, iov, iovcnt);
+        return;
+    }
 
-    qemu_send_packet(&s->nc, pkt, pkt_len);
+    memset(&hdr, 0, sizeof(hdr));
+    if (offload) {
+        hdr.hdr.flags = VIRTIO_NET_HDR_F_NEEDS_CSUM;
+        hdr.hdr.csum_start = offload->csum_start;
+        hdr.hdr.csum_offset = offload->csum_offset;
+        if (offload->gso_size) {
+            hdr.hdr.gso_type = VIRTIO_NET_HDR_GSO_TCPV4;
+            hdr.hdr.hdr_len = offload->hdr_len;
+            hdr.hdr.gso_size = offload->gso_size;
+        }
+    }
+
+    assert(iovcnt < ARRAY_SIZE(vec));
+    vec[0].iov_base = &hdr;
+    vec[0].iov_len = s->vnet_hdr_len;
+    memcpy(&vec[1], iov, iovcnt * sizeof(*iov));
+    qemu_sendv_packet(&s->nc, vec, iovcnt + 1);
+}
+
+static ssize_t net_slirp_receive_iov(NetClientState *nc,
+                                     const struct iovec *iov, int iovcnt)
+{
+    SlirpState *s = DO_UPCAST(SlirpState, nc, nc);
+    size_t size = iov_size(iov, iovcnt);
+    struct virtio_net_hdr hdr;
+    int flags = 0;
+
+    if (!s->using_vnet_hdr) {
+        slirp_input_iov(s->slirp, iov, iovcnt, 0, 0);
+        return size;
+    }
+
+    if (size < s->vnet_hdr_len) {
+        return size;
+    }
+    iov_to_buf(iov, iovcnt, 0, &hdr, sizeof(hdr));
+    /*
+     * Segments larger than the MTU need no special handling: slirp
+     * terminates TCP, so it takes them as they are.  Partial checksums
+     * were written by the guest and cannot be wrong.
+     */
+    if (hdr.flags & (VIRTIO_NET_HDR_F_NEEDS_CSUM |
+                     VIRTIO_NET_HDR_F_DATA_VALID)) {
+        flags |= SLIRP_INPUT_CSUM_VALID;
+    }
+    slirp_input_iov(s->slirp, iov, iovcnt, s->vnet_hdr_len, flags);
+
+    return size;
 }
 
 static ssize_t net_slirp_receive(NetClientState *nc, const uint8_t *buf, size_t size)
+{
+    struct iovec iov = {
+        .iov_base = (void *)buf,
+        .iov_len = size,
+    };
+
+    return net_slirp_receive_iov(nc, &iov, 1);
+}
+
+static ssize_t net_slirp_receive_raw(NetClientState *nc, const uint8_t *buf,
+                                     size_t size)
 {
     SlirpState *s = DO_UPCAST(SlirpState, nc, nc);
 
@@ -116,6 +197,56 @@ static ssize_t net_slirp_receive(NetClientState *nc, const uint8_t *buf, size_t
     return size;
 }
 
+static bool net_slirp_has_vnet_hdr(NetClientState *nc)
+{
+    SlirpState *s = DO_UPCAST(SlirpState, nc, nc);
+
+    assert(nc->info->type == NET_CLIENT_OPTIONS_KIND_USER);
+
+    return s->offload;
+}
+
+static bool net_slirp_has_vnet_hdr_len(NetClientState *nc, int len)
+{
+    return net_slirp_has_vnet_hdr(nc) &&
+           (len == sizeof(struct virtio_net_hdr) ||
+            len == sizeof(struct virtio_net_hdr_mrg_rxbuf));
+}
+
+static void net_slirp_using_vnet_hdr(NetClientState *nc, bool using_vnet_hdr)
+{
+    SlirpState *s = DO_UPCAST(SlirpState, nc, nc);
+
+    assert(nc->info->type == NET_CLIENT_OPTIONS_KIND_USER);
+    assert(s->offload || !using_vnet_hdr);
+
+    s->using_vnet_hdr = using_vnet_hdr;
+    if (!using_vnet_hdr) {
+        slirp_set_offload(s->slirp, false, false);
+    }
+}
+
+static void net_slirp_set_vnet_hdr_len(NetClientState *nc, int len)
+{
+    SlirpState *s = DO_UPCAST(SlirpState, nc, nc);
+
+    assert(net_slirp_has_vnet_hdr_len(nc, len));
+
+    s->vnet_hdr_len = len;
+}
+
+static void net_slirp_set_offload(NetClientState *nc, int csum, int tso4,
+                                  int tso6, int ecn, int ufo)
+{
+    SlirpState *s = DO_UPCAST(SlirpState, nc, nc);
+
+    assert(nc->info->type == NET_CLIENT_OPTIONS_KIND_USER);
+
+    /* Slirp only does IPv4, and never sets ECN or sends UDP above the MTU */
+    slirp_set_offload(s->slirp, s->using_vnet_hdr && csum,
+                      s->using_vnet_hdr && tso4);
+}
+
 static void net_slirp_cleanup(NetClientState *nc)
 {
     SlirpState *s = DO_UPCAST(SlirpState, nc, nc);
@@ -129,7 +260,14 @@ static NetClientInfo net_slirp_info = {
     .type = NET_CLIENT_OPTIONS_KIND_USER,
     .size = sizeof(SlirpState),
     .receive = net_slirp_receive,
+    .receive_raw = net_slirp_receive_raw,
+    .receive_iov = net_slirp_receive_iov,
     .cleanup = net_slirp_cleanup,
+    .has_vnet_hdr = net_slirp_has_vnet_hdr,
+    .has_vnet_hdr_len = net_slirp_has_vnet_hdr_len,
+    .using_vnet_hdr = net_slirp_using_vnet_hdr,
+    .set_offload = net_slirp_set_offload,
+    .set_vnet_hdr_len = net_slirp_set_vnet_hdr_len,
 };
 
 static int net_slirp_init(NetClientState *peer, const char *model,
@@ -138,7 +276,8 @@ static int net_slirp_init(NetClientState *peer, const char *model,
                           const char *vhostname, const char *tftp_export,
                           const char *bootfile, const char *vdhcp_start,
                           const char *vnameserver, const char *smb_export,
-                          const char *vsmbserver, const char **dnssearch)
+                          const char *vsmbserver, const char **dnssearch,
+                          bool offload)
 {
     /* default settings according to historic slirp */
     struct in_addr net  = { .s_addr = htonl(0x0a000200) }; /* 10.0.2.0 */
@@ -242,6 +381,8 @@ static int net_slirp_init(NetClientState *peer, const char *model,
              restricted ? "on" : "off");
 
     s = DO_UPCAST(SlirpState, nc, nc);
+    s->offload = offload;
+    s->vnet_hdr_len = sizeof(struct virtio_net_hdr);
 
     s->slirp = slirp_init(restricted, net, mask, host, vhostname,
                           tftp_export, bootfile, dhcp, dns, dnssearch, s);
@@ -763,7 +904,8 @@ int net_init_slirp(const NetClientOptions *opts, const char *name,
     ret = net_slirp_init(peer, "user", name, user->q_restrict, vnet,
                          user->host, user->hostname, user->tftp,
                          user->bootfile, user->dhcpstart, user->dns, user->smb,
-                         user->smbserver, dnssearch);
+                         user->smbserver, dnssearch,
+                         user->has_offload && user->offload);
 
     while (slirp_configs) {
         config = slirp_configs;
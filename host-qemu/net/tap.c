@@ -39,17 +39,35 @@
 #include "sysemu/sysemu.h"
 #include "qemu-common.h"
 #include "qemu/error-report.h"
+#include "block/aio.h"
 
 #include "net/tap.h"
 
 #include "net/vhost_net.h"
 
+/* Packets read from the tap device per burst, see tap_send() */
+#define TAP_POOL_PACKETS 16
+
+/*
+ * When the host keeps receiving more packets while tap_send() is
+ * running we can hog the QEMU global mutex.  Limit the number of
+ * packets that are processed per tap_send() callback to prevent
+ * stalling the guest.
+ */
+#define TAP_SEND_MAX_PACKETS 50
+
 typedef struct TAPState {
     NetClientState nc;
     int fd;
     char down_script[1024];
     char down_script_arg[128];
-    uint8_t buf[NET_BUFSIZE];
+    /* TAP_POOL_PACKETS buffers of NET_BUFSIZE bytes.  Only the pages that
+     * packets are read into are ever touched.
+     */
+    uint8_t *pool;
+    int pool_size[TAP_POOL_PACKETS];
+    int pool_head;              /* next packet to give to the peer */
+    int pool_count;             /* packets read in the last burst */
     bool read_poll;
     bool write_poll;
     bool using_vnet_hdr;
@@ -57,6 +75,7 @@ typedef struct TAPState {
     bool enabled;
     VHostNetState *vhost_net;
     unsigned host_vnet_hdr_len;
+    AioContext *ctx;            /* NULL for the main loop */
 } TAPState;
 
 static void launch_script(const char *setup_script, const char *ifname,
@@ -67,10 +86,14 @@ static void tap_writable(void *opaque);
 
 static void tap_update_fd_handler(TAPState *s)
 {
-    qemu_set_fd_handler(s->fd,
-                        s->read_poll && s->enabled ? tap_send : NULL,
-                        s->write_poll && s->enabled ? tap_writable : NULL,
-                        s);
+    IOHandler *fd_read = s->read_poll && s->enabled ? tap_send : NULL;
+    IOHandler *fd_write = s->write_poll && s->enabled ? tap_writable : NULL;
+
+    if (s->ctx) {
+        aio_set_fd_handler(s->ctx, s->fd, fd_read, fd_write, s);
+    } else {
+        qemu_set_fd_handler(s->fd, fd_read, fd_write, s);
+    }
 }
 
 static void tap_read_poll(TAPState *s, bool enable)
@@ -171,25 +194,48 @@ ssize_t tap_read_packet(int tapfd, uint8_t *buf, int maxlen)
 }
 #endif
 
-static void tap_send_completed(NetClientState *nc, ssize_t len)
+static uint8_t *tap_pool_buf(TAPState *s, int index)
 {
-    TAPState *s = DO_UPCAST(TAPState, nc, nc);
-    tap_read_poll(s, true);
+    return s->pool + (size_t)index * NET_BUFSIZE;
 }
 
-static void tap_send(void *opaque)
+/* Read as many packets as are waiting, up to @max, into the pool */
+static int tap_fill_pool(TAPState *s, int max)
 {
-    TAPState *s = opaque;
-    int size;
-    int packets = 0;
+    int i, size;
 
-    while (true) {
-        uint8_t *buf = s->buf;
-
-        size = tap_read_packet(s->fd, s->buf, sizeof(s->buf));
+    max = MIN(max, TAP_POOL_PACKETS);
+    for (i = 0; i < max; i++) {
+        size = tap_read_packet(s->fd, tap_pool_buf(s, i), NET_BUFSIZE);
         if (size <= 0) {
             break;
         }
+        s->pool_size[i] = size;
+    }
+    s->pool_head = 0;
+    s->pool_count = i;
+    return i;
+}
+
+static void tap_send_completed(NetClientState *nc, ssize_t len);
+
+/* Give the packets left in the pool to the peer as one burst.  Returns
+ * false if the peer queued one of them; tap_send_completed() resumes
+ * once it is delivered.
+ */
+static bool tap_flush_pool(TAPState *s)
+{
+    bool done = true;
+
+    if (s->pool_head == s->pool_count) {
+        return true;
+    }
+
+    qemu_net_plug(s->nc.peer);
+    while (s->pool_head < s->pool_count) {
+        int index = s->pool_head++;
+        uint8_t *buf = tap_pool_buf(s, index);
+        int size = s->pool_size[index];
 
         if (s->host_vnet_hdr_len && !s->using_vnet_hdr) {
             buf  += s->host_vnet_hdr_len;
@@ -199,21 +245,47 @@ static void tap_send(void *opaque)
         size = qemu_send_packet_async(&s->nc, buf, size, tap_send_completed);
         if (size == 0) {
             tap_read_poll(s, false);
-            break;
-        } else if (size < 0) {
+            done = false;
             break;
         }
+    }
+    qemu_net_unplug(s->nc.peer);
+    return done;
+}
 
-        /*
-         * When the host keeps receiving more packets while tap_send() is
-         * running we can hog the QEMU global mutex.  Limit the number of
-         * packets that are processed per tap_send() callback to prevent
-         * stalling the guest.
-         */
-        packets++;
-        if (packets >= 50) {
+static void tap_send_completed(NetClientState *nc, ssize_t len)
+{
+    TAPState *s = DO_UPCAST(TAPState, nc, nc);
+
+    if (len == 0) {
+        /* Purged: the peer is going away or being reset */
+        s->pool_head = s->pool_count;
+    } else if (!tap_flush_pool(s)) {
+        return;
+    }
+    tap_read_poll(s, true);
+}
+
+static void tap_send(void *opaque)
+{
+    TAPState *s = opaque;
+    int packets = 0;
+
+    /* Packets left over from before the peer stopped us */
+    if (!tap_flush_pool(s)) {
+        return;
+    }
+
+    while (packets < TAP_SEND_MAX_PACKETS) {
+        int count = tap_fill_pool(s, TAP_SEND_MAX_PACKETS - packets);
+
+        if (!count) {
             break;
         }
+        if (!tap_flush_pool(s)) {
+            break;
+        }
+        packets += count;
     }
 }
 
@@ -280,6 +352,23 @@ static int tap_set_vnet_be(NetClientState *nc, bool is_be)
     return tap_fd_set_vnet_be(s->fd, is_be);
 }
 
+static void tap_set_aio_context(NetClientState *nc, AioContext *ctx)
+{
+    TAPState *s = DO_UPCAST(TAPState, nc, nc);
+    bool read_poll = s->read_poll;
+    bool write_poll = s->write_poll;
+
+    /* Unregister from the old context before registering in the new one */
+    s->read_poll = false;
+    s->write_poll = false;
+    tap_update_fd_handler(s);
+
+    s->ctx = ctx;
+    s->read_poll = read_poll;
+    s->write_poll = write_poll;
+    tap_update_fd_handler(s);
+}
+
 static void tap_set_offload(NetClientState *nc, int csum, int tso4,
                      int tso6, int ecn, int ufo)
 {
@@ -314,6 +403,8 @@ static void tap_cleanup(NetClientState *nc)
     tap_write_poll(s, false);
     close(s->fd);
     s->fd = -1;
+    g_free(s->pool);
+    s->pool = NULL;
 }
 
 static void tap_poll(NetClientState *nc, bool enable)
@@ -348,6 +439,7 @@ static NetClientInfo net_tap_info = {
     .set_vnet_hdr_len = tap_set_vnet_hdr_len,
     .set_vnet_le = tap_set_vnet_le,
     .set_vnet_be = tap_set_vnet_be,
+    .set_aio_context = tap_set_aio_context,
 };
 
 static TAPState *net_tap_fd_init(NetClientState *peer,
@@ -364,6 +456,7 @@ static TAPState *net_tap_fd_init(NetClientState *peer,
     s = DO_UPCAST(TAPState, nc, nc);
 
     s->fd = fd;
+    s->pool = g_malloc((size_t)TAP_POOL_PACKETS * NET_BUFSIZE);
     s->host_vnet_hdr_len = vnet_hdr ? sizeof(struct virtio_net_hdr) : 0;
     s->using_vnet_hdr = false;
     s->has_ufo = tap_probe_has_ufo(s->fd);
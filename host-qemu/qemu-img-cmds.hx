@@ -9,6 +9,12 @@ STEXI
 @table @option
 ETEXI
 
+DEF("bench", img_bench,
+    "bench [-q] [-n] [-i aio] [-f fmt] [-t cache] [-c count] [-d depth] [-s buffer_size] [-w window] filename")
+STEXI
+@item bench [-q] [-n] [-i @var{aio}] [-f @var{fmt}] [-t @var{cache}] [-c @var{count}] [-d @var{depth}] [-s @var{buffer_size}] [-w @var{window}] @var{filename}
+ETEXI
+
 DEF("check", img_check,
     "check [-q] [-f fmt] [--output=ofmt] [-r [leaks | all]] [-T src_cache] filename")
 STEXI
@@ -143,6 +143,16 @@ static void QEMU_NORETURN help(void)
            "  '-d' deletes a snapshot\n"
            "  '-l' lists all snapshots in the given image\n"
            "\n"
+           "Parameters to bench subcommand:\n"
+           "  '-c' number of read requests to send (defaults to 75000)\n"
+           "  '-d' number of requests in flight at a time (defaults to 1)\n"
+           "  '-i' AIO mode: 'threads' (the default), 'native' or 'io_uring'\n"
+           "  '-n' use native AIO, needs a cache mode that bypasses the host\n"
+           "       page cache ('-t none' or '-t directsync')\n"
+           "  '-s' size of each request in bytes (defaults to 4k)\n"
+           "  '-w' only read from the first 'window' bytes of the image (defaults\n"
+           "       to the whole image)\n"
+           "\n"
            "Parameters to compare subcommand:\n"
            "  '-f' first image format\n"
            "  '-F' second image format\n"
@@ -3042,6 +3052,238 @@ out:
     return 0;
 }
 
+typedef struct BenchData {
+    BlockBackend *blk;
+    uint64_t state;
+    int64_t window;
+    int bufsize;
+    int n;
+    int in_flight;
+    int64_t latency;
+} BenchData;
+
+typedef struct BenchRequest {
+    BenchData *b;
+    struct iovec iov;
+    QEMUIOVector qiov;
+    int64_t start;
+} BenchRequest;
+
+static void bench_cb(void *opaque, int ret);
+
+static void bench_submit(BenchRequest *req)
+{
+    BenchData *b = req->b;
+    int64_t offset;
+
+    /* A fixed xorshift sequence, so that every run reads the same offsets */
+    b->state ^= b->state << 13;
+    b->state ^= b->state >> 7;
+    b->state ^= b->state << 17;
+    offset = (b->state % (b->window / b->bufsize)) * b->bufsize;
+
+    b->n--;
+    b->in_flight++;
+    req->start = get_clock();
+    if (!blk_aio_readv(b->blk, offset >> BDRV_SECTOR_BITS, &req->qiov,
+                       b->bufsize >> BDRV_SECTOR_BITS, bench_cb, req)) {
+        error_report("Failed to issue request");
+        exit(EXIT_FAILURE);
+    }
+}
+
+static void bench_cb(void *opaque, int ret)
+{
+    BenchRequest *req = opaque;
+    BenchData *b = req->b;
+
+    if (ret < 0) {
+        error_report("Failed request: %s", strerror(-ret));
+        exit(EXIT_FAILURE);
+    }
+
+    b->latency += get_clock() - req->start;
+    b->in_flight--;
+    if (b->n > 0) {
+        bench_submit(req);
+    }
+}
+
+static int img_bench(int argc, char **argv)
+{
+    int c, ret = 0;
+    const char *fmt = NULL, *filename, *cache = BDRV_DEFAULT_CACHE;
+    const char *aio = NULL;
+    bool quiet = false;
+    int count = 75000;
+    int depth = 1;
+    int64_t bufsize = 4096;
+    int64_t window = 0;
+    int flags = 0;
+    BlockBackend *blk;
+    BenchData data;
+    BenchRequest *reqs;
+    uint8_t *buf;
+    int64_t length, start, elapsed;
+    int i;
+
+    for (;;) {
+        c = getopt(argc, argv, "c:d:f:hi:nqs:t:w:");
+        if (c == -1) {
+            break;
+        }
+        switch (c) {
+        case '?':
+        case 'h':
+            help();
+            break;
+        case 'c':
+        {
+            unsigned long long value;
+
+            if (parse_uint_full(optarg, &value, 0) < 0 ||
+                value == 0 || value > INT_MAX) {
+                error_report("Invalid request count specified");
+                return 1;
+            }
+            count = value;
+            break;
+        }
+        case 'd':
+        {
+            unsigned long long value;
+
+            if (parse_uint_full(optarg, &value, 0) < 0 ||
+                value == 0 || value > 4096) {
+                error_report("Invalid queue depth specified");
+                return 1;
+            }
+            depth = value;
+            break;
+        }
+        case 'f':
+            fmt = optarg;
+            break;
+        case 'i':
+            aio = optarg;
+            break;
+        case 'n':
+            aio = "native";
+            break;
+        case 'q':
+            quiet = true;
+            break;
+        case 's':
+        {
+            char *end;
+            bufsize = strtosz_suffix(optarg, &end, STRTOSZ_DEFSUFFIX_B);
+            if (bufsize <= 0 || bufsize > INT_MAX || *end ||
+                bufsize % BDRV_SECTOR_SIZE) {
+                error_report("Invalid buffer size specified");
+                return 1;
+            }
+            break;
+        }
+        case 't':
+            cache = optarg;
+            break;
+        case 'w':
+        {
+            char *end;
+            window = strtosz_suffix(optarg, &end, STRTOSZ_DEFSUFFIX_B);
+            if (window <= 0 || *end) {
+                error_report("Invalid window size specified");
+                return 1;
+            }
+            break;
+        }
+        }
+    }
+
+    if (optind != argc - 1) {
+        error_exit("Expecting one image file name");
+    }
+    filename = argv[argc - 1];
+
+    ret = bdrv_parse_cache_flags(cache, &flags);
+    if (ret < 0) {
+        error_report("Invalid cache option: %s", cache);
+        return 1;
+    }
+    if (aio && bdrv_parse_aio(aio, &flags) < 0) {
+        error_report("Invalid aio option: %s", aio);
+        return 1;
+    }
+    if ((flags & BDRV_O_NATIVE_AIO) && !(flags & BDRV_O_NOCACHE)) {
+        error_report("Native AIO needs a cache mode that bypasses the "
+                     "host page cache");
+        return 1;
+    }
+
+    blk = img_open("image", filename, fmt, flags, true, quiet);
+    if (!blk) {
+        return 1;
+    }
+
+    length = blk_getlength(blk);
+    if (length < 0) {
+        error_report("Could not get image size: %s", strerror(-length));
+        ret = -1;
+        goto out;
+    }
+    if (!window || window > length) {
+        window = length;
+    }
+    if (window < bufsize) {
+        error_report("Image or window smaller than the buffer size");
+        ret = -1;
+        goto out;
+    }
+
+    qprintf(quiet, "Sending %d read requests, %" PRId64 " bytes each, %d at "
+            "a time, at random offsets in the first %" PRId64 " bytes\n",
+            count, bufsize, depth, window);
+
+    data = (BenchData) {
+        .blk        = blk,
+        .state      = 0x2545f4914f6cdd1dULL,
+        .window     = window,
+        .bufsize    = bufsize,
+        .n          = count,
+    };
+    buf = blk_blockalign(blk, (size_t) depth * bufsize);
+    reqs = g_new(BenchRequest, depth);
+
+    start = get_clock();
+    for (i = 0; i < depth && data.n > 0; i++) {
+        reqs[i].b = &data;
+        reqs[i].iov.iov_base = buf + (size_t) i * bufsize;
+        reqs[i].iov.iov_len = bufsize;
+        qemu_iovec_init_external(&reqs[i].qiov, &reqs[i].iov, 1);
+        bench_submit(&reqs[i]);
+    }
+    while (data.in_flight > 0) {
+        main_loop_wait(false);
+    }
+    elapsed = get_clock() - start;
+
+    g_free(reqs);
+    qemu_vfree(buf);
+
+    qprintf(quiet, "Run completed in %.3f seconds, %.2f us per request, "
+            "%.0f requests per second\n", elapsed / 1e9,
+            elapsed / 1e3 / count, count / (elapsed / 1e9));
+    qprintf(quiet, "Average latency %.2f us\n", data.latency / 1e3 / count);
+
+out:
+    blk_unref(blk);
+
+    if (ret < 0) {
+        return 1;
+    }
+    return 0;
+}
+
 static const img_cmd_t img_cmds[] = {
 #define DEF(option, callback, arg_string)        \
     { option, callback },
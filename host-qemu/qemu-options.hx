@@ -461,7 +461,7 @@ DEF("drive", HAS_ARG, QEMU_OPTION_drive,
     "       [,cyls=c,heads=h,secs=s[,trans=t]][,snapshot=on|off]\n"
     "       [,cache=writethrough|writeback|none|directsync|unsafe][,format=f]\n"
     "       [,serial=s][,addr=A][,rerror=ignore|stop|report]\n"
-    "       [,werror=ignore|stop|report|enospc][,id=name][,aio=threads|native]\n"
+    "       [,werror=ignore|stop|report|enospc][,id=name][,aio=threads|native|io_uring]\n"
     "       [,readonly=on|off][,copy-on-read=on|off]\n"
     "       [,discard=ignore|unmap][,detect-zeroes=on|off|unmap]\n"
     "       [[,bps=b]|[[,bps_rd=r][,bps_wr=w]]]\n"
@@ -504,7 +504,7 @@ These options have the same definition as they have in @option{-hdachs}.
 @item cache=@var{cache}
 @var{cache} is "none", "writeback", "unsafe", "directsync" or "writethrough" and controls how the host cache is used to access block data.
 @item aio=@var{aio}
-@var{aio} is "threads", or "native" and selects between pthread based disk I/O and native Linux AIO.
+@var{aio} is "threads", "native" or "io_uring" and selects between pthread based disk I/O, native Linux AIO and Linux io_uring.
 @item discard=@var{discard}
 @var{discard} is one of "ignore" (or "off") or "unmap" (or "on") and controls whether @dfn{discard} (also known as @dfn{trim} or @dfn{unmap}) requests are ignored or passed to the filesystem.  Some machine types may not support discard requests.
 @item format=@var{format}
@@ -1322,9 +1322,34 @@ everybody else.  'ignore' completely ignores the shared flag and
 allows everybody connect unconditionally.  Doesn't conform to the rfb
 spec but is traditional QEMU behavior.
 
+@item workers=@var{n}
+
+Encode updates on @var{n} threads (1 to 64, default 1).  The threads also
+copy the guest framebuffer to the VNC server's copy of the screen, so that
+this is not done by the main loop.  With more than one thread, large
+updates in the raw and hextile encodings are split in bands that are
+encoded in parallel.  The threads are shared by all VNC displays, so the
+largest value given to any display is used.
+
 @end table
 ETEXI
 
+DEF("gles-display", HAS_ARG, QEMU_OPTION_gles_display,
+    "-gles-display file\n"
+    "                show the frames of a headless GLES renderer\n",
+    QEMU_ARCH_ALL)
+STEXI
+@item -gles-display @var{file}
+@findex -gles-display
+Add a graphic console that shows the frames which the GLES renderer,
+started with @option{-headless} @var{file}, publishes in @var{file}.  It
+is the first console, so that VNC and SPICE show it by default.  Frames
+are shown without being copied, and the renderer may start after QEMU or
+restart.  It needs no window system: on a host without a GPU, run the
+renderer with @env{EGL_PLATFORM=surfaceless} and Mesa's libraries in
+@env{ANDROID_EGL_LIB}, @env{ANDROID_GLESv1_LIB} and @env{ANDROID_GLESv2_LIB}.
+ETEXI
+
 STEXI
 @end table
 ETEXI
@@ -1461,7 +1486,7 @@ DEF("netdev", HAS_ARG, QEMU_OPTION_netdev,
 #ifdef CONFIG_SLIRP
     "-netdev user,id=str[,net=addr[/mask]][,host=addr][,restrict=on|off]\n"
     "         [,hostname=host][,dhcpstart=addr][,dns=addr][,dnssearch=domain][,tftp=dir]\n"
-    "         [,bootfile=f][,hostfwd=rule][,guestfwd=rule]"
+    "         [,bootfile=f][,hostfwd=rule][,guestfwd=rule][,offload=on|off]"
 #ifndef _WIN32
                                              "[,smb=dir[,smbserver=addr]]\n"
 #endif
@@ -1735,6 +1760,18 @@ so that QEMU behaves similar to an inetd process for that virtual server:
 qemu -net 'user,guestfwd=tcp:10.0.2.100:1234-cmd:netcat 10.10.1.1 4321'
 @end example
 
+@item offload=on|off
+Exchange virtio-net headers with a virtio-net device connected directly to
+this backend (which rules out the @option{-net} form). The guest can then
+send TCP segments larger than the MTU with partial checksums, and receives
+the data of host connections in segments of up to 64 KiB with partial
+checksums, which it completes and splits itself. Default is off.
+
+Example:
+@example
+qemu -netdev user,id=n0,offload=on -device virtio-net-pci,netdev=n0 [...]
+@end example
+
 @end table
 
 Note: Legacy stand-alone options -tftp, -bootp, -smb and -redir are still
@@ -3269,6 +3306,21 @@ STEXI
 Set TB size.
 ETEXI
 
+DEF("tb-cache", HAS_ARG, QEMU_OPTION_tb_cache, \
+    "-tb-cache file  reuse translated code saved in file by a previous run\n",
+    QEMU_ARCH_ALL)
+STEXI
+@item -tb-cache @var{file}
+@findex -tb-cache
+Load translated code from @var{file} and save it there again on exit, so
+that a later run of the same QEMU binary with the same CPU model and
+features does not
+have to translate the guest code again.  Cached code is only reused when
+the guest code it was translated from is unchanged, and the cache is not
+used with @option{-singlestep}.  Only supported with
+TCG on x86-64 Linux hosts.
+ETEXI
+
 DEF("incoming", HAS_ARG, QEMU_OPTION_incoming, \
     "-incoming tcp:[host]:port[,to=maxport][,ipv4][,ipv6]\n" \
     "-incoming rdma:host:port[,ipv4][,ipv6]\n" \
@@ -3279,6 +3331,8 @@ DEF("incoming", HAS_ARG, QEMU_OPTION_incoming, \
     "-incoming exec:cmdline\n" \
     "                accept incoming migration on given file descriptor\n" \
     "                or from given external command\n" \
+    "-incoming file:filename\n" \
+    "                load a migration stream saved with migrate file:\n" \
     "-incoming defer\n" \
     "                wait for the URI to be specified via migrate_incoming\n",
     QEMU_ARCH_ALL)
@@ -3297,6 +3351,11 @@ Accept incoming migration from a given filedescriptor.
 @item -incoming exec:@var{cmdline}
 Accept incoming migration as an output from specified external command.
 
+@item -incoming file:@var{filename}
+Load a migration stream written by @code{migrate file:@var{filename}}.  If
+it was saved with the mapped-ram capability, guest RAM is mapped from
+@var{filename}.ram and read lazily as the guest touches it.
+
 @item -incoming defer
 Wait for the URI to be specified via migrate_incoming.  The monitor can
 be used to change settings (such as migration parameters) prior to issuing
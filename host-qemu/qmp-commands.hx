@@ -2652,6 +2652,59 @@ EQMP
         .mhandler.cmd_new = qmp_marshal_input_query_iothreads,
     },
 
+SQMP
+query-thread-pools
+------------------
+
+Returns occupancy and queue depth of the worker thread pools of the main
+loop and the iothreads.  Pools are created on first use.
+
+Return a json-array. Each pool is represented by a json-object, which contains:
+
+- "iothread": iothread name, absent for the main loop (json-str, optional)
+- "max-threads": maximum number of worker threads (json-int)
+- "threads": current number of worker threads (json-int)
+- "idle-threads": number of workers waiting for requests (json-int)
+- "active": number of requests being run by a worker (json-int)
+- "queued": number of requests waiting for a worker (json-int)
+- "completed": requests completed since the pool was created (json-int)
+- "stolen": completed requests that a worker of another pool ran (json-int)
+
+Example:
+
+-> { "execute": "query-thread-pools" }
+<- {
+      "return":[
+         {
+            "max-threads":64,
+            "threads":2,
+            "idle-threads":2,
+            "active":0,
+            "queued":0,
+            "completed":1045,
+            "stolen":0
+         },
+         {
+            "iothread":"iothread0",
+            "max-threads":64,
+            "threads":64,
+            "idle-threads":0,
+            "active":64,
+            "queued":130,
+            "completed":4096230,
+            "stolen":18342
+         }
+      ]
+   }
+
+EQMP
+
+    {
+        .name       = "query-thread-pools",
+        .args_type  = "",
+        .mhandler.cmd_new = qmp_marshal_input_query_thread_pools,
+    },
+
 SQMP
 query-pci
 ---------
@@ -3246,6 +3299,17 @@ The main json-object contains the following:
 - "expected-downtime": only present while migration is active
                 total amount in ms for downtime that was calculated on
                 the last bitmap round (json-int)
+- "cpu-throttle-percentage": only present while migration is active and
+                auto-converge is on, percentage of the time of all vCPUs
+                taken away by throttling (json-int)
+- "vcpu-throttle": only present while migration is active and
+                auto-converge is on, a json-array with one json-object
+                per vCPU:
+         - "cpu-index": index of the vCPU (json-int)
+         - "dirty-pages-rate": pages dirtied per second by the vCPU,
+            only measured with TCG (json-int)
+         - "throttle-percentage": percentage of time the vCPU is kept
+            from running (json-int)
 - "ram": only present if "status" is "active", it is a json-object with the
   following RAM information:
          - "transferred": amount transferred in bytes (json-int)
@@ -3388,6 +3452,35 @@ Examples:
       }
    }
 
+7. Migration is being performed and auto-converge throttles one vCPU:
+
+-> { "execute": "query-migrate" }
+<- {
+      "return":{
+         "status":"active",
+         "ram":{
+            "total":1057024,
+            "remaining":1053304,
+            "transferred":3720,
+            "total-time":12345,
+            "setup-time":12345,
+            "expected-downtime":12345,
+            "duplicate":10,
+            "normal":3333,
+            "normal-bytes":3412992,
+            "dirty-pages-rate":4096,
+            "dirty-sync-count":15
+         },
+         "cpu-throttle-percentage":20,
+         "vcpu-throttle":[
+            { "cpu-index":0, "dirty-pages-rate":4096,
+              "throttle-percentage":40 },
+            { "cpu-index":1, "dirty-pages-rate":0,
+              "throttle-percentage":0 }
+         ]
+      }
+   }
+
 EQMP
 
     {
@@ -3407,6 +3500,8 @@ Enable/Disable migration capabilities
 - "auto-converge": throttle down guest to help convergence of migration
 - "zero-blocks": compress zero blocks during block migration
 - "events": generate events for each migration state change
+- "multifd": send RAM pages over several connections
+- "mapped-ram": store guest RAM in a separate, mappable file (file: URIs)
 
 Arguments:
 
@@ -3459,6 +3554,8 @@ Set migration parameters
 - "compress-level": set compression level during migration (json-int)
 - "compress-threads": set compression thread count for migration (json-int)
 - "decompress-threads": set decompression thread count for migration (json-int)
+- "multifd-channels": set the number of multifd channels (json-int)
+- "xbzrle-threads": set xbzrle encoding thread count for migration (json-int)
 
 Arguments:
 
@@ -3472,7 +3569,8 @@ EQMP
     {
         .name       = "migrate-set-parameters",
         .args_type  =
-            "compress-level:i?,compress-threads:i?,decompress-threads:i?",
+            "compress-level:i?,compress-threads:i?,decompress-threads:i?,"
+            "multifd-channels:i?,xbzrle-threads:i?",
 	.mhandler.cmd_new = qmp_marshal_input_migrate_set_parameters,
     },
 SQMP
@@ -3485,6 +3583,8 @@ Query current migration parameters
          - "compress-level" : compression level value (json-int)
          - "compress-threads" : compression thread count value (json-int)
          - "decompress-threads" : decompression thread count value (json-int)
+         - "multifd-channels" : number of multifd channels (json-int)
+         - "xbzrle-threads" : xbzrle encoding thread count value (json-int)
 
 Arguments:
 
@@ -3493,6 +3593,8 @@ Example:
 -> { "execute": "query-migrate-parameters" }
 <- {
       "return": {
+         "xbzrle-threads", 1,
+         "multifd-channels", 2,
          "decompress-threads", 2,
          "compress-threads", 8,
          "compress-level", 1
@@ -3810,6 +3912,63 @@ Example:
       ]
    }
 
+EQMP
+
+    {
+        .name       = "query-net-queue-stats",
+        .args_type  = "name:s?",
+        .mhandler.cmd_new = qmp_marshal_input_query_net_queue_stats,
+    },
+
+SQMP
+query-net-queue-stats
+---------------------
+
+Show the packet counters of net client queues.
+
+Returns a json-array with one entry for every queue of every net client
+(or of the given net client), returning an error if the given net client
+doesn't exist.  A multiqueue NIC and its backend have one entry per
+queue, all with the same name.
+
+Each array entry contains the following:
+
+- "name": net client name (json-string)
+- "queue": index of the queue (json-int)
+- "rx-packets": packets received (json-int)
+- "rx-bytes": bytes received (json-int)
+- "rx-dropped": packets dropped on the way to the queue (json-int)
+- "tx-packets": packets sent (json-int)
+- "tx-bytes": bytes sent (json-int)
+- "tx-dropped": packets sent that were dropped (json-int)
+
+Example:
+
+-> { "execute": "query-net-queue-stats", "arguments": { "name": "vnet0" } }
+<- { "return": [
+        {
+            "name": "vnet0",
+            "queue": 0,
+            "rx-packets": 1520,
+            "rx-bytes": 2012744,
+            "rx-dropped": 0,
+            "tx-packets": 903,
+            "tx-bytes": 81410,
+            "tx-dropped": 0
+        },
+        {
+            "name": "vnet0",
+            "queue": 1,
+            "rx-packets": 1311,
+            "rx-bytes": 1817502,
+            "rx-dropped": 2,
+            "tx-packets": 877,
+            "tx-bytes": 79003,
+            "tx-dropped": 0
+        }
+      ]
+   }
+
 EQMP
 
     {
@@ -4040,6 +4199,79 @@ Example:
 
 -> { "execute": "rtc-reset-reinjection" }
 <- { "return": {} }
+EQMP
+
+    {
+        .name       = "tb-profile",
+        .args_type  = "enable:b,reset:b?",
+        .mhandler.cmd_new = qmp_marshal_input_tb_profile,
+    },
+
+SQMP
+tb-profile
+----------
+
+Start or stop counting TCG translation block executions and translation
+time.  Changing the state flushes the translated code.
+
+Arguments:
+
+- "enable": true to start profiling, false to stop it (json-bool)
+- "reset": clear the statistics gathered so far (json-bool, optional)
+
+Example:
+
+-> { "execute": "tb-profile", "arguments": { "enable": true, "reset": true } }
+<- { "return": {} }
+EQMP
+
+    {
+        .name       = "query-tb-profile",
+        .args_type  = "top:i?",
+        .mhandler.cmd_new = qmp_marshal_input_query_tb_profile,
+    },
+
+SQMP
+query-tb-profile
+----------------
+
+Return the TCG translation block profile.
+
+Arguments:
+
+- "top": number of blocks in each list, default 20 (json-int, optional)
+
+Return a json-object with the following information:
+
+- "enabled": true if the profiler is running (json-bool)
+- "blocks": number of distinct guest addresses seen (json-int)
+- "executions": total number of block executions (json-int)
+- "translations": total number of translations (json-int)
+- "translation-time-ns": total host time spent translating (json-int)
+- "by-executions": the most executed blocks (json-array)
+- "by-time": the blocks that took longest to translate (json-array)
+
+Each block is a json-object with:
+
+- "pc": guest virtual address of the block (json-int)
+- "size": guest code size of the last translation (json-int)
+- "executions": number of times the block was entered (json-int)
+- "translations": number of times the block was translated (json-int)
+- "translation-time-ns": host time spent translating it (json-int)
+
+Example:
+
+-> { "execute": "query-tb-profile", "arguments": { "top": 1 } }
+<- { "return": { "enabled": true, "blocks": 5120, "executions": 91233710,
+                 "translations": 5388, "translation-time-ns": 61023455,
+                 "by-executions": [ { "pc": 18446743524012285952,
+                                      "size": 24, "executions": 1203311,
+                                      "translations": 1,
+                                      "translation-time-ns": 9120 } ],
+                 "by-time": [ { "pc": 18446743524010156032, "size": 508,
+                                "executions": 33, "translations": 12,
+                                "translation-time-ns": 412880 } ] } }
+
 EQMP
 
     {
@@ -0,0 +1,140 @@
+#!/usr/bin/env python
+#
+# IOThread adaptive polling latency benchmark
+#
+# This work is licensed under the terms of the GNU GPL, version 2 or later.
+# See the COPYING file in the top-level directory.
+#
+# Usage: aio-poll-bench.py [options] QEMU KERNEL INITRD
+#
+# Boots a guest once for every IOThread poll-max-ns value (0, which disables
+# polling, 8192, 32768 and 65536 by default) with a RAM-backed raw image as
+# a virtio-blk disk (/dev/vda) served by that IOThread.  The image is created
+# in /dev/shm unless --dir says otherwise.  The initrd must run a 4k random
+# read benchmark with queue depth 1 on the disk (for example fio with
+# --rw=randread --bs=4k --iodepth=1 --direct=1), print fio's usual summary on
+# the serial console and power off.
+#
+# For every run the IOPS, the average completion latency reported by fio,
+# and the IOThread's polling statistics (the self-tuned polling time at the
+# end of the run, the total time spent busy polling and how often polling
+# found an event) are printed.
+
+import optparse
+import os
+import re
+import shutil
+import subprocess
+import sys
+import tempfile
+import time
+
+sys.path.append(os.path.join(os.path.dirname(__file__), 'qmp'))
+import qmp
+from benchlib import parse_iops
+
+LAT_SCALE = {'nsec': 1e-3, 'usec': 1.0, 'msec': 1e3}
+STATS = ['poll-ns', 'poll-time-ns', 'poll-hits', 'poll-misses']
+
+def parse_latency(text):
+    # "     lat (usec): min=12, max=345, avg=23.45, stdev=6.78"; the slat
+    # and clat lines are skipped
+    m = re.search(r'^\s*lat \(([num]sec)\):.*avg=\s*([0-9.]+)', text,
+                  re.MULTILINE)
+    if not m:
+        return None
+    return float(m.group(2)) * LAT_SCALE[m.group(1)]
+
+def run(opts, qemu, kernel, initrd, image, tmpdir, poll_max_ns):
+    qmp_path = os.path.join(tmpdir, 'qmp.sock')
+    console = os.path.join(tmpdir, 'console.log')
+    if os.path.exists(qmp_path):
+        os.unlink(qmp_path)
+    mon = qmp.QEMUMonitorProtocol(qmp_path, server=True)
+    args = [qemu, '-nographic', '-nodefaults', '-no-shutdown',
+            '-serial', 'file:' + console, '-qmp', 'unix:' + qmp_path,
+            '-m', '1024', '-kernel', kernel, '-initrd', initrd,
+            '-append', 'console=ttyS0 panic=-1',
+            '-object', 'iothread,id=iothread0,poll-max-ns=%d' % poll_max_ns,
+            '-drive', 'file=%s,if=none,id=disk,format=raw,cache=%s,aio=%s' %
+                      (image, opts.cache, opts.aio),
+            '-device', 'virtio-blk-pci,drive=disk,iothread=iothread0']
+    if opts.qemu_args:
+        args += opts.qemu_args.split()
+    proc = subprocess.Popen(args)
+    try:
+        mon.accept()
+        deadline = time.time() + opts.timeout
+        while True:
+            left = deadline - time.time()
+            if left <= 0:
+                raise Exception('timed out waiting for the guest')
+            event = mon.pull_event(wait=float(left))
+            if event['event'] == 'SHUTDOWN':
+                break
+        stats = {}
+        for name in STATS:
+            stats[name] = mon.command('qom-get', path='/objects/iothread0',
+                                      property=name)
+        mon.cmd('quit')
+        mon.close()
+    finally:
+        if proc.poll() is None:
+            time.sleep(1)
+            if proc.poll() is None:
+                proc.kill()
+        proc.wait()
+
+    out = open(console).read()
+    iops = parse_iops(out)
+    if not iops:
+        raise Exception('no IOPS= lines on the guest console')
+    return iops, parse_latency(out), stats
+
+def main():
+    parser = optparse.OptionParser(
+        usage='%prog [options] QEMU KERNEL INITRD')
+    parser.add_option('-p', '--poll-max-ns', default='0,8192,32768,65536',
+                      help='comma separated poll-max-ns values [%default]')
+    parser.add_option('-s', '--size', type='int', default=1024,
+                      help='size in MiB of the image [%default]')
+    parser.add_option('--dir', default='/dev/shm',
+                      help='RAM-backed directory for the image [%default]')
+    parser.add_option('-t', '--cache', default='writeback',
+                      help='cache mode [%default]')
+    parser.add_option('-a', '--aio', default='threads',
+                      help='AIO mode [%default]')
+    parser.add_option('--timeout', type='int', default=600,
+                      help='seconds to wait for each guest run [%default]')
+    parser.add_option('--qemu-args', help='more QEMU arguments, '
+                                          'e.g. -enable-kvm')
+    opts, args = parser.parse_args()
+    if len(args) != 3:
+        parser.error('expecting the QEMU binary, a kernel and an initrd')
+    qemu, kernel, initrd = args
+
+    tmpdir = tempfile.mkdtemp(prefix='aio-poll-bench.', dir=opts.dir)
+    try:
+        image = os.path.join(tmpdir, 'test.raw')
+        f = open(image, 'wb')
+        chunk = '\xa5' * (1 << 20)
+        for i in range(opts.size):
+            f.write(chunk)
+        f.close()
+
+        print '%11s %10s %12s %9s %14s %10s %10s' % (
+            'poll-max-ns', 'IOPS', 'latency us', 'poll-ns', 'poll-time-ns',
+            'hits', 'misses')
+        for value in [int(v) for v in opts.poll_max_ns.split(',')]:
+            iops, latency, stats = run(opts, qemu, kernel, initrd, image,
+                                       tmpdir, value)
+            print '%11d %10.0f %12s %9d %14d %10d %10d' % (
+                value, iops,
+                '%.2f' % latency if latency is not None else '-',
+                stats['poll-ns'], stats['poll-time-ns'],
+                stats['poll-hits'], stats['poll-misses'])
+    finally:
+        shutil.rmtree(tmpdir)
+
+if __name__ == '__main__':
+    main()
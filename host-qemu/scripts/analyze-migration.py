@@ -105,6 +105,7 @@ class MigrationFile(object):
         self.file.close()
 
 class RamSection(object):
+    RAM_SAVE_FLAG_MAPPED_RAM = 0x01
     RAM_SAVE_FLAG_COMPRESS = 0x02
     RAM_SAVE_FLAG_MEM_SIZE = 0x04
     RAM_SAVE_FLAG_PAGE     = 0x08
@@ -170,6 +171,20 @@ class RamSection(object):
                         self.files[self.name] = f
                 flags &= ~self.RAM_SAVE_FLAG_MEM_SIZE
 
+            if flags & self.RAM_SAVE_FLAG_MAPPED_RAM:
+                # The pages themselves are in a separate RAM file
+                mapped = collections.OrderedDict()
+                while True:
+                    namelen = self.file.read8()
+                    if namelen == 0:
+                        break
+                    name = self.file.readstr(len = namelen)
+                    offset = self.file.read64()
+                    len = self.file.read64()
+                    mapped[name] = '0x%016x at 0x%016x' % (len, offset)
+                self.data['mapped ram'] = mapped
+                flags &= ~self.RAM_SAVE_FLAG_MAPPED_RAM
+
             if flags & self.RAM_SAVE_FLAG_COMPRESS:
                 if flags & self.RAM_SAVE_FLAG_CONTINUE:
                     flags &= ~self.RAM_SAVE_FLAG_CONTINUE
@@ -0,0 +1,87 @@
+# Helpers shared by the benchmark scripts
+#
+# This work is licensed under the terms of the GNU GPL, version 2 or later.
+# See the COPYING file in the top-level directory.
+#
+# The scripts live next to this file, so a plain "import benchlib" finds it.
+
+import re
+import struct
+
+def check(resp):
+    '''Return the result of a QMP command, raise its error if it failed'''
+    if 'error' in resp:
+        raise Exception(resp['error']['desc'])
+    return resp['return']
+
+def cpu_ticks(pid):
+    '''CPU time used by all threads of process @pid, in clock ticks'''
+    stat = open('/proc/%d/stat' % pid).read()
+    fields = stat[stat.rindex(')') + 2:].split()
+    # utime and stime are fields 14 and 15 of the whole line
+    return int(fields[11]) + int(fields[12])
+
+def parse_iops(text):
+    '''Sum of the IOPS of all jobs in the output of fio'''
+    # fio prints "IOPS=12.3k" or "IOPS=456"
+    total = 0.0
+    for value, suffix in re.findall(r'IOPS=([0-9.]+)([kM]?)', text):
+        total += float(value) * {'': 1, 'k': 1e3, 'M': 1e6}[suffix]
+    return total
+
+# VNC client
+
+def recv_exact(sock, n):
+    data = ''
+    while len(data) < n:
+        chunk = sock.recv(n - len(data))
+        if not chunk:
+            raise Exception('VNC server closed the connection')
+        data += chunk
+    return data
+
+def handshake(sock):
+    '''RFB 3.8 handshake without authentication
+
+    Returns the width, height and bytes per pixel of the framebuffer.'''
+    version = recv_exact(sock, 12)
+    if not version.startswith('RFB 003.'):
+        raise Exception('not a VNC server: %r' % version)
+    sock.sendall('RFB 003.008\n')
+    count = ord(recv_exact(sock, 1))
+    if count == 0:
+        raise Exception('VNC server refused the connection')
+    if 1 not in [ord(c) for c in recv_exact(sock, count)]:
+        raise Exception('VNC server requires authentication')
+    sock.sendall(chr(1))
+    if struct.unpack('>I', recv_exact(sock, 4))[0]:
+        raise Exception('VNC security handshake failed')
+    sock.sendall(chr(1))   # shared
+    width, height = struct.unpack('>HH', recv_exact(sock, 4))
+    bpp = ord(recv_exact(sock, 16)[0]) / 8
+    name_len = struct.unpack('>I', recv_exact(sock, 4))[0]
+    recv_exact(sock, name_len)
+    return width, height, bpp
+
+def request(sock, width, height, incremental):
+    sock.sendall(struct.pack('>BBHHHH', 3, incremental, 0, 0, width, height))
+
+def skip_hextile(sock, w, h, bpp):
+    for ty in range(0, h, 16):
+        th = min(16, h - ty)
+        for tx in range(0, w, 16):
+            tw = min(16, w - tx)
+            sub = ord(recv_exact(sock, 1))
+            if sub & 1:
+                recv_exact(sock, tw * th * bpp)
+                continue
+            size = 0
+            if sub & 2:
+                size += bpp
+            if sub & 4:
+                size += bpp
+            if size:
+                recv_exact(sock, size)
+            if sub & 8:
+                nsub = ord(recv_exact(sock, 1))
+                recv_exact(sock, nsub * (2 + (bpp if sub & 16 else 0)))
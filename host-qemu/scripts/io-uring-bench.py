@@ -0,0 +1,168 @@
+#!/usr/bin/env python
+#
+# io_uring, native AIO and thread pool benchmark
+#
+# This work is licensed under the terms of the GNU GPL, version 2 or later.
+# See the COPYING file in the top-level directory.
+#
+# Usage: io-uring-bench.py [options] QEMU-IMG QEMU-IO
+#
+# Compares aio=threads, aio=native and aio=io_uring in three ways:
+#
+#   read    "qemu-img bench" random 4k reads at queue depths 1, 32 and 128
+#   write   one qemu-io process sends random 4k writes in batches of
+#           --batch "aio_write" commands, each batch followed by "aio_flush"
+#   guest   with --qemu, --kernel and --initrd, boots a guest once per mode
+#           with the image as a virtio-blk disk (/dev/vda).  The initrd must
+#           run the benchmark (for example fio with --rw=randread) on the
+#           disk, print fio's usual "IOPS=" summary lines on the serial
+#           console and power off.
+#
+# Native AIO needs a cache mode that bypasses the host page cache, so all
+# runs use cache=none unless --cache says otherwise, in which case native
+# AIO is skipped.  For every run the requests per second and, where
+# available, the average latency are printed.
+
+import optparse
+import os
+import random
+import re
+import shutil
+import subprocess
+import tempfile
+import time
+
+from benchlib import parse_iops
+
+MODES = ['threads', 'native', 'io_uring']
+BLOCK_SIZE = 4096
+
+def bench_read(qemu_img, image, mode, depth, opts):
+    out = subprocess.check_output([qemu_img, 'bench', '-f', 'raw',
+                                   '-t', opts.cache, '-i', mode,
+                                   '-c', str(opts.count), '-d', str(depth),
+                                   '-s', '4k', image])
+    iops = float(re.search(r'([0-9.]+) requests per second', out).group(1))
+    latency = float(re.search(r'Average latency ([0-9.]+) us',
+                              out).group(1))
+    return iops, latency
+
+def run_qemu_io(qemu_io, image, mode, opts, commands):
+    start = time.time()
+    proc = subprocess.Popen([qemu_io, '-f', 'raw', '-t', opts.cache,
+                             '-i', mode, image],
+                            stdin=subprocess.PIPE,
+                            stdout=open(os.devnull, 'w'))
+    proc.communicate(commands)
+    if proc.returncode:
+        raise Exception('qemu-io failed with aio=%s' % mode)
+    return time.time() - start
+
+def bench_write(qemu_io, image, mode, size, opts):
+    random.seed(1)
+    commands = []
+    for i in range(opts.count):
+        offset = random.randrange(size / BLOCK_SIZE) * BLOCK_SIZE
+        commands.append('aio_write -q %d %d\n' % (offset, BLOCK_SIZE))
+        if i % opts.batch == opts.batch - 1:
+            commands.append('aio_flush\n')
+    commands.append('aio_flush\n')
+    base = run_qemu_io(qemu_io, image, mode, opts, '')
+    elapsed = max(run_qemu_io(qemu_io, image, mode, opts,
+                              ''.join(commands)) - base, 1e-6)
+    return opts.count / elapsed, None
+
+def bench_guest(image, mode, opts):
+    args = [opts.qemu, '-nographic', '-nodefaults', '-serial', 'stdio',
+            '-m', '1024', '-kernel', opts.kernel, '-initrd', opts.initrd,
+            '-append', 'console=ttyS0 panic=-1', '-no-reboot',
+            '-drive', 'file=%s,if=none,id=disk,format=raw,cache=%s,aio=%s' %
+                      (image, opts.cache, mode),
+            '-device', 'virtio-blk-pci,drive=disk']
+    if opts.qemu_args:
+        args += opts.qemu_args.split()
+    out = subprocess.check_output(args)
+    iops = parse_iops(out)
+    if not iops:
+        raise Exception('no IOPS= lines on the guest console')
+    return iops, None
+
+def main():
+    parser = optparse.OptionParser(
+        usage='%prog [options] QEMU-IMG QEMU-IO')
+    parser.add_option('-m', '--modes', default=','.join(MODES),
+                      help='comma separated AIO modes [%default]')
+    parser.add_option('-d', '--depths', default='1,32,128',
+                      help='comma separated queue depths for reads '
+                           '[%default]')
+    parser.add_option('-c', '--count', type='int', default=100000,
+                      help='requests per run [%default]')
+    parser.add_option('-b', '--batch', type='int', default=32,
+                      help='writes between two flushes [%default]')
+    parser.add_option('-t', '--cache', default='none',
+                      help='cache mode [%default]')
+    parser.add_option('-i', '--image',
+                      help='file or block device to use; it is written to')
+    parser.add_option('-s', '--size', type='int', default=4,
+                      help='size in GiB of the file to create if --image '
+                           'is not given [%default]')
+    parser.add_option('--dir', help='directory for the created file')
+    parser.add_option('--qemu', help='QEMU binary for the guest test')
+    parser.add_option('--kernel', help='guest kernel for the guest test')
+    parser.add_option('--initrd', help='guest initrd that runs fio')
+    parser.add_option('--qemu-args', help='more QEMU arguments for the '
+                                          'guest test, e.g. -enable-kvm')
+    opts, args = parser.parse_args()
+    if len(args) != 2:
+        parser.error('expecting the qemu-img and qemu-io binaries')
+    qemu_img, qemu_io = args
+    modes = opts.modes.split(',')
+    for mode in modes:
+        if mode not in MODES:
+            parser.error('unknown AIO mode ' + mode)
+    if opts.cache not in ('none', 'directsync') and 'native' in modes:
+        modes.remove('native')
+    guest = opts.qemu or opts.kernel or opts.initrd
+    if guest and not (opts.qemu and opts.kernel and opts.initrd):
+        parser.error('the guest test needs --qemu, --kernel and --initrd')
+
+    tmpdir = None
+    try:
+        image = opts.image
+        if not image:
+            tmpdir = tempfile.mkdtemp(prefix='io-uring-bench.', dir=opts.dir)
+            image = os.path.join(tmpdir, 'test.raw')
+            subprocess.check_call([qemu_img, 'create', '-q', '-f', 'raw',
+                                   '-o', 'preallocation=full', image,
+                                   '%dG' % opts.size])
+        size = int(subprocess.check_output(
+            [qemu_img, 'info', '-f', 'raw', image]).split(
+                'virtual size: ')[1].split('(')[1].split()[0])
+
+        tests = [('read', depth) for depth in
+                 [int(d) for d in opts.depths.split(',')]]
+        tests.append(('write', opts.batch))
+        if guest:
+            tests.append(('guest', 0))
+
+        print '%-6s %5s %-9s %10s %12s' % ('test', 'depth', 'aio', 'IOPS',
+                                           'latency us')
+        for test, depth in tests:
+            for mode in modes:
+                if test == 'read':
+                    iops, latency = bench_read(qemu_img, image, mode, depth,
+                                               opts)
+                elif test == 'write':
+                    iops, latency = bench_write(qemu_io, image, mode, size,
+                                                opts)
+                else:
+                    iops, latency = bench_guest(image, mode, opts)
+                print '%-6s %5s %-9s %10.0f %12s' % (
+                    test, depth or '-', mode, iops,
+                    '%.2f' % latency if latency is not None else '-')
+    finally:
+        if tmpdir:
+            shutil.rmtree(tmpdir)
+
+if __name__ == '__main__':
+    main()
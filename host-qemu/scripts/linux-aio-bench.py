@@ -0,0 +1,113 @@
+#!/usr/bin/env python
+#
+# Linux native AIO submission and completion benchmark
+#
+# This work is licensed under the terms of the GNU GPL, version 2 or later.
+# See the COPYING file in the top-level directory.
+#
+# Usage: linux-aio-bench.py [options] QEMU-IMG
+#
+# Runs "qemu-img bench" with random 4k reads that bypass the host page
+# cache, at queue depths 1, 32 and 128 by default, for these
+# configurations:
+#
+#   threads     aio=threads, the thread pool
+#   native      aio=native, one io_submit per request
+#   batch       aio=native, requests that arrive while others are in flight
+#               are submitted together (the default for aio=native)
+#   batch-poll  like batch, and busy-waits --poll-ns for completions
+#               before going back to sleep
+#
+# The image is read only.  Give a fast device (e.g. an NVMe namespace or a
+# preallocated file on it) with --image, or let the script create a
+# preallocated raw file of --size GiB in --dir.  For every run the requests
+# per second and the average latency of a request are printed.
+
+import optparse
+import os
+import re
+import shutil
+import stat
+import subprocess
+import tempfile
+
+CONFIGS = ['threads', 'native', 'batch', 'batch-poll']
+
+def filename(image, config, poll_ns):
+    if stat.S_ISBLK(os.stat(image).st_mode):
+        driver = 'host_device'
+    else:
+        driver = 'file'
+    opts = ''
+    if config == 'native':
+        opts = ', "aio-batch": false'
+    elif config == 'batch-poll':
+        opts = ', "aio-poll-ns": %d' % poll_ns
+    return ('json:{"driver": "raw", "file": {"driver": "%s", '
+            '"filename": "%s"%s}}' % (driver, image, opts))
+
+def bench(qemu_img, image, config, depth, opts):
+    args = [qemu_img, 'bench', '-t', 'none', '-c', str(opts.count),
+            '-d', str(depth), '-s', '4k']
+    if config != 'threads':
+        args.append('-n')
+    out = subprocess.check_output(args + [filename(image, config,
+                                                   opts.poll_ns)])
+    iops = float(re.search(r'([0-9.]+) requests per second', out).group(1))
+    latency = float(re.search(r'Average latency ([0-9.]+) us',
+                              out).group(1))
+    return iops, latency
+
+def main():
+    parser = optparse.OptionParser(usage='%prog [options] QEMU-IMG')
+    parser.add_option('-d', '--depths', default='1,32,128',
+                      help='comma separated queue depths [%default]')
+    parser.add_option('-C', '--configs', default=','.join(CONFIGS),
+                      help='comma separated configurations [%default]')
+    parser.add_option('-c', '--count', type='int', default=200000,
+                      help='requests per run [%default]')
+    parser.add_option('-n', '--runs', type='int', default=3,
+                      help='runs for each configuration, the best is '
+                           'reported [%default]')
+    parser.add_option('-p', '--poll-ns', type='int', default=20000,
+                      help='aio-poll-ns for batch-poll [%default]')
+    parser.add_option('-i', '--image',
+                      help='file or block device to read from')
+    parser.add_option('-s', '--size', type='int', default=4,
+                      help='size in GiB of the file to create if --image '
+                           'is not given [%default]')
+    parser.add_option('--dir', help='directory for the created file')
+    opts, args = parser.parse_args()
+    if len(args) != 1:
+        parser.error('expecting the qemu-img binary')
+    qemu_img = args[0]
+    configs = opts.configs.split(',')
+    for config in configs:
+        if config not in CONFIGS:
+            parser.error('unknown configuration ' + config)
+
+    tmpdir = None
+    try:
+        image = opts.image
+        if not image:
+            tmpdir = tempfile.mkdtemp(prefix='linux-aio-bench.', dir=opts.dir)
+            image = os.path.join(tmpdir, 'test.raw')
+            subprocess.check_call([qemu_img, 'create', '-q', '-f', 'raw',
+                                   '-o', 'preallocation=full', image,
+                                   '%dG' % opts.size])
+
+        print '%5s %-11s %10s %12s' % ('depth', 'config', 'IOPS',
+                                       'latency us')
+        for depth in [int(d) for d in opts.depths.split(',')]:
+            for config in configs:
+                results = [bench(qemu_img, image, config, depth, opts)
+                           for _ in range(opts.runs)]
+                iops, latency = max(results)
+                print '%5d %-11s %10.0f %12.2f' % (depth, config, iops,
+                                                   latency)
+    finally:
+        if tmpdir:
+            shutil.rmtree(tmpdir)
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,139 @@
+#!/usr/bin/env python
+#
+# Multifd migration benchmark
+#
+# This work is licensed under the terms of the GNU GPL, version 2 or later.
+# See the COPYING file in the top-level directory.
+#
+# Usage: multifd-bench.py [options] QEMU [QEMU-ARGS...]
+#
+# Migrates a guest between two local QEMU processes, first through the
+# main migration stream only and then with 1, 2, 4 and 8 multifd channels,
+# and prints the total time and the throughput of each run.
+#
+# By default both sides run an idle "virt" machine under the qtest
+# accelerator, and the source RAM is filled with a non-zero pattern first
+# so that every page really has to be sent.  With --no-fill, QEMU-ARGS
+# are used as they are, e.g. to migrate a booted Android guest.
+
+import optparse
+import os
+import shutil
+import socket
+import subprocess
+import sys
+import tempfile
+import time
+
+sys.path.append(os.path.join(os.path.dirname(__file__), 'qmp'))
+import qmp
+from benchlib import check
+
+DEFAULT_ARGS = ['-machine', 'virt,accel=qtest', '-nographic', '-nodefaults']
+FILL_CHUNK = 64 << 20
+
+def qtest_cmd(sock, cmd):
+    sock.sendall(cmd + '\n')
+    reply = ''
+    while not reply.endswith('\n'):
+        data = sock.recv(256)
+        if not data:
+            raise Exception('qtest connection closed')
+        reply += data
+    if not reply.startswith('OK'):
+        raise Exception('qtest command failed: ' + reply.strip())
+
+def start(qemu, args, tmpdir, name, extra, fill):
+    qmp_path = os.path.join(tmpdir, name + '.qmp')
+    qtest_path = os.path.join(tmpdir, name + '.qtest')
+    mon = qmp.QEMUMonitorProtocol(qmp_path, server=True)
+    qtest = None
+    cmdline = [qemu] + args + ['-qmp', 'unix:' + qmp_path] + extra
+    if fill:
+        qtest = socket.socket(socket.AF_UNIX, socket.SOCK_STREAM)
+        qtest.bind(qtest_path)
+        qtest.listen(1)
+        cmdline += ['-qtest', 'unix:' + qtest_path]
+    proc = subprocess.Popen(cmdline)
+    if qtest:
+        qtest, _ = qtest.accept()
+    mon.accept()
+    return proc, mon, qtest
+
+def run(opts, qemu, args, channels):
+    tmpdir = tempfile.mkdtemp(prefix='multifd-bench.')
+    uri = 'unix:' + os.path.join(tmpdir, 'migrate.sock')
+    procs = []
+    try:
+        dst_proc, dst, _ = start(qemu, args, tmpdir, 'dst',
+                                 ['-incoming', uri], opts.fill)
+        procs.append(dst_proc)
+        src_proc, src, qtest = start(qemu, args, tmpdir, 'src', [],
+                                     opts.fill)
+        procs.append(src_proc)
+
+        if opts.fill:
+            size = opts.mem << 20
+            for addr in range(0, size, FILL_CHUNK):
+                qtest_cmd(qtest, 'memset 0x%x 0x%x 0x5a' %
+                          (opts.ram_base + addr, min(FILL_CHUNK, size - addr)))
+
+        caps = [{'capability': 'multifd', 'state': channels > 0}]
+        for mon in (src, dst):
+            check(mon.cmd('migrate-set-capabilities', {'capabilities': caps}))
+            if channels:
+                check(mon.cmd('migrate-set-parameters',
+                              {'multifd-channels': channels}))
+        check(src.cmd('migrate_set_speed', {'value': 1 << 50}))
+
+        check(src.cmd('migrate', {'uri': uri}))
+        while True:
+            info = check(src.cmd('query-migrate'))
+            if info['status'] in ('completed', 'failed', 'cancelled'):
+                break
+            time.sleep(0.05)
+        if info['status'] != 'completed':
+            raise Exception('migration ' + info['status'])
+
+        for mon in (src, dst):
+            mon.cmd('quit')
+        return info['total-time'], info['ram']['transferred']
+    finally:
+        for proc in procs:
+            if proc.poll() is None:
+                proc.kill()
+            proc.wait()
+        shutil.rmtree(tmpdir)
+
+def main():
+    parser = optparse.OptionParser(
+        usage='%prog [options] QEMU [QEMU-ARGS...]')
+    parser.add_option('-c', '--channels', default='0,1,2,4,8',
+                      help='comma separated channel counts, 0 means '
+                           'multifd disabled [%default]')
+    parser.add_option('-m', '--mem', type='int', default=2048,
+                      help='guest RAM in MiB [%default]')
+    parser.add_option('--ram-base', type='int', default=0x40000000,
+                      help='guest physical address of RAM [%default]')
+    parser.add_option('--no-fill', dest='fill', action='store_false',
+                      default=True,
+                      help='do not fill guest RAM, and do not add the '
+                           'default machine options')
+    opts, args = parser.parse_args()
+    if not args:
+        parser.error('missing QEMU binary')
+    qemu = args[0]
+    args = args[1:]
+    if opts.fill:
+        args = DEFAULT_ARGS + ['-m', str(opts.mem)] + args
+
+    print '%8s %10s %10s %10s' % ('channels', 'time (s)', 'MiB', 'MiB/s')
+    for channels in [int(c) for c in opts.channels.split(',')]:
+        total_ms, transferred = run(opts, qemu, args, channels)
+        mib = transferred / float(1 << 20)
+        secs = total_ms / 1000.0
+        print '%8d %10.2f %10.0f %10.1f' % (channels, secs, mib,
+                                            mib / secs if secs else 0)
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,86 @@
+#!/usr/bin/env python
+#
+# qcow2 L2 cache lookup benchmark
+#
+# This work is licensed under the terms of the GNU GPL, version 2 or later.
+# See the COPYING file in the top-level directory.
+#
+# Usage: qcow2-cache-bench.py [options] QEMU-IMG QEMU-IO
+#
+# Creates a qcow2 image with 4k clusters, so that every L2 table maps 2 MiB
+# of guest data, and allocates one cluster in each 2 MiB of the image so
+# that all L2 tables exist.  Then, for every cache size, "qemu-img bench"
+# reads 4k blocks at random offsets in as many 2 MiB chunks as the L2 cache
+# has entries.  Apart from the first read of each table, every request hits
+# the cache, so the time per request should not depend on the number of
+# entries.
+
+import optparse
+import os
+import re
+import shutil
+import subprocess
+import tempfile
+
+CLUSTER_SIZE = 4096
+L2_COVERAGE = CLUSTER_SIZE / 8 * CLUSTER_SIZE
+BATCH = 1024
+
+def populate(qemu_io, image, tables):
+    for first in range(0, tables, BATCH):
+        args = [qemu_io]
+        for table in range(first, min(first + BATCH, tables)):
+            args += ['-c', 'write %d %d' % (table * L2_COVERAGE, CLUSTER_SIZE)]
+        subprocess.check_call(args + [image], stdout=open(os.devnull, 'w'))
+
+def bench(qemu_img, image, entries, count):
+    filename = ('json:{"driver": "qcow2", "l2-cache-size": %d, '
+                '"file": {"driver": "file", "filename": "%s"}}' %
+                (entries * CLUSTER_SIZE, image))
+    out = subprocess.check_output([qemu_img, 'bench', '-c', str(count),
+                                   '-s', str(CLUSTER_SIZE),
+                                   '-w', str(entries * L2_COVERAGE),
+                                   filename])
+    return float(re.search(r'([0-9.]+) us per request', out).group(1))
+
+def main():
+    parser = optparse.OptionParser(
+        usage='%prog [options] QEMU-IMG QEMU-IO')
+    parser.add_option('-e', '--entries', default='16,256,1024,4096,16384',
+                      help='comma separated L2 cache sizes in tables '
+                           '[%default]')
+    parser.add_option('-c', '--count', type='int', default=200000,
+                      help='minimum number of requests per run; at least '
+                           '20 per cache entry are sent [%default]')
+    parser.add_option('-n', '--runs', type='int', default=3,
+                      help='runs for each cache size, the best is '
+                           'reported [%default]')
+    parser.add_option('--dir', help='directory for the image')
+    opts, args = parser.parse_args()
+    if len(args) != 2:
+        parser.error('expecting the qemu-img and qemu-io binaries')
+    qemu_img, qemu_io = args
+    sizes = [int(e) for e in opts.entries.split(',')]
+
+    tmpdir = tempfile.mkdtemp(prefix='qcow2-cache-bench.', dir=opts.dir)
+    try:
+        image = os.path.join(tmpdir, 'test.qcow2')
+        subprocess.check_call([qemu_img, 'create', '-q', '-f', 'qcow2',
+                               '-o', 'cluster_size=%d' % CLUSTER_SIZE,
+                               image, str(max(sizes) * L2_COVERAGE)])
+        populate(qemu_io, image, max(sizes))
+
+        print '%8s %10s %10s %12s' % ('entries', 'cache MiB', 'data GiB',
+                                      'us/request')
+        for entries in sizes:
+            count = max(opts.count, 20 * entries)
+            best = min(bench(qemu_img, image, entries, count)
+                       for _ in range(opts.runs))
+            print '%8d %10.1f %10.2f %12.2f' % (
+                entries, entries * CLUSTER_SIZE / float(1 << 20),
+                entries * L2_COVERAGE / float(1 << 30), best)
+    finally:
+        shutil.rmtree(tmpdir)
+
+if __name__ == '__main__':
+    main()
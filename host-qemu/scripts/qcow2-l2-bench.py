@@ -0,0 +1,128 @@
+#!/usr/bin/env python
+#
+# qcow2 L2 cache sizing benchmark
+#
+# This work is licensed under the terms of the GNU GPL, version 2 or later.
+# See the COPYING file in the top-level directory.
+#
+# Usage: qcow2-l2-bench.py [options] QEMU-IMG QEMU-IO
+#
+# Creates a sparse qcow2 image (64 GiB with 64k clusters by default) and
+# writes one cluster in every part of it that an L2 table maps, so that all
+# L2 tables exist while almost no data is allocated.  Then, like a fio job
+# with random 4k reads at queue depth 1, a single qemu-io process reads
+# 4k blocks at random offsets of the whole image, once with the default
+# cache size and once for every other cache configuration.
+#
+# For every configuration the reads per second, the time per read and the
+# peak resident memory of qemu-io are printed.  The time of an empty run
+# (opening and closing the image) is subtracted.
+
+import optparse
+import os
+import random
+import shutil
+import subprocess
+import tempfile
+import time
+
+BLOCK_SIZE = 4096
+
+CONFIGS = {
+    'default':  {},
+    'l2-1M':    {'l2-cache-size': 1 << 20},
+    'l2-8M':    {'l2-cache-size': 8 << 20},
+    'full':     {'l2-cache-full': True},
+    'full-1s':  {'l2-cache-full': True, 'cache-clean-interval': 1},
+}
+
+def filename(image, options):
+    opts = ''.join(', "%s": %s' % (k, str(v).lower() if isinstance(v, bool)
+                                      else v)
+                   for k, v in sorted(options.items()))
+    return ('json:{"driver": "qcow2"%s, '
+            '"file": {"driver": "file", "filename": "%s"}}' % (opts, image))
+
+def populate(qemu_io, image, size, coverage):
+    proc = subprocess.Popen([qemu_io, image], stdin=subprocess.PIPE,
+                            stdout=open(os.devnull, 'w'))
+    proc.communicate(''.join('write -q %d %d\n' % (offset, BLOCK_SIZE)
+                             for offset in range(0, size, coverage)))
+    if proc.returncode:
+        raise Exception('qemu-io failed to populate the image')
+
+def run(qemu_io, image, options, cache, commands):
+    start = time.time()
+    proc = subprocess.Popen([qemu_io, '-t', cache, filename(image, options)],
+                            stdin=subprocess.PIPE,
+                            stdout=open(os.devnull, 'w'))
+    proc.stdin.write(commands)
+    proc.stdin.close()
+    _, status, rusage = os.wait4(proc.pid, 0)
+    elapsed = time.time() - start
+    if status:
+        raise Exception('qemu-io failed with %s' % options)
+    return elapsed, rusage.ru_maxrss
+
+def main():
+    parser = optparse.OptionParser(
+        usage='%prog [options] QEMU-IMG QEMU-IO')
+    parser.add_option('-s', '--size', type='int', default=64,
+                      help='virtual image size in GiB [%default]')
+    parser.add_option('--cluster-size', type='int', default=65536,
+                      help='image cluster size [%default]')
+    parser.add_option('-c', '--count', type='int', default=100000,
+                      help='random reads per run [%default]')
+    parser.add_option('-n', '--runs', type='int', default=3,
+                      help='runs for each configuration, the best is '
+                           'reported [%default]')
+    parser.add_option('-C', '--configs',
+                      default='default,l2-1M,l2-8M,full,full-1s',
+                      help='comma separated configurations out of %s '
+                           '[%%default]' % ', '.join(sorted(CONFIGS)))
+    parser.add_option('-t', '--cache', default='none',
+                      help='qemu-io cache mode; the default bypasses the '
+                           'host page cache, so that L2 table misses go to '
+                           'the disk [%default]')
+    parser.add_option('--dir', help='directory for the image')
+    opts, args = parser.parse_args()
+    if len(args) != 2:
+        parser.error('expecting the qemu-img and qemu-io binaries')
+    qemu_img, qemu_io = args
+    configs = opts.configs.split(',')
+    for name in configs:
+        if name not in CONFIGS:
+            parser.error('unknown configuration ' + name)
+
+    size = opts.size << 30
+    coverage = opts.cluster_size / 8 * opts.cluster_size
+    random.seed(1)
+    commands = ''.join('read -q %d %d\n' %
+                       (random.randrange(size / BLOCK_SIZE) * BLOCK_SIZE,
+                        BLOCK_SIZE)
+                       for _ in range(opts.count))
+
+    tmpdir = tempfile.mkdtemp(prefix='qcow2-l2-bench.', dir=opts.dir)
+    try:
+        image = os.path.join(tmpdir, 'test.qcow2')
+        subprocess.check_call([qemu_img, 'create', '-q', '-f', 'qcow2',
+                               '-o', 'cluster_size=%d' % opts.cluster_size,
+                               image, str(size)])
+        populate(qemu_io, image, size, coverage)
+
+        print '%-10s %10s %10s %10s' % ('config', 'IOPS', 'us/read',
+                                        'RSS MiB')
+        for name in configs:
+            base = min(run(qemu_io, image, CONFIGS[name], opts.cache, '')[0]
+                       for _ in range(opts.runs))
+            results = [run(qemu_io, image, CONFIGS[name], opts.cache,
+                           commands) for _ in range(opts.runs)]
+            elapsed = max(min(r[0] for r in results) - base, 1e-6)
+            print '%-10s %10.0f %10.2f %10.1f' % (
+                name, opts.count / elapsed, elapsed * 1e6 / opts.count,
+                max(r[1] for r in results) / 1024.0)
+    finally:
+        shutil.rmtree(tmpdir)
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,134 @@
+#!/usr/bin/env python
+#
+# User mode networking (slirp) TCP throughput benchmark
+#
+# This work is licensed under the terms of the GNU GPL, version 2 or later.
+# See the COPYING file in the top-level directory.
+#
+# Usage: slirp-bench.py [options] QEMU KERNEL INITRD
+#
+# Boots a guest with a virtio-net card on a user mode network backend, once
+# with offload=off and once with offload=on, and plays the server side of
+# an iperf-like test on the host loopback interface.  The initrd must bring
+# up eth0 with DHCP and then, in a loop, connect to 10.0.2.2 on the port
+# given with --port (the host's loopback address, as seen by the guest),
+# read one byte and:
+#
+#   - if it is 's', write data to the connection until it is closed;
+#   - if it is 'r', read and discard data until the connection is closed.
+#
+# Each direction is measured on its own connection.  For every backend
+# setting and direction the throughput and the CPU time used by all of
+# QEMU's threads per gigabyte are printed.
+
+import optparse
+import os
+import socket
+import subprocess
+import time
+
+from benchlib import cpu_ticks
+
+CONFIGS = ['off', 'on']
+DIRECTIONS = [('guest-to-host', 's'), ('host-to-guest', 'r')]
+
+BUFFER_SIZE = 256 * 1024
+
+def measure(opts, conn, pid, command):
+    conn.sendall(command)
+    buf = '\0' * BUFFER_SIZE
+    start = time.time() + opts.warmup
+    end = start + opts.duration
+    ticks = None
+    total = 0
+    while True:
+        if command == 's':
+            n = len(conn.recv(BUFFER_SIZE))
+            if not n:
+                raise Exception('the guest closed the connection')
+        else:
+            n = conn.send(buf)
+        now = time.time()
+        if now >= end:
+            ticks = cpu_ticks(pid) - ticks
+            break
+        if now >= start:
+            if ticks is None:
+                ticks = cpu_ticks(pid)
+            else:
+                total += n
+    conn.close()
+
+    if not total:
+        raise Exception('no data transferred')
+    cpu = float(ticks) / os.sysconf('SC_CLK_TCK')
+    return total * 8 / opts.duration / 1e6, cpu / (total / 1e9)
+
+def run(opts, qemu, kernel, initrd, config):
+    server = socket.socket(socket.AF_INET, socket.SOCK_STREAM)
+    server.setsockopt(socket.SOL_SOCKET, socket.SO_REUSEADDR, 1)
+    server.bind(('127.0.0.1', opts.port))
+    server.listen(1)
+    server.settimeout(opts.timeout)
+    args = [qemu, '-nographic', '-nodefaults', '-m', '1024',
+            '-serial', 'null', '-kernel', kernel, '-initrd', initrd,
+            '-append', 'console=ttyS0 panic=-1',
+            '-netdev', 'user,id=net0,offload=%s' % config,
+            '-device', '%s,netdev=net0' % opts.nic]
+    if opts.qemu_args:
+        args += opts.qemu_args.split()
+
+    proc = subprocess.Popen(args)
+    try:
+        results = []
+        for name, command in DIRECTIONS:
+            try:
+                conn = server.accept()[0]
+            except socket.timeout:
+                raise Exception('the guest did not connect')
+            conn.settimeout(None)
+            results.append((name, measure(opts, conn, proc.pid, command)))
+        return results
+    finally:
+        server.close()
+        if proc.poll() is None:
+            proc.kill()
+        proc.wait()
+
+def main():
+    parser = optparse.OptionParser(
+        usage='%prog [options] QEMU KERNEL INITRD')
+    parser.add_option('-c', '--configs', default=','.join(CONFIGS),
+                      help='comma separated offload settings [%default]')
+    parser.add_option('-p', '--port', type='int', default=5001,
+                      help='host loopback port the guest connects to '
+                           '[%default]')
+    parser.add_option('-d', '--duration', type='float', default=10,
+                      help='seconds to measure each direction [%default]')
+    parser.add_option('--warmup', type='float', default=2,
+                      help='seconds between connecting and measuring '
+                           '[%default]')
+    parser.add_option('--nic', default='virtio-net-pci',
+                      help='guest network device [%default]')
+    parser.add_option('--timeout', type='int', default=60,
+                      help='seconds to wait for the guest to connect '
+                           '[%default]')
+    parser.add_option('--qemu-args', help='more QEMU arguments, '
+                                          'e.g. -enable-kvm')
+    opts, args = parser.parse_args()
+    if len(args) != 3:
+        parser.error('expecting the QEMU binary, a kernel and an initrd')
+    qemu, kernel, initrd = args
+    configs = opts.configs.split(',')
+    for config in configs:
+        if config not in CONFIGS:
+            parser.error('unknown offload setting ' + config)
+
+    print '%-8s %-14s %10s %12s' % ('offload', 'direction', 'Mbit/s',
+                                    'CPU s/GB')
+    for config in configs:
+        for name, (mbps, cpu) in run(opts, qemu, kernel, initrd, config):
+            print '%-8s %-14s %10.1f %12.2f' % (config, name, mbps, cpu)
+
+if __name__ == '__main__':
+    main()
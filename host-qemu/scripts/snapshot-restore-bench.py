@@ -0,0 +1,170 @@
+#!/usr/bin/env python
+#
+# Snapshot restore benchmark
+#
+# This work is licensed under the terms of the GNU GPL, version 2 or later.
+# See the COPYING file in the top-level directory.
+#
+# Usage: snapshot-restore-bench.py [options] QEMU [QEMU-ARGS...]
+#
+# For each guest RAM size (2 and 4 GiB by default), boots an Android guest
+# until its launcher is shown, saves it once with the mapped-ram capability
+# to "file:" and once as a plain migration stream, and then restores it
+# from both snapshots.  For every restore, the time from starting QEMU to
+# the first guest instruction (the guest is running again) and to the
+# launcher being the resumed activity is printed.
+#
+# The guest is reached with adb; set ADB_SERIAL to select the device (e.g.
+# localhost:5555 when the guest's adbd is forwarded with hostfwd), and ADB
+# to the adb binary.  QEMU-ARGS must not include -m, and should include
+# -snapshot so that every restore sees the same disk contents.
+
+import optparse
+import os
+import shutil
+import subprocess
+import sys
+import tempfile
+import time
+
+sys.path.append(os.path.join(os.path.dirname(__file__), 'qmp'))
+import qmp
+from benchlib import check
+
+ADB = os.environ.get('ADB', 'adb')
+ADB_SERIAL = os.environ.get('ADB_SERIAL')
+
+def adb(*args):
+    cmd = [ADB]
+    if ADB_SERIAL:
+        subprocess.call([ADB, 'connect', ADB_SERIAL],
+                        stdout=open(os.devnull, 'w'), stderr=subprocess.STDOUT)
+        cmd += ['-s', ADB_SERIAL]
+    proc = subprocess.Popen(cmd + list(args), stdout=subprocess.PIPE,
+                            stderr=open(os.devnull, 'w'))
+    return proc.communicate()[0].replace('\r', '')
+
+def launcher_resumed(pattern):
+    for line in adb('shell', 'dumpsys', 'activity', 'activities').split('\n'):
+        if 'mResumedActivity' in line or 'mFocusedActivity' in line:
+            return pattern in line.lower()
+    return False
+
+def wait_for(cond, proc, timeout, what):
+    start = time.time()
+    while not cond():
+        if proc.poll() is not None:
+            raise Exception('QEMU exited while waiting for ' + what)
+        if time.time() - start > timeout:
+            raise Exception('timed out waiting for ' + what)
+        time.sleep(0.01)
+    return time.time()
+
+def start(qemu, args, tmpdir, extra):
+    qmp_path = os.path.join(tmpdir, 'qmp.sock')
+    if os.path.exists(qmp_path):
+        os.unlink(qmp_path)
+    mon = qmp.QEMUMonitorProtocol(qmp_path, server=True)
+    start = time.time()
+    proc = subprocess.Popen([qemu] + args + ['-qmp', 'unix:' + qmp_path] +
+                            extra)
+    mon.accept()
+    return proc, mon, start
+
+def stop(proc, mon):
+    try:
+        mon.cmd('quit')
+        mon.close()
+    except Exception:
+        pass
+    if proc.poll() is None:
+        time.sleep(1)
+        if proc.poll() is None:
+            proc.kill()
+    proc.wait()
+
+def save(mon, uri, mapped_ram):
+    caps = [{'capability': 'mapped-ram', 'state': mapped_ram}]
+    check(mon.cmd('migrate-set-capabilities', {'capabilities': caps}))
+    check(mon.cmd('migrate_set_speed', {'value': 1 << 50}))
+    check(mon.cmd('migrate', {'uri': uri}))
+    while True:
+        info = check(mon.cmd('query-migrate'))
+        if info['status'] in ('completed', 'failed', 'cancelled'):
+            break
+        time.sleep(0.05)
+    if info['status'] != 'completed':
+        raise Exception('saving to %s %s' % (uri, info['status']))
+
+def boot_and_save(opts, qemu, args, tmpdir, path):
+    proc, mon, _ = start(qemu, args, tmpdir, [])
+    try:
+        wait_for(lambda: adb('shell', 'getprop',
+                             'sys.boot_completed').strip() == '1',
+                 proc, opts.timeout, 'sys.boot_completed')
+        wait_for(lambda: launcher_resumed(opts.launcher),
+                 proc, opts.timeout, 'the launcher')
+        check(mon.cmd('stop'))
+        save(mon, 'file:' + path, True)
+        save(mon, 'exec:cat > ' + path + '.stream', False)
+    finally:
+        stop(proc, mon)
+
+def restore(opts, qemu, args, tmpdir, incoming):
+    proc, mon, start_time = start(qemu, args, tmpdir,
+                                  ['-S', '-incoming', incoming])
+    try:
+        # The main loop does not answer while the state is being loaded.
+        wait_for(lambda: check(mon.cmd('query-status'))['status'] !=
+                         'inmigrate',
+                 proc, opts.timeout, 'the end of the restore')
+        check(mon.cmd('cont'))
+        running = wait_for(lambda: check(mon.cmd('query-status'))['running'],
+                           proc, opts.timeout, 'the guest to run')
+        launcher = wait_for(lambda: launcher_resumed(opts.launcher),
+                            proc, opts.timeout, 'the launcher')
+        return running - start_time, launcher - start_time
+    finally:
+        stop(proc, mon)
+
+def main():
+    parser = optparse.OptionParser(
+        usage='%prog [options] QEMU [QEMU-ARGS...]')
+    parser.add_option('-m', '--mem', default='2048,4096',
+                      help='comma separated guest RAM sizes in MiB '
+                           '[%default]')
+    parser.add_option('-n', '--runs', type='int', default=3,
+                      help='restores of each snapshot [%default]')
+    parser.add_option('--launcher', default='launcher',
+                      help='substring of the launcher activity name '
+                           '[%default]')
+    parser.add_option('--timeout', type='int', default=1800,
+                      help='seconds to wait for each step [%default]')
+    parser.add_option('--dir', help='directory for the snapshot files')
+    opts, args = parser.parse_args()
+    if not args:
+        parser.error('missing QEMU binary')
+    qemu = args[0]
+    args = args[1:]
+    opts.launcher = opts.launcher.lower()
+
+    print '%8s %-12s %12s %12s' % ('RAM MiB', 'snapshot', 'first insn s',
+                                   'launcher s')
+    for mem in [int(m) for m in opts.mem.split(',')]:
+        tmpdir = tempfile.mkdtemp(prefix='snapshot-bench.', dir=opts.dir)
+        try:
+            vm_args = args + ['-m', str(mem)]
+            path = os.path.join(tmpdir, 'snapshot')
+            boot_and_save(opts, qemu, vm_args, tmpdir, path)
+            for name, incoming in (('mapped-ram', 'file:' + path),
+                                   ('stream', 'exec:cat ' + path + '.stream')):
+                for _ in range(opts.runs):
+                    first, launcher = restore(opts, qemu, vm_args, tmpdir,
+                                              incoming)
+                    print '%8d %-12s %12.3f %12.3f' % (mem, name, first,
+                                                       launcher)
+        finally:
+            shutil.rmtree(tmpdir)
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,152 @@
+#!/usr/bin/env python
+#
+# Tap backend small packet rate benchmark
+#
+# This work is licensed under the terms of the GNU GPL, version 2 or later.
+# See the COPYING file in the top-level directory.
+#
+# Usage: tap-pps-bench.py [options] QEMU [QEMU...]
+#
+# Must run as root.  Starts every given QEMU binary (for example a build
+# before and one after a change) with an empty machine and two tap
+# backends on the same hub, so that QEMU forwards every packet read from
+# one tap interface to the other one.  Each interface is moved to a network
+# namespace of its own, with the addresses 10.0.4.1/24 and 10.0.4.2/24.
+#
+# UDP senders in the first namespace then send small datagrams to the
+# second one as fast as they can.  For every binary the rate of packets
+# that come out of the second interface, and the CPU time that all of
+# QEMU's threads used per packet, are printed.
+
+import optparse
+import os
+import socket
+import subprocess
+import sys
+import time
+
+from benchlib import cpu_ticks
+
+NETNS = ['tapbench0', 'tapbench1']
+IFNAMES = ['tapbench0', 'tapbench1']
+ADDRS = ['10.0.4.1', '10.0.4.2']
+
+def netns(index, *args):
+    subprocess.check_call(['ip', 'netns', 'exec', NETNS[index]] + list(args))
+
+def rx_packets():
+    out = subprocess.check_output(['ip', 'netns', 'exec', NETNS[1], 'cat',
+                                   '/sys/class/net/%s/statistics/rx_packets'
+                                   % IFNAMES[1]])
+    return int(out)
+
+def send(opts, port):
+    # Runs inside the first namespace, see start_senders()
+    sock = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+    buf = '\0' * opts.size
+    while True:
+        try:
+            sock.sendto(buf, (ADDRS[1], port))
+        except socket.error:
+            pass
+
+def start_senders(opts):
+    senders = []
+    for i in range(opts.senders):
+        senders.append(subprocess.Popen(
+            ['ip', 'netns', 'exec', NETNS[0], sys.executable,
+             os.path.abspath(__file__), '--size', str(opts.size),
+             '--send', str(opts.port + i)]))
+    return senders
+
+def wait_for_interfaces(proc, timeout):
+    deadline = time.time() + timeout
+    while not all([os.path.exists('/sys/class/net/' + name)
+                   for name in IFNAMES]):
+        if proc.poll() is not None or time.time() > deadline:
+            raise Exception('QEMU did not create the tap interfaces')
+        time.sleep(0.1)
+
+def measure(opts, pid):
+    time.sleep(opts.warmup)
+    packets = rx_packets()
+    ticks = cpu_ticks(pid)
+    start = time.time()
+    time.sleep(opts.duration)
+    packets = rx_packets() - packets
+    ticks = cpu_ticks(pid) - ticks
+    elapsed = time.time() - start
+
+    if not packets:
+        raise Exception('no packets forwarded')
+    cpu = float(ticks) / os.sysconf('SC_CLK_TCK')
+    return packets / elapsed, cpu / packets
+
+def run(opts, qemu):
+    args = [qemu, '-machine', 'none', '-nographic', '-nodefaults']
+    for name in IFNAMES:
+        args += ['-net', 'tap,vlan=0,ifname=%s,script=no,downscript=no' %
+                 name]
+    if opts.qemu_args:
+        args += opts.qemu_args.split()
+
+    for ns in NETNS:
+        subprocess.check_call(['ip', 'netns', 'add', ns])
+    proc = None
+    senders = []
+    try:
+        proc = subprocess.Popen(args)
+        wait_for_interfaces(proc, opts.timeout)
+        for i in range(2):
+            subprocess.check_call(['ip', 'link', 'set', IFNAMES[i],
+                                   'netns', NETNS[i]])
+            netns(i, 'ip', 'addr', 'add', ADDRS[i] + '/24',
+                  'dev', IFNAMES[i])
+            netns(i, 'ip', 'link', 'set', IFNAMES[i], 'up')
+        senders = start_senders(opts)
+        return measure(opts, proc.pid)
+    finally:
+        for sender in senders:
+            sender.kill()
+            sender.wait()
+        if proc:
+            if proc.poll() is None:
+                proc.kill()
+            proc.wait()
+        for ns in NETNS:
+            subprocess.call(['ip', 'netns', 'del', ns])
+
+def main():
+    parser = optparse.OptionParser(usage='%prog [options] QEMU [QEMU...]')
+    parser.add_option('-s', '--size', type='int', default=18,
+                      help='UDP payload size, 18 bytes makes minimum size '
+                           'Ethernet frames [%default]')
+    parser.add_option('-n', '--senders', type='int', default=2,
+                      help='number of sending processes [%default]')
+    parser.add_option('-p', '--port', type='int', default=9000,
+                      help='first destination UDP port [%default]')
+    parser.add_option('-d', '--duration', type='float', default=10,
+                      help='seconds to measure each binary [%default]')
+    parser.add_option('--warmup', type='float', default=2,
+                      help='seconds between starting the senders and '
+                           'measuring [%default]')
+    parser.add_option('--timeout', type='int', default=10,
+                      help='seconds to wait for QEMU to start [%default]')
+    parser.add_option('--qemu-args', help='more QEMU arguments')
+    parser.add_option('--send', type='int', help=optparse.SUPPRESS_HELP)
+    opts, args = parser.parse_args()
+    if opts.send is not None:
+        send(opts, opts.send)
+        return
+    if not args:
+        parser.error('missing QEMU binary')
+    if os.geteuid() != 0:
+        parser.error('must run as root')
+
+    print '%10s %12s  %s' % ('kpps', 'CPU us/pkt', 'binary')
+    for qemu in args:
+        pps, cpu = run(opts, qemu)
+        print '%10.1f %12.2f  %s' % (pps / 1000, cpu * 1e6, qemu)
+
+if __name__ == '__main__':
+    main()
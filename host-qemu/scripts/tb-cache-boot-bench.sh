@@ -0,0 +1,85 @@
+#!/bin/bash
+
+# Measure Android boot time with a cold and a warm TB cache
+#
+# This program is free software; you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation; either version 2 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program; if not, see <http://www.gnu.org/licenses/>.
+#
+# Usage: tb-cache-boot-bench.sh CACHE-FILE QEMU [QEMU-ARGS...]
+#
+# Boots the guest twice with "-tb-cache CACHE-FILE": once after removing
+# the cache file, and once reusing the file written by the first run.
+# Boot time is measured until the guest reports sys.boot_completed via
+# adb; set ADB_SERIAL to select the device (e.g. localhost:5555 when the
+# guest's adbd is forwarded with hostfwd), and ADB to the adb binary.
+
+ADB=${ADB:-adb}
+TIMEOUT=${TIMEOUT:-1800}
+
+if test $# -lt 2; then
+    echo "Usage: $0 CACHE-FILE QEMU [QEMU-ARGS...]" >&2
+    exit 1
+fi
+cache=$1
+shift
+
+adb_cmd() {
+    if test -n "$ADB_SERIAL"; then
+        "$ADB" -s "$ADB_SERIAL" "$@"
+    else
+        "$ADB" "$@"
+    fi
+}
+
+boot() {
+    local start now pid booted
+
+    start=$(date +%s.%N)
+    "$@" -tb-cache "$cache" >/dev/null 2>&1 &
+    pid=$!
+
+    booted=
+    while kill -0 $pid 2>/dev/null; do
+        if test -n "$ADB_SERIAL"; then
+            "$ADB" connect "$ADB_SERIAL" >/dev/null 2>&1
+        fi
+        if test "$(adb_cmd shell getprop sys.boot_completed 2>/dev/null |
+                   tr -d '\r')" = 1; then
+            booted=1
+            break
+        fi
+        now=$(date +%s.%N)
+        if test "$(echo "$now - $start > $TIMEOUT" | bc)" = 1; then
+            break
+        fi
+        sleep 1
+    done
+    now=$(date +%s.%N)
+
+    # SIGTERM makes QEMU exit cleanly and write the cache file.
+    kill -TERM $pid 2>/dev/null
+    wait $pid
+
+    if test -z "$booted"; then
+        echo "boot did not complete" >&2
+        exit 1
+    fi
+    echo "$now - $start" | bc
+}
+
+rm -f "$cache"
+cold=$(boot "$@") || exit 1
+echo "cold boot: $cold s ($(du -k "$cache" | cut -f1) KB cache)"
+
+warm=$(boot "$@") || exit 1
+echo "warm boot: $warm s"
@@ -0,0 +1,142 @@
+#!/usr/bin/env python
+#
+# Thread pool stress benchmark
+#
+# This work is licensed under the terms of the GNU GPL, version 2 or later.
+# See the COPYING file in the top-level directory.
+#
+# Usage: thread-pool-bench.py [options] QEMU KERNEL INITRD
+#
+# Boots a guest with four IOThreads, each serving one virtio-blk disk
+# (/dev/vda to /dev/vdd) with aio=threads, so that every request becomes a
+# preadv or pwritev call in the IOThread's thread pool.  The initrd must run
+# a random read/write benchmark with queue depth 256 on all four disks at
+# once (for example fio with --rw=randrw --bs=4k --iodepth=256
+# --ioengine=libaio --direct=1 and one job per disk), print fio's usual
+# summary on the serial console and power off.
+#
+# While the guest runs, query-thread-pools is sampled every --interval
+# seconds.  For every pool the average and peak number of busy workers and
+# of queued requests, the requests completed and the requests that workers
+# of another pool ran are printed, together with the total IOPS.
+
+import optparse
+import os
+import shutil
+import subprocess
+import sys
+import tempfile
+import time
+
+sys.path.append(os.path.join(os.path.dirname(__file__), 'qmp'))
+import qmp
+from benchlib import parse_iops
+
+DISKS = 4
+
+def run(opts, qemu, kernel, initrd, images, tmpdir):
+    qmp_path = os.path.join(tmpdir, 'qmp.sock')
+    console = os.path.join(tmpdir, 'console.log')
+    mon = qmp.QEMUMonitorProtocol(qmp_path, server=True)
+    args = [qemu, '-nographic', '-nodefaults', '-no-shutdown',
+            '-serial', 'file:' + console, '-qmp', 'unix:' + qmp_path,
+            '-m', '1024', '-smp', str(opts.cpus),
+            '-kernel', kernel, '-initrd', initrd,
+            '-append', 'console=ttyS0 panic=-1']
+    for i, image in enumerate(images):
+        args += ['-object', 'iothread,id=iothread%d' % i,
+                 '-drive', 'file=%s,if=none,id=disk%d,format=raw,'
+                           'cache=%s,aio=threads' % (image, i, opts.cache),
+                 '-device', 'virtio-blk-pci,drive=disk%d,iothread=iothread%d'
+                            % (i, i)]
+    if opts.qemu_args:
+        args += opts.qemu_args.split()
+
+    samples = {}
+    last = []
+    proc = subprocess.Popen(args)
+    try:
+        mon.accept()
+        deadline = time.time() + opts.timeout
+        shutdown = False
+        while not shutdown:
+            if time.time() > deadline:
+                raise Exception('timed out waiting for the guest')
+            last = mon.command('query-thread-pools')
+            for pool in last:
+                name = pool.get('iothread', 'main')
+                samples.setdefault(name, []).append(pool)
+            try:
+                event = mon.pull_event(wait=float(opts.interval))
+                while event:
+                    if event['event'] == 'SHUTDOWN':
+                        shutdown = True
+                    event = mon.pull_event()
+            except qmp.QMPTimeoutError:
+                pass
+        mon.cmd('quit')
+        mon.close()
+    finally:
+        if proc.poll() is None:
+            time.sleep(1)
+            if proc.poll() is None:
+                proc.kill()
+        proc.wait()
+
+    out = open(console).read()
+    iops = parse_iops(out)
+    if not iops:
+        raise Exception('no IOPS= lines on the guest console')
+    return iops, samples, last
+
+def main():
+    parser = optparse.OptionParser(
+        usage='%prog [options] QEMU KERNEL INITRD')
+    parser.add_option('-s', '--size', type='int', default=1024,
+                      help='size in MiB of each disk [%default]')
+    parser.add_option('--dir', help='directory for the disk images')
+    parser.add_option('-t', '--cache', default='none',
+                      help='cache mode [%default]')
+    parser.add_option('-c', '--cpus', type='int', default=4,
+                      help='guest CPUs [%default]')
+    parser.add_option('-i', '--interval', type='float', default=0.5,
+                      help='seconds between two samples [%default]')
+    parser.add_option('--timeout', type='int', default=600,
+                      help='seconds to wait for the guest [%default]')
+    parser.add_option('--qemu-args', help='more QEMU arguments, '
+                                          'e.g. -enable-kvm')
+    opts, args = parser.parse_args()
+    if len(args) != 3:
+        parser.error('expecting the QEMU binary, a kernel and an initrd')
+    qemu, kernel, initrd = args
+
+    tmpdir = tempfile.mkdtemp(prefix='thread-pool-bench.', dir=opts.dir)
+    try:
+        images = []
+        for i in range(DISKS):
+            image = os.path.join(tmpdir, 'disk%d.raw' % i)
+            f = open(image, 'wb')
+            chunk = '\xa5' * (1 << 20)
+            for j in range(opts.size):
+                f.write(chunk)
+            f.close()
+            images.append(image)
+
+        iops, samples, last = run(opts, qemu, kernel, initrd, images, tmpdir)
+
+        print 'total IOPS %.0f' % iops
+        print '%-10s %8s %8s %9s %9s %10s %8s' % (
+            'pool', 'busy', 'max', 'queued', 'max', 'completed', 'stolen')
+        for pool in last:
+            name = pool.get('iothread', 'main')
+            busy = [p['active'] for p in samples[name]]
+            queued = [p['queued'] for p in samples[name]]
+            print '%-10s %8.1f %8d %9.1f %9d %10d %8d' % (
+                name, float(sum(busy)) / len(busy), max(busy),
+                float(sum(queued)) / len(queued), max(queued),
+                pool['completed'], pool['stolen'])
+    finally:
+        shutil.rmtree(tmpdir)
+
+if __name__ == '__main__':
+    main()
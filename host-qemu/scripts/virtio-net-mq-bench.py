@@ -0,0 +1,203 @@
+#!/usr/bin/env python
+#
+# Multiqueue virtio-net IOThread packet rate benchmark
+#
+# This work is licensed under the terms of the GNU GPL, version 2 or later.
+# See the COPYING file in the top-level directory.
+#
+# Usage: virtio-net-mq-bench.py [options] QEMU KERNEL INITRD
+#
+# Must run as root.  For every queue count N (1, 2 and 4 by default) boots
+# an ARM "virt" guest with N vCPUs and a virtio-net-device on a multiqueue
+# tap backend, with every queue pair served from its own IOThread.  The tap
+# interface is moved to a network namespace of its own with the address
+# 10.0.3.1/24, so that the traffic does not leave the host.
+#
+# The kernel command line carries mqbench.queues=N and mqbench.mode=tx or
+# mqbench.mode=rx.  The initrd must bring eth0 up as 10.0.3.2/24 and run
+# "ethtool -L eth0 combined N"; in tx mode it must then run N UDP senders,
+# one per vCPU, that send small datagrams to 10.0.3.1 as fast as they can.
+#
+# In tx mode the packet rate is read from the receive counter of the tap
+# interface.  In rx mode N flows are sent to the guest from the namespace,
+# and the packet rate is the sum of the per-queue counters that
+# query-net-queue-stats returns for the NIC; how evenly the packets were
+# spread over the queues is printed as well.
+
+import optparse
+import os
+import shutil
+import socket
+import subprocess
+import sys
+import tempfile
+import time
+
+sys.path.append(os.path.join(os.path.dirname(__file__), 'qmp'))
+import qmp
+from benchlib import check
+
+MODES = ['tx', 'rx']
+NETNS = 'mqbench'
+IFNAME = 'mqbench0'
+HOST_ADDR = '10.0.3.1'
+GUEST_ADDR = '10.0.3.2'
+
+def netns(*args):
+    subprocess.check_call(['ip', 'netns', 'exec', NETNS] + list(args))
+
+def tap_rx_packets():
+    out = subprocess.check_output(['ip', 'netns', 'exec', NETNS, 'cat',
+                                   '/sys/class/net/%s/statistics/rx_packets'
+                                   % IFNAME])
+    return int(out)
+
+def nic_rx_packets(mon):
+    stats = check(mon.cmd('query-net-queue-stats', {'name': 'nic0'}))
+    return [s['rx-packets'] for s in sorted(stats, key=lambda s: s['queue'])]
+
+def send(opts, port):
+    # Runs inside the namespace, see start_senders()
+    sock = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+    buf = '\0' * opts.size
+    while True:
+        try:
+            sock.sendto(buf, (GUEST_ADDR, port))
+        except socket.error:
+            pass
+
+def start_senders(opts, queues):
+    senders = []
+    for i in range(queues):
+        senders.append(subprocess.Popen(
+            ['ip', 'netns', 'exec', NETNS, sys.executable,
+             os.path.abspath(__file__), '--size', str(opts.size),
+             '--send', str(opts.port + i)]))
+    return senders
+
+def measure(opts, mon, mode):
+    if mode == 'tx':
+        sample = lambda: [tap_rx_packets()]
+    else:
+        sample = lambda: nic_rx_packets(mon)
+    time.sleep(opts.warmup)
+    before = sample()
+    start = time.time()
+    time.sleep(opts.duration)
+    after = sample()
+    elapsed = time.time() - start
+
+    deltas = [b - a for a, b in zip(before, after)]
+    total = sum(deltas)
+    if not total:
+        raise Exception('no packets counted')
+    spread = [100.0 * d / total for d in deltas]
+    return total / elapsed, spread
+
+def run(opts, qemu, kernel, initrd, tmpdir, mode, queues):
+    qmp_path = os.path.join(tmpdir, 'qmp.sock')
+    if os.path.exists(qmp_path):
+        os.unlink(qmp_path)
+    mon = qmp.QEMUMonitorProtocol(qmp_path, server=True)
+
+    device = 'virtio-net-device,id=nic0,netdev=net0,mq=on,len-iothreads=%d' % \
+             queues
+    args = [qemu, '-nographic', '-nodefaults', '-M', opts.machine,
+            '-cpu', opts.cpu, '-smp', str(queues), '-m', '1024',
+            '-serial', 'null', '-kernel', kernel, '-initrd', initrd,
+            '-append', 'console=ttyAMA0 panic=-1 mqbench.queues=%d '
+                       'mqbench.mode=%s' % (queues, mode),
+            '-netdev', 'tap,id=net0,ifname=%s,script=no,downscript=no,'
+                       'queues=%d,vhost=off' % (IFNAME, queues)]
+    for i in range(queues):
+        args += ['-object', 'iothread,id=io%d' % i]
+        device += ',iothreads[%d]=io%d' % (i, i)
+    args += ['-device', device, '-qmp', 'unix:' + qmp_path]
+    if opts.qemu_args:
+        args += opts.qemu_args.split()
+
+    subprocess.check_call(['ip', 'netns', 'add', NETNS])
+    proc = None
+    senders = []
+    try:
+        proc = subprocess.Popen(args)
+        mon.accept()
+        subprocess.check_call(['ip', 'link', 'set', IFNAME,
+                               'netns', NETNS])
+        netns('ip', 'addr', 'add', HOST_ADDR + '/24', 'dev', IFNAME)
+        netns('ip', 'link', 'set', IFNAME, 'up')
+        time.sleep(opts.boot)
+        if mode == 'rx':
+            senders = start_senders(opts, queues)
+        return measure(opts, mon, mode)
+    finally:
+        for sender in senders:
+            sender.kill()
+            sender.wait()
+        if proc:
+            if proc.poll() is None:
+                proc.kill()
+            proc.wait()
+        mon.close()
+        subprocess.call(['ip', 'netns', 'del', NETNS])
+
+def main():
+    parser = optparse.OptionParser(
+        usage='%prog [options] QEMU KERNEL INITRD')
+    parser.add_option('-q', '--queues', default='1,2,4',
+                      help='comma separated queue pair counts [%default]')
+    parser.add_option('-m', '--modes', default=','.join(MODES),
+                      help='comma separated directions, as seen from the '
+                           'guest [%default]')
+    parser.add_option('-s', '--size', type='int', default=64,
+                      help='UDP payload size of the rx senders [%default]')
+    parser.add_option('-p', '--port', type='int', default=9000,
+                      help='first guest UDP port of the rx flows '
+                           '[%default]')
+    parser.add_option('-d', '--duration', type='float', default=10,
+                      help='seconds to measure each run [%default]')
+    parser.add_option('--warmup', type='float', default=2,
+                      help='seconds between starting traffic and measuring '
+                           '[%default]')
+    parser.add_option('--boot', type='float', default=20,
+                      help='seconds to let the guest boot [%default]')
+    parser.add_option('--machine', default='virt',
+                      help='guest machine type [%default]')
+    parser.add_option('--cpu', default='cortex-a57',
+                      help='guest CPU model [%default]')
+    parser.add_option('--qemu-args', help='more QEMU arguments, '
+                                          'e.g. -enable-kvm')
+    parser.add_option('--send', type='int', help=optparse.SUPPRESS_HELP)
+    opts, args = parser.parse_args()
+    if opts.send is not None:
+        send(opts, opts.send)
+        return
+    if len(args) != 3:
+        parser.error('expecting the QEMU binary, a kernel and an initrd')
+    qemu, kernel, initrd = args
+    modes = opts.modes.split(',')
+    for mode in modes:
+        if mode not in MODES:
+            parser.error('unknown direction ' + mode)
+    if os.geteuid() != 0:
+        parser.error('must run as root')
+
+    tmpdir = tempfile.mkdtemp(prefix='virtio-net-mq-bench.')
+    try:
+        print '%6s %4s %10s  %s' % ('queues', 'mode', 'kpps',
+                                    'per-queue share (%)')
+        for mode in modes:
+            for queues in [int(q) for q in opts.queues.split(',')]:
+                pps, spread = run(opts, qemu, kernel, initrd, tmpdir, mode,
+                                  queues)
+                if mode == 'tx':
+                    share = '-'
+                else:
+                    share = ' '.join(['%.0f' % s for s in spread])
+                print '%6d %4s %10.1f  %s' % (queues, mode, pps / 1000,
+                                              share)
+    finally:
+        shutil.rmtree(tmpdir)
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,130 @@
+#!/usr/bin/env python
+#
+# Split and packed virtqueue benchmark
+#
+# This work is licensed under the terms of the GNU GPL, version 2 or later.
+# See the COPYING file in the top-level directory.
+#
+# Usage: virtio-packed-bench.py [options] QEMU KERNEL INITRD
+#
+# Boots an ARM "virt" guest once with split and once with packed virtqueues
+# (the "packed" property of the virtio devices), with the virtio-mmio
+# transports in version 2 mode.  The guest has a RAM-backed raw image as a
+# virtio-blk disk (/dev/vda) and a virtio-net card (eth0) whose frames are
+# sent in UDP datagrams to this script.  The initrd must first flood eth0
+# with small frames (for example with pktgen) for a few seconds, then run a
+# 4k random read benchmark on the disk (for example fio with --rw=randread
+# --bs=4k --iodepth=32 --direct=1), print fio's usual summary on the serial
+# console and power off.
+#
+# For every ring layout the disk IOPS and the frames per second received
+# from the guest are printed.
+
+import optparse
+import os
+import shutil
+import socket
+import subprocess
+import tempfile
+import time
+
+from benchlib import parse_iops
+
+LAYOUTS = ['split', 'packed']
+
+def run(opts, qemu, kernel, initrd, image, tmpdir, layout):
+    console = os.path.join(tmpdir, 'console.log')
+    packed = 'on' if layout == 'packed' else 'off'
+    sock = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+    sock.bind(('127.0.0.1', 0))
+    sock.settimeout(0.5)
+    port = sock.getsockname()[1]
+    args = [qemu, '-nographic', '-nodefaults', '-no-reboot',
+            '-M', 'virt', '-cpu', opts.cpu, '-m', '1024',
+            '-serial', 'file:' + console,
+            '-kernel', kernel, '-initrd', initrd,
+            '-append', 'console=ttyAMA0 panic=-1',
+            '-global', 'virtio-mmio.force-legacy=off',
+            '-drive', 'file=%s,if=none,id=disk,format=raw,cache=%s' %
+                      (image, opts.cache),
+            '-device', 'virtio-blk-device,drive=disk,packed=%s' % packed,
+            '-netdev', 'socket,id=net0,udp=127.0.0.1:%d,'
+                       'localaddr=127.0.0.1:0' % port,
+            '-device', 'virtio-net-device,netdev=net0,packed=%s' % packed]
+    if opts.qemu_args:
+        args += opts.qemu_args.split()
+
+    frames = 0
+    first = last = None
+    proc = subprocess.Popen(args)
+    try:
+        deadline = time.time() + opts.timeout
+        while proc.poll() is None:
+            if time.time() > deadline:
+                raise Exception('timed out waiting for the guest')
+            try:
+                sock.recv(65536)
+            except socket.timeout:
+                continue
+            last = time.time()
+            if first is None:
+                first = last
+            frames += 1
+    finally:
+        if proc.poll() is None:
+            proc.kill()
+        proc.wait()
+        sock.close()
+
+    out = open(console).read()
+    iops = parse_iops(out)
+    if not iops:
+        raise Exception('no IOPS= lines on the guest console')
+    if frames < 2:
+        raise Exception('the guest sent no frames')
+    return iops, (frames - 1) / max(last - first, 1e-6)
+
+def main():
+    parser = optparse.OptionParser(
+        usage='%prog [options] QEMU KERNEL INITRD')
+    parser.add_option('-l', '--layouts', default=','.join(LAYOUTS),
+                      help='comma separated ring layouts [%default]')
+    parser.add_option('-s', '--size', type='int', default=1024,
+                      help='size in MiB of the image [%default]')
+    parser.add_option('--dir', default='/dev/shm',
+                      help='RAM-backed directory for the image [%default]')
+    parser.add_option('-t', '--cache', default='writeback',
+                      help='cache mode [%default]')
+    parser.add_option('--cpu', default='cortex-a57',
+                      help='guest CPU model [%default]')
+    parser.add_option('--timeout', type='int', default=600,
+                      help='seconds to wait for each guest run [%default]')
+    parser.add_option('--qemu-args', help='more QEMU arguments, '
+                                          'e.g. -enable-kvm')
+    opts, args = parser.parse_args()
+    if len(args) != 3:
+        parser.error('expecting the QEMU binary, a kernel and an initrd')
+    qemu, kernel, initrd = args
+    layouts = opts.layouts.split(',')
+    for layout in layouts:
+        if layout not in LAYOUTS:
+            parser.error('unknown ring layout ' + layout)
+
+    tmpdir = tempfile.mkdtemp(prefix='virtio-packed-bench.', dir=opts.dir)
+    try:
+        image = os.path.join(tmpdir, 'test.raw')
+        f = open(image, 'wb')
+        chunk = '\xa5' * (1 << 20)
+        for i in range(opts.size):
+            f.write(chunk)
+        f.close()
+
+        print '%-7s %10s %12s' % ('layout', 'blk IOPS', 'net frames/s')
+        for layout in layouts:
+            iops, fps = run(opts, qemu, kernel, initrd, image, tmpdir, layout)
+            print '%-7s %10.0f %12.0f' % (layout, iops, fps)
+    finally:
+        shutil.rmtree(tmpdir)
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,182 @@
+#!/usr/bin/env python
+#
+# VNC server scalability benchmark
+#
+# This work is licensed under the terms of the GNU GPL, version 2 or later.
+# See the COPYING file in the top-level directory.
+#
+# Usage: vnc-bench.py [options] QEMU KERNEL INITRD
+#
+# Boots a guest once for every number of VNC encoding threads (the workers=
+# option of -vnc, 1 and 4 by default) and connects 1, 4 and 16 shared
+# clients to its VNC server in turn.  The initrd must switch the display to
+# 1920x1080 and then keep redrawing the whole screen (for example by copying
+# alternating frames to /dev/fb0) until it is powered off.
+#
+# Every client asks for the raw or hextile encoding and sends an incremental
+# update request as soon as the previous update has arrived.  For every run
+# the framebuffer update messages per second, the frames per second (pixels
+# received divided by the screen size, summed over all clients) and the
+# main loop occupancy (CPU time of QEMU's main thread over wall clock time)
+# are printed.
+
+import multiprocessing
+import optparse
+import os
+import shutil
+import socket
+import struct
+import subprocess
+import tempfile
+import time
+
+from benchlib import recv_exact, handshake, request, skip_hextile
+
+ENCODINGS = {'raw': 0, 'hextile': 5}
+
+def client(path, encoding, start, end, results):
+    sock = socket.socket(socket.AF_UNIX, socket.SOCK_STREAM)
+    sock.connect(path)
+    width, height, bpp = handshake(sock)
+    sock.sendall(struct.pack('>BBHi', 2, 0, 1, ENCODINGS[encoding]))
+    request(sock, width, height, 0)
+
+    updates = pixels = 0
+    while True:
+        msg = ord(recv_exact(sock, 1))
+        if msg == 0:
+            nrects = struct.unpack('>xH', recv_exact(sock, 3))[0]
+            area = 0
+            for i in range(nrects):
+                x, y, w, h, enc = struct.unpack('>HHHHi', recv_exact(sock, 12))
+                if enc == ENCODINGS['raw']:
+                    recv_exact(sock, w * h * bpp)
+                elif enc == ENCODINGS['hextile']:
+                    skip_hextile(sock, w, h, bpp)
+                else:
+                    raise Exception('unexpected encoding %d' % enc)
+                area += w * h
+            now = time.time()
+            if now >= end:
+                break
+            if now >= start:
+                updates += 1
+                pixels += area
+            request(sock, width, height, 1)
+        elif msg == 2:
+            pass                                # bell
+        elif msg == 3:
+            length = struct.unpack('>xxxI', recv_exact(sock, 7))[0]
+            recv_exact(sock, length)            # cut text
+        else:
+            raise Exception('unexpected server message %d' % msg)
+    sock.close()
+    results.put((updates, float(pixels) / (width * height)))
+
+def main_thread_ticks(pid):
+    stat = open('/proc/%d/task/%d/stat' % (pid, pid)).read()
+    fields = stat[stat.rindex(')') + 2:].split()
+    # utime and stime are fields 14 and 15 of the whole line
+    return int(fields[11]) + int(fields[12])
+
+def measure(opts, path, pid, nclients):
+    results = multiprocessing.Queue()
+    start = time.time() + opts.warmup
+    end = start + opts.duration
+    procs = [multiprocessing.Process(target=client,
+                                     args=(path, opts.encoding, start, end,
+                                           results))
+             for i in range(nclients)]
+    for p in procs:
+        p.start()
+
+    time.sleep(max(start - time.time(), 0))
+    ticks = main_thread_ticks(pid)
+    time.sleep(max(end - time.time(), 0))
+    ticks = main_thread_ticks(pid) - ticks
+
+    updates = frames = 0.0
+    for p in procs:
+        u, f = results.get(timeout=opts.duration + 60)
+        updates += u
+        frames += f
+    for p in procs:
+        p.join()
+    occupancy = float(ticks) / os.sysconf('SC_CLK_TCK') / opts.duration
+    return updates / opts.duration, frames / opts.duration, occupancy
+
+def run(opts, qemu, kernel, initrd, tmpdir, workers, clients):
+    path = os.path.join(tmpdir, 'vnc.sock')
+    if os.path.exists(path):
+        os.unlink(path)
+    args = [qemu, '-nodefaults', '-m', '1024', '-vga', opts.vga,
+            '-serial', 'null', '-kernel', kernel, '-initrd', initrd,
+            '-append', 'console=ttyS0 panic=-1',
+            '-vnc', 'unix:%s,share=force-shared,workers=%d' % (path, workers)]
+    if opts.qemu_args:
+        args += opts.qemu_args.split()
+
+    results = []
+    proc = subprocess.Popen(args)
+    try:
+        deadline = time.time() + opts.timeout
+        while not os.path.exists(path):
+            if proc.poll() is not None or time.time() > deadline:
+                raise Exception('QEMU did not start its VNC server')
+            time.sleep(0.1)
+        time.sleep(opts.boot)
+        for nclients in clients:
+            results.append((nclients, measure(opts, path, proc.pid,
+                                              nclients)))
+    finally:
+        if proc.poll() is None:
+            proc.kill()
+        proc.wait()
+    return results
+
+def main():
+    parser = optparse.OptionParser(
+        usage='%prog [options] QEMU KERNEL INITRD')
+    parser.add_option('-w', '--workers', default='1,4',
+                      help='comma separated numbers of VNC encoding threads '
+                           '[%default]')
+    parser.add_option('-c', '--clients', default='1,4,16',
+                      help='comma separated numbers of clients [%default]')
+    parser.add_option('-e', '--encoding', default='raw',
+                      help='raw or hextile [%default]')
+    parser.add_option('-d', '--duration', type='float', default=10,
+                      help='seconds to measure each run [%default]')
+    parser.add_option('--warmup', type='float', default=2,
+                      help='seconds between connecting and measuring '
+                           '[%default]')
+    parser.add_option('--boot', type='float', default=20,
+                      help='seconds to let the guest boot [%default]')
+    parser.add_option('--vga', default='std',
+                      help='guest display device [%default]')
+    parser.add_option('--timeout', type='int', default=60,
+                      help='seconds to wait for QEMU to start [%default]')
+    parser.add_option('--qemu-args', help='more QEMU arguments, '
+                                          'e.g. -enable-kvm')
+    opts, args = parser.parse_args()
+    if len(args) != 3:
+        parser.error('expecting the QEMU binary, a kernel and an initrd')
+    qemu, kernel, initrd = args
+    if opts.encoding not in ENCODINGS:
+        parser.error('unknown encoding ' + opts.encoding)
+    clients = [int(c) for c in opts.clients.split(',')]
+
+    tmpdir = tempfile.mkdtemp(prefix='vnc-bench.')
+    try:
+        print '%7s %7s %10s %10s %10s' % ('workers', 'clients', 'updates/s',
+                                          'frames/s', 'main loop')
+        for workers in [int(w) for w in opts.workers.split(',')]:
+            for nclients, (ups, fps, occupancy) in run(opts, qemu, kernel,
+                                                       initrd, tmpdir,
+                                                       workers, clients):
+                print '%7d %7d %10.1f %10.1f %9.1f%%' % (
+                    workers, nclients, ups, fps, occupancy * 100)
+    finally:
+        shutil.rmtree(tmpdir)
+
+if __name__ == '__main__':
+    main()
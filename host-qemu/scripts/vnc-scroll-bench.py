@@ -0,0 +1,230 @@
+#!/usr/bin/env python
+#
+# VNC continuous updates benchmark
+#
+# This work is licensed under the terms of the GNU GPL, version 2 or later.
+# See the COPYING file in the top-level directory.
+#
+# Usage: vnc-scroll-bench.py [options] QEMU KERNEL INITRD
+#
+# Boots a guest and connects one client to its VNC server, once for every
+# update mode.  The initrd must switch the display to 1920x1080 and then
+# keep scrolling the whole screen (for example by copying a tall image to
+# /dev/fb0 at an offset that moves down a few lines every frame) until it
+# is powered off.
+#
+# In "request" mode the client sends an incremental update request as soon
+# as the previous update has arrived, like most clients do.  In
+# "continuous" mode it enables the ContinuousUpdates and Fence extensions,
+# so that the server streams updates and paces them with the fences that
+# the client answers.  The tight encoding with JPEG is used by default.
+#
+# For every mode the framebuffer updates per second, the screens per second
+# (pixels received divided by the screen size), and the CPU time used by
+# all of QEMU's threads per update are printed.
+
+import optparse
+import os
+import shutil
+import socket
+import struct
+import subprocess
+import tempfile
+import time
+
+from benchlib import recv_exact, handshake, request, skip_hextile, cpu_ticks
+
+MODES = ['request', 'continuous']
+ENCODINGS = {'raw': 0, 'hextile': 5, 'tight': 7}
+
+ENCODING_QUALITY0 = -32
+ENCODING_FENCE = -312
+ENCODING_CONTINUOUS_UPDATES = -313
+
+FENCE_BLOCK_BEFORE = 1
+FENCE_BLOCK_AFTER = 2
+FENCE_SYNC_NEXT = 4
+FENCE_REQUEST = 1 << 31
+
+def recv_compact(sock):
+    b = ord(recv_exact(sock, 1))
+    n = b & 0x7f
+    if b & 0x80:
+        b = ord(recv_exact(sock, 1))
+        n |= (b & 0x7f) << 7
+        if b & 0x80:
+            n |= ord(recv_exact(sock, 1)) << 14
+    return n
+
+def skip_tight(sock, w, h, bpp):
+    # 32 bit pixels with 8 bit channels are sent as 3 bytes
+    tpixel = 3 if bpp == 4 else bpp
+    ctl = ord(recv_exact(sock, 1)) >> 4
+    if ctl == 8:                                # fill
+        recv_exact(sock, tpixel)
+        return
+    if ctl == 9 or ctl == 10:                   # JPEG or PNG
+        recv_exact(sock, recv_compact(sock))
+        return
+    if ctl > 7:
+        raise Exception('bad tight compression control %#x' % ctl)
+    size = w * h * tpixel
+    if ctl & 4 and ord(recv_exact(sock, 1)) == 1:
+        colors = ord(recv_exact(sock, 1)) + 1
+        recv_exact(sock, colors * tpixel)
+        size = (w + 7) / 8 * h if colors <= 2 else w * h
+    if size < 12:
+        recv_exact(sock, size)
+    else:
+        recv_exact(sock, recv_compact(sock))
+
+def send_fence(sock, flags, payload):
+    sock.sendall(struct.pack('>BxxxIB', 248, flags, len(payload)) + payload)
+
+def measure(opts, path, pid, mode):
+    sock = socket.socket(socket.AF_UNIX, socket.SOCK_STREAM)
+    sock.connect(path)
+    width, height, bpp = handshake(sock)
+    encodings = [ENCODINGS[opts.encoding], ENCODING_QUALITY0 + opts.quality]
+    if mode == 'continuous':
+        encodings += [ENCODING_FENCE, ENCODING_CONTINUOUS_UPDATES]
+    sock.sendall(struct.pack('>BxH', 2, len(encodings)) +
+                 ''.join([struct.pack('>i', e) for e in encodings]))
+    request(sock, width, height, 0)
+
+    start = time.time() + opts.warmup
+    end = start + opts.duration
+    ticks = None
+    cu_enabled = False
+    updates = pixels = 0
+    while True:
+        msg = ord(recv_exact(sock, 1))
+        if msg == 0:
+            nrects = struct.unpack('>xH', recv_exact(sock, 3))[0]
+            area = 0
+            for i in range(nrects):
+                x, y, w, h, enc = struct.unpack('>HHHHi', recv_exact(sock, 12))
+                if enc == ENCODINGS['raw']:
+                    recv_exact(sock, w * h * bpp)
+                elif enc == ENCODINGS['hextile']:
+                    skip_hextile(sock, w, h, bpp)
+                elif enc == ENCODINGS['tight']:
+                    skip_tight(sock, w, h, bpp)
+                else:
+                    raise Exception('unexpected encoding %d' % enc)
+                area += w * h
+            now = time.time()
+            if now >= end:
+                ticks = cpu_ticks(pid) - ticks
+                break
+            if now >= start:
+                if ticks is None:
+                    ticks = cpu_ticks(pid)
+                else:
+                    updates += 1
+                    pixels += area
+            if mode == 'request':
+                request(sock, width, height, 1)
+        elif msg == 2:
+            pass                                # bell
+        elif msg == 3:
+            length = struct.unpack('>xxxI', recv_exact(sock, 7))[0]
+            recv_exact(sock, length)            # cut text
+        elif msg == 150:
+            # EndOfContinuousUpdates confirms the extension
+            if not cu_enabled:
+                sock.sendall(struct.pack('>BBHHHH', 150, 1, 0, 0,
+                                         width, height))
+                cu_enabled = True
+        elif msg == 248:
+            flags, length = struct.unpack('>xxxIB', recv_exact(sock, 8))
+            payload = recv_exact(sock, length)
+            if flags & FENCE_REQUEST:
+                send_fence(sock, flags & (FENCE_BLOCK_BEFORE |
+                                          FENCE_BLOCK_AFTER |
+                                          FENCE_SYNC_NEXT), payload)
+        else:
+            raise Exception('unexpected server message %d' % msg)
+    sock.close()
+
+    if not updates:
+        raise Exception('no updates received')
+    cpu = float(ticks) / os.sysconf('SC_CLK_TCK')
+    return (updates / opts.duration,
+            float(pixels) / (width * height) / opts.duration,
+            cpu / updates)
+
+def run(opts, qemu, kernel, initrd, tmpdir, mode):
+    path = os.path.join(tmpdir, 'vnc.sock')
+    if os.path.exists(path):
+        os.unlink(path)
+    args = [qemu, '-nodefaults', '-m', '1024', '-vga', opts.vga,
+            '-serial', 'null', '-kernel', kernel, '-initrd', initrd,
+            '-append', 'console=ttyS0 panic=-1',
+            '-vnc', 'unix:%s,lossy,workers=%d' % (path, opts.workers)]
+    if opts.qemu_args:
+        args += opts.qemu_args.split()
+
+    proc = subprocess.Popen(args)
+    try:
+        deadline = time.time() + opts.timeout
+        while not os.path.exists(path):
+            if proc.poll() is not None or time.time() > deadline:
+                raise Exception('QEMU did not start its VNC server')
+            time.sleep(0.1)
+        time.sleep(opts.boot)
+        return measure(opts, path, proc.pid, mode)
+    finally:
+        if proc.poll() is None:
+            proc.kill()
+        proc.wait()
+
+def main():
+    parser = optparse.OptionParser(
+        usage='%prog [options] QEMU KERNEL INITRD')
+    parser.add_option('-m', '--modes', default=','.join(MODES),
+                      help='comma separated update modes [%default]')
+    parser.add_option('-e', '--encoding', default='tight',
+                      help='raw, hextile or tight [%default]')
+    parser.add_option('-q', '--quality', type='int', default=7,
+                      help='JPEG quality level, 0 to 9 [%default]')
+    parser.add_option('-w', '--workers', type='int', default=1,
+                      help='number of VNC encoding threads [%default]')
+    parser.add_option('-d', '--duration', type='float', default=10,
+                      help='seconds to measure each run [%default]')
+    parser.add_option('--warmup', type='float', default=2,
+                      help='seconds between connecting and measuring '
+                           '[%default]')
+    parser.add_option('--boot', type='float', default=20,
+                      help='seconds to let the guest boot [%default]')
+    parser.add_option('--vga', default='std',
+                      help='guest display device [%default]')
+    parser.add_option('--timeout', type='int', default=60,
+                      help='seconds to wait for QEMU to start [%default]')
+    parser.add_option('--qemu-args', help='more QEMU arguments, '
+                                          'e.g. -enable-kvm')
+    opts, args = parser.parse_args()
+    if len(args) != 3:
+        parser.error('expecting the QEMU binary, a kernel and an initrd')
+    qemu, kernel, initrd = args
+    if opts.encoding not in ENCODINGS:
+        parser.error('unknown encoding ' + opts.encoding)
+    if opts.quality < 0 or opts.quality > 9:
+        parser.error('the quality level must be between 0 and 9')
+    modes = opts.modes.split(',')
+    for mode in modes:
+        if mode not in MODES:
+            parser.error('unknown update mode ' + mode)
+
+    tmpdir = tempfile.mkdtemp(prefix='vnc-scroll-bench.')
+    try:
+        print '%-10s %10s %10s %14s' % ('mode', 'updates/s', 'screens/s',
+                                        'CPU ms/update')
+        for mode in modes:
+            ups, sps, cpu = run(opts, qemu, kernel, initrd, tmpdir, mode)
+            print '%-10s %10.1f %10.1f %14.2f' % (mode, ups, sps, cpu * 1000)
+    finally:
+        shutil.rmtree(tmpdir)
+
+if __name__ == '__main__':
+    main()
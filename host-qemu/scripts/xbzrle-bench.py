@@ -0,0 +1,166 @@
+#!/usr/bin/env python
+#
+# XBZRLE migration benchmark
+#
+# This work is licensed under the terms of the GNU GPL, version 2 or later.
+# See the COPYING file in the top-level directory.
+#
+# Usage: xbzrle-bench.py [options] QEMU [QEMU-ARGS...]
+#
+# Migrates an idle "virt" machine under the qtest accelerator between two
+# local QEMU processes with the xbzrle capability, once for each number of
+# xbzrle threads.  The source RAM is first filled with a pattern; while the
+# migration runs, a synthetic workload keeps writing a few random bytes to
+# random pages of a working set through qtest, so that pages are sent again
+# and again and go through the xbzrle cache.  After --time seconds the
+# workload stops and the migration is left to converge.
+#
+# For every run the number of xbzrle encoded pages, the encoded pages per
+# second of migration, and the cache misses (as a count and as a share of
+# the cache lookups) are printed.
+
+import optparse
+import os
+import random
+import shutil
+import socket
+import subprocess
+import sys
+import tempfile
+import time
+
+sys.path.append(os.path.join(os.path.dirname(__file__), 'qmp'))
+import qmp
+from benchlib import check
+
+DEFAULT_ARGS = ['-machine', 'virt,accel=qtest', '-nographic', '-nodefaults']
+FILL_CHUNK = 64 << 20
+PAGE_SIZE = 4096
+
+class QTest(object):
+    def __init__(self, sock):
+        self.sock = sock
+        self.buf = ''
+
+    def cmd(self, cmd):
+        self.sock.sendall(cmd + '\n')
+        while '\n' not in self.buf:
+            data = self.sock.recv(256)
+            if not data:
+                raise Exception('qtest connection closed')
+            self.buf += data
+        reply, self.buf = self.buf.split('\n', 1)
+        if not reply.startswith('OK'):
+            raise Exception('qtest command failed: ' + reply)
+
+def start(qemu, args, tmpdir, name, extra, qtest):
+    qmp_path = os.path.join(tmpdir, name + '.qmp')
+    qtest_path = os.path.join(tmpdir, name + '.qtest')
+    mon = qmp.QEMUMonitorProtocol(qmp_path, server=True)
+    cmdline = [qemu] + args + ['-qmp', 'unix:' + qmp_path] + extra
+    listener = None
+    if qtest:
+        listener = socket.socket(socket.AF_UNIX, socket.SOCK_STREAM)
+        listener.bind(qtest_path)
+        listener.listen(1)
+        cmdline += ['-qtest', 'unix:' + qtest_path]
+    proc = subprocess.Popen(cmdline)
+    if listener:
+        sock, _ = listener.accept()
+        qtest = QTest(sock)
+    mon.accept()
+    return proc, mon, qtest
+
+def dirty(opts, qtest, until):
+    # Each command writes 8 random bytes at a random place in one page of
+    # the working set.
+    pages = (opts.working_set << 20) / PAGE_SIZE
+    while time.time() < until:
+        for _ in range(256):
+            addr = (opts.ram_base + random.randrange(pages) * PAGE_SIZE +
+                    random.randrange(PAGE_SIZE / 8) * 8)
+            qtest.cmd('write 0x%x 8 0x%016x' % (addr, random.getrandbits(64)))
+
+def run(opts, qemu, args, threads):
+    tmpdir = tempfile.mkdtemp(prefix='xbzrle-bench.')
+    uri = 'unix:' + os.path.join(tmpdir, 'migrate.sock')
+    procs = []
+    try:
+        dst_proc, dst, _ = start(qemu, args, tmpdir, 'dst',
+                                 ['-incoming', uri], False)
+        procs.append(dst_proc)
+        src_proc, src, qtest = start(qemu, args, tmpdir, 'src', [], True)
+        procs.append(src_proc)
+
+        size = opts.mem << 20
+        for addr in range(0, size, FILL_CHUNK):
+            qtest.cmd('memset 0x%x 0x%x 0x5a' %
+                      (opts.ram_base + addr, min(FILL_CHUNK, size - addr)))
+
+        caps = [{'capability': 'xbzrle', 'state': True}]
+        for mon in (src, dst):
+            check(mon.cmd('migrate-set-capabilities', {'capabilities': caps}))
+        check(src.cmd('migrate-set-parameters', {'xbzrle-threads': threads}))
+        check(src.cmd('migrate-set-cache-size',
+                      {'value': opts.cache_size << 20}))
+        check(src.cmd('migrate_set_speed', {'value': opts.speed << 20}))
+        check(src.cmd('migrate_set_downtime', {'value': 0.3}))
+
+        check(src.cmd('migrate', {'uri': uri}))
+        dirty(opts, qtest, time.time() + opts.time)
+        while True:
+            info = check(src.cmd('query-migrate'))
+            if info['status'] in ('completed', 'failed', 'cancelled'):
+                break
+            time.sleep(0.05)
+        if info['status'] != 'completed':
+            raise Exception('migration ' + info['status'])
+
+        for mon in (src, dst):
+            mon.cmd('quit')
+        return info['total-time'], info['xbzrle-cache']
+    finally:
+        for proc in procs:
+            if proc.poll() is None:
+                proc.kill()
+            proc.wait()
+        shutil.rmtree(tmpdir)
+
+def main():
+    parser = optparse.OptionParser(
+        usage='%prog [options] QEMU [QEMU-ARGS...]')
+    parser.add_option('-j', '--threads', default='1,2,4,8',
+                      help='comma separated xbzrle thread counts '
+                           '[%default]')
+    parser.add_option('-m', '--mem', type='int', default=1024,
+                      help='guest RAM in MiB [%default]')
+    parser.add_option('-w', '--working-set', type='int', default=256,
+                      help='MiB of RAM dirtied by the workload [%default]')
+    parser.add_option('-c', '--cache-size', type='int', default=256,
+                      help='xbzrle cache size in MiB [%default]')
+    parser.add_option('-t', '--time', type='float', default=10,
+                      help='seconds to run the workload for [%default]')
+    parser.add_option('-s', '--speed', type='int', default=1024,
+                      help='bandwidth limit in MiB/s [%default]')
+    parser.add_option('--ram-base', type='int', default=0x40000000,
+                      help='guest physical address of RAM [%default]')
+    opts, args = parser.parse_args()
+    if not args:
+        parser.error('missing QEMU binary')
+    qemu = args[0]
+    args = DEFAULT_ARGS + ['-m', str(opts.mem)] + args[1:]
+
+    print '%7s %9s %12s %12s %10s %7s' % ('threads', 'time (s)',
+                                          'xbzrle pages', 'pages/s',
+                                          'misses', 'miss %')
+    for threads in [int(t) for t in opts.threads.split(',')]:
+        total_ms, cache = run(opts, qemu, args, threads)
+        secs = total_ms / 1000.0
+        lookups = cache['pages'] + cache['cache-miss'] + cache['overflow']
+        print '%7d %9.2f %12d %12.0f %10d %7.1f' % (
+            threads, secs, cache['pages'],
+            cache['pages'] / secs if secs else 0, cache['cache-miss'],
+            100.0 * cache['cache-miss'] / lookups if lookups else 0)
+
+if __name__ == '__main__':
+    main()
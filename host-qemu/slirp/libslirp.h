@@ -20,10 +20,32 @@ void slirp_pollfds_fill(GArray *pollfds, uint32_t *timeout);
 
 void slirp_pollfds_poll(GArray *pollfds, int select_error);
 
+/* The TCP and UDP checksums of the packet need not be verified */
+#define SLIRP_INPUT_CSUM_VALID 1
+
 void slirp_input(Slirp *slirp, const uint8_t *pkt, int pkt_len);
+void slirp_input_iov(Slirp *slirp, const struct iovec *iov, int iovcnt,
+                     size_t offset, int flags);
+
+/*
+ * Let the packets output to the guest carry partial TCP checksums, which
+ * the guest completes, and with @tso TCP segments larger than the MTU,
+ * which the guest splits at the segment size it advertised.
+ */
+void slirp_set_offload(Slirp *slirp, bool csum, bool tso);
+
+/* Offloads of a packet output to the guest, see slirp_set_offload() */
+typedef struct SlirpOffload {
+    int csum_start;     /* offset of the TCP header */
+    int csum_offset;    /* offset of the checksum in the TCP header */
+    int hdr_len;        /* length of the Ethernet, IP and TCP headers */
+    int gso_size;       /* TCP segment size, or 0 if no larger than the MTU */
+} SlirpOffload;
 
 /* you must provide the following functions: */
 void slirp_output(void *opaque, const uint8_t *pkt, int pkt_len);
+void slirp_output_iov(void *opaque, const struct iovec *iov, int iovcnt,
+                      const SlirpOffload *offload);
 
 int slirp_add_hostfwd(Slirp *slirp, int is_udp,
                       struct in_addr host_addr, int host_port,
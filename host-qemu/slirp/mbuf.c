@@ -93,6 +93,7 @@ m_get(Slirp *slirp)
         m->m_prevpkt = NULL;
         m->arp_requested = false;
         m->expiration_date = (uint64_t)-1;
+        m->m_gso_size = 0;
 end_error:
 	DEBUG_ARG("m = %lx", (long )m);
 	return m;
@@ -81,6 +81,7 @@ struct mbuf {
 	Slirp *slirp;
 	bool	arp_requested;
 	uint64_t expiration_date;
+	int	m_gso_size;		/* TCP segment size, if larger than the MTU */
 	/* start of dynamic buffer area, must be last element */
 	union {
 		char	m_dat[1]; /* ANSI don't like 0 sized arrays */
@@ -99,6 +100,10 @@ struct mbuf {
 #define M_USEDLIST		0x04	/* XXX mbuf is on used list (for dtom()) */
 #define M_DOFREE		0x08	/* when m_free is called on the mbuf, free()
 					 * it rather than putting it on the free list */
+#define M_CSUM_VALID		0x10	/* the guest vouches for the TCP or UDP
+					 * checksum, don't verify it */
+#define M_CSUM_PARTIAL		0x20	/* the TCP checksum only covers the
+					 * pseudo header, the guest completes it */
 
 void m_init(Slirp *);
 void m_cleanup(Slirp *slirp);
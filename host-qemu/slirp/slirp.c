@@ -22,6 +22,7 @@
  * THE SOFTWARE.
  */
 #include "qemu-common.h"
+#include "qemu/iov.h"
 #include "qemu/timer.h"
 #include "sysemu/char.h"
 #include "slirp.h"
@@ -728,18 +729,33 @@ static void arp_input(Slirp *slirp, const uint8_t *pkt, int pkt_len)
     }
 }
 
-void slirp_input(Slirp *slirp, const uint8_t *pkt, int pkt_len)
+/*
+ * Input the packet that starts @offset bytes into @iov.  IP packets are
+ * copied once, straight into the mbuf that carries them through the stack.
+ */
+void slirp_input_iov(Slirp *slirp, const struct iovec *iov, int iovcnt,
+                     size_t offset, int flags)
 {
+    uint8_t arp[ETH_HLEN + sizeof(struct arphdr)];
     struct mbuf *m;
-    int proto;
+    size_t size = iov_size(iov, iovcnt);
+    int pkt_len, proto;
 
-    if (pkt_len < ETH_HLEN)
+    if (offset > size || size - offset < ETH_HLEN ||
+        size - offset > ETH_HLEN + IP_MAXPACKET) {
         return;
+    }
+    pkt_len = size - offset;
 
-    proto = ntohs(*(uint16_t *)(pkt + 12));
+    iov_to_buf(iov, iovcnt, offset, arp, ETH_HLEN);
+    proto = ntohs(*(uint16_t *)(arp + 12));
     switch(proto) {
     case ETH_P_ARP:
-        arp_input(slirp, pkt, pkt_len);
+        if (pkt_len < sizeof(arp)) {
+            return;
+        }
+        iov_to_buf(iov, iovcnt, offset, arp, sizeof(arp));
+        arp_input(slirp, arp, sizeof(arp));
         break;
     case ETH_P_IP:
         m = m_get(slirp);
@@ -750,10 +766,13 @@ void slirp_input(Slirp *slirp, const uint8_t *pkt, int pkt_len)
             m_inc(m, pkt_len + 2);
         }
         m->m_len = pkt_len + 2;
-        memcpy(m->m_data + 2, pkt, pkt_len);
+        iov_to_buf(iov, iovcnt, offset, m->m_data + 2, pkt_len);
 
         m->m_data += 2 + ETH_HLEN;
         m->m_len -= 2 + ETH_HLEN;
+        if (flags & SLIRP_INPUT_CSUM_VALID) {
+            m->m_flags |= M_CSUM_VALID;
+        }
 
         ip_input(m);
         break;
@@ -762,19 +781,33 @@ void slirp_input(Slirp *slirp, const uint8_t *pkt, int pkt_len)
     }
 }
 
+void slirp_input(Slirp *slirp, const uint8_t *pkt, int pkt_len)
+{
+    struct iovec iov = {
+        .iov_base = (void *)pkt,
+        .iov_len = pkt_len,
+    };
+
+    slirp_input_iov(slirp, &iov, 1, 0, 0);
+}
+
+void slirp_set_offload(Slirp *slirp, bool csum, bool tso)
+{
+    slirp->csum_offload = csum;
+    slirp->tso_offload = csum && tso;
+}
+
 /* Output the IP packet to the ethernet device. Returns 0 if the packet must be
  * re-queued.
  */
 int if_encap(Slirp *slirp, struct mbuf *ifm)
 {
-    uint8_t buf[1600];
-    struct ethhdr *eh = (struct ethhdr *)buf;
+    struct ethhdr eh;
+    struct iovec iov[2];
+    SlirpOffload offload;
     uint8_t ethaddr[ETH_ALEN];
     const struct ip *iph = (const struct ip *)ifm->m_data;
-
-    if (ifm->m_len + ETH_HLEN > sizeof(buf)) {
-        return 1;
-    }
+    const struct tcphdr *th;
 
     if (iph->ip_dst.s_addr == 0) {
         /* 0.0.0.0 can not be a destination address, something went wrong,
@@ -819,13 +852,28 @@ int if_encap(Slirp *slirp, struct mbuf *ifm)
         }
         return 0;
     } else {
-        memcpy(eh->h_dest, ethaddr, ETH_ALEN);
-        memcpy(eh->h_source, special_ethaddr, ETH_ALEN - 4);
+        memcpy(eh.h_dest, ethaddr, ETH_ALEN);
+        memcpy(eh.h_source, special_ethaddr, ETH_ALEN - 4);
         /* XXX: not correct */
-        memcpy(&eh->h_source[2], &slirp->vhost_addr, 4);
-        eh->h_proto = htons(ETH_P_IP);
-        memcpy(buf + sizeof(struct ethhdr), ifm->m_data, ifm->m_len);
-        slirp_output(slirp->opaque, buf, ifm->m_len + ETH_HLEN);
+        memcpy(&eh.h_source[2], &slirp->vhost_addr, 4);
+        eh.h_proto = htons(ETH_P_IP);
+
+        /* The packet goes out from the mbuf, behind the Ethernet header */
+        iov[0].iov_base = &eh;
+        iov[0].iov_len = ETH_HLEN;
+        iov[1].iov_base = ifm->m_data;
+        iov[1].iov_len = ifm->m_len;
+        if (!(ifm->m_flags & M_CSUM_PARTIAL)) {
+            slirp_output_iov(slirp->opaque, iov, 2, NULL);
+            return 1;
+        }
+
+        th = (const struct tcphdr *)(ifm->m_data + (iph->ip_hl << 2));
+        offload.csum_start = ETH_HLEN + (iph->ip_hl << 2);
+        offload.csum_offset = offsetof(struct tcphdr, th_sum);
+        offload.hdr_len = offload.csum_start + (th->th_off << 2);
+        offload.gso_size = ifm->m_gso_size;
+        slirp_output_iov(slirp->opaque, iov, 2, &offload);
         return 1;
     }
 }
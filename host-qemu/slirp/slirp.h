@@ -229,6 +229,8 @@ struct Slirp {
     struct mbuf if_batchq;  /* queue for non-interactive data */
     struct mbuf *next_m;    /* pointer to next mbuf to output */
     bool if_start_busy;     /* avoid if_start recursion */
+    bool csum_offload;      /* the guest completes partial TCP checksums */
+    bool tso_offload;       /* the guest takes TCP segments above the MTU */
 
     /* ip states */
     struct ipq ipq;         /* ip reass. queue */
@@ -38,8 +38,16 @@ typedef	uint32_t tcp_seq;
 #define      PR_SLOWHZ       2               /* 2 slow timeouts per second (approx) */
 #define      PR_FASTHZ       5               /* 5 fast timeouts per second (not important) */
 
-#define TCP_SNDSPACE 8192
-#define TCP_RCVSPACE 8192
+/*
+ * The receive buffer is about as large as the largest window that can be
+ * advertised without window scaling, TCP_MAXWIN.  tcp_mss() rounds it up
+ * to a multiple of the MSS, so it can exceed TCP_MAXWIN by almost one
+ * segment; the window that goes out is clamped to TCP_MAXWIN.  The send
+ * buffer is twice as large, so that host sockets are read in large chunks
+ * while a full window is in flight.
+ */
+#define TCP_SNDSPACE (128 * 1024)
+#define TCP_RCVSPACE (64 * 1024)
 
 /*
  * TCP header.
@@ -282,7 +282,7 @@ tcp_input(struct mbuf *m, int iphlen, struct socket *inso)
 	ti->ti_x1 = 0;
 	ti->ti_len = htons((uint16_t)tlen);
 	len = sizeof(struct ip ) + tlen;
-	if(cksum(m, len)) {
+	if (!(m->m_flags & M_CSUM_VALID) && cksum(m, len)) {
 	  goto drop;
 	}
 
@@ -57,7 +57,7 @@ int
 tcp_output(struct tcpcb *tp)
 {
 	register struct socket *so = tp->t_socket;
-	register long len, win;
+	register long len, win, maxlen;
 	int off, flags, error;
 	register struct mbuf *m;
 	register struct tcpiphdr *ti;
@@ -144,8 +144,17 @@ again:
 		}
 	}
 
-	if (len > tp->t_maxseg) {
-		len = tp->t_maxseg;
+	/*
+	 * If the guest takes TCP segmentation offload, send as many full
+	 * segments as fit in one IP packet at once.
+	 */
+	maxlen = tp->t_maxseg;
+	if (so->slirp->tso_offload) {
+		maxlen = (IP_MAXPACKET - sizeof(struct tcpiphdr)) /
+			 tp->t_maxseg * tp->t_maxseg;
+	}
+	if (len > maxlen) {
+		len = maxlen;
 		sendalot = 1;
 	}
 	if (SEQ_LT(tp->snd_nxt + len, tp->snd_una + so->so_snd.sb_cc))
@@ -164,7 +173,7 @@ again:
 	 * to send into a small window), then must resend.
 	 */
 	if (len) {
-		if (len == tp->t_maxseg)
+		if (len >= tp->t_maxseg)
 			goto send;
 		if ((1 || idle || tp->t_flags & TF_NODELAY) &&
 		    len + off >= so->so_snd.sb_cc)
@@ -280,8 +289,8 @@ send:
 	 * Adjust data length if insertion of options will
 	 * bump the packet length beyond the t_maxseg length.
 	 */
-	 if (len > tp->t_maxseg - optlen) {
-		len = tp->t_maxseg - optlen;
+	 if (len > maxlen - optlen) {
+		len = maxlen - optlen;
 		sendalot = 1;
 	 }
 
@@ -296,6 +305,9 @@ send:
 			error = 1;
 			goto out;
 		}
+		if (M_FREEROOM(m) < IF_MAXLINKHDR + hdrlen + len) {
+			m_inc(m, IF_MAXLINKHDR + hdrlen + len);
+		}
 		m->m_data += IF_MAXLINKHDR;
 		m->m_len = hdrlen;
 
@@ -386,7 +398,16 @@ send:
 	if (len + optlen)
 		ti->ti_len = htons((uint16_t)(sizeof (struct tcphdr) +
 		    optlen + len));
-	ti->ti_sum = cksum(m, (int)(hdrlen + len));
+	if (so->slirp->csum_offload) {
+		/* Leave the TCP header and data to the guest */
+		ti->ti_sum = ~cksum(m, sizeof(struct ip));
+		m->m_flags |= M_CSUM_PARTIAL;
+		if (len > tp->t_maxseg) {
+			m->m_gso_size = tp->t_maxseg;
+		}
+	} else {
+		ti->ti_sum = cksum(m, (int)(hdrlen + len));
+	}
 
 	/*
 	 * In transmit state, time the transmission and arrange for
@@ -121,8 +121,12 @@ tcp_respond(struct tcpcb *tp, struct tcpiphdr *ti, struct mbuf *m,
 	DEBUG_ARG("seq = %u", seq);
 	DEBUG_ARG("flags = %x", flags);
 
-	if (tp)
+	if (tp) {
 		win = sbspace(&tp->t_socket->so_rcv);
+		/* As in tcp_output(), so_rcv can be larger than that */
+		if (win > (long)TCP_MAXWIN << tp->rcv_scale)
+			win = (long)TCP_MAXWIN << tp->rcv_scale;
+	}
         if (m == NULL) {
 		if (!tp || (m = m_get(tp->t_socket->slirp)) == NULL)
 			return;
@@ -0,0 +1,21 @@
+#include "qemu-common.h"
+#include "migration/migration.h"
+
+int mapped_ram_truncate(uint64_t size)
+{
+    return -ENOSYS;
+}
+
+int mapped_ram_write(const void *buf, size_t len, uint64_t offset)
+{
+    return -ENOSYS;
+}
+
+int mapped_ram_load(void *host, size_t len, uint64_t offset, bool can_map)
+{
+    return -ENOSYS;
+}
+
+void mapped_ram_load_done(void)
+{
+}
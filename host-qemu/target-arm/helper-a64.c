@@ -25,6 +25,7 @@
 #include "qemu/bitops.h"
 #include "internals.h"
 #include "qemu/crc32c.h"
+#include "tcg-gvec-desc.h"
 #include <zlib.h> /* For crc32 */
 
 /* C2.4.7 Multiply and divide */
@@ -544,3 +545,42 @@ void aarch64_cpu_do_interrupt(CPUState *cs)
     cs->interrupt_request |= CPU_INTERRUPT_EXITTB;
 }
 #endif
+
+/* Whole-vector FMLA and FMLS: Vd += (+/-)Vn * Vm for every element, with
+ * the negation requested by the descriptor data.  Each lane is computed
+ * exactly as the scalar helpers do, so exception flags accumulate in the
+ * same way; only the per-element call overhead is removed.
+ */
+void HELPER(gvec_fmla_s)(void *vd, void *vn, void *vm, void *fpstp,
+                         uint32_t desc)
+{
+    float_status *fpst = fpstp;
+    intptr_t i, oprsz = simd_oprsz(desc);
+    bool neg = simd_data(desc);
+    float32 *d = vd, *n = vn, *m = vm;
+
+    for (i = 0; i < oprsz / sizeof(float32); i++) {
+        float32 op1 = neg ? float32_chs(n[i]) : n[i];
+        d[i] = float32_muladd(op1, m[i], d[i], 0, fpst);
+    }
+    if (simd_maxsz(desc) > oprsz) {
+        memset(vd + oprsz, 0, simd_maxsz(desc) - oprsz);
+    }
+}
+
+void HELPER(gvec_fmla_d)(void *vd, void *vn, void *vm, void *fpstp,
+                         uint32_t desc)
+{
+    float_status *fpst = fpstp;
+    intptr_t i, oprsz = simd_oprsz(desc);
+    bool neg = simd_data(desc);
+    float64 *d = vd, *n = vn, *m = vm;
+
+    for (i = 0; i < oprsz / sizeof(float64); i++) {
+        float64 op1 = neg ? float64_chs(n[i]) : n[i];
+        d[i] = float64_muladd(op1, m[i], d[i], 0, fpst);
+    }
+    if (simd_maxsz(desc) > oprsz) {
+        memset(vd + oprsz, 0, simd_maxsz(desc) - oprsz);
+    }
+}
@@ -24,6 +24,8 @@
 
 #include "cpu.h"
 #include "tcg-op.h"
+#include "tcg-op-gvec.h"
+#include "tcg-gvec-desc.h"
 #include "qemu/log.h"
 #include "arm_ldst.h"
 #include "translate.h"
@@ -459,6 +461,26 @@ static inline int fp_reg_offset(DisasContext *s, int regno, TCGMemOp size)
     return offs;
 }
 
+/* Offset of the whole 128 bit vector register, for the generic vector
+ * expanders.  vfp.regs[2n] is the low half on hosts of either byte order.
+ */
+static inline int vec_full_reg_offset(DisasContext *s, int regno)
+{
+    assert_fp_access_checked(s);
+    return offsetof(CPUARMState, vfp.regs[regno * 2]);
+}
+
+/* Expand a 3-operand AdvSIMD vector operation; 64 bit forms clear the
+ * high half of Vd.
+ */
+static void gen_gvec_fn3(DisasContext *s, bool is_q, int rd, int rn, int rm,
+                         GVecGen3Fn *gvec_fn, int vece)
+{
+    gvec_fn(vece, cpu_env, vec_full_reg_offset(s, rd),
+            vec_full_reg_offset(s, rn), vec_full_reg_offset(s, rm),
+            is_q ? 16 : 8, 16);
+}
+
 /* Offset of the high half of the 128 bit vector Qn */
 static inline int fp_reg_hi_offset(DisasContext *s, int regno)
 {
@@ -2443,30 +2465,60 @@ static void disas_ldst_multiple_struct(DisasContext *s, uint32_t insn)
     tcg_addr = tcg_temp_new_i64();
     tcg_gen_mov_i64(tcg_addr, tcg_rn);
 
-    for (r = 0; r < rpt; r++) {
-        int e;
-        for (e = 0; e < elements; e++) {
+    if (selem == 1 && (size == MO_64 || MO_TE == MO_LE)) {
+        /* LD1/ST1 of whole registers: the elements are contiguous in
+         * memory, and with little-endian data their layout matches that
+         * of one 64-bit access, so transfer a doubleword at a time.
+         */
+        TCGv_i64 tcg_tmp = tcg_temp_new_i64();
+
+        for (r = 0; r < rpt; r++) {
             int tt = (rt + r) % 32;
-            int xs;
-            for (xs = 0; xs < selem; xs++) {
+            int half;
+
+            for (half = 0; half < (is_q ? 2 : 1); half++) {
                 if (is_store) {
-                    do_vec_st(s, tt, e, tcg_addr, size);
+                    read_vec_element(s, tcg_tmp, tt, half, MO_64);
+                    tcg_gen_qemu_st_i64(tcg_tmp, tcg_addr, get_mem_index(s),
+                                        MO_TEQ);
                 } else {
-                    do_vec_ld(s, tt, e, tcg_addr, size);
-
-                    /* For non-quad operations, setting a slice of the low
-                     * 64 bits of the register clears the high 64 bits (in
-                     * the ARM ARM pseudocode this is implicit in the fact
-                     * that 'rval' is a 64 bit wide variable). We optimize
-                     * by noticing that we only need to do this the first
-                     * time we touch a register.
-                     */
-                    if (!is_q && e == 0 && (r == 0 || xs == selem - 1)) {
-                        clear_vec_high(s, tt);
+                    tcg_gen_qemu_ld_i64(tcg_tmp, tcg_addr, get_mem_index(s),
+                                        MO_TEQ);
+                    write_vec_element(s, tcg_tmp, tt, half, MO_64);
+                }
+                tcg_gen_addi_i64(tcg_addr, tcg_addr, 8);
+            }
+            if (!is_store && !is_q) {
+                clear_vec_high(s, tt);
+            }
+        }
+        tcg_temp_free_i64(tcg_tmp);
+    } else {
+        for (r = 0; r < rpt; r++) {
+            int e;
+            for (e = 0; e < elements; e++) {
+                int tt = (rt + r) % 32;
+                int xs;
+                for (xs = 0; xs < selem; xs++) {
+                    if (is_store) {
+                        do_vec_st(s, tt, e, tcg_addr, size);
+                    } else {
+                        do_vec_ld(s, tt, e, tcg_addr, size);
+
+                        /* For non-quad operations, setting a slice of the low
+                         * 64 bits of the register clears the high 64 bits (in
+                         * the ARM ARM pseudocode this is implicit in the fact
+                         * that 'rval' is a 64 bit wide variable). We optimize
+                         * by noticing that we only need to do this the first
+                         * time we touch a register.
+                         */
+                        if (!is_q && e == 0 && (r == 0 || xs == selem - 1)) {
+                            clear_vec_high(s, tt);
+                        }
                     }
+                    tcg_gen_addi_i64(tcg_addr, tcg_addr, ebytes);
+                    tt = (tt + 1) % 32;
                 }
-                tcg_gen_addi_i64(tcg_addr, tcg_addr, ebytes);
-                tt = (tt + 1) % 32;
             }
         }
     }
@@ -5538,10 +5590,7 @@ static void handle_simd_dupe(DisasContext *s, int is_q, int rd, int rn,
                              int imm5)
 {
     int size = ctz32(imm5);
-    int esize = 8 << size;
-    int elements = (is_q ? 128 : 64) / esize;
-    int index, i;
-    TCGv_i64 tmp;
+    int index;
 
     if (size > 3 || (size == 3 && !is_q)) {
         unallocated_encoding(s);
@@ -5553,19 +5602,9 @@ static void handle_simd_dupe(DisasContext *s, int is_q, int rd, int rn,
     }
 
     index = imm5 >> (size + 1);
-
-    tmp = tcg_temp_new_i64();
-    read_vec_element(s, tmp, rn, index, size);
-
-    for (i = 0; i < elements; i++) {
-        write_vec_element(s, tmp, rd, i, size);
-    }
-
-    if (!is_q) {
-        clear_vec_high(s, rd);
-    }
-
-    tcg_temp_free_i64(tmp);
+    tcg_gen_gvec_dup_mem(size, cpu_env, vec_full_reg_offset(s, rd),
+                         vec_reg_offset(s, rn, index, size),
+                         is_q ? 16 : 8, 16);
 }
 
 /* C6.3.31 DUP (element, scalar)
@@ -5614,9 +5653,6 @@ static void handle_simd_dupg(DisasContext *s, int is_q, int rd, int rn,
                              int imm5)
 {
     int size = ctz32(imm5);
-    int esize = 8 << size;
-    int elements = (is_q ? 128 : 64)/esize;
-    int i = 0;
 
     if (size > 3 || ((size == 3) && !is_q)) {
         unallocated_encoding(s);
@@ -5627,12 +5663,8 @@ static void handle_simd_dupg(DisasContext *s, int is_q, int rd, int rn,
         return;
     }
 
-    for (i = 0; i < elements; i++) {
-        write_vec_element(s, cpu_reg(s, rn), rd, i, size);
-    }
-    if (!is_q) {
-        clear_vec_high(s, rd);
-    }
+    tcg_gen_gvec_dup_i64(size, cpu_env, vec_full_reg_offset(s, rd),
+                         is_q ? 16 : 8, 16, cpu_reg(s, rn));
 }
 
 /* C6.3.150 INS (Element)
@@ -8786,6 +8818,24 @@ static void disas_simd_3same_logic(DisasContext *s, uint32_t insn)
         return;
     }
 
+    switch (size + 4 * is_u) {
+    case 0: /* AND */
+        gen_gvec_fn3(s, is_q, rd, rn, rm, tcg_gen_gvec_and, 0);
+        return;
+    case 1: /* BIC */
+        gen_gvec_fn3(s, is_q, rd, rn, rm, tcg_gen_gvec_andc, 0);
+        return;
+    case 2: /* ORR */
+        gen_gvec_fn3(s, is_q, rd, rn, rm, tcg_gen_gvec_or, 0);
+        return;
+    case 3: /* ORN */
+        gen_gvec_fn3(s, is_q, rd, rn, rm, tcg_gen_gvec_orc, 0);
+        return;
+    case 4: /* EOR */
+        gen_gvec_fn3(s, is_q, rd, rn, rm, tcg_gen_gvec_xor, 0);
+        return;
+    }
+
     tcg_op1 = tcg_temp_new_i64();
     tcg_op2 = tcg_temp_new_i64();
     tcg_res[0] = tcg_temp_new_i64();
@@ -8794,48 +8844,25 @@ static void disas_simd_3same_logic(DisasContext *s, uint32_t insn)
     for (pass = 0; pass < (is_q ? 2 : 1); pass++) {
         read_vec_element(s, tcg_op1, rn, pass, MO_64);
         read_vec_element(s, tcg_op2, rm, pass, MO_64);
+        /* B* ops need res loaded to operate on */
+        read_vec_element(s, tcg_res[pass], rd, pass, MO_64);
 
-        if (!is_u) {
-            switch (size) {
-            case 0: /* AND */
-                tcg_gen_and_i64(tcg_res[pass], tcg_op1, tcg_op2);
-                break;
-            case 1: /* BIC */
-                tcg_gen_andc_i64(tcg_res[pass], tcg_op1, tcg_op2);
-                break;
-            case 2: /* ORR */
-                tcg_gen_or_i64(tcg_res[pass], tcg_op1, tcg_op2);
-                break;
-            case 3: /* ORN */
-                tcg_gen_orc_i64(tcg_res[pass], tcg_op1, tcg_op2);
-                break;
-            }
-        } else {
-            if (size != 0) {
-                /* B* ops need res loaded to operate on */
-                read_vec_element(s, tcg_res[pass], rd, pass, MO_64);
-            }
-
-            switch (size) {
-            case 0: /* EOR */
-                tcg_gen_xor_i64(tcg_res[pass], tcg_op1, tcg_op2);
-                break;
-            case 1: /* BSL bitwise select */
-                tcg_gen_xor_i64(tcg_op1, tcg_op1, tcg_op2);
-                tcg_gen_and_i64(tcg_op1, tcg_op1, tcg_res[pass]);
-                tcg_gen_xor_i64(tcg_res[pass], tcg_op2, tcg_op1);
-                break;
-            case 2: /* BIT, bitwise insert if true */
-                tcg_gen_xor_i64(tcg_op1, tcg_op1, tcg_res[pass]);
-                tcg_gen_and_i64(tcg_op1, tcg_op1, tcg_op2);
-                tcg_gen_xor_i64(tcg_res[pass], tcg_res[pass], tcg_op1);
-                break;
-            case 3: /* BIF, bitwise insert if false */
-                tcg_gen_xor_i64(tcg_op1, tcg_op1, tcg_res[pass]);
-                tcg_gen_andc_i64(tcg_op1, tcg_op1, tcg_op2);
-                tcg_gen_xor_i64(tcg_res[pass], tcg_res[pass], tcg_op1);
-                break;
-            }
+        switch (size) {
+        case 1: /* BSL bitwise select */
+            tcg_gen_xor_i64(tcg_op1, tcg_op1, tcg_op2);
+            tcg_gen_and_i64(tcg_op1, tcg_op1, tcg_res[pass]);
+            tcg_gen_xor_i64(tcg_res[pass], tcg_op2, tcg_op1);
+            break;
+        case 2: /* BIT, bitwise insert if true */
+            tcg_gen_xor_i64(tcg_op1, tcg_op1, tcg_res[pass]);
+            tcg_gen_and_i64(tcg_op1, tcg_op1, tcg_op2);
+            tcg_gen_xor_i64(tcg_res[pass], tcg_res[pass], tcg_op1);
+            break;
+        case 3: /* BIF, bitwise insert if false */
+            tcg_gen_xor_i64(tcg_op1, tcg_op1, tcg_res[pass]);
+            tcg_gen_andc_i64(tcg_op1, tcg_op1, tcg_op2);
+            tcg_gen_xor_i64(tcg_res[pass], tcg_res[pass], tcg_op1);
+            break;
         }
     }
 
@@ -9029,6 +9056,32 @@ static void handle_simd_3same_pair(DisasContext *s, int is_q, int u, int opcode,
     }
 }
 
+/* Vector FMLA/FMLS: one helper call covers every element of Vd.  */
+static void gen_gvec_fmla(DisasContext *s, bool is_q, int size, bool is_sub,
+                          int rd, int rn, int rm)
+{
+    TCGv_ptr fpst = get_fpstatus_ptr();
+    TCGv_ptr tcg_rd = tcg_temp_new_ptr();
+    TCGv_ptr tcg_rn = tcg_temp_new_ptr();
+    TCGv_ptr tcg_rm = tcg_temp_new_ptr();
+    TCGv_i32 tcg_desc = tcg_const_i32(simd_desc(is_q ? 16 : 8, 16, is_sub));
+
+    tcg_gen_addi_ptr(tcg_rd, cpu_env, vec_full_reg_offset(s, rd));
+    tcg_gen_addi_ptr(tcg_rn, cpu_env, vec_full_reg_offset(s, rn));
+    tcg_gen_addi_ptr(tcg_rm, cpu_env, vec_full_reg_offset(s, rm));
+    if (size) {
+        gen_helper_gvec_fmla_d(tcg_rd, tcg_rn, tcg_rm, fpst, tcg_desc);
+    } else {
+        gen_helper_gvec_fmla_s(tcg_rd, tcg_rn, tcg_rm, fpst, tcg_desc);
+    }
+
+    tcg_temp_free_ptr(fpst);
+    tcg_temp_free_ptr(tcg_rd);
+    tcg_temp_free_ptr(tcg_rn);
+    tcg_temp_free_ptr(tcg_rm);
+    tcg_temp_free_i32(tcg_desc);
+}
+
 /* Floating point op subgroup of C3.6.16. */
 static void disas_simd_3same_float(DisasContext *s, uint32_t insn)
 {
@@ -9067,13 +9120,19 @@ static void disas_simd_3same_float(DisasContext *s, uint32_t insn)
         handle_simd_3same_pair(s, is_q, 0, fpopcode, size ? MO_64 : MO_32,
                                rn, rm, rd);
         return;
+    case 0x19: /* FMLA */
+    case 0x39: /* FMLS */
+        if (!fp_access_check(s)) {
+            return;
+        }
+
+        gen_gvec_fmla(s, is_q, size, fpopcode == 0x39, rd, rn, rm);
+        return;
     case 0x1b: /* FMULX */
     case 0x1f: /* FRECPS */
     case 0x3f: /* FRSQRTS */
     case 0x5d: /* FACGE */
     case 0x7d: /* FACGT */
-    case 0x19: /* FMLA */
-    case 0x39: /* FMLS */
     case 0x18: /* FMAXNM */
     case 0x1a: /* FADD */
     case 0x1c: /* FCMEQ */
@@ -9148,6 +9207,19 @@ static void disas_simd_3same_int(DisasContext *s, uint32_t insn)
         return;
     }
 
+    switch (opcode) {
+    case 0x10: /* ADD, SUB */
+        gen_gvec_fn3(s, is_q, rd, rn, rm,
+                     u ? tcg_gen_gvec_sub : tcg_gen_gvec_add, size);
+        return;
+    case 0x13: /* MUL, PMUL */
+        if (!u) {
+            gen_gvec_fn3(s, is_q, rd, rn, rm, tcg_gen_gvec_mul, size);
+            return;
+        }
+        break;
+    }
+
     if (size == 3) {
         assert(is_q);
         for (pass = 0; pass < 2; pass++) {
@@ -9320,16 +9392,6 @@ static void disas_simd_3same_int(DisasContext *s, uint32_t insn)
                 genfn = fns[size][u];
                 break;
             }
-            case 0x10: /* ADD, SUB */
-            {
-                static NeonGenTwoOpFn * const fns[3][2] = {
-                    { gen_helper_neon_add_u8, gen_helper_neon_sub_u8 },
-                    { gen_helper_neon_add_u16, gen_helper_neon_sub_u16 },
-                    { tcg_gen_add_i32, tcg_gen_sub_i32 },
-                };
-                genfn = fns[size][u];
-                break;
-            }
             case 0x11: /* CMTST, CMEQ */
             {
                 static NeonGenTwoOpFn * const fns[3][2] = {
@@ -9340,14 +9402,10 @@ static void disas_simd_3same_int(DisasContext *s, uint32_t insn)
                 genfn = fns[size][u];
                 break;
             }
-            case 0x13: /* MUL, PMUL */
-                if (u) {
-                    /* PMUL */
-                    assert(size == 0);
-                    genfn = gen_helper_neon_mul_p8;
-                    break;
-                }
-                /* fall through : MUL */
+            case 0x13: /* PMUL */
+                assert(u && size == 0);
+                genfn = gen_helper_neon_mul_p8;
+                break;
             case 0x12: /* MLA, MLS */
             {
                 static NeonGenTwoOpFn * const fns[3] = {
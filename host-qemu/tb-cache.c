@@ -0,0 +1,459 @@
+/*
+ * Persistent translation block cache
+ *
+ * Translated blocks are saved to a file when QEMU exits and reused by
+ * later runs of the same QEMU binary, so that a guest booting the same
+ * kernel and libraries does not have to translate them again.
+ *
+ * While the cache is enabled, TCG generates relocatable code: every host
+ * address embedded in a TB (its own TranslationBlock, the prologue, the
+ * helpers and the TB's own slow paths) is recorded, see TCGHostReloc.
+ * TBs that embed other host pointers are not cached.
+ *
+ * Entries are keyed by guest virtual PC, cs_base, flags and cflags, and
+ * carry a copy of the guest code they were translated from.  They are
+ * only used, lazily from tb_gen_code, if the guest RAM at the physical
+ * address of the new TB holds exactly the same bytes.  TBs that cross a
+ * page boundary are not cached.  The whole cache is also tied to the CPU
+ * model and to the feature bits that the translator reads, and is not
+ * used at all while single-stepping.
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include <sys/stat.h>
+
+#include "config.h"
+#include "qemu-common.h"
+#include "cpu.h"
+#include "tcg.h"
+#include "exec/exec-all.h"
+#include "exec/ram_addr.h"
+#include "exec/tb-cache.h"
+#include "qapi/error.h"
+#include "qemu/error-report.h"
+#include "qemu/notify.h"
+#include "sysemu/sysemu.h"
+
+#define TB_CACHE_MAGIC      0x43425451  /* "QTBC" */
+#define TB_CACHE_VERSION    3
+
+/* Upper bound on the memory used by the entries, and so on the size of
+   the file.  */
+#define TB_CACHE_MAX_SIZE   (256 * 1024 * 1024)
+
+typedef struct TBCacheHeader {
+    uint32_t magic;
+    uint32_t version;
+    char qemu_version[32];
+    char target[16];
+    /* identity of the QEMU binary whose code the entries refer to */
+    uint64_t exe_size;
+    int64_t exe_mtime;
+    uint64_t exe_ino;
+    char cpu_model[64];
+    /* translation-affecting CPU feature bits, see tb_cache_cpu_features */
+    uint8_t cpu_features[64];
+    /* host instructions the code may use, see tcg_target_host_features */
+    uint32_t host_features;
+    uint32_t nb_entries;
+    uint32_t reserved;
+} TBCacheHeader;
+
+typedef struct TBCacheKey {
+    uint64_t pc;
+    uint64_t cs_base;
+    uint64_t flags;
+    uint32_t cflags;
+    uint32_t reserved;
+} TBCacheKey;
+
+/* An entry is followed by SIZE bytes of guest code, CODE_SIZE bytes of
+   host code, and NB_RELOCS relocations aligned to 8 bytes.  The file
+   holds the header followed by the entries.  */
+typedef struct TBCacheEntry {
+    TBCacheKey key;
+    uint16_t size;
+    uint16_t icount;
+    uint16_t tb_next_offset[2];
+    uint16_t tb_jmp_offset[2];
+    uint32_t code_size;
+    uint32_t nb_relocs;
+    uint32_t reserved;
+} TBCacheEntry;
+
+bool tb_cache_enabled;
+
+static char *tb_cache_path;
+static TBCacheHeader tb_cache_header;
+static bool tb_cache_cpu_checked;
+static GHashTable *tb_cache_table;
+static size_t tb_cache_size;
+static Notifier tb_cache_exit_notifier;
+
+static int64_t tb_cache_hits;
+static int64_t tb_cache_misses;
+static int64_t tb_cache_stale;
+
+static inline uint8_t *tb_cache_guest(TBCacheEntry *e)
+{
+    return (uint8_t *)(e + 1);
+}
+
+static inline uint8_t *tb_cache_code(TBCacheEntry *e)
+{
+    return tb_cache_guest(e) + e->size;
+}
+
+static inline size_t tb_cache_relocs_offset(const TBCacheEntry *e)
+{
+    return QEMU_ALIGN_UP(sizeof(*e) + e->size + e->code_size, 8);
+}
+
+static inline TCGHostReloc *tb_cache_relocs(TBCacheEntry *e)
+{
+    return (void *)e + tb_cache_relocs_offset(e);
+}
+
+static inline size_t tb_cache_entry_len(const TBCacheEntry *e)
+{
+    return tb_cache_relocs_offset(e) + e->nb_relocs * sizeof(TCGHostReloc);
+}
+
+static guint tb_cache_key_hash(gconstpointer p)
+{
+    const TBCacheKey *k = p;
+
+    return k->pc ^ (k->pc >> 32) ^ k->flags ^ k->cflags;
+}
+
+static gboolean tb_cache_key_equal(gconstpointer a, gconstpointer b)
+{
+    return !memcmp(a, b, sizeof(TBCacheKey));
+}
+
+static void tb_cache_make_key(TBCacheKey *key, TranslationBlock *tb)
+{
+    memset(key, 0, sizeof(*key));
+    key->pc = tb->pc;
+    key->cs_base = tb->cs_base;
+    key->flags = tb->flags;
+    key->cflags = tb->cflags;
+}
+
+static bool tb_cache_usable(CPUState *cpu, TranslationBlock *tb)
+{
+    return !tb->profile && !(tb->cflags & CF_NOCACHE) && !singlestep &&
+           !cpu->singlestep_enabled && QTAILQ_EMPTY(&cpu->breakpoints);
+}
+
+static void tb_cache_insert(TBCacheEntry *e)
+{
+    TBCacheEntry *old = g_hash_table_lookup(tb_cache_table, &e->key);
+
+    if (old) {
+        tb_cache_size -= tb_cache_entry_len(old);
+    }
+    g_hash_table_replace(tb_cache_table, &e->key, e);
+    tb_cache_size += tb_cache_entry_len(e);
+}
+
+/* Check an entry read from the file, so that a corrupted file cannot
+   make us write outside the TB.  */
+static bool tb_cache_entry_valid(TBCacheEntry *e, size_t avail)
+{
+    size_t max_code = TCG_MAX_OP_SIZE * OPC_BUF_SIZE;
+    TCGHostReloc *r;
+    int i;
+
+    if (avail < sizeof(*e) || e->size == 0 ||
+        (e->key.pc & ~TARGET_PAGE_MASK) + e->size > TARGET_PAGE_SIZE ||
+        e->code_size > max_code || e->nb_relocs > TCG_MAX_HOST_RELOCS ||
+        avail < tb_cache_entry_len(e)) {
+        return false;
+    }
+    for (i = 0; i < 2; i++) {
+        if ((e->tb_next_offset[i] != 0xffff &&
+             e->tb_next_offset[i] > e->code_size) ||
+            (e->tb_jmp_offset[i] != 0xffff &&
+             e->tb_jmp_offset[i] + 4 > e->code_size)) {
+            return false;
+        }
+    }
+    r = tb_cache_relocs(e);
+    for (i = 0; i < e->nb_relocs; i++) {
+        size_t field = r[i].type == TCG_HOST_RELOC_REL32 ? 4 : 8;
+
+        if (r[i].offset + field > e->code_size) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static void tb_cache_read(void)
+{
+    TBCacheHeader *h;
+    gchar *buf;
+    gsize len, pos;
+    uint32_t i;
+
+    if (!g_file_get_contents(tb_cache_path, &buf, &len, NULL)) {
+        return;
+    }
+    h = (TBCacheHeader *)buf;
+    if (len < sizeof(*h) || h->magic != TB_CACHE_MAGIC ||
+        h->version != TB_CACHE_VERSION ||
+        strncmp(h->qemu_version, tb_cache_header.qemu_version,
+                sizeof(h->qemu_version)) ||
+        strncmp(h->target, tb_cache_header.target, sizeof(h->target)) ||
+        h->exe_size != tb_cache_header.exe_size ||
+        h->exe_mtime != tb_cache_header.exe_mtime ||
+        h->exe_ino != tb_cache_header.exe_ino) {
+        error_report("tb-cache: ignoring %s, it was written by a different "
+                     "QEMU binary", tb_cache_path);
+        g_free(buf);
+        return;
+    }
+    memcpy(tb_cache_header.cpu_model, h->cpu_model,
+           sizeof(h->cpu_model));
+    memcpy(tb_cache_header.cpu_features, h->cpu_features,
+           sizeof(h->cpu_features));
+    tb_cache_header.host_features = h->host_features;
+
+    pos = sizeof(*h);
+    for (i = 0; i < h->nb_entries; i++) {
+        TBCacheEntry *e = (TBCacheEntry *)(buf + pos);
+
+        if (!tb_cache_entry_valid(e, len - pos)) {
+            error_report("tb-cache: %s is truncated or corrupted",
+                         tb_cache_path);
+            break;
+        }
+        if (tb_cache_size + tb_cache_entry_len(e) > TB_CACHE_MAX_SIZE) {
+            break;
+        }
+        tb_cache_insert(g_memdup(e, tb_cache_entry_len(e)));
+        pos += tb_cache_entry_len(e);
+    }
+    g_free(buf);
+}
+
+static void tb_cache_write_entry(gpointer key, gpointer value, gpointer opaque)
+{
+    TBCacheEntry *e = value;
+    FILE *f = opaque;
+
+    fwrite(e, tb_cache_entry_len(e), 1, f);
+}
+
+static void tb_cache_save(Notifier *notifier, void *data)
+{
+    char *tmp = g_strdup_printf("%s.tmp", tb_cache_path);
+    TBCacheHeader h = tb_cache_header;
+    FILE *f;
+    int err;
+
+    h.nb_entries = g_hash_table_size(tb_cache_table);
+
+    f = fopen(tmp, "wb");
+    if (!f) {
+        error_report("tb-cache: cannot create %s: %s", tmp, strerror(errno));
+        goto out;
+    }
+    fwrite(&h, sizeof(h), 1, f);
+    g_hash_table_foreach(tb_cache_table, tb_cache_write_entry, f);
+    err = ferror(f);
+    if (fclose(f) || err) {
+        error_report("tb-cache: cannot write %s", tmp);
+        unlink(tmp);
+        goto out;
+    }
+    if (rename(tmp, tb_cache_path)) {
+        error_report("tb-cache: cannot rename %s: %s", tmp, strerror(errno));
+        unlink(tmp);
+    }
+out:
+    g_free(tmp);
+}
+
+void tb_cache_init(const char *path, Error **errp)
+{
+    struct stat st;
+
+    if (!TCG_TARGET_HAS_HOST_RELOC) {
+        error_setg(errp, "tb-cache is not supported on this host");
+        return;
+    }
+    if (stat("/proc/self/exe", &st)) {
+        error_setg_errno(errp, errno, "tb-cache: cannot stat the executable");
+        return;
+    }
+
+    tb_cache_header.magic = TB_CACHE_MAGIC;
+    tb_cache_header.version = TB_CACHE_VERSION;
+    pstrcpy(tb_cache_header.qemu_version,
+            sizeof(tb_cache_header.qemu_version), QEMU_VERSION);
+    pstrcpy(tb_cache_header.target, sizeof(tb_cache_header.target),
+            TARGET_NAME);
+    tb_cache_header.exe_size = st.st_size;
+    tb_cache_header.exe_mtime = st.st_mtime;
+    tb_cache_header.exe_ino = st.st_ino;
+
+    tb_cache_path = g_strdup(path);
+    tb_cache_table = g_hash_table_new_full(tb_cache_key_hash,
+                                           tb_cache_key_equal, NULL, g_free);
+    tb_cache_read();
+
+    tcg_ctx.reloc_mode = true;
+    tb_cache_enabled = true;
+
+    tb_cache_exit_notifier.notify = tb_cache_save;
+    qemu_add_exit_notifier(&tb_cache_exit_notifier);
+}
+
+/* The feature bits that the translator checks besides the TB flags.
+   They can be changed from the model's defaults with -cpu properties
+   (e.g. aarch64=off or +avx2).  On the other targets the instruction
+   set is fixed by the model, which is part of the key already.  */
+static void tb_cache_cpu_features(CPUState *cpu, uint8_t *buf, size_t len)
+{
+    memset(buf, 0, len);
+#if defined(TARGET_ARM) || defined(TARGET_I386)
+    {
+        CPUArchState *env = cpu->env_ptr;
+
+        QEMU_BUILD_BUG_ON(sizeof(env->features) >
+                          sizeof(tb_cache_header.cpu_features));
+        memcpy(buf, &env->features, sizeof(env->features));
+    }
+#endif
+}
+
+/* The entries depend on the CPU model and its features, which are only
+   known once the first CPU starts translating, and on the instructions
+   that the TCG backend found on the host CPU.  */
+static void tb_cache_check_cpu(CPUState *cpu)
+{
+    const char *model = object_get_typename(OBJECT(cpu));
+    uint8_t features[sizeof(tb_cache_header.cpu_features)];
+    uint32_t host_features = 0;
+
+#if TCG_TARGET_HAS_HOST_RELOC
+    host_features = tcg_target_host_features();
+#endif
+    tb_cache_cpu_features(cpu, features, sizeof(features));
+    if (strncmp(tb_cache_header.cpu_model, model,
+                sizeof(tb_cache_header.cpu_model)) ||
+        memcmp(tb_cache_header.cpu_features, features, sizeof(features)) ||
+        tb_cache_header.host_features != host_features) {
+        if (tb_cache_header.cpu_model[0]) {
+            g_hash_table_remove_all(tb_cache_table);
+            tb_cache_size = 0;
+        }
+        pstrcpy(tb_cache_header.cpu_model,
+                sizeof(tb_cache_header.cpu_model), model);
+        memcpy(tb_cache_header.cpu_features, features, sizeof(features));
+        tb_cache_header.host_features = host_features;
+    }
+    tb_cache_cpu_checked = true;
+}
+
+bool tb_cache_load(CPUState *cpu, TranslationBlock *tb,
+                   tb_page_addr_t phys_pc, int *code_size)
+{
+    TBCacheKey key;
+    TBCacheEntry *e;
+
+    if (!tb_cache_usable(cpu, tb)) {
+        return false;
+    }
+    if (unlikely(!tb_cache_cpu_checked)) {
+        tb_cache_check_cpu(cpu);
+    }
+
+    tb_cache_make_key(&key, tb);
+    e = g_hash_table_lookup(tb_cache_table, &key);
+    if (!e) {
+        tb_cache_misses++;
+        return false;
+    }
+    if (memcmp(qemu_get_ram_ptr(phys_pc), tb_cache_guest(e), e->size)) {
+        tb_cache_stale++;
+        return false;
+    }
+
+    memcpy(tb->tc_ptr, tb_cache_code(e), e->code_size);
+    if (!tcg_host_reloc_apply(&tcg_ctx, tb->tc_ptr, (uintptr_t)tb,
+                              tb_cache_relocs(e), e->nb_relocs)) {
+        tb_cache_stale++;
+        return false;
+    }
+    flush_icache_range((uintptr_t)tb->tc_ptr,
+                       (uintptr_t)tb->tc_ptr + e->code_size);
+
+    tb->size = e->size;
+    tb->icount = e->icount;
+    tb->tb_next_offset[0] = e->tb_next_offset[0];
+    tb->tb_next_offset[1] = e->tb_next_offset[1];
+#ifdef USE_DIRECT_JUMP
+    tb->tb_jmp_offset[0] = e->tb_jmp_offset[0];
+    tb->tb_jmp_offset[1] = e->tb_jmp_offset[1];
+#endif
+    *code_size = e->code_size;
+    tb_cache_hits++;
+    return true;
+}
+
+void tb_cache_record(CPUState *cpu, TranslationBlock *tb,
+                     tb_page_addr_t phys_pc, int code_size)
+{
+    TCGContext *s = &tcg_ctx;
+    TBCacheEntry *e, hdr;
+
+    if (!tb_cache_usable(cpu, tb) || s->reloc_failed ||
+        (tb->pc & ~TARGET_PAGE_MASK) + tb->size > TARGET_PAGE_SIZE) {
+        return;
+    }
+
+    memset(&hdr, 0, sizeof(hdr));
+    tb_cache_make_key(&hdr.key, tb);
+    hdr.size = tb->size;
+    hdr.icount = tb->icount;
+    hdr.tb_next_offset[0] = tb->tb_next_offset[0];
+    hdr.tb_next_offset[1] = tb->tb_next_offset[1];
+#ifdef USE_DIRECT_JUMP
+    hdr.tb_jmp_offset[0] = tb->tb_jmp_offset[0];
+    hdr.tb_jmp_offset[1] = tb->tb_jmp_offset[1];
+#else
+    hdr.tb_jmp_offset[0] = 0xffff;
+    hdr.tb_jmp_offset[1] = 0xffff;
+#endif
+    hdr.code_size = code_size;
+    hdr.nb_relocs = s->nb_host_relocs;
+
+    if (tb_cache_size + tb_cache_entry_len(&hdr) > TB_CACHE_MAX_SIZE) {
+        return;
+    }
+
+    e = g_malloc0(tb_cache_entry_len(&hdr));
+    *e = hdr;
+    memcpy(tb_cache_guest(e), qemu_get_ram_ptr(phys_pc), e->size);
+    memcpy(tb_cache_code(e), tb->tc_ptr, code_size);
+    memcpy(tb_cache_relocs(e), s->host_relocs,
+           e->nb_relocs * sizeof(TCGHostReloc));
+    tb_cache_insert(e);
+}
+
+void tb_cache_dump_info(FILE *f, fprintf_function cpu_fprintf)
+{
+    if (!tb_cache_enabled) {
+        return;
+    }
+    cpu_fprintf(f, "TB cache entries    %u (%zu KB)\n",
+                g_hash_table_size(tb_cache_table), tb_cache_size / 1024);
+    cpu_fprintf(f, "TB cache hits       %" PRId64 " (%" PRId64
+                " misses, %" PRId64 " stale)\n",
+                tb_cache_hits, tb_cache_misses, tb_cache_stale);
+}
@@ -0,0 +1,129 @@
+/*
+ * Generic vectorized operation runtime
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include <stdint.h>
+#include <string.h>
+#include "qemu/host-utils.h"
+#include "tcg/tcg-gvec-desc.h"
+
+/* This file is compiled once, and thus we can't include the standard
+   "exec/helper-proto.h", which has includes that are target specific.  */
+
+#include "exec/helper-head.h"
+
+#define DEF_HELPER_FLAGS_2(name, flags, ret, t1, t2) \
+  dh_ctype(ret) HELPER(name) (dh_ctype(t1), dh_ctype(t2));
+#define DEF_HELPER_FLAGS_3(name, flags, ret, t1, t2, t3) \
+  dh_ctype(ret) HELPER(name) (dh_ctype(t1), dh_ctype(t2), dh_ctype(t3));
+#define DEF_HELPER_FLAGS_4(name, flags, ret, t1, t2, t3, t4) \
+  dh_ctype(ret) HELPER(name) (dh_ctype(t1), dh_ctype(t2), dh_ctype(t3), \
+                              dh_ctype(t4));
+
+#include "tcg-runtime.h"
+
+/* The operations below are written with the GCC vector extension, so that
+ * the host compiler lowers each 16-byte step to a single SSE2 or NEON
+ * instruction where the host has one.  Operands are always a multiple of
+ * 8 bytes; a trailing 8-byte chunk is handled with the scalar element type.
+ * Every lane of every operand is stored at the same offset, so the host
+ * byte order within the 64-bit halves of the guest register does not matter.
+ */
+#ifdef CONFIG_VECTOR16
+typedef uint8_t vec8 __attribute__((vector_size(16)));
+typedef uint16_t vec16 __attribute__((vector_size(16)));
+typedef uint32_t vec32 __attribute__((vector_size(16)));
+typedef uint64_t vec64 __attribute__((vector_size(16)));
+#define VEC_STEP 16
+#else
+typedef uint8_t vec8;
+typedef uint16_t vec16;
+typedef uint32_t vec32;
+typedef uint64_t vec64;
+#define VEC_STEP 8
+#endif
+
+/* Zero the bytes of the destination between oprsz and maxsz.  */
+static inline void clear_high(void *d, intptr_t oprsz, uint32_t desc)
+{
+    intptr_t maxsz = simd_maxsz(desc);
+
+    if (unlikely(maxsz > oprsz)) {
+        memset(d + oprsz, 0, maxsz - oprsz);
+    }
+}
+
+#define DO_GVEC_3(NAME, VTYPE, ETYPE, OP)                                   \
+void HELPER(NAME)(void *d, void *a, void *b, uint32_t desc)                \
+{                                                                          \
+    intptr_t oprsz = simd_oprsz(desc);                                     \
+    intptr_t i = 0;                                                        \
+                                                                           \
+    for (; i + VEC_STEP <= oprsz; i += VEC_STEP) {                         \
+        VTYPE va, vb, vd;                                                  \
+        memcpy(&va, a + i, VEC_STEP);                                      \
+        memcpy(&vb, b + i, VEC_STEP);                                      \
+        vd = OP(va, vb);                                                   \
+        memcpy(d + i, &vd, VEC_STEP);                                      \
+    }                                                                      \
+    for (; i < oprsz; i += sizeof(ETYPE)) {                                \
+        ETYPE ea, eb, ed;                                                  \
+        memcpy(&ea, a + i, sizeof(ETYPE));                                 \
+        memcpy(&eb, b + i, sizeof(ETYPE));                                 \
+        ed = OP(ea, eb);                                                   \
+        memcpy(d + i, &ed, sizeof(ETYPE));                                 \
+    }                                                                      \
+    clear_high(d, oprsz, desc);                                            \
+}
+
+#define GVEC_ADD(A, B)   ((A) + (B))
+#define GVEC_SUB(A, B)   ((A) - (B))
+#define GVEC_MUL(A, B)   ((A) * (B))
+#define GVEC_AND(A, B)   ((A) & (B))
+#define GVEC_OR(A, B)    ((A) | (B))
+#define GVEC_XOR(A, B)   ((A) ^ (B))
+#define GVEC_ANDC(A, B)  ((A) & ~(B))
+#define GVEC_ORC(A, B)   ((A) | ~(B))
+
+DO_GVEC_3(gvec_add8, vec8, uint8_t, GVEC_ADD)
+DO_GVEC_3(gvec_add16, vec16, uint16_t, GVEC_ADD)
+DO_GVEC_3(gvec_add32, vec32, uint32_t, GVEC_ADD)
+DO_GVEC_3(gvec_add64, vec64, uint64_t, GVEC_ADD)
+
+DO_GVEC_3(gvec_sub8, vec8, uint8_t, GVEC_SUB)
+DO_GVEC_3(gvec_sub16, vec16, uint16_t, GVEC_SUB)
+DO_GVEC_3(gvec_sub32, vec32, uint32_t, GVEC_SUB)
+DO_GVEC_3(gvec_sub64, vec64, uint64_t, GVEC_SUB)
+
+DO_GVEC_3(gvec_mul8, vec8, uint8_t, GVEC_MUL)
+DO_GVEC_3(gvec_mul16, vec16, uint16_t, GVEC_MUL)
+DO_GVEC_3(gvec_mul32, vec32, uint32_t, GVEC_MUL)
+DO_GVEC_3(gvec_mul64, vec64, uint64_t, GVEC_MUL)
+
+DO_GVEC_3(gvec_and, vec64, uint64_t, GVEC_AND)
+DO_GVEC_3(gvec_or, vec64, uint64_t, GVEC_OR)
+DO_GVEC_3(gvec_xor, vec64, uint64_t, GVEC_XOR)
+DO_GVEC_3(gvec_andc, vec64, uint64_t, GVEC_ANDC)
+DO_GVEC_3(gvec_orc, vec64, uint64_t, GVEC_ORC)
+
+void HELPER(gvec_mov)(void *d, void *a, uint32_t desc)
+{
+    intptr_t oprsz = simd_oprsz(desc);
+
+    memmove(d, a, oprsz);
+    clear_high(d, oprsz, desc);
+}
+
+void HELPER(gvec_dup64)(void *d, uint32_t desc, uint64_t c)
+{
+    intptr_t oprsz = simd_oprsz(desc);
+    intptr_t i;
+
+    for (i = 0; i < oprsz; i += sizeof(uint64_t)) {
+        memcpy(d + i, &c, sizeof(uint64_t));
+    }
+    clear_high(d, oprsz, desc);
+}
@@ -660,9 +660,10 @@ static void tcg_out_movi(TCGContext *s, TCGType type,
         return;
     }
 
-    /* Try a 7 byte pc-relative lea before the 10 byte movq.  */
+    /* Try a 7 byte pc-relative lea before the 10 byte movq.  Not in
+       relocation mode, where the code may be moved.  */
     diff = arg - ((uintptr_t)s->code_ptr + 7);
-    if (diff == (int32_t)diff) {
+    if (diff == (int32_t)diff && !s->reloc_mode) {
         tcg_out_opc(s, OPC_LEA | P_REXW, ret, 0, 0);
         tcg_out8(s, (LOWREGMASK(ret) << 3) | 5);
         tcg_out32(s, diff);
@@ -673,6 +674,19 @@ static void tcg_out_movi(TCGContext *s, TCGType type,
     tcg_out64(s, arg);
 }
 
+/* Load a host code address.  In relocation mode it is always emitted as
+   a 10 byte movq, and recorded so that it can be patched.  */
+static void tcg_out_movi_host(TCGContext *s, TCGReg ret, uintptr_t arg)
+{
+    if (!s->reloc_mode || arg == 0) {
+        tcg_out_movi(s, TCG_TYPE_PTR, ret, arg);
+        return;
+    }
+    tcg_out_opc(s, OPC_MOVL_Iv + P_REXW + LOWREGMASK(ret), 0, ret, 0);
+    tcg_host_reloc_add(s, s->code_ptr, TCG_HOST_RELOC_ABS64, arg);
+    tcg_out64(s, arg);
+}
+
 static inline void tcg_out_pushi(TCGContext *s, tcg_target_long val)
 {
     if (val == (int8_t)val) {
@@ -1102,12 +1116,21 @@ static void tcg_out_movcond64(TCGContext *s, TCGCond cond, TCGArg dest,
 static void tcg_out_branch(TCGContext *s, int call, tcg_insn_unit *dest)
 {
     intptr_t disp = tcg_pcrel_diff(s, dest) - 5;
+    bool in_buffer = (void *)dest >= s->code_gen_buffer &&
+                     (void *)dest < s->code_gen_prologue + 1024;
 
-    if (disp == (int32_t)disp) {
+    /* In relocation mode, only branches within the code buffer are
+       pc-relative; the distance to QEMU's own functions changes from
+       one run to the next.  */
+    if (disp == (int32_t)disp && (in_buffer || !s->reloc_mode)) {
         tcg_out_opc(s, call ? OPC_CALL_Jz : OPC_JMP_long, 0, 0, 0);
+        if (s->reloc_mode && (dest < s->code_buf || dest > s->code_ptr)) {
+            tcg_host_reloc_add(s, s->code_ptr, TCG_HOST_RELOC_REL32,
+                               (uintptr_t)dest);
+        }
         tcg_out32(s, disp);
     } else {
-        tcg_out_movi(s, TCG_TYPE_PTR, TCG_REG_R10, (uintptr_t)dest);
+        tcg_out_movi_host(s, TCG_REG_R10, (uintptr_t)dest);
         tcg_out_modrm(s, OPC_GRP5,
                       call ? EXT5_CALLN_Ev : EXT5_JMPN_Ev, TCG_REG_R10);
     }
@@ -1303,8 +1326,8 @@ static void tcg_out_qemu_ld_slow_path(TCGContext *s, TCGLabelQemuLdst *l)
         tcg_out_mov(s, TCG_TYPE_PTR, tcg_target_call_iarg_regs[0], TCG_AREG0);
         /* The second argument is already loaded with addrlo.  */
         tcg_out_movi(s, TCG_TYPE_I32, tcg_target_call_iarg_regs[2], oi);
-        tcg_out_movi(s, TCG_TYPE_PTR, tcg_target_call_iarg_regs[3],
-                     (uintptr_t)l->raddr);
+        tcg_out_movi_host(s, tcg_target_call_iarg_regs[3],
+                          (uintptr_t)l->raddr);
     }
 
     tcg_out_call(s, qemu_ld_helpers[opc & (MO_BSWAP | MO_SIZE)]);
@@ -1402,10 +1425,10 @@ static void tcg_out_qemu_st_slow_path(TCGContext *s, TCGLabelQemuLdst *l)
 
         if (ARRAY_SIZE(tcg_target_call_iarg_regs) > 4) {
             retaddr = tcg_target_call_iarg_regs[4];
-            tcg_out_movi(s, TCG_TYPE_PTR, retaddr, (uintptr_t)l->raddr);
+            tcg_out_movi_host(s, retaddr, (uintptr_t)l->raddr);
         } else {
             retaddr = TCG_REG_RAX;
-            tcg_out_movi(s, TCG_TYPE_PTR, retaddr, (uintptr_t)l->raddr);
+            tcg_out_movi_host(s, retaddr, (uintptr_t)l->raddr);
             tcg_out_st(s, TCG_TYPE_PTR, retaddr, TCG_REG_ESP,
                        TCG_TARGET_CALL_STACK_OFFSET);
         }
@@ -1764,7 +1787,7 @@ static inline void tcg_out_op(TCGContext *s, TCGOpcode opc,
 
     switch(opc) {
     case INDEX_op_exit_tb:
-        tcg_out_movi(s, TCG_TYPE_PTR, TCG_REG_EAX, args[0]);
+        tcg_out_movi_host(s, TCG_REG_EAX, args[0]);
         tcg_out_jmp(s, tb_ret_addr);
         break;
     case INDEX_op_goto_tb:
@@ -2313,6 +2336,14 @@ static void tcg_target_qemu_prologue(TCGContext *s)
 #endif
 }
 
+#if TCG_TARGET_HAS_HOST_RELOC
+uint32_t tcg_target_host_features(void)
+{
+    return (have_cmov ? 1 : 0) | (have_movbe ? 2 : 0) |
+           (have_bmi1 ? 4 : 0) | (have_bmi2 ? 8 : 0);
+}
+#endif
+
 static void tcg_target_init(TCGContext *s)
 {
 #ifdef CONFIG_CPUID_H
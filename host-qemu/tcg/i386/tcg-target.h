@@ -136,6 +136,14 @@ extern bool have_bmi1;
      ((ofs) == 0 && (len) == 16))
 #define TCG_TARGET_deposit_i64_valid    TCG_TARGET_deposit_i32_valid
 
+/* Generated code can be made relocatable for the persistent TB cache;
+   the relocations against the QEMU binary use the ELF start symbol.  */
+#if TCG_TARGET_REG_BITS == 64 && defined(CONFIG_LINUX)
+# define TCG_TARGET_HAS_HOST_RELOC 1
+#else
+# define TCG_TARGET_HAS_HOST_RELOC 0
+#endif
+
 #if TCG_TARGET_REG_BITS == 64
 # define TCG_AREG0 TCG_REG_R14
 #else
@@ -0,0 +1,408 @@
+/*
+ * Generic vector operation expansion
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include "tcg.h"
+#include "tcg-op.h"
+#include "tcg-op-gvec.h"
+#include "tcg-gvec-desc.h"
+
+#define MAX_UNROLL  4
+
+/* Largest operation, in bytes, that is expanded inline.  */
+#define MAX_INLINE_SIZE  (MAX_UNROLL * 8)
+
+/* Verify vector size and alignment rules.  OFS should be the OR of all
+   of the operand offsets so that we can check them all at once.  */
+static void check_size_align(uint32_t oprsz, uint32_t maxsz, uint32_t ofs)
+{
+    tcg_debug_assert(oprsz > 0);
+    tcg_debug_assert(oprsz <= maxsz);
+    tcg_debug_assert(maxsz <= 256);
+    tcg_debug_assert((oprsz & 7) == 0);
+    tcg_debug_assert((maxsz & 7) == 0);
+    tcg_debug_assert((ofs & 7) == 0);
+}
+
+uint32_t simd_desc(uint32_t oprsz, uint32_t maxsz, int32_t data)
+{
+    uint32_t desc = 0;
+
+    assert(oprsz % 8 == 0 && oprsz <= (8 << SIMD_OPRSZ_BITS));
+    assert(maxsz % 8 == 0 && maxsz <= (8 << SIMD_MAXSZ_BITS));
+    assert(data == sextract32(data, 0, SIMD_DATA_BITS));
+
+    oprsz = (oprsz / 8) - 1;
+    maxsz = (maxsz / 8) - 1;
+    desc = deposit32(desc, SIMD_OPRSZ_SHIFT, SIMD_OPRSZ_BITS, oprsz);
+    desc = deposit32(desc, SIMD_MAXSZ_SHIFT, SIMD_MAXSZ_BITS, maxsz);
+    desc = deposit32(desc, SIMD_DATA_SHIFT, SIMD_DATA_BITS, data);
+
+    return desc;
+}
+
+uint64_t dup_const(unsigned vece, uint64_t c)
+{
+    switch (vece) {
+    case MO_8:
+        return 0x0101010101010101ull * (uint8_t)c;
+    case MO_16:
+        return 0x0001000100010001ull * (uint16_t)c;
+    case MO_32:
+        return 0x0000000100000001ull * (uint32_t)c;
+    case MO_64:
+        return c;
+    default:
+        g_assert_not_reached();
+    }
+}
+
+/* Zero the bytes of the destination between OPRSZ and MAXSZ.  */
+static void expand_clr(TCGv_ptr base, uint32_t dofs, uint32_t maxsz)
+{
+    TCGv_i64 zero;
+    uint32_t i;
+
+    if (maxsz == 0) {
+        return;
+    }
+    zero = tcg_const_i64(0);
+    for (i = 0; i < maxsz; i += 8) {
+        tcg_gen_st_i64(zero, base, dofs + i);
+    }
+    tcg_temp_free_i64(zero);
+}
+
+/* Call an out-of-line helper with pointers to the operands.  */
+static void expand_ool_3(TCGv_ptr base, uint32_t dofs, uint32_t aofs,
+                         uint32_t bofs, uint32_t oprsz, uint32_t maxsz,
+                         void (*fn)(TCGv_ptr, TCGv_ptr, TCGv_ptr, TCGv_i32))
+{
+    TCGv_ptr d = tcg_temp_new_ptr();
+    TCGv_ptr a = tcg_temp_new_ptr();
+    TCGv_ptr b = tcg_temp_new_ptr();
+    TCGv_i32 desc = tcg_const_i32(simd_desc(oprsz, maxsz, 0));
+
+    tcg_gen_addi_ptr(d, base, dofs);
+    tcg_gen_addi_ptr(a, base, aofs);
+    tcg_gen_addi_ptr(b, base, bofs);
+    fn(d, a, b, desc);
+
+    tcg_temp_free_ptr(d);
+    tcg_temp_free_ptr(a);
+    tcg_temp_free_ptr(b);
+    tcg_temp_free_i32(desc);
+}
+
+/* Expand D = A op B one 64-bit chunk at a time.  */
+static void expand_3_i64(TCGv_ptr base, uint32_t dofs, uint32_t aofs,
+                         uint32_t bofs, uint32_t oprsz,
+                         void (*fni)(TCGv_i64, TCGv_i64, TCGv_i64))
+{
+    TCGv_i64 t0 = tcg_temp_new_i64();
+    TCGv_i64 t1 = tcg_temp_new_i64();
+    uint32_t i;
+
+    for (i = 0; i < oprsz; i += 8) {
+        tcg_gen_ld_i64(t0, base, aofs + i);
+        tcg_gen_ld_i64(t1, base, bofs + i);
+        fni(t0, t0, t1);
+        tcg_gen_st_i64(t0, base, dofs + i);
+    }
+    tcg_temp_free_i64(t0);
+    tcg_temp_free_i64(t1);
+}
+
+static void expand_3(TCGv_ptr base, uint32_t dofs, uint32_t aofs,
+                     uint32_t bofs, uint32_t oprsz, uint32_t maxsz,
+                     void (*fni)(TCGv_i64, TCGv_i64, TCGv_i64),
+                     void (*fno)(TCGv_ptr, TCGv_ptr, TCGv_ptr, TCGv_i32))
+{
+    check_size_align(oprsz, maxsz, dofs | aofs | bofs);
+
+    if (fni && oprsz <= MAX_INLINE_SIZE) {
+        expand_3_i64(base, dofs, aofs, bofs, oprsz, fni);
+        expand_clr(base, dofs + oprsz, maxsz - oprsz);
+    } else {
+        expand_ool_3(base, dofs, aofs, bofs, oprsz, maxsz, fno);
+    }
+}
+
+void tcg_gen_gvec_mov(unsigned vece, TCGv_ptr base, uint32_t dofs,
+                      uint32_t aofs, uint32_t oprsz, uint32_t maxsz)
+{
+    check_size_align(oprsz, maxsz, dofs | aofs);
+
+    if (dofs == aofs) {
+        expand_clr(base, dofs + oprsz, maxsz - oprsz);
+    } else if (oprsz <= MAX_INLINE_SIZE) {
+        TCGv_i64 t0 = tcg_temp_new_i64();
+        uint32_t i;
+
+        for (i = 0; i < oprsz; i += 8) {
+            tcg_gen_ld_i64(t0, base, aofs + i);
+            tcg_gen_st_i64(t0, base, dofs + i);
+        }
+        tcg_temp_free_i64(t0);
+        expand_clr(base, dofs + oprsz, maxsz - oprsz);
+    } else {
+        TCGv_ptr d = tcg_temp_new_ptr();
+        TCGv_ptr a = tcg_temp_new_ptr();
+        TCGv_i32 desc = tcg_const_i32(simd_desc(oprsz, maxsz, 0));
+
+        tcg_gen_addi_ptr(d, base, dofs);
+        tcg_gen_addi_ptr(a, base, aofs);
+        gen_helper_gvec_mov(d, a, desc);
+
+        tcg_temp_free_ptr(d);
+        tcg_temp_free_ptr(a);
+        tcg_temp_free_i32(desc);
+    }
+}
+
+/* Lane-wise addition and subtraction within one 64-bit temporary.
+ * M holds the most significant bit of each lane; clearing it keeps
+ * carries and borrows from propagating into the neighbouring lane, and
+ * the true value of that bit is then restored with an exclusive-or.
+ */
+static void gen_addv_mask(TCGv_i64 d, TCGv_i64 a, TCGv_i64 b, TCGv_i64 m)
+{
+    TCGv_i64 t1 = tcg_temp_new_i64();
+    TCGv_i64 t2 = tcg_temp_new_i64();
+    TCGv_i64 t3 = tcg_temp_new_i64();
+
+    tcg_gen_andc_i64(t1, a, m);
+    tcg_gen_andc_i64(t2, b, m);
+    tcg_gen_xor_i64(t3, a, b);
+    tcg_gen_add_i64(d, t1, t2);
+    tcg_gen_and_i64(t3, t3, m);
+    tcg_gen_xor_i64(d, d, t3);
+
+    tcg_temp_free_i64(t1);
+    tcg_temp_free_i64(t2);
+    tcg_temp_free_i64(t3);
+}
+
+static void gen_subv_mask(TCGv_i64 d, TCGv_i64 a, TCGv_i64 b, TCGv_i64 m)
+{
+    TCGv_i64 t1 = tcg_temp_new_i64();
+    TCGv_i64 t2 = tcg_temp_new_i64();
+    TCGv_i64 t3 = tcg_temp_new_i64();
+
+    tcg_gen_or_i64(t1, a, m);
+    tcg_gen_andc_i64(t2, b, m);
+    tcg_gen_eqv_i64(t3, a, b);
+    tcg_gen_sub_i64(d, t1, t2);
+    tcg_gen_and_i64(t3, t3, m);
+    tcg_gen_xor_i64(d, d, t3);
+
+    tcg_temp_free_i64(t1);
+    tcg_temp_free_i64(t2);
+    tcg_temp_free_i64(t3);
+}
+
+static void gen_vec_add8_i64(TCGv_i64 d, TCGv_i64 a, TCGv_i64 b)
+{
+    TCGv_i64 m = tcg_const_i64(dup_const(MO_8, 0x80));
+    gen_addv_mask(d, a, b, m);
+    tcg_temp_free_i64(m);
+}
+
+static void gen_vec_add16_i64(TCGv_i64 d, TCGv_i64 a, TCGv_i64 b)
+{
+    TCGv_i64 m = tcg_const_i64(dup_const(MO_16, 0x8000));
+    gen_addv_mask(d, a, b, m);
+    tcg_temp_free_i64(m);
+}
+
+static void gen_vec_add32_i64(TCGv_i64 d, TCGv_i64 a, TCGv_i64 b)
+{
+    TCGv_i64 m = tcg_const_i64(dup_const(MO_32, 0x80000000));
+    gen_addv_mask(d, a, b, m);
+    tcg_temp_free_i64(m);
+}
+
+static void gen_vec_sub8_i64(TCGv_i64 d, TCGv_i64 a, TCGv_i64 b)
+{
+    TCGv_i64 m = tcg_const_i64(dup_const(MO_8, 0x80));
+    gen_subv_mask(d, a, b, m);
+    tcg_temp_free_i64(m);
+}
+
+static void gen_vec_sub16_i64(TCGv_i64 d, TCGv_i64 a, TCGv_i64 b)
+{
+    TCGv_i64 m = tcg_const_i64(dup_const(MO_16, 0x8000));
+    gen_subv_mask(d, a, b, m);
+    tcg_temp_free_i64(m);
+}
+
+static void gen_vec_sub32_i64(TCGv_i64 d, TCGv_i64 a, TCGv_i64 b)
+{
+    TCGv_i64 m = tcg_const_i64(dup_const(MO_32, 0x80000000));
+    gen_subv_mask(d, a, b, m);
+    tcg_temp_free_i64(m);
+}
+
+void tcg_gen_gvec_add(unsigned vece, TCGv_ptr base, uint32_t dofs,
+                      uint32_t aofs, uint32_t bofs,
+                      uint32_t oprsz, uint32_t maxsz)
+{
+    static void (* const fni[4])(TCGv_i64, TCGv_i64, TCGv_i64) = {
+        gen_vec_add8_i64, gen_vec_add16_i64,
+        gen_vec_add32_i64, tcg_gen_add_i64
+    };
+    static void (* const fno[4])(TCGv_ptr, TCGv_ptr, TCGv_ptr, TCGv_i32) = {
+        gen_helper_gvec_add8, gen_helper_gvec_add16,
+        gen_helper_gvec_add32, gen_helper_gvec_add64
+    };
+
+    tcg_debug_assert(vece <= MO_64);
+    expand_3(base, dofs, aofs, bofs, oprsz, maxsz, fni[vece], fno[vece]);
+}
+
+void tcg_gen_gvec_sub(unsigned vece, TCGv_ptr base, uint32_t dofs,
+                      uint32_t aofs, uint32_t bofs,
+                      uint32_t oprsz, uint32_t maxsz)
+{
+    static void (* const fni[4])(TCGv_i64, TCGv_i64, TCGv_i64) = {
+        gen_vec_sub8_i64, gen_vec_sub16_i64,
+        gen_vec_sub32_i64, tcg_gen_sub_i64
+    };
+    static void (* const fno[4])(TCGv_ptr, TCGv_ptr, TCGv_ptr, TCGv_i32) = {
+        gen_helper_gvec_sub8, gen_helper_gvec_sub16,
+        gen_helper_gvec_sub32, gen_helper_gvec_sub64
+    };
+
+    tcg_debug_assert(vece <= MO_64);
+    expand_3(base, dofs, aofs, bofs, oprsz, maxsz, fni[vece], fno[vece]);
+}
+
+void tcg_gen_gvec_mul(unsigned vece, TCGv_ptr base, uint32_t dofs,
+                      uint32_t aofs, uint32_t bofs,
+                      uint32_t oprsz, uint32_t maxsz)
+{
+    /* Narrow lanes have no cheap 64-bit form; always use the helper,
+       which the host compiler vectorizes.  */
+    static void (* const fni[4])(TCGv_i64, TCGv_i64, TCGv_i64) = {
+        NULL, NULL, NULL, tcg_gen_mul_i64
+    };
+    static void (* const fno[4])(TCGv_ptr, TCGv_ptr, TCGv_ptr, TCGv_i32) = {
+        gen_helper_gvec_mul8, gen_helper_gvec_mul16,
+        gen_helper_gvec_mul32, gen_helper_gvec_mul64
+    };
+
+    tcg_debug_assert(vece <= MO_64);
+    expand_3(base, dofs, aofs, bofs, oprsz, maxsz, fni[vece], fno[vece]);
+}
+
+void tcg_gen_gvec_and(unsigned vece, TCGv_ptr base, uint32_t dofs,
+                      uint32_t aofs, uint32_t bofs,
+                      uint32_t oprsz, uint32_t maxsz)
+{
+    expand_3(base, dofs, aofs, bofs, oprsz, maxsz,
+             tcg_gen_and_i64, gen_helper_gvec_and);
+}
+
+void tcg_gen_gvec_or(unsigned vece, TCGv_ptr base, uint32_t dofs,
+                     uint32_t aofs, uint32_t bofs,
+                     uint32_t oprsz, uint32_t maxsz)
+{
+    expand_3(base, dofs, aofs, bofs, oprsz, maxsz,
+             tcg_gen_or_i64, gen_helper_gvec_or);
+}
+
+void tcg_gen_gvec_xor(unsigned vece, TCGv_ptr base, uint32_t dofs,
+                      uint32_t aofs, uint32_t bofs,
+                      uint32_t oprsz, uint32_t maxsz)
+{
+    expand_3(base, dofs, aofs, bofs, oprsz, maxsz,
+             tcg_gen_xor_i64, gen_helper_gvec_xor);
+}
+
+void tcg_gen_gvec_andc(unsigned vece, TCGv_ptr base, uint32_t dofs,
+                       uint32_t aofs, uint32_t bofs,
+                       uint32_t oprsz, uint32_t maxsz)
+{
+    expand_3(base, dofs, aofs, bofs, oprsz, maxsz,
+             tcg_gen_andc_i64, gen_helper_gvec_andc);
+}
+
+void tcg_gen_gvec_orc(unsigned vece, TCGv_ptr base, uint32_t dofs,
+                      uint32_t aofs, uint32_t bofs,
+                      uint32_t oprsz, uint32_t maxsz)
+{
+    expand_3(base, dofs, aofs, bofs, oprsz, maxsz,
+             tcg_gen_orc_i64, gen_helper_gvec_orc);
+}
+
+void tcg_gen_gvec_dup_i64(unsigned vece, TCGv_ptr base, uint32_t dofs,
+                          uint32_t oprsz, uint32_t maxsz, TCGv_i64 in)
+{
+    TCGv_i64 t0 = tcg_temp_new_i64();
+    uint32_t i;
+
+    check_size_align(oprsz, maxsz, dofs);
+    tcg_debug_assert(vece <= MO_64);
+
+    /* Replicate the element by multiplying its zero-extension with
+       a constant that has a one in the low bit of every lane.  */
+    switch (vece) {
+    case MO_8:
+        tcg_gen_ext8u_i64(t0, in);
+        tcg_gen_muli_i64(t0, t0, dup_const(MO_8, 1));
+        break;
+    case MO_16:
+        tcg_gen_ext16u_i64(t0, in);
+        tcg_gen_muli_i64(t0, t0, dup_const(MO_16, 1));
+        break;
+    case MO_32:
+        tcg_gen_deposit_i64(t0, in, in, 32, 32);
+        break;
+    default:
+        tcg_gen_mov_i64(t0, in);
+        break;
+    }
+
+    if (oprsz <= MAX_INLINE_SIZE) {
+        for (i = 0; i < oprsz; i += 8) {
+            tcg_gen_st_i64(t0, base, dofs + i);
+        }
+        expand_clr(base, dofs + oprsz, maxsz - oprsz);
+    } else {
+        TCGv_ptr d = tcg_temp_new_ptr();
+        TCGv_i32 desc = tcg_const_i32(simd_desc(oprsz, maxsz, 0));
+
+        tcg_gen_addi_ptr(d, base, dofs);
+        gen_helper_gvec_dup64(d, desc, t0);
+
+        tcg_temp_free_ptr(d);
+        tcg_temp_free_i32(desc);
+    }
+    tcg_temp_free_i64(t0);
+}
+
+void tcg_gen_gvec_dup_mem(unsigned vece, TCGv_ptr base, uint32_t dofs,
+                          uint32_t aofs, uint32_t oprsz, uint32_t maxsz)
+{
+    TCGv_i64 t0 = tcg_temp_new_i64();
+
+    switch (vece) {
+    case MO_8:
+        tcg_gen_ld8u_i64(t0, base, aofs);
+        break;
+    case MO_16:
+        tcg_gen_ld16u_i64(t0, base, aofs);
+        break;
+    case MO_32:
+        tcg_gen_ld32u_i64(t0, base, aofs);
+        break;
+    default:
+        tcg_gen_ld_i64(t0, base, aofs);
+        break;
+    }
+    tcg_gen_gvec_dup_i64(vece, base, dofs, oprsz, maxsz, t0);
+    tcg_temp_free_i64(t0);
+}
@@ -0,0 +1,68 @@
+/*
+ * Generic vector operation expansion
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#ifndef TCG_TCG_OP_GVEC_H
+#define TCG_TCG_OP_GVEC_H
+
+/*
+ * "Generic" vectors.  All operands are given as offsets from BASE, which
+ * is normally the env pointer of the translating target.  All sizes must
+ * be multiples of 8 up to 256.  OPRSZ is the number of bytes operated on;
+ * the bytes between OPRSZ and MAXSZ of the destination are zeroed.  VECE
+ * is the element size as a TCGMemOp (MO_8 ... MO_64).
+ *
+ * Small operations are expanded inline into 64-bit integer operations,
+ * combining narrow lanes within one 64-bit temporary where possible.
+ * Larger operations, and those with no cheap inline form, call the
+ * out-of-line helpers in tcg-runtime-gvec.c.
+ */
+
+typedef void GVecGen3Fn(unsigned vece, TCGv_ptr base, uint32_t dofs,
+                        uint32_t aofs, uint32_t bofs,
+                        uint32_t oprsz, uint32_t maxsz);
+
+void tcg_gen_gvec_mov(unsigned vece, TCGv_ptr base, uint32_t dofs,
+                      uint32_t aofs, uint32_t oprsz, uint32_t maxsz);
+
+void tcg_gen_gvec_add(unsigned vece, TCGv_ptr base, uint32_t dofs,
+                      uint32_t aofs, uint32_t bofs,
+                      uint32_t oprsz, uint32_t maxsz);
+void tcg_gen_gvec_sub(unsigned vece, TCGv_ptr base, uint32_t dofs,
+                      uint32_t aofs, uint32_t bofs,
+                      uint32_t oprsz, uint32_t maxsz);
+void tcg_gen_gvec_mul(unsigned vece, TCGv_ptr base, uint32_t dofs,
+                      uint32_t aofs, uint32_t bofs,
+                      uint32_t oprsz, uint32_t maxsz);
+
+void tcg_gen_gvec_and(unsigned vece, TCGv_ptr base, uint32_t dofs,
+                      uint32_t aofs, uint32_t bofs,
+                      uint32_t oprsz, uint32_t maxsz);
+void tcg_gen_gvec_or(unsigned vece, TCGv_ptr base, uint32_t dofs,
+                     uint32_t aofs, uint32_t bofs,
+                     uint32_t oprsz, uint32_t maxsz);
+void tcg_gen_gvec_xor(unsigned vece, TCGv_ptr base, uint32_t dofs,
+                      uint32_t aofs, uint32_t bofs,
+                      uint32_t oprsz, uint32_t maxsz);
+void tcg_gen_gvec_andc(unsigned vece, TCGv_ptr base, uint32_t dofs,
+                       uint32_t aofs, uint32_t bofs,
+                       uint32_t oprsz, uint32_t maxsz);
+void tcg_gen_gvec_orc(unsigned vece, TCGv_ptr base, uint32_t dofs,
+                      uint32_t aofs, uint32_t bofs,
+                      uint32_t oprsz, uint32_t maxsz);
+
+/* Replicate the low VECE bits of IN, or the element at AOFS, across
+ * every element of the destination.
+ */
+void tcg_gen_gvec_dup_i64(unsigned vece, TCGv_ptr base, uint32_t dofs,
+                          uint32_t oprsz, uint32_t maxsz, TCGv_i64 in);
+void tcg_gen_gvec_dup_mem(unsigned vece, TCGv_ptr base, uint32_t dofs,
+                          uint32_t aofs, uint32_t oprsz, uint32_t maxsz);
+
+/* Return a 64-bit constant with C replicated into every element of VECE.  */
+uint64_t dup_const(unsigned vece, uint64_t c);
+
+#endif
@@ -255,6 +255,112 @@ TCGLabel *gen_new_label(void)
     return l;
 }
 
+/* host address relocation processing, for relocatable code */
+
+#if TCG_TARGET_HAS_HOST_RELOC
+extern char __executable_start[], etext[];
+#endif
+
+/* Record that the field at FIELD holds TARGET, encoded as TYPE.  Addresses
+   outside the TB's code, the prologue and the executable text make the
+   TB non-relocatable.  */
+static __attribute__((unused)) void
+tcg_host_reloc_add(TCGContext *s, tcg_insn_unit *field,
+                   TCGHostRelocType type, uintptr_t target)
+{
+    uintptr_t code = (uintptr_t)s->code_buf;
+    uintptr_t prologue = (uintptr_t)s->code_gen_prologue;
+    TCGHostReloc *r;
+    uintptr_t base;
+    int kind;
+
+    if (target >= code && target <= (uintptr_t)s->code_ptr) {
+        kind = TCG_HOST_BASE_CODE;
+        base = code;
+    } else if (target >= prologue && target < prologue + 1024) {
+        kind = TCG_HOST_BASE_PROLOGUE;
+        base = prologue;
+    } else if (s->reloc_tb && (target & ~(uintptr_t)3) == s->reloc_tb) {
+        kind = TCG_HOST_BASE_TB;
+        base = s->reloc_tb;
+#if TCG_TARGET_HAS_HOST_RELOC
+    } else if (target >= (uintptr_t)__executable_start &&
+               target < (uintptr_t)etext) {
+        kind = TCG_HOST_BASE_TEXT;
+        base = (uintptr_t)__executable_start;
+#endif
+    } else {
+        s->reloc_failed = true;
+        return;
+    }
+
+    if (s->nb_host_relocs == TCG_MAX_HOST_RELOCS) {
+        s->reloc_failed = true;
+        return;
+    }
+    r = &s->host_relocs[s->nb_host_relocs++];
+    r->offset = tcg_ptr_byte_diff(field, s->code_buf);
+    r->type = type;
+    r->base = kind;
+    r->addend = target - base;
+}
+
+/* Patch the host addresses in CODE, a copy of the code of a TB made
+   in relocation mode, for its new location and its new TB structure.
+   Return false if some address cannot be encoded there.  */
+bool tcg_host_reloc_apply(TCGContext *s, tcg_insn_unit *code, uintptr_t tb,
+                          const TCGHostReloc *relocs, int nb_relocs)
+{
+    int i;
+
+    for (i = 0; i < nb_relocs; i++) {
+        const TCGHostReloc *r = &relocs[i];
+        void *field = (void *)code + r->offset;
+        uintptr_t target;
+        intptr_t disp;
+        int32_t disp32;
+        uint64_t abs64;
+
+        switch (r->base) {
+        case TCG_HOST_BASE_TB:
+            target = tb;
+            break;
+        case TCG_HOST_BASE_CODE:
+            target = (uintptr_t)code;
+            break;
+        case TCG_HOST_BASE_PROLOGUE:
+            target = (uintptr_t)s->code_gen_prologue;
+            break;
+#if TCG_TARGET_HAS_HOST_RELOC
+        case TCG_HOST_BASE_TEXT:
+            target = (uintptr_t)__executable_start;
+            break;
+#endif
+        default:
+            return false;
+        }
+        target += r->addend;
+
+        switch (r->type) {
+        case TCG_HOST_RELOC_ABS64:
+            abs64 = target;
+            memcpy(field, &abs64, sizeof(abs64));
+            break;
+        case TCG_HOST_RELOC_REL32:
+            disp = target - ((uintptr_t)field + 4);
+            disp32 = disp;
+            if (disp != disp32) {
+                return false;
+            }
+            memcpy(field, &disp32, sizeof(disp32));
+            break;
+        default:
+            return false;
+        }
+    }
+    return true;
+}
+
 #include "tcg-target.c"
 
 /* pool based memory allocation */
@@ -403,6 +509,7 @@ void tcg_func_start(TCGContext *s)
 
     s->nb_labels = 0;
     s->current_frame_offset = s->frame_start;
+    s->reloc_failed = false;
 
 #ifdef CONFIG_DEBUG_TCG
     s->goto_tb_issue_mask = 0;
@@ -2340,6 +2447,7 @@ static inline int tcg_gen_code_common(TCGContext *s,
 
     s->code_buf = gen_code_buf;
     s->code_ptr = gen_code_buf;
+    s->nb_host_relocs = 0;
 
     tcg_out_tb_init(s);
 
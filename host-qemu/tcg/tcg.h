@@ -29,6 +29,10 @@
 #include "qemu/bitops.h"
 #include "tcg-target.h"
 
+#ifndef TCG_TARGET_HAS_HOST_RELOC
+#define TCG_TARGET_HAS_HOST_RELOC 0
+#endif
+
 #define CPU_TEMP_BUF_NLONGS 128
 
 /* Default target word size to pointer size.  */
@@ -483,6 +487,31 @@ QEMU_BUILD_BUG_ON(NB_OPS > 0xff);
 QEMU_BUILD_BUG_ON(OPC_BUF_SIZE >= 0x7fff);
 QEMU_BUILD_BUG_ON(OPPARAM_BUF_SIZE >= 0x7fff);
 
+/* Host addresses embedded in relocatable generated code.  Each one is
+   recorded as an offset from one of a few bases that can be recomputed
+   when the code is copied to another TB, possibly in another process
+   running the same QEMU binary.  */
+typedef enum TCGHostRelocType {
+    TCG_HOST_RELOC_ABS64,   /* 64-bit absolute address */
+    TCG_HOST_RELOC_REL32,   /* 32-bit displacement from the end of field */
+} TCGHostRelocType;
+
+typedef enum TCGHostRelocBase {
+    TCG_HOST_BASE_TB,       /* the TranslationBlock structure */
+    TCG_HOST_BASE_CODE,     /* the start of the TB's own code */
+    TCG_HOST_BASE_PROLOGUE, /* tcg_ctx.code_gen_prologue */
+    TCG_HOST_BASE_TEXT,     /* the start of the QEMU executable */
+} TCGHostRelocBase;
+
+typedef struct TCGHostReloc {
+    uint32_t offset;        /* of the field, from the start of the code */
+    uint8_t type;
+    uint8_t base;
+    int64_t addend;         /* target address minus base address */
+} TCGHostReloc;
+
+#define TCG_MAX_HOST_RELOCS 512
+
 struct TCGContext {
     uint8_t *pool_cur, *pool_end;
     TCGPool *pool_first, *pool_current, *pool_first_large;
@@ -556,6 +585,18 @@ struct TCGContext {
 
     TBContext tb_ctx;
 
+    /* Relocatable code generation.  reloc_mode makes the backend emit
+       every host address in a position independent form and record it
+       in host_relocs; it must not change once code has been generated,
+       because cpu_restore_state regenerates code in place.  reloc_tb is
+       the TB whose code is being generated.  reloc_failed is set when
+       the TB embeds a host address that cannot be described.  */
+    bool reloc_mode;
+    bool reloc_failed;
+    uintptr_t reloc_tb;
+    int nb_host_relocs;
+    TCGHostReloc host_relocs[TCG_MAX_HOST_RELOCS];
+
     /* The TCGBackendData structure is private to tcg-target.c.  */
     struct TCGBackendData *be;
 
@@ -616,6 +657,13 @@ void tcg_func_start(TCGContext *s);
 int tcg_gen_code(TCGContext *s, tcg_insn_unit *gen_code_buf);
 int tcg_gen_code_search_pc(TCGContext *s, tcg_insn_unit *gen_code_buf,
                            long offset);
+bool tcg_host_reloc_apply(TCGContext *s, tcg_insn_unit *code, uintptr_t tb,
+                          const TCGHostReloc *relocs, int nb_relocs);
+#if TCG_TARGET_HAS_HOST_RELOC
+/* Bitmask of the optional host instructions that the backend found at
+   run time and may emit; relocatable code is only valid with the same.  */
+uint32_t tcg_target_host_features(void);
+#endif
 
 void tcg_set_frame(TCGContext *s, int reg, intptr_t start, intptr_t size);
 
@@ -730,11 +778,21 @@ do {\
 
 void tcg_add_target_add_op_defs(const TCGTargetOpDef *tdefs);
 
+/* A host pointer loaded as a constant cannot be told apart from other
+   constants once in the opcode stream, so it makes the TB's code
+   non-relocatable.  */
+static inline intptr_t tcg_host_ptr_const(intptr_t ptr)
+{
+    tcg_ctx.reloc_failed = true;
+    return ptr;
+}
+
 #if UINTPTR_MAX == UINT32_MAX
 #define TCGV_NAT_TO_PTR(n) MAKE_TCGV_PTR(GET_TCGV_I32(n))
 #define TCGV_PTR_TO_NAT(n) MAKE_TCGV_I32(GET_TCGV_PTR(n))
 
-#define tcg_const_ptr(V) TCGV_NAT_TO_PTR(tcg_const_i32((intptr_t)(V)))
+#define tcg_const_ptr(V) \
+    TCGV_NAT_TO_PTR(tcg_const_i32(tcg_host_ptr_const((intptr_t)(V))))
 #define tcg_global_reg_new_ptr(R, N) \
     TCGV_NAT_TO_PTR(tcg_global_reg_new_i32((R), (N)))
 #define tcg_global_mem_new_ptr(R, O, N) \
@@ -745,7 +803,8 @@ void tcg_add_target_add_op_defs(const TCGTargetOpDef *tdefs);
 #define TCGV_NAT_TO_PTR(n) MAKE_TCGV_PTR(GET_TCGV_I64(n))
 #define TCGV_PTR_TO_NAT(n) MAKE_TCGV_I64(GET_TCGV_PTR(n))
 
-#define tcg_const_ptr(V) TCGV_NAT_TO_PTR(tcg_const_i64((intptr_t)(V)))
+#define tcg_const_ptr(V) \
+    TCGV_NAT_TO_PTR(tcg_const_i64(tcg_host_ptr_const((intptr_t)(V))))
 #define tcg_global_reg_new_ptr(R, N) \
     TCGV_NAT_TO_PTR(tcg_global_reg_new_i64((R), (N)))
 #define tcg_global_mem_new_ptr(R, O, N) \
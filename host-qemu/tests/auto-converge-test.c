@@ -0,0 +1,163 @@
+/*
+ * QTest testcase for the migration auto-converge throttle
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include <glib.h>
+#include <string.h>
+#include <unistd.h>
+#include "libqtest.h"
+#include "qemu/osdep.h"
+#include "qapi/qmp/qlist.h"
+
+/*
+ * Guest dirtier, loaded as a raw kernel on the "virt" board.  CPU 0
+ * increments one byte in every page of 8 MiB of RAM, forever; the other
+ * CPUs stay powered off and never write to memory.
+ */
+static const uint32_t dirtier[] = {
+    0xe3000000,     /*     movw r0, #0x0000            */
+    0xe3440010,     /*     movt r0, #0x4010            */
+    0xe3001000,     /*     movw r1, #0x0000            */
+    0xe3441090,     /*     movt r1, #0x4090            */
+    0xe1a02000,     /* 1:  mov  r2, r0                 */
+    0xe5d23000,     /* 2:  ldrb r3, [r2]               */
+    0xe2833001,     /*     add  r3, r3, #1             */
+    0xe5c23000,     /*     strb r3, [r2]               */
+    0xe2822a01,     /*     add  r2, r2, #4096          */
+    0xe1520001,     /*     cmp  r2, r1                 */
+    0x3afffff9,     /*     blo  2b                     */
+    0xeafffff7,     /*     b    1b                     */
+};
+
+/* Low enough for the dirtier to be always above the throttle target */
+#define MIGRATION_SPEED (8 << 20)
+#define TIMEOUT_MS 60000
+
+static char *write_kernel(void)
+{
+    GError *error = NULL;
+    char *path;
+    uint8_t buf[sizeof(dirtier)];
+    int fd, i;
+
+    for (i = 0; i < ARRAY_SIZE(dirtier); i++) {
+        buf[i * 4] = dirtier[i];
+        buf[i * 4 + 1] = dirtier[i] >> 8;
+        buf[i * 4 + 2] = dirtier[i] >> 16;
+        buf[i * 4 + 3] = dirtier[i] >> 24;
+    }
+
+    fd = g_file_open_tmp("dirtier-XXXXXX", &path, &error);
+    g_assert_no_error(error);
+    g_assert_cmpint(write(fd, buf, sizeof(buf)), ==, sizeof(buf));
+    close(fd);
+    return path;
+}
+
+static QDict *vcpu_throttle(QDict *info, int64_t cpu_index)
+{
+    QList *list = qdict_get_qlist(info, "vcpu-throttle");
+    const QListEntry *entry;
+
+    for (entry = qlist_first(list); entry; entry = qlist_next(entry)) {
+        QDict *vcpu = qobject_to_qdict(qlist_entry_obj(entry));
+
+        if (qdict_get_int(vcpu, "cpu-index") == cpu_index) {
+            return vcpu;
+        }
+    }
+    g_assert_not_reached();
+    return NULL;
+}
+
+static void test_auto_converge(void)
+{
+    QDict *rsp, *info, *ram, *vcpu;
+    int ms;
+
+    qmp_discard_response("{ 'execute': 'migrate-set-capabilities',"
+                         "  'arguments': { 'capabilities': ["
+                         "    { 'capability': 'auto-converge',"
+                         "      'state': true } ] } }");
+    qmp_discard_response("{ 'execute': 'migrate_set_speed',"
+                         "  'arguments': { 'value': %d } }", MIGRATION_SPEED);
+    qmp_discard_response("{ 'execute': 'migrate_set_downtime',"
+                         "  'arguments': { 'value': 0.001 } }");
+    rsp = qmp("{ 'execute': 'migrate',"
+              "  'arguments': { 'uri': 'exec:cat > /dev/null' } }");
+    g_assert(qdict_haskey(rsp, "return"));
+    QDECREF(rsp);
+
+    /* Wait for the controller to throttle the dirtying vCPU */
+    for (ms = 0; ; ms += 100) {
+        const char *status;
+
+        g_assert_cmpint(ms, <, TIMEOUT_MS);
+        rsp = qmp("{ 'execute': 'query-migrate' }");
+        info = qdict_get_qdict(rsp, "return");
+        status = qdict_get_str(info, "status");
+        if (!strcmp(status, "active") &&
+            qdict_get_int(info, "cpu-throttle-percentage") > 0) {
+            break;
+        }
+        g_assert(!strcmp(status, "setup") || !strcmp(status, "active"));
+        QDECREF(rsp);
+        g_usleep(100 * 1000);
+    }
+
+    ram = qdict_get_qdict(info, "ram");
+    g_assert_cmpint(qdict_get_int(ram, "dirty-pages-rate"), >, 0);
+    g_assert_cmpint(qdict_get_int(info, "expected-downtime"), >, 0);
+
+    vcpu = vcpu_throttle(info, 0);
+    g_assert_cmpint(qdict_get_int(vcpu, "dirty-pages-rate"), >, 0);
+    g_assert_cmpint(qdict_get_int(vcpu, "throttle-percentage"), >, 0);
+
+    /* Only the vCPU that dirties memory is slowed down */
+    vcpu = vcpu_throttle(info, 1);
+    g_assert_cmpint(qdict_get_int(vcpu, "dirty-pages-rate"), ==, 0);
+    g_assert_cmpint(qdict_get_int(vcpu, "throttle-percentage"), ==, 0);
+    QDECREF(rsp);
+
+    qmp_discard_response("{ 'execute': 'migrate_cancel' }");
+    for (ms = 0; ; ms += 100) {
+        const char *status;
+
+        g_assert_cmpint(ms, <, TIMEOUT_MS);
+        rsp = qmp("{ 'execute': 'query-migrate' }");
+        info = qdict_get_qdict(rsp, "return");
+        status = qdict_get_str(info, "status");
+        if (!strcmp(status, "cancelled")) {
+            QDECREF(rsp);
+            break;
+        }
+        g_assert_cmpstr(status, ==, "cancelling");
+        QDECREF(rsp);
+        g_usleep(100 * 1000);
+    }
+}
+
+int main(int argc, char **argv)
+{
+    char *kernel, *args;
+    int ret;
+
+    g_test_init(&argc, &argv, NULL);
+    qtest_add_func("/migration/auto-converge", test_auto_converge);
+
+    kernel = write_kernel();
+    args = g_strdup_printf("-machine virt,accel=tcg -cpu cortex-a15 -smp 2 "
+                           "-m 128 -kernel %s", kernel);
+    qtest_start(args);
+    ret = g_test_run();
+
+    qtest_end();
+    unlink(kernel);
+    g_free(kernel);
+    g_free(args);
+
+    return ret;
+}
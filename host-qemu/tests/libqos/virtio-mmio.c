@@ -39,22 +39,34 @@ static uint64_t qvirtio_mmio_config_readq(QVirtioDevice *d, uint64_t addr)
     return readq(dev->addr + addr);
 }
 
-static uint32_t qvirtio_mmio_get_features(QVirtioDevice *d)
+static uint64_t qvirtio_mmio_get_features(QVirtioDevice *d)
 {
     QVirtioMMIODevice *dev = (QVirtioMMIODevice *)d;
+    uint64_t features;
+
     writel(dev->addr + QVIRTIO_MMIO_HOST_FEATURES_SEL, 0);
-    return readl(dev->addr + QVIRTIO_MMIO_HOST_FEATURES);
+    features = readl(dev->addr + QVIRTIO_MMIO_HOST_FEATURES);
+    if (dev->version > 1) {
+        writel(dev->addr + QVIRTIO_MMIO_HOST_FEATURES_SEL, 1);
+        features |= (uint64_t)readl(dev->addr + QVIRTIO_MMIO_HOST_FEATURES)
+            << 32;
+    }
+    return features;
 }
 
-static void qvirtio_mmio_set_features(QVirtioDevice *d, uint32_t features)
+static void qvirtio_mmio_set_features(QVirtioDevice *d, uint64_t features)
 {
     QVirtioMMIODevice *dev = (QVirtioMMIODevice *)d;
     dev->features = features;
     writel(dev->addr + QVIRTIO_MMIO_GUEST_FEATURES_SEL, 0);
     writel(dev->addr + QVIRTIO_MMIO_GUEST_FEATURES, features);
+    if (dev->version > 1) {
+        writel(dev->addr + QVIRTIO_MMIO_GUEST_FEATURES_SEL, 1);
+        writel(dev->addr + QVIRTIO_MMIO_GUEST_FEATURES, features >> 32);
+    }
 }
 
-static uint32_t qvirtio_mmio_get_guest_features(QVirtioDevice *d)
+static uint64_t qvirtio_mmio_get_guest_features(QVirtioDevice *d)
 {
     QVirtioMMIODevice *dev = (QVirtioMMIODevice *)d;
     return dev->features;
@@ -105,7 +117,11 @@ static void qvirtio_mmio_queue_select(QVirtioDevice *d, uint16_t index)
     QVirtioMMIODevice *dev = (QVirtioMMIODevice *)d;
     writel(dev->addr + QVIRTIO_MMIO_QUEUE_SEL, (uint32_t)index);
 
-    g_assert_cmphex(readl(dev->addr + QVIRTIO_MMIO_QUEUE_PFN), ==, 0);
+    if (dev->version > 1) {
+        g_assert_cmphex(readl(dev->addr + QVIRTIO_MMIO_QUEUE_READY), ==, 0);
+    } else {
+        g_assert_cmphex(readl(dev->addr + QVIRTIO_MMIO_QUEUE_PFN), ==, 0);
+    }
 }
 
 static uint16_t qvirtio_mmio_get_queue_size(QVirtioDevice *d)
@@ -120,6 +136,20 @@ static void qvirtio_mmio_set_queue_address(QVirtioDevice *d, uint32_t pfn)
     writel(dev->addr + QVIRTIO_MMIO_QUEUE_PFN, pfn);
 }
 
+static void qvirtio_mmio_set_queue_rings(QVirtioMMIODevice *dev,
+                                         QVirtQueue *vq)
+{
+    writel(dev->addr + QVIRTIO_MMIO_QUEUE_DESC_LOW, vq->desc);
+    writel(dev->addr + QVIRTIO_MMIO_QUEUE_DESC_HIGH, vq->desc >> 32);
+    writel(dev->addr + QVIRTIO_MMIO_QUEUE_AVAIL_LOW, vq->avail);
+    writel(dev->addr + QVIRTIO_MMIO_QUEUE_AVAIL_HIGH, vq->avail >> 32);
+    writel(dev->addr + QVIRTIO_MMIO_QUEUE_USED_LOW, vq->used);
+    writel(dev->addr + QVIRTIO_MMIO_QUEUE_USED_HIGH, vq->used >> 32);
+
+    writel(dev->addr + QVIRTIO_MMIO_QUEUE_READY, 1);
+    g_assert_cmphex(readl(dev->addr + QVIRTIO_MMIO_QUEUE_READY), ==, 1);
+}
+
 static QVirtQueue *qvirtio_mmio_virtqueue_setup(QVirtioDevice *d,
                                         QGuestAllocator *alloc, uint16_t index)
 {
@@ -129,10 +159,16 @@ static QVirtQueue *qvirtio_mmio_virtqueue_setup(QVirtioDevice *d,
 
     vq = g_malloc0(sizeof(*vq));
     qvirtio_mmio_queue_select(d, index);
-    writel(dev->addr + QVIRTIO_MMIO_QUEUE_ALIGN, dev->page_size);
+    if (dev->version == 1) {
+        writel(dev->addr + QVIRTIO_MMIO_QUEUE_ALIGN, dev->page_size);
+    }
 
     vq->index = index;
     vq->size = qvirtio_mmio_get_queue_size(d);
+    if (dev->version > 1 && dev->queue_size) {
+        g_assert_cmpint(dev->queue_size, <=, vq->size);
+        vq->size = dev->queue_size;
+    }
     vq->free_head = 0;
     vq->num_free = vq->size;
     vq->align = dev->page_size;
@@ -147,9 +183,19 @@ static QVirtQueue *qvirtio_mmio_virtqueue_setup(QVirtioDevice *d,
     /* Check power of 2 */
     g_assert_cmpint(vq->size & (vq->size - 1), ==, 0);
 
-    addr = guest_alloc(alloc, qvring_size(vq->size, dev->page_size));
-    qvring_init(alloc, vq, addr);
-    qvirtio_mmio_set_queue_address(d, vq->desc / dev->page_size);
+    if (dev->features & QVIRTIO_F_RING_PACKED) {
+        addr = guest_alloc(alloc, qvring_packed_size(vq->size));
+        qvring_packed_init(alloc, vq, addr);
+    } else {
+        addr = guest_alloc(alloc, qvring_size(vq->size, dev->page_size));
+        qvring_init(alloc, vq, addr);
+    }
+
+    if (dev->version > 1) {
+        qvirtio_mmio_set_queue_rings(dev, vq);
+    } else {
+        qvirtio_mmio_set_queue_address(d, vq->desc / dev->page_size);
+    }
 
     return vq;
 }
@@ -190,9 +236,12 @@ QVirtioMMIODevice *qvirtio_mmio_init_device(uint64_t addr, uint32_t page_size)
 
     dev->addr = addr;
     dev->page_size = page_size;
+    dev->version = readl(addr + QVIRTIO_MMIO_VERSION);
     dev->vdev.device_type = readl(addr + QVIRTIO_MMIO_DEVICE_ID);
 
-    writel(addr + QVIRTIO_MMIO_GUEST_PAGE_SIZE, page_size);
+    if (dev->version == 1) {
+        writel(addr + QVIRTIO_MMIO_GUEST_PAGE_SIZE, page_size);
+    }
 
     return dev;
 }
@@ -26,17 +26,27 @@
 #define QVIRTIO_MMIO_QUEUE_NUM          0x038
 #define QVIRTIO_MMIO_QUEUE_ALIGN        0x03C
 #define QVIRTIO_MMIO_QUEUE_PFN          0x040
+#define QVIRTIO_MMIO_QUEUE_READY        0x044
 #define QVIRTIO_MMIO_QUEUE_NOTIFY       0x050
 #define QVIRTIO_MMIO_INTERRUPT_STATUS   0x060
 #define QVIRTIO_MMIO_INTERRUPT_ACK      0x064
 #define QVIRTIO_MMIO_DEVICE_STATUS      0x070
+#define QVIRTIO_MMIO_QUEUE_DESC_LOW     0x080
+#define QVIRTIO_MMIO_QUEUE_DESC_HIGH    0x084
+#define QVIRTIO_MMIO_QUEUE_AVAIL_LOW    0x090
+#define QVIRTIO_MMIO_QUEUE_AVAIL_HIGH   0x094
+#define QVIRTIO_MMIO_QUEUE_USED_LOW     0x0A0
+#define QVIRTIO_MMIO_QUEUE_USED_HIGH    0x0A4
+#define QVIRTIO_MMIO_CONFIG_GENERATION  0x0FC
 #define QVIRTIO_MMIO_DEVICE_SPECIFIC    0x100
 
 typedef struct QVirtioMMIODevice {
     QVirtioDevice vdev;
     uint64_t addr;
     uint32_t page_size;
-    uint32_t features; /* As it cannot be read later, save it */
+    uint32_t version;
+    uint16_t queue_size; /* Version 2 queue size, 0 for the maximum */
+    uint64_t features; /* As it cannot be read later, save it */
 } QVirtioMMIODevice;
 
 extern const QVirtioBus qvirtio_mmio;
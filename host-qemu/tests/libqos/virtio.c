@@ -35,13 +35,13 @@ uint64_t qvirtio_config_readq(const QVirtioBus *bus, QVirtioDevice *d,
     return bus->config_readq(d, addr);
 }
 
-uint32_t qvirtio_get_features(const QVirtioBus *bus, QVirtioDevice *d)
+uint64_t qvirtio_get_features(const QVirtioBus *bus, QVirtioDevice *d)
 {
     return bus->get_features(d);
 }
 
 void qvirtio_set_features(const QVirtioBus *bus, QVirtioDevice *d,
-                                                            uint32_t features)
+                                                            uint64_t features)
 {
     bus->set_features(d, features);
 }
@@ -71,10 +71,22 @@ void qvirtio_set_driver(const QVirtioBus *bus, QVirtioDevice *d)
                                     QVIRTIO_DRIVER | QVIRTIO_ACKNOWLEDGE);
 }
 
+/* Only virtio 1.0 devices have the FEATURES_OK step, and they clear it
+ * again if they do not accept the features written before.
+ */
+void qvirtio_set_features_ok(const QVirtioBus *bus, QVirtioDevice *d)
+{
+    bus->set_status(d, bus->get_status(d) | QVIRTIO_FEATURES_OK);
+    g_assert_cmphex(bus->get_status(d), ==,
+                QVIRTIO_FEATURES_OK | QVIRTIO_DRIVER | QVIRTIO_ACKNOWLEDGE);
+}
+
 void qvirtio_set_driver_ok(const QVirtioBus *bus, QVirtioDevice *d)
 {
+    uint8_t status = bus->get_status(d) & QVIRTIO_FEATURES_OK;
+
     bus->set_status(d, bus->get_status(d) | QVIRTIO_DRIVER_OK);
-    g_assert_cmphex(bus->get_status(d), ==,
+    g_assert_cmphex(bus->get_status(d), ==, status |
                 QVIRTIO_DRIVER_OK | QVIRTIO_DRIVER | QVIRTIO_ACKNOWLEDGE);
 }
 
@@ -157,6 +169,35 @@ void qvring_init(const QGuestAllocator *alloc, QVirtQueue *vq, uint64_t addr)
     writew(vq->used+2+(sizeof(struct QVRingUsedElem)*vq->size), 0);
 }
 
+void qvring_packed_init(const QGuestAllocator *alloc, QVirtQueue *vq,
+                                                                uint64_t addr)
+{
+    int i;
+
+    vq->packed = true;
+    vq->desc = addr;
+    vq->avail = vq->desc + vq->size * sizeof(QVRingPackedDesc);
+    vq->used = vq->avail + sizeof(QVRingPackedDescEvent);
+    vq->avail_wrap_counter = true;
+    vq->used_wrap_counter = true;
+    vq->last_used_idx = 0;
+    vq->chained = false;
+    vq->ndescs = g_new0(uint16_t, vq->size);
+
+    for (i = 0; i < vq->size; i++) {
+        /* vq->desc[i].flags: neither available nor used in either lap */
+        writew(vq->desc + (16 * i) + 14, 0);
+    }
+
+    /* Driver event area: interrupt on every used buffer */
+    writew(vq->avail, 0);
+    writew(vq->avail + 2, QVRING_PACKED_EVENT_FLAG_ENABLE);
+
+    /* Device event area */
+    writew(vq->used, 0);
+    writew(vq->used + 2, QVRING_PACKED_EVENT_FLAG_ENABLE);
+}
+
 QVRingIndirectDesc *qvring_indirect_desc_setup(QVirtioDevice *d,
                                         QGuestAllocator *alloc, uint16_t elem)
 {
@@ -165,6 +206,7 @@ QVRingIndirectDesc *qvring_indirect_desc_setup(QVirtioDevice *d,
 
     indirect->index = 0;
     indirect->elem = elem;
+    indirect->packed = false;
     indirect->desc = guest_alloc(alloc, sizeof(QVRingDesc)*elem);
 
     for (i = 0; i < elem - 1; ++i) {
@@ -179,14 +221,40 @@ QVRingIndirectDesc *qvring_indirect_desc_setup(QVirtioDevice *d,
     return indirect;
 }
 
+/* A packed indirect table has no next fields: the device walks all of it */
+QVRingIndirectDesc *qvring_packed_indirect_desc_setup(QVirtioDevice *d,
+                                        QGuestAllocator *alloc, uint16_t elem)
+{
+    int i;
+    QVRingIndirectDesc *indirect = g_malloc(sizeof(*indirect));
+
+    indirect->index = 0;
+    indirect->elem = elem;
+    indirect->packed = true;
+    indirect->desc = guest_alloc(alloc, sizeof(QVRingPackedDesc) * elem);
+
+    for (i = 0; i < elem; ++i) {
+        /* indirect->desc[i].addr */
+        writeq(indirect->desc + (16 * i), 0);
+        /* indirect->desc[i].id */
+        writew(indirect->desc + (16 * i) + 12, 0);
+        /* indirect->desc[i].flags */
+        writew(indirect->desc + (16 * i) + 14, 0);
+    }
+
+    return indirect;
+}
+
 void qvring_indirect_desc_add(QVRingIndirectDesc *indirect, uint64_t data,
                                                     uint32_t len, bool write)
 {
+    /* Offset of the flags field in either descriptor layout */
+    unsigned flags_off = indirect->packed ? 14 : 12;
     uint16_t flags;
 
     g_assert_cmpint(indirect->index, <, indirect->elem);
 
-    flags = readw(indirect->desc + (16 * indirect->index) + 12);
+    flags = readw(indirect->desc + (16 * indirect->index) + flags_off);
 
     if (write) {
         flags |= QVRING_DESC_F_WRITE;
@@ -197,15 +265,67 @@ void qvring_indirect_desc_add(QVRingIndirectDesc *indirect, uint64_t data,
     /* indirect->desc[indirect->index].len */
     writel(indirect->desc + (16 * indirect->index) + 8, len);
     /* indirect->desc[indirect->index].flags */
-    writew(indirect->desc + (16 * indirect->index) + 12, flags);
+    writew(indirect->desc + (16 * indirect->index) + flags_off, flags);
 
     indirect->index++;
 }
 
+/* Fill the next descriptor of a packed ring.  The head of a chain is made
+ * available by qvirtqueue_kick(), after the rest of the chain.
+ */
+static uint32_t qvirtqueue_packed_add(QVirtQueue *vq, uint64_t data,
+                                      uint32_t len, uint16_t flags)
+{
+    uint32_t i = vq->free_head;
+
+    g_assert_cmpint(vq->num_free, >, 0);
+    vq->num_free--;
+
+    if (vq->avail_wrap_counter) {
+        flags |= QVRING_PACKED_DESC_F_AVAIL;
+    } else {
+        flags |= QVRING_PACKED_DESC_F_USED;
+    }
+
+    if (!vq->chained) {
+        vq->head = i;
+        vq->head_flags = flags;
+        vq->head_wrap_counter = vq->avail_wrap_counter;
+        vq->ndescs[i] = 0;
+    }
+    vq->ndescs[vq->head]++;
+    vq->chained = (flags & QVRING_DESC_F_NEXT) != 0;
+
+    /* vq->desc[i].addr */
+    writeq(vq->desc + (16 * i), data);
+    /* vq->desc[i].len */
+    writel(vq->desc + (16 * i) + 8, len);
+    /* vq->desc[i].id: the buffer ID is the index of its head */
+    writew(vq->desc + (16 * i) + 12, vq->head);
+    if (i != vq->head) {
+        /* vq->desc[i].flags */
+        writew(vq->desc + (16 * i) + 14, flags);
+    }
+
+    if (++vq->free_head == vq->size) {
+        vq->free_head = 0;
+        vq->avail_wrap_counter = !vq->avail_wrap_counter;
+    }
+
+    return i;
+}
+
 uint32_t qvirtqueue_add(QVirtQueue *vq, uint64_t data, uint32_t len, bool write,
                                                                     bool next)
 {
     uint16_t flags = 0;
+
+    if (vq->packed) {
+        return qvirtqueue_packed_add(vq, data, len,
+                                     (write ? QVRING_DESC_F_WRITE : 0) |
+                                     (next ? QVRING_DESC_F_NEXT : 0));
+    }
+
     vq->num_free--;
 
     if (write) {
@@ -232,6 +352,13 @@ uint32_t qvirtqueue_add_indirect(QVirtQueue *vq, QVRingIndirectDesc *indirect)
     g_assert_cmpint(vq->size, >=, indirect->elem);
     g_assert_cmpint(indirect->index, ==, indirect->elem);
 
+    if (vq->packed) {
+        g_assert(indirect->packed);
+        return qvirtqueue_packed_add(vq, indirect->desc,
+                                     sizeof(QVRingPackedDesc) * indirect->elem,
+                                     QVRING_DESC_F_INDIRECT);
+    }
+
     vq->num_free--;
 
     /* vq->desc[vq->free_head].addr */
@@ -245,9 +372,54 @@ uint32_t qvirtqueue_add_indirect(QVirtQueue *vq, QVRingIndirectDesc *indirect)
     return vq->free_head++; /* Return and increase, in this order */
 }
 
+/* Make the chain at @head available and notify the device unless its event
+ * suppression area says otherwise.
+ */
+static void qvirtqueue_packed_kick(const QVirtioBus *bus, QVirtioDevice *d,
+                                   QVirtQueue *vq, uint32_t head)
+{
+    uint32_t end = vq->free_head;
+    uint16_t off_wrap, flags;
+    uint32_t off;
+
+    g_assert_cmpint(head, ==, vq->head);
+    g_assert(!vq->chained);
+
+    /* vq->desc[head].flags */
+    writew(vq->desc + (16 * head) + 14, vq->head_flags);
+
+    /* Must read after the head is made available */
+    off_wrap = readw(vq->used);
+    flags = readw(vq->used + 2);
+
+    if (flags == QVRING_PACKED_EVENT_FLAG_DISABLE) {
+        return;
+    }
+    if (flags == QVRING_PACKED_EVENT_FLAG_DESC) {
+        /* Count both offsets from the start of the lap the head is in */
+        off = off_wrap & ~(1 << QVRING_PACKED_EVENT_F_WRAP_CTR);
+        if ((off_wrap >> QVRING_PACKED_EVENT_F_WRAP_CTR) !=
+            vq->head_wrap_counter) {
+            off += vq->size;
+        }
+        if (end <= head) {
+            end += vq->size;
+        }
+        if (off < head || off >= end) {
+            return;
+        }
+    }
+    bus->virtqueue_kick(d, vq);
+}
+
 void qvirtqueue_kick(const QVirtioBus *bus, QVirtioDevice *d, QVirtQueue *vq,
                                                             uint32_t free_head)
 {
+    if (vq->packed) {
+        qvirtqueue_packed_kick(bus, d, vq, free_head);
+        return;
+    }
+
     /* vq->avail->idx */
     uint16_t idx = readl(vq->avail + 2);
     /* vq->used->flags */
@@ -272,10 +444,61 @@ void qvirtqueue_kick(const QVirtioBus *bus, QVirtioDevice *d, QVirtQueue *vq,
     }
 }
 
+/* Fetch the next used buffer of a packed ring, false if there is none */
+bool qvirtqueue_packed_get_buf(QVirtQueue *vq, uint32_t *id, uint32_t *len)
+{
+    uint64_t desc = vq->desc + (16 * vq->last_used_idx);
+    /* vq->desc[vq->last_used_idx].flags */
+    uint16_t flags = readw(desc + 14);
+    bool avail = (flags & QVRING_PACKED_DESC_F_AVAIL) != 0;
+    bool used = (flags & QVRING_PACKED_DESC_F_USED) != 0;
+
+    g_assert(vq->packed);
+
+    if (avail != used || used != vq->used_wrap_counter) {
+        return false;
+    }
+
+    /* vq->desc[vq->last_used_idx].id */
+    *id = readw(desc + 12);
+    if (len) {
+        /* vq->desc[vq->last_used_idx].len */
+        *len = readl(desc + 8);
+    }
+    g_assert_cmpint(*id, <, vq->size);
+    g_assert_cmpint(vq->ndescs[*id], >, 0);
+
+    vq->num_free += vq->ndescs[*id];
+    vq->last_used_idx += vq->ndescs[*id];
+    vq->ndescs[*id] = 0;
+    if (vq->last_used_idx >= vq->size) {
+        vq->last_used_idx -= vq->size;
+        vq->used_wrap_counter = !vq->used_wrap_counter;
+    }
+    return true;
+}
+
+/* For a packed ring @idx is a descriptor in the lap of the next used one */
 void qvirtqueue_set_used_event(QVirtQueue *vq, uint16_t idx)
 {
     g_assert(vq->event);
 
+    if (vq->packed) {
+        /* vq->avail->off_wrap, written before the flags */
+        writew(vq->avail, idx |
+               vq->used_wrap_counter << QVRING_PACKED_EVENT_F_WRAP_CTR);
+        qvirtqueue_packed_set_event_flags(vq, QVRING_PACKED_EVENT_FLAG_DESC);
+        return;
+    }
+
     /* vq->avail->used_event */
     writew(vq->avail + 4 + (2 * vq->size), idx);
 }
+
+void qvirtqueue_packed_set_event_flags(QVirtQueue *vq, uint16_t flags)
+{
+    g_assert(vq->packed);
+
+    /* vq->avail->flags */
+    writew(vq->avail + 2, flags);
+}
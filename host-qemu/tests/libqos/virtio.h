@@ -18,6 +18,7 @@
 #define QVIRTIO_ACKNOWLEDGE     0x1
 #define QVIRTIO_DRIVER          0x2
 #define QVIRTIO_DRIVER_OK       0x4
+#define QVIRTIO_FEATURES_OK     0x8
 
 #define QVIRTIO_NET_DEVICE_ID       0x1
 #define QVIRTIO_BLK_DEVICE_ID       0x2
@@ -48,6 +49,18 @@
 
 #define QVRING_USED_F_NO_NOTIFY     1
 
+/* Feature bits above 31, only seen by virtio 1.0 transports */
+#define QVIRTIO_F_VERSION_1             (1ULL << 32)
+#define QVIRTIO_F_RING_PACKED           (1ULL << 34)
+
+#define QVRING_PACKED_DESC_F_AVAIL      (1 << 7)
+#define QVRING_PACKED_DESC_F_USED       (1 << 15)
+
+#define QVRING_PACKED_EVENT_FLAG_ENABLE     0x0
+#define QVRING_PACKED_EVENT_FLAG_DISABLE    0x1
+#define QVRING_PACKED_EVENT_FLAG_DESC       0x2
+#define QVRING_PACKED_EVENT_F_WRAP_CTR      15
+
 typedef struct QVirtioDevice {
     /* Device type */
     uint16_t device_type;
@@ -79,6 +92,18 @@ typedef struct QVRingUsed {
     uint16_t avail_event;
 } QVRingUsed;
 
+typedef struct QVRingPackedDesc {
+    uint64_t addr;
+    uint32_t len;
+    uint16_t id;
+    uint16_t flags;
+} QVRingPackedDesc;
+
+typedef struct QVRingPackedDescEvent {
+    uint16_t off_wrap;
+    uint16_t flags;
+} QVRingPackedDescEvent;
+
 typedef struct QVirtQueue {
     uint64_t desc; /* This points to an array of QVRingDesc */
     uint64_t avail; /* This points to a QVRingAvail */
@@ -90,12 +115,25 @@ typedef struct QVirtQueue {
     uint32_t align;
     bool indirect;
     bool event;
+    /* Packed ring: avail and used point to the driver and device event
+     * suppression areas, and free_head is the next descriptor to fill.
+     */
+    bool packed;
+    bool avail_wrap_counter;
+    bool used_wrap_counter;
+    uint32_t last_used_idx;
+    uint32_t head; /* Head of the last chain added */
+    uint16_t head_flags; /* Written by qvirtqueue_kick() */
+    bool head_wrap_counter;
+    bool chained; /* The last descriptor added had QVRING_DESC_F_NEXT */
+    uint16_t *ndescs; /* Descriptors taken by each buffer ID */
 } QVirtQueue;
 
 typedef struct QVRingIndirectDesc {
     uint64_t desc; /* This points to an array fo QVRingDesc */
     uint16_t index;
     uint16_t elem;
+    bool packed; /* The table holds QVRingPackedDesc */
 } QVRingIndirectDesc;
 
 typedef struct QVirtioBus {
@@ -105,13 +143,13 @@ typedef struct QVirtioBus {
     uint64_t (*config_readq)(QVirtioDevice *d, uint64_t addr);
 
     /* Get features of the device */
-    uint32_t (*get_features)(QVirtioDevice *d);
+    uint64_t (*get_features)(QVirtioDevice *d);
 
     /* Set features of the device */
-    void (*set_features)(QVirtioDevice *d, uint32_t features);
+    void (*set_features)(QVirtioDevice *d, uint64_t features);
 
     /* Get features of the guest */
-    uint32_t (*get_guest_features)(QVirtioDevice *d);
+    uint64_t (*get_guest_features)(QVirtioDevice *d);
 
     /* Get status of the device */
     uint8_t (*get_status)(QVirtioDevice *d);
@@ -149,6 +187,12 @@ static inline uint32_t qvring_size(uint32_t num, uint32_t align)
         + sizeof(uint16_t) * 3 + sizeof(struct QVRingUsedElem) * num;
 }
 
+static inline uint32_t qvring_packed_size(uint32_t num)
+{
+    return sizeof(struct QVRingPackedDesc) * num
+        + sizeof(struct QVRingPackedDescEvent) * 2;
+}
+
 uint8_t qvirtio_config_readb(const QVirtioBus *bus, QVirtioDevice *d,
                                                                 uint64_t addr);
 uint16_t qvirtio_config_readw(const QVirtioBus *bus, QVirtioDevice *d,
@@ -157,13 +201,14 @@ uint32_t qvirtio_config_readl(const QVirtioBus *bus, QVirtioDevice *d,
                                                                 uint64_t addr);
 uint64_t qvirtio_config_readq(const QVirtioBus *bus, QVirtioDevice *d,
                                                                 uint64_t addr);
-uint32_t qvirtio_get_features(const QVirtioBus *bus, QVirtioDevice *d);
+uint64_t qvirtio_get_features(const QVirtioBus *bus, QVirtioDevice *d);
 void qvirtio_set_features(const QVirtioBus *bus, QVirtioDevice *d,
-                                                            uint32_t features);
+                                                            uint64_t features);
 
 void qvirtio_reset(const QVirtioBus *bus, QVirtioDevice *d);
 void qvirtio_set_acknowledge(const QVirtioBus *bus, QVirtioDevice *d);
 void qvirtio_set_driver(const QVirtioBus *bus, QVirtioDevice *d);
+void qvirtio_set_features_ok(const QVirtioBus *bus, QVirtioDevice *d);
 void qvirtio_set_driver_ok(const QVirtioBus *bus, QVirtioDevice *d);
 
 void qvirtio_wait_queue_isr(const QVirtioBus *bus, QVirtioDevice *d,
@@ -179,8 +224,12 @@ QVirtQueue *qvirtqueue_setup(const QVirtioBus *bus, QVirtioDevice *d,
                                         QGuestAllocator *alloc, uint16_t index);
 
 void qvring_init(const QGuestAllocator *alloc, QVirtQueue *vq, uint64_t addr);
+void qvring_packed_init(const QGuestAllocator *alloc, QVirtQueue *vq,
+                                                                uint64_t addr);
 QVRingIndirectDesc *qvring_indirect_desc_setup(QVirtioDevice *d,
                                         QGuestAllocator *alloc, uint16_t elem);
+QVRingIndirectDesc *qvring_packed_indirect_desc_setup(QVirtioDevice *d,
+                                        QGuestAllocator *alloc, uint16_t elem);
 void qvring_indirect_desc_add(QVRingIndirectDesc *indirect, uint64_t data,
                                                     uint32_t len, bool write);
 uint32_t qvirtqueue_add(QVirtQueue *vq, uint64_t data, uint32_t len, bool write,
@@ -189,5 +238,8 @@ uint32_t qvirtqueue_add_indirect(QVirtQueue *vq, QVRingIndirectDesc *indirect);
 void qvirtqueue_kick(const QVirtioBus *bus, QVirtioDevice *d, QVirtQueue *vq,
                                                             uint32_t free_head);
 
+bool qvirtqueue_packed_get_buf(QVirtQueue *vq, uint32_t *id, uint32_t *len);
+
 void qvirtqueue_set_used_event(QVirtQueue *vq, uint16_t idx);
+void qvirtqueue_packed_set_event_flags(QVirtQueue *vq, uint16_t flags);
 #endif
@@ -0,0 +1,186 @@
+/*
+ * Scalar floating point speed test
+ *
+ * A handful of SciMark/Linpack-style kernels (a dense LU-style DAXPY
+ * loop, Jacobi successive over-relaxation, a single precision dot
+ * product with normalisation, and Newton iterations for division and
+ * square root) that print the time taken by each together with a
+ * checksum, so that the output can be compared between a native run and
+ * a run under TCG.
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+
+#define N       200
+#define SOR_N   100
+#define VEC_N   4096
+#define ITERS   20
+
+static double mat[N][N];
+static double vec[N];
+static double grid[SOR_N][SOR_N];
+static float fa[VEC_N], fb[VEC_N];
+
+static double now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static uint32_t checksum(const void *buf, size_t len)
+{
+    const uint8_t *p = buf;
+    uint32_t sum = 0;
+    size_t i;
+
+    for (i = 0; i < len; i++) {
+        sum = (sum << 5) + sum + p[i];
+    }
+    return sum;
+}
+
+static void init(void)
+{
+    uint32_t seed = 1;
+    int i, j;
+
+    for (i = 0; i < N; i++) {
+        for (j = 0; j < N; j++) {
+            seed = seed * 1103515245 + 12345;
+            mat[i][j] = (double)(seed >> 8) / (1 << 24) - 0.5;
+        }
+        mat[i][i] += N;
+        vec[i] = 1.0;
+    }
+    for (i = 0; i < SOR_N; i++) {
+        for (j = 0; j < SOR_N; j++) {
+            grid[i][j] = (double)((i * 7 + j * 13) % 101) / 101.0;
+        }
+    }
+    for (i = 0; i < VEC_N; i++) {
+        fa[i] = (float)(i % 97) / 97.0f + 0.25f;
+        fb[i] = (float)(i % 89) / 89.0f - 0.5f;
+    }
+}
+
+/* Gaussian elimination without pivoting on a diagonally dominant matrix;
+ * nearly all of the time goes into the DAXPY inner loop, as in Linpack.
+ */
+static void lu(double a[N][N], double *b)
+{
+    int i, j, k;
+
+    for (k = 0; k < N; k++) {
+        double inv = 1.0 / a[k][k];
+
+        for (i = k + 1; i < N; i++) {
+            double t = a[i][k] * inv;
+
+            for (j = k; j < N; j++) {
+                a[i][j] -= t * a[k][j];
+            }
+            b[i] -= t * b[k];
+        }
+    }
+    for (i = N - 1; i >= 0; i--) {
+        double s = b[i];
+
+        for (j = i + 1; j < N; j++) {
+            s -= a[i][j] * b[j];
+        }
+        b[i] = s / a[i][i];
+    }
+}
+
+static void sor(double g[SOR_N][SOR_N], double omega, int iters)
+{
+    double omega_4 = omega * 0.25;
+    double omega_1 = 1.0 - omega;
+    int i, j, p;
+
+    for (p = 0; p < iters; p++) {
+        for (i = 1; i < SOR_N - 1; i++) {
+            for (j = 1; j < SOR_N - 1; j++) {
+                g[i][j] = omega_4 * (g[i - 1][j] + g[i + 1][j] +
+                                     g[i][j - 1] + g[i][j + 1]) +
+                          omega_1 * g[i][j];
+            }
+        }
+    }
+}
+
+static float normalize(float *a, const float *b, int n)
+{
+    float dot = 0.0f, norm = 0.0f;
+    int i;
+
+    for (i = 0; i < n; i++) {
+        dot += a[i] * b[i];
+        norm += a[i] * a[i];
+    }
+    norm = sqrtf(norm);
+    for (i = 0; i < n; i++) {
+        a[i] = a[i] / norm + dot * 1e-6f;
+    }
+    return dot;
+}
+
+static double newton(int n)
+{
+    double x = 2.0, s = 0.0;
+    int i;
+
+    for (i = 1; i <= n; i++) {
+        x = 0.5 * (x + (double)i / x);
+        s += sqrt(x) / (x + 1.0);
+    }
+    return s;
+}
+
+int main(void)
+{
+    static double m[N][N];
+    static double b[N];
+    double t0, r = 0.0;
+    float f = 0.0f;
+    int i;
+
+    init();
+
+    t0 = now();
+    for (i = 0; i < ITERS; i++) {
+        memcpy(m, mat, sizeof(m));
+        memcpy(b, vec, sizeof(b));
+        lu(m, b);
+    }
+    printf("lu:     %8.3f s  sum %08x\n", now() - t0,
+           checksum(b, sizeof(b)));
+
+    t0 = now();
+    sor(grid, 1.25, ITERS * 10);
+    printf("sor:    %8.3f s  sum %08x\n", now() - t0,
+           checksum(grid, sizeof(grid)));
+
+    t0 = now();
+    for (i = 0; i < ITERS * 50; i++) {
+        f += normalize(fa, fb, VEC_N);
+    }
+    printf("norm:   %8.3f s  sum %08x\n", now() - t0,
+           checksum(&f, sizeof(f)));
+
+    t0 = now();
+    r = newton(ITERS * 50000);
+    printf("newton: %8.3f s  sum %08x\n", now() - t0,
+           checksum(&r, sizeof(r)));
+
+    return 0;
+}
@@ -0,0 +1,253 @@
+/*
+ * AArch64 scalar floating point conformance test
+ *
+ * Runs add, sub, mul, div, sqrt and fused multiply-add on random single
+ * and double precision operands, biased towards the edges of the exponent
+ * range, and prints a digest of the results and of the FPSR cumulative
+ * flags for each operation.  Every operation is run twice: once with the
+ * flags cleared and once with the inexact flag already set, which are the
+ * two cases the softfloat host FPU fast path treats differently; any
+ * difference between the two is reported directly.  The digests can then
+ * be compared between a native run and a run under TCG.
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+
+#define ITERS   200000
+
+#define FPSR_IOC    (1 << 0)
+#define FPSR_DZC    (1 << 1)
+#define FPSR_OFC    (1 << 2)
+#define FPSR_UFC    (1 << 3)
+#define FPSR_IXC    (1 << 4)
+#define FPSR_IDC    (1 << 7)
+#define FPSR_FLAGS  (FPSR_IOC | FPSR_DZC | FPSR_OFC | FPSR_UFC | FPSR_IXC | \
+                     FPSR_IDC)
+
+enum { OP_ADD, OP_SUB, OP_MUL, OP_DIV, OP_SQRT, OP_FMA, NB_OPS };
+
+static const char * const op_names[NB_OPS] = {
+    "add", "sub", "mul", "div", "sqrt", "fma"
+};
+
+static uint64_t seed = 0x2545f4914f6cdd1dULL;
+
+static uint64_t rand64(void)
+{
+    seed ^= seed >> 12;
+    seed ^= seed << 25;
+    seed ^= seed >> 27;
+    return seed * 0x2545f4914f6cdd1dULL;
+}
+
+static inline uint64_t get_fpsr(void)
+{
+    uint64_t r;
+
+    asm volatile("mrs %0, fpsr" : "=r" (r));
+    return r;
+}
+
+static inline void set_fpsr(uint64_t r)
+{
+    asm volatile("msr fpsr, %0" : : "r" (r));
+}
+
+/* Mostly normal numbers, with a fair share of zeroes, denormals, values
+ * close to overflow, infinities and NaNs.
+ */
+static uint32_t rand_f32(void)
+{
+    uint64_t r = rand64();
+    uint32_t exp;
+
+    switch (r & 7) {
+    case 0:
+        exp = (r >> 8) & 3;
+        break;
+    case 1:
+        exp = 0xfc + ((r >> 8) & 3);
+        break;
+    case 2:
+        exp = 0x7f + ((r >> 8) & 7);
+        break;
+    default:
+        exp = (r >> 8) & 0xff;
+        break;
+    }
+    return ((r >> 16) & 0x807fffff) | (exp << 23);
+}
+
+static uint64_t rand_f64(void)
+{
+    uint64_t r = rand64();
+    uint64_t exp;
+
+    switch (r & 7) {
+    case 0:
+        exp = (r >> 8) & 3;
+        break;
+    case 1:
+        exp = 0x7fc + ((r >> 8) & 3);
+        break;
+    case 2:
+        exp = 0x3ff + ((r >> 8) & 7);
+        break;
+    default:
+        exp = (r >> 8) & 0x7ff;
+        break;
+    }
+    return (rand64() & 0x800fffffffffffffULL) | (exp << 52);
+}
+
+static uint32_t do_f32(int op, uint32_t ia, uint32_t ib, uint32_t ic)
+{
+    float a, b, c, r;
+    uint32_t ir;
+
+    memcpy(&a, &ia, 4);
+    memcpy(&b, &ib, 4);
+    memcpy(&c, &ic, 4);
+    switch (op) {
+    case OP_ADD:
+        asm volatile("fadd %s0, %s1, %s2" : "=w" (r) : "w" (a), "w" (b));
+        break;
+    case OP_SUB:
+        asm volatile("fsub %s0, %s1, %s2" : "=w" (r) : "w" (a), "w" (b));
+        break;
+    case OP_MUL:
+        asm volatile("fmul %s0, %s1, %s2" : "=w" (r) : "w" (a), "w" (b));
+        break;
+    case OP_DIV:
+        asm volatile("fdiv %s0, %s1, %s2" : "=w" (r) : "w" (a), "w" (b));
+        break;
+    case OP_SQRT:
+        asm volatile("fsqrt %s0, %s1" : "=w" (r) : "w" (a));
+        break;
+    default:
+        asm volatile("fmadd %s0, %s1, %s2, %s3"
+                     : "=w" (r) : "w" (a), "w" (b), "w" (c));
+        break;
+    }
+    memcpy(&ir, &r, 4);
+    return ir;
+}
+
+static uint64_t do_f64(int op, uint64_t ia, uint64_t ib, uint64_t ic)
+{
+    double a, b, c, r;
+    uint64_t ir;
+
+    memcpy(&a, &ia, 8);
+    memcpy(&b, &ib, 8);
+    memcpy(&c, &ic, 8);
+    switch (op) {
+    case OP_ADD:
+        asm volatile("fadd %d0, %d1, %d2" : "=w" (r) : "w" (a), "w" (b));
+        break;
+    case OP_SUB:
+        asm volatile("fsub %d0, %d1, %d2" : "=w" (r) : "w" (a), "w" (b));
+        break;
+    case OP_MUL:
+        asm volatile("fmul %d0, %d1, %d2" : "=w" (r) : "w" (a), "w" (b));
+        break;
+    case OP_DIV:
+        asm volatile("fdiv %d0, %d1, %d2" : "=w" (r) : "w" (a), "w" (b));
+        break;
+    case OP_SQRT:
+        asm volatile("fsqrt %d0, %d1" : "=w" (r) : "w" (a));
+        break;
+    default:
+        asm volatile("fmadd %d0, %d1, %d2, %d3"
+                     : "=w" (r) : "w" (a), "w" (b), "w" (c));
+        break;
+    }
+    memcpy(&ir, &r, 8);
+    return ir;
+}
+
+static uint64_t digest(uint64_t h, uint64_t v)
+{
+    return (h ^ v) * 0x100000001b3ULL;
+}
+
+static int test_f32(int op)
+{
+    uint64_t h = 0xcbf29ce484222325ULL;
+    int i, errors = 0;
+
+    for (i = 0; i < ITERS; i++) {
+        uint32_t a = rand_f32(), b = rand_f32(), c = rand_f32();
+        uint32_t r0, r1;
+        uint64_t f0, f1;
+
+        set_fpsr(0);
+        r0 = do_f32(op, a, b, c);
+        f0 = get_fpsr() & FPSR_FLAGS;
+
+        set_fpsr(FPSR_IXC);
+        r1 = do_f32(op, a, b, c);
+        f1 = get_fpsr() & FPSR_FLAGS;
+
+        if (r0 != r1 || (f0 | FPSR_IXC) != f1) {
+            if (errors++ < 10) {
+                printf("f32 %s %08x %08x %08x: %08x/%02x vs %08x/%02x\n",
+                       op_names[op], a, b, c, r0, (int)f0, r1, (int)f1);
+            }
+        }
+        h = digest(digest(h, r0), f0);
+    }
+    printf("f32 %-4s %016llx\n", op_names[op], (unsigned long long)h);
+    return errors;
+}
+
+static int test_f64(int op)
+{
+    uint64_t h = 0xcbf29ce484222325ULL;
+    int i, errors = 0;
+
+    for (i = 0; i < ITERS; i++) {
+        uint64_t a = rand_f64(), b = rand_f64(), c = rand_f64();
+        uint64_t r0, r1, f0, f1;
+
+        set_fpsr(0);
+        r0 = do_f64(op, a, b, c);
+        f0 = get_fpsr() & FPSR_FLAGS;
+
+        set_fpsr(FPSR_IXC);
+        r1 = do_f64(op, a, b, c);
+        f1 = get_fpsr() & FPSR_FLAGS;
+
+        if (r0 != r1 || (f0 | FPSR_IXC) != f1) {
+            if (errors++ < 10) {
+                printf("f64 %s %016llx %016llx %016llx: "
+                       "%016llx/%02x vs %016llx/%02x\n", op_names[op],
+                       (unsigned long long)a, (unsigned long long)b,
+                       (unsigned long long)c, (unsigned long long)r0,
+                       (int)f0, (unsigned long long)r1, (int)f1);
+            }
+        }
+        h = digest(digest(h, r0), f0);
+    }
+    printf("f64 %-4s %016llx\n", op_names[op], (unsigned long long)h);
+    return errors;
+}
+
+int main(void)
+{
+    int op, errors = 0;
+
+    for (op = 0; op < NB_OPS; op++) {
+        errors += test_f32(op);
+    }
+    for (op = 0; op < NB_OPS; op++) {
+        errors += test_f64(op);
+    }
+    printf("%d errors\n", errors);
+    return errors != 0;
+}
@@ -0,0 +1,198 @@
+/*
+ * AArch64 AdvSIMD speed test
+ *
+ * Runs a few kernels shaped like the inner loops of Android's media
+ * stack (libjpeg IDCT butterflies, Skia src-over blending, an audio
+ * FIR filter and plain vector copies) and prints the time taken by
+ * each together with a checksum, so that the output can be compared
+ * between a native run and a run under TCG.
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <arm_neon.h>
+
+#define WIDTH   1024
+#define HEIGHT  64
+#define NPIX    (WIDTH * HEIGHT)
+#define TAPS    16
+#define ITERS   200
+
+static uint8_t src_pix[NPIX * 4] __attribute__((aligned(16)));
+static uint8_t dst_pix[NPIX * 4] __attribute__((aligned(16)));
+static int16_t coef[NPIX] __attribute__((aligned(16)));
+static float samples[NPIX + TAPS] __attribute__((aligned(16)));
+static float filtered[NPIX] __attribute__((aligned(16)));
+static float taps[TAPS];
+
+static double now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static uint32_t checksum(const void *buf, size_t len)
+{
+    const uint8_t *p = buf;
+    uint32_t sum = 0;
+    size_t i;
+
+    for (i = 0; i < len; i++) {
+        sum = (sum << 5) + sum + p[i];
+    }
+    return sum;
+}
+
+static void init(void)
+{
+    uint32_t seed = 1;
+    int i;
+
+    for (i = 0; i < NPIX * 4; i++) {
+        seed = seed * 1103515245 + 12345;
+        src_pix[i] = seed >> 16;
+        dst_pix[i] = seed >> 24;
+    }
+    for (i = 0; i < NPIX; i++) {
+        coef[i] = (int16_t)(i * 37) - 512;
+    }
+    for (i = 0; i < NPIX + TAPS; i++) {
+        samples[i] = (float)((i * 7) % 101) / 101.0f - 0.5f;
+    }
+    for (i = 0; i < TAPS; i++) {
+        taps[i] = 1.0f / (i + 2);
+    }
+}
+
+/* Row pass of an 8-point integer IDCT: butterflies over 16-bit lanes.  */
+static void idct_rows(int16_t *blk, int n)
+{
+    const int16x8_t c1 = vdupq_n_s16(181);
+    int i;
+
+    for (i = 0; i + 64 <= n; i += 64) {
+        int16x8_t r0 = vld1q_s16(blk + i);
+        int16x8_t r1 = vld1q_s16(blk + i + 8);
+        int16x8_t r2 = vld1q_s16(blk + i + 16);
+        int16x8_t r3 = vld1q_s16(blk + i + 24);
+        int16x8_t r4 = vld1q_s16(blk + i + 32);
+        int16x8_t r5 = vld1q_s16(blk + i + 40);
+        int16x8_t r6 = vld1q_s16(blk + i + 48);
+        int16x8_t r7 = vld1q_s16(blk + i + 56);
+
+        int16x8_t a0 = vaddq_s16(r0, r4);
+        int16x8_t a1 = vsubq_s16(r0, r4);
+        int16x8_t a2 = vmulq_s16(vsubq_s16(r2, r6), c1);
+        int16x8_t a3 = vaddq_s16(r2, r6);
+        int16x8_t b0 = vaddq_s16(r1, r7);
+        int16x8_t b1 = vsubq_s16(r1, r7);
+        int16x8_t b2 = vmulq_s16(vaddq_s16(r3, r5), c1);
+        int16x8_t b3 = vsubq_s16(r3, r5);
+
+        vst1q_s16(blk + i, vaddq_s16(a0, a3));
+        vst1q_s16(blk + i + 8, vaddq_s16(a1, a2));
+        vst1q_s16(blk + i + 16, vsubq_s16(a1, a2));
+        vst1q_s16(blk + i + 24, vsubq_s16(a0, a3));
+        vst1q_s16(blk + i + 32, vaddq_s16(b0, b2));
+        vst1q_s16(blk + i + 40, vaddq_s16(b1, b3));
+        vst1q_s16(blk + i + 48, vsubq_s16(b1, b3));
+        vst1q_s16(blk + i + 56, vsubq_s16(b0, b2));
+    }
+}
+
+/* Src-over blend of a constant-alpha source, 8 channels at a time.  */
+static void blend(uint8_t *dst, const uint8_t *src, int n, uint8_t alpha)
+{
+    const uint16x8_t va = vdupq_n_u16(alpha);
+    const uint16x8_t vna = vdupq_n_u16(255 - alpha);
+    const uint16x8_t mask = vdupq_n_u16(0xff);
+    int i;
+
+    for (i = 0; i + 8 <= n; i += 8) {
+        uint16x8_t s = vmovl_u8(vld1_u8(src + i));
+        uint16x8_t d = vmovl_u8(vld1_u8(dst + i));
+        uint16x8_t r = vaddq_u16(vmulq_u16(s, va), vmulq_u16(d, vna));
+
+        r = vandq_u16(vshrq_n_u16(r, 8), mask);
+        vst1_u8(dst + i, vmovn_u16(r));
+    }
+}
+
+/* FIR filter with fused multiply-add.  */
+static void fir(float *out, const float *in, int n)
+{
+    int i, t;
+
+    for (i = 0; i + 4 <= n; i += 4) {
+        float32x4_t acc = vdupq_n_f32(0.0f);
+
+        for (t = 0; t < TAPS; t++) {
+            acc = vfmaq_f32(acc, vld1q_f32(in + i + t), vdupq_n_f32(taps[t]));
+        }
+        vst1q_f32(out + i, acc);
+    }
+}
+
+static void copy(uint8_t *dst, const uint8_t *src, int n)
+{
+    int i;
+
+    for (i = 0; i + 64 <= n; i += 64) {
+        uint8x16x4_t v;
+
+        v.val[0] = vld1q_u8(src + i);
+        v.val[1] = vld1q_u8(src + i + 16);
+        v.val[2] = vld1q_u8(src + i + 32);
+        v.val[3] = vld1q_u8(src + i + 48);
+        v.val[0] = veorq_u8(v.val[0], v.val[3]);
+        vst1q_u8(dst + i, v.val[0]);
+        vst1q_u8(dst + i + 16, v.val[1]);
+        vst1q_u8(dst + i + 32, v.val[2]);
+        vst1q_u8(dst + i + 48, v.val[3]);
+    }
+}
+
+int main(void)
+{
+    double t0;
+    int i;
+
+    init();
+
+    t0 = now();
+    for (i = 0; i < ITERS; i++) {
+        idct_rows(coef, NPIX);
+    }
+    printf("idct:  %8.3f s  sum %08x\n", now() - t0,
+           checksum(coef, sizeof(coef)));
+
+    t0 = now();
+    for (i = 0; i < ITERS; i++) {
+        blend(dst_pix, src_pix, NPIX * 4, i & 0xff);
+    }
+    printf("blend: %8.3f s  sum %08x\n", now() - t0,
+           checksum(dst_pix, sizeof(dst_pix)));
+
+    t0 = now();
+    for (i = 0; i < ITERS / 10; i++) {
+        fir(filtered, samples, NPIX);
+    }
+    printf("fir:   %8.3f s  sum %08x\n", now() - t0,
+           checksum(filtered, sizeof(filtered)));
+
+    t0 = now();
+    for (i = 0; i < ITERS; i++) {
+        copy(dst_pix, src_pix, NPIX * 4);
+    }
+    printf("copy:  %8.3f s  sum %08x\n", now() - t0,
+           checksum(dst_pix, sizeof(dst_pix)));
+
+    return 0;
+}
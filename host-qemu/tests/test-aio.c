@@ -15,6 +15,7 @@
 #include "qemu/timer.h"
 #include "qemu/sockets.h"
 #include "qemu/error-report.h"
+#include "qapi/error.h"
 
 static AioContext *ctx;
 
@@ -368,6 +369,51 @@ static void test_flush_event_notifier(void)
     event_notifier_cleanup(&data.e);
 }
 
+#ifndef _WIN32
+static bool event_poll_cb(void *opaque)
+{
+    EventNotifierTestData *data = container_of(opaque, EventNotifierTestData,
+                                               e);
+    if (!data->active) {
+        return false;
+    }
+    data->active--;
+    data->n++;
+    return true;
+}
+
+static void test_poll_event_notifier(void)
+{
+    EventNotifierTestData data = { .n = 0, .active = 0 };
+    int64_t hits = ctx->poll_hits;
+
+    event_notifier_init(&data.e, false);
+    aio_set_event_notifier(ctx, &data.e, event_ready_cb);
+    aio_set_event_notifier_poll(ctx, &data.e, event_poll_cb);
+    aio_context_set_poll_params(ctx, 1000000, 0, 0, &error_abort);
+    g_assert(!aio_poll(ctx, false));
+    g_assert_cmpint(ctx->poll_ns, ==, 0);
+
+    /* An event that arrives within poll-max-ns starts polling */
+    event_notifier_set(&data.e);
+    g_assert(aio_poll(ctx, true));
+    g_assert_cmpint(data.n, ==, 1);
+    g_assert_cmpint(ctx->poll_ns, >, 0);
+
+    /* Now the poll callback finds the next one without ppoll() */
+    data.active = 1;
+    g_assert(aio_poll(ctx, true));
+    g_assert_cmpint(data.n, ==, 2);
+    g_assert_cmpint(data.active, ==, 0);
+    g_assert_cmpint(ctx->poll_hits, ==, hits + 1);
+
+    aio_context_set_poll_params(ctx, 0, 0, 0, &error_abort);
+    aio_set_event_notifier(ctx, &data.e, NULL);
+    g_assert(!aio_poll(ctx, false));
+    event_notifier_cleanup(&data.e);
+}
+#endif
+
 static void test_wait_event_notifier_noflush(void)
 {
     EventNotifierTestData data = { .n = 0 };
@@ -826,6 +872,9 @@ int main(int argc, char **argv)
     g_test_add_func("/aio/event/wait",              test_wait_event_notifier);
     g_test_add_func("/aio/event/wait/no-flush-cb",  test_wait_event_notifier_noflush);
     g_test_add_func("/aio/event/flush",             test_flush_event_notifier);
+#ifndef _WIN32
+    g_test_add_func("/aio/event/poll",              test_poll_event_notifier);
+#endif
     g_test_add_func("/aio/timer/schedule",          test_timer_schedule);
 
     g_test_add_func("/aio-gsource/flush",                   test_source_flush);
@@ -0,0 +1,121 @@
+/*
+ * ARMv8 Crypto Extensions primitives: host acceleration vs. portable code
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include <glib.h>
+
+#include "crypto/arm-ce.h"
+
+#define ITERATIONS 10000
+
+static void random_state(ArmCEState *st)
+{
+    int i;
+
+    for (i = 0; i < 4; i++) {
+        st->words[i] = g_test_rand_int();
+    }
+}
+
+static void assert_state_equal(const ArmCEState *a, const ArmCEState *b)
+{
+    g_assert_cmphex(a->l[0], ==, b->l[0]);
+    g_assert_cmphex(a->l[1], ==, b->l[1]);
+}
+
+static void test_aes(void)
+{
+    ArmCEState st, rk, ref, out;
+    int i, decrypt;
+
+    for (i = 0; i < ITERATIONS; i++) {
+        random_state(&st);
+        random_state(&rk);
+        for (decrypt = 0; decrypt < 2; decrypt++) {
+            ref = out = st;
+            arm_ce_generic_ops.aese(&ref, &rk, decrypt);
+            arm_ce_ops.aese(&out, &rk, decrypt);
+            assert_state_equal(&ref, &out);
+
+            ref = out = st;
+            arm_ce_generic_ops.aesmc(&ref, decrypt);
+            arm_ce_ops.aesmc(&out, decrypt);
+            assert_state_equal(&ref, &out);
+        }
+    }
+}
+
+static void test_sha1(void)
+{
+    ArmCEState d, n, m, ref, out, nref, nout;
+    int i, op;
+
+    for (i = 0; i < ITERATIONS; i++) {
+        random_state(&d);
+        random_state(&n);
+        random_state(&m);
+        for (op = 0; op < 4; op++) {
+            ref = out = d;
+            nref = nout = n;
+            arm_ce_generic_ops.sha1_3reg(&ref, &nref, &m, op);
+            arm_ce_ops.sha1_3reg(&out, &nout, &m, op);
+            assert_state_equal(&ref, &out);
+        }
+
+        ref = out = d;
+        arm_ce_generic_ops.sha1su1(&ref, &m);
+        arm_ce_ops.sha1su1(&out, &m);
+        assert_state_equal(&ref, &out);
+    }
+}
+
+static void test_sha256(void)
+{
+    ArmCEState d, n, m, ref, out;
+    int i;
+
+    for (i = 0; i < ITERATIONS; i++) {
+        random_state(&d);
+        random_state(&n);
+        random_state(&m);
+
+        ref = out = d;
+        arm_ce_generic_ops.sha256h(&ref, &n, &m);
+        arm_ce_ops.sha256h(&out, &n, &m);
+        assert_state_equal(&ref, &out);
+
+        ref = out = d;
+        arm_ce_generic_ops.sha256h2(&ref, &n, &m);
+        arm_ce_ops.sha256h2(&out, &n, &m);
+        assert_state_equal(&ref, &out);
+
+        ref = out = d;
+        arm_ce_generic_ops.sha256su0(&ref, &m);
+        arm_ce_ops.sha256su0(&out, &m);
+        assert_state_equal(&ref, &out);
+
+        ref = out = d;
+        arm_ce_generic_ops.sha256su1(&ref, &n, &m);
+        arm_ce_ops.sha256su1(&out, &n, &m);
+        assert_state_equal(&ref, &out);
+    }
+}
+
+int main(int argc, char **argv)
+{
+    g_test_init(&argc, &argv, NULL);
+
+    if (g_test_verbose()) {
+        g_test_message("%d operations are host-accelerated",
+                       arm_ce_accel_count());
+    }
+
+    g_test_add_func("/crypto/arm-ce/aes", test_aes);
+    g_test_add_func("/crypto/arm-ce/sha1", test_sha1);
+    g_test_add_func("/crypto/arm-ce/sha256", test_sha256);
+
+    return g_test_run();
+}
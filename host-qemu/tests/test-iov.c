@@ -145,6 +145,116 @@ static void test_to_from_buf(void)
     }
 }
 
+static void test_to_buf_2d(void)
+{
+    unsigned niov, i, n, rows;
+    struct iovec *iov;
+    size_t sz, offset, iov_stride, buf_stride, row_bytes, done, expected;
+    unsigned char *buf, *ref;
+
+    for (n = 0; n < 1000; n++) {
+        iov_random(&iov, &niov);
+        sz = iov_size(iov, niov);
+        for (i = 0, offset = 0; i < niov; i++) {
+            unsigned char *b = iov[i].iov_base;
+            size_t j;
+            for (j = 0; j < iov[i].iov_len; j++) {
+                b[j] = offset++ & 255;
+            }
+        }
+
+        row_bytes = g_test_rand_int_range(1, 9);
+        iov_stride = g_test_rand_int_range(row_bytes, row_bytes + 9);
+        buf_stride = g_test_rand_int_range(row_bytes, row_bytes + 9);
+        rows = g_test_rand_int_range(0, 13);
+        offset = g_test_rand_int_range(0, sz + 1);
+        buf = g_malloc(buf_stride * 13);
+        ref = g_malloc(buf_stride * 13);
+        memset(buf, 0xff, buf_stride * 13);
+        memset(ref, 0xff, buf_stride * 13);
+
+        /* the same rows, one iov_to_buf() each */
+        expected = 0;
+        for (i = 0; i < rows && offset + i * iov_stride <= sz; i++) {
+            expected += iov_to_buf(iov, niov, offset + i * iov_stride,
+                                   ref + i * buf_stride, row_bytes);
+        }
+
+        done = iov_to_buf_2d(iov, niov, offset, iov_stride,
+                             buf, buf_stride, row_bytes, rows);
+        g_assert_cmpint(done, ==, expected);
+        g_assert(memcmp(buf, ref, buf_stride * 13) == 0);
+
+        g_free(buf);
+        g_free(ref);
+        iov_free(iov, niov);
+    }
+}
+
+/*
+ * Transfers/s of 1080p frames and of smaller rectangles from a guest
+ * framebuffer backed by 4 KiB pages, like virtio-gpu's 2D transfers
+ */
+#define PERF_WIDTH      1920
+#define PERF_HEIGHT     1080
+#define PERF_STRIDE     (PERF_WIDTH * 4)
+#define PERF_PAGE       4096
+#define PERF_TRANSFERS  200
+
+static void perf_to_buf_2d(void)
+{
+    static const struct {
+        const char *name;
+        unsigned x, y, width, height;
+    } rects[] = {
+        { "full", 0, 0, PERF_WIDTH, PERF_HEIGHT },
+        { "bottom half", 0, PERF_HEIGHT / 2, PERF_WIDTH, PERF_HEIGHT / 2 },
+        { "512x256", 1024, 700, 512, 256 },
+        { "64x64", 1800, 1000, 64, 64 },
+    };
+    unsigned niov = DIV_ROUND_UP(PERF_STRIDE * PERF_HEIGHT, PERF_PAGE);
+    struct iovec *iov = g_new(struct iovec, niov);
+    unsigned char *image = g_malloc(PERF_STRIDE * PERF_HEIGHT);
+    unsigned i, n, r, h;
+
+    for (i = 0; i < niov; i++) {
+        iov[i].iov_len = PERF_PAGE;
+        iov[i].iov_base = g_malloc0(PERF_PAGE);
+    }
+
+    for (r = 0; r < ARRAY_SIZE(rects); r++) {
+        size_t offset = rects[r].y * PERF_STRIDE + rects[r].x * 4;
+        unsigned char *dst = image + offset;
+        double rowwise, bulk;
+
+        g_test_timer_start();
+        for (n = 0; n < PERF_TRANSFERS; n++) {
+            for (h = 0; h < rects[r].height; h++) {
+                iov_to_buf(iov, niov, offset + h * PERF_STRIDE,
+                           dst + h * PERF_STRIDE, rects[r].width * 4);
+            }
+        }
+        rowwise = g_test_timer_elapsed();
+
+        g_test_timer_start();
+        for (n = 0; n < PERF_TRANSFERS; n++) {
+            iov_to_buf_2d(iov, niov, offset, PERF_STRIDE, dst, PERF_STRIDE,
+                          rects[r].width * 4, rects[r].height);
+        }
+        bulk = g_test_timer_elapsed();
+
+        g_test_message("%s: %.0f transfers/s row by row, %.0f transfers/s "
+                       "with iov_to_buf_2d", rects[r].name,
+                       PERF_TRANSFERS / rowwise, PERF_TRANSFERS / bulk);
+    }
+
+    for (i = 0; i < niov; i++) {
+        g_free(iov[i].iov_base);
+    }
+    g_free(iov);
+    g_free(image);
+}
+
 static void test_io(void)
 {
 #ifndef _WIN32
@@ -403,8 +513,12 @@ int main(int argc, char **argv)
     g_test_init(&argc, &argv, NULL);
     g_test_rand_int();
     g_test_add_func("/basic/iov/from-to-buf", test_to_from_buf);
+    g_test_add_func("/basic/iov/to-buf-2d", test_to_buf_2d);
     g_test_add_func("/basic/iov/io", test_io);
     g_test_add_func("/basic/iov/discard-front", test_discard_front);
     g_test_add_func("/basic/iov/discard-back", test_discard_back);
+    if (g_test_perf()) {
+        g_test_add_func("/perf/iov/to-buf-2d", perf_to_buf_2d);
+    }
     return g_test_run();
 }
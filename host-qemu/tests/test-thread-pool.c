@@ -5,6 +5,7 @@
 #include "block/block.h"
 #include "qemu/timer.h"
 #include "qemu/error-report.h"
+#include "qapi/error.h"
 
 static AioContext *ctx;
 static ThreadPool *pool;
@@ -210,6 +211,80 @@ static void do_test_cancel(bool sync)
     }
 }
 
+static int sleep_cb(void *opaque)
+{
+    g_usleep(100000);
+    return 0;
+}
+
+static bool release;
+
+static int wait_cb(void *opaque)
+{
+    WorkerTestData *data = opaque;
+
+    while (!atomic_read(&release)) {
+        g_usleep(1000);
+    }
+    atomic_inc(&data->n);
+    return 0;
+}
+
+static void test_steal(void)
+{
+    WorkerTestData data[100];
+    AioContext *ctx2;
+    ThreadPool *pool2;
+    ThreadPoolStats stats;
+    uint64_t stolen;
+    int i;
+
+    /* Give a second pool a few idle workers */
+    ctx2 = aio_context_new(&error_abort);
+    pool2 = aio_get_thread_pool(ctx2);
+    for (i = 0; i < 8; i++) {
+        data[i].n = 0;
+        data[i].ret = -EINPROGRESS;
+        thread_pool_submit_aio(pool2, sleep_cb, &data[i], done_cb, &data[i]);
+    }
+    active = 8;
+    while (active > 0) {
+        aio_poll(ctx2, true);
+    }
+
+    /* Fill our pool beyond its maximum number of threads */
+    thread_pool_get_stats(pool, &stats);
+    g_assert_cmpint(stats.queued, ==, 0);
+    stolen = stats.stolen;
+    release = false;
+    for (i = 0; i < 100; i++) {
+        data[i].n = 0;
+        data[i].ret = -EINPROGRESS;
+        thread_pool_submit_aio(pool, wait_cb, &data[i], done_cb, &data[i]);
+    }
+    active = 100;
+    aio_notify(ctx);
+    aio_poll(ctx, false);
+    g_usleep(100000);
+    atomic_set(&release, true);
+
+    while (active > 0) {
+        aio_poll(ctx, true);
+    }
+    for (i = 0; i < 100; i++) {
+        g_assert_cmpint(data[i].n, ==, 1);
+        g_assert_cmpint(data[i].ret, ==, 0);
+    }
+
+    /* The second pool's workers took some of the requests */
+    thread_pool_get_stats(pool, &stats);
+    g_assert_cmpint(stats.stolen, >, stolen);
+    g_assert_cmpint(stats.queued, ==, 0);
+    g_assert_cmpint(stats.active, ==, 0);
+
+    aio_context_unref(ctx2);
+}
+
 static void test_cancel(void)
 {
     do_test_cancel(true);
@@ -243,6 +318,7 @@ int main(int argc, char **argv)
     g_test_add_func("/thread-pool/submit-many", test_submit_many);
     g_test_add_func("/thread-pool/cancel", test_cancel);
     g_test_add_func("/thread-pool/cancel-async", test_cancel_async);
+    g_test_add_func("/thread-pool/steal", test_steal);
 
     ret = g_test_run();
 
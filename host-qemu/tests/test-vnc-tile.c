@@ -0,0 +1,300 @@
+/*
+ * VNC server surface tile compare and copy unit tests and benchmark
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ *
+ * With -m perf, every kernel also runs over 1920x1080 frames with
+ * synthetic dirty patterns, next to the memcmp()/memcpy() loop it
+ * replaces.
+ */
+#include <glib.h>
+#include <string.h>
+#include "qemu-common.h"
+#include "qemu/bitops.h"
+#include "qemu/host-utils.h"
+#include "ui/vnc-tile.h"
+
+#define ROW_TILES  BITS_PER_LONG
+#define ROW_PIXELS (ROW_TILES * VNC_TILE_PIXELS)
+#define ROW_BYTES  (ROW_TILES * VNC_TILE_BYTES)
+
+#define FRAME_WIDTH  1920
+#define FRAME_HEIGHT 1080
+#define FRAME_TILES  (FRAME_WIDTH / VNC_TILE_PIXELS)
+#define FRAME_FRAMES 200
+
+static uint32_t rgb565_to_server(uint16_t p)
+{
+    uint32_t r = p >> 11, g = (p >> 5) & 0x3f, b = p & 0x1f;
+
+    return ((r << 3 | r >> 2) << 16) | ((g << 2 | g >> 4) << 8) |
+           (b << 3 | b >> 2);
+}
+
+/* The loop of the old vnc_refresh_server_surface(), one tile at a time */
+static unsigned long sync_reference(uint8_t *dst, const uint8_t *src,
+                                    unsigned long dirty, int bytes)
+{
+    unsigned long changed = 0;
+    int i, n;
+
+    for (i = 0; i < BITS_PER_LONG; i++) {
+        if (!(dirty & (1UL << i))) {
+            continue;
+        }
+        n = MIN(VNC_TILE_BYTES, bytes - i * VNC_TILE_BYTES);
+        if (memcmp(dst + i * VNC_TILE_BYTES, src + i * VNC_TILE_BYTES, n)) {
+            memcpy(dst + i * VNC_TILE_BYTES, src + i * VNC_TILE_BYTES, n);
+            changed |= 1UL << i;
+        }
+    }
+    return changed;
+}
+
+/* The same after converting the row, like qemu_pixman_linebuf_fill() */
+static unsigned long sync_rgb565_reference(uint32_t *dst, const uint16_t *src,
+                                           unsigned long dirty, int pixels)
+{
+    uint32_t line[ROW_PIXELS];
+    int i;
+
+    pixels = MIN(pixels, ROW_PIXELS);
+    for (i = 0; i < pixels; i++) {
+        line[i] = rgb565_to_server(src[i]);
+    }
+    return sync_reference((uint8_t *)dst, (uint8_t *)line, dirty, pixels * 4);
+}
+
+static void check_sync(void)
+{
+    uint8_t *src = g_malloc(ROW_BYTES + 1);
+    uint8_t *dst = g_malloc(ROW_BYTES + 1);
+    uint8_t *expected = g_malloc(ROW_BYTES);
+    unsigned long dirty, mask;
+    int iter, i, bytes;
+
+    for (iter = 0; iter < 20000; iter++) {
+        /* Unaligned rows and short last tiles */
+        uint8_t *s = src + (iter & 1);
+        uint8_t *d = dst + ((iter >> 1) & 1);
+
+        bytes = g_test_rand_int_range(1, ROW_BYTES + 1);
+        dirty = ((unsigned long)g_test_rand_int() << 16 << 16) ^
+                g_test_rand_int();
+        mask = BITMAP_LAST_WORD_MASK(DIV_ROUND_UP(bytes, VNC_TILE_BYTES));
+        dirty &= mask;
+
+        for (i = 0; i < ROW_BYTES; i++) {
+            s[i] = g_test_rand_int_range(0, 4);
+            d[i] = g_test_rand_int_range(0, 64) ? s[i] : s[i] ^ 1;
+        }
+        memcpy(expected, d, ROW_BYTES);
+
+        g_assert_cmphex(vnc_tile_sync(d, s, dirty, bytes), ==,
+                        sync_reference(expected, s, dirty, bytes));
+        g_assert(memcmp(d, expected, ROW_BYTES) == 0);
+    }
+
+    g_free(src);
+    g_free(dst);
+    g_free(expected);
+}
+
+static void check_sync_rgb565(void)
+{
+    uint16_t *src = g_new(uint16_t, ROW_PIXELS + 1);
+    uint32_t *dst = g_new(uint32_t, ROW_PIXELS);
+    uint32_t *expected = g_new(uint32_t, ROW_PIXELS);
+    unsigned long dirty, mask;
+    int iter, i, pixels;
+
+    for (iter = 0; iter < 20000; iter++) {
+        uint16_t *s = src + (iter & 1);
+
+        pixels = g_test_rand_int_range(1, ROW_PIXELS + 1);
+        dirty = ((unsigned long)g_test_rand_int() << 16 << 16) ^
+                g_test_rand_int();
+        mask = BITMAP_LAST_WORD_MASK(DIV_ROUND_UP(pixels, VNC_TILE_PIXELS));
+        dirty &= mask;
+
+        for (i = 0; i < ROW_PIXELS; i++) {
+            s[i] = g_test_rand_int();
+            dst[i] = g_test_rand_int_range(0, 64) ? rgb565_to_server(s[i])
+                                                  : g_test_rand_int();
+        }
+        memcpy(expected, dst, ROW_PIXELS * 4);
+
+        g_assert_cmphex(vnc_tile_sync_rgb565(dst, s, dirty, pixels), ==,
+                        sync_rgb565_reference(expected, s, dirty, pixels));
+        g_assert(memcmp(dst, expected, ROW_PIXELS * 4) == 0);
+    }
+
+    g_free(src);
+    g_free(dst);
+    g_free(expected);
+}
+
+static void test_sync(void)
+{
+    vnc_tile_set_avx2(false);
+    check_sync();
+    check_sync_rgb565();
+    if (vnc_tile_set_avx2(true)) {
+        check_sync();
+        check_sync_rgb565();
+    }
+}
+
+/*
+ * Benchmark
+ */
+
+typedef enum {
+    PATTERN_STATIC,     /* everything dirty, nothing changed */
+    PATTERN_SPARSE,     /* everything dirty, one tile in eight changed */
+    PATTERN_FULL,       /* everything dirty and changed */
+    PATTERN__MAX,
+} Pattern;
+
+static const char *pattern_names[PATTERN__MAX] = {
+    [PATTERN_STATIC] = "static",
+    [PATTERN_SPARSE] = "sparse",
+    [PATTERN_FULL] = "full",
+};
+
+typedef enum {
+    KERNEL_REFERENCE,
+    KERNEL_VECTOR,
+    KERNEL_AVX2,
+    KERNEL__MAX,
+} Kernel;
+
+static const char *kernel_names[KERNEL__MAX] = {
+    [KERNEL_REFERENCE] = "memcmp",
+    [KERNEL_VECTOR] = "vector",
+    [KERNEL_AVX2] = "avx2",
+};
+
+typedef struct {
+    Pattern pattern;
+    Kernel kernel;
+    bool rgb565;
+} PerfParams;
+
+/* Change the tiles of the guest frame that @pattern changes */
+static void perf_change_frame(void *guest, int bpp, Pattern pattern, int n)
+{
+    int i;
+
+    for (i = 0; i < FRAME_HEIGHT * FRAME_TILES; i++) {
+        if (pattern == PATTERN_FULL ||
+            (pattern == PATTERN_SPARSE && (i + n) % 8 == 0)) {
+            uint8_t *p = (uint8_t *)guest + i * VNC_TILE_PIXELS * bpp;
+            p[(n % VNC_TILE_PIXELS) * bpp] ^= 0x10;
+        }
+    }
+}
+
+static void perf_sync(gconstpointer opaque)
+{
+    const PerfParams *params = opaque;
+    int bpp = params->rgb565 ? 2 : 4;
+    int words = BITS_TO_LONGS(FRAME_TILES);
+    void *guest = g_malloc0(FRAME_WIDTH * FRAME_HEIGHT * bpp);
+    uint32_t *server = g_new0(uint32_t, FRAME_WIDTH * FRAME_HEIGHT);
+    unsigned long changed = 0;
+    double duration = 0;
+    int n, y, i;
+
+    if (params->rgb565) {
+        for (i = 0; i < FRAME_WIDTH * FRAME_HEIGHT; i++) {
+            server[i] = rgb565_to_server(0);
+        }
+    }
+
+    if (params->kernel == KERNEL_AVX2 && !vnc_tile_set_avx2(true)) {
+        g_test_message("AVX2 not available, skipped");
+        goto out;
+    }
+    if (params->kernel == KERNEL_VECTOR) {
+        vnc_tile_set_avx2(false);
+    }
+
+    for (n = 0; n < FRAME_FRAMES; n++) {
+        perf_change_frame(guest, bpp, params->pattern, n);
+
+        g_test_timer_start();
+        for (y = 0; y < FRAME_HEIGHT; y++) {
+            uint8_t *g = (uint8_t *)guest + y * FRAME_WIDTH * bpp;
+            uint32_t *s = server + y * FRAME_WIDTH;
+
+            for (i = 0; i < words; i++) {
+                int x = i * BITS_PER_LONG * VNC_TILE_PIXELS;
+                unsigned long dirty = ~0UL;
+
+                if (i == words - 1) {
+                    dirty = BITMAP_LAST_WORD_MASK(FRAME_TILES);
+                }
+                if (params->kernel == KERNEL_REFERENCE && params->rgb565) {
+                    dirty = sync_rgb565_reference(s + x, (uint16_t *)g + x,
+                                                  dirty, FRAME_WIDTH - x);
+                } else if (params->kernel == KERNEL_REFERENCE) {
+                    dirty = sync_reference((uint8_t *)(s + x), g + x * 4,
+                                           dirty, (FRAME_WIDTH - x) * 4);
+                } else if (params->rgb565) {
+                    dirty = vnc_tile_sync_rgb565(s + x, (uint16_t *)g + x,
+                                                 dirty, FRAME_WIDTH - x);
+                } else {
+                    dirty = vnc_tile_sync(s + x, g + x * 4, dirty,
+                                          (FRAME_WIDTH - x) * 4);
+                }
+                changed += ctpopl(dirty);
+            }
+        }
+        duration += g_test_timer_elapsed();
+    }
+
+    g_test_message("%s %s %s: %.1f frames/s, %.0f Mtiles/s, "
+                   "%lu tiles changed",
+                   params->rgb565 ? "rgb565" : "x8r8g8b8",
+                   pattern_names[params->pattern],
+                   kernel_names[params->kernel],
+                   FRAME_FRAMES / duration,
+                   FRAME_FRAMES * (double)FRAME_HEIGHT * FRAME_TILES /
+                   duration / 1e6, changed);
+
+out:
+    g_free(guest);
+    g_free(server);
+}
+
+int main(int argc, char **argv)
+{
+    g_test_init(&argc, &argv, NULL);
+    g_test_add_func("/vnc-tile/sync", test_sync);
+
+    if (g_test_perf()) {
+        int rgb565, pattern, kernel;
+
+        for (rgb565 = 0; rgb565 < 2; rgb565++) {
+            for (pattern = 0; pattern < PATTERN__MAX; pattern++) {
+                for (kernel = 0; kernel < KERNEL__MAX; kernel++) {
+                    PerfParams *params = g_new(PerfParams, 1);
+                    char *path;
+
+                    params->pattern = pattern;
+                    params->kernel = kernel;
+                    params->rgb565 = rgb565;
+                    path = g_strdup_printf("/vnc-tile/perf/%s/%s/%s",
+                                           rgb565 ? "rgb565" : "x8r8g8b8",
+                                           pattern_names[pattern],
+                                           kernel_names[kernel]);
+                    g_test_add_data_func(path, params, perf_sync);
+                    g_free(path);
+                }
+            }
+        }
+    }
+    return g_test_run();
+}
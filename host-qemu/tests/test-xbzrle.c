@@ -179,6 +179,61 @@ static void test_encode_decode(void)
     }
 }
 
+/* Byte at a time encoder, to check the vectorized run scan against */
+static int encode_bytewise(uint8_t *old_buf, uint8_t *new_buf, int slen,
+                           uint8_t *dst)
+{
+    int d = 0, i = 0, start;
+
+    while (i < slen) {
+        start = i;
+        while (i < slen && old_buf[i] == new_buf[i]) {
+            i++;
+        }
+        if (i == slen) {
+            break;
+        }
+        d += uleb128_encode_small(dst + d, i - start);
+        start = i;
+        while (i < slen && old_buf[i] != new_buf[i]) {
+            i++;
+        }
+        d += uleb128_encode_small(dst + d, i - start);
+        memcpy(dst + d, new_buf + start, i - start);
+        d += i - start;
+    }
+    return d;
+}
+
+static void test_encode_runs(void)
+{
+    uint8_t *old_buf = g_malloc0(PAGE_SIZE);
+    uint8_t *new_buf = g_malloc0(PAGE_SIZE);
+    uint8_t *compressed = g_malloc(PAGE_SIZE);
+    uint8_t *expected = g_malloc(PAGE_SIZE);
+    int start, len, rc;
+
+    /* Runs starting and ending at every position of a 64 byte vector */
+    for (start = 0; start < 64; start++) {
+        for (len = 1; len <= 80; len++) {
+            memset(new_buf, 0, PAGE_SIZE);
+            memset(new_buf + start, 0xaa, len);
+            memset(new_buf + PAGE_SIZE - 64 + start / 2, 0x55, len / 4 + 1);
+
+            rc = xbzrle_encode_buffer(old_buf, new_buf, PAGE_SIZE,
+                                      compressed, PAGE_SIZE);
+            g_assert(rc == encode_bytewise(old_buf, new_buf, PAGE_SIZE,
+                                           expected));
+            g_assert(memcmp(compressed, expected, rc) == 0);
+        }
+    }
+
+    g_free(old_buf);
+    g_free(new_buf);
+    g_free(compressed);
+    g_free(expected);
+}
+
 int main(int argc, char **argv)
 {
     g_test_init(&argc, &argv, NULL);
@@ -191,6 +246,7 @@ int main(int argc, char **argv)
     g_test_add_func("/xbzrle/encode_decode_overflow",
                     test_encode_decode_overflow);
     g_test_add_func("/xbzrle/encode_decode", test_encode_decode);
+    g_test_add_func("/xbzrle/encode_runs", test_encode_runs);
 
     return g_test_run();
 }
@@ -96,17 +96,20 @@ static QPCIBus *pci_test_start(void)
     return qpci_init_pc();
 }
 
-static void arm_test_start(void)
+static void arm_test_start(bool modern)
 {
     char *cmdline;
     char *tmp_path;
 
     tmp_path = drive_create();
 
-    cmdline = g_strdup_printf("-machine virt "
+    cmdline = g_strdup_printf("-machine virt%s "
                                 "-drive if=none,id=drive0,file=%s,format=raw "
-                                "-device virtio-blk-device,drive=drive0",
-                                tmp_path);
+                                "-device virtio-blk-device,drive=drive0%s",
+                                modern ? " -global virtio-mmio.force-legacy=off"
+                                       : "",
+                                tmp_path,
+                                modern ? ",scsi=off,packed=on" : "");
     qtest_start(cmdline);
     unlink(tmp_path);
     g_free(tmp_path);
@@ -732,11 +735,12 @@ static void mmio_basic(void)
     int n_size = TEST_IMAGE_SIZE / 2;
     uint64_t capacity;
 
-    arm_test_start();
+    arm_test_start(false);
 
     dev = qvirtio_mmio_init_device(MMIO_DEV_BASE_ADDR, MMIO_PAGE_SIZE);
     g_assert(dev != NULL);
     g_assert_cmphex(dev->vdev.device_type, ==, QVIRTIO_BLK_DEVICE_ID);
+    g_assert_cmpint(dev->version, ==, 1);
 
     qvirtio_reset(&qvirtio_mmio, &dev->vdev);
     qvirtio_set_acknowledge(&qvirtio_mmio, &dev->vdev);
@@ -765,6 +769,347 @@ static void mmio_basic(void)
     test_end();
 }
 
+/* Bring up a version 2 device with the packed ring and @extra_features */
+static QVirtQueue *mmio_packed_init(QVirtioMMIODevice *dev,
+                                    QGuestAllocator *alloc,
+                                    uint64_t extra_features)
+{
+    uint64_t features;
+
+    qvirtio_reset(&qvirtio_mmio, &dev->vdev);
+    qvirtio_set_acknowledge(&qvirtio_mmio, &dev->vdev);
+    qvirtio_set_driver(&qvirtio_mmio, &dev->vdev);
+
+    features = qvirtio_get_features(&qvirtio_mmio, &dev->vdev);
+    g_assert(features & QVIRTIO_F_VERSION_1);
+    g_assert(features & QVIRTIO_F_RING_PACKED);
+    features &= QVIRTIO_F_VERSION_1 | QVIRTIO_F_RING_PACKED | extra_features;
+    qvirtio_set_features(&qvirtio_mmio, &dev->vdev, features);
+    qvirtio_set_features_ok(&qvirtio_mmio, &dev->vdev);
+
+    return qvirtqueue_setup(&qvirtio_mmio, &dev->vdev, alloc, 0);
+}
+
+/* Queue a 512 byte read or write of @sector as a three descriptor chain and
+ * return the address of the request, whose status byte is at offset 528.
+ */
+static uint64_t mmio_packed_submit(QVirtioMMIODevice *dev,
+                                   QGuestAllocator *alloc, QVirtQueue *vq,
+                                   uint32_t type, uint64_t sector,
+                                   const char *data, uint32_t *head)
+{
+    QVirtioBlkReq req;
+    uint64_t req_addr;
+    bool write = type == QVIRTIO_BLK_T_OUT;
+
+    req.type = type;
+    req.ioprio = 1;
+    req.sector = sector;
+    req.data = g_malloc0(512);
+    if (data) {
+        strcpy(req.data, data);
+    }
+
+    req_addr = virtio_blk_request(alloc, &req, 512);
+
+    g_free(req.data);
+
+    *head = qvirtqueue_add(vq, req_addr, 16, false, true);
+    qvirtqueue_add(vq, req_addr + 16, 512, !write, true);
+    qvirtqueue_add(vq, req_addr + 528, 1, true, false);
+
+    qvirtqueue_kick(&qvirtio_mmio, &dev->vdev, vq, *head);
+
+    return req_addr;
+}
+
+/* Reap the next used buffer, which must be the request at @head */
+static void mmio_packed_complete(QGuestAllocator *alloc, QVirtQueue *vq,
+                                 uint64_t req_addr, uint32_t head)
+{
+    uint32_t id;
+
+    g_assert(qvirtqueue_packed_get_buf(vq, &id, NULL));
+    g_assert_cmpint(id, ==, head);
+    g_assert_cmpint(readb(req_addr + 528), ==, 0);
+
+    guest_free(alloc, req_addr);
+}
+
+static void mmio_modern_negotiate(void)
+{
+    QVirtioMMIODevice *dev;
+    QVirtQueue *vq;
+    QGuestAllocator *alloc;
+    int n_size = TEST_IMAGE_SIZE / 2;
+    uint32_t generation;
+    uint64_t capacity;
+
+    arm_test_start(true);
+
+    dev = qvirtio_mmio_init_device(MMIO_DEV_BASE_ADDR, MMIO_PAGE_SIZE);
+    g_assert(dev != NULL);
+    g_assert_cmphex(dev->vdev.device_type, ==, QVIRTIO_BLK_DEVICE_ID);
+    g_assert_cmpint(dev->version, ==, 2);
+
+    alloc = generic_alloc_init(MMIO_RAM_ADDR, MMIO_RAM_SIZE, MMIO_PAGE_SIZE);
+    vq = mmio_packed_init(dev, alloc, 0);
+
+    /* The legacy queue registers are gone in version 2 */
+    g_assert_cmphex(readl(dev->addr + QVIRTIO_MMIO_QUEUE_PFN), ==, 0);
+
+    qvirtio_set_driver_ok(&qvirtio_mmio, &dev->vdev);
+
+    /* A config change bumps the generation */
+    generation = readl(dev->addr + QVIRTIO_MMIO_CONFIG_GENERATION);
+
+    qmp("{ 'execute': 'block_resize', 'arguments': { 'device': 'drive0', "
+                                                    " 'size': %d } }", n_size);
+
+    qvirtio_wait_config_isr(&qvirtio_mmio, &dev->vdev, QVIRTIO_BLK_TIMEOUT_US);
+    g_assert_cmpint(readl(dev->addr + QVIRTIO_MMIO_CONFIG_GENERATION), ==,
+                    generation + 1);
+
+    capacity = qvirtio_config_readq(&qvirtio_mmio, &dev->vdev,
+                                                QVIRTIO_MMIO_DEVICE_SPECIFIC);
+    g_assert_cmpint(capacity, ==, n_size / 512);
+
+    /* Reset disables the queue again */
+    qvirtio_reset(&qvirtio_mmio, &dev->vdev);
+    writel(dev->addr + QVIRTIO_MMIO_QUEUE_SEL, 0);
+    g_assert_cmphex(readl(dev->addr + QVIRTIO_MMIO_QUEUE_READY), ==, 0);
+
+    /* End test */
+    guest_free(alloc, vq->desc);
+    generic_alloc_uninit(alloc);
+    g_free(dev);
+    test_end();
+}
+
+static void mmio_packed_wrap(void)
+{
+    QVirtioMMIODevice *dev;
+    QVirtQueue *vq;
+    QGuestAllocator *alloc;
+    uint64_t req_addr;
+    uint32_t head;
+    char *data;
+    int i;
+
+    arm_test_start(true);
+
+    dev = qvirtio_mmio_init_device(MMIO_DEV_BASE_ADDR, MMIO_PAGE_SIZE);
+    g_assert(dev != NULL);
+
+    /* Three descriptors per request, so that chains straddle the end of
+     * the ring and both wrap counters flip twice.
+     */
+    dev->queue_size = 16;
+
+    alloc = generic_alloc_init(MMIO_RAM_ADDR, MMIO_RAM_SIZE, MMIO_PAGE_SIZE);
+    vq = mmio_packed_init(dev, alloc, 0);
+    g_assert(vq->packed);
+    g_assert_cmpint(vq->size, ==, 16);
+
+    qvirtio_set_driver_ok(&qvirtio_mmio, &dev->vdev);
+
+    data = g_malloc0(512);
+    for (i = 0; i < 12; i++) {
+        char *str = g_strdup_printf("TEST%d", i);
+
+        req_addr = mmio_packed_submit(dev, alloc, vq, QVIRTIO_BLK_T_OUT, i,
+                                      str, &head);
+        qvirtio_wait_queue_isr(&qvirtio_mmio, &dev->vdev, vq,
+                               QVIRTIO_BLK_TIMEOUT_US);
+        mmio_packed_complete(alloc, vq, req_addr, head);
+
+        req_addr = mmio_packed_submit(dev, alloc, vq, QVIRTIO_BLK_T_IN, i,
+                                      NULL, &head);
+        qvirtio_wait_queue_isr(&qvirtio_mmio, &dev->vdev, vq,
+                               QVIRTIO_BLK_TIMEOUT_US);
+        memread(req_addr + 16, data, 512);
+        g_assert_cmpstr(data, ==, str);
+        mmio_packed_complete(alloc, vq, req_addr, head);
+
+        g_free(str);
+
+        if (i == 2) {
+            /* 18 descriptors: the device is in its second lap */
+            g_assert(!vq->avail_wrap_counter);
+            g_assert(!vq->used_wrap_counter);
+        }
+    }
+    g_free(data);
+
+    /* 72 descriptors are four laps and a half */
+    g_assert_cmpint(vq->last_used_idx, ==, 8);
+    g_assert(vq->used_wrap_counter);
+    g_assert_cmpint(vq->num_free, ==, vq->size);
+
+    /* End test */
+    guest_free(alloc, vq->desc);
+    generic_alloc_uninit(alloc);
+    g_free(dev);
+    test_end();
+}
+
+static void mmio_packed_indirect(void)
+{
+    QVirtioMMIODevice *dev;
+    QVirtQueue *vq;
+    QGuestAllocator *alloc;
+    QVRingIndirectDesc *indirect;
+    QVirtioBlkReq req;
+    uint64_t req_addr;
+    uint32_t free_head, id;
+    uint8_t status;
+    char *data;
+
+    arm_test_start(true);
+
+    dev = qvirtio_mmio_init_device(MMIO_DEV_BASE_ADDR, MMIO_PAGE_SIZE);
+    g_assert(dev != NULL);
+
+    alloc = generic_alloc_init(MMIO_RAM_ADDR, MMIO_RAM_SIZE, MMIO_PAGE_SIZE);
+    vq = mmio_packed_init(dev, alloc, QVIRTIO_F_RING_INDIRECT_DESC);
+    g_assert(vq->indirect);
+
+    qvirtio_set_driver_ok(&qvirtio_mmio, &dev->vdev);
+
+    /* Write request */
+    req.type = QVIRTIO_BLK_T_OUT;
+    req.ioprio = 1;
+    req.sector = 0;
+    req.data = g_malloc0(512);
+    strcpy(req.data, "TEST");
+
+    req_addr = virtio_blk_request(alloc, &req, 512);
+
+    g_free(req.data);
+
+    indirect = qvring_packed_indirect_desc_setup(&dev->vdev, alloc, 2);
+    qvring_indirect_desc_add(indirect, req_addr, 528, false);
+    qvring_indirect_desc_add(indirect, req_addr + 528, 1, true);
+    free_head = qvirtqueue_add_indirect(vq, indirect);
+    qvirtqueue_kick(&qvirtio_mmio, &dev->vdev, vq, free_head);
+
+    qvirtio_wait_queue_isr(&qvirtio_mmio, &dev->vdev, vq,
+                           QVIRTIO_BLK_TIMEOUT_US);
+    g_assert(qvirtqueue_packed_get_buf(vq, &id, NULL));
+    g_assert_cmpint(id, ==, free_head);
+    status = readb(req_addr + 528);
+    g_assert_cmpint(status, ==, 0);
+
+    /* The whole table takes a single ring slot */
+    g_assert_cmpint(vq->last_used_idx, ==, 1);
+
+    g_free(indirect);
+    guest_free(alloc, req_addr);
+
+    /* Read request */
+    req.type = QVIRTIO_BLK_T_IN;
+    req.ioprio = 1;
+    req.sector = 0;
+    req.data = g_malloc0(512);
+    strcpy(req.data, "TEST");
+
+    req_addr = virtio_blk_request(alloc, &req, 512);
+
+    g_free(req.data);
+
+    indirect = qvring_packed_indirect_desc_setup(&dev->vdev, alloc, 3);
+    qvring_indirect_desc_add(indirect, req_addr, 16, false);
+    qvring_indirect_desc_add(indirect, req_addr + 16, 512, true);
+    qvring_indirect_desc_add(indirect, req_addr + 528, 1, true);
+    free_head = qvirtqueue_add_indirect(vq, indirect);
+    qvirtqueue_kick(&qvirtio_mmio, &dev->vdev, vq, free_head);
+
+    qvirtio_wait_queue_isr(&qvirtio_mmio, &dev->vdev, vq,
+                           QVIRTIO_BLK_TIMEOUT_US);
+    g_assert(qvirtqueue_packed_get_buf(vq, &id, NULL));
+    g_assert_cmpint(id, ==, free_head);
+    status = readb(req_addr + 528);
+    g_assert_cmpint(status, ==, 0);
+    g_assert_cmpint(vq->last_used_idx, ==, 2);
+
+    data = g_malloc0(512);
+    memread(req_addr + 16, data, 512);
+    g_assert_cmpstr(data, ==, "TEST");
+    g_free(data);
+
+    g_free(indirect);
+    guest_free(alloc, req_addr);
+
+    /* End test */
+    guest_free(alloc, vq->desc);
+    generic_alloc_uninit(alloc);
+    g_free(dev);
+    test_end();
+}
+
+static void mmio_packed_event(void)
+{
+    QVirtioMMIODevice *dev;
+    QVirtQueue *vq;
+    QGuestAllocator *alloc;
+    uint64_t req_addr, req_addr2;
+    uint32_t head, head2;
+    uint16_t off_wrap;
+    uint8_t status;
+
+    arm_test_start(true);
+
+    dev = qvirtio_mmio_init_device(MMIO_DEV_BASE_ADDR, MMIO_PAGE_SIZE);
+    g_assert(dev != NULL);
+
+    alloc = generic_alloc_init(MMIO_RAM_ADDR, MMIO_RAM_SIZE, MMIO_PAGE_SIZE);
+    vq = mmio_packed_init(dev, alloc, QVIRTIO_F_RING_EVENT_IDX);
+    g_assert(vq->event);
+
+    qvirtio_set_driver_ok(&qvirtio_mmio, &dev->vdev);
+
+    /* Interrupts disabled */
+    qvirtqueue_packed_set_event_flags(vq, QVRING_PACKED_EVENT_FLAG_DISABLE);
+
+    req_addr = mmio_packed_submit(dev, alloc, vq, QVIRTIO_BLK_T_OUT, 0,
+                                  "TEST", &head);
+    status = qvirtio_wait_status_byte_no_isr(&qvirtio_mmio, &dev->vdev, vq,
+                                             req_addr + 528,
+                                             QVIRTIO_BLK_TIMEOUT_US);
+    g_assert_cmpint(status, ==, 0);
+    mmio_packed_complete(alloc, vq, req_addr, head);
+
+    /* The device asks to be kicked for the next descriptor */
+    off_wrap = readw(vq->used);
+    g_assert_cmpint(off_wrap, ==,
+                    vq->free_head |
+                    vq->avail_wrap_counter << QVRING_PACKED_EVENT_F_WRAP_CTR);
+
+    /* Interrupt once the second of the next two requests is used */
+    qvirtqueue_set_used_event(vq, vq->last_used_idx + 4);
+
+    req_addr = mmio_packed_submit(dev, alloc, vq, QVIRTIO_BLK_T_IN, 0,
+                                  NULL, &head);
+    status = qvirtio_wait_status_byte_no_isr(&qvirtio_mmio, &dev->vdev, vq,
+                                             req_addr + 528,
+                                             QVIRTIO_BLK_TIMEOUT_US);
+    g_assert_cmpint(status, ==, 0);
+
+    req_addr2 = mmio_packed_submit(dev, alloc, vq, QVIRTIO_BLK_T_IN, 0,
+                                   NULL, &head2);
+    qvirtio_wait_queue_isr(&qvirtio_mmio, &dev->vdev, vq,
+                           QVIRTIO_BLK_TIMEOUT_US);
+
+    mmio_packed_complete(alloc, vq, req_addr, head);
+    mmio_packed_complete(alloc, vq, req_addr2, head2);
+
+    /* End test */
+    guest_free(alloc, vq->desc);
+    generic_alloc_uninit(alloc);
+    g_free(dev);
+    test_end();
+}
+
 int main(int argc, char **argv)
 {
     int ret;
@@ -781,6 +1126,12 @@ int main(int argc, char **argv)
         qtest_add_func("/virtio/blk/pci/hotplug", pci_hotplug);
     } else if (strcmp(arch, "arm") == 0) {
         qtest_add_func("/virtio/blk/mmio/basic", mmio_basic);
+        qtest_add_func("/virtio/blk/mmio/modern/negotiate",
+                       mmio_modern_negotiate);
+        qtest_add_func("/virtio/blk/mmio/packed/wrap", mmio_packed_wrap);
+        qtest_add_func("/virtio/blk/mmio/packed/indirect",
+                       mmio_packed_indirect);
+        qtest_add_func("/virtio/blk/mmio/packed/event", mmio_packed_event);
     }
 
     ret = g_test_run();
@@ -9,21 +9,235 @@
 
 #include <glib.h>
 #include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
 #include "libqtest.h"
 #include "qemu/osdep.h"
 #include "libqos/pci.h"
+#include "libqos/pci-pc.h"
+#include "libqos/virtio.h"
+#include "libqos/virtio-pci.h"
+#include "libqos/malloc.h"
+#include "libqos/malloc-pc.h"
+#include "qapi/qmp/qdict.h"
+#include "qapi/qmp/qlist.h"
 
 #define PCI_SLOT_HP             0x06
+#define PCI_SLOT                0x04
+#define PCI_FN                  0x00
 
-/* Tests only initialization so far. TODO: Replace with functional tests */
-static void pci_nop(void)
+#define QVIRTIO_NET_F_MRG_RXBUF     0x00008000
+
+#define QVIRTIO_NET_TIMEOUT_US  (30 * 1000 * 1000)
+/* struct virtio_net_hdr, without VIRTIO_NET_F_MRG_RXBUF */
+#define VNET_HDR_SIZE           10
+#define TX_BUF_SIZE             64
+
+/* The tap backend reads and writes one packet per datagram, so the other
+ * end of a SOCK_DGRAM socketpair sees the guest's packets.
+ */
+static QPCIBus *pci_test_start(int socket, bool iothread)
+{
+    char *cmdline;
+
+    cmdline = g_strdup_printf("%s-netdev tap,id=hs0,fd=%d "
+                              "-device virtio-net-pci,id=net0,netdev=hs0,"
+                              "addr=%x.%x%s",
+                              iothread ? "-object iothread,id=io0 " : "",
+                              socket, PCI_SLOT, PCI_FN,
+                              iothread ? ",len-iothreads=1,iothreads[0]=io0"
+                                       : "");
+    qtest_start(cmdline);
+    g_free(cmdline);
+
+    return qpci_init_pc();
+}
+
+static void test_end(void)
 {
+    qtest_end();
+}
+
+static QVirtioPCIDevice *virtio_net_pci_init(QPCIBus *bus, int slot)
+{
+    QVirtioPCIDevice *dev;
+
+    dev = qvirtio_pci_device_find(bus, QVIRTIO_NET_DEVICE_ID);
+    g_assert(dev != NULL);
+    g_assert_cmphex(dev->vdev.device_type, ==, QVIRTIO_NET_DEVICE_ID);
+    g_assert_cmphex(dev->pdev->devfn, ==, ((slot << 3) | PCI_FN));
+
+    qvirtio_pci_device_enable(dev);
+    qvirtio_reset(&qvirtio_pci, &dev->vdev);
+    qvirtio_set_acknowledge(&qvirtio_pci, &dev->vdev);
+    qvirtio_set_driver(&qvirtio_pci, &dev->vdev);
+
+    return dev;
+}
+
+static void driver_init(const QVirtioBus *bus, QVirtioDevice *dev)
+{
+    uint32_t features;
+
+    features = qvirtio_get_features(bus, dev);
+    features = features & ~(QVIRTIO_F_BAD_FEATURE |
+                            QVIRTIO_F_RING_INDIRECT_DESC |
+                            QVIRTIO_F_RING_EVENT_IDX |
+                            QVIRTIO_NET_F_MRG_RXBUF);
+    qvirtio_set_features(bus, dev, features);
+}
+
+static void rx_test(const QVirtioBus *bus, QVirtioDevice *dev,
+                    QGuestAllocator *alloc, QVirtQueue *vq,
+                    int socket)
+{
+    uint64_t req_addr;
+    uint32_t free_head;
+    char test[] = "TEST";
+    char buffer[64];
+    ssize_t ret;
+
+    req_addr = guest_alloc(alloc, 64);
+
+    free_head = qvirtqueue_add(vq, req_addr, 64, true, false);
+    qvirtqueue_kick(bus, dev, vq, free_head);
+
+    ret = send(socket, test, sizeof(test), 0);
+    g_assert_cmpint(ret, ==, sizeof(test));
+
+    qvirtio_wait_queue_isr(bus, dev, vq, QVIRTIO_NET_TIMEOUT_US);
+    memread(req_addr + VNET_HDR_SIZE, buffer, sizeof(test));
+    g_assert_cmpstr(buffer, ==, "TEST");
+
+    guest_free(alloc, req_addr);
+}
+
+static void tx_test(const QVirtioBus *bus, QVirtioDevice *dev,
+                    QGuestAllocator *alloc, QVirtQueue *vq,
+                    int socket)
+{
+    uint64_t req_addr;
+    uint32_t free_head;
+    char buffer[64];
+    ssize_t ret;
+
+    req_addr = guest_alloc(alloc, TX_BUF_SIZE);
+    qmemset(req_addr, 0, TX_BUF_SIZE);
+    memwrite(req_addr + VNET_HDR_SIZE, "TEST", 5);
+
+    free_head = qvirtqueue_add(vq, req_addr, TX_BUF_SIZE, false, false);
+    qvirtqueue_kick(bus, dev, vq, free_head);
+
+    qvirtio_wait_queue_isr(bus, dev, vq, QVIRTIO_NET_TIMEOUT_US);
+    guest_free(alloc, req_addr);
+
+    ret = recv(socket, buffer, sizeof(buffer), 0);
+    g_assert_cmpint(ret, ==, TX_BUF_SIZE - VNET_HDR_SIZE);
+    g_assert_cmpstr(buffer, ==, "TEST");
+}
+
+/* Check the counters of the only queue of net client @name */
+static void check_stats(const char *name,
+                        int64_t rx_packets, int64_t rx_bytes,
+                        int64_t tx_packets, int64_t tx_bytes)
+{
+    QDict *response, *stats;
+    QList *list;
+
+    response = qmp("{ 'execute': 'query-net-queue-stats',"
+                   "  'arguments': { 'name': %s } }", name);
+    g_assert(response);
+    list = qdict_get_qlist(response, "return");
+    g_assert(list);
+    g_assert_cmpint(qlist_size(list), ==, 1);
+
+    stats = qobject_to_qdict(qlist_peek(list));
+    g_assert(stats);
+    g_assert_cmpstr(qdict_get_str(stats, "name"), ==, name);
+    g_assert_cmpint(qdict_get_int(stats, "queue"), ==, 0);
+    g_assert_cmpint(qdict_get_int(stats, "rx-packets"), ==, rx_packets);
+    g_assert_cmpint(qdict_get_int(stats, "rx-bytes"), ==, rx_bytes);
+    g_assert_cmpint(qdict_get_int(stats, "rx-dropped"), ==, 0);
+    g_assert_cmpint(qdict_get_int(stats, "tx-packets"), ==, tx_packets);
+    g_assert_cmpint(qdict_get_int(stats, "tx-bytes"), ==, tx_bytes);
+    g_assert_cmpint(qdict_get_int(stats, "tx-dropped"), ==, 0);
+
+    QDECREF(response);
+}
+
+/* Run one packet each way @cycles times and check the counters on both
+ * sides.  The VM is stopped and restarted in between; with an IOThread,
+ * that moves the queue pair back to the main loop and out again.
+ */
+static void pci_rx_tx(bool iothread, int cycles)
+{
+    QVirtioPCIDevice *dev;
+    QPCIBus *bus;
+    QVirtQueuePCI *rx, *tx;
+    QGuestAllocator *alloc;
+    int64_t rx_bytes = sizeof("TEST");
+    int64_t tx_bytes = TX_BUF_SIZE - VNET_HDR_SIZE;
+    int sv[2];
+    int ret, i;
+
+    ret = socketpair(PF_UNIX, SOCK_DGRAM, 0, sv);
+    g_assert_cmpint(ret, !=, -1);
+
+    bus = pci_test_start(sv[1], iothread);
+    dev = virtio_net_pci_init(bus, PCI_SLOT);
+
+    alloc = pc_alloc_init();
+    driver_init(&qvirtio_pci, &dev->vdev);
+    rx = (QVirtQueuePCI *)qvirtqueue_setup(&qvirtio_pci, &dev->vdev,
+                                           alloc, 0);
+    tx = (QVirtQueuePCI *)qvirtqueue_setup(&qvirtio_pci, &dev->vdev,
+                                           alloc, 1);
+    qvirtio_set_driver_ok(&qvirtio_pci, &dev->vdev);
+
+    for (i = 1; i <= cycles; i++) {
+        if (i > 1) {
+            qmp_async("{ 'execute': 'stop' }");
+            qmp_eventwait("STOP");
+            QDECREF(qmp_receive());
+            qmp_async("{ 'execute': 'cont' }");
+            qmp_eventwait("RESUME");
+            QDECREF(qmp_receive());
+        }
+
+        rx_test(&qvirtio_pci, &dev->vdev, alloc, &rx->vq, sv[0]);
+        tx_test(&qvirtio_pci, &dev->vdev, alloc, &tx->vq, sv[0]);
+
+        check_stats("net0", i, i * rx_bytes, i, i * tx_bytes);
+        check_stats("hs0", i, i * tx_bytes, i, i * rx_bytes);
+    }
+
+    /* End test */
+    close(sv[0]);
+    guest_free(alloc, tx->vq.desc);
+    guest_free(alloc, rx->vq.desc);
+    pc_alloc_uninit(alloc);
+    qvirtio_pci_device_disable(dev);
+    g_free(dev);
+    qpci_free_pc(bus);
+    test_end();
+}
+
+static void pci_stats(void)
+{
+    pci_rx_tx(false, 2);
+}
+
+static void pci_iothread(void)
+{
+    pci_rx_tx(true, 3);
 }
 
 static void hotplug(void)
 {
+    qtest_start("-device virtio-net-pci");
     qpci_plug_device_test("virtio-net-pci", "net1", PCI_SLOT_HP, NULL);
     qpci_unplug_acpi_device_test("net1", PCI_SLOT_HP);
+    test_end();
 }
 
 int main(int argc, char **argv)
@@ -31,13 +245,11 @@ int main(int argc, char **argv)
     int ret;
 
     g_test_init(&argc, &argv, NULL);
-    qtest_add_func("/virtio/net/pci/nop", pci_nop);
+    qtest_add_func("/virtio/net/pci/stats", pci_stats);
+    qtest_add_func("/virtio/net/pci/iothread", pci_iothread);
     qtest_add_func("/virtio/net/pci/hotplug", hotplug);
 
-    qtest_start("-device virtio-net-pci");
     ret = g_test_run();
 
-    qtest_end();
-
     return ret;
 }
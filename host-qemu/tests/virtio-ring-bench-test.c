@@ -0,0 +1,152 @@
+/*
+ * QTest testcase and benchmark for the virtqueue code
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include <glib.h>
+#include <string.h>
+#include <stdio.h>
+#include "libqtest.h"
+#include "qemu/osdep.h"
+#include "libqos/virtio.h"
+#include "libqos/virtio-pci.h"
+#include "libqos/pci-pc.h"
+#include "libqos/malloc.h"
+#include "libqos/malloc-pc.h"
+
+#define QVIRTIO_RING_BENCH_DEVICE_ID    63
+
+#define PCI_SLOT                0x04
+#define PCI_FN                  0x00
+
+/* Buffers on the ring, each one readable and one writable descriptor */
+#define DEPTH                   64
+#define BUF_SIZE                256
+
+#define TIMEOUT_US              (30 * 1000 * 1000)
+
+typedef struct {
+    uint64_t cycles;
+    uint64_t elapsed_ns;
+} BenchResult;
+
+static BenchResult run_bench(uint32_t batch, uint32_t iterations)
+{
+    QVirtioPCIDevice *dev;
+    QPCIBus *bus;
+    QVirtQueue *vq;
+    QGuestAllocator *alloc;
+    BenchResult result;
+    uint64_t data, config;
+    uint32_t features, head;
+    char *cmdline;
+    int i;
+
+    cmdline = g_strdup_printf("-device virtio-ring-bench-pci,addr=%x.%x,"
+                              "batch=%u,iterations=%u",
+                              PCI_SLOT, PCI_FN, batch, iterations);
+    qtest_start(cmdline);
+    g_free(cmdline);
+    bus = qpci_init_pc();
+
+    dev = qvirtio_pci_device_find(bus, QVIRTIO_RING_BENCH_DEVICE_ID);
+    g_assert(dev != NULL);
+    qvirtio_pci_device_enable(dev);
+    qvirtio_reset(&qvirtio_pci, &dev->vdev);
+    qvirtio_set_acknowledge(&qvirtio_pci, &dev->vdev);
+    qvirtio_set_driver(&qvirtio_pci, &dev->vdev);
+
+    alloc = pc_alloc_init();
+    vq = qvirtqueue_setup(&qvirtio_pci, &dev->vdev, alloc, 0);
+    g_assert_cmpint(vq->size, >=, DEPTH * 2);
+
+    features = qvirtio_get_features(&qvirtio_pci, &dev->vdev);
+    qvirtio_set_features(&qvirtio_pci, &dev->vdev,
+                         features & QVIRTIO_F_RING_EVENT_IDX);
+    qvirtio_set_driver_ok(&qvirtio_pci, &dev->vdev);
+
+    data = guest_alloc(alloc, DEPTH * 2 * BUF_SIZE);
+    for (i = 0; i < DEPTH; i++) {
+        head = qvirtqueue_add(vq, data + 2 * i * BUF_SIZE, BUF_SIZE,
+                              false, true);
+        qvirtqueue_add(vq, data + (2 * i + 1) * BUF_SIZE, BUF_SIZE,
+                       true, false);
+        /* vq->avail->ring[i] */
+        writew(vq->avail + 4 + 2 * i, head);
+    }
+    /* vq->avail->idx */
+    writew(vq->avail + 2, DEPTH);
+    qvirtio_pci.virtqueue_kick(&dev->vdev, vq);
+    qvirtio_wait_queue_isr(&qvirtio_pci, &dev->vdev, vq, TIMEOUT_US);
+
+    /* MSI-X is not enabled */
+    config = (uintptr_t)dev->addr + QVIRTIO_PCI_DEVICE_SPECIFIC_NO_MSIX;
+    result.cycles = qvirtio_config_readq(&qvirtio_pci, &dev->vdev, config);
+    result.elapsed_ns = qvirtio_config_readq(&qvirtio_pci, &dev->vdev,
+                                             config + 8);
+
+    g_assert_cmpint(result.cycles, ==, iterations);
+    /* vq->used->idx */
+    g_assert_cmpint(readw(vq->used + 2), ==, iterations & 0xffff);
+    /* vq->avail->idx, the device put every buffer back */
+    g_assert_cmpint(readw(vq->avail + 2), ==, (DEPTH + iterations) & 0xffff);
+
+    guest_free(alloc, data);
+    guest_free(alloc, vq->desc);
+    pc_alloc_uninit(alloc);
+    qvirtio_pci_device_disable(dev);
+    g_free(dev);
+    qpci_free_pc(bus);
+    qtest_end();
+
+    return result;
+}
+
+static void test_pop(void)
+{
+    run_bench(0, 10000);
+}
+
+static void test_pop_batch(void)
+{
+    run_bench(1, 1000);
+    run_bench(7, 10000);
+    run_bench(DEPTH, 10000);
+}
+
+static void perf_pop_push(gconstpointer opaque)
+{
+    uint32_t batch = GPOINTER_TO_UINT(opaque);
+    const uint32_t iterations = 10000000;
+    BenchResult result;
+
+    result = run_bench(batch, iterations);
+    g_test_message("batch %u: %" PRIu64 " pop/push cycles in %f s, "
+                   "%.0f cycles/s, %.1f ns per cycle",
+                   batch, result.cycles, result.elapsed_ns / 1e9,
+                   result.cycles * 1e9 / result.elapsed_ns,
+                   (double)result.elapsed_ns / result.cycles);
+}
+
+int main(int argc, char **argv)
+{
+    static const uint32_t batches[] = { 0, 1, 4, 16, DEPTH };
+    int i;
+
+    g_test_init(&argc, &argv, NULL);
+    qtest_add_func("/virtio/ring-bench/pci/pop", test_pop);
+    qtest_add_func("/virtio/ring-bench/pci/pop-batch", test_pop_batch);
+    if (g_test_perf()) {
+        for (i = 0; i < ARRAY_SIZE(batches); i++) {
+            char *path = g_strdup_printf("/virtio/ring-bench/perf/batch-%u",
+                                         batches[i]);
+            qtest_add_data_func(path, GUINT_TO_POINTER(batches[i]),
+                                perf_pop_push);
+            g_free(path);
+        }
+    }
+
+    return g_test_run();
+}
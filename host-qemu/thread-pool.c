@@ -46,7 +46,9 @@ struct ThreadPoolElement {
     enum ThreadState state;
     int ret;
 
-    /* Access to this list is protected by lock.  */
+    /* Links the element into request_list, done_list or completed.  Access
+     * to the first two lists is protected by lock.
+     */
     QTAILQ_ENTRY(ThreadPoolElement) reqs;
 
     /* Access to this list is protected by the global mutex.  */
@@ -64,16 +66,116 @@ struct ThreadPool {
 
     /* The following variables are only accessed from one AioContext. */
     QLIST_HEAD(, ThreadPoolElement) head;
+    QTAILQ_HEAD(, ThreadPoolElement) completed; /* callbacks not run yet */
 
     /* The following variables are protected by lock.  */
     QTAILQ_HEAD(, ThreadPoolElement) request_list;
+    QTAILQ_HEAD(, ThreadPoolElement) done_list; /* finished by workers */
     int cur_threads;
     int idle_threads;
     int new_threads;     /* backlog of threads we need to create */
     int pending_threads; /* threads created but not running yet */
+    int queued;          /* length of request_list */
+    int active;          /* requests being run, possibly by other pools */
+    uint64_t completed_reqs;
+    uint64_t stolen_reqs; /* requests run by other pools' workers */
     bool stopping;
+
+    /* Protected by thread_pools_lock.  */
+    QLIST_ENTRY(ThreadPool) next;
 };
 
+/* All pools, so that idle workers can take requests from busy pools */
+static QemuMutex thread_pools_lock;
+static QLIST_HEAD(, ThreadPool) thread_pools =
+    QLIST_HEAD_INITIALIZER(thread_pools);
+
+static void __attribute__((constructor)) thread_pools_init(void)
+{
+    qemu_mutex_init(&thread_pools_lock);
+}
+
+/* Hand a finished request over to the completion BH of its pool.  Called
+ * with pool->lock held.  The BH is only scheduled when done_list goes from
+ * empty to non-empty; it picks up everything that finished meanwhile.
+ */
+static void thread_pool_done_locked(ThreadPool *pool, ThreadPoolElement *req)
+{
+    if (QTAILQ_EMPTY(&pool->done_list)) {
+        qemu_bh_schedule(pool->completion_bh);
+    }
+    QTAILQ_INSERT_TAIL(&pool->done_list, req, reqs);
+    pool->completed_reqs++;
+}
+
+/* Take the first queued request of a pool.  Called with pool->lock held
+ * after consuming one count of pool->sem.
+ */
+static ThreadPoolElement *thread_pool_dequeue_locked(ThreadPool *pool)
+{
+    ThreadPoolElement *req = QTAILQ_FIRST(&pool->request_list);
+
+    if (req) {
+        QTAILQ_REMOVE(&pool->request_list, req, reqs);
+        req->state = THREAD_ACTIVE;
+        pool->queued--;
+        pool->active++;
+    }
+    return req;
+}
+
+/* Take a queued request from another pool on behalf of an idle worker of
+ * @thief.  Called without locks held.
+ */
+static ThreadPoolElement *thread_pool_steal(ThreadPool *thief)
+{
+    ThreadPool *pool;
+    ThreadPoolElement *req = NULL;
+
+    qemu_mutex_lock(&thread_pools_lock);
+    QLIST_FOREACH(pool, &thread_pools, next) {
+        if (pool == thief || !atomic_read(&pool->queued)) {
+            continue;
+        }
+
+        qemu_mutex_lock(&pool->lock);
+        /* As in thread_pool_cancel, taking a count of the semaphore with
+         * the lock held keeps the pool's own workers from waiting for the
+         * request that we take.
+         */
+        if (!QTAILQ_EMPTY(&pool->request_list) &&
+            qemu_sem_timedwait(&pool->sem, 0) == 0) {
+            req = thread_pool_dequeue_locked(pool);
+            pool->stolen_reqs++;
+        }
+        qemu_mutex_unlock(&pool->lock);
+        if (req) {
+            break;
+        }
+    }
+    qemu_mutex_unlock(&thread_pools_lock);
+    return req;
+}
+
+/* Wake up an idle worker of another pool to help @busy, whose workers are
+ * all taken.  Called without locks held.
+ */
+static void thread_pool_kick(ThreadPool *busy)
+{
+    ThreadPool *pool;
+
+    qemu_mutex_lock(&thread_pools_lock);
+    QLIST_FOREACH(pool, &thread_pools, next) {
+        if (pool != busy &&
+            atomic_read(&pool->idle_threads) > atomic_read(&pool->queued)) {
+            /* The worker finds no request of its own and steals one */
+            qemu_sem_post(&pool->sem);
+            break;
+        }
+    }
+    qemu_mutex_unlock(&thread_pools_lock);
+}
+
 static void *worker_thread(void *opaque)
 {
     ThreadPool *pool = opaque;
@@ -84,6 +186,7 @@ static void *worker_thread(void *opaque)
 
     while (!pool->stopping) {
         ThreadPoolElement *req;
+        ThreadPool *owner;
         int ret;
 
         do {
@@ -97,11 +200,18 @@ static void *worker_thread(void *opaque)
             break;
         }
 
-        req = QTAILQ_FIRST(&pool->request_list);
-        QTAILQ_REMOVE(&pool->request_list, req, reqs);
-        req->state = THREAD_ACTIVE;
+        req = thread_pool_dequeue_locked(pool);
         qemu_mutex_unlock(&pool->lock);
 
+        if (!req) {
+            /* Woken up by thread_pool_kick(), or our request was stolen */
+            req = thread_pool_steal(pool);
+            if (!req) {
+                qemu_mutex_lock(&pool->lock);
+                continue;
+            }
+        }
+
         ret = req->func(req->arg);
 
         req->ret = ret;
@@ -109,9 +219,18 @@ static void *worker_thread(void *opaque)
         smp_wmb();
         req->state = THREAD_DONE;
 
-        qemu_mutex_lock(&pool->lock);
-
-        qemu_bh_schedule(pool->completion_bh);
+        owner = req->pool;
+        if (owner != pool) {
+            qemu_mutex_lock(&owner->lock);
+            owner->active--;
+            thread_pool_done_locked(owner, req);
+            qemu_mutex_unlock(&owner->lock);
+            qemu_mutex_lock(&pool->lock);
+        } else {
+            qemu_mutex_lock(&pool->lock);
+            pool->active--;
+            thread_pool_done_locked(pool, req);
+        }
     }
 
     pool->cur_threads--;
@@ -163,16 +282,20 @@ static void spawn_thread(ThreadPool *pool)
 static void thread_pool_completion_bh(void *opaque)
 {
     ThreadPool *pool = opaque;
-    ThreadPoolElement *elem, *next;
+    ThreadPoolElement *elem;
 
-restart:
-    QLIST_FOREACH_SAFE(elem, &pool->head, all, next) {
-        if (elem->state != THREAD_DONE) {
-            continue;
-        }
+    /* Take all the requests that finished since the last run at once */
+    qemu_mutex_lock(&pool->lock);
+    while ((elem = QTAILQ_FIRST(&pool->done_list))) {
+        QTAILQ_REMOVE(&pool->done_list, elem, reqs);
+        QTAILQ_INSERT_TAIL(&pool->completed, elem, reqs);
+    }
+    qemu_mutex_unlock(&pool->lock);
 
+    while ((elem = QTAILQ_FIRST(&pool->completed))) {
         trace_thread_pool_complete(pool, elem, elem->common.opaque,
                                    elem->ret);
+        QTAILQ_REMOVE(&pool->completed, elem, reqs);
         QLIST_REMOVE(elem, all);
 
         if (elem->common.cb) {
@@ -185,11 +308,8 @@ restart:
             qemu_bh_schedule(pool->completion_bh);
 
             elem->common.cb(elem->common.opaque, elem->ret);
-            qemu_aio_unref(elem);
-            goto restart;
-        } else {
-            qemu_aio_unref(elem);
         }
+        qemu_aio_unref(elem);
     }
 }
 
@@ -209,10 +329,11 @@ static void thread_pool_cancel(BlockAIOCB *acb)
          */
         qemu_sem_timedwait(&pool->sem, 0) == 0) {
         QTAILQ_REMOVE(&pool->request_list, elem, reqs);
-        qemu_bh_schedule(pool->completion_bh);
+        pool->queued--;
 
         elem->state = THREAD_DONE;
         elem->ret = -ECANCELED;
+        thread_pool_done_locked(pool, elem);
     }
 
     qemu_mutex_unlock(&pool->lock);
@@ -236,6 +357,7 @@ BlockAIOCB *thread_pool_submit_aio(ThreadPool *pool,
         BlockCompletionFunc *cb, void *opaque)
 {
     ThreadPoolElement *req;
+    bool saturated;
 
     req = qemu_aio_get(&thread_pool_aiocb_info, NULL, cb, opaque);
     req->func = func;
@@ -252,8 +374,16 @@ BlockAIOCB *thread_pool_submit_aio(ThreadPool *pool,
         spawn_thread(pool);
     }
     QTAILQ_INSERT_TAIL(&pool->request_list, req, reqs);
+    pool->queued++;
+    saturated = pool->cur_threads >= pool->max_threads &&
+                pool->queued > pool->idle_threads;
     qemu_mutex_unlock(&pool->lock);
     qemu_sem_post(&pool->sem);
+
+    /* All our workers are busy, let an idle worker elsewhere help */
+    if (saturated) {
+        thread_pool_kick(pool);
+    }
     return &req->common;
 }
 
@@ -301,7 +431,13 @@ static void thread_pool_init_one(ThreadPool *pool, AioContext *ctx)
     pool->new_thread_bh = aio_bh_new(ctx, spawn_thread_bh_fn, pool);
 
     QLIST_INIT(&pool->head);
+    QTAILQ_INIT(&pool->completed);
     QTAILQ_INIT(&pool->request_list);
+    QTAILQ_INIT(&pool->done_list);
+
+    qemu_mutex_lock(&thread_pools_lock);
+    QLIST_INSERT_HEAD(&thread_pools, pool, next);
+    qemu_mutex_unlock(&thread_pools_lock);
 }
 
 ThreadPool *thread_pool_new(AioContext *ctx)
@@ -311,6 +447,19 @@ ThreadPool *thread_pool_new(AioContext *ctx)
     return pool;
 }
 
+void thread_pool_get_stats(ThreadPool *pool, ThreadPoolStats *stats)
+{
+    qemu_mutex_lock(&pool->lock);
+    stats->max_threads = pool->max_threads;
+    stats->threads = pool->cur_threads;
+    stats->idle_threads = pool->idle_threads;
+    stats->active = pool->active;
+    stats->queued = pool->queued;
+    stats->completed = pool->completed_reqs;
+    stats->stolen = pool->stolen_reqs;
+    qemu_mutex_unlock(&pool->lock);
+}
+
 void thread_pool_free(ThreadPool *pool)
 {
     if (!pool) {
@@ -319,6 +468,11 @@ void thread_pool_free(ThreadPool *pool)
 
     assert(QLIST_EMPTY(&pool->head));
 
+    /* No other pool's worker can take a request from us after this */
+    qemu_mutex_lock(&thread_pools_lock);
+    QLIST_REMOVE(pool, next);
+    qemu_mutex_unlock(&thread_pools_lock);
+
     qemu_mutex_lock(&pool->lock);
 
     /* Stop new threads from spawning */
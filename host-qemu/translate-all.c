@@ -59,6 +59,7 @@
 
 #include "exec/cputlb.h"
 #include "exec/tb-hash.h"
+#include "exec/tb-cache.h"
 #include "translate-all.h"
 #include "qemu/bitmap.h"
 #include "qemu/timer.h"
@@ -159,6 +160,7 @@ int cpu_gen_code(CPUArchState *env, TranslationBlock *tb, int *gen_code_size_ptr
     ti = profile_getclock();
 #endif
     tcg_func_start(s);
+    s->reloc_tb = (uintptr_t)tb;
 
     gen_intermediate_code(env, tb);
 
@@ -995,6 +997,75 @@ static void build_page_bitmap(PageDesc *p)
     }
 }
 
+/* TB profiling: when enabled, every TB gets a pointer to the statistics
+   for its guest PC and gen_tb_start emits an increment of its execution
+   counter.  Toggling the profiler flushes the code buffer, so that no
+   TB is left with (or without) the counter.  */
+bool tb_profile_enabled;
+static GHashTable *tb_profile_table;
+
+static TBProfile *tb_profile_get(target_ulong pc)
+{
+    uint64_t key = pc;
+    TBProfile *prof;
+
+    if (!tb_profile_table) {
+        tb_profile_table = g_hash_table_new_full(g_int64_hash, g_int64_equal,
+                                                 NULL, g_free);
+    }
+    prof = g_hash_table_lookup(tb_profile_table, &key);
+    if (!prof) {
+        prof = g_new0(TBProfile, 1);
+        prof->pc = pc;
+        g_hash_table_insert(tb_profile_table, &prof->pc, prof);
+    }
+    return prof;
+}
+
+void tb_profile_set_enabled(CPUState *cpu, bool enable)
+{
+    if (enable != tb_profile_enabled) {
+        tb_profile_enabled = enable;
+        tb_flush(cpu);
+    }
+}
+
+void tb_profile_reset(CPUState *cpu)
+{
+    if (!tb_profile_table) {
+        return;
+    }
+    /* Live TBs point into the table.  */
+    if (tb_profile_enabled) {
+        tb_flush(cpu);
+    }
+    g_hash_table_remove_all(tb_profile_table);
+}
+
+typedef struct TBProfileForeach {
+    void (*fn)(TBProfile *prof, void *opaque);
+    void *opaque;
+} TBProfileForeach;
+
+static void tb_profile_foreach_entry(gpointer key, gpointer value,
+                                     gpointer opaque)
+{
+    TBProfileForeach *data = opaque;
+
+    data->fn(value, data->opaque);
+}
+
+void tb_profile_foreach(void (*fn)(TBProfile *prof, void *opaque),
+                        void *opaque)
+{
+    TBProfileForeach data = { .fn = fn, .opaque = opaque };
+
+    if (tb_profile_table) {
+        g_hash_table_foreach(tb_profile_table, tb_profile_foreach_entry,
+                             &data);
+    }
+}
+
 TranslationBlock *tb_gen_code(CPUState *cpu,
                               target_ulong pc, target_ulong cs_base,
                               int flags, int cflags)
@@ -1004,6 +1075,7 @@ TranslationBlock *tb_gen_code(CPUState *cpu,
     tb_page_addr_t phys_pc, phys_page2;
     target_ulong virt_page2;
     int code_gen_size;
+    int64_t ti = 0;
 
     phys_pc = get_page_addr_code(env, pc);
     if (use_icount) {
@@ -1022,7 +1094,27 @@ TranslationBlock *tb_gen_code(CPUState *cpu,
     tb->cs_base = cs_base;
     tb->flags = flags;
     tb->cflags = cflags;
+    tb->profile = NULL;
+    if (unlikely(tb_profile_enabled)) {
+        tb->profile = tb_profile_get(pc);
+        ti = get_clock();
+    }
+#ifdef CONFIG_SOFTMMU
+    if (!tb_cache_enabled ||
+        !tb_cache_load(cpu, tb, phys_pc, &code_gen_size)) {
+        cpu_gen_code(env, tb, &code_gen_size);
+        if (tb_cache_enabled) {
+            tb_cache_record(cpu, tb, phys_pc, code_gen_size);
+        }
+    }
+#else
     cpu_gen_code(env, tb, &code_gen_size);
+#endif
+    if (unlikely(tb->profile)) {
+        tb->profile->translations++;
+        tb->profile->gen_time += get_clock() - ti;
+        tb->profile->size = tb->size;
+    }
     tcg_ctx.code_gen_ptr = (void *)(((uintptr_t)tcg_ctx.code_gen_ptr +
             code_gen_size + CODE_GEN_ALIGN - 1) & ~(CODE_GEN_ALIGN - 1));
 
@@ -1619,6 +1711,9 @@ void dump_exec_info(FILE *f, fprintf_function cpu_fprintf)
     cpu_fprintf(f, "TB invalidate count %d\n",
             tcg_ctx.tb_ctx.tb_phys_invalidate_count);
     cpu_fprintf(f, "TLB flush count     %d\n", tlb_flush_count);
+#ifdef CONFIG_SOFTMMU
+    tb_cache_dump_info(f, cpu_fprintf);
+#endif
     tcg_dump_info(f, cpu_fprintf);
 }
 
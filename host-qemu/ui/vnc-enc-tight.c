@@ -1176,52 +1176,135 @@ static void jpeg_term_destination(j_compress_ptr cinfo)
     buffer->offset = buffer->capacity - cinfo->dest->free_in_buffer;
 }
 
-static int send_jpeg_rect(VncState *vs, int x, int y, int w, int h, int quality)
-{
+/*
+ * Each client keeps one compressor, so that the tables and buffers of
+ * libjpeg are set up once rather than for every rectangle.
+ */
+typedef struct VncTightJpeg {
     struct jpeg_compress_struct cinfo;
     struct jpeg_error_mgr jerr;
     struct jpeg_destination_mgr manager;
+    int quality;
+    /* Without libjpeg-turbo rows are converted to RGB here first */
     pixman_image_t *linebuf;
-    JSAMPROW row[1];
-    uint8_t *buf;
-    int dy;
+    int linebuf_width;
+} VncTightJpeg;
 
-    if (surface_bytes_per_pixel(vs->vd->ds) == 1) {
-        return send_full_color_rect(vs, x, y, w, h);
-    }
+/* Rows passed to libjpeg in one call */
+#define TIGHT_JPEG_ROWS 16
 
-    buffer_reserve(&vs->tight.jpeg, 2048);
+#ifdef JCS_EXTENSIONS
+/* libjpeg-turbo reads the server surface, PIXMAN_x8r8g8b8, directly */
+#define TIGHT_JPEG_COMPONENTS 4
+#ifdef HOST_WORDS_BIGENDIAN
+#define TIGHT_JPEG_COLOR_SPACE JCS_EXT_XRGB
+#else
+#define TIGHT_JPEG_COLOR_SPACE JCS_EXT_BGRX
+#endif
+#else
+#define TIGHT_JPEG_COMPONENTS 3
+#define TIGHT_JPEG_COLOR_SPACE JCS_RGB
+#endif
 
-    cinfo.err = jpeg_std_error(&jerr);
-    jpeg_create_compress(&cinfo);
+static VncTightJpeg *tight_jpeg_get(VncState *vs, int quality)
+{
+    VncTightJpeg *jpeg = vs->tight.jpeg_ctx;
 
-    cinfo.client_data = vs;
-    cinfo.image_width = w;
-    cinfo.image_height = h;
-    cinfo.input_components = 3;
-    cinfo.in_color_space = JCS_RGB;
+    if (!jpeg) {
+        jpeg = g_new0(VncTightJpeg, 1);
+        jpeg->cinfo.err = jpeg_std_error(&jpeg->jerr);
+        jpeg_create_compress(&jpeg->cinfo);
 
-    jpeg_set_defaults(&cinfo);
-    jpeg_set_quality(&cinfo, quality, true);
+        jpeg->manager.init_destination = jpeg_init_destination;
+        jpeg->manager.empty_output_buffer = jpeg_empty_output_buffer;
+        jpeg->manager.term_destination = jpeg_term_destination;
+        jpeg->cinfo.dest = &jpeg->manager;
 
-    manager.init_destination = jpeg_init_destination;
-    manager.empty_output_buffer = jpeg_empty_output_buffer;
-    manager.term_destination = jpeg_term_destination;
-    cinfo.dest = &manager;
+        jpeg->cinfo.input_components = TIGHT_JPEG_COMPONENTS;
+        jpeg->cinfo.in_color_space = TIGHT_JPEG_COLOR_SPACE;
+        jpeg_set_defaults(&jpeg->cinfo);
+        jpeg->quality = -1;
+        vs->tight.jpeg_ctx = jpeg;
+    }
 
-    jpeg_start_compress(&cinfo, true);
+    if (jpeg->quality != quality) {
+        jpeg_set_quality(&jpeg->cinfo, quality, true);
+        jpeg->quality = quality;
+    }
+    /* The worker encodes with a copy of the client state */
+    jpeg->cinfo.client_data = vs;
+    return jpeg;
+}
 
-    linebuf = qemu_pixman_linebuf_create(PIXMAN_BE_r8g8b8, w);
-    buf = (uint8_t *)pixman_image_get_data(linebuf);
-    row[0] = buf;
+static void tight_jpeg_free(VncState *vs)
+{
+    VncTightJpeg *jpeg = vs->tight.jpeg_ctx;
+
+    if (!jpeg) {
+        return;
+    }
+    jpeg_destroy_compress(&jpeg->cinfo);
+    if (jpeg->linebuf) {
+        qemu_pixman_image_unref(jpeg->linebuf);
+    }
+    g_free(jpeg);
+    vs->tight.jpeg_ctx = NULL;
+}
+
+#ifdef JCS_EXTENSIONS
+static void tight_jpeg_write_rows(VncState *vs, VncTightJpeg *jpeg,
+                                  int x, int y, int w, int h)
+{
+    JSAMPROW rows[TIGHT_JPEG_ROWS];
+    int dy, i, n;
+
+    for (dy = 0; dy < h; dy += n) {
+        n = MIN(TIGHT_JPEG_ROWS, h - dy);
+        for (i = 0; i < n; i++) {
+            rows[i] = vnc_server_fb_ptr(vs->vd, x, y + dy + i);
+        }
+        jpeg_write_scanlines(&jpeg->cinfo, rows, n);
+    }
+}
+#else
+static void tight_jpeg_write_rows(VncState *vs, VncTightJpeg *jpeg,
+                                  int x, int y, int w, int h)
+{
+    JSAMPROW row[1];
+    int dy;
+
+    if (jpeg->linebuf_width < w) {
+        if (jpeg->linebuf) {
+            qemu_pixman_image_unref(jpeg->linebuf);
+        }
+        jpeg->linebuf = qemu_pixman_linebuf_create(PIXMAN_BE_r8g8b8, w);
+        jpeg->linebuf_width = w;
+    }
+    row[0] = (uint8_t *)pixman_image_get_data(jpeg->linebuf);
     for (dy = 0; dy < h; dy++) {
-        qemu_pixman_linebuf_fill(linebuf, vs->vd->server, w, x, y + dy);
-        jpeg_write_scanlines(&cinfo, row, 1);
+        qemu_pixman_linebuf_fill(jpeg->linebuf, vs->vd->server, w, x, y + dy);
+        jpeg_write_scanlines(&jpeg->cinfo, row, 1);
     }
-    qemu_pixman_image_unref(linebuf);
+}
+#endif
+
+static int send_jpeg_rect(VncState *vs, int x, int y, int w, int h, int quality)
+{
+    VncTightJpeg *jpeg;
+
+    if (surface_bytes_per_pixel(vs->vd->ds) == 1) {
+        return send_full_color_rect(vs, x, y, w, h);
+    }
+
+    buffer_reserve(&vs->tight.jpeg, 2048);
+
+    jpeg = tight_jpeg_get(vs, quality);
+    jpeg->cinfo.image_width = w;
+    jpeg->cinfo.image_height = h;
 
-    jpeg_finish_compress(&cinfo);
-    jpeg_destroy_compress(&cinfo);
+    jpeg_start_compress(&jpeg->cinfo, true);
+    tight_jpeg_write_rows(vs, jpeg, x, y, w, h);
+    jpeg_finish_compress(&jpeg->cinfo);
 
     vnc_write_u8(vs, VNC_TIGHT_JPEG << 4);
 
@@ -1691,6 +1774,7 @@ void vnc_tight_clear(VncState *vs)
     buffer_free(&vs->tight.gradient);
 #ifdef CONFIG_VNC_JPEG
     buffer_free(&vs->tight.jpeg);
+    tight_jpeg_free(vs);
 #endif
 #ifdef CONFIG_VNC_PNG
     buffer_free(&vs->tight.png);
@@ -36,34 +36,62 @@
  *
  * There are three levels of locking:
  * - jobs queue lock: for each operation on the queue (push, pop, isEmpty?)
- * - VncDisplay global lock: mainly used for framebuffer updates to avoid
- *                      screen corruption if the framebuffer is updated
- *                      while the worker is doing something.
+ *                    and for the VncState::jobs_* fields
+ * - VncDisplay global lock: decides who owns the server surface.  Encoding
+ *                      jobs of any number of workers read it and count
+ *                      themselves in VncDisplay::encoders; refresh jobs
+ *                      write it and run only while there is no encoder.
  * - VncState::output lock: used to make sure the output buffer is not corrupted
  *                          if two threads try to write on it at the same time
  *
- * While the VNC worker thread is working, the VncDisplay global lock is held
- * to avoid screen corruption (this does not block vnc_refresh() because it
- * uses trylock()) but the output lock is not held because the thread works on
- * its own output buffer.
- * When the encoding job is done, the worker thread will hold the output lock
- * and copy its output buffer in vs->output.
+ * Neither side ever waits for the other on a worker: a job that cannot get
+ * the server surface is simply left in the queue, and the workers look for
+ * another one.  vnc_refresh() on the main loop only starts a refresh when
+ * no encoder is running, and keeps new ones out until it could.  The
+ * synchronous refresh and the bitblit done by vnc_dpy_copy() keep them out
+ * as well, and wait for the running ones on VncDisplay::refresh_cond.
+ *
+ * The jobs of one client run one at a time and in order, so the zlib
+ * streams of the stateful encodings never see two threads.  The only
+ * exception are the bands that vnc_job_push() splits a large update into
+ * for stateless encodings, which cover disjoint rectangles.
+ *
+ * While a worker is encoding, the output lock is not held because the
+ * thread works on its own output buffer.  When the encoding job is done,
+ * the worker thread will hold the output lock and hand its output buffer
+ * over to vs->jobs_buffer, or copy it there if the main loop has not
+ * consumed the previous one yet.
+ *
+ * The locks are taken in this order: queue, display, output.
  */
 
+/* Updates with at least this many pixels are encoded in bands */
+#define VNC_JOB_BAND_MIN_PIXELS (256 * 256)
+/* Band boundaries are aligned to hextile tiles */
+#define VNC_JOB_BAND_ALIGN 16
+
+typedef struct VncJobQueue VncJobQueue;
+
+typedef struct VncWorker {
+    QemuThread thread;
+    Buffer buffer;
+    VncJobQueue *queue;
+} VncWorker;
+
 struct VncJobQueue {
     QemuCond cond;
     QemuMutex mutex;
-    QemuThread thread;
-    Buffer buffer;
+    VncWorker workers[VNC_WORKERS_MAX];
+    int nr_workers;
+    int nr_exited;
+    unsigned int scan;
+    unsigned int group;
     bool exit;
     QTAILQ_HEAD(, VncJob) jobs;
 };
 
-typedef struct VncJobQueue VncJobQueue;
-
 /*
- * We use a single global queue, but most of the functions are
- * already reentrant, so we can easily add more than one encoding thread
+ * We use a single global queue, served by one or more encoding threads
  */
 static VncJobQueue *queue;
 
@@ -103,23 +131,156 @@ int vnc_job_add_rect(VncJob *job, int x, int y, int w, int h)
     return 1;
 }
 
+static void vnc_job_free(VncJob *job)
+{
+    VncRectEntry *entry, *tmp;
+
+    QLIST_FOREACH_SAFE(entry, &job->rectangles, next, tmp) {
+        g_free(entry);
+    }
+    g_free(job);
+}
+
+/* raw and hextile keep no state from one rectangle to the next */
+static bool vnc_job_can_split(VncJob *job)
+{
+    VncRectEntry *entry;
+    uint64_t pixels = 0;
+
+    if (job->vs->vnc_encoding != VNC_ENCODING_RAW &&
+        job->vs->vnc_encoding != VNC_ENCODING_HEXTILE) {
+        return false;
+    }
+    QLIST_FOREACH(entry, &job->rectangles, next) {
+        pixels += entry->rect.w * entry->rect.h;
+    }
+    return pixels >= VNC_JOB_BAND_MIN_PIXELS;
+}
+
+/* Queue @job as one job per horizontal band, each of them sent as a
+ * framebuffer update message of its own.
+ */
+static void vnc_job_push_bands_locked(VncJob *job, int nbands)
+{
+    VncJob *bands[VNC_WORKERS_MAX], *last = NULL;
+    VncRectEntry *entry, *tmp;
+    int height = 0, band_h, i;
+
+    QLIST_FOREACH(entry, &job->rectangles, next) {
+        height = MAX(height, entry->rect.y + entry->rect.h);
+    }
+    band_h = ROUND_UP(DIV_ROUND_UP(height, nbands), VNC_JOB_BAND_ALIGN);
+
+    if (++queue->group == 0) {
+        queue->group = 1;
+    }
+    for (i = 0; i < nbands; i++) {
+        bands[i] = g_malloc0(sizeof(VncJob));
+        bands[i]->vs = job->vs;
+        bands[i]->group = queue->group;
+        QLIST_INIT(&bands[i]->rectangles);
+    }
+
+    QLIST_FOREACH_SAFE(entry, &job->rectangles, next, tmp) {
+        VncRect rect = entry->rect;
+
+        QLIST_REMOVE(entry, next);
+        g_free(entry);
+        while (rect.h > 0) {
+            int band = rect.y / band_h;
+            int h = MIN(rect.h, (band + 1) * band_h - rect.y);
+
+            entry = g_malloc0(sizeof(VncRectEntry));
+            entry->rect = rect;
+            entry->rect.h = h;
+            QLIST_INSERT_HEAD(&bands[band]->rectangles, entry, next);
+            rect.y += h;
+            rect.h -= h;
+        }
+    }
+
+    for (i = 0; i < nbands; i++) {
+        if (QLIST_EMPTY(&bands[i]->rectangles)) {
+            g_free(bands[i]);
+        } else {
+            QTAILQ_INSERT_TAIL(&queue->jobs, bands[i], next);
+            last = bands[i];
+        }
+    }
+
+    /* One fence per update, after the band that is sent last, see
+     * vnc_job_can_start_locked()
+     */
+    if (last) {
+        last->fence = job->fence;
+        last->fence_id = job->fence_id;
+    }
+    g_free(job);
+}
+
 void vnc_job_push(VncJob *job)
 {
     vnc_lock_queue(queue);
     if (queue->exit || QLIST_EMPTY(&job->rectangles)) {
-        g_free(job);
+        vnc_job_free(job);
     } else {
-        QTAILQ_INSERT_TAIL(&queue->jobs, job, next);
+        if (queue->nr_workers > 1 && vnc_job_can_split(job)) {
+            vnc_job_push_bands_locked(job, queue->nr_workers);
+        } else {
+            QTAILQ_INSERT_TAIL(&queue->jobs, job, next);
+        }
         qemu_cond_broadcast(&queue->cond);
     }
     vnc_unlock_queue(queue);
 }
 
+int vnc_jobs_refresh(VncDisplay *vd, int height)
+{
+    VncJob *job;
+    int nbands, band_h, y;
+
+    if (!height) {
+        return 0;
+    }
+
+    vnc_lock_queue(queue);
+    /* Bands are aligned to the rectangles of the update statistics */
+    nbands = MIN(queue->nr_workers, DIV_ROUND_UP(height, VNC_STAT_RECT));
+    band_h = ROUND_UP(DIV_ROUND_UP(height, nbands), VNC_STAT_RECT);
+    nbands = DIV_ROUND_UP(height, band_h);
+
+    vnc_lock_display(vd);
+    vd->refresh_pending = nbands;
+    vnc_unlock_display(vd);
+
+    for (y = 0; y < height; y += band_h) {
+        job = g_malloc0(sizeof(VncJob));
+        job->refresh = vd;
+        job->y = y;
+        job->h = MIN(band_h, height - y);
+        QLIST_INIT(&job->rectangles);
+        QTAILQ_INSERT_HEAD(&queue->jobs, job, next);
+    }
+    qemu_cond_broadcast(&queue->cond);
+    vnc_unlock_queue(queue);
+    return nbands;
+}
+
+void vnc_jobs_kick(void)
+{
+    vnc_lock_queue(queue);
+    qemu_cond_broadcast(&queue->cond);
+    vnc_unlock_queue(queue);
+}
+
 static bool vnc_has_job_locked(VncState *vs)
 {
     VncJob *job;
 
     QTAILQ_FOREACH(job, &queue->jobs, next) {
+        if (job->refresh) {
+            continue;
+        }
         if (job->vs == vs || !vs) {
             return true;
         }
@@ -143,8 +304,13 @@ void vnc_jobs_clear(VncState *vs)
 
     vnc_lock_queue(queue);
     QTAILQ_FOREACH_SAFE(job, &queue->jobs, next, tmp) {
+        /* running jobs are removed by their worker */
+        if (job->refresh || job->running) {
+            continue;
+        }
         if (job->vs == vs || !vs) {
             QTAILQ_REMOVE(&queue->jobs, job, next);
+            vnc_job_free(job);
         }
     }
     vnc_unlock_queue(queue);
@@ -152,6 +318,11 @@ void vnc_jobs_clear(VncState *vs)
 
 void vnc_jobs_join(VncState *vs)
 {
+    /* The jobs may be waiting for a refresh that only the main loop can
+     * complete.
+     */
+    vnc_refresh_join(vs->vd);
+
     vnc_lock_queue(queue);
     while (vnc_has_job_locked(vs)) {
         qemu_cond_wait(&queue->cond, &queue->mutex);
@@ -166,8 +337,7 @@ void vnc_jobs_consume_buffer(VncState *vs)
 
     vnc_lock_output(vs);
     if (vs->jobs_buffer.offset) {
-        vnc_write(vs, vs->jobs_buffer.buffer, vs->jobs_buffer.offset);
-        buffer_reset(&vs->jobs_buffer);
+        vnc_write_buffer(vs, &vs->jobs_buffer);
     }
     flush = vs->csock != -1 && vs->abort != true;
     vnc_unlock_output(vs);
@@ -180,7 +350,8 @@ void vnc_jobs_consume_buffer(VncState *vs)
 /*
  * Copy data for local use
  */
-static void vnc_async_encoding_start(VncState *orig, VncState *local)
+static void vnc_async_encoding_start(VncWorker *worker, VncState *orig,
+                                     VncState *local)
 {
     local->vnc_encoding = orig->vnc_encoding;
     local->features = orig->features;
@@ -193,52 +364,99 @@ static void vnc_async_encoding_start(VncState *orig, VncState *local)
     local->zlib = orig->zlib;
     local->hextile = orig->hextile;
     local->zrle = orig->zrle;
-    local->output =  queue->buffer;
+    local->output =  worker->buffer;
     local->csock = -1; /* Don't do any network work on this thread */
 
     buffer_reset(&local->output);
 }
 
-static void vnc_async_encoding_end(VncState *orig, VncState *local)
+static void vnc_async_encoding_end(VncWorker *worker, VncJob *job,
+                                   VncState *local)
 {
-    orig->tight = local->tight;
-    orig->zlib = local->zlib;
-    orig->hextile = local->hextile;
-    orig->zrle = local->zrle;
-    orig->lossy_rect = local->lossy_rect;
+    VncState *orig = job->vs;
+
+    /* Bands of one update run in parallel and use stateless encodings */
+    if (!job->group) {
+        orig->tight = local->tight;
+        orig->zlib = local->zlib;
+        orig->hextile = local->hextile;
+        orig->zrle = local->zrle;
+        orig->lossy_rect = local->lossy_rect;
+    }
+
+    worker->buffer = local->output;
+}
+
+/* Can @job start now?  Called with the queue lock held. */
+static bool vnc_job_can_start_locked(VncJobQueue *queue, VncJob *job)
+{
+    VncState *vs = job->vs;
+
+    if (job->refresh) {
+        return true;
+    }
+
+    /* Only the oldest job of each client that is not running is eligible */
+    if (vs->jobs_scan == queue->scan) {
+        return false;
+    }
+    vs->jobs_scan = queue->scan;
 
-    queue->buffer = local->output;
+    if (vs->jobs_running && (!job->group || job->group != vs->jobs_group)) {
+        return false;
+    }
+    /* The fenced band of an update waits for the other ones, so that the
+     * fence follows all of them on the wire.
+     */
+    if (vs->jobs_running && job->fence) {
+        return false;
+    }
+    return vnc_display_start_encoding(vs->vd);
 }
 
-static int vnc_worker_thread_loop(VncJobQueue *queue)
+static VncJob *vnc_queue_next_job_locked(VncJobQueue *queue)
 {
     VncJob *job;
+
+    queue->scan++;
+    QTAILQ_FOREACH(job, &queue->jobs, next) {
+        if (!job->running && vnc_job_can_start_locked(queue, job)) {
+            job->running = true;
+            if (job->vs) {
+                job->vs->jobs_running++;
+                job->vs->jobs_group = job->group;
+            }
+            return job;
+        }
+    }
+    return NULL;
+}
+
+static void vnc_worker_refresh(VncJob *job)
+{
+    int has_dirty;
+
+    has_dirty = vnc_refresh_server_rows(job->refresh, job->y, job->h);
+    vnc_refresh_done(job->refresh, has_dirty);
+}
+
+static void vnc_worker_encode(VncWorker *worker, VncJob *job)
+{
     VncRectEntry *entry, *tmp;
     VncState vs;
     int n_rectangles;
     int saved_offset;
 
-    vnc_lock_queue(queue);
-    while (QTAILQ_EMPTY(&queue->jobs) && !queue->exit) {
-        qemu_cond_wait(&queue->cond, &queue->mutex);
-    }
-    /* Here job can only be NULL if queue->exit is true */
-    job = QTAILQ_FIRST(&queue->jobs);
-    vnc_unlock_queue(queue);
-
-    if (queue->exit) {
-        return -1;
-    }
-
     vnc_lock_output(job->vs);
     if (job->vs->csock == -1 || job->vs->abort == true) {
         vnc_unlock_output(job->vs);
-        goto disconnected;
+        vnc_display_end_encoding(job->vs->vd);
+        return;
     }
     vnc_unlock_output(job->vs);
 
     /* Make a local copy of vs and switch output buffers */
-    vnc_async_encoding_start(job->vs, &vs);
+    vnc_async_encoding_start(worker, job->vs, &vs);
 
     /* Start sending rectangles */
     n_rectangles = 0;
@@ -247,15 +465,14 @@ static int vnc_worker_thread_loop(VncJobQueue *queue)
     saved_offset = vs.output.offset;
     vnc_write_u16(&vs, 0);
 
-    vnc_lock_display(job->vs->vd);
     QLIST_FOREACH_SAFE(entry, &job->rectangles, next, tmp) {
         int n;
 
         if (job->vs->csock == -1) {
-            vnc_unlock_display(job->vs->vd);
+            vnc_display_end_encoding(job->vs->vd);
             /* Copy persistent encoding data */
-            vnc_async_encoding_end(job->vs, &vs);
-            goto disconnected;
+            vnc_async_encoding_end(worker, job, &vs);
+            return;
         }
 
         n = vnc_send_framebuffer_update(&vs, entry->rect.x, entry->rect.y,
@@ -264,35 +481,77 @@ static int vnc_worker_thread_loop(VncJobQueue *queue)
         if (n >= 0) {
             n_rectangles += n;
         }
+        QLIST_REMOVE(entry, next);
         g_free(entry);
     }
-    vnc_unlock_display(job->vs->vd);
+    vnc_display_end_encoding(job->vs->vd);
 
     /* Put n_rectangles at the beginning of the message */
     vs.output.buffer[saved_offset] = (n_rectangles >> 8) & 0xFF;
     vs.output.buffer[saved_offset + 1] = n_rectangles & 0xFF;
 
+    /* The client answers once it has processed the update */
+    if (job->fence) {
+        uint8_t id[4];
+
+        stl_be_p(id, job->fence_id);
+        vnc_write_fence(&vs, VNC_FENCE_REQUEST | VNC_FENCE_BLOCK_BEFORE,
+                        sizeof(id), id);
+    }
+
     vnc_lock_output(job->vs);
     if (job->vs->csock != -1) {
-        buffer_reserve(&job->vs->jobs_buffer, vs.output.offset);
-        buffer_append(&job->vs->jobs_buffer, vs.output.buffer,
-                      vs.output.offset);
+        if (!job->vs->jobs_buffer.offset) {
+            Buffer tmp = job->vs->jobs_buffer;
+
+            job->vs->jobs_buffer = vs.output;
+            vs.output = tmp;
+        } else {
+            buffer_reserve(&job->vs->jobs_buffer, vs.output.offset);
+            buffer_append(&job->vs->jobs_buffer, vs.output.buffer,
+                          vs.output.offset);
+        }
         /* Copy persistent encoding data */
-        vnc_async_encoding_end(job->vs, &vs);
+        vnc_async_encoding_end(worker, job, &vs);
 
 	qemu_bh_schedule(job->vs->bh);
     }  else {
         /* Copy persistent encoding data */
-        vnc_async_encoding_end(job->vs, &vs);
+        vnc_async_encoding_end(worker, job, &vs);
     }
     vnc_unlock_output(job->vs);
+}
+
+static int vnc_worker_thread_loop(VncWorker *worker)
+{
+    VncJobQueue *queue = worker->queue;
+    VncJob *job = NULL;
+
+    vnc_lock_queue(queue);
+    while (!queue->exit && !(job = vnc_queue_next_job_locked(queue))) {
+        qemu_cond_wait(&queue->cond, &queue->mutex);
+    }
+    vnc_unlock_queue(queue);
+
+    /* Here job can only be NULL if queue->exit is true */
+    if (!job) {
+        return -1;
+    }
+
+    if (job->refresh) {
+        vnc_worker_refresh(job);
+    } else {
+        vnc_worker_encode(worker, job);
+    }
 
-disconnected:
     vnc_lock_queue(queue);
     QTAILQ_REMOVE(&queue->jobs, job, next);
+    if (job->vs) {
+        job->vs->jobs_running--;
+    }
     vnc_unlock_queue(queue);
     qemu_cond_broadcast(&queue->cond);
-    g_free(job);
+    vnc_job_free(job);
     return 0;
 }
 
@@ -308,21 +567,33 @@ static VncJobQueue *vnc_queue_init(void)
 
 static void vnc_queue_clear(VncJobQueue *q)
 {
+    int i;
+
     qemu_cond_destroy(&queue->cond);
     qemu_mutex_destroy(&queue->mutex);
-    buffer_free(&queue->buffer);
+    for (i = 0; i < q->nr_workers; i++) {
+        buffer_free(&q->workers[i].buffer);
+    }
     g_free(q);
     queue = NULL; /* Unset global queue */
 }
 
 static void *vnc_worker_thread(void *arg)
 {
-    VncJobQueue *queue = arg;
+    VncWorker *worker = arg;
+    VncJobQueue *queue = worker->queue;
+    bool last;
+
+    qemu_thread_get_self(&worker->thread);
 
-    qemu_thread_get_self(&queue->thread);
+    while (!vnc_worker_thread_loop(worker)) ;
 
-    while (!vnc_worker_thread_loop(queue)) ;
-    vnc_queue_clear(queue);
+    vnc_lock_queue(queue);
+    last = ++queue->nr_exited == queue->nr_workers;
+    vnc_unlock_queue(queue);
+    if (last) {
+        vnc_queue_clear(queue);
+    }
     return NULL;
 }
 
@@ -331,6 +602,15 @@ static bool vnc_worker_thread_running(void)
     return queue; /* Check global queue */
 }
 
+static void vnc_start_worker_locked(VncJobQueue *q)
+{
+    VncWorker *worker = &q->workers[q->nr_workers++];
+
+    worker->queue = q;
+    qemu_thread_create(&worker->thread, "vnc_worker", vnc_worker_thread,
+                       worker, QEMU_THREAD_DETACHED);
+}
+
 void vnc_start_worker_thread(void)
 {
     VncJobQueue *q;
@@ -339,7 +619,19 @@ void vnc_start_worker_thread(void)
         return ;
 
     q = vnc_queue_init();
-    qemu_thread_create(&q->thread, "vnc_worker", vnc_worker_thread, q,
-                       QEMU_THREAD_DETACHED);
+    vnc_lock_queue(q);
+    vnc_start_worker_locked(q);
+    vnc_unlock_queue(q);
     queue = q; /* Set global queue */
 }
+
+void vnc_jobs_set_workers(int n)
+{
+    assert(n <= VNC_WORKERS_MAX);
+
+    vnc_lock_queue(queue);
+    while (queue->nr_workers < n) {
+        vnc_start_worker_locked(queue);
+    }
+    vnc_unlock_queue(queue);
+}
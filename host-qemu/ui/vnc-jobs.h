@@ -30,6 +30,8 @@
 #ifndef VNC_JOBS_H
 #define VNC_JOBS_H
 
+#define VNC_WORKERS_MAX 64
+
 /* Jobs */
 VncJob *vnc_job_new(VncState *vs);
 int vnc_job_add_rect(VncJob *job, int x, int y, int w, int h);
@@ -40,6 +42,11 @@ void vnc_jobs_join(VncState *vs);
 
 void vnc_jobs_consume_buffer(VncState *vs);
 void vnc_start_worker_thread(void);
+void vnc_jobs_set_workers(int n);
+
+/* Server surface refresh */
+int vnc_jobs_refresh(VncDisplay *vd, int height);
+void vnc_jobs_kick(void);
 
 /* Locks */
 static inline int vnc_trylock_display(VncDisplay *vd)
@@ -57,6 +64,34 @@ static inline void vnc_unlock_display(VncDisplay *vd)
     qemu_mutex_unlock(&vd->mutex);
 }
 
+/*
+ * Encoders share the server surface, a refresh owns it.  Starting to encode
+ * never waits: the caller leaves the job in the queue if a refresh is
+ * running or waiting for the encoders to drain.
+ */
+static inline bool vnc_display_start_encoding(VncDisplay *vd)
+{
+    bool ok;
+
+    vnc_lock_display(vd);
+    ok = !vd->refreshing && !vd->refresh_wanted;
+    if (ok) {
+        vd->encoders++;
+    }
+    vnc_unlock_display(vd);
+    return ok;
+}
+
+static inline void vnc_display_end_encoding(VncDisplay *vd)
+{
+    vnc_lock_display(vd);
+    if (--vd->encoders == 0) {
+        /* for vnc_refresh_server_surface() */
+        qemu_cond_broadcast(&vd->refresh_cond);
+    }
+    vnc_unlock_display(vd);
+}
+
 static inline void vnc_lock_output(VncState *vs)
 {
     qemu_mutex_lock(&vs->output_mutex);
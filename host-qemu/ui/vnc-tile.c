@@ -0,0 +1,375 @@
+/*
+ * QEMU VNC display driver: server surface tile compare and copy
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include "qemu-common.h"
+#include "qemu/host-utils.h"
+#include "vnc-tile.h"
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#endif
+#ifdef CONFIG_AVX2_OPT
+#include <immintrin.h>
+#endif
+
+/*
+ * Each of the kernels below handles the tiles of one word of a dirty map.
+ * Whole tiles are compared and copied with vector loads and stores, the
+ * short tile at the end of a row with memcmp() and memcpy().
+ */
+typedef unsigned long (*VncTileSyncFunc)(void *dst, const void *src,
+                                         unsigned long dirty, int bytes);
+typedef unsigned long (*VncTileSyncRGB565Func)(uint32_t *dst,
+                                               const uint16_t *src,
+                                               unsigned long dirty,
+                                               int pixels);
+
+/* The same expansion as pixman: the top bits are replicated below */
+static inline uint32_t rgb565_to_server(uint16_t p)
+{
+    uint32_t r = p >> 11;
+    uint32_t g = (p >> 5) & 0x3f;
+    uint32_t b = p & 0x1f;
+
+    return ((r << 3 | r >> 2) << 16) | ((g << 2 | g >> 4) << 8) |
+           (b << 3 | b >> 2);
+}
+
+static bool tile_sync_bytes(uint8_t *dst, const uint8_t *src, int n)
+{
+    if (memcmp(dst, src, n) == 0) {
+        return false;
+    }
+    memcpy(dst, src, n);
+    return true;
+}
+
+static bool tile_sync_rgb565_pixels(uint32_t *dst, const uint16_t *src, int n)
+{
+    uint32_t buf[VNC_TILE_PIXELS];
+    int i;
+
+    for (i = 0; i < n; i++) {
+        buf[i] = rgb565_to_server(src[i]);
+    }
+    return tile_sync_bytes((uint8_t *)dst, (uint8_t *)buf, n * 4);
+}
+
+#if defined(__SSE2__)
+
+static inline bool tile_sync_full(uint8_t *dst, const uint8_t *src)
+{
+    __m128i s0 = _mm_loadu_si128((const __m128i *)src);
+    __m128i s1 = _mm_loadu_si128((const __m128i *)(src + 16));
+    __m128i s2 = _mm_loadu_si128((const __m128i *)(src + 32));
+    __m128i s3 = _mm_loadu_si128((const __m128i *)(src + 48));
+    __m128i eq;
+
+    eq = _mm_and_si128(
+        _mm_and_si128(
+            _mm_cmpeq_epi8(s0, _mm_loadu_si128((const __m128i *)dst)),
+            _mm_cmpeq_epi8(s1, _mm_loadu_si128((const __m128i *)(dst + 16)))),
+        _mm_and_si128(
+            _mm_cmpeq_epi8(s2, _mm_loadu_si128((const __m128i *)(dst + 32))),
+            _mm_cmpeq_epi8(s3, _mm_loadu_si128((const __m128i *)(dst + 48)))));
+    if (_mm_movemask_epi8(eq) == 0xffff) {
+        return false;
+    }
+    _mm_storeu_si128((__m128i *)dst, s0);
+    _mm_storeu_si128((__m128i *)(dst + 16), s1);
+    _mm_storeu_si128((__m128i *)(dst + 32), s2);
+    _mm_storeu_si128((__m128i *)(dst + 48), s3);
+    return true;
+}
+
+/* Convert 8 pixels; the first four end up in *lo, the others in *hi */
+static inline void rgb565_to_server_sse2(__m128i p, __m128i *lo, __m128i *hi)
+{
+    __m128i r = _mm_srli_epi16(p, 11);
+    __m128i g = _mm_and_si128(_mm_srli_epi16(p, 5), _mm_set1_epi16(0x3f));
+    __m128i b = _mm_and_si128(p, _mm_set1_epi16(0x1f));
+    __m128i gb;
+
+    r = _mm_or_si128(_mm_slli_epi16(r, 3), _mm_srli_epi16(r, 2));
+    g = _mm_or_si128(_mm_slli_epi16(g, 2), _mm_srli_epi16(g, 4));
+    b = _mm_or_si128(_mm_slli_epi16(b, 3), _mm_srli_epi16(b, 2));
+    gb = _mm_or_si128(_mm_slli_epi16(g, 8), b);
+    *lo = _mm_unpacklo_epi16(gb, r);
+    *hi = _mm_unpackhi_epi16(gb, r);
+}
+
+static inline bool tile_sync_rgb565_full(uint32_t *dst, const uint16_t *src)
+{
+    __m128i px[4];
+    __m128i eq = _mm_set1_epi8(-1);
+    int i;
+
+    rgb565_to_server_sse2(_mm_loadu_si128((const __m128i *)src),
+                          &px[0], &px[1]);
+    rgb565_to_server_sse2(_mm_loadu_si128((const __m128i *)(src + 8)),
+                          &px[2], &px[3]);
+    for (i = 0; i < 4; i++) {
+        eq = _mm_and_si128(eq, _mm_cmpeq_epi32(px[i],
+                           _mm_loadu_si128((const __m128i *)(dst + i * 4))));
+    }
+    if (_mm_movemask_epi8(eq) == 0xffff) {
+        return false;
+    }
+    for (i = 0; i < 4; i++) {
+        _mm_storeu_si128((__m128i *)(dst + i * 4), px[i]);
+    }
+    return true;
+}
+
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+
+static inline bool neon_all_set(uint8x16_t eq)
+{
+    return vget_lane_u64(vreinterpret_u64_u8(
+               vshrn_n_u16(vreinterpretq_u16_u8(eq), 4)), 0) == ~0ULL;
+}
+
+static inline bool tile_sync_full(uint8_t *dst, const uint8_t *src)
+{
+    uint8x16_t s0 = vld1q_u8(src);
+    uint8x16_t s1 = vld1q_u8(src + 16);
+    uint8x16_t s2 = vld1q_u8(src + 32);
+    uint8x16_t s3 = vld1q_u8(src + 48);
+    uint8x16_t eq;
+
+    eq = vandq_u8(vandq_u8(vceqq_u8(s0, vld1q_u8(dst)),
+                           vceqq_u8(s1, vld1q_u8(dst + 16))),
+                  vandq_u8(vceqq_u8(s2, vld1q_u8(dst + 32)),
+                           vceqq_u8(s3, vld1q_u8(dst + 48))));
+    if (neon_all_set(eq)) {
+        return false;
+    }
+    vst1q_u8(dst, s0);
+    vst1q_u8(dst + 16, s1);
+    vst1q_u8(dst + 32, s2);
+    vst1q_u8(dst + 48, s3);
+    return true;
+}
+
+/* Convert 8 pixels; the first four end up in val[0], the others in val[1] */
+static inline uint16x8x2_t rgb565_to_server_neon(uint16x8_t p)
+{
+    uint16x8_t r = vshrq_n_u16(p, 11);
+    uint16x8_t g = vandq_u16(vshrq_n_u16(p, 5), vdupq_n_u16(0x3f));
+    uint16x8_t b = vandq_u16(p, vdupq_n_u16(0x1f));
+
+    r = vorrq_u16(vshlq_n_u16(r, 3), vshrq_n_u16(r, 2));
+    g = vorrq_u16(vshlq_n_u16(g, 2), vshrq_n_u16(g, 4));
+    b = vorrq_u16(vshlq_n_u16(b, 3), vshrq_n_u16(b, 2));
+    return vzipq_u16(vorrq_u16(vshlq_n_u16(g, 8), b), r);
+}
+
+static inline bool tile_sync_rgb565_full(uint32_t *dst, const uint16_t *src)
+{
+    uint16x8x2_t p0 = rgb565_to_server_neon(vld1q_u16(src));
+    uint16x8x2_t p1 = rgb565_to_server_neon(vld1q_u16(src + 8));
+    uint32x4_t px[4];
+    uint32x4_t eq = vdupq_n_u32(~0U);
+    int i;
+
+    px[0] = vreinterpretq_u32_u16(p0.val[0]);
+    px[1] = vreinterpretq_u32_u16(p0.val[1]);
+    px[2] = vreinterpretq_u32_u16(p1.val[0]);
+    px[3] = vreinterpretq_u32_u16(p1.val[1]);
+    for (i = 0; i < 4; i++) {
+        eq = vandq_u32(eq, vceqq_u32(px[i], vld1q_u32(dst + i * 4)));
+    }
+    if (neon_all_set(vreinterpretq_u8_u32(eq))) {
+        return false;
+    }
+    for (i = 0; i < 4; i++) {
+        vst1q_u32(dst + i * 4, px[i]);
+    }
+    return true;
+}
+
+#else
+
+static inline bool tile_sync_full(uint8_t *dst, const uint8_t *src)
+{
+    return tile_sync_bytes(dst, src, VNC_TILE_BYTES);
+}
+
+static inline bool tile_sync_rgb565_full(uint32_t *dst, const uint16_t *src)
+{
+    return tile_sync_rgb565_pixels(dst, src, VNC_TILE_PIXELS);
+}
+
+#endif
+
+static unsigned long tile_sync_vec(void *dst, const void *src,
+                                   unsigned long dirty, int bytes)
+{
+    unsigned long changed = 0;
+
+    while (dirty) {
+        int i = ctzl(dirty);
+        int offset = i * VNC_TILE_BYTES;
+        uint8_t *d = (uint8_t *)dst + offset;
+        const uint8_t *s = (const uint8_t *)src + offset;
+
+        dirty &= dirty - 1;
+        if (offset + VNC_TILE_BYTES <= bytes ?
+            tile_sync_full(d, s) : tile_sync_bytes(d, s, bytes - offset)) {
+            changed |= 1UL << i;
+        }
+    }
+    return changed;
+}
+
+static unsigned long tile_sync_rgb565_vec(uint32_t *dst, const uint16_t *src,
+                                          unsigned long dirty, int pixels)
+{
+    unsigned long changed = 0;
+
+    while (dirty) {
+        int i = ctzl(dirty);
+        int offset = i * VNC_TILE_PIXELS;
+
+        dirty &= dirty - 1;
+        if (offset + VNC_TILE_PIXELS <= pixels ?
+            tile_sync_rgb565_full(dst + offset, src + offset) :
+            tile_sync_rgb565_pixels(dst + offset, src + offset,
+                                    pixels - offset)) {
+            changed |= 1UL << i;
+        }
+    }
+    return changed;
+}
+
+#ifdef CONFIG_AVX2_OPT
+
+static __attribute__((target("avx2")))
+unsigned long tile_sync_avx2(void *dst, const void *src,
+                             unsigned long dirty, int bytes)
+{
+    unsigned long changed = 0;
+
+    while (dirty) {
+        int i = ctzl(dirty);
+        int offset = i * VNC_TILE_BYTES;
+        uint8_t *d = (uint8_t *)dst + offset;
+        const uint8_t *s = (const uint8_t *)src + offset;
+        __m256i s0, s1, eq;
+
+        dirty &= dirty - 1;
+        if (offset + VNC_TILE_BYTES > bytes) {
+            if (tile_sync_bytes(d, s, bytes - offset)) {
+                changed |= 1UL << i;
+            }
+            continue;
+        }
+
+        s0 = _mm256_loadu_si256((const __m256i *)s);
+        s1 = _mm256_loadu_si256((const __m256i *)(s + 32));
+        eq = _mm256_and_si256(
+            _mm256_cmpeq_epi8(s0, _mm256_loadu_si256((const __m256i *)d)),
+            _mm256_cmpeq_epi8(s1,
+                              _mm256_loadu_si256((const __m256i *)(d + 32))));
+        if (_mm256_movemask_epi8(eq) != -1) {
+            _mm256_storeu_si256((__m256i *)d, s0);
+            _mm256_storeu_si256((__m256i *)(d + 32), s1);
+            changed |= 1UL << i;
+        }
+    }
+    return changed;
+}
+
+static __attribute__((target("avx2")))
+unsigned long tile_sync_rgb565_avx2(uint32_t *dst, const uint16_t *src,
+                                    unsigned long dirty, int pixels)
+{
+    const __m256i mask6 = _mm256_set1_epi16(0x3f);
+    const __m256i mask5 = _mm256_set1_epi16(0x1f);
+    unsigned long changed = 0;
+
+    while (dirty) {
+        int i = ctzl(dirty);
+        int offset = i * VNC_TILE_PIXELS;
+        uint32_t *d = dst + offset;
+        __m256i p, r, g, b, lo, hi, px0, px1, eq;
+
+        dirty &= dirty - 1;
+        if (offset + VNC_TILE_PIXELS > pixels) {
+            if (tile_sync_rgb565_pixels(d, src + offset, pixels - offset)) {
+                changed |= 1UL << i;
+            }
+            continue;
+        }
+
+        p = _mm256_loadu_si256((const __m256i *)(src + offset));
+        r = _mm256_srli_epi16(p, 11);
+        g = _mm256_and_si256(_mm256_srli_epi16(p, 5), mask6);
+        b = _mm256_and_si256(p, mask5);
+        r = _mm256_or_si256(_mm256_slli_epi16(r, 3), _mm256_srli_epi16(r, 2));
+        g = _mm256_or_si256(_mm256_slli_epi16(g, 2), _mm256_srli_epi16(g, 4));
+        b = _mm256_or_si256(_mm256_slli_epi16(b, 3), _mm256_srli_epi16(b, 2));
+        g = _mm256_or_si256(_mm256_slli_epi16(g, 8), b);
+
+        /* The unpacks work within 128-bit lanes: lo has pixels 0-3 and
+         * 8-11, hi has pixels 4-7 and 12-15.
+         */
+        lo = _mm256_unpacklo_epi16(g, r);
+        hi = _mm256_unpackhi_epi16(g, r);
+        px0 = _mm256_permute2x128_si256(lo, hi, 0x20);
+        px1 = _mm256_permute2x128_si256(lo, hi, 0x31);
+
+        eq = _mm256_and_si256(
+            _mm256_cmpeq_epi32(px0, _mm256_loadu_si256((const __m256i *)d)),
+            _mm256_cmpeq_epi32(px1,
+                               _mm256_loadu_si256((const __m256i *)(d + 8))));
+        if (_mm256_movemask_epi8(eq) != -1) {
+            _mm256_storeu_si256((__m256i *)d, px0);
+            _mm256_storeu_si256((__m256i *)(d + 8), px1);
+            changed |= 1UL << i;
+        }
+    }
+    return changed;
+}
+
+#endif
+
+static VncTileSyncFunc tile_sync = tile_sync_vec;
+static VncTileSyncRGB565Func tile_sync_rgb565 = tile_sync_rgb565_vec;
+
+unsigned long vnc_tile_sync(void *dst, const void *src,
+                            unsigned long dirty, int bytes)
+{
+    return tile_sync(dst, src, dirty, bytes);
+}
+
+unsigned long vnc_tile_sync_rgb565(uint32_t *dst, const uint16_t *src,
+                                   unsigned long dirty, int pixels)
+{
+    return tile_sync_rgb565(dst, src, dirty, pixels);
+}
+
+bool vnc_tile_set_avx2(bool enable)
+{
+    tile_sync = tile_sync_vec;
+    tile_sync_rgb565 = tile_sync_rgb565_vec;
+#ifdef CONFIG_AVX2_OPT
+    if (enable && host_avx2_usable()) {
+        tile_sync = tile_sync_avx2;
+        tile_sync_rgb565 = tile_sync_rgb565_avx2;
+        return true;
+    }
+#endif
+    return false;
+}
+
+static void __attribute__((constructor)) vnc_tile_init_accel(void)
+{
+    vnc_tile_set_avx2(true);
+}
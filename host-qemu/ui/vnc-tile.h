@@ -0,0 +1,44 @@
+/*
+ * QEMU VNC display driver: server surface tile compare and copy
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#ifndef VNC_TILE_H
+#define VNC_TILE_H
+
+#include "qemu-common.h"
+
+/*
+ * A tile is the part of a row that one bit of the dirty maps covers, in
+ * the 32 bit per pixel format of the server surface.
+ */
+#define VNC_TILE_PIXELS 16
+#define VNC_TILE_BYTES  (VNC_TILE_PIXELS * 4)
+
+/*
+ * Compare the tiles of @src whose bit is set in @dirty with the same tiles
+ * of @dst, and copy the ones that differ to @dst.  Tile i starts i *
+ * VNC_TILE_BYTES bytes after @dst and @src; only the first @bytes bytes
+ * of the row are valid, so the last tile may be shorter.  Returns the
+ * tiles that changed.
+ */
+unsigned long vnc_tile_sync(void *dst, const void *src,
+                            unsigned long dirty, int bytes);
+
+/*
+ * The same, for a guest row in RGB565 that is converted to the server
+ * format on the fly.  Only the first @pixels pixels of the row are valid.
+ */
+unsigned long vnc_tile_sync_rgb565(uint32_t *dst, const uint16_t *src,
+                                   unsigned long dirty, int pixels);
+
+/*
+ * Use the AVX2 versions if @enable and the host supports them, the
+ * baseline vector versions otherwise.  Returns whether AVX2 is used.
+ * The best versions are chosen at startup; this is for tests.
+ */
+bool vnc_tile_set_avx2(bool enable);
+
+#endif /* VNC_TILE_H */
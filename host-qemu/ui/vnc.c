@@ -26,12 +26,14 @@
 
 #include "vnc.h"
 #include "vnc-jobs.h"
+#include "vnc-tile.h"
 #include "trace.h"
 #include "hw/qdev.h"
 #include "sysemu/sysemu.h"
 #include "qemu/error-report.h"
 #include "qemu/sockets.h"
 #include "qemu/timer.h"
+#include "qemu/iov.h"
 #include "qemu/acl.h"
 #include "qemu/config-file.h"
 #include "qapi/qmp/qerror.h"
@@ -45,6 +47,13 @@
 #define VNC_REFRESH_INTERVAL_BASE GUI_REFRESH_INTERVAL_DEFAULT
 #define VNC_REFRESH_INTERVAL_INC  50
 #define VNC_REFRESH_INTERVAL_MAX  GUI_REFRESH_INTERVAL_IDLE
+
+/* Fenced updates that may be in flight before waiting for the client */
+#define VNC_FENCE_WINDOW 2
+/* Smaller encoder output is copied to the output buffer */
+#define VNC_OUTPUT_CHUNK_MIN 4096
+/* At most this many chunks are written in one system call */
+#define VNC_OUTPUT_IOV_MAX 64
 static const struct timeval VNC_REFRESH_STATS = { 0, 500000 };
 static const struct timeval VNC_REFRESH_LOSSY = { 2, 0 };
 
@@ -610,6 +619,8 @@ static void framebuffer_update_request(VncState *vs, int incremental,
                                        int w, int h);
 static void vnc_refresh(DisplayChangeListener *dcl);
 static int vnc_refresh_server_surface(VncDisplay *vd);
+static void vnc_own_server_surface(VncDisplay *vd);
+static void vnc_release_server_surface(VncDisplay *vd);
 
 static void vnc_set_area_dirty(DECLARE_BITMAP(dirty[VNC_MAX_HEIGHT],
                                VNC_MAX_WIDTH / VNC_DIRTY_PIXELS_PER_BIT),
@@ -722,6 +733,7 @@ static void vnc_abort_display_jobs(VncDisplay *vd)
 {
     VncState *vs;
 
+    vnc_refresh_join(vd);
     QTAILQ_FOREACH(vs, &vd->clients, next) {
         vnc_lock_output(vs);
         vs->abort = true;
@@ -752,6 +764,15 @@ void *vnc_server_fb_ptr(VncDisplay *vd, int x, int y)
     return ptr;
 }
 
+static bool vnc_check_pageflip(DisplaySurface *s1,
+                               DisplaySurface *s2)
+{
+    return s1 != NULL && s2 != NULL &&
+        surface_width(s1) == surface_width(s2) &&
+        surface_height(s1) == surface_height(s2) &&
+        surface_format(s1) == surface_format(s2);
+}
+
 static void vnc_dpy_switch(DisplayChangeListener *dcl,
                            DisplaySurface *surface)
 {
@@ -759,6 +780,23 @@ static void vnc_dpy_switch(DisplayChangeListener *dcl,
     VncState *vs;
     int width, height;
 
+    if (vnc_check_pageflip(vd->ds, surface)) {
+        /*
+         * Same size and format, e.g. a display that flips between
+         * buffers every frame: keep the server surface and the clients'
+         * state, and let the next refresh send the tiles that changed.
+         */
+        vnc_refresh_join(vd);
+        vd->ds = surface;
+        qemu_pixman_image_unref(vd->guest.fb);
+        vd->guest.fb = pixman_image_ref(surface->image);
+        width = pixman_image_get_width(vd->server);
+        height = pixman_image_get_height(vd->server);
+        vnc_set_area_dirty(vd->guest.dirty, width, height, 0, 0,
+                           width, height);
+        return;
+    }
+
     vnc_abort_display_jobs(vd);
 
     /* server surface */
@@ -943,6 +981,7 @@ static void vnc_dpy_copy(DisplayChangeListener *dcl,
     }
 
     /* do bitblit op on the local surface too */
+    vnc_own_server_surface(vd);
     pitch = vnc_server_fb_stride(vd);
     src_row = vnc_server_fb_ptr(vd, src_x, src_y);
     dst_row = vnc_server_fb_ptr(vd, dst_x, dst_y);
@@ -990,6 +1029,7 @@ static void vnc_dpy_copy(DisplayChangeListener *dcl,
         dst_row += pitch - w * VNC_SERVER_FB_BYTES;
         y += inc;
     }
+    vnc_release_server_surface(vd);
 
     QTAILQ_FOREACH(vs, &vd->clients, next) {
         if (vnc_has_feature(vs, VNC_FEATURE_COPYRECT)) {
@@ -1060,6 +1100,24 @@ static int find_and_clear_dirty_height(VncState *vs,
     return h;
 }
 
+/* Add a dirty rectangle to @job, clipped to the continuous updates region */
+static int vnc_update_add_rect(VncState *vs, VncJob *job,
+                               int x, int y, int w, int h)
+{
+    int x2 = x + w, y2 = y + h;
+
+    if (vs->continuous_updates) {
+        x = MAX(x, vs->cu_x);
+        y = MAX(y, vs->cu_y);
+        x2 = MIN(x2, vs->cu_x + vs->cu_w);
+        y2 = MIN(y2, vs->cu_y + vs->cu_h);
+        if (x2 <= x || y2 <= y) {
+            return 0;
+        }
+    }
+    return vnc_job_add_rect(job, x, y, x2 - x, y2 - y);
+}
+
 static int vnc_update_client(VncState *vs, int has_dirty, bool sync)
 {
     vs->has_dirty += has_dirty;
@@ -1069,10 +1127,20 @@ static int vnc_update_client(VncState *vs, int has_dirty, bool sync)
         int y;
         int height, width;
         int n = 0;
+        bool fenced = vs->continuous_updates &&
+                      vnc_has_feature(vs, VNC_FEATURE_FENCE);
 
-        if (vs->output.offset && !vs->audio_cap && !vs->force_update)
+        if (fenced) {
+            /* the client acknowledges every update, keep a few in flight */
+            if (vs->fence_sent - vs->fence_acked >= VNC_FENCE_WINDOW &&
+                !vs->force_update) {
+                return 0;
+            }
+        } else if (vnc_output_pending(vs) && !vs->audio_cap &&
+                   !vs->force_update) {
             /* kernel send buffers are full -> drop frames to throttle */
             return 0;
+        }
 
         if (!vs->has_dirty && !vs->audio_cap && !vs->force_update)
             return 0;
@@ -1107,8 +1175,9 @@ static int vnc_update_client(VncState *vs, int has_dirty, bool sync)
             h = find_and_clear_dirty_height(vs, y, x, x2, height);
             x2 = MIN(x2, width / VNC_DIRTY_PIXELS_PER_BIT);
             if (x2 > x) {
-                n += vnc_job_add_rect(job, x * VNC_DIRTY_PIXELS_PER_BIT, y,
-                                      (x2 - x) * VNC_DIRTY_PIXELS_PER_BIT, h);
+                n += vnc_update_add_rect(vs, job, x * VNC_DIRTY_PIXELS_PER_BIT,
+                                         y, (x2 - x) * VNC_DIRTY_PIXELS_PER_BIT,
+                                         h);
             }
             if (!x && x2 == width / VNC_DIRTY_PIXELS_PER_BIT) {
                 y += h;
@@ -1118,6 +1187,10 @@ static int vnc_update_client(VncState *vs, int has_dirty, bool sync)
             }
         }
 
+        if (fenced && n) {
+            job->fence = true;
+            job->fence_id = ++vs->fence_sent;
+        }
         vnc_job_push(job);
         if (sync) {
             vnc_jobs_join(vs);
@@ -1228,6 +1301,13 @@ void vnc_disconnect_finish(VncState *vs)
 
     buffer_free(&vs->input);
     buffer_free(&vs->output);
+    while (!QSIMPLEQ_EMPTY(&vs->output_chunks)) {
+        VncOutputChunk *chunk = QSIMPLEQ_FIRST(&vs->output_chunks);
+
+        QSIMPLEQ_REMOVE_HEAD(&vs->output_chunks, next);
+        buffer_free(&chunk->buffer);
+        g_free(chunk);
+    }
     buffer_free(&vs->ws_input);
     buffer_free(&vs->ws_output);
 
@@ -1350,6 +1430,140 @@ long vnc_client_write_buf(VncState *vs, const uint8_t *data, size_t datalen)
 }
 
 
+/*
+ * Can encoder output go to the socket as it is?  Only if nothing has
+ * to encrypt or frame it on the way.
+ */
+static bool vnc_output_zero_copy(VncState *vs)
+{
+#ifdef CONFIG_VNC_TLS
+    if (vs->tls.session) {
+        return false;
+    }
+#endif /* CONFIG_VNC_TLS */
+#ifdef CONFIG_VNC_SASL
+    if (vs->sasl.conn && vs->sasl.runSSF) {
+        return false;
+    }
+#endif /* CONFIG_VNC_SASL */
+    return !vs->encode_ws;
+}
+
+size_t vnc_output_pending(VncState *vs)
+{
+    return vs->output_chunks_bytes + vs->output.offset;
+}
+
+/* Move the output buffer to the end of the chunks */
+static void vnc_output_chunk_add(VncState *vs, Buffer *buffer)
+{
+    VncOutputChunk *chunk = g_new(VncOutputChunk, 1);
+
+    chunk->buffer = *buffer;
+    chunk->sent = 0;
+    memset(buffer, 0, sizeof(*buffer));
+    vs->output_chunks_bytes += chunk->buffer.offset;
+    QSIMPLEQ_INSERT_TAIL(&vs->output_chunks, chunk, next);
+}
+
+/*
+ * Queue the contents of @buffer for the client and empty it.  On plain
+ * sockets large buffers are not copied but queued as they are, and
+ * written together with the rest of the output by one writev().  The
+ * memory of the buffer comes back to vs->jobs_buffer once it is sent.
+ *
+ * Called with the output lock held.
+ */
+void vnc_write_buffer(VncState *vs, Buffer *buffer)
+{
+    if (buffer->offset < VNC_OUTPUT_CHUNK_MIN || !vnc_output_zero_copy(vs)) {
+        vnc_write(vs, buffer->buffer, buffer->offset);
+        buffer_reset(buffer);
+        return;
+    }
+
+    if (vs->csock != -1 && !vnc_output_pending(vs)) {
+        qemu_set_fd_handler(vs->csock, vnc_client_read, vnc_client_write, vs);
+    }
+    /* Keep what was written before ahead of @buffer */
+    if (vs->output.offset) {
+        vnc_output_chunk_add(vs, &vs->output);
+    }
+    vnc_output_chunk_add(vs, buffer);
+}
+
+/*
+ * Write the output chunks, and vs->output after them, to the socket
+ * with as few system calls as possible.
+ *
+ * Returns the number of bytes written, like vnc_client_write_plain().
+ */
+static long vnc_client_write_chunks(VncState *vs)
+{
+    struct iovec iov[VNC_OUTPUT_IOV_MAX];
+    VncOutputChunk *chunk;
+    size_t bytes = 0, done;
+    int niov = 0;
+    long ret;
+
+    QSIMPLEQ_FOREACH(chunk, &vs->output_chunks, next) {
+        if (niov == VNC_OUTPUT_IOV_MAX) {
+            break;
+        }
+        iov[niov].iov_base = chunk->buffer.buffer + chunk->sent;
+        iov[niov].iov_len = chunk->buffer.offset - chunk->sent;
+        bytes += iov[niov++].iov_len;
+    }
+    if (!chunk && niov < VNC_OUTPUT_IOV_MAX && vs->output.offset) {
+        iov[niov].iov_base = vs->output.buffer;
+        iov[niov].iov_len = vs->output.offset;
+        bytes += iov[niov++].iov_len;
+    }
+
+    ret = iov_send(vs->csock, iov, niov, 0, bytes);
+    VNC_DEBUG("Wrote wire %d chunks %zd -> %ld\n", niov, bytes, ret);
+    ret = vnc_client_io_error(vs, ret, socket_error());
+    if (!ret) {
+        return 0;
+    }
+
+    done = ret;
+    while (done && !QSIMPLEQ_EMPTY(&vs->output_chunks)) {
+        size_t left;
+
+        chunk = QSIMPLEQ_FIRST(&vs->output_chunks);
+        left = chunk->buffer.offset - chunk->sent;
+        if (done < left) {
+            /* Unlike buffer_advance(), don't move the rest of the data */
+            chunk->sent += done;
+            vs->output_chunks_bytes -= done;
+            done = 0;
+            break;
+        }
+        done -= left;
+        vs->output_chunks_bytes -= left;
+        QSIMPLEQ_REMOVE_HEAD(&vs->output_chunks, next);
+
+        /* Give the memory back to the encoders */
+        if (!vs->jobs_buffer.capacity) {
+            vs->jobs_buffer = chunk->buffer;
+            buffer_reset(&vs->jobs_buffer);
+        } else {
+            buffer_free(&chunk->buffer);
+        }
+        g_free(chunk);
+    }
+    if (done) {
+        buffer_advance(&vs->output, done);
+    }
+
+    if (!vnc_output_pending(vs)) {
+        qemu_set_fd_handler(vs->csock, vnc_client_read, NULL, vs);
+    }
+
+    return ret;
+}
+
 /*
  * Called to write buffered data to the client socket, when not
  * using any SASL SSF encryption layers. Will write as much data
@@ -1364,6 +1578,10 @@ static long vnc_client_write_plain(VncState *vs)
 {
     long ret;
 
+    if (!QSIMPLEQ_EMPTY(&vs->output_chunks)) {
+        return vnc_client_write_chunks(vs);
+    }
+
 #ifdef CONFIG_VNC_SASL
     VNC_DEBUG("Write Plain: Pending output %p size %zd offset %zd. Wait SSF %d\n",
               vs->output.buffer, vs->output.capacity, vs->output.offset,
@@ -1421,7 +1639,7 @@ void vnc_client_write(void *opaque)
     VncState *vs = opaque;
 
     vnc_lock_output(vs);
-    if (vs->output.offset || vs->ws_output.offset) {
+    if (vnc_output_pending(vs) || vs->ws_output.offset) {
         vnc_client_write_locked(opaque);
     } else if (vs->csock != -1) {
         qemu_set_fd_handler(vs->csock, vnc_client_read, NULL, vs);
@@ -1606,10 +1824,24 @@ void vnc_write_u8(VncState *vs, uint8_t value)
     vnc_write(vs, (char *)&value, 1);
 }
 
+void vnc_write_fence(VncState *vs, uint32_t flags, uint8_t len,
+                     const uint8_t *data)
+{
+    static const uint8_t pad[3];
+
+    vnc_write_u8(vs, VNC_MSG_SERVER_FENCE);
+    vnc_write(vs, pad, sizeof(pad));
+    vnc_write_u32(vs, flags);
+    vnc_write_u8(vs, len);
+    if (len) {
+        vnc_write(vs, data, len);
+    }
+}
+
 void vnc_flush(VncState *vs)
 {
     vnc_lock_output(vs);
-    if (vs->csock != -1 && (vs->output.offset ||
+    if (vs->csock != -1 && (vnc_output_pending(vs) ||
                             vs->ws_output.offset)) {
         vnc_client_write_locked(vs);
     }
@@ -2037,6 +2269,63 @@ static void framebuffer_update_request(VncState *vs, int incremental,
     vnc_set_area_dirty(vs->dirty, width, height, x, y, w, h);
 }
 
+static void enable_continuous_updates(VncState *vs, int enable,
+                                      int x, int y, int w, int h)
+{
+    if (!vnc_has_feature(vs, VNC_FEATURE_CONTINUOUS_UPDATES)) {
+        VNC_DEBUG("Continuous updates were not negotiated\n");
+        vnc_client_error(vs);
+        return;
+    }
+
+    if (enable) {
+        vs->continuous_updates = true;
+        vs->cu_x = x;
+        vs->cu_y = y;
+        vs->cu_w = w;
+        vs->cu_h = h;
+        /* Start with the whole region, as for a non-incremental request */
+        framebuffer_update_request(vs, 0, x, y, w, h);
+        return;
+    }
+
+    /* EndOfContinuousUpdates follows the last update sent on our own */
+    vs->continuous_updates = false;
+    vnc_jobs_join(vs);
+    vnc_lock_output(vs);
+    vnc_write_u8(vs, VNC_MSG_SERVER_END_CONTINUOUS_UPDATES);
+    vnc_unlock_output(vs);
+    vnc_flush(vs);
+}
+
+static void client_fence(VncState *vs, uint32_t flags, uint8_t len,
+                         uint8_t *data)
+{
+    if (!(flags & VNC_FENCE_REQUEST)) {
+        /* The answer to the fence of an update, see vnc_update_client() */
+        if (len == 4) {
+            vs->fence_acked = read_u32(data, 0);
+            /* Send what piled up while the window was full right away */
+            if (vs->continuous_updates && vs->csock != -1) {
+                vnc_update_client(vs, 0, false);
+            }
+        }
+        return;
+    }
+
+    /*
+     * Messages are handled in order on the main loop, so only the
+     * updates that are still being encoded can pass the fence.
+     */
+    if (flags & VNC_FENCE_BLOCK_BEFORE) {
+        vnc_jobs_join(vs);
+    }
+    vnc_lock_output(vs);
+    vnc_write_fence(vs, flags & VNC_FENCE_SUPPORTED, len, data);
+    vnc_unlock_output(vs);
+    vnc_flush(vs);
+}
+
 static void send_ext_key_event_ack(VncState *vs)
 {
     vnc_lock_output(vs);
@@ -2065,10 +2354,38 @@ static void send_ext_audio_ack(VncState *vs)
     vnc_flush(vs);
 }
 
+/*
+ * The server confirms the fence and continuous updates extensions with a
+ * message of each, the first time the client asks for them.
+ */
+static void vnc_confirm_extensions(VncState *vs, uint32_t old_features)
+{
+    uint32_t new_features = vs->features & ~old_features;
+
+    if (!vnc_has_feature(vs, VNC_FEATURE_CONTINUOUS_UPDATES)) {
+        vs->continuous_updates = false;
+    }
+    if (!(new_features & (VNC_FEATURE_FENCE_MASK |
+                          VNC_FEATURE_CONTINUOUS_UPDATES_MASK))) {
+        return;
+    }
+
+    vnc_lock_output(vs);
+    if (new_features & VNC_FEATURE_FENCE_MASK) {
+        vnc_write_fence(vs, VNC_FENCE_REQUEST, 0, NULL);
+    }
+    if (new_features & VNC_FEATURE_CONTINUOUS_UPDATES_MASK) {
+        vnc_write_u8(vs, VNC_MSG_SERVER_END_CONTINUOUS_UPDATES);
+    }
+    vnc_unlock_output(vs);
+    vnc_flush(vs);
+}
+
 static void set_encodings(VncState *vs, int32_t *encodings, size_t n_encodings)
 {
     int i;
     unsigned int enc = 0;
+    uint32_t old_features = vs->features;
 
     vs->features = 0;
     vs->vnc_encoding = 0;
@@ -2137,6 +2454,12 @@ static void set_encodings(VncState *vs, int32_t *encodings, size_t n_encodings)
         case VNC_ENCODING_LED_STATE:
             vs->features |= VNC_FEATURE_LED_STATE_MASK;
             break;
+        case VNC_ENCODING_FENCE:
+            vs->features |= VNC_FEATURE_FENCE_MASK;
+            break;
+        case VNC_ENCODING_CONTINUOUS_UPDATES:
+            vs->features |= VNC_FEATURE_CONTINUOUS_UPDATES_MASK;
+            break;
         case VNC_ENCODING_COMPRESSLEVEL0 ... VNC_ENCODING_COMPRESSLEVEL0 + 9:
             vs->tight.compression = (enc & 0x0F);
             break;
@@ -2153,6 +2476,7 @@ static void set_encodings(VncState *vs, int32_t *encodings, size_t n_encodings)
     vnc_desktop_resize(vs);
     check_pointer_type_change(&vs->mouse_mode_notifier, NULL);
     vnc_led_state_change(vs);
+    vnc_confirm_extensions(vs, old_features);
 }
 
 static void set_pixel_conversion(VncState *vs)
@@ -2317,6 +2641,35 @@ static int protocol_client_msg(VncState *vs, uint8_t *data, size_t len)
 
         pointer_event(vs, read_u8(data, 1), read_u16(data, 2), read_u16(data, 4));
         break;
+    case VNC_MSG_CLIENT_ENABLE_CONTINUOUS_UPDATES:
+        if (len == 1) {
+            return 10;
+        }
+
+        enable_continuous_updates(vs, read_u8(data, 1),
+                                  read_u16(data, 2), read_u16(data, 4),
+                                  read_u16(data, 6), read_u16(data, 8));
+        break;
+    case VNC_MSG_CLIENT_FENCE:
+        if (len == 1) {
+            return 9;
+        }
+        if (len == 9) {
+            uint8_t flen = read_u8(data, 8);
+            if (flen > VNC_FENCE_PAYLOAD_MAX) {
+                error_report("vnc: fence msg payload has %u bytes"
+                             " which exceeds the limit of %d.",
+                             flen, VNC_FENCE_PAYLOAD_MAX);
+                vnc_client_error(vs);
+                break;
+            }
+            if (flen > 0) {
+                return 9 + flen;
+            }
+        }
+
+        client_fence(vs, read_u32(data, 4), read_u8(data, 8), data + 9);
+        break;
     case VNC_MSG_CLIENT_CUT_TEXT:
         if (len == 1) {
             return 8;
@@ -2755,7 +3108,7 @@ static int vnc_refresh_lossy_rect(VncDisplay *vd, int x, int y)
         int j;
 
         /* kernel send buffers are full -> refresh later */
-        if (vs->output.offset) {
+        if (vnc_output_pending(vs)) {
             continue;
         }
 
@@ -2866,120 +3219,240 @@ static void vnc_rect_updated(VncDisplay *vd, int x, int y, struct timeval * tv)
     rect->updated = true;
 }
 
-static int vnc_refresh_server_surface(VncDisplay *vd)
+static int vnc_refresh_height(VncDisplay *vd)
+{
+    return MIN(pixman_image_get_height(vd->guest.fb),
+               pixman_image_get_height(vd->server));
+}
+
+/*
+ * Walk through rows @y0 to @y0 + @h - 1 of the refresh dirty map.
+ * Check and copy modified tiles from guest to server surface, one word of
+ * the dirty map at a time.  Update the same rows of the server dirty map.
+ *
+ * Runs on the worker threads, one band of rows per job; bands start on a
+ * VNC_STAT_RECT boundary so that the update statistics are not shared.
+ */
+int vnc_refresh_server_rows(VncDisplay *vd, int y0, int h)
 {
     int width = MIN(pixman_image_get_width(vd->guest.fb),
                     pixman_image_get_width(vd->server));
-    int height = MIN(pixman_image_get_height(vd->guest.fb),
-                     pixman_image_get_height(vd->server));
-    int cmp_bytes, server_stride, line_bytes, guest_ll, guest_stride, y = 0;
+    int tiles = DIV_ROUND_UP(width, VNC_DIRTY_PIXELS_PER_BIT);
+    int server_stride, line_bytes, guest_ll, guest_stride;
     uint8_t *guest_row0 = NULL, *server_row0;
-    VncState *vs;
+    bool rgb565 = vd->guest.format == PIXMAN_r5g6b5;
     int has_dirty = 0;
     pixman_image_t *tmpbuf = NULL;
+    int y, i;
 
-    struct timeval tv = { 0, 0 };
+    QEMU_BUILD_BUG_ON(VNC_TILE_PIXELS != VNC_DIRTY_PIXELS_PER_BIT);
+    QEMU_BUILD_BUG_ON(VNC_TILE_BYTES !=
+                      VNC_DIRTY_PIXELS_PER_BIT * VNC_SERVER_FB_BYTES);
 
-    if (!vd->non_adaptive) {
-        gettimeofday(&tv, NULL);
-        has_dirty = vnc_update_stats(vd, &tv);
-    }
+    memset(vd->server_dirty[y0], 0, h * sizeof(vd->server_dirty[0]));
 
-    /*
-     * Walk through the guest dirty map.
-     * Check and copy modified bits from guest to server surface.
-     * Update server dirty map.
-     */
     server_row0 = (uint8_t *)pixman_image_get_data(vd->server);
     server_stride = guest_stride = guest_ll =
         pixman_image_get_stride(vd->server);
-    cmp_bytes = MIN(VNC_DIRTY_PIXELS_PER_BIT * VNC_SERVER_FB_BYTES,
-                    server_stride);
-    if (vd->guest.format != VNC_SERVER_FB_FORMAT) {
-        int width = pixman_image_get_width(vd->server);
-        tmpbuf = qemu_pixman_linebuf_create(VNC_SERVER_FB_FORMAT, width);
-    } else {
+    if (rgb565 || vd->guest.format == VNC_SERVER_FB_FORMAT) {
         int guest_bpp =
             PIXMAN_FORMAT_BPP(pixman_image_get_format(vd->guest.fb));
         guest_row0 = (uint8_t *)pixman_image_get_data(vd->guest.fb);
         guest_stride = pixman_image_get_stride(vd->guest.fb);
         guest_ll = pixman_image_get_width(vd->guest.fb) * ((guest_bpp + 7) / 8);
+    } else {
+        int width = pixman_image_get_width(vd->server);
+        tmpbuf = qemu_pixman_linebuf_create(VNC_SERVER_FB_FORMAT, width);
     }
     line_bytes = MIN(server_stride, guest_ll);
 
-    for (;;) {
-        int x;
-        uint8_t *guest_ptr, *server_ptr;
-        unsigned long offset = find_next_bit((unsigned long *) &vd->guest.dirty,
-                                             height * VNC_DIRTY_BPL(&vd->guest),
-                                             y * VNC_DIRTY_BPL(&vd->guest));
-        if (offset == height * VNC_DIRTY_BPL(&vd->guest)) {
-            /* no more dirty bits */
-            break;
-        }
-        y = offset / VNC_DIRTY_BPL(&vd->guest);
-        x = offset % VNC_DIRTY_BPL(&vd->guest);
+    for (y = y0; y < y0 + h; y++) {
+        uint8_t *server_ptr = server_row0 + y * server_stride;
+        uint8_t *guest_ptr = NULL;
 
-        server_ptr = server_row0 + y * server_stride + x * cmp_bytes;
+        for (i = 0; i < BITS_TO_LONGS(tiles); i++) {
+            unsigned long dirty = vd->refresh_dirty[y][i];
+            unsigned long changed;
+            int x = i * BITS_PER_LONG;
 
-        if (vd->guest.format != VNC_SERVER_FB_FORMAT) {
-            qemu_pixman_linebuf_fill(tmpbuf, vd->guest.fb, width, 0, y);
-            guest_ptr = (uint8_t *)pixman_image_get_data(tmpbuf);
-        } else {
-            guest_ptr = guest_row0 + y * guest_stride;
-        }
-        guest_ptr += x * cmp_bytes;
-
-        for (; x < DIV_ROUND_UP(width, VNC_DIRTY_PIXELS_PER_BIT);
-             x++, guest_ptr += cmp_bytes, server_ptr += cmp_bytes) {
-            int _cmp_bytes = cmp_bytes;
-            if (!test_and_clear_bit(x, vd->guest.dirty[y])) {
+            if (!dirty) {
                 continue;
             }
-            if ((x + 1) * cmp_bytes > line_bytes) {
-                _cmp_bytes = line_bytes - x * cmp_bytes;
+            vd->refresh_dirty[y][i] = 0;
+            if (x + BITS_PER_LONG > tiles) {
+                dirty &= BITMAP_LAST_WORD_MASK(tiles);
             }
-            assert(_cmp_bytes >= 0);
-            if (memcmp(server_ptr, guest_ptr, _cmp_bytes) == 0) {
-                continue;
+
+            if (!guest_ptr) {
+                if (tmpbuf) {
+                    qemu_pixman_linebuf_fill(tmpbuf, vd->guest.fb, width, 0, y);
+                    guest_ptr = (uint8_t *)pixman_image_get_data(tmpbuf);
+                } else {
+                    guest_ptr = guest_row0 + y * guest_stride;
+                }
             }
-            memcpy(server_ptr, guest_ptr, _cmp_bytes);
-            if (!vd->non_adaptive) {
-                vnc_rect_updated(vd, x * VNC_DIRTY_PIXELS_PER_BIT,
-                                 y, &tv);
+
+            if (rgb565) {
+                changed = vnc_tile_sync_rgb565(
+                    (uint32_t *)server_ptr + x * VNC_TILE_PIXELS,
+                    (uint16_t *)guest_ptr + x * VNC_TILE_PIXELS,
+                    dirty, width - x * VNC_TILE_PIXELS);
+            } else {
+                changed = vnc_tile_sync(server_ptr + x * VNC_TILE_BYTES,
+                                        guest_ptr + x * VNC_TILE_BYTES,
+                                        dirty,
+                                        line_bytes - x * VNC_TILE_BYTES);
             }
-            QTAILQ_FOREACH(vs, &vd->clients, next) {
-                set_bit(x, vs->dirty[y]);
+            if (!changed) {
+                continue;
             }
-            has_dirty++;
-        }
 
-        y++;
+            vd->server_dirty[y][i] |= changed;
+            has_dirty += ctpopl(changed);
+            while (changed && !vd->non_adaptive) {
+                vnc_rect_updated(vd, (x + ctzl(changed)) *
+                                 VNC_DIRTY_PIXELS_PER_BIT, y,
+                                 &vd->refresh_tv);
+                changed &= changed - 1;
+            }
+        }
     }
     qemu_pixman_image_unref(tmpbuf);
     return has_dirty;
 }
 
-static void vnc_refresh(DisplayChangeListener *dcl)
+/*
+ * Update the statistics and move the guest dirty map to the refresh dirty
+ * map, where vnc_refresh_server_rows() finds it.  The main loop keeps
+ * marking the guest dirty map while the workers copy the surface.
+ */
+static void vnc_refresh_snapshot(VncDisplay *vd, int height)
 {
-    VncDisplay *vd = container_of(dcl, VncDisplay, dcl);
-    VncState *vs, *vn;
-    int has_dirty, rects = 0;
+    int has_dirty = 0;
 
-    if (QTAILQ_EMPTY(&vd->clients)) {
-        update_displaychangelistener(&vd->dcl, VNC_REFRESH_INTERVAL_MAX);
-        return;
+    memset(&vd->refresh_tv, 0, sizeof(vd->refresh_tv));
+    if (!vd->non_adaptive) {
+        gettimeofday(&vd->refresh_tv, NULL);
+        has_dirty = vnc_update_stats(vd, &vd->refresh_tv);
     }
+    vd->refresh_has_dirty = has_dirty;
 
-    graphic_hw_update(vd->dcl.con);
+    memcpy(vd->refresh_dirty, vd->guest.dirty,
+           height * sizeof(vd->guest.dirty[0]));
+    memset(vd->guest.dirty, 0, height * sizeof(vd->guest.dirty[0]));
+}
 
-    if (vnc_trylock_display(vd)) {
-        update_displaychangelistener(&vd->dcl, VNC_REFRESH_INTERVAL_BASE);
-        return;
+/* Copy the server dirty map to the clients' dirty maps */
+static void vnc_refresh_mark_clients(VncDisplay *vd)
+{
+    int height = vnc_refresh_height(vd);
+    VncState *vs;
+    int y;
+
+    for (y = 0; y < height; y++) {
+        if (bitmap_empty(vd->server_dirty[y], VNC_DIRTY_BITS)) {
+            continue;
+        }
+        QTAILQ_FOREACH(vs, &vd->clients, next) {
+            bitmap_or(vs->dirty[y], vs->dirty[y], vd->server_dirty[y],
+                      VNC_DIRTY_BITS);
+        }
+        bitmap_zero(vd->server_dirty[y], VNC_DIRTY_BITS);
     }
+}
 
-    has_dirty = vnc_refresh_server_surface(vd);
+/*
+ * Write access to the server surface from the main loop.  Like a refresh,
+ * keep new encoders out, and wait for the running ones.  No refresh may be
+ * running, see vnc_refresh_join().
+ */
+static void vnc_own_server_surface(VncDisplay *vd)
+{
+    vnc_lock_display(vd);
+    vd->refreshing = true;
+    while (vd->encoders) {
+        qemu_cond_wait(&vd->refresh_cond, &vd->mutex);
+    }
+    vnc_unlock_display(vd);
+}
+
+static void vnc_release_server_surface(VncDisplay *vd)
+{
+    vnc_lock_display(vd);
+    vd->refreshing = false;
     vnc_unlock_display(vd);
+    vnc_jobs_kick();
+}
+
+/* Synchronous refresh, for callers that need the server surface now */
+static int vnc_refresh_server_surface(VncDisplay *vd)
+{
+    int height;
+
+    vnc_refresh_join(vd);
+
+    vnc_own_server_surface(vd);
+    height = vnc_refresh_height(vd);
+    vnc_refresh_snapshot(vd, height);
+    vd->refresh_has_dirty += vnc_refresh_server_rows(vd, 0, height);
+    vnc_release_server_surface(vd);
+
+    vnc_refresh_mark_clients(vd);
+    return vd->refresh_has_dirty;
+}
+
+void vnc_refresh_done(VncDisplay *vd, int has_dirty)
+{
+    vnc_lock_display(vd);
+    vd->refresh_has_dirty += has_dirty;
+    if (--vd->refresh_pending == 0) {
+        qemu_cond_broadcast(&vd->refresh_cond);
+        qemu_bh_schedule(vd->refresh_bh);
+    }
+    vnc_unlock_display(vd);
+}
+
+/*
+ * Wait for the workers to finish the refresh, and complete it here instead
+ * of in vnc_refresh_bh().  Afterwards encoders can run again.
+ */
+void vnc_refresh_join(VncDisplay *vd)
+{
+    VncState *vs;
+    bool refreshing;
+
+    vnc_lock_display(vd);
+    while (vd->refresh_pending) {
+        qemu_cond_wait(&vd->refresh_cond, &vd->mutex);
+    }
+    refreshing = vd->refreshing;
+    vd->refreshing = false;
+    vd->refresh_wanted = false;
+    vnc_unlock_display(vd);
+
+    if (refreshing) {
+        qemu_bh_cancel(vd->refresh_bh);
+        vnc_refresh_mark_clients(vd);
+        QTAILQ_FOREACH(vs, &vd->clients, next) {
+            vs->has_dirty += vd->refresh_has_dirty;
+        }
+    }
+    vnc_jobs_kick();
+}
+
+static void vnc_refresh_bh(void *opaque)
+{
+    VncDisplay *vd = opaque;
+    VncState *vs, *vn;
+    int has_dirty, rects = 0;
+
+    vnc_lock_display(vd);
+    vd->refreshing = false;
+    has_dirty = vd->refresh_has_dirty;
+    vnc_unlock_display(vd);
+    vnc_jobs_kick();
+
+    vnc_refresh_mark_clients(vd);
 
     QTAILQ_FOREACH_SAFE(vs, &vd->clients, next, vn) {
         rects += vnc_update_client(vs, has_dirty, false);
@@ -2999,6 +3472,43 @@ static void vnc_refresh(DisplayChangeListener *dcl)
     }
 }
 
+static void vnc_refresh(DisplayChangeListener *dcl)
+{
+    VncDisplay *vd = container_of(dcl, VncDisplay, dcl);
+    int height;
+
+    if (QTAILQ_EMPTY(&vd->clients)) {
+        update_displaychangelistener(&vd->dcl, VNC_REFRESH_INTERVAL_MAX);
+        return;
+    }
+
+    graphic_hw_update(vd->dcl.con);
+
+    /*
+     * The workers copy the guest surface to the server surface, which must
+     * not be done while they encode from it.  If encoders are running, keep
+     * new ones from starting and try again soon.
+     */
+    vnc_lock_display(vd);
+    if (vd->refreshing || vd->encoders) {
+        if (!vd->refreshing) {
+            vd->refresh_wanted = true;
+        }
+        vnc_unlock_display(vd);
+        update_displaychangelistener(&vd->dcl, VNC_REFRESH_INTERVAL_BASE);
+        return;
+    }
+    vd->refreshing = true;
+    vd->refresh_wanted = false;
+    vnc_unlock_display(vd);
+
+    height = vnc_refresh_height(vd);
+    vnc_refresh_snapshot(vd, height);
+    if (!vnc_jobs_refresh(vd, height)) {
+        qemu_bh_schedule(vd->refresh_bh);
+    }
+}
+
 static void vnc_connect(VncDisplay *vd, int csock,
                         bool skipauth, bool websocket)
 {
@@ -3007,6 +3517,7 @@ static void vnc_connect(VncDisplay *vd, int csock,
 
     vs->csock = csock;
     vs->vd = vd;
+    QSIMPLEQ_INIT(&vs->output_chunks);
 
     if (skipauth) {
 	vs->auth = VNC_AUTH_NONE;
@@ -3168,6 +3679,8 @@ void vnc_display_init(const char *id)
         exit(1);
 
     qemu_mutex_init(&vs->mutex);
+    qemu_cond_init(&vs->refresh_cond);
+    vs->refresh_bh = qemu_bh_new(vnc_refresh_bh, vs);
     vnc_start_worker_thread();
 
     vs->dcl.ops = &dcl_ops;
@@ -3300,6 +3813,9 @@ static QemuOptsList qemu_vnc_opts = {
         },{
             .name = "non-adaptive",
             .type = QEMU_OPT_BOOL,
+        },{
+            .name = "workers",
+            .type = QEMU_OPT_NUMBER,
         },
         { /* end of list */ }
     },
@@ -3453,6 +3969,7 @@ void vnc_display_open(const char *id, Error **errp)
     const char *path;
 #endif
     bool sasl = false;
+    int64_t workers;
 #ifdef CONFIG_VNC_SASL
     int saslErr;
 #endif
@@ -3583,6 +4100,14 @@ void vnc_display_open(const char *id, Error **errp)
     }
     vs->connections_limit = qemu_opt_get_number(opts, "connections", 32);
 
+    workers = qemu_opt_get_number(opts, "workers", 1);
+    if (workers < 1 || workers > VNC_WORKERS_MAX) {
+        error_setg(errp, "vnc workers= must be between 1 and %d",
+                   VNC_WORKERS_MAX);
+        goto fail;
+    }
+    vnc_jobs_set_workers(workers);
+
     websocket = qemu_opt_get(opts, "websocket");
     if (websocket) {
         vs->ws_enabled = true;
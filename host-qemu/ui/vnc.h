@@ -62,6 +62,13 @@ typedef struct Buffer
     uint8_t *buffer;
 } Buffer;
 
+/* Output handed over whole to the socket, see vnc_write_buffer() */
+typedef struct VncOutputChunk {
+    Buffer buffer;
+    size_t sent;
+    QSIMPLEQ_ENTRY(VncOutputChunk) next;
+} VncOutputChunk;
+
 typedef struct VncState VncState;
 typedef struct VncJob VncJob;
 typedef struct VncRect VncRect;
@@ -181,6 +188,25 @@ struct VncDisplay
     bool ws_tls; /* Used by websockets */
     bool lossy;
     bool non_adaptive;
+
+    /* The guest surface is diffed into the server surface by refresh jobs
+     * on the VNC workers.  While they run the server surface belongs to
+     * them; otherwise any number of workers may encode from it.  These
+     * fields are protected by mutex.
+     */
+    int encoders;           /* encoding jobs reading the server surface */
+    bool refreshing;        /* refresh jobs own the server surface */
+    bool refresh_wanted;    /* keep new encoders out until it starts */
+    int refresh_pending;    /* refresh jobs that did not finish yet */
+    int refresh_has_dirty;
+    QemuCond refresh_cond;  /* refresh_pending or encoders reached 0 */
+    QEMUBH *refresh_bh;
+    struct timeval refresh_tv;
+    /* guest dirty map taken by the running refresh, and the tiles that
+     * it found changed
+     */
+    DECLARE_BITMAP(refresh_dirty[VNC_MAX_HEIGHT], VNC_DIRTY_BITS);
+    DECLARE_BITMAP(server_dirty[VNC_MAX_HEIGHT], VNC_DIRTY_BITS);
 #ifdef CONFIG_VNC_TLS
     VncDisplayTLS tls;
 #endif
@@ -200,6 +226,8 @@ typedef struct VncTight {
     Buffer gradient;
 #ifdef CONFIG_VNC_JPEG
     Buffer jpeg;
+    /* Compressor kept from one rectangle to the next */
+    struct VncTightJpeg *jpeg_ctx;
 #endif
 #ifdef CONFIG_VNC_PNG
     Buffer png;
@@ -250,6 +278,22 @@ struct VncRectEntry
 struct VncJob
 {
     VncState *vs;
+    /* Nonzero for the horizontal bands of one framebuffer update, which
+     * may be encoded in parallel.
+     */
+    unsigned int group;
+    bool running;
+
+    /* Fenced updates are followed by a fence request carrying fence_id */
+    bool fence;
+    uint32_t fence_id;
+
+    /* Refresh jobs have no client and diff rows [y, y + h) of the guest
+     * surface of this display instead.
+     */
+    VncDisplay *refresh;
+    int y;
+    int h;
 
     QLIST_HEAD(, VncRectEntry) rectangles;
     QTAILQ_ENTRY(VncJob) next;
@@ -276,6 +320,15 @@ struct VncState
     int client_height;
     VncShareMode share_mode;
 
+    /* Continuous updates region, and the fences of the updates in flight */
+    bool continuous_updates;
+    int cu_x;
+    int cu_y;
+    int cu_w;
+    int cu_h;
+    uint32_t fence_sent;
+    uint32_t fence_acked;
+
     uint32_t vnc_encoding;
 
     int major;
@@ -296,6 +349,9 @@ struct VncState
     VncClientInfo *info;
 
     Buffer output;
+    /* Sent before output; only used for plain sockets */
+    QSIMPLEQ_HEAD(, VncOutputChunk) output_chunks;
+    size_t output_chunks_bytes;
     Buffer input;
     Buffer ws_input;
     Buffer ws_output;
@@ -321,6 +377,10 @@ struct VncState
     QemuMutex output_mutex;
     QEMUBH *bh;
     Buffer jobs_buffer;
+    /* Encoding jobs on the workers, protected by the jobs queue lock */
+    int jobs_running;
+    unsigned int jobs_group;
+    unsigned int jobs_scan;
 
     /* Encoding specific, if you add something here, don't forget to
      *  update vnc_async_encoding_start()
@@ -398,6 +458,8 @@ enum {
 #define VNC_ENCODING_AUDIO                0XFFFFFEFD /* -259 */
 #define VNC_ENCODING_TIGHT_PNG            0xFFFFFEFC /* -260 */
 #define VNC_ENCODING_LED_STATE            0XFFFFFEFB /* -261 */
+#define VNC_ENCODING_FENCE                0xFFFFFEC8 /* -312 */
+#define VNC_ENCODING_CONTINUOUS_UPDATES   0xFFFFFEC7 /* -313 */
 #define VNC_ENCODING_WMVi                 0x574D5669
 
 /*****************************************************************************
@@ -437,6 +499,8 @@ enum {
 #define VNC_FEATURE_ZRLE                     9
 #define VNC_FEATURE_ZYWRLE                  10
 #define VNC_FEATURE_LED_STATE               11
+#define VNC_FEATURE_FENCE                   12
+#define VNC_FEATURE_CONTINUOUS_UPDATES      13
 
 #define VNC_FEATURE_RESIZE_MASK              (1 << VNC_FEATURE_RESIZE)
 #define VNC_FEATURE_HEXTILE_MASK             (1 << VNC_FEATURE_HEXTILE)
@@ -450,6 +514,8 @@ enum {
 #define VNC_FEATURE_ZRLE_MASK                (1 << VNC_FEATURE_ZRLE)
 #define VNC_FEATURE_ZYWRLE_MASK              (1 << VNC_FEATURE_ZYWRLE)
 #define VNC_FEATURE_LED_STATE_MASK           (1 << VNC_FEATURE_LED_STATE)
+#define VNC_FEATURE_FENCE_MASK               (1 << VNC_FEATURE_FENCE)
+#define VNC_FEATURE_CONTINUOUS_UPDATES_MASK  (1 << VNC_FEATURE_CONTINUOUS_UPDATES)
 
 
 /* Client -> Server message IDs */
@@ -460,6 +526,8 @@ enum {
 #define VNC_MSG_CLIENT_POINTER_EVENT              5
 #define VNC_MSG_CLIENT_CUT_TEXT                   6
 #define VNC_MSG_CLIENT_VMWARE_0                   127
+#define VNC_MSG_CLIENT_ENABLE_CONTINUOUS_UPDATES  150
+#define VNC_MSG_CLIENT_FENCE                      248
 #define VNC_MSG_CLIENT_CALL_CONTROL               249
 #define VNC_MSG_CLIENT_XVP                        250
 #define VNC_MSG_CLIENT_SET_DESKTOP_SIZE           251
@@ -474,6 +542,8 @@ enum {
 #define VNC_MSG_SERVER_BELL                       2
 #define VNC_MSG_SERVER_CUT_TEXT                   3
 #define VNC_MSG_SERVER_VMWARE_0                   127
+#define VNC_MSG_SERVER_END_CONTINUOUS_UPDATES     150
+#define VNC_MSG_SERVER_FENCE                      248
 #define VNC_MSG_SERVER_CALL_CONTROL               249
 #define VNC_MSG_SERVER_XVP                        250
 #define VNC_MSG_SERVER_TIGHT                      252
@@ -483,6 +553,15 @@ enum {
 
 
 
+/* Fence message flags */
+#define VNC_FENCE_BLOCK_BEFORE                    (1U << 0)
+#define VNC_FENCE_BLOCK_AFTER                     (1U << 1)
+#define VNC_FENCE_SYNC_NEXT                       (1U << 2)
+#define VNC_FENCE_REQUEST                         (1U << 31)
+#define VNC_FENCE_SUPPORTED                       (VNC_FENCE_BLOCK_BEFORE | \
+                                                   VNC_FENCE_BLOCK_AFTER)
+#define VNC_FENCE_PAYLOAD_MAX                     64
+
 /* QEMU client -> server message IDs */
 #define VNC_MSG_CLIENT_QEMU_EXT_KEY_EVENT         0
 #define VNC_MSG_CLIENT_QEMU_AUDIO                 1
@@ -522,7 +601,11 @@ void vnc_write_u32(VncState *vs, uint32_t value);
 void vnc_write_s32(VncState *vs, int32_t value);
 void vnc_write_u16(VncState *vs, uint16_t value);
 void vnc_write_u8(VncState *vs, uint8_t value);
+void vnc_write_buffer(VncState *vs, Buffer *buffer);
+void vnc_write_fence(VncState *vs, uint32_t flags, uint8_t len,
+                     const uint8_t *data);
 void vnc_flush(VncState *vs);
+size_t vnc_output_pending(VncState *vs);
 void vnc_read_when(VncState *vs, VncReadEvent *func, size_t expecting);
 void vnc_disconnect_finish(VncState *vs);
 void vnc_init_state(VncState *vs);
@@ -572,6 +655,11 @@ void vnc_convert_pixel(VncState *vs, uint8_t *buf, uint32_t v);
 double vnc_update_freq(VncState *vs, int x, int y, int w, int h);
 void vnc_sent_lossy_rect(VncState *vs, int x, int y, int w, int h);
 
+/* Server surface refresh */
+int vnc_refresh_server_rows(VncDisplay *vd, int y, int h);
+void vnc_refresh_done(VncDisplay *vd, int has_dirty);
+void vnc_refresh_join(VncDisplay *vd);
+
 /* Encodings */
 int vnc_send_framebuffer_update(VncState *vs, int x, int y, int w, int h);
 
@@ -26,6 +26,9 @@
 #include <math.h>
 #include <limits.h>
 #include <errno.h>
+#ifdef CONFIG_AVX2_OPT
+#include <cpuid.h>
+#endif
 
 #include "qemu/sockets.h"
 #include "qemu/iov.h"
@@ -221,6 +224,29 @@ size_t buffer_find_nonzero_offset(const void *buf, size_t len)
     return i * sizeof(VECTYPE);
 }
 
+#ifdef CONFIG_AVX2_OPT
+bool host_avx2_usable(void)
+{
+    unsigned int a, b, c, d;
+    uint32_t xcr0_lo, xcr0_hi;
+
+    if (__get_cpuid_max(0, NULL) < 7) {
+        return false;
+    }
+    __cpuid(1, a, b, c, d);
+    if (!(c & bit_OSXSAVE) || !(c & bit_AVX)) {
+        return false;
+    }
+    /* The OS must save the YMM registers */
+    asm("xgetbv" : "=a" (xcr0_lo), "=d" (xcr0_hi) : "c" (0));
+    if ((xcr0_lo & 6) != 6) {
+        return false;
+    }
+    __cpuid_count(7, 0, a, b, c, d);
+    return b & bit_AVX2;
+}
+#endif
+
 /*
  * Checks if a buffer is all zeroes
  *
@@ -57,6 +57,39 @@ size_t iov_to_buf(const struct iovec *iov, const unsigned int iov_cnt,
     return done;
 }
 
+size_t iov_to_buf_2d(const struct iovec *iov, const unsigned int iov_cnt,
+                     size_t offset, size_t iov_stride,
+                     void *buf, size_t buf_stride,
+                     size_t row_bytes, unsigned int rows)
+{
+    size_t done = 0, base = 0;
+    unsigned int i = 0, row;
+
+    assert(rows <= 1 || iov_stride >= row_bytes);
+    for (row = 0; row < rows; row++) {
+        size_t pos = offset + row * iov_stride;
+        size_t len = 0, n;
+
+        while (len < row_bytes) {
+            /* rows only move forward, so never look back in the iovec */
+            while (i < iov_cnt && pos >= base + iov[i].iov_len) {
+                base += iov[i].iov_len;
+                i++;
+            }
+            if (i == iov_cnt) {
+                return done;
+            }
+            n = MIN(base + iov[i].iov_len - pos, row_bytes - len);
+            memcpy(buf + row * buf_stride + len, iov[i].iov_base + pos - base,
+                   n);
+            pos += n;
+            len += n;
+            done += n;
+        }
+    }
+    return done;
+}
+
 size_t iov_memset(const struct iovec *iov, const unsigned int iov_cnt,
                   size_t offset, int fillc, size_t bytes)
 {
@@ -124,6 +124,7 @@ int main(int argc, char **argv)
 #include "crypto/init.h"
 #include "android/opengles.h"
 #include "android/hw-pipe-net.h"
+#include "android/gles-display.h"
 
 #define MAX_VIRTIO_CONSOLES 1
 #define MAX_SCLP_CONSOLES 1
@@ -2960,6 +2961,7 @@ int main(int argc, char **argv, char **envp)
     const char *qtest_chrdev = NULL;
     const char *qtest_log = NULL;
     const char *pid_file = NULL;
+    const char *gles_display = NULL;
     const char *incoming = NULL;
 #ifdef CONFIG_VNC
     int show_vnc_port = 0;
@@ -3616,6 +3618,9 @@ int main(int argc, char **argv, char **envp)
             case QEMU_OPTION_pidfile:
                 pid_file = optarg;
                 break;
+            case QEMU_OPTION_gles_display:
+                gles_display = optarg;
+                break;
             case QEMU_OPTION_win2k_hack:
                 win2k_install_hack = 1;
                 break;
@@ -3856,6 +3861,9 @@ int main(int argc, char **argv, char **envp)
                     tcg_tb_size = 0;
                 }
                 break;
+            case QEMU_OPTION_tb_cache:
+                tcg_tb_cache = optarg;
+                break;
             case QEMU_OPTION_icount:
                 icount_opts = qemu_opts_parse_noisily(qemu_find_opts("icount"),
                                                       optarg, true);
@@ -4513,6 +4521,10 @@ int main(int argc, char **argv, char **envp)
     {
        android_net_pipes_init();
        android_init_opengles_pipes();
+       /* before the machine's displays, so that it is the first console */
+       if (gles_display) {
+           android_gles_display_init(gles_display);
+       }
         // if (android_initOpenglesEmulation() == 0 &&
         //     android_startOpenglesRenderer(graphic_width, graphic_height) == 0)
         // {